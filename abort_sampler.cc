@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "abort_sampler.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+atomic<uint64_t> abort_sampler::g_one_in(0);
+percore<uint64_t> abort_sampler::g_ntxns;
+percore<abort_sampler::sketch> abort_sampler::g_sketches;
+
+static event_counter evt_sampled_aborts("sampled_aborts");
+
+// only touched when tables come and go, and on sampled aborts
+static mutex g_tables_mutex;
+static map<const void *, string> g_tables;
+
+void
+abort_sampler::RegisterTable(const void *btr, const string &name)
+{
+  std::lock_guard<mutex> l(g_tables_mutex);
+  g_tables[btr] = name;
+}
+
+void
+abort_sampler::UnregisterTable(const void *btr)
+{
+  std::lock_guard<mutex> l(g_tables_mutex);
+  g_tables.erase(btr);
+}
+
+string
+abort_sampler::TableName(const void *btr)
+{
+  std::lock_guard<mutex> l(g_tables_mutex);
+  auto it = g_tables.find(btr);
+  return it == g_tables.end() ? "<unknown>" : it->second;
+}
+
+void
+abort_sampler::Record(const void *btr, const string &key)
+{
+  ++evt_sampled_aborts;
+  const string table = TableName(btr);
+  sketch &s = g_sketches.my();
+  ::lock_guard<spinlock> l(s.lock_);
+  auto min_it = s.entries_.end();
+  for (auto it = s.entries_.begin(); it != s.entries_.end(); ++it) {
+    if (it->key_ == key && it->table_ == table) {
+      it->count_++;
+      return;
+    }
+    if (min_it == s.entries_.end() || it->count_ < min_it->count_)
+      min_it = it;
+  }
+  if (s.entries_.size() < K) {
+    s.entries_.push_back(entry{table, key, 1, 0});
+    return;
+  }
+  // evict the least frequent key
+  min_it->table_ = table;
+  min_it->key_ = key;
+  min_it->error_ = min_it->count_;
+  min_it->count_++;
+}
+
+vector<abort_sampler::entry>
+abort_sampler::TopK(size_t k)
+{
+  map<pair<string, string>, entry> merged;
+  for (size_t i = 0; i < g_sketches.size(); i++) {
+    sketch &s = g_sketches[i];
+    ::lock_guard<spinlock> l(s.lock_);
+    for (auto &e : s.entries_) {
+      auto p = merged.emplace(make_pair(e.table_, e.key_), e);
+      if (!p.second) {
+        p.first->second.count_ += e.count_;
+        p.first->second.error_ += e.error_;
+      }
+    }
+  }
+  vector<entry> ret;
+  for (auto &p : merged)
+    ret.emplace_back(move(p.second));
+  sort(ret.begin(), ret.end(), [](const entry &a, const entry &b) {
+    return a.count_ > b.count_;
+  });
+  if (ret.size() > k)
+    ret.resize(k);
+  return ret;
+}
+
+string
+abort_sampler::TopKString(size_t k)
+{
+  ostringstream buf;
+  for (auto &e : TopK(k))
+    buf << e.table_ << "\t" << hexify(e.key_) << "\t"
+        << e.count_ << "\t" << e.error_ << endl;
+  return buf.str();
+}
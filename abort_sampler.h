@@ -0,0 +1,85 @@
+#ifndef _NDB_ABORT_SAMPLER_H_
+#define _NDB_ABORT_SAMPLER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "core.h"
+#include "spinlock.h"
+
+/**
+ * Samples the keys which abort txns, for diagnosis.
+ *
+ * When enabled, 1-in-N txns (per core) remember the table and key behind
+ * each record and btree node they touch. If such a txn aborts on a record
+ * or node, its table and key are offered to a per-core top-K sketch (the
+ * space-saving algorithm: a key which is not tracked evicts the one with the
+ * smallest count, and inherits that count as its error). TopK() merges the
+ * sketches, and stats_server serves it.
+ *
+ * Txns which are not sampled only pay for a branch per read.
+ */
+class abort_sampler {
+public:
+
+  static const size_t K = 32; // keys tracked per core
+
+  struct entry {
+    std::string table_;
+    std::string key_;
+    uint64_t count_;
+    uint64_t error_; // count_ overestimates by at most this much
+  };
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_one_in.load(std::memory_order_relaxed);
+  }
+
+  // 0 disables sampling. should be called before any txns run
+  static inline void
+  Enable(uint64_t one_in)
+  {
+    g_one_in.store(one_in, std::memory_order_release);
+  }
+
+  // should the calling core's next txn be sampled?
+  static inline bool
+  ShouldSample()
+  {
+    const uint64_t one_in = g_one_in.load(std::memory_order_relaxed);
+    if (likely(!one_in))
+      return false;
+    uint64_t &n = g_ntxns.my();
+    return (n++ % one_in) == 0;
+  }
+
+  // tables are named by their underlying btree
+  static void RegisterTable(const void *btr, const std::string &name);
+  static void UnregisterTable(const void *btr);
+  static std::string TableName(const void *btr);
+
+  static void Record(const void *btr, const std::string &key);
+
+  // the (at most) k most frequent keys over all cores, most frequent first
+  static std::vector<entry> TopK(size_t k = K);
+
+  // table \t hex(key) \t count \t error, one entry per line
+  static std::string TopKString(size_t k = K);
+
+private:
+
+  struct sketch {
+    spinlock lock_;
+    std::vector<entry> entries_;
+  };
+
+  static std::atomic<uint64_t> g_one_in;
+  static percore<uint64_t> g_ntxns;
+  static percore<sketch> g_sketches;
+};
+
+#endif /* _NDB_ABORT_SAMPLER_H_ */
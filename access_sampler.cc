@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+#include "abort_sampler.h"
+#include "access_sampler.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+atomic<uint64_t> access_sampler::g_one_in(0);
+percore<uint64_t> access_sampler::g_ntxns;
+percore<access_sampler::ring> access_sampler::g_rings;
+
+static event_counter evt_sampled_accesses("sampled_accesses");
+
+uint64_t
+access_sampler::KeyPrefix(const string &key)
+{
+  uint64_t p = 0;
+  for (size_t i = 0; i < 8; i++)
+    p = (p << 8) | (i < key.size() ? uint8_t(key[i]) : 0);
+  return p;
+}
+
+void
+access_sampler::Record(const void *btr, const string &key,
+                       access_kind kind, uint64_t now_us)
+{
+  ++evt_sampled_accesses;
+  const access a{btr, KeyPrefix(key), now_us, kind};
+  ring &r = g_rings.my();
+  ::lock_guard<spinlock> l(r.lock_);
+  if (r.accesses_.size() < RingSize) {
+    r.accesses_.push_back(a);
+    return;
+  }
+  r.accesses_[r.next_] = a;
+  r.next_ = (r.next_ + 1) % RingSize;
+}
+
+vector<access_sampler::table_heatmap>
+access_sampler::Heatmap(uint64_t window_us, size_t nbuckets)
+{
+  INVARIANT(nbuckets);
+  const uint64_t now = timer::cur_usec();
+  const uint64_t since = window_us && window_us < now ? now - window_us : 0;
+  map<const void *, vector<access>> by_table;
+  for (size_t i = 0; i < g_rings.size(); i++) {
+    ring &r = g_rings[i];
+    ::lock_guard<spinlock> l(r.lock_);
+    for (auto &a : r.accesses_)
+      if (a.time_us_ >= since)
+        by_table[a.btr_].push_back(a);
+  }
+
+  vector<table_heatmap> ret;
+  for (auto &p : by_table) {
+    uint64_t lo = p.second[0].prefix_, hi = lo;
+    for (auto &a : p.second) {
+      lo = min(lo, a.prefix_);
+      hi = max(hi, a.prefix_);
+    }
+    // (hi - lo) / nbuckets + 1 cannot overflow, unlike (hi - lo + 1)
+    const uint64_t width = (hi - lo) / nbuckets + 1;
+    vector<bucket> buckets((hi - lo) / width + 1);
+    for (size_t i = 0; i < buckets.size(); i++) {
+      buckets[i].lo_ = lo + i * width;
+      buckets[i].hi_ = min(hi, buckets[i].lo_ + (width - 1));
+      buckets[i].nreads_ = buckets[i].nwrites_ = buckets[i].nconflicts_ = 0;
+    }
+    table_heatmap h;
+    h.table_ = abort_sampler::TableName(p.first);
+    h.nreads_ = h.nwrites_ = h.nconflicts_ = 0;
+    for (auto &a : p.second) {
+      bucket &b = buckets[(a.prefix_ - lo) / width];
+      switch (a.kind_) {
+      case ACCESS_READ:
+        b.nreads_++;
+        h.nreads_++;
+        break;
+      case ACCESS_WRITE:
+        b.nwrites_++;
+        h.nwrites_++;
+        break;
+      case ACCESS_CONFLICT:
+        b.nconflicts_++;
+        h.nconflicts_++;
+        break;
+      }
+    }
+    for (auto &b : buckets)
+      if (b.nreads_ || b.nwrites_ || b.nconflicts_)
+        h.buckets_.push_back(b);
+    ret.emplace_back(move(h));
+  }
+  sort(ret.begin(), ret.end(), [](const table_heatmap &a, const table_heatmap &b) {
+    return a.nreads_ + a.nwrites_ > b.nreads_ + b.nwrites_;
+  });
+  return ret;
+}
+
+string
+access_sampler::HeatmapString(uint64_t window_us, size_t nbuckets)
+{
+  ostringstream buf;
+  for (auto &h : Heatmap(window_us, nbuckets)) {
+    buf << h.table_ << "\t" << h.nreads_ << "\t" << h.nwrites_ << "\t"
+        << h.nconflicts_ << endl;
+    for (auto &b : h.buckets_)
+      buf << "\t" << hexify(b.lo_) << "\t" << hexify(b.hi_) << "\t"
+          << b.nreads_ << "\t" << b.nwrites_ << "\t" << b.nconflicts_ << endl;
+  }
+  return buf.str();
+}
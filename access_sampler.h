@@ -0,0 +1,114 @@
+#ifndef _NDB_ACCESS_SAMPLER_H_
+#define _NDB_ACCESS_SAMPLER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "core.h"
+#include "spinlock.h"
+
+/**
+ * Samples where in each table's key space txns read, write and conflict, for
+ * partitioning and tiering decisions.
+ *
+ * When enabled, 1-in-N txns (per core) remember the keys they touch, as
+ * abort_sampler's sampled txns do. When such a txn ends, each key it read or
+ * wrote (and the key it aborted on, if any) goes into a per-core ring of the
+ * most recent accesses, kept by the key's first 8 bytes. Heatmap() merges the
+ * rings, and cuts the keys each table saw within a time window into
+ * equal-width ranges, each with its read, write and conflict counts.
+ * stats_server serves it.
+ *
+ * Tables are named as registered with abort_sampler.
+ */
+class access_sampler {
+public:
+
+  static const size_t RingSize = 1 << 14; // accesses kept per core
+  static const size_t NBuckets = 32;
+
+  enum access_kind : uint8_t {
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_CONFLICT,
+  };
+
+  struct bucket {
+    uint64_t lo_, hi_; // range of key prefixes, inclusive
+    uint64_t nreads_;
+    uint64_t nwrites_;
+    uint64_t nconflicts_;
+  };
+
+  struct table_heatmap {
+    std::string table_;
+    uint64_t nreads_;
+    uint64_t nwrites_;
+    uint64_t nconflicts_;
+    std::vector<bucket> buckets_; // in key order, empty ones left out
+  };
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_one_in.load(std::memory_order_relaxed);
+  }
+
+  // 0 disables sampling. should be called before any txns run
+  static inline void
+  Enable(uint64_t one_in)
+  {
+    g_one_in.store(one_in, std::memory_order_release);
+  }
+
+  // should the calling core's next txn be sampled?
+  static inline bool
+  ShouldSample()
+  {
+    const uint64_t one_in = g_one_in.load(std::memory_order_relaxed);
+    if (likely(!one_in))
+      return false;
+    uint64_t &n = g_ntxns.my();
+    return (n++ % one_in) == 0;
+  }
+
+  // the (big-endian) first 8 bytes of key, zero padded
+  static uint64_t KeyPrefix(const std::string &key);
+
+  static void Record(const void *btr, const std::string &key,
+                     access_kind kind, uint64_t now_us);
+
+  // the accesses of the last window_us microseconds (all of those kept if
+  // 0), per table, busiest table first
+  static std::vector<table_heatmap>
+  Heatmap(uint64_t window_us, size_t nbuckets = NBuckets);
+
+  // per table, a line of table \t reads \t writes \t conflicts, then one
+  // line of \t hex(lo) \t hex(hi) \t reads \t writes \t conflicts per bucket
+  static std::string
+  HeatmapString(uint64_t window_us, size_t nbuckets = NBuckets);
+
+private:
+
+  struct access {
+    const void *btr_;
+    uint64_t prefix_;
+    uint64_t time_us_;
+    access_kind kind_;
+  };
+
+  struct ring {
+    ring() : next_(0) {}
+    spinlock lock_;
+    std::vector<access> accesses_;
+    size_t next_;
+  };
+
+  static std::atomic<uint64_t> g_one_in;
+  static percore<uint64_t> g_ntxns;
+  static percore<ring> g_rings;
+};
+
+#endif /* _NDB_ACCESS_SAMPLER_H_ */
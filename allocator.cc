@@ -1,8 +1,12 @@
 #include <sys/mman.h>
 #include <unistd.h>
+#include <chrono>
 #include <map>
 #include <iostream>
 #include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <numa.h>
 
 #include "allocator.h"
@@ -15,6 +19,12 @@ using namespace util;
 
 static event_counter evt_allocator_total_region_usage(
     "allocator_total_region_usage_bytes");
+static event_counter evt_allocator_nodeless_homed_arenas(
+    "allocator_nodeless_homed_arenas");
+static event_counter evt_allocator_reclaimed_bytes(
+    "allocator_reclaimed_bytes");
+static event_counter evt_allocator_reused_reclaimed_bytes(
+    "allocator_reused_reclaimed_bytes");
 
 // page+alloc routines taken from masstree
 
@@ -74,6 +84,18 @@ allocator::UseMAdvWillNeed()
   return use_madv;
 }
 
+int
+allocator::CpuNode(size_t cpu)
+{
+  if (numa_available() < 0)
+    return 0;
+  const int node = numa_node_of_cpu(cpu);
+  if (node < 0)
+    return 0;
+  ALWAYS_ASSERT(size_t(node) < MAX_NUMA_NODES);
+  return node;
+}
+
 void
 allocator::Initialize(size_t ncpus, size_t maxpercore)
 {
@@ -121,14 +143,17 @@ allocator::Initialize(size_t ncpus, size_t maxpercore)
   ALWAYS_ASSERT(!(reinterpret_cast<uintptr_t>(g_memstart) % hugepgsize));
   ALWAYS_ASSERT(reinterpret_cast<uintptr_t>(g_memend) <=
       (reinterpret_cast<uintptr_t>(x) + (g_ncpus * g_maxpercore + hugepgsize)));
+  g_pack_groups = new uint8_t[g_ncpus * g_maxpercore / hugepgsize]();
 
   for (size_t i = 0; i < g_ncpus; i++) {
     g_regions[i].region_begin =
       reinterpret_cast<char *>(g_memstart) + (i * g_maxpercore);
     g_regions[i].region_end   =
       reinterpret_cast<char *>(g_memstart) + ((i + 1) * g_maxpercore);
+    g_regions[i].node = CpuNode(i);
     std::cerr << "cpu" << i << " owns [" << g_regions[i].region_begin
-              << ", " << g_regions[i].region_end << ")" << std::endl;
+              << ", " << g_regions[i].region_end << ") on node "
+              << g_regions[i].node << std::endl;
     ALWAYS_ASSERT(g_regions[i].region_begin < g_regions[i].region_end);
     ALWAYS_ASSERT(g_regions[i].region_begin >= x);
     ALWAYS_ASSERT(g_regions[i].region_end <= endpx);
@@ -140,7 +165,8 @@ allocator::Initialize(size_t ncpus, size_t maxpercore)
 void
 allocator::DumpStats()
 {
-  std::cerr << "[allocator] ncpus=" << g_ncpus << std::endl;
+  std::cerr << "[allocator] ncpus=" << g_ncpus
+            << " arena_bytes_in_use=" << ArenaBytesInUse() << std::endl;
   for (size_t i = 0; i < g_ncpus; i++) {
     const bool f = g_regions[i].region_faulted;
     const size_t remaining =
@@ -187,6 +213,28 @@ initialize_page(void *page, const size_t pagesize, const size_t unit)
   return first;
 }
 
+// the number of chunks initialize_page() makes of page
+static size_t
+chunks_per_page(uintptr_t page, const size_t pagesize, const size_t unit)
+{
+#ifdef MEMCHECK_MAGIC
+  const uintptr_t first =
+    util::iceil(page + sizeof(::allocator::pgmetadata), (uintptr_t)unit);
+#else
+  const uintptr_t first = util::iceil(page, (uintptr_t)unit);
+#endif
+  return (page + pagesize - first) / unit;
+}
+
+static void
+numa_hint_memory_placement(void *px, size_t sz, unsigned node)
+{
+  struct bitmask *bm = numa_allocate_nodemask();
+  numa_bitmask_setbit(bm, node);
+  numa_interleave_memory(px, sz, bm);
+  numa_free_nodemask(bm);
+}
+
 void *
 allocator::AllocateArenas(size_t cpu, size_t arena)
 {
@@ -206,10 +254,58 @@ allocator::AllocateArenas(size_t cpu, size_t arena)
     return ret;
   }
 
-  void * const mypx = AllocateUnmanagedWithLock(pc, 1); // releases lock
+  void * const mypx = AllocateArenaHugepageWithLock(pc); // releases lock
+  return initialize_page(mypx, hugepgsize, (arena + 1) * AllocAlignment);
+}
+
+void *
+allocator::AllocatePackedArenas(size_t cpu, size_t arena, unsigned group)
+{
+  INVARIANT(cpu < g_ncpus);
+  INVARIANT(arena < MAX_ARENAS);
+  INVARIANT(group > 0 && group < MAX_PACK_GROUPS);
+  static const size_t hugepgsize = GetHugepageSize();
+
+  regionctx &pc = g_regions[cpu];
+  pc.lock.lock();
+  void * const mypx = AllocateArenaHugepageWithLock(pc); // releases lock
+  g_pack_groups[(reinterpret_cast<char *>(mypx) -
+                 reinterpret_cast<char *>(g_memstart)) / hugepgsize] = group;
   return initialize_page(mypx, hugepgsize, (arena + 1) * AllocAlignment);
 }
 
+void *
+allocator::AllocateArenaHugepageWithLock(regionctx &pc)
+{
+  static const size_t hugepgsize = GetHugepageSize();
+  g_arena_bytes.fetch_add(hugepgsize, std::memory_order_acq_rel);
+  if (unlikely(!pc.reclaimed_hugepgs.empty())) {
+    // faulted back in (zeroed) on first touch
+    void * const px = pc.reclaimed_hugepgs.back();
+    pc.reclaimed_hugepgs.pop_back();
+    pc.lock.unlock();
+    // it may have been a packed one (see rcu::sync::do_release())
+    g_pack_groups[(reinterpret_cast<char *>(px) -
+                   reinterpret_cast<char *>(g_memstart)) / hugepgsize] = 0;
+    evt_allocator_reused_reclaimed_bytes.inc(hugepgsize);
+    return px;
+  }
+  return AllocateUnmanagedWithLock(pc, 1); // releases lock
+}
+
+void *
+allocator::AllocateArenasOnNode(int node, size_t hint, size_t arena)
+{
+  INVARIANT(hint < g_ncpus);
+  for (size_t i = 0; i < g_ncpus; i++) {
+    const size_t cpu = (hint + i) % g_ncpus;
+    if (g_regions[cpu].node == node)
+      return AllocateArenas(cpu, arena);
+  }
+  ++evt_allocator_nodeless_homed_arenas;
+  return AllocateArenas(hint, arena);
+}
+
 void *
 allocator::AllocateUnmanaged(size_t cpu, size_t nhugepgs)
 {
@@ -240,6 +336,7 @@ allocator::AllocateUnmanagedWithLock(regionctx &pc, size_t nhugepgs)
 
   const bool needs_mmap = !pc.region_faulted;
   pc.region_begin = mynewpx;
+  const int node = pc.node;
   pc.lock.unlock();
 
   evt_allocator_total_region_usage.inc(nhugepgs * hugepgsize);
@@ -258,6 +355,9 @@ allocator::AllocateUnmanagedWithLock(regionctx &pc, size_t nhugepgs)
       perror("madvise");
       ALWAYS_ASSERT(false);
     }
+    // the page may be first touched by a core on another node (see
+    // AllocateArenasOnNode())
+    numa_hint_memory_placement(x, hugepgsize, node);
   }
 
   return mypx;
@@ -307,13 +407,80 @@ allocator::ReleaseArenas(void **arenas)
   }
 }
 
-static void
-numa_hint_memory_placement(void *px, size_t sz, unsigned node)
+void
+allocator::SetReclaimHighWaterMark(size_t bytes)
 {
-  struct bitmask *bm = numa_allocate_nodemask();
-  numa_bitmask_setbit(bm, node);
-  numa_interleave_memory(px, sz, bm);
-  numa_free_nodemask(bm);
+  static std::once_flag s_started;
+  g_reclaim_high_water.store(bytes, std::memory_order_release);
+  if (bytes)
+    std::call_once(s_started, [] { std::thread(&ReclaimerLoop).detach(); });
+}
+
+void
+allocator::ReclaimerLoop()
+{
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const size_t high_water =
+      g_reclaim_high_water.load(std::memory_order_acquire);
+    if (!high_water)
+      continue;
+    for (size_t cpu = 0; cpu < g_ncpus; cpu++)
+      for (size_t arena = 0;
+           arena < MAX_ARENAS && ArenaBytesInUse() > high_water;
+           arena++)
+        ReclaimArena(cpu, arena, high_water);
+  }
+}
+
+void
+allocator::ReclaimArena(size_t cpu, size_t arena, size_t high_water)
+{
+  static const size_t hugepgsize = GetHugepageSize();
+  const size_t unit = (arena + 1) * AllocAlignment;
+  regionctx &pc = g_regions[cpu];
+
+  // all under the lock: while the list is off its arena, an allocation
+  // would fault in a fresh hugepage, and the region may have none left
+  lock_guard<spinlock> l(pc.lock);
+  void * const head = pc.arenas[arena];
+  if (!head)
+    return;
+
+  // a hugepage is free when all of its chunks are on the list (each chunk
+  // is on at most one list)
+  std::unordered_map<uintptr_t, size_t> nfree;
+  for (void *p = head; p; p = *reinterpret_cast<void **>(p))
+    nfree[uintptr_t(p) & ~(hugepgsize - 1)]++;
+  std::unordered_set<uintptr_t> victims;
+  for (auto &e : nfree) {
+    if (ArenaBytesInUse() <= high_water + victims.size() * hugepgsize)
+      break;
+    if (e.second == chunks_per_page(e.first, hugepgsize, unit))
+      victims.insert(e.first);
+  }
+  if (victims.empty())
+    return;
+
+  // unlink the victims' chunks
+  void *rest = nullptr;
+  for (void *p = head, *pnext; p; p = pnext) {
+    pnext = *reinterpret_cast<void **>(p);
+    if (victims.count(uintptr_t(p) & ~(hugepgsize - 1)))
+      continue;
+    *reinterpret_cast<void **>(p) = rest;
+    rest = p;
+  }
+  pc.arenas[arena] = rest;
+  for (auto px : victims) {
+    if (madvise((void *) px, hugepgsize, MADV_DONTNEED)) {
+      perror("madvise");
+      ALWAYS_ASSERT(false);
+    }
+    pc.reclaimed_hugepgs.push_back((void *) px);
+  }
+  g_arena_bytes.fetch_sub(victims.size() * hugepgsize, std::memory_order_acq_rel);
+  evt_allocator_reclaimed_bytes.inc(victims.size() * hugepgsize);
 }
 
 void
@@ -373,4 +540,7 @@ void *allocator::g_memstart = nullptr;
 void *allocator::g_memend = nullptr;
 size_t allocator::g_ncpus = 0;
 size_t allocator::g_maxpercore = 0;
+uint8_t *allocator::g_pack_groups = nullptr;
 percore<allocator::regionctx> allocator::g_regions;
+std::atomic<size_t> allocator::g_arena_bytes(0);
+std::atomic<size_t> allocator::g_reclaim_high_water(0);
@@ -1,9 +1,11 @@
 #ifndef _NDB_ALLOCATOR_H_
 #define _NDB_ALLOCATOR_H_
 
+#include <atomic>
 #include <cstdint>
 #include <iterator>
 #include <mutex>
+#include <vector>
 
 #include "util.h"
 #include "core.h"
@@ -35,12 +37,39 @@ public:
   static void *
   AllocateUnmanaged(size_t cpu, size_t nhugepgs);
 
+  // like AllocateArenas(), but from a region on numa node node (the one of
+  // the regions on node picked by cpu hint, or cpu hint's if none is)
+  static void *
+  AllocateArenasOnNode(int node, size_t hint, size_t arena);
+
+  // like AllocateArenas(), but always from a hugepage of its own, tagged
+  // with pack group group (> 0), so the chunks of one group are packed
+  // together on hugepages no other group's chunks are on
+  static void *
+  AllocatePackedArenas(size_t cpu, size_t arena, unsigned group);
+
   static void
   ReleaseArenas(void **arenas);
 
+  // once more than bytes of arena memory is in use, a background thread
+  // returns hugepages whose arenas have all been released back to the OS
+  // (reusing them for later arenas), until it is back under bytes. 0 (the
+  // default) never returns memory. the first non-zero call starts the thread
+  static void
+  SetReclaimHighWaterMark(size_t bytes);
+
+  // bytes of arena hugepages carved out of the regions and not returned
+  static inline size_t
+  ArenaBytesInUse()
+  {
+    return g_arena_bytes.load(std::memory_order_acquire);
+  }
+
   static const size_t LgAllocAlignment = 4; // all allocations aligned to 2^4 = 16
   static const size_t AllocAlignment = 1 << LgAllocAlignment;
   static const size_t MAX_ARENAS = 32;
+  static const size_t MAX_NUMA_NODES = 8;
+  static const size_t MAX_PACK_GROUPS = 8; // group 0 is the shared pool
 
   static inline std::pair<size_t, size_t>
   ArenaSize(size_t sz)
@@ -75,6 +104,29 @@ public:
     return ret;
   }
 
+  // the numa node CPU's region is placed on
+  static int CpuNode(size_t cpu);
+
+  // assumes p is managed by this allocator- returns the numa node of the
+  // region p was allocated from
+  static inline int
+  PointerToNode(const void *p)
+  {
+    return g_regions[PointerToCpu(p)].node;
+  }
+
+  // assumes p is managed by this allocator- returns the pack group of the
+  // hugepage p was allocated from (0 if it is not a packed one)
+  static inline unsigned
+  PointerToPackGroup(const void *p)
+  {
+    static const size_t hugepgsize = GetHugepageSize();
+    INVARIANT(ManagesPointer(p));
+    return g_pack_groups[
+      (reinterpret_cast<const char *>(p) -
+       reinterpret_cast<const char *>(g_memstart)) / hugepgsize];
+  }
+
 #ifdef MEMCHECK_MAGIC
   struct pgmetadata {
     uint32_t unit_; // 0-indexed
@@ -109,6 +161,7 @@ private:
     regionctx()
       : region_begin(nullptr),
         region_end(nullptr),
+        node(0),
         region_faulted(false)
     {
       NDB_MEMSET(arenas, 0, sizeof(arenas));
@@ -120,14 +173,27 @@ private:
     // set by Initialize()
     void *region_begin;
     void *region_end;
+    int node;
 
     bool region_faulted;
 
     spinlock lock;
     std::mutex fault_lock; // XXX: hacky
     void *arenas[MAX_ARENAS];
+    std::vector<void *> reclaimed_hugepgs; // returned to the OS, for reuse
   };
 
+  // pops a hugepage off pc.reclaimed_hugepgs, or carves a new one. releases
+  // the lock
+  static void *
+  AllocateArenaHugepageWithLock(regionctx &pc);
+
+  static void ReclaimerLoop();
+
+  // returns hugepages of arena's released chunks on CPU's region to the OS,
+  // while more than high_water bytes are in use
+  static void ReclaimArena(size_t cpu, size_t arena, size_t high_water);
+
   // assumes caller has the regionctx lock held, and
   // will release the lock.
   static void *
@@ -138,8 +204,17 @@ private:
   static void *g_memend; // g_memstart + ncpus * maxpercore
   static size_t g_ncpus;
   static size_t g_maxpercore;
+  // pack group of each hugepage of [g_memstart, g_memend) (0 if not a packed
+  // one). the freed chunks of packed hugepages stay in their threads' group
+  // caches, and only go back to the regions' free lists when a thread
+  // releases those (on exit or repinning, see rcu::sync::do_release()). from
+  // then on the hugepage may be reclaimed, and is unpacked once reused
+  static uint8_t *g_pack_groups;
 
   static percore<regionctx> g_regions CACHE_ALIGNED;
+
+  static std::atomic<size_t> g_arena_bytes;
+  static std::atomic<size_t> g_reclaim_high_water;
 };
 
 #endif /* _NDB_ALLOCATOR_H_ */
@@ -18,4 +18,32 @@ rdtsc(void)
   return ((uint64_t)lo)|(((uint64_t)hi)<<32);
 }
 
+// cache line write-back for persistent memory. clflushopt and clwb are
+// encoded by hand, since older assemblers do not know them. callers must
+// check cpuid before using either
+
+inline ALWAYS_INLINE void
+clflush(const void *p)
+{
+  __asm volatile("clflush %0" : "+m" (*(volatile char *) p));
+}
+
+inline ALWAYS_INLINE void
+clflushopt(const void *p)
+{
+  __asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *) p));
+}
+
+inline ALWAYS_INLINE void
+clwb(const void *p)
+{
+  __asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*(volatile char *) p));
+}
+
+inline ALWAYS_INLINE void
+sfence()
+{
+  __asm volatile("sfence" : : : "memory");
+}
+
 #endif /* _AMD64_H_ */
@@ -0,0 +1,40 @@
+/**
+ * backup_restore.cc
+ *
+ * stand-alone tool to turn a backup stream (see txn_checkpointer::Export())
+ * into a checkpoint directory, which dbtest --recover-checkpoint-dir loads
+ *
+ */
+
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "txn_checkpoint.h"
+
+using namespace std;
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 2 && argc != 3) {
+    cerr << "[usage] " << argv[0] << " checkpoint-dir [backup-file]" << endl;
+    cerr << "  reads the backup from stdin if no file is given" << endl;
+    return 1;
+  }
+
+  int fd = 0;
+  if (argc == 3 && (fd = open(argv[2], O_RDONLY)) == -1) {
+    perror("open");
+    return 1;
+  }
+  if (!txn_checkpointer::Restore(fd, argv[1])) {
+    cerr << "[ERROR] could not restore the backup" << endl;
+    return 1;
+  }
+  if (fd)
+    close(fd);
+  return 0;
+}
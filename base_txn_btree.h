@@ -3,7 +3,13 @@
 
 #include "btree_choice.h"
 #include "txn.h"
+#include "abort_sampler.h"
+#include "cold_store.h"
+#include "learned_index.h"
 #include "lockguard.h"
+#include "partition_manager.h"
+#include "point_index.h"
+#include "txn_ttl.h"
 #include "util.h"
 #include "ndb_type_traits.h"
 
@@ -11,13 +17,30 @@
 #include <map>
 #include <type_traits>
 #include <memory>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 // each Transaction implementation should specialize this for special
 // behavior- the default implementation is just nops
 template <template <typename> class Transaction>
 struct base_txn_btree_handler {
-  static inline void on_construct() {} // called when initializing
+  // called when initializing/destroying a tree
+  static inline void on_construct(const std::string &name, concurrent_btree *btr) {}
+  // called once a typed_txn_btree is constructed, with its schema's mask of
+  // all fields
+  static inline void on_typed_construct(concurrent_btree *btr, uint64_t all_fields) {}
+  static inline void on_destruct(concurrent_btree *btr) {}
   static const bool has_background_task = false;
+  // the version bulk loaded records are made at
+  static inline transaction_base::tid_t bulk_load_tid() { return dbtuple::MIN_TID; }
+  // whether txn_btree::bulk_load() may load a table now
+  static inline bool can_bulk_load() { return true; }
+  // whether the snapshot at tid (of a read-only txn) has every commit made
+  // by tick, and keeping it readable past the txn until unpinned
+  static inline bool snapshot_covers(transaction_base::tid_t tid, uint64_t tick) { return true; }
+  static inline void pin_snapshot(transaction_base::tid_t tid) {}
+  static inline void unpin_snapshot(transaction_base::tid_t tid) {}
 };
 
 template <template <typename> class Transaction, typename P>
@@ -31,18 +54,42 @@ public:
 
   base_txn_btree(size_type value_size_hint = 128,
             bool mostly_append = false,
-            const std::string &name = "<unknown>")
+            const std::string &name = "<unknown>",
+            bool point_only = false)
     : value_size_hint(value_size_hint),
       name(name),
+      partition(-1),
+      ttl_us(0),
       been_destructed(false)
   {
-    base_txn_btree_handler<Transaction>::on_construct();
+    base_txn_btree_handler<Transaction>::on_construct(name, &underlying_btree);
+    abort_sampler::RegisterTable(&underlying_btree, name);
+    if (point_only) {
+      hash_index.reset(new point_index);
+      point_index::Register(&underlying_btree, hash_index.get());
+    }
+    if (cold_store::IsEnabled())
+      cold_store::RegisterTree(&underlying_btree);
   }
 
   ~base_txn_btree()
   {
     if (!been_destructed)
       unsafe_purge(false);
+    if (hash_index)
+      point_index::Unregister(&underlying_btree);
+    if (learned_idx)
+      learned_index::Unregister(&underlying_btree);
+    // the table may have range deletes, TTL or not
+    txn_ttl::UnregisterTree(&underlying_btree);
+    base_txn_btree_handler<Transaction>::on_destruct(&underlying_btree);
+    abort_sampler::UnregisterTable(&underlying_btree);
+  }
+
+  inline const std::string &
+  get_name() const
+  {
+    return name;
   }
 
   inline size_t
@@ -51,6 +98,124 @@ public:
     return underlying_btree.size();
   }
 
+  /**
+   * Bytes used by the table, for sizing machines by memory. Walks the whole
+   * tree, and like size_estimate() is not consistent given concurrent
+   * modifications
+   */
+  struct memory_stats {
+    memory_stats()
+      : ntuples_(0), tuple_bytes_(0), record_bytes_(0),
+        nold_versions_(0), version_chain_bytes_(0),
+        point_index_buckets_(0) {}
+    concurrent_btree::shape_stats shape_;
+    size_t ntuples_;
+    size_t tuple_bytes_; // of the latest versions, headers included
+    size_t record_bytes_; // the records alone, out of tuple_bytes_
+    size_t nold_versions_;
+    size_t version_chain_bytes_; // of the older versions, headers included
+    size_t point_index_buckets_; // 0 if not point_only
+  };
+
+  memory_stats get_memory_stats() const;
+
+  // point reads which find their key are served by a hash index instead of
+  // the btree (see point_index)
+  inline bool
+  is_point_only() const
+  {
+    return bool(hash_index);
+  }
+
+  // the table's nodes and records are allocated on numa node node from now
+  // on (-1 for the allocating core's own); see scoped_alloc_node
+  inline void
+  set_numa_node(int node)
+  {
+    underlying_btree.set_numa_node(node);
+  }
+
+  // the table's records are packed on hugepages of pack group group (1 to
+  // allocator::MAX_PACK_GROUPS - 1, 0 for the shared pool) from now on, so a
+  // hot table scanned often gets hugepages of its own; see
+  // scoped_alloc_pack_group
+  inline void
+  set_pack_group(unsigned group)
+  {
+    INVARIANT(group < allocator::MAX_PACK_GROUPS);
+    underlying_btree.set_pack_group(group);
+  }
+
+  // how commits write over the table's records (see
+  // transaction_base::write_policy). tables no snapshot reads need not pay
+  // for version chains. should be called before the table is used
+  inline void
+  set_write_policy(transaction_base::write_policy policy)
+  {
+    underlying_btree.set_write_policy(policy);
+  }
+
+  // the tree to take a pinned_snapshot of the table over
+  inline concurrent_btree *
+  get_underlying_btree()
+  {
+    return &underlying_btree;
+  }
+
+  // rows expire ttl_us after the txn which last wrote them committed (see
+  // txn_ttl, which must be initialized). should be called once, before the
+  // table is used
+  inline void
+  set_ttl(uint64_t ttl_us)
+  {
+    INVARIANT(ttl_us && !this->ttl_us);
+    this->ttl_us = ttl_us;
+    txn_ttl::RegisterTree(&underlying_btree, name, ttl_us);
+  }
+
+  // 0 if the table has no TTL
+  inline uint64_t
+  get_ttl() const
+  {
+    return ttl_us;
+  }
+
+  /**
+   * Deletes the records in [lower, upper) (upper null for no bound, the keys
+   * in their stored form) without a txn: the range reads as deleted right
+   * away, only one record is logged for it, and its records are reclaimed
+   * in the background (see txn_ttl, which must be initialized). Returns once
+   * the epoch the delete is made in is over, so it must not be called from
+   * within a txn. A table's secondary indexes (see typed_txn_btree) are left
+   * alone
+   */
+  inline void
+  delete_range(const std::string &lower, const std::string *upper)
+  {
+    txn_ttl::DeleteRange(&underlying_btree, name, lower, upper);
+  }
+
+  // deletes every record, like delete_range()
+  inline void
+  truncate()
+  {
+    delete_range(std::string(), nullptr);
+  }
+
+  // binds the table to partition p (-1 for none); see partition_manager
+  inline void
+  set_partition(int p)
+  {
+    INVARIANT(p < 0 || size_t(p) < partition_manager::NPartitions());
+    partition = p;
+  }
+
+  inline int
+  get_partition() const
+  {
+    return partition;
+  }
+
   inline size_type
   get_value_size_hint() const
   {
@@ -77,6 +242,48 @@ public:
    */
   std::map<std::string, uint64_t> unsafe_purge(bool dump_stats = false);
 
+  /**
+   * Same as do_bulk_load(), for records already in their stored form:
+   * keys[i] => the sizes[i] bytes at values[i]. Recovery uses this to load a
+   * checkpoint image (see txn_checkpointer::table_image) in place. The tuples
+   * are made by nthreads threads, each taking a contiguous range of the
+   * records, before the tree is built
+   */
+  void bulk_load_records(const varkey *keys, const uint8_t *const *values,
+                         const size_t *sizes, size_t n, size_t nthreads = 1);
+
+protected:
+
+  // a table writes the entries of its secondary indexes into their trees
+  template <template <typename> class T, typename S> friend class typed_txn_btree;
+
+  /**
+   * Fills the table, which must be empty and not yet in use, with
+   * keys[i] => values[i] (written with writer) for i in [0, n), the keys
+   * being sorted. No txns are involved: the records are made directly at the
+   * protocol's bulk_load_tid(), and the underlying tree is built bottom up
+   * (see concurrent_btree::bulk_load()). In particular, nothing is logged,
+   * so take a checkpoint if the load must survive a crash (which is why
+   * txn_btree::bulk_load() is refused while the protocol logs)
+   */
+  template <typename Value>
+  void do_bulk_load(const std::string *keys, const Value *values, size_t n,
+                    dbtuple::tuple_writer_t writer);
+
+  // point reads of the keys in the tree when build_learned_index() last
+  // ran are served by a learned index from then on (see learned_index).
+  // before the table is used
+  void
+  enable_learned_index()
+  {
+    INVARIANT(!hash_index && !learned_idx);
+    learned_idx.reset(new learned_index);
+    learned_index::Register(&underlying_btree, learned_idx.get());
+  }
+
+  // no writes to the table may run concurrently. bulk loads build it too
+  void build_learned_index();
+
 private:
 
   struct purge_tree_walker : public concurrent_btree::tree_walk_callback {
@@ -135,38 +342,146 @@ private:
     std::vector< std::pair<typename concurrent_btree::value_type, bool> > spec_values;
   };
 
+  struct memory_tree_walker : public concurrent_btree::tree_walk_callback {
+    memory_tree_walker(memory_stats &s) : s(&s) {}
+    virtual void on_node_begin(const typename concurrent_btree::node_opaque_t *n);
+    virtual void on_node_success();
+    virtual void on_node_failure();
+  private:
+    memory_stats *s;
+    std::vector< std::pair<typename concurrent_btree::value_type, bool> > spec_values;
+  };
+
 protected:
 
+  // value readers may filter the records they read (see
+  // typed_txn_btree::search_range_call_if()): those have a matched(), which
+  // says if the record last read passed, and scan callbacks are only invoked
+  // on the records which do
+  template <typename ValueReader>
+  static inline auto
+  RecordMatched(const ValueReader &r, int) -> decltype(r.matched())
+  {
+    return r.matched();
+  }
+
+  template <typename ValueReader>
+  static inline bool
+  RecordMatched(const ValueReader &r, long)
+  {
+    return true;
+  }
+
   // readers are placed here so they can be shared amongst
   // derived implementations
 
+  // reads none of the record, only whether there is one
+  struct presence_reader {
+    typedef typename P::Value value_type;
+
+    template <typename StringAllocator>
+    inline bool
+    operator()(const uint8_t *data, size_t sz, StringAllocator &sa)
+    {
+      return true;
+    }
+
+    template <typename StringAllocator>
+    inline void
+    dup(const value_type &vdup, StringAllocator &sa)
+    {
+    }
+  };
+
   template <typename Traits, typename Callback,
             typename KeyReader, typename ValueReader>
   struct txn_search_range_callback : public concurrent_btree::low_level_search_range_callback {
-    constexpr txn_search_range_callback(
+    txn_search_range_callback(
           Transaction<Traits> *t,
           Callback *caller_callback,
           KeyReader *key_reader,
-          ValueReader *value_reader)
+          ValueReader *value_reader,
+          const concurrent_btree *btr,
+          const std::string *bound,
+          bool track)
       : t(t), caller_callback(caller_callback),
-        key_reader(key_reader), value_reader(value_reader) {}
+        key_reader(key_reader), value_reader(value_reader),
+        btr(btr), bound(bound), track(track) {}
 
     virtual void on_resp_node(const typename concurrent_btree::node_opaque_t *n, uint64_t version);
     virtual bool invoke(const typename concurrent_btree::string_type &k, typename concurrent_btree::value_type v,
                         const typename concurrent_btree::node_opaque_t *n, uint64_t version);
+    virtual unsigned prefetch_distance() const { return prefetcher.distance(); }
 
   private:
     Transaction<Traits> *const t;
     Callback *const caller_callback;
     KeyReader *const key_reader;
     ValueReader *const value_reader;
+    // nodes are noted (for sampled txns) under the bound the scan starts at
+    const concurrent_btree *const btr;
+    const std::string *const bound;
+    // false if t owns the table's partition
+    const bool track;
+    tuple_prefetcher prefetcher;
+  };
+
+  // reads on behalf of a snapshot txn t, on another thread (see
+  // do_parallel_search_range_call())
+  template <typename Traits, typename Callback,
+            typename KeyReader, typename ValueReader>
+  struct snapshot_search_range_callback : public concurrent_btree::low_level_search_range_callback {
+    snapshot_search_range_callback(
+          const Transaction<Traits> *t,
+          Callback *caller_callback,
+          const KeyReader &key_reader,
+          const ValueReader &value_reader,
+          const concurrent_btree *btr)
+      : t(t), caller_callback(caller_callback),
+        key_reader(key_reader), value_reader(value_reader),
+        btr(btr), failed_tuple(nullptr) {}
+
+    // snapshot reads are not validated, so nodes needn't be remembered
+    virtual void on_resp_node(const typename concurrent_btree::node_opaque_t *n, uint64_t version) {}
+    virtual bool invoke(const typename concurrent_btree::string_type &k, typename concurrent_btree::value_type v,
+                        const typename concurrent_btree::node_opaque_t *n, uint64_t version);
+    virtual unsigned prefetch_distance() const { return prefetcher.distance(); }
+
+    const Transaction<Traits> *const t;
+    Callback *const caller_callback;
+    KeyReader key_reader;
+    ValueReader value_reader;
+    const concurrent_btree *const btr; // for its expiry cutoffs (see txn_ttl)
+    // made on the first read, since most subranges of a small scan are empty
+    std::unique_ptr<typename Traits::StringAllocator> sa;
+    // set if a read failed, which stops the scan
+    const dbtuple *failed_tuple;
+    tuple_prefetcher prefetcher;
   };
 
+  // field_read, if given, is what value_reader reads of a fixed layout
+  // record: the read is then validated by those fields alone
   template <typename Traits, typename ValueReader>
   inline bool
   do_search(Transaction<Traits> &t,
             const typename P::Key &k,
-            ValueReader &value_reader);
+            ValueReader &value_reader,
+            const transaction_base::field_read_t *field_read = nullptr);
+
+  // do_search() of each keys[i], i in [0, n), read by value_readers[i] (and
+  // validated by field_reads[i], if field_reads is given), with found[i] set
+  // to whether it was found. the keys are looked up in key order, in
+  // lockstep (see concurrent_btree::search_batch()), so that their misses
+  // overlap, and the reads are then taken in one pass. keys absent from the
+  // batch are searched again one at a time, for the node versions their
+  // absence is validated against
+  template <typename Traits, typename ValueReader>
+  void do_search_batch(Transaction<Traits> &t,
+                       const typename P::Key *keys,
+                       size_t n,
+                       ValueReader *value_readers,
+                       bool *found,
+                       const transaction_base::field_read_t *field_reads = nullptr);
 
   template <typename Traits, typename Callback,
             typename KeyReader, typename ValueReader>
@@ -188,21 +503,82 @@ protected:
                         KeyReader &key_reader,
                         ValueReader &value_reader);
 
+  // scans [lower, *upper) as callbacks.size() subranges (see
+  // concurrent_btree::split_range()), callbacks[i] getting the i-th one.
+  // snapshot txns scan the subranges at the same time, on the task_pool.
+  // other txns have to track their reads in t, so they scan them in turn
+  template <typename Traits, typename Callback,
+            typename KeyReader, typename ValueReader>
+  void do_parallel_search_range_call(Transaction<Traits> &t,
+                                     const typename P::Key &lower,
+                                     const typename P::Key *upper,
+                                     const std::vector<Callback *> &callbacks,
+                                     KeyReader &key_reader,
+                                     ValueReader &value_reader);
+
   // expect_new indicates if we expect the record to not exist in the tree-
   // is just a hint that affects perf, not correctness. remove is put with nullptr
-  // as value.
+  // as value. returns true if the record was new
   //
   // NOTE: both key and value are expected to be stable values already
   template <typename Traits>
-  void do_tree_put(Transaction<Traits> &t,
-                   const std::string *k,
-                   const typename P::Value *v,
-                   dbtuple::tuple_writer_t writer,
-                   bool expect_new);
+  inline bool
+  do_tree_put(Transaction<Traits> &t,
+              const std::string *k,
+              const typename P::Value *v,
+              dbtuple::tuple_writer_t writer,
+              bool expect_new)
+  {
+    return do_btree_put(t, underlying_btree, hash_index.get(),
+                        k, v, writer, expect_new);
+  }
+
+  // do_tree_put() into any table's btr (and hash index hidx, if any), e.g.
+  // a secondary index of this one (see typed_txn_btree::add_secondary_index())
+  template <typename Traits>
+  static bool do_btree_put(Transaction<Traits> &t,
+                           concurrent_btree &btr,
+                           point_index *hidx,
+                           const std::string *k,
+                           const void *v,
+                           dbtuple::tuple_writer_t writer,
+                           bool expect_new);
+
+  // do_tree_put() of keys[i] => values[i], for i in [0, n), in key order.
+  // the keys are looked up in lockstep (see concurrent_btree::search_batch()),
+  // and the writes to records which exist are appended to the write set
+  // without another descent, while the others are inserted (so there is no
+  // expect_new hint). writes to the same key keep their order. if inserted
+  // is not null, inserted[i] is set to whether keys[i] was new
+  template <typename Traits>
+  void do_tree_put_batch(Transaction<Traits> &t,
+                         const std::string *const *keys,
+                         const typename P::Value *const *values,
+                         size_t n,
+                         dbtuple::tuple_writer_t writer,
+                         bool *inserted = nullptr);
+
+  // adds the delta v to the record at k, as a commutative write (see
+  // write_record_t). returns false (and does nothing, besides remembering the
+  // absence) if there is no record at k.
+  //
+  // v must be owned by the txn, and P::Value must be trivially copyable. if
+  // the txn already wrote the record, the delta is folded into that write,
+  // which must be a commutative write with the same writer, or a put (or
+  // insert) of at least the fields the delta touches
+  template <typename Traits>
+  bool do_tree_increment(Transaction<Traits> &t,
+                         const std::string *k,
+                         typename P::Value *v,
+                         dbtuple::tuple_writer_t writer);
 
   concurrent_btree underlying_btree;
+  std::unique_ptr<point_index> hash_index; // null unless point_only
+  std::unique_ptr<learned_index> learned_idx; // null unless enabled
   size_type value_size_hint;
   std::string name;
+  int partition; // -1 unless set_partition()
+  uint64_t ttl_us; // 0 unless set_ttl()
   bool been_destructed;
 };
 
@@ -217,38 +593,246 @@ bool
 base_txn_btree<Transaction, P>::do_search(
     Transaction<Traits> &t,
     const typename P::Key &k,
-    ValueReader &value_reader)
+    ValueReader &value_reader,
+    const transaction_base::field_read_t *field_read)
 {
   t.ensure_active();
+  if (t.is_snapshot())
+    t.note_snapshot_read(&this->underlying_btree);
 
   typename P::KeyWriter key_writer(&k);
   const std::string * const key_str =
     key_writer.fully_materialize(true, t.string_allocator());
 
+  if (hash_index || learned_idx) {
+    const dbtuple * const tuple = hash_index ?
+      hash_index->lookup(varkey(*key_str)) :
+      learned_idx->lookup(varkey(*key_str));
+    if (tuple) {
+      if (unlikely(t.is_sampling_keys()))
+        t.note_key(tuple, &this->underlying_btree, *key_str);
+      return t.do_tuple_read(tuple, value_reader, !t.owns_partition(partition),
+                             txn_ttl::CutoffFor(&this->underlying_btree,
+                                                key_str->data(),
+                                                key_str->size()),
+                             field_read);
+    }
+  }
+
   // search the underlying btree to map k=>(btree_node|tuple)
   typename concurrent_btree::value_type underlying_v{};
   concurrent_btree::versioned_node_t search_info;
   const bool found = this->underlying_btree.search(varkey(*key_str), underlying_v, &search_info);
   if (found) {
     const dbtuple * const tuple = reinterpret_cast<const dbtuple *>(underlying_v);
-    return t.do_tuple_read(tuple, value_reader);
+    if (unlikely(t.is_sampling_keys()))
+      t.note_key(tuple, &this->underlying_btree, *key_str);
+    return t.do_tuple_read(tuple, value_reader, !t.owns_partition(partition),
+                           txn_ttl::CutoffFor(&this->underlying_btree,
+                                              key_str->data(),
+                                              key_str->size()),
+                           field_read);
   } else {
     // not found, add to absent_set
-    t.do_node_read(search_info.first, search_info.second);
+    if (unlikely(t.is_sampling_keys()))
+      t.note_key(search_info.first, &this->underlying_btree, *key_str);
+    t.do_node_read(search_info.first, search_info.second,
+                   !t.owns_partition(partition));
     return false;
   }
 }
 
+template <template <typename> class Transaction, typename P>
+template <typename Traits, typename ValueReader>
+void
+base_txn_btree<Transaction, P>::do_search_batch(
+    Transaction<Traits> &t,
+    const typename P::Key *keys,
+    size_t n,
+    ValueReader *value_readers,
+    bool *found,
+    const transaction_base::field_read_t *field_reads)
+{
+  t.ensure_active();
+  if (t.is_snapshot())
+    t.note_snapshot_read(&this->underlying_btree);
+
+  std::vector<const std::string *> key_strs(n);
+  std::vector<const dbtuple *> tuples(n, nullptr);
+  std::vector<size_t> order; // the keys to search the btree for
+  order.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    typename P::KeyWriter key_writer(&keys[i]);
+    key_strs[i] = key_writer.fully_materialize(true, t.string_allocator());
+    if (hash_index)
+      tuples[i] = hash_index->lookup(varkey(*key_strs[i]));
+    else if (learned_idx)
+      tuples[i] = learned_idx->lookup(varkey(*key_strs[i]));
+    if (!tuples[i])
+      order.push_back(i);
+  }
+
+  // sorted keys share the upper levels of their paths
+  std::sort(order.begin(), order.end(),
+      [&key_strs](size_t a, size_t b) { return *key_strs[a] < *key_strs[b]; });
+  std::vector<varkey> vks;
+  vks.reserve(order.size());
+  for (auto i : order)
+    vks.emplace_back(*key_strs[i]);
+  std::vector<typename concurrent_btree::value_type> vs(order.size());
+  std::unique_ptr<bool[]> in_btree(new bool[order.size()]);
+  this->underlying_btree.search_batch(
+      vks.data(), order.size(), vs.data(), in_btree.get());
+  for (size_t j = 0; j < order.size(); j++)
+    if (in_btree[j])
+      tuples[order[j]] = reinterpret_cast<const dbtuple *>(vs[j]);
+
+  const bool track = !t.owns_partition(partition);
+  for (size_t i = 0; i < n; i++) {
+    const std::string &k = *key_strs[i];
+    const transaction_base::field_read_t * const field_read =
+      field_reads ? &field_reads[i] : nullptr;
+    const dbtuple *tuple = tuples[i];
+    if (!tuple) {
+      typename concurrent_btree::value_type underlying_v{};
+      concurrent_btree::versioned_node_t search_info;
+      if (!this->underlying_btree.search(varkey(k), underlying_v, &search_info)) {
+        if (unlikely(t.is_sampling_keys()))
+          t.note_key(search_info.first, &this->underlying_btree, k);
+        t.do_node_read(search_info.first, search_info.second, track);
+        found[i] = false;
+        continue;
+      }
+      // inserted since the batch looked
+      tuple = reinterpret_cast<const dbtuple *>(underlying_v);
+    }
+    if (unlikely(t.is_sampling_keys()))
+      t.note_key(tuple, &this->underlying_btree, k);
+    found[i] = t.do_tuple_read(
+        tuple, value_readers[i], track,
+        txn_ttl::CutoffFor(&this->underlying_btree, k.data(), k.size()),
+        field_read);
+  }
+}
+
+template <template <typename> class Transaction, typename P>
+template <typename Value>
+void
+base_txn_btree<Transaction, P>::do_bulk_load(
+    const std::string *keys, const Value *values, size_t n,
+    dbtuple::tuple_writer_t writer)
+{
+  scoped_rcu_region guard;
+  scoped_alloc_node home(underlying_btree.numa_node());
+  scoped_alloc_pack_group pack(underlying_btree.pack_group());
+  const tid_t tid = base_txn_btree_handler<Transaction>::bulk_load_tid();
+  std::vector<varkey> bulk_keys;
+  std::vector<typename concurrent_btree::value_type> tuples;
+  bulk_keys.reserve(n);
+  tuples.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    const size_t sz =
+      writer(dbtuple::TUPLE_WRITER_COMPUTE_NEEDED, &values[i], nullptr, 0);
+    INVARIANT(sz);
+    dbtuple * const tuple = dbtuple::alloc_first(sz, false);
+    writer(dbtuple::TUPLE_WRITER_DO_WRITE,
+        &values[i], tuple->get_value_start(), 0);
+    tuple->version = tid;
+#ifdef TUPLE_CHECK_KEY
+    tuple->key.assign(keys[i].data(), keys[i].size());
+    tuple->tree = (void *) &underlying_btree;
+#endif
+    bulk_keys.emplace_back(keys[i]);
+    tuples.push_back((typename concurrent_btree::value_type) tuple);
+  }
+  underlying_btree.bulk_load(bulk_keys.data(), tuples.data(), n);
+  if (hash_index)
+    for (size_t i = 0; i < n; i++)
+      hash_index->put(bulk_keys[i], (dbtuple *) tuples[i]);
+  if (learned_idx)
+    build_learned_index();
+}
+
+template <template <typename> class Transaction, typename P>
+void
+base_txn_btree<Transaction, P>::bulk_load_records(
+    const varkey *keys, const uint8_t *const *values,
+    const size_t *sizes, size_t n, size_t nthreads)
+{
+  INVARIANT(nthreads > 0);
+  const tid_t tid = base_txn_btree_handler<Transaction>::bulk_load_tid();
+  std::vector<typename concurrent_btree::value_type> tuples(n);
+  auto make_tuples = [&](size_t begin, size_t end) {
+    scoped_rcu_region guard;
+    scoped_alloc_node home(underlying_btree.numa_node());
+    scoped_alloc_pack_group pack(underlying_btree.pack_group());
+    for (size_t i = begin; i < end; i++) {
+      dbtuple * const tuple = dbtuple::alloc_first(sizes[i], false);
+      NDB_MEMCPY(tuple->get_value_start(), values[i], sizes[i]);
+      tuple->version = tid;
+#ifdef TUPLE_CHECK_KEY
+      tuple->key.assign((const char *) keys[i].data(), keys[i].size());
+      tuple->tree = (void *) &underlying_btree;
+#endif
+      tuples[i] = (typename concurrent_btree::value_type) tuple;
+    }
+  };
+  nthreads = std::max<size_t>(1, std::min(nthreads, n));
+  const size_t per_thread = n / nthreads;
+  std::vector<std::thread> thds;
+  for (size_t t = 1; t < nthreads; t++)
+    thds.emplace_back(make_tuples, t * per_thread,
+                      t + 1 == nthreads ? n : (t + 1) * per_thread);
+  make_tuples(0, nthreads == 1 ? n : per_thread);
+  for (auto &t : thds)
+    t.join();
+
+  scoped_rcu_region guard;
+  underlying_btree.bulk_load(keys, tuples.data(), n);
+  if (hash_index)
+    for (size_t i = 0; i < n; i++)
+      hash_index->put(keys[i], (dbtuple *) tuples[i]);
+  if (learned_idx)
+    build_learned_index();
+}
+
+template <template <typename> class Transaction, typename P>
+void
+base_txn_btree<Transaction, P>::build_learned_index()
+{
+  INVARIANT(learned_idx);
+  std::vector<std::string> keys;
+  std::vector<dbtuple *> tuples;
+  keys.reserve(underlying_btree.size());
+  tuples.reserve(underlying_btree.size());
+  scoped_rcu_region guard;
+  auto add = [&keys, &tuples](const std::string &k,
+                              typename concurrent_btree::value_type v) {
+    keys.push_back(k);
+    tuples.push_back(reinterpret_cast<dbtuple *>(v));
+    return true;
+  };
+  underlying_btree.search_range(varkey(""), nullptr, add);
+  learned_idx->build(keys, tuples);
+}
+
 template <template <typename> class Transaction, typename P>
 std::map<std::string, uint64_t>
 base_txn_btree<Transaction, P>::unsafe_purge(bool dump_stats)
 {
   ALWAYS_ASSERT(!been_destructed);
   been_destructed = true;
+  // before the tuples go away under the sweeper
+  if (cold_store::IsEnabled())
+    cold_store::UnregisterTree(&underlying_btree);
   purge_tree_walker w;
   scoped_rcu_region guard;
   underlying_btree.tree_walk(w);
   underlying_btree.clear();
+  if (hash_index)
+    hash_index->clear();
+  if (learned_idx)
+    learned_idx->clear();
 #ifdef TXN_BTREE_DUMP_PURGE_STATS
   if (!dump_stats)
     return std::map<std::string, uint64_t>();
@@ -258,6 +842,56 @@ base_txn_btree<Transaction, P>::unsafe_purge(bool dump_stats)
 #endif
 }
 
+template <template <typename> class Transaction, typename P>
+typename base_txn_btree<Transaction, P>::memory_stats
+base_txn_btree<Transaction, P>::get_memory_stats() const
+{
+  memory_stats s;
+  underlying_btree.shape(s.shape_);
+  memory_tree_walker w(s);
+  // older versions are freed through rcu, so the walker can follow chains
+  underlying_btree.tree_walk(w);
+  if (hash_index)
+    s.point_index_buckets_ = hash_index->nbuckets();
+  return s;
+}
+
+template <template <typename> class Transaction, typename P>
+void
+base_txn_btree<Transaction, P>::memory_tree_walker::on_node_begin(const typename concurrent_btree::node_opaque_t *n)
+{
+  INVARIANT(spec_values.empty());
+  spec_values = concurrent_btree::ExtractValues(n);
+}
+
+template <template <typename> class Transaction, typename P>
+void
+base_txn_btree<Transaction, P>::memory_tree_walker::on_node_success()
+{
+  for (size_t i = 0; i < spec_values.size(); i++) {
+    const dbtuple *tuple = (const dbtuple *) spec_values[i].first;
+    INVARIANT(tuple);
+    s->ntuples_++;
+    s->tuple_bytes_ += sizeof(dbtuple) + tuple->alloc_size;
+    if (!tuple->is_deleting())
+      s->record_bytes_ += tuple->size;
+    for (const dbtuple *p = tuple->get_next();
+         p && p != dbtuple::TruncatedChain();
+         p = p->get_next()) {
+      s->nold_versions_++;
+      s->version_chain_bytes_ += sizeof(dbtuple) + p->alloc_size;
+    }
+  }
+  spec_values.clear();
+}
+
+template <template <typename> class Transaction, typename P>
+void
+base_txn_btree<Transaction, P>::memory_tree_walker::on_node_failure()
+{
+  spec_values.clear();
+}
+
 template <template <typename> class Transaction, typename P>
 void
 base_txn_btree<Transaction, P>::purge_tree_walker::on_node_begin(const typename concurrent_btree::node_opaque_t *n)
@@ -317,10 +951,13 @@ base_txn_btree<Transaction, P>::purge_tree_walker::on_node_failure()
 
 template <template <typename> class Transaction, typename P>
 template <typename Traits>
-void base_txn_btree<Transaction, P>::do_tree_put(
+bool
+base_txn_btree<Transaction, P>::do_btree_put(
     Transaction<Traits> &t,
+    concurrent_btree &btr,
+    point_index *hidx,
     const std::string *k,
-    const typename P::Value *v,
+    const void *v,
     dbtuple::tuple_writer_t writer,
     bool expect_new)
 {
@@ -330,7 +967,7 @@ void base_txn_btree<Transaction, P>::do_tree_put(
                                // for now [since this would indicate a suboptimality]
   t.ensure_active();
 
-  if (unlikely(t.is_snapshot())) {
+  if (unlikely(t.is_read_only())) {
     const transaction_base::abort_reason r = transaction_base::ABORT_REASON_USER;
     t.abort_impl(r);
     throw transaction_abort_exception(r);
@@ -339,7 +976,7 @@ void base_txn_btree<Transaction, P>::do_tree_put(
   bool insert = false;
 retry:
   if (expect_new) {
-    auto ret = t.try_insert_new_tuple(this->underlying_btree, k, v, writer);
+    auto ret = t.try_insert_new_tuple(btr, k, v, writer);
     INVARIANT(!ret.second || ret.first);
     if (unlikely(ret.second)) {
       const transaction_base::abort_reason r = transaction_base::ABORT_REASON_WRITE_NODE_INTERFERENCE;
@@ -347,13 +984,18 @@ retry:
       throw transaction_abort_exception(r);
     }
     px = ret.first;
-    if (px)
+    if (px) {
       insert = true;
+      if (hidx)
+        hidx->put(varkey(*k), px);
+    }
   }
+  if (!px && hidx)
+    px = hidx->lookup(varkey(*k));
   if (!px) {
     // do regular search
     typename concurrent_btree::value_type bv = 0;
-    if (!this->underlying_btree.search(varkey(*k), bv)) {
+    if (!btr.search(varkey(*k), bv)) {
       // XXX(stephentu): if we are removing a key and we can't find it, then we
       // should just treat this as a read [of an empty-value], instead of
       // explicitly inserting an empty node...
@@ -365,7 +1007,7 @@ retry:
   INVARIANT(px);
   if (!insert) {
     // add to write set normally, as non-insert
-    t.write_set.emplace_back(px, k, v, writer, &this->underlying_btree, false);
+    t.write_set.emplace_back(px, k, v, writer, &btr, false);
   } else {
     // should already exist in write set as insert
     // (because of try_insert_new_tuple())
@@ -374,6 +1016,139 @@ retry:
     //INVARIANT(t.find_write_set(px) != t.write_set.end());
     //INVARIANT(t.find_write_set(px)->is_insert());
   }
+  return insert;
+}
+
+template <template <typename> class Transaction, typename P>
+template <typename Traits>
+void
+base_txn_btree<Transaction, P>::do_tree_put_batch(
+    Transaction<Traits> &t,
+    const std::string *const *keys,
+    const typename P::Value *const *values,
+    size_t n,
+    dbtuple::tuple_writer_t writer,
+    bool *inserted)
+{
+  t.ensure_active();
+
+  if (unlikely(t.is_read_only())) {
+    const transaction_base::abort_reason r = transaction_base::ABORT_REASON_USER;
+    t.abort_impl(r);
+    throw transaction_abort_exception(r);
+  }
+
+  // sorted keys share the upper levels of their paths (a stable sort, so
+  // later writes to a key are still appended later)
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+      [keys](size_t a, size_t b) { return *keys[a] < *keys[b]; });
+
+  std::vector<varkey> vks;
+  vks.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    vks.emplace_back(*keys[order[i]]);
+  std::vector<typename concurrent_btree::value_type> tuples(n);
+  std::unique_ptr<bool[]> found(new bool[n]);
+  if (hash_index) {
+    for (size_t i = 0; i < n; i++) {
+      tuples[i] = (typename concurrent_btree::value_type) hash_index->lookup(vks[i]);
+      found[i] = tuples[i];
+    }
+  } else {
+    this->underlying_btree.search_batch(vks.data(), n, tuples.data(), found.get());
+  }
+
+  t.write_set.reserve(t.write_set.size() + n);
+  for (size_t i = 0; i < n; i++) {
+    const size_t j = order[i];
+    if (found[i]) {
+      // an insert of an existing key is a put, as in do_tree_put()
+      dbtuple * const px = reinterpret_cast<dbtuple *>(tuples[i]);
+      t.write_set.emplace_back(
+          px, keys[j], values[j], writer, &this->underlying_btree, false);
+      if (inserted)
+        inserted[j] = false;
+      continue;
+    }
+    // absent when we looked (or inserted by an earlier write of the batch),
+    // so do_tree_put() can go straight to inserting
+    const bool ins = do_tree_put(t, keys[j], values[j], writer, values[j] != nullptr);
+    if (inserted)
+      inserted[j] = ins;
+  }
+}
+
+template <template <typename> class Transaction, typename P>
+template <typename Traits>
+bool
+base_txn_btree<Transaction, P>::do_tree_increment(
+    Transaction<Traits> &t,
+    const std::string *k,
+    typename P::Value *v,
+    dbtuple::tuple_writer_t writer)
+{
+  INVARIANT(k);
+  INVARIANT(v);
+  t.ensure_active();
+
+  if (unlikely(t.is_read_only())) {
+    const transaction_base::abort_reason r = transaction_base::ABORT_REASON_USER;
+    t.abort_impl(r);
+    throw transaction_abort_exception(r);
+  }
+
+  dbtuple *px = hash_index ? hash_index->lookup(varkey(*k)) :
+    learned_idx ? learned_idx->lookup(varkey(*k)) : nullptr;
+  if (!px) {
+    typename concurrent_btree::value_type bv = 0;
+    concurrent_btree::versioned_node_t search_info;
+    if (!this->underlying_btree.search(varkey(*k), bv, &search_info)) {
+      t.do_node_read(search_info.first, search_info.second,
+                     !t.owns_partition(partition));
+      return false;
+    }
+    px = reinterpret_cast<dbtuple *>(bv);
+  }
+
+  // the latest write to the record (if any) decides what the delta is
+  // added to
+  const auto it = t.find_last_write_set(px);
+  if (it != t.write_set.end() && !it->is_insert()) {
+    // (an inserted value is already in the record)
+    if (it->is_commutative()) {
+      ALWAYS_ASSERT(it->get_writer() == writer);
+      writer(dbtuple::TUPLE_WRITER_ADD_DELTA, v,
+             reinterpret_cast<uint8_t *>(
+               const_cast<void *>(it->get_value())), 0);
+      return true;
+    }
+    // a put, whose value we cannot modify in place
+    if (!it->get_value())
+      // removed by the txn
+      return false;
+    std::string * const s = t.string_allocator()();
+    s->assign(reinterpret_cast<const char *>(it->get_value()),
+              sizeof(typename P::Value));
+    writer(dbtuple::TUPLE_WRITER_ADD_DELTA, v,
+           reinterpret_cast<uint8_t *>(&(*s)[0]), 0);
+    it->set_value(s->data());
+    return true;
+  }
+  if (unlikely(px->is_deleting() || !px->size)) {
+    // (probably) removed, which the delta would only find at commit, and
+    // abort on, until GC unlinks the record. so it is read like search()
+    // would, which remembers the absence
+    presence_reader r;
+    if (!t.do_tuple_read(px, r, !t.owns_partition(partition),
+                         txn_ttl::CutoffFor(&this->underlying_btree,
+                                            k->data(), k->size())))
+      return false;
+  }
+  t.write_set.emplace_back(px, k, v, writer, &this->underlying_btree, false, true);
+  return true;
 }
 
 template <template <typename> class Transaction, typename P>
@@ -388,7 +1163,9 @@ base_txn_btree<Transaction, P>
   VERBOSE(std::cerr << "on_resp_node(): <node=0x" << util::hexify(intptr_t(n))
                << ", version=" << version << ">" << std::endl);
   VERBOSE(std::cerr << "  " << concurrent_btree::NodeStringify(n) << std::endl);
-  t->do_node_read(n, version);
+  if (unlikely(t->is_sampling_keys()))
+    t->note_key(n, btr, *bound);
+  t->do_node_read(n, version, track);
 }
 
 template <template <typename> class Transaction, typename P>
@@ -402,11 +1179,18 @@ base_txn_btree<Transaction, P>
     const typename concurrent_btree::node_opaque_t *n, uint64_t version)
 {
   t->ensure_active();
+  prefetcher.on_record();
   VERBOSE(std::cerr << "search range k: " << util::hexify(k) << " from <node=0x" << util::hexify(n)
                     << ", version=" << version << ">" << std::endl
                     << "  " << *((dbtuple *) v) << std::endl);
   const dbtuple * const tuple = reinterpret_cast<const dbtuple *>(v);
-  if (t->do_tuple_read(tuple, *value_reader))
+  if (unlikely(t->is_sampling_keys()))
+    t->note_key(tuple, btr, std::string(k.data(), k.length()));
+  // the read is recorded even if the record is filtered out, since the
+  // filter decided on what it read
+  if (t->do_tuple_read(tuple, *value_reader, track,
+                       txn_ttl::CutoffFor(btr, k.data(), k.length())) &&
+      RecordMatched(*value_reader, 0))
     return caller_callback->invoke(
         (*key_reader)(k), value_reader->results());
   return true;
@@ -425,6 +1209,8 @@ base_txn_btree<Transaction, P>::do_search_range_call(
     ValueReader &value_reader)
 {
   t.ensure_active();
+  if (t.is_snapshot())
+    t.note_snapshot_read(&this->underlying_btree);
   if (upper)
     VERBOSE(std::cerr << "txn_btree(0x" << util::hexify(intptr_t(this))
                  << ")::search_range_call [" << util::hexify(lower)
@@ -446,7 +1232,9 @@ base_txn_btree<Transaction, P>::do_search_range_call(
     return;
 
   txn_search_range_callback<Traits, Callback, KeyReader, ValueReader> c(
-			&t, &callback, &key_reader, &value_reader);
+			&t, &callback, &key_reader, &value_reader,
+			&this->underlying_btree, lower_str,
+			!t.owns_partition(partition));
 
   varkey uppervk;
   if (upper_str)
@@ -469,6 +1257,8 @@ base_txn_btree<Transaction, P>::do_rsearch_range_call(
     ValueReader &value_reader)
 {
   t.ensure_active();
+  if (t.is_snapshot())
+    t.note_snapshot_read(&this->underlying_btree);
 
   typename P::KeyWriter lower_key_writer(lower);
   const std::string * const lower_str =
@@ -482,7 +1272,9 @@ base_txn_btree<Transaction, P>::do_rsearch_range_call(
     return;
 
   txn_search_range_callback<Traits, Callback, KeyReader, ValueReader> c(
-			&t, &callback, &key_reader, &value_reader);
+			&t, &callback, &key_reader, &value_reader,
+			&this->underlying_btree, upper_str,
+			!t.owns_partition(partition));
 
   varkey lowervk;
   if (lower_str)
@@ -492,4 +1284,104 @@ base_txn_btree<Transaction, P>::do_rsearch_range_call(
       c, t.string_allocator()());
 }
 
+template <template <typename> class Transaction, typename P>
+template <typename Traits, typename Callback,
+          typename KeyReader, typename ValueReader>
+bool
+base_txn_btree<Transaction, P>
+  ::snapshot_search_range_callback<Traits, Callback, KeyReader, ValueReader>
+  ::invoke(
+    const typename concurrent_btree::string_type &k, typename concurrent_btree::value_type v,
+    const typename concurrent_btree::node_opaque_t *n, uint64_t version)
+{
+  const dbtuple * const tuple = reinterpret_cast<const dbtuple *>(v);
+  prefetcher.on_record();
+  if (unlikely(!sa))
+    sa.reset(new typename Traits::StringAllocator);
+  const dbtuple::ReadStatus stat =
+    t->do_snapshot_tuple_read(tuple, value_reader, *sa,
+                              txn_ttl::CutoffFor(btr, k.data(), k.length()));
+  if (unlikely(stat == dbtuple::READ_FAILED)) {
+    failed_tuple = tuple;
+    return false;
+  }
+  if (stat == dbtuple::READ_EMPTY || !RecordMatched(value_reader, 0))
+    return true;
+  return caller_callback->invoke(key_reader(k), value_reader.results());
+}
+
+template <template <typename> class Transaction, typename P>
+template <typename Traits, typename Callback,
+          typename KeyReader, typename ValueReader>
+void
+base_txn_btree<Transaction, P>::do_parallel_search_range_call(
+    Transaction<Traits> &t,
+    const typename P::Key &lower,
+    const typename P::Key *upper,
+    const std::vector<Callback *> &callbacks,
+    KeyReader &key_reader,
+    ValueReader &value_reader)
+{
+  t.ensure_active();
+  if (t.is_snapshot())
+    t.note_snapshot_read(&this->underlying_btree);
+
+  typename P::KeyWriter lower_key_writer(&lower);
+  const std::string * const lower_str =
+    lower_key_writer.fully_materialize(true, t.string_allocator());
+
+  typename P::KeyWriter upper_key_writer(upper);
+  const std::string * const upper_str =
+    upper_key_writer.fully_materialize(true, t.string_allocator());
+
+  if (unlikely(upper_str && *upper_str <= *lower_str))
+    return;
+
+  varkey uppervk;
+  if (upper_str)
+    uppervk = varkey(*upper_str);
+
+  if (!t.is_snapshot()) {
+    const std::vector<std::string> bounds =
+      this->underlying_btree.split_range(
+          varkey(*lower_str), upper_str ? &uppervk : nullptr, callbacks.size());
+    for (size_t i = 0; i <= bounds.size() && i < callbacks.size(); i++) {
+      txn_search_range_callback<Traits, Callback, KeyReader, ValueReader> c(
+          &t, callbacks[i], &key_reader, &value_reader,
+          &this->underlying_btree, i ? &bounds[i - 1] : lower_str,
+          !t.owns_partition(partition));
+      varkey sub_upper;
+      if (i < bounds.size())
+        sub_upper = varkey(bounds[i]);
+      this->underlying_btree.search_range_call(
+          i ? varkey(bounds[i - 1]) : varkey(*lower_str),
+          i < bounds.size() ? &sub_upper : (upper_str ? &uppervk : nullptr),
+          c, t.string_allocator()());
+    }
+    return;
+  }
+
+  typedef snapshot_search_range_callback<
+    Traits, Callback, KeyReader, ValueReader> worker_callback;
+  std::vector<std::unique_ptr<worker_callback>> cs;
+  std::vector<typename concurrent_btree::low_level_search_range_callback *> cps;
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    cs.emplace_back(
+        new worker_callback(&t, callbacks[i], key_reader, value_reader,
+                            &this->underlying_btree));
+    cps.push_back(cs.back().get());
+  }
+  this->underlying_btree.search_range_call_parallel(
+      varkey(*lower_str), upper_str ? &uppervk : nullptr, cps);
+  for (auto &c : cs) {
+    if (unlikely(c->failed_tuple)) {
+      const transaction_base::abort_reason r =
+        transaction_base::ABORT_REASON_UNSTABLE_READ;
+      t.conflict_tuple = c->failed_tuple;
+      t.abort_impl(r);
+      throw transaction_abort_exception(r);
+    }
+  }
+}
+
 #endif /* _NDB_BASE_TXN_BTREE_H_ */
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include "batch_executor.h"
+#include "counter.h"
+#include "ticker.h"
+
+using namespace std;
+
+static event_counter evt_batch_executor_batches("batch_executor_batches");
+static event_counter evt_batch_executor_txns("batch_executor_txns");
+static event_counter evt_batch_executor_waves("batch_executor_waves");
+static event_counter evt_batch_executor_retries("batch_executor_retries");
+
+namespace {
+  struct key_ref_hash {
+    inline size_t
+    operator()(const batch_executor::key_ref &k) const
+    {
+      return hash<string>()(k.key_) ^
+             (hash<const void *>()(k.table_) * 0x9e3779b97f4a7c15ULL);
+    }
+  };
+
+  struct key_ref_equal {
+    inline bool
+    operator()(const batch_executor::key_ref &a,
+               const batch_executor::key_ref &b) const
+    {
+      return a.table_ == b.table_ && a.key_ == b.key_;
+    }
+  };
+}
+
+batch_executor::batch_executor(txn_executor &exec)
+  : exec_(exec), stopping_(false)
+{
+  thd_ = thread(&batch_executor::run_batches, this);
+}
+
+batch_executor::~batch_executor()
+{
+  {
+    std::lock_guard<mutex> l(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thd_.join();
+}
+
+void
+batch_executor::submit(vector<key_ref> keys, txn_t txn, done_t done)
+{
+  std::lock_guard<mutex> l(mutex_);
+  INVARIANT(!stopping_);
+  pending_.push_back(pending_txn{move(keys), move(txn), move(done)});
+  if (pending_.size() == 1 || pending_.size() == MaxBatchSize)
+    cv_.notify_one();
+}
+
+vector<size_t>
+batch_executor::Schedule(const vector<const vector<key_ref> *> &batch)
+{
+  // the wave of the last txn to touch each key, plus one
+  unordered_map<key_ref, size_t, key_ref_hash, key_ref_equal> last;
+  vector<size_t> waves;
+  waves.reserve(batch.size());
+  for (auto keys : batch) {
+    size_t w = 0;
+    for (auto &k : *keys) {
+      auto it = last.find(k);
+      if (it != last.end())
+        w = max(w, it->second);
+    }
+    for (auto &k : *keys)
+      last[k] = w + 1;
+    waves.push_back(w);
+  }
+  return waves;
+}
+
+void
+batch_executor::run_batches()
+{
+  for (;;) {
+    vector<pending_txn> batch;
+    {
+      unique_lock<mutex> l(mutex_);
+      cv_.wait(l, [this]() { return stopping_ || !pending_.empty(); });
+      if (pending_.empty())
+        return;
+      // the rest of the tick's txns join the batch
+      cv_.wait_for(l, chrono::microseconds(ticker::TickUsec()), [this]() {
+        return stopping_ || pending_.size() >= MaxBatchSize;
+      });
+      batch.swap(pending_);
+    }
+    run_batch(batch);
+  }
+}
+
+void
+batch_executor::run_batch(vector<pending_txn> &batch)
+{
+  vector<const vector<key_ref> *> keys;
+  keys.reserve(batch.size());
+  for (auto &t : batch)
+    keys.push_back(&t.keys_);
+  const vector<size_t> waves = Schedule(keys);
+  const size_t nwaves = *max_element(waves.begin(), waves.end()) + 1;
+  vector<vector<pending_txn *>> by_wave(nwaves);
+  for (size_t i = 0; i < batch.size(); i++)
+    by_wave[waves[i]].push_back(&batch[i]);
+  ++evt_batch_executor_batches;
+  evt_batch_executor_txns += batch.size();
+  evt_batch_executor_waves += nwaves;
+
+  mutex m;
+  condition_variable cv;
+  for (auto &wave : by_wave) {
+    size_t nleft = wave.size();
+    for (auto t : wave)
+      exec_.submit([t, &m, &cv, &nleft]() {
+        while (!t->txn_())
+          ++evt_batch_executor_retries;
+        if (t->done_)
+          t->done_();
+        std::lock_guard<mutex> l(m);
+        if (!--nleft)
+          cv.notify_one();
+      });
+    unique_lock<mutex> l(m);
+    cv.wait(l, [&nleft]() { return !nleft; });
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef _NDB_BATCH_EXECUTOR_H_
+#define _NDB_BATCH_EXECUTOR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "macros.h"
+#include "txn_executor.h"
+
+/**
+ * Deterministic batch execution, for workloads so contended (say, a flash
+ * sale on a few items) that OCC spends its time aborting and retrying.
+ *
+ * Txns submitted here declare up front every key they will read or write.
+ * They are collected into batches, one per epoch tick (see
+ * ticker::TickUsec()) or MaxBatchSize txns, whichever comes first. Each
+ * batch is then ordered before anything in it runs: txns go in submission
+ * order, and each is put in the wave after the last wave holding a txn it
+ * shares a key with. The txns of a wave share no keys, so they run in
+ * parallel on the txn_executor's workers without aborting each other. Each
+ * wave starts once the one before it is done, so txns which share keys run
+ * in submission order.
+ *
+ * The txns themselves are ordinary proto2 txns, committed and logged as
+ * usual, so txns which do not go through here run alongside them. A batched
+ * txn can still abort on a conflict with one of those (or on a key it did not
+ * declare); it is then retried right away, still in its wave. Submitted txns
+ * only run after their batch is closed, so each pays up to a tick of
+ * latency.
+ */
+class batch_executor {
+public:
+
+  static const size_t MaxBatchSize = 1 << 14;
+
+  // a key of a table (any pointer the caller uses to name it, ie the
+  // table's underlying btree)
+  struct key_ref {
+    const void *table_;
+    std::string key_;
+  };
+
+  // runs the txn once, returning false if it aborted (and should be
+  // retried). must not throw
+  typedef std::function<bool()> txn_t;
+
+  // called on the worker, once the txn has committed
+  typedef std::function<void()> done_t;
+
+  // exec's workers run the waves; it can run other tasks too
+  explicit batch_executor(txn_executor &exec);
+
+  // runs what has been submitted, then stops
+  ~batch_executor();
+
+  batch_executor(const batch_executor &) = delete;
+  batch_executor(batch_executor &&) = delete;
+  batch_executor &operator=(const batch_executor &) = delete;
+
+  // keys are the keys txn reads or writes (the order does not matter)
+  void submit(std::vector<key_ref> keys, txn_t txn, done_t done = nullptr);
+
+  // puts the txns of a batch (by their keys) into waves, returning the wave
+  // of each. exposed for testing
+  static std::vector<size_t>
+  Schedule(const std::vector<const std::vector<key_ref> *> &batch);
+
+private:
+
+  struct pending_txn {
+    std::vector<key_ref> keys_;
+    txn_t txn_;
+    done_t done_;
+  };
+
+  void run_batches();
+  void run_batch(std::vector<pending_txn> &batch);
+
+  txn_executor &exec_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<pending_txn> pending_;
+  bool stopping_;
+
+  std::thread thd_;
+};
+
+#endif /* _NDB_BATCH_EXECUTOR_H_ */
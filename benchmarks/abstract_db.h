@@ -5,8 +5,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "abstract_ordered_index.h"
 #include "../str_arena.h"
@@ -56,6 +58,14 @@ public:
    */
   virtual void do_txn_finish() const {}
 
+  /**
+   * Called by the calling thread before it retries the txn which it just
+   * aborted, so the db can wait according to why it aborted. Returns false if
+   * the db does not manage contention (in which case the caller is free to
+   * back off on its own)
+   */
+  virtual bool before_txn_retry() { return false; }
+
   /** loader should be used as a performance hint, not for correctness */
   virtual void thread_init(bool loader) {}
 
@@ -67,9 +77,79 @@ public:
 
   virtual void reset_ntxn_persisted() { }
 
+  /**
+   * Rebuilds the (empty) tables from the log files and/or the checkpoint
+   * directory (empty for none) of a previous run, instead of running the
+   * loaders. compressed says how the log was written. Returns false if
+   * not supported
+   */
+  virtual bool
+  recover(const std::vector<std::string> &logfiles,
+          const std::string &checkpoint_dir,
+          bool compressed,
+          const std::map<std::string, abstract_ordered_index *> &tables)
+  {
+    return false;
+  }
+
+  /**
+   * Starts taking periodic background checkpoints of the tables into dir,
+   * scanning at most max_bytes_per_sec (0 for unlimited). With image, the
+   * checkpoints are written to be mapped and bulk loaded on recovery. With
+   * max_deltas, up to that many incremental checkpoints follow each full
+   * one. Returns false if not supported
+   */
+  virtual bool
+  start_checkpointer(const std::string &dir,
+                     uint64_t interval_sec,
+                     uint64_t max_bytes_per_sec,
+                     const std::map<std::string, abstract_ordered_index *> &tables,
+                     bool image = false,
+                     size_t max_deltas = 0)
+  {
+    return false;
+  }
+
+  virtual void stop_checkpointer() {}
+
+  /**
+   * Streams a consistent copy of the tables to fd while txns keep running,
+   * writing at most max_bytes_per_sec (0 for unlimited). Returns false if
+   * not supported, or fd could not be written to
+   */
+  virtual bool
+  backup(int fd,
+         uint64_t max_bytes_per_sec,
+         const std::map<std::string, abstract_ordered_index *> &tables)
+  {
+    return false;
+  }
+
+  /**
+   * Fills idx, which must be empty and not yet in use, with
+   * keys[i] => values[i], the keys being sorted, without going through txns.
+   * For loaders which are the only ones to load a table. Returns false,
+   * loading nothing, if not supported (or not now, eg because the load
+   * would not be logged): the loader then inserts the records in txns
+   */
+  virtual bool
+  bulk_load(abstract_ordered_index *idx,
+            const std::vector<std::string> &keys,
+            const std::vector<std::string> &values)
+  {
+    return false;
+  }
+
   enum TxnProfileHint {
     HINT_DEFAULT,
 
+    // generic profiles, for txns whose shape is known up front (see
+    // procedure_registry)
+    HINT_READ_ONLY, // runs against the read-only snapshot
+    HINT_SIZED_SMALL, // touches up to ~8 keys
+    HINT_SIZED_MEDIUM, // up to ~64 keys
+    HINT_SIZED_LARGE, // up to ~512 keys
+
     // ycsb profiles
     HINT_KV_GET_PUT, // KV workloads over a single key
     HINT_KV_RMW, // get/put over a single key
@@ -83,6 +163,7 @@ public:
     HINT_TPCC_ORDER_STATUS_READ_ONLY,
     HINT_TPCC_STOCK_LEVEL,
     HINT_TPCC_STOCK_LEVEL_READ_ONLY,
+    HINT_TPCC_CH_QUERY_READ_ONLY, // CH-benCHmark analytic queries
   };
 
   /**
@@ -114,22 +195,92 @@ public:
    * Returns true on successful commit.
    *
    * On failure, can either throw abstract_abort_exception, or
-   * return false- caller should be prepared to deal with both cases
+   * return false- caller should be prepared to deal with both cases. A
+   * failed txn's buffer is kept like an aborted one's (see abort_txn())
    */
   virtual bool commit_txn(void *txn) = 0;
 
   /**
-   * XXX
+   * Like commit_txn(), but once the committed txn is durable, on_durable()
+   * is called (possibly from another thread, and possibly before this
+   * returns), so the caller can go on to run other txns in the meantime.
+   * on_durable() is not called if the txn fails to commit, and should be
+   * quick.
+   *
+   * Default implementation calls on_durable() right after commit_txn()
+   */
+  virtual bool
+  commit_txn_async(void *txn, std::function<void()> on_durable)
+  {
+    if (!commit_txn(txn))
+      return false;
+    on_durable();
+    return true;
+  }
+
+  /**
+   * The db may keep what the aborted txn allocated in its buffer, for a
+   * retry to reuse, so the buffer must stay valid until the next new_txn()
+   * or thread_end() of the calling thread
    */
   virtual void abort_txn(void *txn) = 0;
 
   virtual void print_txn_debug(void *txn) const {}
 
+  /**
+   * Turns on partitioned execution over npartitions partitions (see
+   * abstract_ordered_index::set_partition()). Called before the workers
+   * start. Returns false if not supported
+   */
+  virtual bool
+  init_partitions(size_t npartitions)
+  {
+    return false;
+  }
+
+  /**
+   * Makes txn the owner of partitions parts[0, n) until it commits or
+   * aborts, blocking while other txns own any of them. A txn which entered a
+   * single partition does not validate its reads of the partition's indexes.
+   * Must be called before the txn's first operation, and at most once
+   */
+  virtual void
+  enter_partitions(void *txn, const unsigned *parts, size_t n)
+  {
+  }
+
   virtual abstract_ordered_index *
   open_index(const std::string &name,
              size_t value_size_hint,
              bool mostly_append = false) = 0;
 
+  /**
+   * Like open_index(), for a table which is only ever accessed by key:
+   * scan() and rscan() are not supported on the index returned. Systems with
+   * nothing better for such tables just open a regular index
+   */
+  virtual abstract_ordered_index *
+  open_point_index(const std::string &name,
+                   size_t value_size_hint)
+  {
+    return open_index(name, value_size_hint);
+  }
+
+  /**
+   * Like open_index(), for data which needs no serializability (caches,
+   * metrics): each op on the index returned is atomic on its own key and
+   * takes effect right away, whether or not the txn it is made in commits.
+   * With logged, its writes survive a crash like those of a regular index.
+   * Systems with nothing better just open a regular index
+   */
+  virtual abstract_ordered_index *
+  open_kv_index(const std::string &name,
+                size_t value_size_hint,
+                bool logged = false)
+  {
+    return open_index(name, value_size_hint);
+  }
+
   virtual void
   close_index(abstract_ordered_index *idx) = 0;
 };
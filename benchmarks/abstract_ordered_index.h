@@ -29,6 +29,63 @@ public:
       std::string &value,
       size_t max_bytes_read = std::string::npos) = 0;
 
+  /**
+   * Like get(), but [data, data + sz) is the value, which can be read until
+   * the txn ends. Indexes which can point into their records do so, rather
+   * than copying the value; by default the value is copied into scratch,
+   * which must then outlive the view
+   */
+  virtual bool
+  get_view(void *txn,
+           const std::string &key,
+           const char *&data,
+           size_t &sz,
+           std::string &scratch)
+  {
+    if (!get(txn, key, scratch))
+      return false;
+    data = scratch.data();
+    sz = scratch.size();
+    return true;
+  }
+
+  /**
+   * One step of warming up the cache for an access to key, for workers
+   * which interleave several txns on a thread to overlap their cache misses
+   * (see bench_worker::txn_coroutine): each step issues a prefetch, which
+   * the next step relies on. state must start null for each key, and the
+   * txn which accesses key must be active over all of its steps.
+   *
+   * Returns false once there is nothing left to prefetch. By default there
+   * is nothing to prefetch
+   */
+  virtual bool
+  prefetch_step(const std::string &key, const void *&state)
+  {
+    return false;
+  }
+
+  /**
+   * Homes the index's memory on numa node node, for indexes which belong to
+   * one partition of the data (see tpcc's --home-partitions). Systems which
+   * cannot place memory ignore it
+   */
+  virtual void
+  set_numa_node(int node)
+  {
+  }
+
+  /**
+   * Binds the index to partition p of abstract_db::init_partitions(), for
+   * indexes which hold only keys owned by p. Txns which entered only p (see
+   * abstract_db::enter_partitions()) read it without validating their reads.
+   * Systems without partitioned execution ignore it
+   */
+  virtual void
+  set_partition(int p)
+  {
+  }
+
   class scan_callback {
   public:
     virtual ~scan_callback() {}
@@ -94,6 +151,25 @@ public:
                     static_cast<const std::string &>(value));
   }
 
+  /**
+   * Puts key => value only if key maps to *expected (or is absent, with
+   * expected null). Returns whether it did. By default it is a get() and a
+   * put(), made atomic by the txn
+   */
+  virtual bool
+  compare_and_put(void *txn,
+                  const std::string &key,
+                  const std::string *expected,
+                  const std::string &value)
+  {
+    std::string cur;
+    const bool found = get(txn, key, cur);
+    if (found != bool(expected) || (found && cur != *expected))
+      return false;
+    put(txn, key, value);
+    return true;
+  }
+
   /**
    * Insert a key of length keylen.
    *
@@ -145,6 +221,16 @@ public:
    * Not thread safe for now
    */
   virtual std::map<std::string, uint64_t> clear() = 0;
+
+  /**
+   * Bytes (and nodes, records) used by the index, by name. Only an
+   * estimate, and slow: walks the whole index. Empty if not implemented
+   */
+  virtual std::map<std::string, uint64_t>
+  memory_stats() const
+  {
+    return std::map<std::string, uint64_t>();
+  }
 };
 
 #endif /* _ABSTRACT_ORDERED_INDEX_H_ */
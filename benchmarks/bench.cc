@@ -1,12 +1,17 @@
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include <utility>
 #include <string>
 
+#include <math.h>
 #include <stdlib.h>
 #include <sched.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/sysinfo.h>
 
@@ -15,6 +20,9 @@
 #include "../counter.h"
 #include "../scopedperf.hh"
 #include "../allocator.h"
+#include "../thread_placement.h"
+#include "../txn_tracer.h"
+#include "../stats_server.h"
 
 #ifdef USE_JEMALLOC
 //cannot include this header b/c conflicts with malloc.h
@@ -43,6 +51,26 @@ int slow_exit = 0;
 int retry_aborted_transaction = 0;
 int no_reset_counters = 0;
 int backoff_aborted_transaction = 0;
+size_t interleave_txns = 1;
+int perf_counters = 0;
+double open_loop_rate = 0.0;
+int poisson_arrivals = 0;
+vector<string> recover_logfiles;
+int recover_log_compress = 0;
+string recover_checkpoint_dir;
+string checkpoint_dir;
+uint64_t checkpoint_interval = 10;
+uint64_t checkpoint_max_bytes_per_sec = 0;
+int checkpoint_image = 0;
+size_t checkpoint_max_deltas = 0;
+string replay_trace_file;
+workload_trace::record_vec replay_trace;
+double replay_speed = 1.0;
+uint64_t sample_interval_ms = 1000;
+string backup_file;
+int print_memory_report = 0;
+string json_output_file;
+map<string, string> bench_config;
 
 template <typename T>
 static void
@@ -102,8 +130,152 @@ write_cb(void *p, const char *s)
   ofs.close();
 }
 
+// the latency percentiles we report, for picking configurations on their
+// tails rather than on their averages
+static const double LatencyPercentileList[] = {50, 95, 99, 99.9};
+
+static string
+LatencyPercentiles(const histogram_data &d)
+{
+  ostringstream o;
+  o << "count=" << d.count_ << ", avg=" << d.avg();
+  for (double p : LatencyPercentileList)
+    o << ", p" << p << "=" << d.percentile(p);
+  o << ", max=" << d.max_;
+  return o.str();
+}
+
+static string
+JsonStr(const string &s)
+{
+  string ret = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (uint8_t(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", unsigned(c));
+      ret += buf;
+    } else {
+      ret += c;
+    }
+  }
+  return ret + "\"";
+}
+
+// a json object, in usec
+static string
+LatencyPercentilesJson(const histogram_data &d)
+{
+  ostringstream o;
+  o << "{\"count\": " << d.count_ << ", \"avg_us\": " << d.avg();
+  for (double p : LatencyPercentileList)
+    o << ", \"p" << p << "_us\": " << d.percentile(p);
+  o << ", \"max_us\": " << d.max_ << "}";
+  return o.str();
+}
+
+// space separated, in msec, ending with the max
+static string
+LatencyPercentilesMs(const histogram_data &d)
+{
+  ostringstream o;
+  for (double p : LatencyPercentileList)
+    o << (d.percentile(p) / 1000.0) << " ";
+  o << (d.max_ / 1000.0);
+  return o.str();
+}
+
+// what the workers did over one sampling interval of a run
+struct run_sample {
+  double t_sec;  // the end of the interval, since the start of the run
+  double dt_sec;
+  uint64_t ncommits;
+  uint64_t naborts;
+  uint64_t npersisted;
+  double memory_mb; // system memory used since the start of the run
+  inline double throughput() const { return double(ncommits) / dt_sec; }
+};
+
+/**
+ * The number of leading samples which are warmup, by MSER: the run is cut
+ * where the mean throughput of what is left has the smallest standard error
+ * (its variance over the number of samples left). Cutting off a ramp up
+ * lowers the variance more than it costs in samples, while cutting into
+ * steady state only costs samples. At most half the run is cut
+ */
+static size_t
+WarmupSamples(const vector<run_sample> &samples)
+{
+  const size_t n = samples.size();
+  if (n < 4)
+    return 0;
+  double sum = 0.0, sumsq = 0.0; // of samples [d, n)
+  for (auto &s : samples) {
+    sum += s.throughput();
+    sumsq += s.throughput() * s.throughput();
+  }
+  size_t best = 0;
+  double best_stat = numeric_limits<double>::infinity();
+  for (size_t d = 0; d <= n / 2; d++) {
+    const double m = double(n - d);
+    const double mean = sum / m;
+    const double stat = max(sumsq / m - mean * mean, 0.0) / m;
+    if (stat < best_stat) {
+      best = d;
+      best_stat = stat;
+    }
+    sum -= samples[d].throughput();
+    sumsq -= samples[d].throughput() * samples[d].throughput();
+  }
+  return best;
+}
+
 static event_avg_counter evt_avg_abort_spins("avg_abort_spins");
 
+// waits for an open loop txn's scheduled start, giving up the cpu for the
+// longer waits
+static void
+WaitUntilUsec(uint64_t t)
+{
+  for (;;) {
+    const uint64_t now = timer::cur_usec();
+    if (now >= t || !running)
+      return;
+    if (t - now > 200)
+      usleep(min(t - now - 100, uint64_t(1000)));
+    else
+      nop_pause();
+  }
+}
+
+void
+bench_loader::PinToWorker(unsigned w)
+{
+  rcu::s_instance.pin_current_thread(WorkerCpu(w));
+  rcu::s_instance.fault_region();
+}
+
+unsigned
+bench_loader::WorkerCpu(unsigned w)
+{
+  const unsigned i = (w % coreid::num_cpus_online()) % nthreads;
+  const int cpu = thread_placement::WorkerCpu(i);
+  return cpu >= 0 ? cpu : i;
+}
+
+static size_t
+PickTxn(const bench_worker::workload_desc_vec &workload, double d)
+{
+  for (size_t i = 0; i + 1 < workload.size(); i++) {
+    if (d < workload[i].frequency)
+      return i;
+    d -= workload[i].frequency;
+  }
+  return workload.size() - 1;
+}
+
 void
 bench_worker::run()
 {
@@ -115,61 +287,255 @@ bench_worker::run()
     scoped_rcu_region r; // register this thread in rcu region
   }
   on_run_setup();
+  // outlives ctx, since thread_end() can touch the coroutines' txn buffers
+  vector<unique_ptr<txn_coroutine>> coroutines;
   scoped_db_thread_ctx ctx(db, false);
   const workload_desc_vec workload = get_workload();
   txn_counts.resize(workload.size());
+  txn_latencies.resize(workload.size());
+  if (!worker_id)
+    for (size_t i = 0; i < workload.size(); i++)
+      txn_tracer::NameTxnType(i, workload[i].name);
+  if (perf_counters) {
+    if (perf_ctrs.open())
+      txn_perf.resize(workload.size());
+    else if (!worker_id)
+      cerr << "[WARNING] could not open hardware counters "
+           << "(is perf_event_paranoid too high?)" << endl;
+  }
+  while (interleave_txns > 1 && coroutines.size() < interleave_txns) {
+    txn_coroutine * const c = new_txn_coroutine();
+    if (!c)
+      break;
+    coroutines.emplace_back(c);
+  }
   barrier_a->count_down();
   barrier_b->wait_for();
+  if (!coroutines.empty()) {
+    run_interleaved(workload, coroutines);
+    return;
+  }
+  if (replay) {
+    run_replay(workload);
+    return;
+  }
+  // in an open loop, txns are scheduled at the offered rate whether or not
+  // the ones before them are done, and their latency is from when they were
+  // scheduled. so a stall shows up in the latency of every txn it held up,
+  // instead of in fewer txns being measured (coordinated omission)
+  const double interarrival_us =
+    open_loop_rate > 0.0 ? 1e6 * double(nthreads) / open_loop_rate : 0.0;
+  fast_random arrivals(worker_id);
+  // staggered, so evenly spaced arrivals don't come in bursts over workers
+  double next_arrival_us =
+    double(timer::cur_usec()) + arrivals.next_uniform() * interarrival_us;
   while (running && (run_mode != RUNMODE_OPS || ntxn_commits < ops_per_worker)) {
-    double d = r.next_uniform();
-    for (size_t i = 0; i < workload.size(); i++) {
-      if ((i + 1) == workload.size() || d < workload[i].frequency) {
-      retry:
-        timer t;
-        const unsigned long old_seed = r.get_seed();
-        const auto ret = workload[i].fn(this);
-        if (likely(ret.first)) {
-          ++ntxn_commits;
-          latency_numer_us += t.lap();
-          backoff_shifts >>= 1;
-        } else {
-          ++ntxn_aborts;
-          if (retry_aborted_transaction && running) {
-            if (backoff_aborted_transaction) {
-              if (backoff_shifts < 63)
-                backoff_shifts++;
-              uint64_t spins = 1UL << backoff_shifts;
-              spins *= 100; // XXX: tuned pretty arbitrarily
-              evt_avg_abort_spins.offer(spins);
-              while (spins) {
-                nop_pause();
-                spins--;
-              }
-            }
-            r.set_seed(old_seed);
-            goto retry;
-          }
+    uint64_t scheduled_us = 0;
+    if (interarrival_us > 0.0) {
+      scheduled_us = uint64_t(next_arrival_us);
+      next_arrival_us += poisson_arrivals ?
+        -log(1.0 - arrivals.next_uniform()) * interarrival_us :
+        interarrival_us;
+      WaitUntilUsec(scheduled_us);
+    }
+    const size_t i = PickTxn(workload, r.next_uniform());
+    if (workload_trace::IsCapturing())
+      trace_writer.add(scheduled_us ? scheduled_us : timer::cur_usec(),
+                       r.get_seed(), worker_id, i);
+    run_txn(workload, i, scheduled_us);
+  }
+  trace_writer.flush();
+}
+
+void
+bench_worker::run_txn(const workload_desc_vec &workload, size_t i,
+                      uint64_t scheduled_us)
+{
+retry:
+  timer t;
+  uint64_t ctrs_before[perf_counter_group::NCounters];
+  if (perf_ctrs.is_open())
+    perf_ctrs.read(ctrs_before);
+  const unsigned long old_seed = r.get_seed();
+  txn_tracer::SetTxnType(i);
+  const auto ret = workload[i].fn(this);
+  if (perf_ctrs.is_open())
+    measure_perf_counters(ctrs_before, &i, 1);
+  if (likely(ret.first)) {
+    ++ntxn_commits;
+    const uint64_t us = scheduled_us ?
+      timer::cur_usec() - scheduled_us : t.lap();
+    latency_numer_us += us;
+    txn_latencies[i].offer(us);
+    backoff_shifts >>= 1;
+  } else {
+    ++ntxn_aborts;
+    if (retry_aborted_transaction && running) {
+      if (!db->before_txn_retry() && backoff_aborted_transaction) {
+        if (backoff_shifts < 63)
+          backoff_shifts++;
+        uint64_t spins = 1UL << backoff_shifts;
+        spins *= 100; // XXX: tuned pretty arbitrarily
+        evt_avg_abort_spins.offer(spins);
+        while (spins) {
+          nop_pause();
+          spins--;
         }
-        size_delta += ret.second; // should be zero on abort
-        txn_counts[i]++; // txn_counts aren't used to compute throughput (is
-                         // just an informative number to print to the console
-                         // in verbose mode)
-        break;
       }
-      d -= workload[i].frequency;
+      r.set_seed(old_seed);
+      goto retry;
+    }
+  }
+  size_delta += ret.second; // should be zero on abort
+  txn_counts[i]++; // txn_counts aren't used to compute throughput (is
+                   // just an informative number to print to the console
+                   // in verbose mode)
+}
+
+void
+bench_worker::run_replay(const workload_desc_vec &workload)
+{
+  // a txn starts at its recorded arrival, scaled by replay_speed, and its
+  // latency is from then (as in an open loop), so a replay which falls behind
+  // the trace shows it in its latencies
+  const uint64_t start_us = timer::cur_usec();
+  for (auto &rec : *replay) {
+    if (!running)
+      break;
+    ALWAYS_ASSERT(rec.txn_type_ < workload.size());
+    uint64_t scheduled_us = 0;
+    if (replay_speed > 0.0) {
+      scheduled_us = start_us + uint64_t(double(rec.arrival_us_) / replay_speed);
+      WaitUntilUsec(scheduled_us);
     }
+    r.set_seed(rec.seed_);
+    run_txn(workload, rec.txn_type_, scheduled_us);
   }
 }
 
+void
+bench_worker::run_interleaved(
+    const workload_desc_vec &workload,
+    vector<unique_ptr<txn_coroutine>> &coroutines)
+{
+  // the txns are interleaved in groups, and a group finishes before the next
+  // one starts: an active txn holds an RCU region, so overlapping the groups
+  // would keep this thread from ever leaving one
+  vector<size_t> txn_types(coroutines.size());
+  vector<bool> done(coroutines.size());
+  uint64_t ctrs_before[perf_counter_group::NCounters];
+  while (running && (run_mode != RUNMODE_OPS || ntxn_commits < ops_per_worker)) {
+    timer t;
+    if (perf_ctrs.is_open())
+      perf_ctrs.read(ctrs_before);
+    for (size_t j = 0; j < coroutines.size(); j++) {
+      txn_types[j] = PickTxn(workload, r.next_uniform());
+      txn_tracer::SetTxnType(txn_types[j]);
+      coroutines[j]->start(workload[txn_types[j]].fn);
+      done[j] = false;
+    }
+    for (size_t nrunning = coroutines.size(); nrunning;)
+      for (size_t j = 0; j < coroutines.size(); j++)
+        if (!done[j]) {
+          txn_tracer::SetTxnType(txn_types[j]);
+          if (coroutines[j]->resume())
+            continue;
+          done[j] = true;
+          nrunning--;
+        }
+    // each txn took as long as its group
+    const uint64_t us = t.lap();
+    if (perf_ctrs.is_open())
+      measure_perf_counters(ctrs_before, &txn_types[0], txn_types.size());
+    for (size_t j = 0; j < coroutines.size(); j++) {
+      const auto ret = coroutines[j]->result();
+      if (likely(ret.first)) {
+        ++ntxn_commits;
+        latency_numer_us += us;
+        txn_latencies[txn_types[j]].offer(us);
+      } else {
+        ++ntxn_aborts;
+      }
+      size_delta += ret.second;
+      txn_counts[txn_types[j]]++;
+    }
+  }
+}
+
+string
+bench_runner::memory_report() const
+{
+  ostringstream o;
+  uint64_t total_bytes = 0;
+  for (auto &p : open_tables) {
+    map<string, uint64_t> s;
+    {
+      scoped_rcu_region guard;
+      s = p.second->memory_stats();
+    }
+    if (s.empty()) {
+      o << "table " << p.first << ": no memory stats" << endl;
+      continue;
+    }
+    const uint64_t bytes =
+      s["node_bytes"] + s["tuple_bytes"] + s["version_chain_bytes"];
+    total_bytes += bytes;
+    o << "table " << p.first << ": " << bytes << " bytes, "
+      << s["keys"] << " keys" << endl;
+    o << "  nodes by depth:";
+    for (size_t d = 0; s.count("internal_nodes_depth_" + to_string(d)) ||
+                       s.count("leaf_nodes_depth_" + to_string(d)); d++) {
+      o << " " << d << "=";
+      const auto it = s.find("internal_nodes_depth_" + to_string(d));
+      if (it != s.end())
+        o << it->second << "i";
+      const auto it1 = s.find("leaf_nodes_depth_" + to_string(d));
+      if (it1 != s.end())
+        o << (it != s.end() ? "+" : "") << it1->second << "l";
+    }
+    o << endl;
+    o << "  node bytes: " << s["node_bytes"] << ", leaf fill factor: "
+      << (s["leaf_key_slots"] ? 100.0 * double(s["keys"] + s["layers"]) / double(s["leaf_key_slots"]) : 0.0)
+      << "%, layers: " << s["layers"] << endl;
+    o << "  tuple bytes: " << s["tuple_bytes"] << " (" << s["tuples"]
+      << " tuples, " << s["record_bytes"] << " record bytes, "
+      << s["tuple_slack_bytes"] << " slack)" << endl;
+    o << "  version chain bytes: " << s["version_chain_bytes"] << " ("
+      << s["old_versions"] << " old versions)" << endl;
+    if (s.count("point_index_buckets"))
+      o << "  point index buckets: " << s["point_index_buckets"] << endl;
+  }
+  o << "all tables: " << total_bytes << " bytes" << endl;
+  // the arenas are only in use with --numa-memory
+  const size_t arena_bytes = ::allocator::ArenaBytesInUse();
+  if (arena_bytes) {
+    o << "allocator arena bytes in use: " << arena_bytes;
+    if (arena_bytes >= total_bytes)
+      o << " (" << (arena_bytes - total_bytes) << " not in tables, "
+        << (100.0 * double(arena_bytes - total_bytes) / double(arena_bytes))
+        << "%)";
+    o << endl;
+  }
+  return o.str();
+}
+
 void
 bench_runner::run()
 {
-  // load data
-  const vector<bench_loader *> loaders = make_loaders();
+  // load data, or recover it from the log files (and checkpoint) of a
+  // previous run
+  const bool do_recover =
+    !recover_logfiles.empty() || !recover_checkpoint_dir.empty();
+  const vector<bench_loader *> loaders =
+    do_recover ? vector<bench_loader *>() : make_loaders();
   {
-    spin_barrier b(loaders.size());
     const pair<uint64_t, uint64_t> mem_info_before = get_system_memory_info();
-    {
+    if (do_recover) {
+      scoped_timer t("recovery", verbose);
+      ALWAYS_ASSERT(db->recover(recover_logfiles, recover_checkpoint_dir,
+                                recover_log_compress, open_tables));
+    } else {
+      spin_barrier b(loaders.size());
       scoped_timer t("dataloading", verbose);
       for (vector<bench_loader *>::const_iterator it = loaders.begin();
           it != loaders.end(); ++it) {
@@ -197,9 +563,12 @@ bench_runner::run()
       cerr << persisted_info << " txns persisted in loading phase" << endl;
   }
   db->reset_ntxn_persisted();
+  // for stats_client, while the tables are in use
+  stats_server::SetMemoryReportFn([this]() { return memory_report(); });
 
   if (!no_reset_counters) {
     event_counter::reset_all_counters(); // XXX: for now - we really should have a before/after loading
+    event_histogram::reset_all_histograms();
     PERF_EXPR(scopedperf::perfsum_base::resetall());
   }
   {
@@ -226,16 +595,96 @@ bench_runner::run()
 
   const pair<uint64_t, uint64_t> mem_info_before = get_system_memory_info();
 
+  if (!checkpoint_dir.empty())
+    ALWAYS_ASSERT(db->start_checkpointer(
+          checkpoint_dir, checkpoint_interval,
+          checkpoint_max_bytes_per_sec, open_tables, checkpoint_image,
+          checkpoint_max_deltas));
+
   const vector<bench_worker *> workers = make_workers();
   ALWAYS_ASSERT(!workers.empty());
+  vector<workload_trace::record_vec> replay_slots;
+  if (!replay_trace.empty()) {
+    const size_t nrecorded =
+      workload_trace::Split(replay_trace, workers.size(), replay_slots);
+    workload_trace::record_vec().swap(replay_trace);
+    if (nrecorded != workers.size())
+      cerr << "[WARNING] replaying the txns of " << nrecorded
+           << " workers on " << workers.size() << endl;
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i]->set_replay(&replay_slots[i]);
+  }
+  const vector<bench_worker *> analytic_workers =
+    nanalytic ? make_analytic_workers() : vector<bench_worker *>();
+  ALWAYS_ASSERT(analytic_workers.size() == nanalytic);
   for (vector<bench_worker *>::const_iterator it = workers.begin();
        it != workers.end(); ++it)
     (*it)->start();
+  for (auto w : analytic_workers)
+    w->start();
 
   barrier_a.wait_for(); // wait for all threads to start up
   timer t, t_nosync;
   barrier_b.count_down(); // bombs away!
-  if (run_mode == RUNMODE_TIME) {
+  // commits, aborts, persisted txns and memory, every sample_interval_ms.
+  // the workers' counts are read as they run: they are only ever
+  // incremented, by their worker, and reading a word is atomic
+  vector<run_sample> samples;
+  atomic<bool> sampling(sample_interval_ms > 0);
+  thread sampler_thd;
+  if (sampling.load())
+    sampler_thd = thread([&]() {
+      const uint64_t start_us = timer::cur_usec();
+      const uint64_t free_before = get_system_memory_info().first;
+      uint64_t last_us = start_us, last_commits = 0, last_aborts = 0,
+               last_persisted = 0;
+      for (uint64_t next_us = start_us + sample_interval_ms * 1000;
+           sampling.load(memory_order_acquire);
+           next_us += sample_interval_ms * 1000) {
+        uint64_t now;
+        while ((now = timer::cur_usec()) < next_us &&
+               sampling.load(memory_order_acquire))
+          usleep(min(next_us - now, uint64_t(10000)));
+        if (now < next_us)
+          break; // the last interval is cut short, so not sampled
+        uint64_t commits = 0, aborts = 0;
+        for (auto w : workers) {
+          commits += w->get_ntxn_commits();
+          aborts += w->get_ntxn_aborts();
+        }
+        const uint64_t persisted = get<0>(db->get_ntxn_persisted());
+        run_sample s;
+        s.t_sec = double(now - start_us) / 1000000.0;
+        s.dt_sec = double(now - last_us) / 1000000.0;
+        s.ncommits = commits - last_commits;
+        s.naborts = aborts - last_aborts;
+        s.npersisted = persisted - last_persisted;
+        s.memory_mb =
+          (double(free_before) - double(get_system_memory_info().first)) / 1048576.0;
+        samples.push_back(s);
+        last_us = now;
+        last_commits = commits;
+        last_aborts = aborts;
+        last_persisted = persisted;
+      }
+    });
+  // an online backup, taken while the workers run
+  thread backup_thd;
+  if (!backup_file.empty())
+    backup_thd = thread([this]() {
+      const int fd = open(backup_file.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+      if (fd == -1) {
+        perror("open");
+        ALWAYS_ASSERT(false);
+      }
+      scoped_timer t("backup", verbose);
+      ALWAYS_ASSERT(db->backup(fd, checkpoint_max_bytes_per_sec, open_tables));
+      if (fsync(fd) == -1)
+        perror("fsync");
+      close(fd);
+    });
+  // a replay runs until its workers are out of txns
+  if (run_mode == RUNMODE_TIME && replay_slots.empty()) {
     sleep(runtime);
     running = false;
   }
@@ -243,6 +692,20 @@ bench_runner::run()
   for (size_t i = 0; i < nthreads; i++)
     workers[i]->join();
   const unsigned long elapsed_nosync = t_nosync.lap();
+  sampling.store(false, memory_order_release);
+  if (sampler_thd.joinable())
+    sampler_thd.join();
+  // they would go on forever with RUNMODE_OPS
+  running = false;
+  __sync_synchronize();
+  size_t n_analytic_commits = 0;
+  for (auto w : analytic_workers) {
+    w->join();
+    n_analytic_commits += w->get_ntxn_commits();
+  }
+  if (backup_thd.joinable())
+    backup_thd.join();
+  db->stop_checkpointer();
   db->do_txn_finish(); // waits for all worker txns to persist
   size_t n_commits = 0;
   size_t n_aborts = 0;
@@ -254,6 +717,18 @@ bench_runner::run()
   }
   const auto persisted_info = db->get_ntxn_persisted();
 
+  map<string, histogram_data> agg_txn_latencies;
+  for (size_t i = 0; i < nthreads; i++)
+    for (auto &p : workers[i]->get_txn_latencies())
+      agg_txn_latencies[p.first] += p.second;
+  histogram_data agg_latencies;
+  for (auto &p : agg_txn_latencies)
+    agg_latencies += p.second;
+  // included in the latencies by txn type, but not in the overall ones
+  for (auto w : analytic_workers)
+    for (auto &p : w->get_txn_latencies())
+      agg_txn_latencies[p.first] += p.second;
+
   const unsigned long elapsed = t.lap(); // lap() must come after do_txn_finish(),
                                          // because do_txn_finish() potentially
                                          // waits a bit
@@ -287,6 +762,36 @@ bench_runner::run()
   const double avg_persist_latency_ms =
     get<2>(persisted_info) / 1000.0;
 
+  // steady state: the samples after warmup
+  const size_t nwarmup = WarmupSamples(samples);
+  const double warmup_sec = nwarmup ? samples[nwarmup - 1].t_sec : 0.0;
+  double steady_sec = 0.0, steady_throughput = 0.0, steady_abort_rate = 0.0,
+         steady_persist_throughput = 0.0, steady_min_throughput = 0.0,
+         steady_throughput_cv = 0.0;
+  if (nwarmup < samples.size()) {
+    uint64_t ncommits = 0, naborts = 0, npersisted = 0;
+    double sum = 0.0, sumsq = 0.0;
+    steady_min_throughput = numeric_limits<double>::infinity();
+    for (size_t i = nwarmup; i < samples.size(); i++) {
+      steady_sec += samples[i].dt_sec;
+      ncommits += samples[i].ncommits;
+      naborts += samples[i].naborts;
+      npersisted += samples[i].npersisted;
+      sum += samples[i].throughput();
+      sumsq += samples[i].throughput() * samples[i].throughput();
+      steady_min_throughput = min(steady_min_throughput, samples[i].throughput());
+    }
+    steady_throughput = double(ncommits) / steady_sec;
+    steady_abort_rate = double(naborts) / steady_sec;
+    steady_persist_throughput = double(npersisted) / steady_sec;
+    // of the throughput over intervals, unweighted: dips from reaping or
+    // fsyncs show up here, and not in the means
+    const double m = double(samples.size() - nwarmup);
+    const double mean = sum / m;
+    if (mean > 0.0)
+      steady_throughput_cv = sqrt(max(sumsq / m - mean * mean, 0.0)) / mean;
+  }
+
   if (verbose) {
     const pair<uint64_t, uint64_t> mem_info_after = get_system_memory_info();
     const int64_t delta = int64_t(mem_info_before.first) - int64_t(mem_info_after.first); // free mem
@@ -297,8 +802,17 @@ bench_runner::run()
       map_agg(agg_txn_counts, workers[i]->get_txn_counts());
       size_delta += workers[i]->get_size_delta();
     }
+    for (auto w : analytic_workers)
+      map_agg(agg_txn_counts, w->get_txn_counts());
+    size_t arena_nstrs = 0, arena_nbytes = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+      const str_arena &a = workers[i]->get_arena();
+      arena_nstrs = max(arena_nstrs, a.nstrs_high_water_mark());
+      arena_nbytes = max(arena_nbytes, a.nbytes_high_water_mark());
+    }
     const double size_delta_mb = double(size_delta)/1048576.0;
     map<string, counter_data> ctrs = event_counter::get_all_counters();
+    map<string, histogram_data> hists = event_histogram::get_all_histograms();
 
     cerr << "--- table statistics ---" << endl;
     for (map<string, abstract_ordered_index *>::iterator it = open_tables.begin();
@@ -332,19 +846,69 @@ bench_runner::run()
     cerr << "logical memory delta rate: " << (size_delta_mb / elapsed_sec) << " MB/sec" << endl;
     cerr << "agg_nosync_throughput: " << agg_nosync_throughput << " ops/sec" << endl;
     cerr << "avg_nosync_per_core_throughput: " << avg_nosync_per_core_throughput << " ops/sec/core" << endl;
+    if (open_loop_rate > 0.0)
+      cerr << "offered_throughput: " << open_loop_rate << " ops/sec ("
+           << (poisson_arrivals ? "poisson" : "constant") << " arrivals)" << endl;
     cerr << "agg_throughput: " << agg_throughput << " ops/sec" << endl;
     cerr << "avg_per_core_throughput: " << avg_per_core_throughput << " ops/sec/core" << endl;
     cerr << "agg_persist_throughput: " << agg_persist_throughput << " ops/sec" << endl;
     cerr << "avg_per_core_persist_throughput: " << avg_per_core_persist_throughput << " ops/sec/core" << endl;
     cerr << "avg_latency: " << avg_latency_ms << " ms" << endl;
     cerr << "avg_persist_latency: " << avg_persist_latency_ms << " ms" << endl;
+    if (nanalytic)
+      cerr << "agg_analytic_throughput: "
+           << (double(n_analytic_commits) / elapsed_sec) << " ops/sec" << endl;
     cerr << "agg_abort_rate: " << agg_abort_rate << " aborts/sec" << endl;
     cerr << "avg_per_core_abort_rate: " << avg_per_core_abort_rate << " aborts/sec/core" << endl;
+    if (!samples.empty()) {
+      cerr << "--- steady state (" << samples.size() << " samples, "
+           << nwarmup << " of them warmup) ---" << endl;
+      cerr << "warmup: " << warmup_sec << " sec" << endl;
+      cerr << "steady_throughput: " << steady_throughput << " ops/sec" << endl;
+      cerr << "steady_min_throughput: " << steady_min_throughput << " ops/sec" << endl;
+      cerr << "steady_throughput_cv: " << steady_throughput_cv << endl;
+      cerr << "steady_abort_rate: " << steady_abort_rate << " aborts/sec" << endl;
+      cerr << "steady_persist_throughput: " << steady_persist_throughput << " ops/sec" << endl;
+      cerr << "throughput by interval (ops/sec):";
+      for (auto &s : samples)
+        cerr << " " << s.throughput();
+      cerr << endl;
+    }
     cerr << "txn breakdown: " << format_list(agg_txn_counts.begin(), agg_txn_counts.end()) << endl;
+    cerr << "--- txn latencies (usec, committed txns) ---" << endl;
+    for (auto &p : agg_txn_latencies)
+      if (p.second.count_)
+        cerr << p.first << ": " << LatencyPercentiles(p.second) << endl;
+    cerr << "all: " << LatencyPercentiles(agg_latencies) << endl;
+    if (perf_counters) {
+      map<string, bench_worker::txn_perf_data> agg_txn_perf;
+      for (size_t i = 0; i < workers.size(); i++)
+        for (auto &p : workers[i]->get_txn_perf())
+          agg_txn_perf[p.first] += p.second;
+      cerr << "--- hardware counters (user space, per txn attempt) ---" << endl;
+      for (auto &p : agg_txn_perf) {
+        if (!p.second.nattempts)
+          continue;
+        cerr << p.first << ": attempts=" << p.second.nattempts;
+        for (size_t c = 0; c < perf_counter_group::NCounters; c++)
+          cerr << ", " << perf_counter_group::Name(c) << "="
+               << double(p.second.ctrs[c]) / double(p.second.nattempts);
+        cerr << endl;
+      }
+    }
+    cerr << "max arena usage per txn: " << arena_nstrs << " strings, "
+         << arena_nbytes << " bytes" << endl;
     cerr << "--- system counters (for benchmark) ---" << endl;
     for (map<string, counter_data>::iterator it = ctrs.begin();
          it != ctrs.end(); ++it)
       cerr << it->first << ": " << it->second << endl;
+    cerr << "--- gauges (by core) ---" << endl;
+    for (auto &p : event_gauge::get_all_gauges())
+      cerr << p.first << ": " << format_list(p.second.begin(), p.second.end()) << endl;
+    cerr << "--- latency histograms (usec, for benchmark) ---" << endl;
+    for (auto &p : hists)
+      if (p.second.count_)
+        cerr << p.first << ": " << p.second << endl;
     cerr << "--- perf counters (if enabled, for benchmark) ---" << endl;
     PERF_EXPR(scopedperf::perfsum_base::printall());
     cerr << "--- allocator stats ---" << endl;
@@ -362,12 +926,119 @@ bench_runner::run()
 #endif
   }
 
-  // output for plotting script
+  if (print_memory_report)
+    cerr << "--- memory by table ---" << endl << memory_report();
+  stats_server::SetMemoryReportFn(nullptr);
+
+  if (!json_output_file.empty()) {
+    map<string, size_t> agg_txn_counts;
+    for (auto w : workers)
+      map_agg(agg_txn_counts, w->get_txn_counts());
+    for (auto w : analytic_workers)
+      map_agg(agg_txn_counts, w->get_txn_counts());
+    const map<string, counter_data> ctrs = event_counter::get_all_counters();
+
+    // one object a line, so repeated runs can append to the same file
+    ofstream ofs(json_output_file.c_str(), ofstream::app);
+    ofs.precision(12);
+    ofs << "{\"config\": {";
+    for (auto it = bench_config.begin(); it != bench_config.end(); ++it)
+      ofs << (it == bench_config.begin() ? "" : ", ")
+          << JsonStr(it->first) << ": " << JsonStr(it->second);
+    ofs << "}";
+    ofs << ", \"runtime_sec\": " << elapsed_sec;
+    ofs << ", \"nworkers\": " << workers.size();
+    ofs << ", \"ncommits\": " << n_commits;
+    ofs << ", \"naborts\": " << n_aborts;
+    ofs << ", \"agg_throughput\": " << agg_throughput;
+    ofs << ", \"avg_per_core_throughput\": " << avg_per_core_throughput;
+    ofs << ", \"agg_nosync_throughput\": " << agg_nosync_throughput;
+    ofs << ", \"agg_abort_rate\": " << agg_abort_rate;
+    if (nanalytic)
+      ofs << ", \"agg_analytic_throughput\": " << (double(n_analytic_commits) / elapsed_sec);
+    // the ABORT_REASON_ counters only count with ENABLE_EVENT_COUNTERS
+    ofs << ", \"abort_rates\": {";
+    bool first = true;
+    for (auto &p : ctrs) {
+      if (p.first.compare(0, 13, "ABORT_REASON_") || p.first == "ABORT_REASON_NONE")
+        continue;
+      ofs << (first ? "" : ", ") << JsonStr(p.first) << ": "
+          << (double(p.second.count_) / elapsed_sec);
+      first = false;
+    }
+    ofs << "}";
+    ofs << ", \"persistence\": {\"agg_persist_throughput\": " << agg_persist_throughput
+        << ", \"ntxns_persisted\": " << get<0>(persisted_info)
+        << ", \"avg_persist_latency_ms\": " << avg_persist_latency_ms
+        << "}";
+    ofs << ", \"latency\": " << LatencyPercentilesJson(agg_latencies);
+    if (!samples.empty()) {
+      ofs << ", \"steady_state\": {\"nwarmup_samples\": " << nwarmup
+          << ", \"warmup_sec\": " << warmup_sec
+          << ", \"runtime_sec\": " << steady_sec
+          << ", \"agg_throughput\": " << steady_throughput
+          << ", \"min_throughput\": " << steady_min_throughput
+          << ", \"throughput_cv\": " << steady_throughput_cv
+          << ", \"agg_abort_rate\": " << steady_abort_rate
+          << ", \"agg_persist_throughput\": " << steady_persist_throughput
+          << "}";
+      // columns, a row per interval
+      ofs << ", \"timeseries\": {\"interval_ms\": " << sample_interval_ms;
+      ofs << ", \"t_sec\": [";
+      for (size_t i = 0; i < samples.size(); i++)
+        ofs << (i ? ", " : "") << samples[i].t_sec;
+      ofs << "], \"throughput\": [";
+      for (size_t i = 0; i < samples.size(); i++)
+        ofs << (i ? ", " : "") << samples[i].throughput();
+      ofs << "], \"abort_rate\": [";
+      for (size_t i = 0; i < samples.size(); i++)
+        ofs << (i ? ", " : "") << (double(samples[i].naborts) / samples[i].dt_sec);
+      ofs << "], \"persist_throughput\": [";
+      for (size_t i = 0; i < samples.size(); i++)
+        ofs << (i ? ", " : "") << (double(samples[i].npersisted) / samples[i].dt_sec);
+      ofs << "], \"memory_mb\": [";
+      for (size_t i = 0; i < samples.size(); i++)
+        ofs << (i ? ", " : "") << samples[i].memory_mb;
+      ofs << "]}";
+    }
+    ofs << ", \"txns\": {";
+    first = true;
+    for (auto &p : agg_txn_counts) {
+      auto it = agg_txn_latencies.find(p.first);
+      ofs << (first ? "" : ", ") << JsonStr(p.first) << ": {\"ncommits\": " << p.second
+          << ", \"latency\": "
+          << LatencyPercentilesJson(it == agg_txn_latencies.end() ? histogram_data() : it->second)
+          << "}";
+      first = false;
+    }
+    ofs << "}";
+    ofs << ", \"counters\": {";
+    first = true;
+    for (auto &p : ctrs) {
+      ofs << (first ? "" : ", ") << JsonStr(p.first) << ": {\"count\": " << p.second.count_;
+      if (p.second.type_ == counter_data::TYPE_AGG)
+        ofs << ", \"sum\": " << p.second.sum_ << ", \"max\": " << p.second.max_;
+      ofs << "}";
+      first = false;
+    }
+    ofs << "}}" << endl;
+    if (!ofs)
+      cerr << "[ERROR] could not write results to " << json_output_file << endl;
+  }
+
+  // output for plotting script: the first line is the aggregates, followed
+  // by the commit latency percentiles (msec) over all txns. then a line per
+  // txn type: its name, # of commits, and latency percentiles
   cout << agg_throughput << " "
        << agg_persist_throughput << " "
        << avg_latency_ms << " "
        << avg_persist_latency_ms << " "
-       << agg_abort_rate << endl;
+       << agg_abort_rate << " "
+       << LatencyPercentilesMs(agg_latencies) << endl;
+  for (auto &p : agg_txn_latencies)
+    cout << p.first << " "
+         << p.second.count_ << " "
+         << LatencyPercentilesMs(p.second) << endl;
   cout.flush();
 
   if (!slow_exit)
@@ -388,6 +1059,7 @@ bench_runner::run()
 
   delete_pointers(loaders);
   delete_pointers(workers);
+  delete_pointers(analytic_workers);
 }
 
 template <typename K, typename V>
@@ -417,6 +1089,40 @@ bench_worker::measure_txn_counters(void *txn, const char *txn_name)
 }
 #endif
 
+void
+bench_worker::measure_perf_counters(
+    const uint64_t *before, const size_t *txn_types, size_t ntxns)
+{
+  uint64_t after[perf_counter_group::NCounters];
+  perf_ctrs.read(after);
+  for (size_t j = 0; j < ntxns; j++) {
+    txn_perf_data &d = txn_perf[txn_types[j]];
+    d.nattempts++;
+    for (size_t c = 0; c < perf_counter_group::NCounters; c++)
+      d.ctrs[c] += (after[c] - before[c]) / ntxns;
+  }
+}
+
+map<string, bench_worker::txn_perf_data>
+bench_worker::get_txn_perf() const
+{
+  map<string, txn_perf_data> m;
+  const workload_desc_vec workload = get_workload();
+  for (size_t i = 0; i < txn_perf.size(); i++)
+    m[workload[i].name] = txn_perf[i];
+  return m;
+}
+
+map<string, histogram_data>
+bench_worker::get_txn_latencies() const
+{
+  map<string, histogram_data> m;
+  const workload_desc_vec workload = get_workload();
+  for (size_t i = 0; i < txn_latencies.size(); i++)
+    m[workload[i].name] = txn_latencies[i];
+  return m;
+}
+
 map<string, size_t>
 bench_worker::get_txn_counts() const
 {
@@ -4,12 +4,16 @@
 #include <stdint.h>
 
 #include <map>
+#include <memory>
 #include <vector>
 #include <utility>
 #include <string>
 
 #include "abstract_db.h"
+#include "workload_trace.h"
+#include "../counter.h"
 #include "../macros.h"
+#include "../perf_counters.h"
 #include "../thread.h"
 #include "../util.h"
 #include "../spinbarrier.h"
@@ -20,6 +24,8 @@ extern void tpcc_do_test(abstract_db *db, int argc, char **argv);
 extern void queue_do_test(abstract_db *db, int argc, char **argv);
 extern void encstress_do_test(abstract_db *db, int argc, char **argv);
 extern void bid_do_test(abstract_db *db, int argc, char **argv);
+extern void smallbank_do_test(abstract_db *db, int argc, char **argv);
+extern void tatp_do_test(abstract_db *db, int argc, char **argv);
 
 enum {
   RUNMODE_TIME = 0,
@@ -41,6 +47,26 @@ extern int slow_exit;
 extern int retry_aborted_transaction;
 extern int no_reset_counters;
 extern int backoff_aborted_transaction;
+extern size_t interleave_txns; // txns a worker runs at once (see bench_worker::txn_coroutine)
+extern int perf_counters; // sample hardware counters around every txn
+extern double open_loop_rate; // txns/sec offered over all workers, 0 for a closed loop
+extern int poisson_arrivals; // open loop arrivals are poisson, else evenly spaced
+extern std::vector<std::string> recover_logfiles; // if non-empty, recover instead of load
+extern int recover_log_compress;
+extern std::string recover_checkpoint_dir; // if non-empty, recover from it (and the logfiles)
+extern std::string checkpoint_dir; // if non-empty, checkpoint into it while running
+extern uint64_t checkpoint_interval;
+extern uint64_t checkpoint_max_bytes_per_sec;
+extern int checkpoint_image; // checkpoint as images, for fast restarts
+extern size_t checkpoint_max_deltas; // incremental checkpoints between full ones
+extern std::string replay_trace_file; // if non-empty, replay its txns (see workload_trace)
+extern workload_trace::record_vec replay_trace; // its txns, loaded with the options
+extern double replay_speed; // of the replay, relative to the trace. 0 for no waits
+extern uint64_t sample_interval_ms; // of the run's time series, 0 to not sample
+extern std::string backup_file; // if non-empty, back up into it while running
+extern int print_memory_report; // the tables' memory report, at the end of a run
+extern std::string json_output_file; // if non-empty, a line of json results is appended to it
+extern std::map<std::string, std::string> bench_config; // the run's settings, for the json results
 
 class scoped_db_thread_ctx {
 public:
@@ -65,7 +91,7 @@ class bench_loader : public ndb_thread {
 public:
   bench_loader(unsigned long seed, abstract_db *db,
                const std::map<std::string, abstract_ordered_index *> &open_tables)
-    : r(seed), db(db), open_tables(open_tables), b(0)
+    : r(seed), db(db), open_tables(open_tables), b(0), home_worker(-1)
   {
     txn_obj_buf.reserve(str_arena::MinStrReserveLength);
     txn_obj_buf.resize(db->sizeof_txn_object(txn_flags));
@@ -76,6 +102,26 @@ public:
     ALWAYS_ASSERT(!this->b);
     this->b = &b;
   }
+
+  // with --pin-cpus, the loader runs where the w-th worker will (see
+  // PinToWorker()) from the start, so what it loads for that worker is
+  // allocated from, and first touched on, its numa node. -1 (the default)
+  // leaves the loader unpinned
+  inline void
+  set_home_worker(int w)
+  {
+    home_worker = w;
+  }
+
+  // pins the calling thread, and its allocator arenas, to the cpu the w-th
+  // worker made by make_workers() pins itself to in on_run_setup()
+  static void PinToWorker(unsigned w);
+
+  // the cpu of the worker with id w. worker ids start at a block aligned to
+  // ncpus, so that is the ((w % ncpus) % nthreads)-th worker's cpu in the
+  // placement plan (see thread_placement), or that number itself without one
+  static unsigned WorkerCpu(unsigned w);
+
   virtual void
   run()
   {
@@ -85,6 +131,8 @@ public:
     ALWAYS_ASSERT(b);
     b->count_down();
     b->wait_for();
+    if (pin_cpus && home_worker >= 0)
+      PinToWorker(home_worker);
     scoped_db_thread_ctx ctx(db, true);
     load();
   }
@@ -97,6 +145,7 @@ protected:
   abstract_db *const db;
   std::map<std::string, abstract_ordered_index *> open_tables;
   spin_barrier *b;
+  int home_worker;
   std::string txn_obj_buf;
   str_arena arena;
 };
@@ -116,6 +165,7 @@ public:
       ntxn_commits(0), ntxn_aborts(0),
       latency_numer_us(0),
       backoff_shifts(0), // spin between [0, 2^backoff_shifts) times before retry
+      replay(nullptr),
       size_delta(0)
   {
     txn_obj_buf.reserve(str_arena::MinStrReserveLength);
@@ -143,8 +193,39 @@ public:
   typedef std::vector<workload_desc> workload_desc_vec;
   virtual workload_desc_vec get_workload() const = 0;
 
+  /**
+   * A txn run as a stackless coroutine, so a worker can interleave several
+   * txns on its thread (see --interleave-txns): resume() runs the txn until
+   * it issues a prefetch it would otherwise stall on, so the txns' cache
+   * misses overlap instead of being taken one at a time.
+   *
+   * Interleaved txns which abort are not retried
+   */
+  class txn_coroutine {
+  public:
+    virtual ~txn_coroutine() {}
+    // begins the txn fn (from get_workload()) would run
+    virtual void start(txn_fn_t fn) = 0;
+    // returns false once the txn is done
+    virtual bool resume() = 0;
+    virtual txn_result result() const = 0;
+  };
+
+  // workers whose txns can be interleaved return a new coroutine per call,
+  // each with its own txn object and arena. by default, txns are run to
+  // completion one at a time
+  virtual txn_coroutine *new_txn_coroutine() { return nullptr; }
+
   virtual void run();
 
+  // instead of drawing its txns, the worker runs recs (from
+  // workload_trace::Split()) in order, and stops after the last one
+  inline void
+  set_replay(const workload_trace::record_vec *recs)
+  {
+    replay = recs;
+  }
+
   inline size_t get_ntxn_commits() const { return ntxn_commits; }
   inline size_t get_ntxn_aborts() const { return ntxn_aborts; }
 
@@ -158,6 +239,32 @@ public:
 
   std::map<std::string, size_t> get_txn_counts() const;
 
+  // latencies (usec) of the committed txns, by txn type
+  std::map<std::string, histogram_data> get_txn_latencies() const;
+
+  // hardware counters (see perf_counter_group), summed over the attempts
+  // (commits and aborts) of a txn type. interleaved txns split their
+  // group's counts evenly
+  struct txn_perf_data {
+    txn_perf_data() : nattempts(0)
+    {
+      NDB_MEMSET(&ctrs[0], 0, sizeof(ctrs));
+    }
+    inline txn_perf_data &
+    operator+=(const txn_perf_data &that)
+    {
+      nattempts += that.nattempts;
+      for (size_t c = 0; c < perf_counter_group::NCounters; c++)
+        ctrs[c] += that.ctrs[c];
+      return *this;
+    }
+    uint64_t nattempts;
+    uint64_t ctrs[perf_counter_group::NCounters];
+  };
+
+  // empty unless perf_counters
+  std::map<std::string, txn_perf_data> get_txn_perf() const;
+
   typedef abstract_db::counter_map counter_map;
   typedef abstract_db::txn_counter_map txn_counter_map;
 
@@ -171,10 +278,18 @@ public:
 
   inline ssize_t get_size_delta() const { return size_delta; }
 
+  inline const str_arena &get_arena() const { return arena; }
+
 protected:
 
   virtual void on_run_setup() {}
 
+  void run_interleaved(
+      const workload_desc_vec &workload,
+      std::vector<std::unique_ptr<txn_coroutine>> &coroutines);
+
+  void run_replay(const workload_desc_vec &workload);
+
   inline void *txn_buf() { return (void *) txn_obj_buf.data(); }
 
   unsigned int worker_id;
@@ -186,10 +301,23 @@ protected:
   spin_barrier *const barrier_b;
 
 private:
+  // runs workload[i] (retrying it, if retry_aborted_transaction) and accounts
+  // for it. an open loop txn's latency is from scheduled_us, if non-zero
+  void run_txn(const workload_desc_vec &workload, size_t i,
+               uint64_t scheduled_us);
+
+  // adds the counts since before (read by perf_ctrs.read()) to the ntxns
+  // txns of txn_types
+  void measure_perf_counters(const uint64_t *before,
+                             const size_t *txn_types, size_t ntxns);
+
   size_t ntxn_commits;
   size_t ntxn_aborts;
   uint64_t latency_numer_us;
   unsigned backoff_shifts;
+  perf_counter_group perf_ctrs; // open()ed by run() if perf_counters
+  const workload_trace::record_vec *replay;
+  workload_trace::writer trace_writer; // if workload_trace::IsCapturing()
 
 protected:
 
@@ -201,6 +329,8 @@ protected:
 #endif
 
   std::vector<size_t> txn_counts; // breakdown of txns
+  std::vector<histogram_data> txn_latencies; // by txn type, like txn_counts
+  std::vector<txn_perf_data> txn_perf; // by txn type, if perf_ctrs.is_open()
   ssize_t size_delta; // how many logical bytes (of values) did the worker add to the DB
 
   std::string txn_obj_buf;
@@ -213,10 +343,17 @@ public:
   bench_runner(bench_runner &&) = delete;
   bench_runner &operator=(const bench_runner &) = delete;
 
-  bench_runner(abstract_db *db)
-    : db(db), barrier_a(nthreads), barrier_b(1) {}
+  // nanalytic workers run beside the nthreads of make_workers() (see
+  // make_analytic_workers())
+  bench_runner(abstract_db *db, size_t nanalytic = 0)
+    : db(db), nanalytic(nanalytic),
+      barrier_a(nthreads + nanalytic), barrier_b(1) {}
   virtual ~bench_runner() {}
   void run();
+
+  // bytes used by every open table (see abstract_ordered_index::memory_stats()),
+  // next to the allocator's. slow: walks every table
+  std::string memory_report() const;
 protected:
   // only called once
   virtual std::vector<bench_loader*> make_loaders() = 0;
@@ -224,7 +361,18 @@ protected:
   // only called once
   virtual std::vector<bench_worker*> make_workers() = 0;
 
+  // only called once, if nanalytic. these workers (nanalytic of them, with
+  // barrier_a and barrier_b) run for as long as the others do, but their
+  // txns are reported apart from the throughput of the others, so that
+  // shows what they cost the others
+  virtual std::vector<bench_worker*>
+  make_analytic_workers()
+  {
+    return std::vector<bench_worker*>();
+  }
+
   abstract_db *const db;
+  const size_t nanalytic;
   std::map<std::string, abstract_ordered_index *> open_tables;
 
   // barriers for actual benchmark execution
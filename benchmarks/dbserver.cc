@@ -0,0 +1,195 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../allocator.h"
+#include "../stats_server.h"
+#include "bench.h"
+#include "ndb_wrapper.h"
+#include "ndb_wrapper_impl.h"
+#include "rpc_server.h"
+
+using namespace std;
+using namespace util;
+
+/**
+ * Serves a key/value table over rpc_server (see rpc_server.h for the wire
+ * protocol), with the procedures below. Requests are run by --num-threads
+ * workers, and replies are sent once the txn is durable (right away when
+ * running without --logfile)
+ */
+enum kv_procedure : uint16_t {
+  // arg is the key. reply is the value, or empty (with status ABORTED) if
+  // there is none
+  KV_GET = 0,
+  // arg is a uint32_t key length, then the key, then the value. no reply
+  KV_PUT = 1,
+  // arg is the key. no reply
+  KV_REMOVE = 2,
+};
+
+static bool
+SplitPutArg(const string &arg, string &k, string &v)
+{
+  uint32_t klen;
+  if (arg.size() < sizeof(klen))
+    return false;
+  memcpy(&klen, arg.data(), sizeof(klen));
+  if (arg.size() - sizeof(klen) < klen)
+    return false;
+  k.assign(arg.data() + sizeof(klen), klen);
+  v.assign(arg.data() + sizeof(klen) + klen, arg.size() - sizeof(klen) - klen);
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned port = 7878;
+  size_t max_batch = 32;
+  unsigned max_retries = 16;
+  int nofsync = 0;
+  int async_fsync = 0;
+  uint64_t group_commit_us = 0;
+  vector<string> logfiles;
+  vector<vector<unsigned>> assignments;
+  string stats_server_sockfile;
+  while (1) {
+    static struct option long_options[] =
+    {
+      {"verbose"                    , no_argument       , &verbose                   , 1}   ,
+      {"pin-cpus"                   , no_argument       , &pin_cpus                  , 1}   ,
+      {"num-threads"                , required_argument , 0                          , 't'} ,
+      {"port"                       , required_argument , 0                          , 'p'} ,
+      {"batch-size"                 , required_argument , 0                          , 'b'} , // requests per worker dispatch
+      {"max-retries"                , required_argument , 0                          , 'r'} ,
+      {"logfile"                    , required_argument , 0                          , 'l'} ,
+      {"assignment"                 , required_argument , 0                          , 'a'} ,
+      {"log-nofsync"                , no_argument       , &nofsync                   , 1}   ,
+      {"log-async-fsync"            , no_argument       , &async_fsync               , 1}   ,
+      {"log-group-commit-us"        , required_argument , 0                          , 'G'} , // 0 to group commit by epoch
+      {"stats-server-sockfile"      , required_argument , 0                          , 'x'} ,
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "t:p:b:r:l:a:G:x:", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case 't':
+      nthreads = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(nthreads > 0);
+      break;
+
+    case 'p':
+      port = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'b':
+      max_batch = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(max_batch > 0);
+      break;
+
+    case 'r':
+      max_retries = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'l':
+      logfiles.emplace_back(optarg);
+      break;
+
+    case 'a':
+      assignments.emplace_back(
+          ParseCSVString<unsigned, RangeAwareParser<unsigned>>(optarg));
+      break;
+
+    case 'G':
+      group_commit_us = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'x':
+      stats_server_sockfile = optarg;
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+
+  if (group_commit_us && logfiles.empty()) {
+    cerr << "[ERROR] --log-group-commit-us specified without logging enabled" << endl;
+    return 1;
+  }
+
+  abstract_db * const db = new ndb_wrapper<transaction_proto2>(
+      logfiles, assignments, !nofsync, false, false,
+      0, async_fsync, group_commit_us, 0, false, false,
+      vector<string>(), 0, false, false, 0, 0, 0);
+#ifdef PROTO2_CAN_DISABLE_GC
+  transaction_proto2_static::InitGC();
+#endif
+
+  if (!stats_server_sockfile.empty()) {
+    stats_server *srvr = new stats_server(stats_server_sockfile);
+    thread(&stats_server::serve_forever, srvr).detach();
+  }
+
+  abstract_ordered_index * const tbl = db->open_index("kv", 128);
+
+  // registered in kv_procedure order, so the ids match
+  procedure_registry procs;
+  procedure_registry::procedure_desc get_desc("kv_get",
+      [tbl](void *txn, const string &arg, string &reply, str_arena &arena) {
+        return tbl->get(txn, arg, reply);
+      });
+  get_desc.max_keys_ = 1;
+  ALWAYS_ASSERT(procs.add(get_desc) == KV_GET);
+  procedure_registry::procedure_desc put_desc("kv_put",
+      [tbl](void *txn, const string &arg, string &reply, str_arena &arena) {
+        string &k = *arena.next();
+        string &v = *arena.next();
+        if (!SplitPutArg(arg, k, v))
+          return false;
+        tbl->put(txn, k, v);
+        return true;
+      });
+  put_desc.max_keys_ = 1;
+  ALWAYS_ASSERT(procs.add(put_desc) == KV_PUT);
+  procedure_registry::procedure_desc remove_desc("kv_remove",
+      [tbl](void *txn, const string &arg, string &reply, str_arena &arena) {
+        tbl->remove(txn, arg);
+        return true;
+      });
+  remove_desc.max_keys_ = 1;
+  ALWAYS_ASSERT(procs.add(remove_desc) == KV_REMOVE);
+
+  rpc_server srv(db, procs, nthreads, max_batch, max_retries, pin_cpus);
+
+  if (verbose) {
+    cerr << "settings:" << endl;
+    cerr << "  num-threads : " << nthreads    << endl;
+    cerr << "  port        : " << port        << endl;
+    cerr << "  batch-size  : " << max_batch   << endl;
+    cerr << "  max-retries : " << max_retries << endl;
+    cerr << "  logfiles    : " << logfiles    << endl;
+  }
+
+  srv.serve_forever(port);
+  return 0;
+}
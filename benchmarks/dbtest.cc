@@ -13,6 +13,14 @@
 
 #include "../allocator.h"
 #include "../stats_server.h"
+#include "../abort_sampler.h"
+#include "../access_sampler.h"
+#include "../cold_store.h"
+#include "../queue_lock.h"
+#include "../thread_placement.h"
+#include "../tuple.h"
+#include "../txn_replication.h"
+#include "../txn_tracer.h"
 #include "bench.h"
 #include "bdb_wrapper.h"
 #include "ndb_wrapper.h"
@@ -66,25 +74,69 @@ main(int argc, char **argv)
   string basedir = curdir;
   string bench_opts;
   size_t numa_memory = 0;
+  size_t reclaim_high_water = 0;
+  size_t rcu_garbage_cap = 0;
+  int rcu_quiescent_state = 0;
   free(curdir);
   int saw_run_spec = 0;
   int nofsync = 0;
   int do_compress = 0;
   int fake_writes = 0;
+  int async_fsync = 0;
+  uint64_t group_commit_us = 0;
+  size_t ncompress_threads = 0;
+  int log_numa_aware = 0;
+  int topology_placement = 0;
+  int log_dax = 0;
+  int log_coalesce_writes = 0;
+  int log_compact = 0;
+  uint64_t epoch_us = 0;
+  uint64_t epoch_adaptive_max_us = 0;
+  uint64_t epoch_adaptive_target = 10000;
+  int park_idle_ticker = 0;
   int disable_gc = 0;
+  size_t gc_threads = 0;
+  int contention_mgr = 0;
+  int hot_record_locking = 0;
+  int queue_locks = 0;
+  uint64_t abort_sample_one_in = 0;
+  uint64_t access_sample_one_in = 0;
+  uint64_t txn_trace_one_in = 0;
+  string txn_trace_file = "txn_trace.bin";
+  string workload_trace_file;
+  size_t max_version_chain_length = 0;
+  string cold_tier_file;
+  uint64_t cold_tier_sweep_ms = 1000;
+  int cold_tier_compress = 0;
+  unsigned tuple_prefetch_distance = tuple_prefetcher::g_distance.load();
+  size_t early_validation_reads = 0;
   int disable_snapshots = 0;
   vector<string> logfiles;
+  size_t log_segment_size = 0;
+  size_t log_buffer_size = 0;
+  size_t log_buffer_budget = 0;
+  size_t log_admission_lag_epochs = 0;
+  vector<string> log_standbys;
+  size_t log_standby_quorum = 0;
+  unsigned standby_port = 0;
   vector<vector<unsigned>> assignments;
   string stats_server_sockfile;
+  unsigned stats_http_port = 0;
   while (1) {
     static struct option long_options[] =
     {
       {"verbose"                    , no_argument       , &verbose                   , 1}   ,
       {"parallel-loading"           , no_argument       , &enable_parallel_loading   , 1}   ,
       {"pin-cpus"                   , no_argument       , &pin_cpus                  , 1}   ,
+      {"topology-placement"         , no_argument       , &topology_placement        , 1}   , // with --pin-cpus, see thread_placement
       {"slow-exit"                  , no_argument       , &slow_exit                 , 1}   ,
       {"retry-aborted-transactions" , no_argument       , &retry_aborted_transaction , 1}   ,
+      {"perf-counters"              , no_argument       , &perf_counters             , 1}   , // per txn type
+      {"poisson-arrivals"           , no_argument       , &poisson_arrivals          , 1}   , // with --open-loop-rate
       {"backoff-aborted-transactions" , no_argument     , &backoff_aborted_transaction , 1}   ,
+      {"contention-manager"         , no_argument       , &contention_mgr            , 1}   ,
+      {"hot-record-locking"         , no_argument       , &hot_record_locking        , 1}   ,
+      {"queue-locks"                , no_argument       , &queue_locks               , 1}   , // queue waiters on contended locks
       {"bench"                      , required_argument , 0                          , 'b'} ,
       {"scale-factor"               , required_argument , 0                          , 's'} ,
       {"num-threads"                , required_argument , 0                          , 't'} ,
@@ -95,19 +147,69 @@ main(int argc, char **argv)
       {"ops-per-worker"             , required_argument , 0                          , 'n'} ,
       {"bench-opts"                 , required_argument , 0                          , 'o'} ,
       {"numa-memory"                , required_argument , 0                          , 'm'} , // implies --pin-cpus
+      {"reclaim-high-water-mark"    , required_argument , 0                          , 'W'} , // needs --numa-memory
+      {"rcu-garbage-cap"            , required_argument , 0                          , 'g'} , // per core
+      {"rcu-quiescent-state"        , no_argument       , &rcu_quiescent_state       , 1}   ,
       {"logfile"                    , required_argument , 0                          , 'l'} ,
       {"assignment"                 , required_argument , 0                          , 'a'} ,
       {"log-nofsync"                , no_argument       , &nofsync                   , 1}   ,
       {"log-compress"               , no_argument       , &do_compress               , 1}   ,
       {"log-fake-writes"            , no_argument       , &fake_writes               , 1}   ,
+      {"log-async-fsync"            , no_argument       , &async_fsync               , 1}   ,
+      {"log-numa-aware"             , no_argument       , &log_numa_aware            , 1}   ,
+      {"log-dax"                    , no_argument       , &log_dax                   , 1}   ,
+      {"log-coalesce-writes"        , no_argument       , &log_coalesce_writes       , 1}   ,
+      {"log-compact"                , no_argument       , &log_compact               , 1}   , // version 2 log format
+      {"log-compress-threads"       , required_argument , 0                          , 'P'} ,
+      {"log-group-commit-us"        , required_argument , 0                          , 'G'} , // 0 to group commit by epoch
+      {"log-segment-size"           , required_argument , 0                          , 'S'} , // MB, 0 to not segment
+      {"log-buffer-size"            , required_argument , 0                          , 'e'} , // KB, 0 for the default
+      {"log-buffer-budget"          , required_argument , 0                          , 'Y'} , // MB over all cores, 0 for none
+      {"log-admission-lag-epochs"   , required_argument , 0                          , 'X'} , // throttle past this lag, 0 to not
+      {"log-standby"                , required_argument , 0                          , 'y'} , // host:port
+      {"log-standby-quorum"         , required_argument , 0                          , 'q'} , // 0 for all standbys
+      {"standby-port"               , required_argument , 0                          , 'w'} , // run as a standby first
+      {"recover-logfile"            , required_argument , 0                          , 'R'} ,
+      {"recover-log-compress"       , no_argument       , &recover_log_compress      , 1}   ,
+      {"recover-checkpoint-dir"     , required_argument , 0                          , 'K'} ,
+      {"checkpoint-dir"             , required_argument , 0                          , 'C'} ,
+      {"checkpoint-interval"        , required_argument , 0                          , 'I'} , // seconds
+      {"checkpoint-max-mbps"        , required_argument , 0                          , 'M'} , // MB/sec, 0 for unlimited
+      {"checkpoint-image"           , no_argument       , &checkpoint_image          , 1}   , // mmappable, bulk loaded on recovery
+      {"checkpoint-max-deltas"      , required_argument , 0                          , 'z'} , // incremental ones between full ones
+      {"backup-file"                , required_argument , 0                          , 'k'} , // restore with backup_restore
+      {"epoch-us"                   , required_argument , 0                          , 'E'} , // 0 for the default
+      {"epoch-adaptive-max-us"      , required_argument , 0                          , 'U'} , // 0 to not adapt
+      {"epoch-adaptive-target"      , required_argument , 0                          , 'T'} , // txns per epoch
+      {"park-idle-ticker"           , no_argument       , &park_idle_ticker          , 1}   , // stop ticking while idle
       {"disable-gc"                 , no_argument       , &disable_gc                , 1}   ,
+      {"gc-threads"                 , required_argument , 0                          , 'N'} , // 0 for workers to reap inline
       {"disable-snapshots"          , no_argument       , &disable_snapshots         , 1}   ,
       {"stats-server-sockfile"      , required_argument , 0                          , 'x'} ,
+      {"stats-http-port"            , required_argument , 0                          , 'H'} , // prometheus scrapes
+      {"abort-sample-one-in"        , required_argument , 0                          , 'A'} , // 0 to not sample
+      {"access-sample-one-in"       , required_argument , 0                          , 'u'} , // 0 to not sample
+      {"txn-trace-one-in"           , required_argument , 0                          , 'j'} , // 0 to not trace
+      {"txn-trace-file"             , required_argument , 0                          , 'J'} ,
+      {"workload-trace-file"        , required_argument , 0                          , 'c'} , // captures the txns run into it
+      {"replay-trace-file"          , required_argument , 0                          , 'p'} , // runs its txns instead
+      {"replay-speed"               , required_argument , 0                          , 'h'} , // 1 as recorded, 0 for no waits
+      {"sample-interval-ms"         , required_argument , 0                          , 'v'} , // of the time series, 0 to not sample
       {"no-reset-counters"          , no_argument       , &no_reset_counters         , 1}   ,
+      {"memory-report"              , no_argument       , &print_memory_report       , 1}   , // by table, at the end
+      {"max-version-chain-length"   , required_argument , 0                          , 'L'} , // 0 for unbounded
+      {"cold-tier-file"             , required_argument , 0                          , 'F'} , // evicts unread tuples here
+      {"cold-tier-sweep-ms"         , required_argument , 0                          , 'Z'} , // between sweeps of the cold tier
+      {"cold-tier-compress"         , no_argument       , &cold_tier_compress        , 1}   , // keep cold values lz4'd in memory
+      {"tuple-prefetch-distance"    , required_argument , 0                          , 'D'} , // on scans, 0 to never prefetch
+      {"early-validation-reads"     , required_argument , 0                          , 'V'} , // 0 to only validate at commit
+      {"interleave-txns"            , required_argument , 0                          , 'i'} , // txns per worker at once
+      {"open-loop-rate"             , required_argument , 0                          , 'O'} , // txns/sec, 0 for a closed loop
+      {"json-output"                , required_argument , 0                          , 'Q'} , // appends a line of results
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "b:s:t:d:B:f:r:n:o:m:l:a:x:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "b:s:t:d:B:f:r:n:o:m:l:a:x:H:R:K:C:I:M:S:e:Y:X:N:G:P:E:U:T:y:q:w:A:u:j:J:c:p:h:v:i:O:L:W:g:Q:F:Z:k:D:V:z:", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -172,6 +274,14 @@ main(int argc, char **argv)
       }
       break;
 
+    case 'W':
+      reclaim_high_water = parse_memory_spec(optarg);
+      break;
+
+    case 'g':
+      rcu_garbage_cap = parse_memory_spec(optarg);
+      break;
+
     case 'l':
       logfiles.emplace_back(optarg);
       break;
@@ -185,6 +295,162 @@ main(int argc, char **argv)
       stats_server_sockfile = optarg;
       break;
 
+    case 'H':
+      stats_http_port = strtoul(optarg, nullptr, 10);
+      ALWAYS_ASSERT(stats_http_port > 0 && stats_http_port < 65536);
+      break;
+
+    case 'R':
+      recover_logfiles.emplace_back(optarg);
+      break;
+
+    case 'S':
+      log_segment_size = strtoul(optarg, NULL, 10) * 1048576;
+      break;
+
+    case 'e':
+      log_buffer_size = strtoul(optarg, NULL, 10) * 1024;
+      break;
+
+    case 'Y':
+      log_buffer_budget = strtoul(optarg, NULL, 10) * 1048576;
+      break;
+
+    case 'X':
+      log_admission_lag_epochs = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'N':
+      gc_threads = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'P':
+      ncompress_threads = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'G':
+      group_commit_us = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'K':
+      recover_checkpoint_dir = optarg;
+      break;
+
+    case 'C':
+      checkpoint_dir = optarg;
+      break;
+
+    case 'I':
+      checkpoint_interval = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(checkpoint_interval > 0);
+      break;
+
+    case 'L':
+      max_version_chain_length = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'i':
+      interleave_txns = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(interleave_txns > 0);
+      break;
+
+    case 'O':
+      open_loop_rate = strtod(optarg, NULL);
+      ALWAYS_ASSERT(open_loop_rate >= 0.0);
+      break;
+
+    case 'Q':
+      json_output_file = optarg;
+      break;
+
+    case 'F':
+      cold_tier_file = optarg;
+      break;
+
+    case 'Z':
+      cold_tier_sweep_ms = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(cold_tier_sweep_ms > 0);
+      break;
+
+    case 'D':
+      tuple_prefetch_distance = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'V':
+      early_validation_reads = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'k':
+      backup_file = optarg;
+      break;
+
+    case 'M':
+      checkpoint_max_bytes_per_sec = strtoul(optarg, NULL, 10) * 1048576;
+      break;
+
+    case 'z':
+      checkpoint_max_deltas = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'y':
+      log_standbys.emplace_back(optarg);
+      break;
+
+    case 'q':
+      log_standby_quorum = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'w':
+      standby_port = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(standby_port > 0 && standby_port < 65536);
+      break;
+
+    case 'E':
+      epoch_us = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'A':
+      abort_sample_one_in = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'u':
+      access_sample_one_in = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'j':
+      txn_trace_one_in = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'J':
+      txn_trace_file = optarg;
+      break;
+
+    case 'c':
+      workload_trace_file = optarg;
+      break;
+
+    case 'p':
+      replay_trace_file = optarg;
+      break;
+
+    case 'h':
+      replay_speed = strtod(optarg, NULL);
+      ALWAYS_ASSERT(replay_speed >= 0.0);
+      break;
+
+    case 'v':
+      sample_interval_ms = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'U':
+      epoch_adaptive_max_us = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'T':
+      epoch_adaptive_target = strtoul(optarg, NULL, 10);
+      ALWAYS_ASSERT(epoch_adaptive_target > 0);
+      break;
+
     case '?':
       /* getopt_long already printed an error message. */
       exit(1);
@@ -204,6 +470,10 @@ main(int argc, char **argv)
     test_fn = encstress_do_test;
   else if (bench_type == "bid")
     test_fn = bid_do_test;
+  else if (bench_type == "smallbank")
+    test_fn = smallbank_do_test;
+  else if (bench_type == "tatp")
+    test_fn = tatp_do_test;
   else
     ALWAYS_ASSERT(false);
 
@@ -212,6 +482,41 @@ main(int argc, char **argv)
     return 1;
   }
 
+  if (log_numa_aware && logfiles.empty()) {
+    cerr << "[ERROR] --log-numa-aware specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_dax && logfiles.empty()) {
+    cerr << "[ERROR] --log-dax specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_coalesce_writes && logfiles.empty()) {
+    cerr << "[ERROR] --log-coalesce-writes specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_compact && logfiles.empty()) {
+    cerr << "[ERROR] --log-compact specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_coalesce_writes && do_compress) {
+    cerr << "[ERROR] --log-coalesce-writes and --log-compress are mutually exclusive" << endl;
+    return 1;
+  }
+
+  if (log_dax && async_fsync) {
+    cerr << "[ERROR] --log-dax and --log-async-fsync are mutually exclusive" << endl;
+    return 1;
+  }
+
+  if (ncompress_threads && !do_compress) {
+    cerr << "[ERROR] --log-compress-threads specified without --log-compress" << endl;
+    return 1;
+  }
+
   if (fake_writes && logfiles.empty()) {
     cerr << "[ERROR] --log-fake-writes specified without logging enabled" << endl;
     return 1;
@@ -222,14 +527,189 @@ main(int argc, char **argv)
     return 1;
   }
 
+  if (async_fsync && logfiles.empty()) {
+    cerr << "[ERROR] --log-async-fsync specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (async_fsync && (nofsync || fake_writes)) {
+    cerr << "[WARNING] --log-async-fsync has no effect with --log-nofsync or --log-fake-writes enabled" << endl;
+  }
+
+  if (!log_standbys.empty() && logfiles.empty()) {
+    cerr << "[ERROR] --log-standby specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (!log_standbys.empty() && async_fsync) {
+    cerr << "[ERROR] --log-standby and --log-async-fsync are mutually exclusive" << endl;
+    return 1;
+  }
+
+  if (open_loop_rate > 0.0 && interleave_txns > 1) {
+    cerr << "[ERROR] --open-loop-rate and --interleave-txns are mutually exclusive" << endl;
+    return 1;
+  }
+
+  if ((!workload_trace_file.empty() || !replay_trace_file.empty()) &&
+      interleave_txns > 1) {
+    cerr << "[ERROR] workload traces are not supported with --interleave-txns" << endl;
+    return 1;
+  }
+
+  if (!replay_trace_file.empty() &&
+      (open_loop_rate > 0.0 || !workload_trace_file.empty())) {
+    cerr << "[ERROR] --replay-trace-file is mutually exclusive with --open-loop-rate and --workload-trace-file" << endl;
+    return 1;
+  }
+
+  if (!replay_trace_file.empty() &&
+      !workload_trace::Load(replay_trace_file, replay_trace))
+    return 1;
+
+  if (poisson_arrivals && open_loop_rate <= 0.0) {
+    cerr << "[ERROR] --poisson-arrivals specified without --open-loop-rate" << endl;
+    return 1;
+  }
+
+  if (log_standby_quorum > log_standbys.size()) {
+    cerr << "[ERROR] --log-standby-quorum is larger than the # of standbys" << endl;
+    return 1;
+  }
+
+  if (standby_port && recover_logfiles.empty()) {
+    cerr << "[ERROR] --standby-port specified without --recover-logfile" << endl;
+    return 1;
+  }
+
+  if (group_commit_us && logfiles.empty()) {
+    cerr << "[ERROR] --log-group-commit-us specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (topology_placement && !pin_cpus) {
+    cerr << "[ERROR] --topology-placement specified without --pin-cpus" << endl;
+    return 1;
+  }
+
+  // before the loggers, GC threads and workers it places are started
+  if (topology_placement) {
+    thread_placement::Plan(nthreads, logfiles.size(), gc_threads);
+    ticker::SetCpu(thread_placement::TickerCpu());
+    cerr << "--- thread placement ---" << endl << thread_placement::Describe();
+  }
+
+  // the ticker is already running, but no txns have run yet
+  if (epoch_adaptive_max_us)
+    ticker::SetAdaptiveTickUsec(
+        epoch_us ? epoch_us : ticker::MinTickUsec,
+        epoch_adaptive_max_us, epoch_adaptive_target);
+  else if (epoch_us)
+    ticker::SetTickUsec(epoch_us);
+  if (park_idle_ticker)
+    ticker::SetIdleParking(true);
+  // nor any rcu regions
+  rcu::SetQuiescentStateMode(rcu_quiescent_state);
+
+  if (group_commit_us >= ticker::TickUsec()) {
+    cerr << "[WARNING] --log-group-commit-us is not shorter than an epoch ("
+         << ticker::TickUsec() << " us)" << endl;
+  }
+
+  if (log_segment_size && logfiles.empty()) {
+    cerr << "[ERROR] --log-segment-size specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_buffer_size && logfiles.empty()) {
+    cerr << "[ERROR] --log-buffer-size specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_buffer_size && log_buffer_size < 2 * txn_logger::g_horizon_buffer_size) {
+    cerr << "[ERROR] --log-buffer-size must be at least "
+         << 2 * txn_logger::g_horizon_buffer_size / 1024 << " KB" << endl;
+    return 1;
+  }
+
+  if (log_buffer_budget && logfiles.empty()) {
+    cerr << "[ERROR] --log-buffer-budget specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_buffer_budget &&
+      log_buffer_budget < 2 * nthreads * (sizeof(txn_logger::pbuffer) +
+        (log_buffer_size ? log_buffer_size : txn_logger::g_default_buffer_size))) {
+    cerr << "[ERROR] --log-buffer-budget must fit two log buffers per thread" << endl;
+    return 1;
+  }
+
+  if (log_admission_lag_epochs && logfiles.empty()) {
+    cerr << "[ERROR] --log-admission-lag-epochs specified without logging enabled" << endl;
+    return 1;
+  }
+
+  if (log_admission_lag_epochs >= txn_logger::g_max_lag_epochs) {
+    cerr << "[ERROR] --log-admission-lag-epochs must be less than "
+         << txn_logger::g_max_lag_epochs << endl;
+    return 1;
+  }
+
+  if (recover_log_compress && recover_logfiles.empty()) {
+    cerr << "[ERROR] --recover-log-compress specified without --recover-logfile" << endl;
+    return 1;
+  }
+
+  for (auto &f : recover_logfiles)
+    if (find(logfiles.begin(), logfiles.end(), f) != logfiles.end()) {
+      cerr << "[ERROR] cannot recover from logfile " << f
+           << " which is also being logged to" << endl;
+      return 1;
+    }
+
+  if (!checkpoint_dir.empty() && checkpoint_dir == recover_checkpoint_dir) {
+    cerr << "[ERROR] cannot recover from checkpoint dir " << checkpoint_dir
+         << " which is also being checkpointed into" << endl;
+    return 1;
+  }
+
+  if (!checkpoint_dir.empty() && disable_snapshots) {
+    cerr << "[ERROR] --checkpoint-dir requires snapshots" << endl;
+    return 1;
+  }
+
+  if (checkpoint_image && checkpoint_max_deltas) {
+    cerr << "[ERROR] image checkpoints cannot be incremental" << endl;
+    return 1;
+  }
+
+  if (!backup_file.empty() && disable_snapshots) {
+    cerr << "[ERROR] --backup-file requires snapshots" << endl;
+    return 1;
+  }
+
   if (fake_writes && nofsync) {
     cerr << "[WARNING] --log-nofsync has no effect with --log-fake-writes enabled" << endl;
   }
 
+  // in every build, event counters or not
+  if (standby_port) {
+    // receive the primary's log into the files we are about to recover
+    // from, until it goes away
+    txn_log_receiver receiver(standby_port, recover_logfiles, !nofsync);
+    cerr << "standby listening on port " << standby_port << endl;
+    receiver.wait_for_primary();
+    cerr << "primary went away at persistent epoch "
+         << receiver.persistent_epoch() << ", taking over" << endl;
+  }
+
 #ifndef ENABLE_EVENT_COUNTERS
   if (!stats_server_sockfile.empty()) {
     cerr << "[WARNING] --stats-server-sockfile with no event counters enabled is useless" << endl;
   }
+  if (stats_http_port) {
+    cerr << "[WARNING] --stats-http-port with no event counters enabled is useless" << endl;
+  }
 #endif
 
   // initialize the numa allocator
@@ -238,7 +718,9 @@ main(int argc, char **argv)
         numa_memory / nthreads, ::allocator::GetHugepageSize());
     numa_memory = maxpercpu * nthreads;
     ::allocator::Initialize(nthreads, maxpercpu);
+    ::allocator::SetReclaimHighWaterMark(reclaim_high_water);
   }
+  rcu::SetGarbageCap(rcu_garbage_cap);
 
   const set<string> can_persist({"ndb-proto2"});
   if (!logfiles.empty() && !can_persist.count(db_type)) {
@@ -246,6 +728,72 @@ main(int argc, char **argv)
          << " does not have persistence implemented" << endl;
     return 1;
   }
+  if ((!recover_logfiles.empty() || !recover_checkpoint_dir.empty() ||
+       !checkpoint_dir.empty() || !backup_file.empty()) &&
+      !can_persist.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have recovery or checkpointing implemented" << endl;
+    return 1;
+  }
+
+  if (contention_mgr && !retry_aborted_transaction) {
+    cerr << "[ERROR] --contention-manager specified without --retry-aborted-transactions" << endl;
+    return 1;
+  }
+
+  const set<string> has_contention_mgr({"ndb-proto1", "ndb-proto2"});
+  if (contention_mgr && !has_contention_mgr.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have a contention manager" << endl;
+    return 1;
+  }
+  if (hot_record_locking && !has_contention_mgr.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have hot record locking" << endl;
+    return 1;
+  }
+  if (abort_sample_one_in && !has_contention_mgr.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have abort sampling" << endl;
+    return 1;
+  }
+  if (access_sample_one_in && !has_contention_mgr.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have access sampling" << endl;
+    return 1;
+  }
+  if ((!cold_tier_file.empty() || cold_tier_compress) &&
+      !has_contention_mgr.count(db_type)) {
+    cerr << "[ERROR] benchmark " << db_type
+         << " does not have a cold tier" << endl;
+    return 1;
+  }
+
+  // before any txns run
+  if (contention_mgr)
+    contention_manager::Enable();
+  if (hot_record_locking)
+    contention_manager::EnableHotLocking();
+  if (abort_sample_one_in)
+    abort_sampler::Enable(abort_sample_one_in);
+  if (access_sample_one_in)
+    access_sampler::Enable(access_sample_one_in);
+  if (txn_trace_one_in)
+    txn_tracer::Enable(txn_trace_one_in, txn_trace_file);
+  if (!workload_trace_file.empty())
+    workload_trace::Open(workload_trace_file);
+  if (queue_locks)
+    queue_lock::SetEnabled(true);
+  tuple_prefetcher::g_distance.store(tuple_prefetch_distance);
+  transaction_base::g_early_validation_reads.store(early_validation_reads);
+  if (!cold_tier_file.empty() || cold_tier_compress)
+    cold_store::Init(cold_tier_file, cold_tier_sweep_ms * 1000, 0,
+                     cold_tier_compress);
+
+  if (gc_threads && (db_type != "ndb-proto2" || disable_gc)) {
+    cerr << "[ERROR] --gc-threads needs ndb-proto2 with gc enabled" << endl;
+    return 1;
+  }
 
 #ifdef PROTO2_CAN_DISABLE_GC
   const set<string> has_gc({"ndb-proto1", "ndb-proto2"});
@@ -283,7 +831,12 @@ main(int argc, char **argv)
   } else if (db_type == "ndb-proto1") {
     // XXX: hacky simulation of proto1
     db = new ndb_wrapper<transaction_proto2>(
-        logfiles, assignments, !nofsync, do_compress, fake_writes);
+        logfiles, assignments, !nofsync, do_compress, fake_writes,
+        log_segment_size, async_fsync, group_commit_us,
+        ncompress_threads, log_numa_aware, log_dax,
+        log_standbys, log_standby_quorum, log_coalesce_writes,
+        log_compact, log_buffer_size, log_buffer_budget,
+        log_admission_lag_epochs);
     transaction_proto2_static::set_hack_status(true);
     ALWAYS_ASSERT(transaction_proto2_static::get_hack_status());
 #ifdef PROTO2_CAN_DISABLE_GC
@@ -292,7 +845,12 @@ main(int argc, char **argv)
 #endif
   } else if (db_type == "ndb-proto2") {
     db = new ndb_wrapper<transaction_proto2>(
-        logfiles, assignments, !nofsync, do_compress, fake_writes);
+        logfiles, assignments, !nofsync, do_compress, fake_writes,
+        log_segment_size, async_fsync, group_commit_us,
+        ncompress_threads, log_numa_aware, log_dax,
+        log_standbys, log_standby_quorum, log_coalesce_writes,
+        log_compact, log_buffer_size, log_buffer_budget,
+        log_admission_lag_epochs);
     ALWAYS_ASSERT(!transaction_proto2_static::get_hack_status());
 #ifdef PROTO2_CAN_DISABLE_GC
     if (!disable_gc)
@@ -302,6 +860,19 @@ main(int argc, char **argv)
     if (disable_snapshots)
       transaction_proto2_static::DisableSnapshots();
 #endif
+    transaction_proto2_static::SetMaxVersionChainLength(
+        max_version_chain_length);
+    if (gc_threads) {
+      // on the cpus after the workers'
+      vector<unsigned> gc_cpus;
+      if (topology_placement)
+        for (size_t i = 0; i < gc_threads; i++)
+          gc_cpus.push_back(thread_placement::GCCpu(i));
+      else if (pin_cpus)
+        for (size_t i = 0; i < gc_threads; i++)
+          gc_cpus.push_back((nthreads + i) % coreid::num_cpus_online());
+      transaction_proto2_static::StartGCThreads(gc_threads, gc_cpus);
+    }
   } else if (db_type == "kvdb") {
     db = new kvdb_wrapper<true>;
   } else if (db_type == "kvdb-st") {
@@ -325,6 +896,27 @@ main(int argc, char **argv)
 #endif
 #endif
 
+  if (!json_output_file.empty()) {
+    // what a comparison of results should match runs on
+    ostringstream cmdline;
+    for (int i = 0; i < argc; i++)
+      cmdline << (i ? " " : "") << argv[i];
+    bench_config["cmdline"] = cmdline.str();
+    bench_config["bench"] = bench_type;
+    bench_config["bench-opts"] = bench_opts;
+    bench_config["db-type"] = db_type;
+    bench_config["scale-factor"] = to_string(scale_factor);
+    bench_config["num-threads"] = to_string(nthreads);
+    bench_config["num-cpus"] = to_string(coreid::num_cpus_online());
+    bench_config["txn-flags"] = hexify(txn_flags);
+    if (run_mode == RUNMODE_TIME)
+      bench_config["runtime"] = to_string(runtime);
+    else
+      bench_config["ops-per-worker"] = to_string(ops_per_worker);
+    bench_config["nlogfiles"] = to_string(logfiles.size());
+    bench_config["epoch-us"] = to_string(ticker::TickUsec());
+  }
+
   if (verbose) {
     const unsigned long ncpus = coreid::num_cpus_online();
     cerr << "Database Benchmark:"                           << endl;
@@ -332,9 +924,32 @@ main(int argc, char **argv)
     cerr << "settings:"                                     << endl;
     cerr << "  par-loading : " << enable_parallel_loading   << endl;
     cerr << "  pin-cpus    : " << pin_cpus                  << endl;
+    cerr << "  topology-placement: " << topology_placement << endl;
+    cerr << "  gc-threads  : " << gc_threads                << endl;
     cerr << "  slow-exit   : " << slow_exit                 << endl;
     cerr << "  retry-txns  : " << retry_aborted_transaction << endl;
     cerr << "  backoff-txns: " << backoff_aborted_transaction << endl;
+    cerr << "  interleave-txns: " << interleave_txns << endl;
+    cerr << "  perf-counters: " << perf_counters << endl;
+    cerr << "  open-loop-rate: " << open_loop_rate << endl;
+    if (open_loop_rate > 0.0)
+      cerr << "  poisson-arrivals: " << poisson_arrivals << endl;
+    cerr << "  sample-interval-ms: " << sample_interval_ms << endl;
+    cerr << "  max-version-chain-length: " << max_version_chain_length << endl;
+    cerr << "  contention-manager: " << contention_mgr << endl;
+    cerr << "  hot-record-locking: " << hot_record_locking << endl;
+    cerr << "  queue-locks : " << queue_locks               << endl;
+    cerr << "  abort-sample-one-in: " << abort_sample_one_in << endl;
+    cerr << "  access-sample-one-in: " << access_sample_one_in << endl;
+    cerr << "  txn-trace-one-in: " << txn_trace_one_in << endl;
+    if (txn_trace_one_in)
+      cerr << "  txn-trace-file: " << txn_trace_file << endl;
+    if (!workload_trace_file.empty())
+      cerr << "  workload-trace-file: " << workload_trace_file << endl;
+    if (!replay_trace_file.empty()) {
+      cerr << "  replay-trace-file: " << replay_trace_file << endl;
+      cerr << "  replay-speed: " << replay_speed << endl;
+    }
     cerr << "  bench       : " << bench_type                << endl;
     cerr << "  scale       : " << scale_factor              << endl;
     cerr << "  num-cpus    : " << ncpus                     << endl;
@@ -363,14 +978,42 @@ main(int argc, char **argv)
 #endif
     if (numa_memory > 0) {
       cerr << "  numa-memory : " << numa_memory             << endl;
+      cerr << "  reclaim-high-water-mark : " << reclaim_high_water << endl;
     } else {
       cerr << "  numa-memory : disabled"                    << endl;
     }
+    cerr << "  rcu-garbage-cap : " << rcu_garbage_cap       << endl;
+    cerr << "  rcu-quiescent-state : " << rcu_quiescent_state << endl;
     cerr << "  logfiles : " << logfiles                     << endl;
+    cerr << "  log-segment-size : " << log_segment_size     << endl;
+    cerr << "  log-buffer-size : " << log_buffer_size       << endl;
+    cerr << "  log-buffer-budget : " << log_buffer_budget   << endl;
+    cerr << "  log-admission-lag-epochs : " << log_admission_lag_epochs << endl;
+    cerr << "  log-standbys : " << log_standbys             << endl;
+    cerr << "  log-standby-quorum : " << log_standby_quorum << endl;
+    cerr << "  standby-port : " << standby_port             << endl;
+    cerr << "  recover-logfiles : " << recover_logfiles     << endl;
+    cerr << "  recover-checkpoint-dir : " << recover_checkpoint_dir << endl;
+    cerr << "  checkpoint-dir : " << checkpoint_dir         << endl;
+    cerr << "  checkpoint-interval : " << checkpoint_interval << endl;
+    cerr << "  checkpoint-max-bytes-per-sec : " << checkpoint_max_bytes_per_sec << endl;
+    cerr << "  checkpoint-image : " << checkpoint_image     << endl;
+    cerr << "  checkpoint-max-deltas : " << checkpoint_max_deltas << endl;
+    cerr << "  backup-file : " << backup_file               << endl;
+    cerr << "  cold-tier-file : " << cold_tier_file         << endl;
+    cerr << "  cold-tier-sweep-ms : " << cold_tier_sweep_ms << endl;
+    cerr << "  cold-tier-compress : " << cold_tier_compress << endl;
+    cerr << "  tuple-prefetch-distance : " << tuple_prefetch_distance << endl;
+    cerr << "  early-validation-reads : " << early_validation_reads << endl;
     cerr << "  assignments : " << assignments               << endl;
+    cerr << "  epoch-us : " << ticker::TickUsec()           << endl;
+    cerr << "  epoch-adaptive-max-us : " << epoch_adaptive_max_us << endl;
+    cerr << "  park-idle-ticker : " << park_idle_ticker << endl;
     cerr << "  disable-gc : " << disable_gc                 << endl;
     cerr << "  disable-snapshots : " << disable_snapshots   << endl;
     cerr << "  stats-server-sockfile: " << stats_server_sockfile << endl;
+    cerr << "  stats-http-port : " << stats_http_port << endl;
+    cerr << "  memory-report : " << print_memory_report << endl;
 
     cerr << "system properties:" << endl;
     cerr << "  btree_internal_node_size: " << concurrent_btree::InternalNodeSize() << endl;
@@ -394,6 +1037,8 @@ main(int argc, char **argv)
     stats_server *srvr = new stats_server(stats_server_sockfile);
     thread(&stats_server::serve_forever, srvr).detach();
   }
+  if (stats_http_port)
+    thread(&stats_server::ServeHttpForever, stats_http_port).detach();
 
   vector<string> bench_toks = split_ws(bench_opts);
   int argc = 1 + bench_toks.size();
@@ -402,6 +1047,8 @@ main(int argc, char **argv)
   for (size_t i = 1; i <= bench_toks.size(); i++)
     argv[i] = (char *) bench_toks[i - 1].c_str();
   test_fn(db, argc, argv);
+  txn_tracer::Disable();
+  workload_trace::Close();
   delete db;
   return 0;
 }
@@ -49,6 +49,14 @@ public:
   }
 };
 
+/**
+ * An index straight on a btree, without txns. With UseConcurrencyControl,
+ * each op is atomic on its key: writers lock the record they found, and
+ * those which find it retired (replaced or removed under them) search again.
+ * Records are freed through RCU, so ops must be made in an RCU region, which
+ * the txn of any db they are used from holds (see
+ * abstract_db::open_kv_index())
+ */
 template <bool UseConcurrencyControl>
 class kvdb_ordered_index : public abstract_ordered_index {
 public:
@@ -62,6 +70,11 @@ public:
       void *txn,
       const std::string &key,
       const std::string &value);
+  virtual bool compare_and_put(
+      void *txn,
+      const std::string &key,
+      const std::string *expected,
+      const std::string &value);
   virtual const char *
   insert(void *txn,
          const std::string &key,
@@ -84,6 +97,11 @@ public:
   virtual size_t size() const;
   virtual std::map<std::string, uint64_t> clear();
 private:
+  // with check, only puts if key maps to *expected (is absent if expected
+  // is null). returns whether it put
+  bool do_put(const std::string &key, const std::string &value,
+              bool check, const std::string *expected);
+
   std::string name;
   typedef
     typename std::conditional<
@@ -1,6 +1,8 @@
 #ifndef _KVDB_WRAPPER_IMPL_H_
 #define _KVDB_WRAPPER_IMPL_H_
 
+#include <string.h>
+
 #include <vector>
 #include <limits>
 #include <utility>
@@ -43,6 +45,14 @@ struct record_version {
 
   inline ALWAYS_INLINE void unlock() {}
 
+  inline ALWAYS_INLINE bool
+  is_retired() const
+  {
+    return false;
+  }
+
+  inline ALWAYS_INLINE void retire() {}
+
   static inline ALWAYS_INLINE size_t
   Size(uint32_t v)
   {
@@ -78,15 +88,19 @@ struct record_version {
 // concurrency control version
 template <>
 struct record_version<true> {
-  // [ locked | size  | version ]
-  // [  0..1  | 1..17 | 17..32  ]
+  // [ locked | retired | size  | version ]
+  // [  0..1  |  1..2   | 2..18 | 18..32  ]
 
   static const uint32_t HDR_LOCKED_MASK = 0x1;
 
-  static const uint32_t HDR_SIZE_SHIFT = 1;
+  // set, under the lock, once the record is no longer in the tree (it was
+  // replaced or removed), so writers which found it must search again
+  static const uint32_t HDR_RETIRED_MASK = 0x1 << 1;
+
+  static const uint32_t HDR_SIZE_SHIFT = 2;
   static const uint32_t HDR_SIZE_MASK = std::numeric_limits<uint16_t>::max() << HDR_SIZE_SHIFT;
 
-  static const uint32_t HDR_VERSION_SHIFT = 17;
+  static const uint32_t HDR_VERSION_SHIFT = 18;
   static const uint32_t HDR_VERSION_MASK = ((uint32_t)-1) << HDR_VERSION_SHIFT;
 
   record_version<true>() : hdr(0) {}
@@ -140,6 +154,19 @@ struct record_version<true> {
     hdr = v;
   }
 
+  inline bool
+  is_retired() const
+  {
+    return hdr & HDR_RETIRED_MASK;
+  }
+
+  inline void
+  retire()
+  {
+    INVARIANT(is_locked());
+    hdr |= HDR_RETIRED_MASK;
+  }
+
   static inline size_t
   Size(uint32_t v)
   {
@@ -253,6 +280,14 @@ struct basic_kvdb_record : public record_version<UseConcurrencyControl> {
     }
   }
 
+  inline bool
+  equals(const std::string &s) const
+  {
+    INVARIANT(!UseConcurrencyControl || this->is_locked());
+    return this->size() == s.size() &&
+           !memcmp(&data[0], s.data(), s.size());
+  }
+
   inline bool
   do_write(const std::string &s)
   {
@@ -330,38 +365,72 @@ kvdb_ordered_index<UseConcurrencyControl>::get(
 }
 
 template <bool UseConcurrencyControl>
-const char *
-kvdb_ordered_index<UseConcurrencyControl>::put(
-    void *txn,
+bool
+kvdb_ordered_index<UseConcurrencyControl>::do_put(
     const std::string &key,
-    const std::string &value)
+    const std::string &value,
+    bool check,
+    const std::string *expected)
 {
   typedef basic_kvdb_record<UseConcurrencyControl> kvdb_record;
-  ANON_REGION("kvdb_ordered_index::put:", &private_::kvdb_put_probe0_cg);
-  typename my_btree::value_type v = 0, v_old = 0;
-  if (btr.search(varkey(key), v)) {
-    // easy
+  for (;;) {
+    typename my_btree::value_type v = 0;
+    if (!btr.search(varkey(key), v)) {
+      if (check && expected)
+        return false;
+      kvdb_record * const rnew = kvdb_record::alloc(value);
+      if (btr.insert_if_absent(varkey(key), (typename my_btree::value_type) rnew))
+        return true;
+      // lost to a concurrent insert. nobody saw rnew, so no need for rcu
+      kvdb_record::release_no_rcu(rnew);
+      continue;
+    }
     kvdb_record * const r = (kvdb_record *) v;
     r->prefetch();
     lock_guard<kvdb_record> guard(*r);
+    if (unlikely(r->is_retired()))
+      continue;
+    if (check && (!expected || !r->equals(*expected)))
+      return false;
+    // easy
     if (r->do_write(value))
-      return 0;
+      return true;
     // replace
     kvdb_record * const rnew = kvdb_record::alloc(value);
+    typename my_btree::value_type v_old = 0;
     btr.insert(varkey(key), (typename my_btree::value_type) rnew, &v_old, 0);
     INVARIANT((typename my_btree::value_type) r == v_old);
+    r->retire();
     // rcu-free the old record
     kvdb_record::release(r);
-    return 0;
-  }
-  kvdb_record * const rnew = kvdb_record::alloc(value);
-  if (!btr.insert(varkey(key), (typename my_btree::value_type) rnew, &v_old, 0)) {
-    kvdb_record * const r = (kvdb_record *) v_old;
-    kvdb_record::release(r);
+    return true;
   }
+}
+
+template <bool UseConcurrencyControl>
+const char *
+kvdb_ordered_index<UseConcurrencyControl>::put(
+    void *txn,
+    const std::string &key,
+    const std::string &value)
+{
+  ANON_REGION("kvdb_ordered_index::put:", &private_::kvdb_put_probe0_cg);
+  do_put(key, value, false, nullptr);
   return 0;
 }
 
+template <bool UseConcurrencyControl>
+bool
+kvdb_ordered_index<UseConcurrencyControl>::compare_and_put(
+    void *txn,
+    const std::string &key,
+    const std::string *expected,
+    const std::string &value)
+{
+  ANON_REGION("kvdb_ordered_index::put:", &private_::kvdb_put_probe0_cg);
+  return do_put(key, value, true, expected);
+}
+
 template <bool UseConcurrencyControl>
 const char *
 kvdb_ordered_index<UseConcurrencyControl>::insert(void *txn,
@@ -440,10 +509,20 @@ kvdb_ordered_index<UseConcurrencyControl>::remove(void *txn, const std::string &
 {
   typedef basic_kvdb_record<UseConcurrencyControl> kvdb_record;
   ANON_REGION("kvdb_ordered_index::remove:", &private_::kvdb_remove_probe0_cg);
-  typename my_btree::value_type v = 0;
-  if (btr.remove(varkey(key), &v)) {
+  for (;;) {
+    typename my_btree::value_type v = 0;
+    if (!btr.search(varkey(key), v))
+      return;
     kvdb_record * const r = (kvdb_record *) v;
+    lock_guard<kvdb_record> guard(*r);
+    if (unlikely(r->is_retired()))
+      continue;
+    typename my_btree::value_type v_old = 0;
+    btr.remove(varkey(key), &v_old);
+    INVARIANT((typename my_btree::value_type) r == v_old);
+    r->retire();
     kvdb_record::release(r);
+    return;
   }
 }
 
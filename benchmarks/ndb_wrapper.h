@@ -1,8 +1,12 @@
 #ifndef _NDB_WRAPPER_H_
 #define _NDB_WRAPPER_H_
 
+#include <memory>
+
 #include "abstract_db.h"
 #include "../txn_btree.h"
+#include "../txn_checkpoint.h"
+#include "../contention_manager.h"
 
 namespace private_ {
   struct ndbtxn {
@@ -44,7 +48,20 @@ public:
       const std::vector<std::vector<unsigned>> &assignments_given,
       bool call_fsync,
       bool use_compression,
-      bool fake_writes);
+      bool fake_writes,
+      size_t log_segment_size,
+      bool async_fsync,
+      uint64_t group_commit_us,
+      size_t ncompress_threads,
+      bool numa_aware,
+      bool use_dax,
+      const std::vector<std::string> &standbys,
+      size_t standby_quorum,
+      bool coalesce_writes,
+      bool compact_encoding,
+      size_t log_buffer_size,
+      size_t log_buffer_budget,
+      size_t log_admission_lag_epochs);
 
   virtual ssize_t txn_max_batch_size() const OVERRIDE { return 100; }
 
@@ -66,9 +83,20 @@ public:
     txn_epoch_sync<Transaction>::thread_init(loader);
   }
 
+  virtual bool
+  before_txn_retry()
+  {
+    if (!contention_manager::IsEnabled())
+      return false;
+    contention_manager::BeforeRetry();
+    return true;
+  }
+
   virtual void
   thread_end()
   {
+    if (tl_parked_txn)
+      destroy_parked_txn();
     txn_epoch_sync<Transaction>::thread_end();
   }
 
@@ -78,6 +106,37 @@ public:
     return txn_epoch_sync<Transaction>::compute_ntxn_persisted();
   }
 
+  virtual bool
+  recover(const std::vector<std::string> &logfiles,
+          const std::string &checkpoint_dir,
+          bool compressed,
+          const std::map<std::string, abstract_ordered_index *> &tables);
+
+  virtual bool
+  start_checkpointer(const std::string &dir,
+                     uint64_t interval_sec,
+                     uint64_t max_bytes_per_sec,
+                     const std::map<std::string, abstract_ordered_index *> &tables,
+                     bool image,
+                     size_t max_deltas);
+
+  virtual void
+  stop_checkpointer()
+  {
+    checkpointer.reset();
+  }
+
+  virtual bool
+  backup(int fd,
+         uint64_t max_bytes_per_sec,
+         const std::map<std::string, abstract_ordered_index *> &tables);
+
+  // not while logging (see txn_btree::bulk_load()), nor into kv indexes
+  virtual bool
+  bulk_load(abstract_ordered_index *idx,
+            const std::vector<std::string> &keys,
+            const std::vector<std::string> &values);
+
   virtual void
   reset_ntxn_persisted()
   {
@@ -93,8 +152,12 @@ public:
       void *buf,
       TxnProfileHint hint);
   virtual bool commit_txn(void *txn);
+  // the callback is txn_logger::NotifyOnDurable()'s
+  virtual bool commit_txn_async(void *txn, std::function<void()> on_durable);
   virtual void abort_txn(void *txn);
   virtual void print_txn_debug(void *txn) const;
+  virtual bool init_partitions(size_t npartitions);
+  virtual void enter_partitions(void *txn, const unsigned *parts, size_t n);
   virtual std::map<std::string, uint64_t> get_txn_counters(void *txn) const;
 
   virtual abstract_ordered_index *
@@ -102,9 +165,31 @@ public:
              size_t value_size_hint,
              bool mostly_append);
 
+  virtual abstract_ordered_index *
+  open_point_index(const std::string &name,
+                   size_t value_size_hint);
+
+  // unlogged, a kvdb_ordered_index: ops go straight to the btree. logged
+  // tables are regular ones, since log records are ordered by commit tids
+  virtual abstract_ordered_index *
+  open_kv_index(const std::string &name,
+                size_t value_size_hint,
+                bool logged);
+
   virtual void
   close_index(abstract_ordered_index *idx);
 
+private:
+  // a retry of an aborted txn usually asks for the same kind of txn in the
+  // same buffer, so aborted txns are parked there (see transaction::park())
+  // and reset() by the next new_txn() that matches them. one per thread
+  static __thread ndbtxn *tl_parked_txn;
+
+  // resets the parked txn p, if it was built with txn_flags and arena
+  bool reset_parked_txn(ndbtxn *p, uint64_t txn_flags, str_arena &arena);
+  void destroy_parked_txn();
+
+  std::unique_ptr<txn_checkpointer> checkpointer;
 };
 
 template <template <typename> class Transaction>
@@ -115,11 +200,21 @@ protected:
     using cast = private_::cast_base<Transaction, Traits>;
 
 public:
-  ndb_ordered_index(const std::string &name, size_t value_size_hint, bool mostly_append);
+  ndb_ordered_index(const std::string &name, size_t value_size_hint,
+                    bool mostly_append, bool point_only = false);
   virtual bool get(
       void *txn,
       const std::string &key,
       std::string &value, size_t max_bytes_read);
+  virtual bool get_view(
+      void *txn,
+      const std::string &key,
+      const char *&data,
+      size_t &sz,
+      std::string &scratch);
+  virtual bool prefetch_step(const std::string &key, const void *&state);
+  virtual void set_numa_node(int node);
+  virtual void set_partition(int p);
   virtual const char * put(
       void *txn,
       const std::string &key,
@@ -156,6 +251,13 @@ public:
       std::string &&key);
   virtual size_t size() const;
   virtual std::map<std::string, uint64_t> clear();
+  virtual std::map<std::string, uint64_t> memory_stats() const;
+
+  inline txn_btree<Transaction> &
+  get_txn_btree()
+  {
+    return btr;
+  }
 private:
   std::string name;
   txn_btree<Transaction> btr;
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "ndb_wrapper.h"
+#include "kvdb_wrapper_impl.h"
 #include "../counter.h"
 #include "../rcu.h"
 #include "../varkey.h"
@@ -10,14 +11,41 @@
 #include "../util.h"
 #include "../scopedperf.hh"
 #include "../txn.h"
+#include "../partition_manager.h"
 //#include "../txn_proto1_impl.h"
 #include "../txn_proto2_impl.h"
+#include "../txn_recovery.h"
 #include "../tuple.h"
 
 struct hint_default_traits : public default_transaction_traits {
   typedef str_arena StringAllocator;
 };
 
+// generic profiles
+
+struct hint_sized_small_traits {
+  static const size_t read_set_expected_size = 8;
+  static const size_t write_set_expected_size = 8;
+  static const size_t absent_set_expected_size = 8;
+  static const bool stable_input_memory = true;
+  static const bool hard_expected_sizes = false;
+  static const bool read_own_writes = false;
+  static const bool read_only = false;
+  typedef str_arena StringAllocator;
+};
+
+struct hint_sized_medium_traits : public hint_sized_small_traits {
+  static const size_t read_set_expected_size = 64;
+  static const size_t write_set_expected_size = 64;
+  static const size_t absent_set_expected_size = 16;
+};
+
+struct hint_sized_large_traits : public hint_sized_small_traits {
+  static const size_t read_set_expected_size = 512;
+  static const size_t write_set_expected_size = 64;
+  static const size_t absent_set_expected_size = 64;
+};
+
 // ycsb profiles
 
 struct hint_kv_get_put_traits {
@@ -27,6 +55,7 @@ struct hint_kv_get_put_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = true;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -39,6 +68,7 @@ struct hint_kv_scan_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = false;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -51,6 +81,7 @@ struct hint_read_only_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = true;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -61,6 +92,7 @@ struct hint_tpcc_new_order_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = true;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -71,6 +103,7 @@ struct hint_tpcc_payment_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = false;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -81,6 +114,7 @@ struct hint_tpcc_delivery_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = false;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
@@ -91,9 +125,16 @@ struct hint_tpcc_order_status_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = false;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
+// procedures marked read-only always run against the snapshot (see
+// procedure_registry), so they can be read-only by type
+struct hint_generic_read_only_traits : public hint_read_only_traits {
+  static const bool read_only = true;
+};
+
 struct hint_tpcc_order_status_read_only_traits : public hint_read_only_traits {};
 
 struct hint_tpcc_stock_level_traits {
@@ -103,13 +144,20 @@ struct hint_tpcc_stock_level_traits {
   static const bool stable_input_memory = true;
   static const bool hard_expected_sizes = false;
   static const bool read_own_writes = false;
+  static const bool read_only = false;
   typedef str_arena StringAllocator;
 };
 
 struct hint_tpcc_stock_level_read_only_traits : public hint_read_only_traits {};
 
+struct hint_tpcc_ch_query_read_only_traits : public hint_read_only_traits {};
+
 #define TXN_PROFILE_HINT_OP(x) \
   x(abstract_db::HINT_DEFAULT, hint_default_traits) \
+  x(abstract_db::HINT_READ_ONLY, hint_generic_read_only_traits) \
+  x(abstract_db::HINT_SIZED_SMALL, hint_sized_small_traits) \
+  x(abstract_db::HINT_SIZED_MEDIUM, hint_sized_medium_traits) \
+  x(abstract_db::HINT_SIZED_LARGE, hint_sized_large_traits) \
   x(abstract_db::HINT_KV_GET_PUT, hint_kv_get_put_traits) \
   x(abstract_db::HINT_KV_RMW, hint_kv_rmw_traits) \
   x(abstract_db::HINT_KV_SCAN, hint_kv_scan_traits) \
@@ -119,7 +167,8 @@ struct hint_tpcc_stock_level_read_only_traits : public hint_read_only_traits {};
   x(abstract_db::HINT_TPCC_ORDER_STATUS, hint_tpcc_order_status_traits) \
   x(abstract_db::HINT_TPCC_ORDER_STATUS_READ_ONLY, hint_tpcc_order_status_read_only_traits) \
   x(abstract_db::HINT_TPCC_STOCK_LEVEL, hint_tpcc_stock_level_traits) \
-  x(abstract_db::HINT_TPCC_STOCK_LEVEL_READ_ONLY, hint_tpcc_stock_level_read_only_traits)
+  x(abstract_db::HINT_TPCC_STOCK_LEVEL_READ_ONLY, hint_tpcc_stock_level_read_only_traits) \
+  x(abstract_db::HINT_TPCC_CH_QUERY_READ_ONLY, hint_tpcc_ch_query_read_only_traits)
 
 template <template <typename> class Transaction>
 ndb_wrapper<Transaction>::ndb_wrapper(
@@ -127,7 +176,20 @@ ndb_wrapper<Transaction>::ndb_wrapper(
     const std::vector<std::vector<unsigned>> &assignments_given,
     bool call_fsync,
     bool use_compression,
-    bool fake_writes)
+    bool fake_writes,
+    size_t log_segment_size,
+    bool async_fsync,
+    uint64_t group_commit_us,
+    size_t ncompress_threads,
+    bool numa_aware,
+    bool use_dax,
+    const std::vector<std::string> &standbys,
+    size_t standby_quorum,
+    bool coalesce_writes,
+    bool compact_encoding,
+    size_t log_buffer_size,
+    size_t log_buffer_budget,
+    size_t log_admission_lag_epochs)
 {
   if (logfiles.empty())
     return;
@@ -136,14 +198,146 @@ ndb_wrapper<Transaction>::ndb_wrapper(
       nthreads, logfiles, assignments_given, &assignments_used,
       call_fsync,
       use_compression,
-      fake_writes);
+      fake_writes,
+      log_segment_size,
+      async_fsync,
+      group_commit_us,
+      ncompress_threads,
+      numa_aware,
+      use_dax,
+      standbys,
+      standby_quorum,
+      coalesce_writes,
+      compact_encoding,
+      log_buffer_size,
+      log_buffer_budget,
+      log_admission_lag_epochs);
   if (verbose) {
     std::cerr << "[logging subsystem]" << std::endl;
     std::cerr << "  assignments: " << assignments_used << std::endl;
     std::cerr << "  call fsync : " << call_fsync       << std::endl;
     std::cerr << "  compression: " << use_compression  << std::endl;
     std::cerr << "  fake_writes: " << fake_writes      << std::endl;
+    std::cerr << "  segment size: " << log_segment_size << std::endl;
+    std::cerr << "  async fsync: " << async_fsync      << std::endl;
+    std::cerr << "  group commit (us): " << group_commit_us << std::endl;
+    std::cerr << "  compress threads: " << ncompress_threads << std::endl;
+    std::cerr << "  numa aware : " << numa_aware       << std::endl;
+    std::cerr << "  dax        : " << use_dax          << std::endl;
+    std::cerr << "  standbys   : " << standbys         << std::endl;
+    std::cerr << "  standby quorum: " << standby_quorum << std::endl;
+    std::cerr << "  coalesce writes: " << coalesce_writes << std::endl;
+    std::cerr << "  compact encoding: " << compact_encoding << std::endl;
+    std::cerr << "  buffer size: " << log_buffer_size << std::endl;
+    std::cerr << "  buffer budget: " << log_buffer_budget << std::endl;
+    std::cerr << "  admission lag (epochs): " << log_admission_lag_epochs << std::endl;
+  }
+}
+
+// the same index can be opened under multiple names (ie tpcc w/o
+// partitioning), so key off of the name the log knows the table by
+template <template <typename> class Transaction>
+static std::map<std::string, txn_btree<Transaction> *>
+get_txn_btrees(const std::map<std::string, abstract_ordered_index *> &tables)
+{
+  std::map<std::string, txn_btree<Transaction> *> btrs;
+  for (auto &p : tables) {
+    // unlogged kv indexes (see open_kv_index()) are not recovered
+    ndb_ordered_index<Transaction> * const idx =
+      dynamic_cast<ndb_ordered_index<Transaction> *>(p.second);
+    if (!idx)
+      continue;
+    txn_btree<Transaction> &btr = idx->get_txn_btree();
+    btrs[btr.get_name()] = &btr;
+  }
+  return btrs;
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::recover(
+    const std::vector<std::string> &logfiles,
+    const std::string &checkpoint_dir,
+    bool compressed,
+    const std::map<std::string, abstract_ordered_index *> &tables)
+{
+  util::timer t;
+  const txn_log_replayer::replay_stats s = txn_log_replayer::Replay(
+      logfiles, checkpoint_dir, get_txn_btrees<Transaction>(tables),
+      nthreads, compressed, verbose);
+  const double xsec = t.lap() / 1000000.0;
+  if (verbose) {
+    // how fast the log can be recovered from, with nthreads
+    std::cerr << "[log replay] " << nthreads << " threads: "
+              << double(s.nbytes_) / double(1UL << 30) / xsec
+              << " GB/sec of log, " << double(s.ntxns_) / xsec
+              << " txns/sec, " << double(s.nwrites_) / xsec
+              << " writes/sec" << std::endl;
+    std::cerr << "  (" << s.nbytes_ << " bytes, " << s.ntxns_ << " txns, "
+              << s.nwrites_ << " writes in " << xsec << " sec)" << std::endl;
+  }
+  return true;
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::start_checkpointer(
+    const std::string &dir,
+    uint64_t interval_sec,
+    uint64_t max_bytes_per_sec,
+    const std::map<std::string, abstract_ordered_index *> &tables,
+    bool image,
+    size_t max_deltas)
+{
+  INVARIANT(!checkpointer);
+  checkpointer.reset(new txn_checkpointer(
+      dir, get_txn_btrees<Transaction>(tables), interval_sec, max_bytes_per_sec,
+      image, max_deltas));
+  if (verbose) {
+    std::cerr << "[checkpointer]" << std::endl;
+    std::cerr << "  dir              : " << dir               << std::endl;
+    std::cerr << "  interval (sec)   : " << interval_sec      << std::endl;
+    std::cerr << "  max bytes/sec    : " << max_bytes_per_sec << std::endl;
+    std::cerr << "  image            : " << image             << std::endl;
+    std::cerr << "  max deltas       : " << max_deltas        << std::endl;
   }
+  return true;
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::backup(
+    int fd,
+    uint64_t max_bytes_per_sec,
+    const std::map<std::string, abstract_ordered_index *> &tables)
+{
+  uint64_t snapshot_tid = 0;
+  const bool ret = txn_checkpointer::Export(
+      fd, get_txn_btrees<Transaction>(tables), max_bytes_per_sec,
+      &snapshot_tid);
+  if (verbose)
+    std::cerr << "[backup] snapshot tid "
+              << g_proto_version_str(snapshot_tid)
+              << (ret ? "" : " (failed)") << std::endl;
+  return ret;
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::bulk_load(
+    abstract_ordered_index *idx,
+    const std::vector<std::string> &keys,
+    const std::vector<std::string> &values)
+{
+  ndb_ordered_index<Transaction> * const px =
+    dynamic_cast<ndb_ordered_index<Transaction> *>(idx);
+  if (!px)
+    return false;
+  const bool ret = px->get_txn_btree().bulk_load(keys, values);
+  if (verbose && ret)
+    std::cerr << "[bulk load] " << keys.size() << " records into "
+              << px->get_txn_btree().get_name() << std::endl;
+  return ret;
 }
 
 template <template <typename> class Transaction>
@@ -158,7 +352,7 @@ ndb_wrapper<Transaction>::sizeof_txn_object(uint64_t txn_flags) const
   size_t xmax = 0;
   for (size_t i = 0; i < ARRAY_NELEMS(xs); i++)
     xmax = std::max(xmax, xs[i]);
-  return xmax;
+  return sizeof(ndbtxn) + xmax;
 }
 
 template <template <typename> class Transaction>
@@ -169,7 +363,17 @@ ndb_wrapper<Transaction>::new_txn(
     void *buf,
     TxnProfileHint hint)
 {
+  // before the txn enters its rcu region (see txn_logger::Admit())
+  txn_logger::Admit(txn_flags);
   ndbtxn * const p = reinterpret_cast<ndbtxn *>(buf);
+  if (unlikely(tl_parked_txn)) {
+    if (tl_parked_txn == p && p->hint == hint &&
+        reset_parked_txn(p, txn_flags, arena)) {
+      tl_parked_txn = nullptr;
+      return p;
+    }
+    destroy_parked_txn();
+  }
   p->hint = hint;
 #define MY_OP_X(a, b) \
   case a: \
@@ -203,8 +407,66 @@ ndb_wrapper<Transaction>::commit_txn(void *txn)
     { \
       auto t = cast< b >()(p); \
       const bool ret = t->commit(); \
-      Destroy(t); \
-      return ret; \
+      if (likely(ret)) { \
+        Destroy(t); \
+        return true; \
+      } \
+      if (tl_parked_txn) \
+        destroy_parked_txn(); \
+      t->park(); \
+      tl_parked_txn = p; \
+      return false; \
+    }
+  switch (p->hint) {
+    TXN_PROFILE_HINT_OP(MY_OP_X)
+  default:
+    ALWAYS_ASSERT(false);
+  }
+#undef MY_OP_X
+  return false;
+}
+
+namespace private_ {
+  // deletes itself once called
+  class ndb_durable_fn : public txn_logger::durable_callback {
+  public:
+    explicit ndb_durable_fn(std::function<void()> &&fn) : fn_(std::move(fn)) {}
+
+    virtual void
+    on_durable(uint64_t tid)
+    {
+      fn_();
+      delete this;
+    }
+
+  private:
+    std::function<void()> fn_;
+  };
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::commit_txn_async(
+    void *txn, std::function<void()> on_durable)
+{
+  ndbtxn * const p = reinterpret_cast<ndbtxn *>(txn);
+  private_::ndb_durable_fn * const cb =
+    new private_::ndb_durable_fn(std::move(on_durable));
+#define MY_OP_X(a, b) \
+  case a: \
+    { \
+      auto t = cast< b >()(p); \
+      const bool ret = t->commit_async(cb); \
+      if (likely(ret)) { \
+        Destroy(t); \
+        return true; \
+      } \
+      delete cb; \
+      if (tl_parked_txn) \
+        destroy_parked_txn(); \
+      t->park(); \
+      tl_parked_txn = p; \
+      return false; \
     }
   switch (p->hint) {
     TXN_PROFILE_HINT_OP(MY_OP_X)
@@ -225,7 +487,10 @@ ndb_wrapper<Transaction>::abort_txn(void *txn)
     { \
       auto t = cast< b >()(p); \
       t->abort(); \
-      Destroy(t); \
+      if (tl_parked_txn) \
+        destroy_parked_txn(); \
+      t->park(); \
+      tl_parked_txn = p; \
       return; \
     }
   switch (p->hint) {
@@ -236,6 +501,52 @@ ndb_wrapper<Transaction>::abort_txn(void *txn)
 #undef MY_OP_X
 }
 
+template <template <typename> class Transaction>
+__thread typename ndb_wrapper<Transaction>::ndbtxn *
+ndb_wrapper<Transaction>::tl_parked_txn = nullptr;
+
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::reset_parked_txn(
+    ndbtxn *p, uint64_t txn_flags, str_arena &arena)
+{
+#define MY_OP_X(a, b) \
+  case a: \
+    { \
+      auto t = cast< b >()(p); \
+      if (t->get_flags() != txn_flags || &t->string_allocator() != &arena) \
+        return false; \
+      t->reset(); \
+      return true; \
+    }
+  switch (p->hint) {
+    TXN_PROFILE_HINT_OP(MY_OP_X)
+  default:
+    ALWAYS_ASSERT(false);
+  }
+#undef MY_OP_X
+  return false;
+}
+
+template <template <typename> class Transaction>
+void
+ndb_wrapper<Transaction>::destroy_parked_txn()
+{
+  ndbtxn * const p = tl_parked_txn;
+  INVARIANT(p);
+  tl_parked_txn = nullptr;
+#define MY_OP_X(a, b) \
+  case a: \
+    Destroy(cast< b >()(p)); \
+    return;
+  switch (p->hint) {
+    TXN_PROFILE_HINT_OP(MY_OP_X)
+  default:
+    ALWAYS_ASSERT(false);
+  }
+#undef MY_OP_X
+}
+
 template <template <typename> class Transaction>
 void
 ndb_wrapper<Transaction>::print_txn_debug(void *txn) const
@@ -256,6 +567,35 @@ ndb_wrapper<Transaction>::print_txn_debug(void *txn) const
 #undef MY_OP_X
 }
 
+template <template <typename> class Transaction>
+bool
+ndb_wrapper<Transaction>::init_partitions(size_t npartitions)
+{
+  partition_manager::Init(npartitions);
+  return true;
+}
+
+template <template <typename> class Transaction>
+void
+ndb_wrapper<Transaction>::enter_partitions(
+    void *txn, const unsigned *parts, size_t n)
+{
+  ndbtxn * const p = reinterpret_cast<ndbtxn *>(txn);
+#define MY_OP_X(a, b) \
+  case a: \
+    { \
+      auto t = cast< b >()(p); \
+      t->enter_partitions(parts, n); \
+      return; \
+    }
+  switch (p->hint) {
+    TXN_PROFILE_HINT_OP(MY_OP_X)
+  default:
+    ALWAYS_ASSERT(false);
+  }
+#undef MY_OP_X
+}
+
 template <template <typename> class Transaction>
 std::map<std::string, uint64_t>
 ndb_wrapper<Transaction>::get_txn_counters(void *txn) const
@@ -283,6 +623,24 @@ ndb_wrapper<Transaction>::open_index(const std::string &name, size_t value_size_
   return new ndb_ordered_index<Transaction>(name, value_size_hint, mostly_append);
 }
 
+template <template <typename> class Transaction>
+abstract_ordered_index *
+ndb_wrapper<Transaction>::open_point_index(const std::string &name, size_t value_size_hint)
+{
+  return new ndb_ordered_index<Transaction>(name, value_size_hint, false, true);
+}
+
+template <template <typename> class Transaction>
+abstract_ordered_index *
+ndb_wrapper<Transaction>::open_kv_index(const std::string &name,
+                                        size_t value_size_hint,
+                                        bool logged)
+{
+  if (logged)
+    return open_index(name, value_size_hint, false);
+  return new kvdb_ordered_index<true>(name);
+}
+
 template <template <typename> class Transaction>
 void
 ndb_wrapper<Transaction>::close_index(abstract_ordered_index *idx)
@@ -292,8 +650,9 @@ ndb_wrapper<Transaction>::close_index(abstract_ordered_index *idx)
 
 template <template <typename> class Transaction>
 ndb_ordered_index<Transaction>::ndb_ordered_index(
-    const std::string &name, size_t value_size_hint, bool mostly_append)
-  : name(name), btr(value_size_hint, mostly_append, name)
+    const std::string &name, size_t value_size_hint, bool mostly_append,
+    bool point_only)
+  : name(name), btr(value_size_hint, mostly_append, name, point_only)
 {
   // for debugging
   //std::cerr << name << " : btree= "
@@ -333,6 +692,61 @@ ndb_ordered_index<Transaction>::get(
   }
 }
 
+template <template <typename> class Transaction>
+bool
+ndb_ordered_index<Transaction>::get_view(
+    void *txn,
+    const std::string &key,
+    const char *&data,
+    size_t &sz,
+    std::string &scratch)
+{
+  ndbtxn * const p = reinterpret_cast<ndbtxn *>(txn);
+  try {
+#define MY_OP_X(a, b) \
+  case a: \
+    { \
+      auto t = cast< b >()(p); \
+      const uint8_t *px; \
+      if (!btr.search_view(*t, key, px, sz)) \
+        return false; \
+      data = (const char *) px; \
+      return true; \
+    }
+    switch (p->hint) {
+      TXN_PROFILE_HINT_OP(MY_OP_X)
+    default:
+      ALWAYS_ASSERT(false);
+    }
+#undef MY_OP_X
+    return true;
+  } catch (transaction_abort_exception &ex) {
+    throw abstract_db::abstract_abort_exception();
+  }
+}
+
+template <template <typename> class Transaction>
+bool
+ndb_ordered_index<Transaction>::prefetch_step(
+    const std::string &key, const void *&state)
+{
+  return btr.prefetch_step(varkey(key), state);
+}
+
+template <template <typename> class Transaction>
+void
+ndb_ordered_index<Transaction>::set_numa_node(int node)
+{
+  btr.set_numa_node(node);
+}
+
+template <template <typename> class Transaction>
+void
+ndb_ordered_index<Transaction>::set_partition(int p)
+{
+  btr.set_partition(p);
+}
+
 // XXX: find way to remove code duplication below using C++ templates!
 
 template <template <typename> class Transaction>
@@ -479,6 +893,7 @@ ndb_ordered_index<Transaction>::scan(
 {
   PERF_DECL(static std::string probe1_name(std::string(__PRETTY_FUNCTION__) + std::string(":total:")));
   ANON_REGION(probe1_name.c_str(), &private_::ndb_scan_probe0_cg);
+  ALWAYS_ASSERT(!btr.is_point_only()); // see open_point_index()
   ndbtxn * const p = reinterpret_cast<ndbtxn *>(txn);
   ndb_wrapper_search_range_callback<Transaction> c(callback);
   try {
@@ -509,6 +924,7 @@ ndb_ordered_index<Transaction>::rscan(
     scan_callback &callback,
     str_arena *arena)
 {
+  ALWAYS_ASSERT(!btr.is_point_only()); // see open_point_index()
   ndbtxn * const p = reinterpret_cast<ndbtxn *>(txn);
   ndb_wrapper_search_range_callback<Transaction> c(callback);
   try {
@@ -597,4 +1013,32 @@ ndb_ordered_index<Transaction>::clear()
   return btr.unsafe_purge(true);
 }
 
+template <template <typename> class Transaction>
+std::map<std::string, uint64_t>
+ndb_ordered_index<Transaction>::memory_stats() const
+{
+  const auto s = btr.get_memory_stats();
+  std::map<std::string, uint64_t> ret;
+  for (size_t i = 0; i < s.shape_.internal_nodes_.size(); i++)
+    ret["internal_nodes_depth_" + std::to_string(i)] = s.shape_.internal_nodes_[i];
+  for (size_t i = 0; i < s.shape_.leaf_nodes_.size(); i++)
+    if (s.shape_.leaf_nodes_[i])
+      ret["leaf_nodes_depth_" + std::to_string(i)] = s.shape_.leaf_nodes_[i];
+  ret["keys"] = s.shape_.nkeys_;
+  ret["leaf_key_slots"] = s.shape_.nkey_slots_;
+  ret["layers"] = s.shape_.nlayers_;
+  ret["node_bytes"] = s.shape_.node_bytes_;
+  ret["tuples"] = s.ntuples_;
+  ret["tuple_bytes"] = s.tuple_bytes_;
+  ret["record_bytes"] = s.record_bytes_;
+  // allocated past the records, ie room to grow in place
+  ret["tuple_slack_bytes"] =
+    s.tuple_bytes_ - s.record_bytes_ - s.ntuples_ * sizeof(dbtuple);
+  ret["old_versions"] = s.nold_versions_;
+  ret["version_chain_bytes"] = s.version_chain_bytes_;
+  if (s.point_index_buckets_)
+    ret["point_index_buckets"] = s.point_index_buckets_;
+  return ret;
+}
+
 #endif /* _NDB_WRAPPER_IMPL_H_ */
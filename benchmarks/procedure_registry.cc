@@ -0,0 +1,82 @@
+#include <limits>
+
+#include "../txn.h"
+#include "../util.h"
+#include "procedure_registry.h"
+
+using namespace std;
+
+uint16_t
+procedure_registry::add(const procedure_desc &desc)
+{
+  ALWAYS_ASSERT(desc.fn_);
+  ALWAYS_ASSERT(procs_.size() < numeric_limits<uint16_t>::max());
+  ALWAYS_ASSERT(!desc.partitioned_ || desc.route_);
+  procs_.emplace_back(desc);
+  procedure &p = procs_.back();
+
+  p.txn_flags_ = desc.read_only_ ? transaction_base::TXN_FLAG_READ_ONLY : 0;
+  if (desc.hint_ != abstract_db::HINT_DEFAULT)
+    p.hint_ = desc.hint_;
+  else if (desc.read_only_)
+    p.hint_ = abstract_db::HINT_READ_ONLY;
+  else if (desc.max_keys_ == 1)
+    p.hint_ = abstract_db::HINT_KV_RMW;
+  else if (desc.max_keys_ && desc.max_keys_ <= 8)
+    p.hint_ = abstract_db::HINT_SIZED_SMALL;
+  else if (desc.max_keys_ && desc.max_keys_ <= 64)
+    p.hint_ = abstract_db::HINT_SIZED_MEDIUM;
+  else if (desc.max_keys_ && desc.max_keys_ <= 512)
+    p.hint_ = abstract_db::HINT_SIZED_LARGE;
+  else
+    p.hint_ = abstract_db::HINT_DEFAULT;
+
+  const string prefix = "proc_" + desc.name_;
+  p.evt_commits_ = new event_counter(prefix + "_commits");
+  p.evt_aborts_ = new event_counter(prefix + "_aborts");
+  p.evt_retries_ = new event_counter(prefix + "_retries");
+  p.hist_latency_us_ = new event_histogram(prefix + "_latency_us");
+  return procs_.size() - 1;
+}
+
+procedure_registry::run_result
+procedure_registry::run(abstract_db *db, uint16_t id,
+                        str_arena &arena, void *txn_buf,
+                        const string &arg, string &reply,
+                        function<void()> on_durable,
+                        unsigned max_retries) const
+{
+  INVARIANT(has(id));
+  const procedure &p = procs_[id];
+  const int part = p.desc_.partitioned_ ? p.desc_.route_(arg) : -1;
+  util::timer t;
+  for (unsigned attempt = 0;; attempt++) {
+    scoped_str_arena s_arena(arena);
+    void * const txn = db->new_txn(p.txn_flags_, arena, txn_buf, p.hint_);
+    reply.clear();
+    try {
+      if (part >= 0) {
+        const unsigned u = part;
+        db->enter_partitions(txn, &u, 1);
+      }
+      if (!p.desc_.fn_(txn, arg, reply, arena)) {
+        db->abort_txn(txn);
+        ++*p.evt_aborts_;
+        return RUN_ABORTED;
+      }
+      if (db->commit_txn_async(txn, on_durable)) {
+        ++*p.evt_commits_;
+        p.hist_latency_us_->offer(t.lap());
+        return RUN_COMMITTED;
+      }
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    if (attempt == max_retries) {
+      ++*p.evt_aborts_;
+      return RUN_GAVE_UP;
+    }
+    ++*p.evt_retries_;
+    db->before_txn_retry();
+  }
+}
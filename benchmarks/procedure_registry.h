@@ -0,0 +1,136 @@
+#ifndef _PROCEDURE_REGISTRY_H_
+#define _PROCEDURE_REGISTRY_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../counter.h"
+#include "../macros.h"
+#include "abstract_db.h"
+
+/**
+ * A fixed set of txn types (stored procedures), each registered once along
+ * with what is known about its shape. Registration compiles that into a
+ * plan:
+ *
+ *   - a read-only procedure runs against the read-only snapshot (with
+ *     TXN_FLAG_READ_ONLY), so it never aborts or validates
+ *   - a procedure which touches at most max_keys keys gets a txn whose read,
+ *     write and absent sets are preallocated to hold them (one of the
+ *     HINT_SIZED_* profiles), or the single key fast path if max_keys is 1
+ *   - a procedure with a route runs on the worker of the partition its
+ *     argument routes to (see txn_executor), and enters that partition if it
+ *     is partitioned (see abstract_db::enter_partitions())
+ *
+ * Every procedure has its own commit/abort/retry counters and latency
+ * histogram, named proc_<name>_*.
+ *
+ * Procedures are registered before any are run, and never unregistered
+ */
+class procedure_registry {
+public:
+
+  /**
+   * Runs the procedure's txn. Fills in reply, and returns false to abort the
+   * txn. Can throw abstract_db::abstract_abort_exception, in which case the
+   * txn is retried. Strings from arena are valid until the txn finishes
+   */
+  typedef std::function<
+    bool(void *txn, const std::string &arg, std::string &reply, str_arena &arena)>
+    procedure_t;
+
+  // the partition (or just a routing key) arg belongs to, -1 for none
+  typedef std::function<int(const std::string &arg)> route_t;
+
+  struct procedure_desc {
+    std::string name_;
+    procedure_t fn_;
+    bool read_only_;
+    size_t max_keys_;  // the most keys the txn reads (or writes), 0 if unknown
+                       // or unbounded (ie it scans). must be a hard bound
+    route_t route_;    // nullptr if not routed
+    bool partitioned_; // route_ names a partition of the db
+    abstract_db::TxnProfileHint hint_; // if not HINT_DEFAULT, overrides
+                                       // max_keys_
+
+    procedure_desc(const std::string &name, procedure_t fn)
+      : name_(name), fn_(fn), read_only_(false), max_keys_(0),
+        partitioned_(false), hint_(abstract_db::HINT_DEFAULT) {}
+  };
+
+  enum run_result {
+    RUN_COMMITTED, // on_durable() will be called
+    RUN_ABORTED,   // the procedure returned false
+    RUN_GAVE_UP,   // aborted max_retries + 1 times
+  };
+
+  procedure_registry() {}
+
+  procedure_registry(const procedure_registry &) = delete;
+  procedure_registry(procedure_registry &&) = delete;
+  procedure_registry &operator=(const procedure_registry &) = delete;
+
+  // returns the id of the procedure, ids counting up from 0
+  uint16_t add(const procedure_desc &desc);
+
+  inline size_t
+  size() const
+  {
+    return procs_.size();
+  }
+
+  inline bool
+  has(uint16_t id) const
+  {
+    return id < procs_.size();
+  }
+
+  inline const procedure_desc &
+  desc(uint16_t id) const
+  {
+    INVARIANT(has(id));
+    return procs_[id].desc_;
+  }
+
+  // the routing hint of running id on arg, -1 for none
+  inline int
+  route(uint16_t id, const std::string &arg) const
+  {
+    INVARIANT(has(id));
+    const procedure &p = procs_[id];
+    return p.desc_.route_ ? p.desc_.route_(arg) : -1;
+  }
+
+  /**
+   * Runs procedure id on arg as a txn of db, retrying conflicts up to
+   * max_retries times, in the txn buffer txn_buf (of at least
+   * db->sizeof_txn_object(0) bytes). Commits with commit_txn_async(), so
+   * on_durable() is called once the txn is durable
+   */
+  run_result run(abstract_db *db, uint16_t id,
+                 str_arena &arena, void *txn_buf,
+                 const std::string &arg, std::string &reply,
+                 std::function<void()> on_durable,
+                 unsigned max_retries) const;
+
+private:
+
+  struct procedure {
+    procedure_desc desc_;
+    uint64_t txn_flags_;
+    abstract_db::TxnProfileHint hint_;
+    // live as long as the process, like static counters
+    event_counter *evt_commits_;
+    event_counter *evt_aborts_;
+    event_counter *evt_retries_;
+    event_histogram *hist_latency_us_;
+    procedure(const procedure_desc &desc) : desc_(desc) {}
+  };
+
+  std::vector<procedure> procs_;
+};
+
+#endif /* _PROCEDURE_REGISTRY_H_ */
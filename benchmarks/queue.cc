@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 
 #include "../macros.h"
 #include "../varkey.h"
@@ -14,11 +15,33 @@
 #include "../spinbarrier.h"
 
 #include "bench.h"
+#include "queue_table.h"
 
 using namespace std;
 using namespace util;
 
 static size_t nkeys;
+// each queue in its own table, owned by a partition of its own (see
+// abstract_db::enter_partitions())
+static int g_partitioned_execution = 0;
+// keep the queues in a queue_table rather than scanning for their heads
+static int g_queue_table = 0;
+
+static inline string
+queue_table_name(uint64_t id)
+{
+  return g_partitioned_execution ? "table_" + to_string(id) : "table";
+}
+
+// enters the partition of queue id, if partitioned
+static inline void
+enter_queue_partition(abstract_db *db, void *txn, uint64_t id)
+{
+  if (g_partitioned_execution) {
+    const unsigned part = id;
+    db->enter_partitions(txn, &part, 1);
+  }
+}
 
 static inline string
 queue_key(uint64_t id0, uint64_t id1)
@@ -42,15 +65,60 @@ public:
                uint64_t id, bool consumer)
     : bench_worker(worker_id, false, seed, db,
                    open_tables, barrier_a, barrier_b),
-      tbl(open_tables.at("table")), id(id), consumer(consumer),
-      ctr(consumer ? 0 : nkeys)
+      tbl(open_tables.at(queue_table_name(id))), q(tbl), id(id),
+      consumer(consumer), ctr(consumer ? 0 : nkeys)
   {
   }
 
+  txn_result
+  txn_enqueue()
+  {
+    void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
+    try {
+      q.enqueue(txn, id, queue_values);
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, queue_values.size());
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnEnqueue(bench_worker *w)
+  {
+    return static_cast<queue_worker *>(w)->txn_enqueue();
+  }
+
+  txn_result
+  txn_dequeue()
+  {
+    void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
+    try {
+      string v;
+      const ssize_t ret =
+        q.dequeue(txn, id, v) ? -ssize_t(queue_values.size()) : 0;
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, ret);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnDequeue(bench_worker *w)
+  {
+    return static_cast<queue_worker *>(w)->txn_dequeue();
+  }
+
   txn_result
   txn_produce()
   {
     void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
     try {
       const string k = queue_key(id, ctr);
       tbl->insert(txn, k, queue_values);
@@ -74,6 +142,7 @@ public:
   txn_consume()
   {
     void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
     try {
       const string lowk = queue_key(id, 0);
       const string highk = queue_key(id, numeric_limits<uint64_t>::max());
@@ -104,6 +173,7 @@ public:
   txn_consume_scanhint()
   {
     void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
     try {
       const string lowk = queue_key(id, ctr);
       const string highk = queue_key(id, numeric_limits<uint64_t>::max());
@@ -137,6 +207,7 @@ public:
   txn_consume_noscan()
   {
     void *txn = db->new_txn(txn_flags, arena, txn_buf());
+    enter_queue_partition(db, txn, id);
     try {
       const string k = queue_key(id, ctr);
       string v;
@@ -166,7 +237,11 @@ public:
   get_workload() const
   {
     workload_desc_vec w;
-    if (consumer)
+    if (g_queue_table)
+      w.push_back(consumer ?
+          workload_desc("Dequeue", 1.0, TxnDequeue) :
+          workload_desc("Enqueue", 1.0, TxnEnqueue));
+    else if (consumer)
       w.push_back(workload_desc("Consume", 1.0, TxnConsume));
       //w.push_back(workload_desc("ConsumeScanHint", 1.0, TxnConsumeScanHint));
       //w.push_back(workload_desc("ConsumeNoScan", 1.0, TxnConsumeNoScan));
@@ -177,6 +252,7 @@ public:
 
 private:
   abstract_ordered_index *tbl;
+  queue_table q;
   uint64_t id;
   bool consumer;
   uint64_t ctr;
@@ -194,7 +270,6 @@ protected:
   virtual void
   load()
   {
-    abstract_ordered_index *tbl = open_tables.at("table");
     try {
       // load
       const size_t batchsize = (db->txn_max_batch_size() == -1) ?
@@ -202,7 +277,16 @@ protected:
       ALWAYS_ASSERT(batchsize > 0);
       const size_t nbatches = nkeys / batchsize;
       for (size_t id = 0; id < nthreads / 2; id++) {
-        if (nbatches == 0) {
+        abstract_ordered_index *tbl = open_tables.at(queue_table_name(id));
+        if (g_queue_table) {
+          queue_table q(tbl);
+          for (size_t i = 0; i < nkeys; i += batchsize) {
+            const vector<string> values(min(batchsize, nkeys - i), queue_values);
+            void *txn = db->new_txn(txn_flags, arena, txn_buf());
+            q.enqueue(txn, id, values);
+            ALWAYS_ASSERT(db->commit_txn(txn));
+          }
+        } else if (nbatches == 0) {
           void *txn = db->new_txn(txn_flags, arena, txn_buf());
           for (size_t j = 0; j < nkeys; j++) {
             const string k = queue_key(id, j);
@@ -241,10 +325,28 @@ public:
   queue_bench_runner(abstract_db *db, bool write_only)
     : bench_runner(db), write_only(write_only)
   {
-    open_tables["table"] = db->open_index("table", queue_values.size());
+    if (g_partitioned_execution) {
+      ALWAYS_ASSERT(db->init_partitions(nthreads));
+      for (size_t id = 0; id < nthreads; id++) {
+        const string name = queue_table_name(id);
+        open_tables[name] = open_queue_index(db, name);
+        open_tables[name]->set_partition(id);
+      }
+    } else {
+      open_tables["table"] = open_queue_index(db, "table");
+    }
   }
 
 protected:
+  static abstract_ordered_index *
+  open_queue_index(abstract_db *db, const string &name)
+  {
+    // a queue_table is only accessed by key
+    if (g_queue_table)
+      return db->open_point_index(name, queue_values.size());
+    return db->open_index(name, queue_values.size());
+  }
+
   virtual vector<bench_loader *>
   make_loaders()
   {
@@ -289,6 +391,40 @@ private:
 void
 queue_do_test(abstract_db *db, int argc, char **argv)
 {
+  // parse options
+  optind = 1;
+  while (1) {
+    static struct option long_options[] = {
+      {"partitioned-execution", no_argument, &g_partitioned_execution, 1},
+      {"queue-table",           no_argument, &g_queue_table,           1},
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+
+  if (verbose) {
+    cerr << "queue settings:" << endl;
+    cerr << "  partitioned_execution : " << g_partitioned_execution << endl;
+    cerr << "  queue_table           : " << g_queue_table << endl;
+  }
+
   nkeys = size_t(scale_factor * 1000.0);
   ALWAYS_ASSERT(nkeys > 0);
   queue_bench_runner r(db, true);
@@ -0,0 +1,134 @@
+#ifndef _QUEUE_TABLE_H_
+#define _QUEUE_TABLE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../macros.h"
+#include "../util.h"
+#include "abstract_ordered_index.h"
+
+/**
+ * A FIFO queue per producer, kept in an index which holds nothing else.
+ * Entries of producer p are keyed by (p, seq), seq counting up from 0, and
+ * two cursor records per producer hold the seq of its head (next to
+ * dequeue) and of its tail (next to enqueue).
+ *
+ * Everything is an ordinary record, so queue operations are part of the
+ * txn which does them, and are logged like any other write. A dequeue is
+ * a few point reads and writes: it never scans, so it does not revisit the
+ * entries consumed before it (which a scan from the head of the queue would
+ * keep running into until they are garbage collected). The index should
+ * then be a point index (see abstract_db::open_point_index()).
+ *
+ * Enqueues to one producer conflict on its tail, and dequeues from one
+ * producer conflict on its head; an enqueue and a dequeue only conflict
+ * when the dequeue finds the queue empty.
+ */
+class queue_table {
+public:
+
+  explicit queue_table(abstract_ordered_index *idx)
+    : idx(idx) {}
+
+  inline abstract_ordered_index *
+  index() const
+  {
+    return idx;
+  }
+
+  // appends value to the queue of producer
+  void
+  enqueue(void *txn, uint64_t producer, const std::string &value)
+  {
+    const uint64_t tail = get_cursor(txn, producer, CURSOR_TAIL);
+    idx->insert(txn, entry_key(producer, tail), value);
+    put_cursor(txn, producer, CURSOR_TAIL, tail + 1);
+  }
+
+  // appends values, in order, to the queue of producer. cheaper than
+  // enqueueing them one at a time, which rewrites the tail for each
+  void
+  enqueue(void *txn, uint64_t producer, const std::vector<std::string> &values)
+  {
+    const uint64_t tail = get_cursor(txn, producer, CURSOR_TAIL);
+    for (size_t i = 0; i < values.size(); i++)
+      idx->insert(txn, entry_key(producer, tail + i), values[i]);
+    put_cursor(txn, producer, CURSOR_TAIL, tail + values.size());
+  }
+
+  // removes the entry at the head of the queue of producer into value.
+  // returns false if the queue is empty
+  bool
+  dequeue(void *txn, uint64_t producer, std::string &value)
+  {
+    const uint64_t head = get_cursor(txn, producer, CURSOR_HEAD);
+    const std::string k = entry_key(producer, head);
+    if (!idx->get(txn, k, value))
+      return false;
+    idx->remove(txn, k);
+    put_cursor(txn, producer, CURSOR_HEAD, head + 1);
+    return true;
+  }
+
+  // number of entries in the queue of producer
+  uint64_t
+  length(void *txn, uint64_t producer)
+  {
+    return get_cursor(txn, producer, CURSOR_TAIL) -
+           get_cursor(txn, producer, CURSOR_HEAD);
+  }
+
+private:
+
+  enum cursor_type { CURSOR_HEAD, CURSOR_TAIL };
+
+  // entries and cursors sort by producer, but differ in length, so they
+  // never collide
+  static inline std::string
+  entry_key(uint64_t producer, uint64_t seq)
+  {
+    util::big_endian_trfm<uint64_t> t;
+    std::string buf(2 * sizeof(uint64_t), 0);
+    uint64_t *p = (uint64_t *) &buf[0];
+    *p++ = t(producer);
+    *p++ = t(seq);
+    return buf;
+  }
+
+  static inline std::string
+  cursor_key(uint64_t producer, cursor_type c)
+  {
+    util::big_endian_trfm<uint64_t> t;
+    std::string buf(sizeof(uint64_t) + 1, 0);
+    *((uint64_t *) &buf[0]) = t(producer);
+    buf[sizeof(uint64_t)] = char(c);
+    return buf;
+  }
+
+  // a missing cursor is at 0
+  uint64_t
+  get_cursor(void *txn, uint64_t producer, cursor_type c)
+  {
+    std::string v;
+    if (!idx->get(txn, cursor_key(producer, c), v))
+      return 0;
+    INVARIANT(v.size() == sizeof(uint64_t));
+    uint64_t seq;
+    memcpy(&seq, v.data(), sizeof(seq));
+    return seq;
+  }
+
+  void
+  put_cursor(void *txn, uint64_t producer, cursor_type c, uint64_t seq)
+  {
+    idx->put(txn, cursor_key(producer, c),
+             std::string((const char *) &seq, sizeof(seq)));
+  }
+
+  abstract_ordered_index *const idx;
+};
+
+#endif /* _QUEUE_TABLE_H_ */
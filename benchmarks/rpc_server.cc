@@ -0,0 +1,364 @@
+#include <iostream>
+#include <map>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "../counter.h"
+#include "../lockguard.h"
+#include "rpc_server.h"
+
+using namespace std;
+
+static event_counter evt_rpc_requests("rpc_requests");
+static event_counter evt_rpc_batches("rpc_batches");
+static event_counter evt_rpc_aborts("rpc_aborts");
+static event_counter evt_rpc_io_wakeups("rpc_io_wakeups");
+static event_avg_counter evt_avg_rpc_batch_size("avg_rpc_batch_size");
+
+// the largest request we accept: anything bigger is a broken client
+static const size_t MaxRequestLen = 1 << 24;
+
+rpc_server::rpc_server(abstract_db *db,
+                       const procedure_registry &procs,
+                       size_t nworkers,
+                       size_t max_batch,
+                       unsigned max_retries,
+                       bool pin_cpus)
+  : db_(db),
+    max_batch_(max_batch),
+    max_retries_(max_retries),
+    procs_(procs),
+    epoll_fd_(-1),
+    event_fd_(-1)
+{
+  ALWAYS_ASSERT(max_batch > 0);
+  for (size_t i = 0; i < nworkers; i++) {
+    worker_ctxs_.emplace_back(new worker_ctx);
+    worker_ctx &w = *worker_ctxs_.back();
+    w.txn_obj_buf_.reserve(str_arena::MinStrReserveLength);
+    w.txn_obj_buf_.resize(db->sizeof_txn_object(0));
+  }
+  executor_.reset(new txn_executor(
+      nworkers, pin_cpus,
+      [db]() { db->thread_init(false); },
+      [db]() { db->thread_end(); }));
+}
+
+rpc_server::~rpc_server()
+{
+  executor_->stop();
+  for (auto &p : conns_)
+    close(p.first);
+  if (event_fd_ != -1)
+    close(event_fd_);
+  if (epoll_fd_ != -1)
+    close(epoll_fd_);
+}
+
+void
+rpc_server::run_batch(const shared_ptr<connection> &c, const batch &b)
+{
+  const int id = executor_->current_worker();
+  INVARIANT(id != -1);
+  worker_ctx &w = *worker_ctxs_[id];
+  for (auto &r : b)
+    run_request(w, c, r);
+}
+
+void
+rpc_server::run_request(worker_ctx &w,
+                        const shared_ptr<connection> &c,
+                        const request &r)
+{
+  ++evt_rpc_requests;
+  if (!procs_.has(r.proc_)) {
+    post_reply(c, r.id_, rpc_status::NO_SUCH_PROC, string());
+    return;
+  }
+  // the reply goes out once the txn is durable, which is usually after we
+  // have moved on to the next request
+  rpc_server * const self = this;
+  const shared_ptr<connection> cc(c);
+  const uint32_t rid = r.id_;
+  const shared_ptr<string> reply = make_shared<string>();
+  const procedure_registry::run_result res = procs_.run(
+      db_, r.proc_, w.arena_, (void *) w.txn_obj_buf_.data(),
+      r.arg_, *reply,
+      [self, cc, rid, reply]() {
+        self->post_reply(cc, rid, rpc_status::OK, *reply);
+      },
+      max_retries_);
+  if (res == procedure_registry::RUN_COMMITTED)
+    return;
+  ++evt_rpc_aborts;
+  post_reply(c, r.id_, rpc_status::ABORTED,
+             res == procedure_registry::RUN_ABORTED ? *reply : string());
+}
+
+void
+rpc_server::post_reply(const shared_ptr<connection> &c, uint32_t id,
+                       rpc_status status, const string &payload)
+{
+  if (c->closed_.load(memory_order_acquire))
+    return;
+  rpc_reply_header hdr;
+  hdr.len_ = payload.size();
+  hdr.id_ = id;
+  hdr.status_ = static_cast<uint8_t>(status);
+  bool wakeup = false;
+  {
+    ::lock_guard<spinlock> l(c->lock_);
+    c->ready_.append((const char *) &hdr, sizeof(hdr));
+    c->ready_.append(payload);
+    if (c->queued_)
+      return;
+    c->queued_ = true;
+    ::lock_guard<spinlock> l1(ready_lock_);
+    // only the first connection to become ready wakes the IO thread, which
+    // picks up every ready connection at once
+    wakeup = ready_.empty();
+    ready_.push_back(c);
+  }
+  if (wakeup) {
+    const uint64_t one = 1;
+    if (write(event_fd_, &one, sizeof(one)) != sizeof(one))
+      perror("write eventfd");
+  }
+}
+
+void
+rpc_server::drain_ready()
+{
+  uint64_t n;
+  if (read(event_fd_, &n, sizeof(n)) != sizeof(n) && errno != EAGAIN)
+    perror("read eventfd");
+  ++evt_rpc_io_wakeups;
+  vector<shared_ptr<connection>> ready;
+  {
+    ::lock_guard<spinlock> l(ready_lock_);
+    ready.swap(ready_);
+  }
+  for (auto &c : ready) {
+    {
+      ::lock_guard<spinlock> l(c->lock_);
+      c->out_.append(c->ready_);
+      c->ready_.clear();
+      c->queued_ = false;
+    }
+    if (!c->closed_.load(memory_order_acquire))
+      flush(*c);
+  }
+}
+
+void
+rpc_server::flush(connection &c)
+{
+  while (c.out_off_ < c.out_.size()) {
+    const ssize_t n = write(c.fd_, c.out_.data() + c.out_off_,
+                            c.out_.size() - c.out_off_);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      perror("write- dropping connection");
+      close_connection(c);
+      return;
+    }
+    c.out_off_ += n;
+  }
+  const bool done = c.out_off_ == c.out_.size();
+  if (done) {
+    c.out_.clear();
+    c.out_off_ = 0;
+  }
+  // poll for EPOLLOUT only while there is something left to write
+  if (done == c.want_out_) {
+    c.want_out_ = !done;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (c.want_out_ ? EPOLLOUT : 0);
+    ev.data.fd = c.fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd_, &ev) < 0)
+      perror("epoll_ctl");
+  }
+}
+
+void
+rpc_server::close_connection(connection &c)
+{
+  if (c.closed_.exchange(true, memory_order_acq_rel))
+    return;
+  // forgotten before the fd is closed, since a new connection can reuse it
+  auto it = conns_.find(c.fd_);
+  if (it != conns_.end() && it->second.get() == &c)
+    conns_.erase(it);
+  // closing the fd takes it out of the epoll set. replies to requests still
+  // running are dropped by post_reply()
+  close(c.fd_);
+}
+
+void
+rpc_server::on_readable(const shared_ptr<connection> &c)
+{
+  char buf[1 << 16];
+  for (;;) {
+    const ssize_t n = read(c->fd_, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      perror("read- dropping connection");
+      close_connection(*c);
+      return;
+    }
+    if (!n) {
+      close_connection(*c);
+      return;
+    }
+    c->in_.append(buf, n);
+    if (size_t(n) < sizeof(buf))
+      break;
+  }
+
+  // everything the client has sent so far goes out in batches of
+  // max_batch_, one executor task each, batched by where they route to
+  map<int, shared_ptr<batch>> batches;
+  size_t off = 0;
+  while (c->in_.size() - off >= sizeof(rpc_request_header)) {
+    rpc_request_header hdr;
+    memcpy(&hdr, c->in_.data() + off, sizeof(hdr));
+    if (hdr.len_ > MaxRequestLen) {
+      cerr << "request too large- dropping connection" << endl;
+      close_connection(*c);
+      return;
+    }
+    if (c->in_.size() - off - sizeof(hdr) < hdr.len_)
+      break;
+    request r;
+    r.id_ = hdr.id_;
+    r.proc_ = hdr.proc_;
+    r.arg_.assign(c->in_.data() + off + sizeof(hdr), hdr.len_);
+    off += sizeof(hdr) + hdr.len_;
+    const int hint = procs_.has(r.proc_) ? procs_.route(r.proc_, r.arg_) : -1;
+    shared_ptr<batch> &b = batches[hint];
+    if (!b) {
+      b = make_shared<batch>();
+      b->reserve(max_batch_);
+    }
+    b->emplace_back(move(r));
+    if (b->size() == max_batch_) {
+      dispatch(c, b, hint);
+      b.reset();
+    }
+  }
+  for (auto &p : batches)
+    if (p.second)
+      dispatch(c, p.second, p.first);
+  c->in_.erase(0, off);
+}
+
+void
+rpc_server::dispatch(const shared_ptr<connection> &c,
+                     const shared_ptr<batch> &b, int hint)
+{
+  ++evt_rpc_batches;
+  evt_avg_rpc_batch_size.offer(b->size());
+  executor_->submit([this, c, b]() { run_batch(c, *b); },
+                    hint < 0 ? txn_executor::NoHint : hint);
+}
+
+void
+rpc_server::serve_forever(unsigned port)
+{
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    throw system_error(errno, system_category(), "creating TCP socket");
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (::bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    throw system_error(errno, system_category(),
+        "binding to port " + to_string(port));
+  if (listen(fd, 128) < 0)
+    throw system_error(errno, system_category(),
+        "listening on port " + to_string(port));
+
+  epoll_fd_ = epoll_create1(0);
+  if (epoll_fd_ < 0)
+    throw system_error(errno, system_category(), "epoll_create1");
+  event_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (event_fd_ < 0)
+    throw system_error(errno, system_category(), "eventfd");
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+    throw system_error(errno, system_category(), "epoll_ctl");
+  ev.data.fd = event_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) < 0)
+    throw system_error(errno, system_category(), "epoll_ctl");
+
+  struct epoll_event evs[256];
+  for (;;) {
+    const int n = epoll_wait(epoll_fd_, evs, ARRAY_NELEMS(evs), -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw system_error(errno, system_category(), "epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      const int efd = evs[i].data.fd;
+      if (efd == fd) {
+        int cfd;
+        while ((cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+          setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          ev.events = EPOLLIN;
+          ev.data.fd = cfd;
+          if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(cfd);
+            continue;
+          }
+          conns_[cfd] = make_shared<connection>(cfd);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          perror("accept");
+        continue;
+      }
+      if (efd == event_fd_) {
+        drain_ready();
+        continue;
+      }
+      auto it = conns_.find(efd);
+      if (it == conns_.end())
+        continue;
+      const shared_ptr<connection> c = it->second;
+      if (evs[i].events & (EPOLLHUP | EPOLLERR))
+        close_connection(*c);
+      if (!c->closed_.load(memory_order_acquire) &&
+          (evs[i].events & EPOLLOUT))
+        flush(*c);
+      if (!c->closed_.load(memory_order_acquire) &&
+          (evs[i].events & EPOLLIN))
+        on_readable(c);
+    }
+  }
+}
@@ -0,0 +1,145 @@
+#ifndef _RPC_SERVER_H_
+#define _RPC_SERVER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../macros.h"
+#include "../spinlock.h"
+#include "../txn_executor.h"
+#include "abstract_db.h"
+#include "procedure_registry.h"
+
+/**
+ * The wire protocol. Every message is a header followed by len_ bytes of
+ * payload, in host byte order (XXX: like the stats protocol, we don't care
+ * about endianness). Requests may be pipelined: a client can send any number
+ * of them without waiting for replies, which come back in whatever order
+ * their txns become durable, each carrying the id_ of its request
+ */
+struct rpc_request_header {
+  uint32_t len_;
+  uint32_t id_;   // chosen by the client, echoed in the reply
+  uint16_t proc_; // id in the server's procedure_registry
+} PACKED;
+
+enum class rpc_status : uint8_t {
+  OK = 0x0,
+  ABORTED = 0x1,      // the procedure gave up, or the txn kept conflicting
+  NO_SUCH_PROC = 0x2,
+};
+
+struct rpc_reply_header {
+  uint32_t len_;
+  uint32_t id_;
+  uint8_t status_; // rpc_status
+} PACKED;
+
+/**
+ * Serves the stored procedures of a procedure_registry over TCP, running
+ * them as txns against db.
+ *
+ * One thread does all the network IO over epoll. It reads whatever each
+ * connection has sent, and hands the requests to a txn_executor in batches
+ * of up to max_batch, so a worker is woken up (and a task allocated) per
+ * batch rather than per request. Workers commit with
+ * abstract_db::commit_txn_async(), and move on to the next request without
+ * waiting for the txn to become durable; its reply is queued once it is.
+ * Replies made durable together (ie by one group commit) are written out
+ * together, with one wakeup of the IO thread and one write() per connection.
+ *
+ * Requests for procedures with a route are batched by where they route to,
+ * and run on that partition's worker
+ */
+class rpc_server {
+public:
+
+  // a procedure which returns false is replied to with rpc_status::ABORTED
+  // (and its reply), as is one which conflicts more than max_retries times
+  // (with no reply). procs must outlive the server
+  rpc_server(abstract_db *db,
+             const procedure_registry &procs,
+             size_t nworkers,
+             size_t max_batch = 32,
+             unsigned max_retries = 16,
+             bool pin_cpus = false);
+
+  ~rpc_server();
+
+  rpc_server(const rpc_server &) = delete;
+  rpc_server(rpc_server &&) = delete;
+  rpc_server &operator=(const rpc_server &) = delete;
+
+  // blocks current thread
+  void serve_forever(unsigned port);
+
+private:
+
+  struct request {
+    uint32_t id_;
+    uint16_t proc_;
+    std::string arg_;
+  };
+
+  typedef std::vector<request> batch;
+
+  struct connection {
+    const int fd_;
+    std::string in_;      // IO thread only
+    std::string out_;     // IO thread only
+    size_t out_off_;      // IO thread only, written out of out_ so far
+    bool want_out_;       // IO thread only, polling for EPOLLOUT
+    std::atomic<bool> closed_;
+
+    spinlock lock_;
+    std::string ready_;   // replies not yet picked up by the IO thread
+    bool queued_;         // on rpc_server::ready_
+
+    explicit connection(int fd)
+      : fd_(fd), out_off_(0), want_out_(false), closed_(false), queued_(false) {}
+  };
+
+  struct worker_ctx {
+    str_arena arena_;
+    std::string txn_obj_buf_;
+  };
+
+  void dispatch(const std::shared_ptr<connection> &c,
+                const std::shared_ptr<batch> &b, int hint);
+  void run_batch(const std::shared_ptr<connection> &c, const batch &b);
+  void run_request(worker_ctx &w,
+                   const std::shared_ptr<connection> &c,
+                   const request &r);
+
+  // called by workers, and from durable callbacks
+  void post_reply(const std::shared_ptr<connection> &c, uint32_t id,
+                  rpc_status status, const std::string &payload);
+
+  // IO thread only
+  void on_readable(const std::shared_ptr<connection> &c);
+  void flush(connection &c);
+  void close_connection(connection &c);
+  void drain_ready();
+
+  abstract_db *const db_;
+  const size_t max_batch_;
+  const unsigned max_retries_;
+  const procedure_registry &procs_;
+  std::vector<std::unique_ptr<worker_ctx>> worker_ctxs_;
+  std::unique_ptr<txn_executor> executor_;
+
+  int epoll_fd_;
+  int event_fd_;
+  std::map<int, std::shared_ptr<connection>> conns_; // IO thread only
+
+  spinlock ready_lock_;
+  std::vector<std::shared_ptr<connection>> ready_; // have replies to write
+};
+
+#endif /* _RPC_SERVER_H_ */
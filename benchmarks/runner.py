@@ -642,7 +642,9 @@ def run_configuration(
       print >>sys.stderr, 'pid=', p.pid
       r = p.stdout.read()
       retcode = p.wait()
-      toks = r.strip().split(' ')
+      # the first line starts with the 5 aggregates, followed by the latency
+      # percentiles. the lines after it are per txn type
+      toks = r.strip().split('\n')[0].split(' ')[:5]
   else:
     assert check_binary_executable(binary)
     toks = [0,0,0,0,0]
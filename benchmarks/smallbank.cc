@@ -0,0 +1,578 @@
+/**
+ * An implementation of SmallBank, as in Cahill et al. ("Serializable
+ * Isolation for Snapshot Databases"), with the transaction mix and amounts
+ * of oltpbench's:
+ * https://github.com/oltpbenchmark/oltpbench/tree/master/src/com/oltpbenchmark/benchmarks/smallbank
+ *
+ * Customers are picked by id, with a hotspot of a few accounts getting a
+ * share of the picks, which is what makes the txns contend
+ */
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "../macros.h"
+#include "../thread.h"
+#include "../util.h"
+#include "../spinbarrier.h"
+#include "../core.h"
+#include "../counter.h"
+
+#include "../record/encoder.h"
+#include "../record/inline_str.h"
+#include "bench.h"
+#include "ycsb_key_chooser.h"
+
+using namespace std;
+using namespace util;
+
+static size_t naccounts;
+
+// configuration flags
+static int g_enable_point_indexes = 0;
+static size_t g_hot_accounts = 100;
+static unsigned g_hot_pct = 25; // of the picks which go to the hot accounts
+
+// [Amalgamate, Balance, DepositChecking, SendPayment, TransactSavings, WriteCheck]
+static unsigned g_txn_workload_mix[] = { 15, 15, 15, 25, 15, 15 };
+
+static const float MinBalance = 10000.0;
+static const float MaxBalance = 50000.0;
+static const float DepositCheckingAmount = 1.3;
+static const float TransactSavingsAmount = 20.20;
+static const float WriteCheckAmount = 5.0;
+static const float SendPaymentAmount = 5.0;
+
+// see g_hot_accounts
+static ycsb_key_chooser g_key_chooser;
+
+static event_counter evt_smallbank_rejected_txns("smallbank_rejected_txns");
+
+#define ACCOUNTS_KEY_FIELDS(x, y) \
+  x(uint64_t,a_custid)
+#define ACCOUNTS_VALUE_FIELDS(x, y) \
+  x(inline_str_8<64>,a_name)
+DO_STRUCT(accounts, ACCOUNTS_KEY_FIELDS, ACCOUNTS_VALUE_FIELDS)
+
+#define SAVINGS_KEY_FIELDS(x, y) \
+  x(uint64_t,s_custid)
+#define SAVINGS_VALUE_FIELDS(x, y) \
+  x(float,s_bal)
+DO_STRUCT(savings, SAVINGS_KEY_FIELDS, SAVINGS_VALUE_FIELDS)
+
+#define CHECKING_KEY_FIELDS(x, y) \
+  x(uint64_t,c_custid)
+#define CHECKING_VALUE_FIELDS(x, y) \
+  x(float,c_bal)
+DO_STRUCT(checking, CHECKING_KEY_FIELDS, CHECKING_VALUE_FIELDS)
+
+class smallbank_worker : public bench_worker {
+public:
+  smallbank_worker(unsigned int worker_id,
+                   unsigned long seed, abstract_db *db,
+                   const map<string, abstract_ordered_index *> &open_tables,
+                   spin_barrier *barrier_a, spin_barrier *barrier_b)
+    : bench_worker(worker_id, true, seed, db,
+                   open_tables, barrier_a, barrier_b),
+      tbl_accounts(open_tables.at("accounts")),
+      tbl_savings(open_tables.at("savings")),
+      tbl_checking(open_tables.at("checking")),
+      balance_sum(0.0)
+  {
+    obj_key0.reserve(str_arena::MinStrReserveLength);
+    obj_v.reserve(str_arena::MinStrReserveLength);
+  }
+
+  // moves all of custid0's money into custid1's checking account
+  txn_result
+  txn_amalgamate()
+  {
+    uint64_t custid0, custid1;
+    PickTwo(custid0, custid1);
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const savings::key k_s0(custid0);
+      const checking::key k_c0(custid0);
+      const checking::key k_c1(custid1);
+      savings::value v_s0;
+      checking::value v_c0, v_c1;
+      ALWAYS_ASSERT(tbl_savings->get(txn, Encode(obj_key0, k_s0), obj_v));
+      Decode(obj_v, v_s0);
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c0), obj_v));
+      Decode(obj_v, v_c0);
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c1), obj_v));
+      Decode(obj_v, v_c1);
+
+      const float total = v_s0.s_bal + v_c0.c_bal;
+      v_s0.s_bal = 0.0;
+      v_c0.c_bal = 0.0;
+      v_c1.c_bal += total;
+      tbl_savings->put(txn, Encode(str(), k_s0), Encode(str(), v_s0));
+      tbl_checking->put(txn, Encode(str(), k_c0), Encode(str(), v_c0));
+      tbl_checking->put(txn, Encode(str(), k_c1), Encode(str(), v_c1));
+      measure_txn_counters(txn, "txn_amalgamate");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnAmalgamate(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_amalgamate();
+  }
+
+  txn_result
+  txn_balance()
+  {
+    const uint64_t custid = PickOne();
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      savings::value v_s;
+      checking::value v_c;
+      ALWAYS_ASSERT(tbl_accounts->get(txn, Encode(obj_key0, accounts::key(custid)), obj_v));
+      ALWAYS_ASSERT(tbl_savings->get(txn, Encode(obj_key0, savings::key(custid)), obj_v));
+      Decode(obj_v, v_s);
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, checking::key(custid)), obj_v));
+      Decode(obj_v, v_c);
+      balance_sum += v_s.s_bal + v_c.c_bal;
+      measure_txn_counters(txn, "txn_balance");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnBalance(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_balance();
+  }
+
+  // a single key read-modify-write
+  txn_result
+  txn_deposit_checking()
+  {
+    const uint64_t custid = PickOne();
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_RMW);
+    scoped_str_arena s_arena(arena);
+    try {
+      const checking::key k_c(custid);
+      checking::value v_c;
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c), obj_v));
+      Decode(obj_v, v_c);
+      v_c.c_bal += DepositCheckingAmount;
+      tbl_checking->put(txn, Encode(str(), k_c), Encode(str(), v_c));
+      measure_txn_counters(txn, "txn_deposit_checking");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnDepositChecking(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_deposit_checking();
+  }
+
+  txn_result
+  txn_send_payment()
+  {
+    uint64_t custid0, custid1;
+    PickTwo(custid0, custid1);
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const checking::key k_c0(custid0);
+      const checking::key k_c1(custid1);
+      checking::value v_c0, v_c1;
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c0), obj_v));
+      Decode(obj_v, v_c0);
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c1), obj_v));
+      Decode(obj_v, v_c1);
+      // insufficient funds is a rejection, which commits having written
+      // nothing (an abort would be retried with the same inputs)
+      if (v_c0.c_bal >= SendPaymentAmount) {
+        v_c0.c_bal -= SendPaymentAmount;
+        v_c1.c_bal += SendPaymentAmount;
+        tbl_checking->put(txn, Encode(str(), k_c0), Encode(str(), v_c0));
+        tbl_checking->put(txn, Encode(str(), k_c1), Encode(str(), v_c1));
+      } else {
+        ++evt_smallbank_rejected_txns;
+      }
+      measure_txn_counters(txn, "txn_send_payment");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnSendPayment(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_send_payment();
+  }
+
+  // a single key read-modify-write
+  txn_result
+  txn_transact_savings()
+  {
+    const uint64_t custid = PickOne();
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_RMW);
+    scoped_str_arena s_arena(arena);
+    try {
+      const savings::key k_s(custid);
+      savings::value v_s;
+      ALWAYS_ASSERT(tbl_savings->get(txn, Encode(obj_key0, k_s), obj_v));
+      Decode(obj_v, v_s);
+      // a withdrawal (negative amount) can't overdraw savings
+      if (v_s.s_bal + TransactSavingsAmount >= 0.0) {
+        v_s.s_bal += TransactSavingsAmount;
+        tbl_savings->put(txn, Encode(str(), k_s), Encode(str(), v_s));
+      } else {
+        ++evt_smallbank_rejected_txns;
+      }
+      measure_txn_counters(txn, "txn_transact_savings");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnTransactSavings(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_transact_savings();
+  }
+
+  txn_result
+  txn_write_check()
+  {
+    const uint64_t custid = PickOne();
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const checking::key k_c(custid);
+      savings::value v_s;
+      checking::value v_c;
+      ALWAYS_ASSERT(tbl_savings->get(txn, Encode(obj_key0, savings::key(custid)), obj_v));
+      Decode(obj_v, v_s);
+      ALWAYS_ASSERT(tbl_checking->get(txn, Encode(obj_key0, k_c), obj_v));
+      Decode(obj_v, v_c);
+      // overdrawing costs a penalty of 1
+      if (v_s.s_bal + v_c.c_bal < WriteCheckAmount)
+        v_c.c_bal -= WriteCheckAmount + 1.0;
+      else
+        v_c.c_bal -= WriteCheckAmount;
+      tbl_checking->put(txn, Encode(str(), k_c), Encode(str(), v_c));
+      measure_txn_counters(txn, "txn_write_check");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnWriteCheck(bench_worker *w)
+  {
+    return static_cast<smallbank_worker *>(w)->txn_write_check();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    unsigned m = 0;
+    for (size_t i = 0; i < ARRAY_NELEMS(g_txn_workload_mix); i++)
+      m += g_txn_workload_mix[i];
+    ALWAYS_ASSERT(m == 100);
+    if (g_txn_workload_mix[0])
+      w.push_back(workload_desc("Amalgamate", double(g_txn_workload_mix[0])/100.0, TxnAmalgamate));
+    if (g_txn_workload_mix[1])
+      w.push_back(workload_desc("Balance", double(g_txn_workload_mix[1])/100.0, TxnBalance));
+    if (g_txn_workload_mix[2])
+      w.push_back(workload_desc("DepositChecking", double(g_txn_workload_mix[2])/100.0, TxnDepositChecking));
+    if (g_txn_workload_mix[3])
+      w.push_back(workload_desc("SendPayment", double(g_txn_workload_mix[3])/100.0, TxnSendPayment));
+    if (g_txn_workload_mix[4])
+      w.push_back(workload_desc("TransactSavings", double(g_txn_workload_mix[4])/100.0, TxnTransactSavings));
+    if (g_txn_workload_mix[5])
+      w.push_back(workload_desc("WriteCheck", double(g_txn_workload_mix[5])/100.0, TxnWriteCheck));
+    return w;
+  }
+
+protected:
+
+  virtual void
+  on_run_setup() OVERRIDE
+  {
+    if (!pin_cpus)
+      return;
+    rcu::s_instance.pin_current_thread(bench_loader::WorkerCpu(worker_id));
+    rcu::s_instance.fault_region();
+  }
+
+  inline ALWAYS_INLINE string &
+  str()
+  {
+    return *arena.next();
+  }
+
+private:
+
+  inline uint64_t
+  PickOne()
+  {
+    return g_key_chooser.next(r, naccounts);
+  }
+
+  // two distinct customers
+  inline void
+  PickTwo(uint64_t &custid0, uint64_t &custid1)
+  {
+    custid0 = PickOne();
+    do {
+      custid1 = PickOne();
+    } while (custid1 == custid0);
+  }
+
+  abstract_ordered_index *tbl_accounts;
+  abstract_ordered_index *tbl_savings;
+  abstract_ordered_index *tbl_checking;
+
+  // scratch buffer space
+  string obj_key0;
+  string obj_v;
+
+  float balance_sum; // so balance reads aren't optimized away
+};
+
+// loads customers [custstart, custend)
+class smallbank_loader : public bench_loader {
+public:
+  smallbank_loader(unsigned long seed,
+                   abstract_db *db,
+                   const map<string, abstract_ordered_index *> &open_tables,
+                   uint64_t custstart,
+                   uint64_t custend)
+    : bench_loader(seed, db, open_tables),
+      custstart(custstart), custend(custend)
+  {
+    INVARIANT(custend > custstart);
+  }
+
+protected:
+  virtual void
+  load()
+  {
+    abstract_ordered_index *tbl_accounts = open_tables.at("accounts");
+    abstract_ordered_index *tbl_savings = open_tables.at("savings");
+    abstract_ordered_index *tbl_checking = open_tables.at("checking");
+    string obj_buf;
+    // three records a customer
+    const size_t batchsize = (db->txn_max_batch_size() == -1) ?
+      10000 : max(db->txn_max_batch_size() / 3, ssize_t(1));
+    for (uint64_t b = custstart; b < custend;) {
+      scoped_str_arena s_arena(arena);
+      void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+      const uint64_t bend = min(b + batchsize, custend);
+      try {
+        for (uint64_t c = b; c < bend; c++) {
+          accounts::value v_a;
+          v_a.a_name.assign(to_string(c));
+          const savings::value v_s(RandomBalance());
+          const checking::value v_c(RandomBalance());
+          tbl_accounts->insert(txn, Encode(accounts::key(c)), Encode(obj_buf, v_a));
+          tbl_savings->insert(txn, Encode(savings::key(c)), Encode(obj_buf, v_s));
+          tbl_checking->insert(txn, Encode(checking::key(c)), Encode(obj_buf, v_c));
+        }
+        // a failed commit has already aborted (and released) the txn
+        if (db->commit_txn(txn))
+          b = bend;
+      } catch (abstract_db::abstract_abort_exception &ex) {
+        db->abort_txn(txn);
+      }
+    }
+    if (verbose)
+      cerr << "[INFO] finished loading customers [" << custstart
+           << ", " << custend << ")" << endl;
+  }
+
+private:
+  inline float
+  RandomBalance()
+  {
+    return MinBalance + r.next_uniform() * (MaxBalance - MinBalance);
+  }
+
+  uint64_t custstart;
+  uint64_t custend;
+};
+
+class smallbank_bench_runner : public bench_runner {
+public:
+  smallbank_bench_runner(abstract_db *db)
+    : bench_runner(db)
+  {
+    open_tables["accounts"] = OpenTable(db, "accounts", sizeof(accounts::value));
+    open_tables["savings"] = OpenTable(db, "savings", sizeof(savings::value));
+    open_tables["checking"] = OpenTable(db, "checking", sizeof(checking::value));
+  }
+
+protected:
+  virtual vector<bench_loader *>
+  make_loaders()
+  {
+    vector<bench_loader *> ret;
+    if (enable_parallel_loading && naccounts >= nthreads) {
+      // each worker's cpu loads a slice
+      fast_random r(5438921);
+      const size_t nperloader = naccounts / nthreads;
+      for (size_t i = 0; i < nthreads; i++) {
+        const uint64_t cend = (i + 1 == nthreads) ?
+          naccounts : (i + 1) * nperloader;
+        bench_loader * const l =
+          new smallbank_loader(r.next(), db, open_tables, i * nperloader, cend);
+        l->set_home_worker(i);
+        ret.push_back(l);
+      }
+    } else {
+      ret.push_back(new smallbank_loader(5438921, db, open_tables, 0, naccounts));
+    }
+    return ret;
+  }
+
+  virtual vector<bench_worker *>
+  make_workers()
+  {
+    const unsigned alignment = coreid::num_cpus_online();
+    const int blockstart =
+      coreid::allocate_contiguous_aligned_block(nthreads, alignment);
+    ALWAYS_ASSERT(blockstart >= 0);
+    ALWAYS_ASSERT((blockstart % alignment) == 0);
+    fast_random r(93847522);
+    vector<bench_worker *> ret;
+    for (size_t i = 0; i < nthreads; i++)
+      ret.push_back(
+        new smallbank_worker(
+          blockstart + i, r.next(), db, open_tables,
+          &barrier_a, &barrier_b));
+    return ret;
+  }
+
+private:
+  // the tables are only ever accessed by key
+  static abstract_ordered_index *
+  OpenTable(abstract_db *db, const char *name, size_t expected_size)
+  {
+    if (g_enable_point_indexes)
+      return db->open_point_index(name, expected_size);
+    return db->open_index(name, expected_size);
+  }
+};
+
+void
+smallbank_do_test(abstract_db *db, int argc, char **argv)
+{
+  naccounts = size_t(scale_factor * 100000.0);
+  ALWAYS_ASSERT(naccounts >= 2);
+
+  // parse options
+  optind = 1;
+  while (1) {
+    static struct option long_options[] = {
+      {"enable-point-indexes" , no_argument       , &g_enable_point_indexes , 1}   ,
+      {"hot-accounts"         , required_argument , 0                       , 'a'} ,
+      {"hot-pct"              , required_argument , 0                       , 'p'} , // of the picks
+      {"workload-mix"         , required_argument , 0                       , 'w'} ,
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "a:p:w:", long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case 'a':
+      g_hot_accounts = strtoul(optarg, nullptr, 10);
+      break;
+
+    case 'p':
+      g_hot_pct = strtoul(optarg, nullptr, 10);
+      ALWAYS_ASSERT(g_hot_pct <= 100);
+      break;
+
+    case 'w':
+      {
+        const vector<string> toks = split(optarg, ',');
+        ALWAYS_ASSERT(toks.size() == ARRAY_NELEMS(g_txn_workload_mix));
+        unsigned s = 0;
+        for (size_t i = 0; i < toks.size(); i++) {
+          unsigned p = strtoul(toks[i].c_str(), nullptr, 10);
+          ALWAYS_ASSERT(p >= 0 && p <= 100);
+          s += p;
+          g_txn_workload_mix[i] = p;
+        }
+        ALWAYS_ASSERT(s == 100);
+      }
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+
+  // no hotspot is a uniform pick
+  const bool hotspot = g_hot_pct && g_hot_accounts && g_hot_accounts < naccounts;
+  if (hotspot)
+    g_key_chooser.init(
+        ycsb_key_chooser::DIST_HOTSPOT, naccounts,
+        0.0, double(g_hot_accounts) / double(naccounts), double(g_hot_pct) / 100.0);
+  else
+    g_key_chooser.init(ycsb_key_chooser::DIST_UNIFORM, naccounts, 0.0, 0.0, 0.0);
+
+  if (verbose) {
+    cerr << "smallbank settings:" << endl;
+    cerr << "  accounts     : " << naccounts << endl;
+    cerr << "  hot_accounts : " << (hotspot ? g_hot_accounts : 0) << endl;
+    cerr << "  hot_pct      : " << (hotspot ? g_hot_pct : 0) << endl;
+    cerr << "  point_indexes: " << g_enable_point_indexes << endl;
+    cerr << "  workload_mix : " <<
+      format_list(g_txn_workload_mix,
+                  g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix)) << endl;
+  }
+
+  smallbank_bench_runner r(db);
+  r.run();
+}
@@ -0,0 +1,738 @@
+/**
+ * An implementation of TATP (the Telecom Application Transaction Processing
+ * benchmark), as in its 1.0 description:
+ * http://tatpbenchmark.sourceforge.net/TATP_Description.pdf
+ *
+ * 80% of the txns are reads, mostly of a single record. Subscribers are
+ * picked with the spec's non-uniform distribution, and the txns which name
+ * them by number (sub_nbr) look them up through a secondary index first.
+ *
+ * The txns the spec calls unsuccessful (ie a GetAccessData of a record which
+ * does not exist) commit having changed nothing, like the others
+ */
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "../macros.h"
+#include "../thread.h"
+#include "../util.h"
+#include "../spinbarrier.h"
+#include "../core.h"
+#include "../counter.h"
+
+#include "../record/encoder.h"
+#include "../record/inline_str.h"
+#include "bench.h"
+
+using namespace std;
+using namespace util;
+
+static size_t nsubscribers;
+
+// configuration flags
+static int g_enable_point_indexes = 0;
+static int g_uniform_subscriber_dist = 0;
+
+// [GetSubscriberData, GetNewDestination, GetAccessData, UpdateSubscriberData,
+//  UpdateLocation, InsertCallForwarding, DeleteCallForwarding]
+static unsigned g_txn_workload_mix[] = { 35, 10, 35, 2, 14, 2, 2 };
+
+static event_counter evt_tatp_unsuccessful_txns("tatp_unsuccessful_txns");
+
+#define SUBSCRIBER_KEY_FIELDS(x, y) \
+  x(uint32_t,s_id)
+#define SUBSCRIBER_VALUE_FIELDS(x, y) \
+  x(inline_str_fixed<15>,sub_nbr) \
+  y(uint16_t,s_bits) \
+  y(uint64_t,s_hexes) \
+  y(inline_str_fixed<10>,s_byte2) \
+  y(uint32_t,msc_location) \
+  y(uint32_t,vlr_location)
+DO_STRUCT(subscriber, SUBSCRIBER_KEY_FIELDS, SUBSCRIBER_VALUE_FIELDS)
+
+#define SUBSCRIBER_NBR_IDX_KEY_FIELDS(x, y) \
+  x(inline_str_fixed<15>,sub_nbr)
+#define SUBSCRIBER_NBR_IDX_VALUE_FIELDS(x, y) \
+  x(uint32_t,s_id)
+DO_STRUCT(subscriber_nbr_idx, SUBSCRIBER_NBR_IDX_KEY_FIELDS, SUBSCRIBER_NBR_IDX_VALUE_FIELDS)
+
+#define ACCESS_INFO_KEY_FIELDS(x, y) \
+  x(uint32_t,ai_s_id) \
+  y(uint8_t,ai_type)
+#define ACCESS_INFO_VALUE_FIELDS(x, y) \
+  x(uint8_t,data1) \
+  y(uint8_t,data2) \
+  y(inline_str_fixed<3>,data3) \
+  y(inline_str_fixed<5>,data4)
+DO_STRUCT(access_info, ACCESS_INFO_KEY_FIELDS, ACCESS_INFO_VALUE_FIELDS)
+
+#define SPECIAL_FACILITY_KEY_FIELDS(x, y) \
+  x(uint32_t,sf_s_id) \
+  y(uint8_t,sf_type)
+#define SPECIAL_FACILITY_VALUE_FIELDS(x, y) \
+  x(uint8_t,is_active) \
+  y(uint8_t,error_cntrl) \
+  y(uint8_t,data_a) \
+  y(inline_str_fixed<5>,data_b)
+DO_STRUCT(special_facility, SPECIAL_FACILITY_KEY_FIELDS, SPECIAL_FACILITY_VALUE_FIELDS)
+
+#define CALL_FORWARDING_KEY_FIELDS(x, y) \
+  x(uint32_t,cf_s_id) \
+  y(uint8_t,cf_sf_type) \
+  y(uint8_t,start_time)
+#define CALL_FORWARDING_VALUE_FIELDS(x, y) \
+  x(uint8_t,end_time) \
+  y(inline_str_fixed<15>,numberx)
+DO_STRUCT(call_forwarding, CALL_FORWARDING_KEY_FIELDS, CALL_FORWARDING_VALUE_FIELDS)
+
+// types (of access_info and special_facility) are in [1, NumTypes]
+static const unsigned NumTypes = 4;
+
+class tatp_worker_mixin {
+public:
+  static inline ALWAYS_INLINE uint32_t
+  RandomNumber(fast_random &r, uint32_t min, uint32_t max)
+  {
+    return min + (r.next() % (max - min + 1));
+  }
+
+  // the spec's non-uniform pick of an s_id in [1, nsubscribers]
+  static inline uint32_t
+  PickSubscriberId(fast_random &r)
+  {
+    if (g_uniform_subscriber_dist)
+      return RandomNumber(r, 1, nsubscribers);
+    const uint32_t a = nsubscribers <= 1000000 ? 65535 :
+      (nsubscribers <= 10000000 ? 1048575 : 2097151);
+    return ((RandomNumber(r, 0, a) | RandomNumber(r, 1, nsubscribers)) % nsubscribers) + 1;
+  }
+
+  // s_id as its 15 digit sub_nbr
+  static inline string
+  SubscriberNumber(uint32_t s_id)
+  {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%015u", s_id);
+    return string(buf, 15);
+  }
+
+  static inline string
+  RandomStr(fast_random &r, size_t len, char base, unsigned nchars)
+  {
+    string s(len, 0);
+    for (size_t i = 0; i < len; i++)
+      s[i] = base + (r.next() % nchars);
+    return s;
+  }
+
+  // call_forwarding start_times are one of 0, 8, 16
+  static inline uint8_t
+  RandomStartTime(fast_random &r)
+  {
+    return 8 * RandomNumber(r, 0, 2);
+  }
+
+  // n distinct types of [1, NumTypes], in sorted order
+  static inline size_t
+  RandomTypes(fast_random &r, uint8_t *types)
+  {
+    const size_t n = RandomNumber(r, 1, NumTypes);
+    unsigned mask = 0;
+    while (__builtin_popcount(mask) < int(n))
+      mask |= 1u << RandomNumber(r, 0, NumTypes - 1);
+    size_t i = 0;
+    for (unsigned t = 0; t < NumTypes; t++)
+      if (mask & (1u << t))
+        types[i++] = t + 1;
+    return n;
+  }
+};
+
+class tatp_worker : public bench_worker, public tatp_worker_mixin {
+public:
+  tatp_worker(unsigned int worker_id,
+              unsigned long seed, abstract_db *db,
+              const map<string, abstract_ordered_index *> &open_tables,
+              spin_barrier *barrier_a, spin_barrier *barrier_b)
+    : bench_worker(worker_id, true, seed, db,
+                   open_tables, barrier_a, barrier_b),
+      tbl_subscriber(open_tables.at("subscriber")),
+      tbl_subscriber_nbr_idx(open_tables.at("subscriber_nbr_idx")),
+      tbl_access_info(open_tables.at("access_info")),
+      tbl_special_facility(open_tables.at("special_facility")),
+      tbl_call_forwarding(open_tables.at("call_forwarding")),
+      computation_n(0)
+  {
+    obj_key0.reserve(str_arena::MinStrReserveLength);
+    obj_key1.reserve(str_arena::MinStrReserveLength);
+    obj_v.reserve(str_arena::MinStrReserveLength);
+  }
+
+  txn_result
+  txn_get_subscriber_data()
+  {
+    const subscriber::key k_s(PickSubscriberId(r));
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_GET_PUT);
+    scoped_str_arena s_arena(arena);
+    try {
+      subscriber::value v_s;
+      ALWAYS_ASSERT(tbl_subscriber->get(txn, Encode(obj_key0, k_s), obj_v));
+      Decode(obj_v, v_s);
+      computation_n += v_s.msc_location;
+      measure_txn_counters(txn, "txn_get_subscriber_data");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnGetSubscriberData(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_get_subscriber_data();
+  }
+
+  txn_result
+  txn_get_new_destination()
+  {
+    const uint32_t s_id = PickSubscriberId(r);
+    const uint8_t sf_type = RandomNumber(r, 1, NumTypes);
+    const uint8_t start_time = RandomStartTime(r);
+    const uint8_t end_time = RandomNumber(r, 1, 24);
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      bool found = false;
+      special_facility::value v_sf;
+      if (tbl_special_facility->get(
+            txn, Encode(obj_key0, special_facility::key(s_id, sf_type)), obj_v) &&
+          Decode(obj_v, v_sf)->is_active) {
+        // the forwardings which start by start_time, and end after end_time
+        static_limit_callback<3> c(s_arena.get(), true);
+        const call_forwarding::key k_cf_0(s_id, sf_type, 0);
+        const call_forwarding::key k_cf_1(s_id, sf_type, start_time + 1);
+        tbl_call_forwarding->scan(
+            txn, Encode(obj_key0, k_cf_0), &Encode(obj_key1, k_cf_1), c, s_arena.get());
+        for (size_t i = 0; i < c.size(); i++) {
+          call_forwarding::value v_cf;
+          if (Decode(*c.values[i].second, v_cf)->end_time > end_time) {
+            computation_n += v_cf.numberx.size();
+            found = true;
+          }
+        }
+      }
+      if (!found)
+        ++evt_tatp_unsuccessful_txns;
+      measure_txn_counters(txn, "txn_get_new_destination");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnGetNewDestination(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_get_new_destination();
+  }
+
+  txn_result
+  txn_get_access_data()
+  {
+    const access_info::key k_ai(PickSubscriberId(r), RandomNumber(r, 1, NumTypes));
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_GET_PUT);
+    scoped_str_arena s_arena(arena);
+    try {
+      access_info::value v_ai;
+      if (tbl_access_info->get(txn, Encode(obj_key0, k_ai), obj_v))
+        computation_n += Decode(obj_v, v_ai)->data1;
+      else
+        ++evt_tatp_unsuccessful_txns;
+      measure_txn_counters(txn, "txn_get_access_data");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnGetAccessData(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_get_access_data();
+  }
+
+  txn_result
+  txn_update_subscriber_data()
+  {
+    const uint32_t s_id = PickSubscriberId(r);
+    const bool bit_1 = r.next() % 2;
+    const special_facility::key k_sf(s_id, RandomNumber(r, 1, NumTypes));
+    const uint8_t data_a = RandomNumber(r, 0, 255);
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const subscriber::key k_s(s_id);
+      subscriber::value v_s;
+      ALWAYS_ASSERT(tbl_subscriber->get(txn, Encode(obj_key0, k_s), obj_v));
+      Decode(obj_v, v_s);
+      v_s.s_bits = (v_s.s_bits & ~1) | bit_1;
+      tbl_subscriber->put(txn, Encode(str(), k_s), Encode(str(), v_s));
+
+      special_facility::value v_sf;
+      if (tbl_special_facility->get(txn, Encode(obj_key0, k_sf), obj_v)) {
+        Decode(obj_v, v_sf);
+        v_sf.data_a = data_a;
+        tbl_special_facility->put(txn, Encode(str(), k_sf), Encode(str(), v_sf));
+      } else {
+        ++evt_tatp_unsuccessful_txns;
+      }
+      measure_txn_counters(txn, "txn_update_subscriber_data");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnUpdateSubscriberData(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_update_subscriber_data();
+  }
+
+  txn_result
+  txn_update_location()
+  {
+    const string sub_nbr = SubscriberNumber(PickSubscriberId(r));
+    const uint32_t vlr_location = r.next();
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const subscriber::key k_s(LookupSubscriberId(txn, sub_nbr));
+      subscriber::value v_s;
+      ALWAYS_ASSERT(tbl_subscriber->get(txn, Encode(obj_key0, k_s), obj_v));
+      Decode(obj_v, v_s);
+      v_s.vlr_location = vlr_location;
+      tbl_subscriber->put(txn, Encode(str(), k_s), Encode(str(), v_s));
+      measure_txn_counters(txn, "txn_update_location");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, 0);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnUpdateLocation(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_update_location();
+  }
+
+  txn_result
+  txn_insert_call_forwarding()
+  {
+    const string sub_nbr = SubscriberNumber(PickSubscriberId(r));
+    const uint8_t sf_type = RandomNumber(r, 1, NumTypes);
+    const uint8_t start_time = RandomStartTime(r);
+    call_forwarding::value v_cf;
+    v_cf.end_time = start_time + RandomNumber(r, 1, 8);
+    v_cf.numberx.assign(RandomStr(r, 15, '0', 10));
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const uint32_t s_id = LookupSubscriberId(txn, sub_nbr);
+      // the subscriber's special facilities, which the forwarding must be of
+      static_limit_callback<NumTypes> c(s_arena.get(), false);
+      const special_facility::key k_sf_0(s_id, 0);
+      const special_facility::key k_sf_1(s_id, NumTypes + 1);
+      tbl_special_facility->scan(
+          txn, Encode(obj_key0, k_sf_0), &Encode(obj_key1, k_sf_1), c, s_arena.get());
+      bool has_sf = false;
+      for (size_t i = 0; i < c.size(); i++) {
+        special_facility::key k_sf;
+        if (Decode(*c.values[i].first, k_sf)->sf_type == sf_type)
+          has_sf = true;
+      }
+      ssize_t ret = 0;
+      const call_forwarding::key k_cf(s_id, sf_type, start_time);
+      // the primary key must not exist yet
+      if (has_sf && !tbl_call_forwarding->get(txn, Encode(obj_key0, k_cf), obj_v)) {
+        const string &v = Encode(str(), v_cf);
+        tbl_call_forwarding->put(txn, Encode(str(), k_cf), v);
+        ret = v.size();
+      } else {
+        ++evt_tatp_unsuccessful_txns;
+      }
+      measure_txn_counters(txn, "txn_insert_call_forwarding");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, ret);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnInsertCallForwarding(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_insert_call_forwarding();
+  }
+
+  txn_result
+  txn_delete_call_forwarding()
+  {
+    const string sub_nbr = SubscriberNumber(PickSubscriberId(r));
+    const uint8_t sf_type = RandomNumber(r, 1, NumTypes);
+    const uint8_t start_time = RandomStartTime(r);
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+    scoped_str_arena s_arena(arena);
+    try {
+      const call_forwarding::key k_cf(LookupSubscriberId(txn, sub_nbr), sf_type, start_time);
+      ssize_t ret = 0;
+      if (tbl_call_forwarding->get(txn, Encode(obj_key0, k_cf), obj_v)) {
+        tbl_call_forwarding->remove(txn, Encode(str(), k_cf));
+        ret = -obj_v.size();
+      } else {
+        ++evt_tatp_unsuccessful_txns;
+      }
+      measure_txn_counters(txn, "txn_delete_call_forwarding");
+      if (likely(db->commit_txn(txn)))
+        return txn_result(true, ret);
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnDeleteCallForwarding(bench_worker *w)
+  {
+    return static_cast<tatp_worker *>(w)->txn_delete_call_forwarding();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    unsigned m = 0;
+    for (size_t i = 0; i < ARRAY_NELEMS(g_txn_workload_mix); i++)
+      m += g_txn_workload_mix[i];
+    ALWAYS_ASSERT(m == 100);
+    if (g_txn_workload_mix[0])
+      w.push_back(workload_desc("GetSubscriberData", double(g_txn_workload_mix[0])/100.0, TxnGetSubscriberData));
+    if (g_txn_workload_mix[1])
+      w.push_back(workload_desc("GetNewDestination", double(g_txn_workload_mix[1])/100.0, TxnGetNewDestination));
+    if (g_txn_workload_mix[2])
+      w.push_back(workload_desc("GetAccessData", double(g_txn_workload_mix[2])/100.0, TxnGetAccessData));
+    if (g_txn_workload_mix[3])
+      w.push_back(workload_desc("UpdateSubscriberData", double(g_txn_workload_mix[3])/100.0, TxnUpdateSubscriberData));
+    if (g_txn_workload_mix[4])
+      w.push_back(workload_desc("UpdateLocation", double(g_txn_workload_mix[4])/100.0, TxnUpdateLocation));
+    if (g_txn_workload_mix[5])
+      w.push_back(workload_desc("InsertCallForwarding", double(g_txn_workload_mix[5])/100.0, TxnInsertCallForwarding));
+    if (g_txn_workload_mix[6])
+      w.push_back(workload_desc("DeleteCallForwarding", double(g_txn_workload_mix[6])/100.0, TxnDeleteCallForwarding));
+    return w;
+  }
+
+protected:
+
+  virtual void
+  on_run_setup() OVERRIDE
+  {
+    if (!pin_cpus)
+      return;
+    rcu::s_instance.pin_current_thread(bench_loader::WorkerCpu(worker_id));
+    rcu::s_instance.fault_region();
+  }
+
+  inline ALWAYS_INLINE string &
+  str()
+  {
+    return *arena.next();
+  }
+
+private:
+
+  // the secondary lookup. every sub_nbr the txns pick exists
+  inline uint32_t
+  LookupSubscriberId(void *txn, const string &sub_nbr)
+  {
+    subscriber_nbr_idx::key k_idx;
+    k_idx.sub_nbr.assign(sub_nbr);
+    subscriber_nbr_idx::value v_idx;
+    ALWAYS_ASSERT(tbl_subscriber_nbr_idx->get(txn, Encode(obj_key0, k_idx), obj_v));
+    return Decode(obj_v, v_idx)->s_id;
+  }
+
+  abstract_ordered_index *tbl_subscriber;
+  abstract_ordered_index *tbl_subscriber_nbr_idx;
+  abstract_ordered_index *tbl_access_info;
+  abstract_ordered_index *tbl_special_facility;
+  abstract_ordered_index *tbl_call_forwarding;
+
+  // scratch buffer space
+  string obj_key0;
+  string obj_key1;
+  string obj_v;
+
+  uint64_t computation_n;
+};
+
+// loads subscribers [s_id_start, s_id_end) (and all of their records)
+class tatp_loader : public bench_loader, public tatp_worker_mixin {
+public:
+  tatp_loader(unsigned long seed,
+              abstract_db *db,
+              const map<string, abstract_ordered_index *> &open_tables,
+              uint32_t s_id_start,
+              uint32_t s_id_end)
+    : bench_loader(seed, db, open_tables),
+      s_id_start(s_id_start), s_id_end(s_id_end)
+  {
+    INVARIANT(s_id_end > s_id_start);
+  }
+
+protected:
+  virtual void
+  load()
+  {
+    // about 11 records a subscriber
+    const size_t batchsize = (db->txn_max_batch_size() == -1) ?
+      10000 : max(db->txn_max_batch_size() / 11, ssize_t(1));
+    for (uint32_t b = s_id_start; b < s_id_end;) {
+      scoped_str_arena s_arena(arena);
+      void * const txn = db->new_txn(txn_flags, arena, txn_buf());
+      const uint32_t bend = min(uint64_t(b) + batchsize, uint64_t(s_id_end));
+      try {
+        for (uint32_t s_id = b; s_id < bend; s_id++)
+          load_subscriber(txn, s_id);
+        // a failed commit has already aborted (and released) the txn
+        if (db->commit_txn(txn))
+          b = bend;
+      } catch (abstract_db::abstract_abort_exception &ex) {
+        db->abort_txn(txn);
+      }
+    }
+    if (verbose)
+      cerr << "[INFO] finished loading subscribers [" << s_id_start
+           << ", " << s_id_end << ")" << endl;
+  }
+
+private:
+  void
+  load_subscriber(void *txn, uint32_t s_id)
+  {
+    abstract_ordered_index *tbl_subscriber = open_tables.at("subscriber");
+    abstract_ordered_index *tbl_subscriber_nbr_idx = open_tables.at("subscriber_nbr_idx");
+    abstract_ordered_index *tbl_access_info = open_tables.at("access_info");
+    abstract_ordered_index *tbl_special_facility = open_tables.at("special_facility");
+    abstract_ordered_index *tbl_call_forwarding = open_tables.at("call_forwarding");
+    string obj_buf;
+
+    const string sub_nbr = SubscriberNumber(s_id);
+    subscriber::value v_s;
+    v_s.sub_nbr.assign(sub_nbr);
+    v_s.s_bits = r.next() & 0x3ff;              // 10 bits
+    v_s.s_hexes = r.next() & 0xffffffffffULL;   // 10 hex digits
+    v_s.s_byte2.assign(RandomStr(r, 10, 0, 256)); // 10 bytes
+    v_s.msc_location = r.next();
+    v_s.vlr_location = r.next();
+    tbl_subscriber->insert(txn, Encode(subscriber::key(s_id)), Encode(obj_buf, v_s));
+
+    subscriber_nbr_idx::key k_idx;
+    k_idx.sub_nbr.assign(sub_nbr);
+    tbl_subscriber_nbr_idx->insert(
+        txn, Encode(k_idx), Encode(obj_buf, subscriber_nbr_idx::value(s_id)));
+
+    uint8_t types[NumTypes];
+    const size_t nai = RandomTypes(r, types);
+    for (size_t i = 0; i < nai; i++) {
+      access_info::value v_ai;
+      v_ai.data1 = RandomNumber(r, 0, 255);
+      v_ai.data2 = RandomNumber(r, 0, 255);
+      v_ai.data3.assign(RandomStr(r, 3, 'A', 26));
+      v_ai.data4.assign(RandomStr(r, 5, 'A', 26));
+      tbl_access_info->insert(
+          txn, Encode(access_info::key(s_id, types[i])), Encode(obj_buf, v_ai));
+    }
+
+    const size_t nsf = RandomTypes(r, types);
+    for (size_t i = 0; i < nsf; i++) {
+      special_facility::value v_sf;
+      v_sf.is_active = RandomNumber(r, 1, 100) <= 85;
+      v_sf.error_cntrl = RandomNumber(r, 0, 255);
+      v_sf.data_a = RandomNumber(r, 0, 255);
+      v_sf.data_b.assign(RandomStr(r, 5, 'A', 26));
+      tbl_special_facility->insert(
+          txn, Encode(special_facility::key(s_id, types[i])), Encode(obj_buf, v_sf));
+
+      // 0-3 forwardings, of distinct start times
+      const unsigned ncf = RandomNumber(r, 0, 3);
+      const unsigned skip = ncf == 2 ? RandomNumber(r, 0, 2) : 3;
+      for (unsigned j = 0; j < 3 && ncf; j++) {
+        if (j == skip || (ncf == 1 && j))
+          continue;
+        const uint8_t start_time = 8 * (ncf == 1 ? RandomNumber(r, 0, 2) : j);
+        call_forwarding::value v_cf;
+        v_cf.end_time = start_time + RandomNumber(r, 1, 8);
+        v_cf.numberx.assign(RandomStr(r, 15, '0', 10));
+        tbl_call_forwarding->insert(
+            txn, Encode(call_forwarding::key(s_id, types[i], start_time)),
+            Encode(obj_buf, v_cf));
+      }
+    }
+  }
+
+  uint32_t s_id_start;
+  uint32_t s_id_end;
+};
+
+class tatp_bench_runner : public bench_runner {
+public:
+  tatp_bench_runner(abstract_db *db)
+    : bench_runner(db)
+  {
+    open_tables["subscriber"] =
+      OpenPointTable(db, "subscriber", sizeof(subscriber::value));
+    open_tables["subscriber_nbr_idx"] =
+      OpenPointTable(db, "subscriber_nbr_idx", sizeof(subscriber_nbr_idx::value));
+    open_tables["access_info"] =
+      OpenPointTable(db, "access_info", sizeof(access_info::value));
+    open_tables["special_facility"] =
+      db->open_index("special_facility", sizeof(special_facility::value));
+    open_tables["call_forwarding"] =
+      db->open_index("call_forwarding", sizeof(call_forwarding::value));
+  }
+
+protected:
+  virtual vector<bench_loader *>
+  make_loaders()
+  {
+    vector<bench_loader *> ret;
+    if (enable_parallel_loading && nsubscribers >= nthreads) {
+      // each worker's cpu loads a slice
+      fast_random r(1248943);
+      const size_t nperloader = nsubscribers / nthreads;
+      for (size_t i = 0; i < nthreads; i++) {
+        const uint32_t send = (i + 1 == nthreads) ?
+          nsubscribers + 1 : (i + 1) * nperloader + 1;
+        bench_loader * const l =
+          new tatp_loader(r.next(), db, open_tables, i * nperloader + 1, send);
+        l->set_home_worker(i);
+        ret.push_back(l);
+      }
+    } else {
+      ret.push_back(new tatp_loader(1248943, db, open_tables, 1, nsubscribers + 1));
+    }
+    return ret;
+  }
+
+  virtual vector<bench_worker *>
+  make_workers()
+  {
+    const unsigned alignment = coreid::num_cpus_online();
+    const int blockstart =
+      coreid::allocate_contiguous_aligned_block(nthreads, alignment);
+    ALWAYS_ASSERT(blockstart >= 0);
+    ALWAYS_ASSERT((blockstart % alignment) == 0);
+    fast_random r(7659123);
+    vector<bench_worker *> ret;
+    for (size_t i = 0; i < nthreads; i++)
+      ret.push_back(
+        new tatp_worker(
+          blockstart + i, r.next(), db, open_tables,
+          &barrier_a, &barrier_b));
+    return ret;
+  }
+
+private:
+  static abstract_ordered_index *
+  OpenPointTable(abstract_db *db, const char *name, size_t expected_size)
+  {
+    if (g_enable_point_indexes)
+      return db->open_point_index(name, expected_size);
+    return db->open_index(name, expected_size);
+  }
+};
+
+void
+tatp_do_test(abstract_db *db, int argc, char **argv)
+{
+  nsubscribers = size_t(scale_factor * 100000.0);
+  ALWAYS_ASSERT(nsubscribers > 0);
+  ALWAYS_ASSERT(nsubscribers < numeric_limits<uint32_t>::max());
+
+  // parse options
+  optind = 1;
+  while (1) {
+    static struct option long_options[] = {
+      {"enable-point-indexes"    , no_argument       , &g_enable_point_indexes    , 1}   ,
+      {"uniform-subscriber-dist" , no_argument       , &g_uniform_subscriber_dist , 1}   ,
+      {"workload-mix"            , required_argument , 0                          , 'w'} ,
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "w:", long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case 'w':
+      {
+        const vector<string> toks = split(optarg, ',');
+        ALWAYS_ASSERT(toks.size() == ARRAY_NELEMS(g_txn_workload_mix));
+        unsigned s = 0;
+        for (size_t i = 0; i < toks.size(); i++) {
+          unsigned p = strtoul(toks[i].c_str(), nullptr, 10);
+          ALWAYS_ASSERT(p >= 0 && p <= 100);
+          s += p;
+          g_txn_workload_mix[i] = p;
+        }
+        ALWAYS_ASSERT(s == 100);
+      }
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+
+  if (verbose) {
+    cerr << "tatp settings:" << endl;
+    cerr << "  subscribers            : " << nsubscribers << endl;
+    cerr << "  point_indexes          : " << g_enable_point_indexes << endl;
+    cerr << "  uniform_subscriber_dist: " << g_uniform_subscriber_dist << endl;
+    cerr << "  workload_mix           : " <<
+      format_list(g_txn_workload_mix,
+                  g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix)) << endl;
+  }
+
+  tatp_bench_runner r(db);
+  r.run();
+}
@@ -16,6 +16,7 @@
 #include <set>
 #include <vector>
 
+#include "../allocator.h"
 #include "../txn.h"
 #include "../macros.h"
 #include "../scopedperf.hh"
@@ -142,12 +143,17 @@ private:
 // configuration flags
 static int g_disable_xpartition_txn = 0;
 static int g_disable_read_only_scans = 0;
+static uint64_t g_read_only_staleness_usec = 0; // 0 for the usual snapshot
 static int g_enable_partition_locks = 0;
 static int g_enable_separate_tree_per_partition = 0;
+static int g_home_partitions = 0; // each partition's trees on its worker's node
+static int g_partitioned_execution = 0; // see abstract_db::enter_partitions()
+static int g_enable_point_indexes = 0;
 static int g_new_order_remote_item_pct = 1;
 static int g_new_order_fast_id_gen = 0;
 static int g_uniform_item_dist = 0;
 static int g_order_status_scan_hack = 0;
+static size_t g_ch_analytic_threads = 0; // see tpcc_ch_worker
 static unsigned g_txn_workload_mix[] = { 45, 43, 4, 4, 4 }; // default TPC-C workload mix
 
 static aligned_padded_elem<spinlock> *g_partition_locks = nullptr;
@@ -176,6 +182,12 @@ LockForPartition(unsigned int wid)
   return g_partition_locks[PartitionId(wid)].elem;
 }
 
+static inline size_t
+NPartitions()
+{
+  return std::min(size_t(NumWarehouses()), nthreads);
+}
+
 static inline atomic<uint64_t> &
 NewOrderIdHolder(unsigned warehouse, unsigned district)
 {
@@ -192,6 +204,16 @@ FastNewOrderIdGen(unsigned warehouse, unsigned district)
   return NewOrderIdHolder(warehouse, district).fetch_add(1, memory_order_acq_rel);
 }
 
+static inline uint64_t
+ReadOnlyTxnFlags()
+{
+  if (g_disable_read_only_scans)
+    return 0;
+  if (g_read_only_staleness_usec)
+    return transaction_base::BoundedStalenessFlags(g_read_only_staleness_usec);
+  return transaction_base::TXN_FLAG_READ_ONLY;
+}
+
 struct checker {
   // these sanity checks are just a few simple checks to make sure
   // the data is not entirely corrupted
@@ -318,8 +340,7 @@ protected: \
       cerr << "PinToWarehouseId(): coreid=" << coreid::core_id()
            << " pinned to whse=" << wid << " (partid=" << partid << ")"
            << endl;
-    rcu::s_instance.pin_current_thread(pinid);
-    rcu::s_instance.fault_region();
+    bench_loader::PinToWorker(pinid);
   }
 
 public:
@@ -609,9 +630,7 @@ protected:
   {
     if (!pin_cpus)
       return;
-    const size_t a = worker_id % coreid::num_cpus_online();
-    const size_t b = a % nthreads;
-    rcu::s_instance.pin_current_thread(b);
+    rcu::s_instance.pin_current_thread(bench_loader::WorkerCpu(worker_id));
     rcu::s_instance.fault_region();
   }
 
@@ -720,44 +739,55 @@ protected:
   load()
   {
     string obj_buf;
-    const ssize_t bsize = db->txn_max_batch_size();
-    void *txn = db->new_txn(txn_flags, arena, txn_buf());
     uint64_t total_sz = 0;
-    try {
-      for (uint i = 1; i <= NumItems(); i++) {
-        // items don't "belong" to a certain warehouse, so no pinning
-        const item::key k(i);
-
-        item::value v;
-        const string i_name = RandomStr(r, RandomNumber(r, 14, 24));
-        v.i_name.assign(i_name);
-        v.i_price = (float) RandomNumber(r, 100, 10000) / 100.0;
-        const int len = RandomNumber(r, 26, 50);
-        if (RandomNumber(r, 1, 100) > 10) {
-          const string i_data = RandomStr(r, len);
-          v.i_data.assign(i_data);
-        } else {
-          const int startOriginal = RandomNumber(r, 2, (len - 8));
-          const string i_data = RandomStr(r, startOriginal + 1) + "ORIGINAL" + RandomStr(r, len - startOriginal - 7);
-          v.i_data.assign(i_data);
-        }
-        v.i_im_id = RandomNumber(r, 1, 10000);
+    // this table is shared, so any partition is OK. it is only loaded here,
+    // so it can be bulk loaded (the keys are big endian, so sorted)
+    abstract_ordered_index * const tbl = tbl_item(1);
+    vector<string> keys, values;
+    keys.reserve(NumItems());
+    values.reserve(NumItems());
+    for (uint i = 1; i <= NumItems(); i++) {
+      // items don't "belong" to a certain warehouse, so no pinning
+      const item::key k(i);
+      item::value v;
+      const string i_name = RandomStr(r, RandomNumber(r, 14, 24));
+      v.i_name.assign(i_name);
+      v.i_price = (float) RandomNumber(r, 100, 10000) / 100.0;
+      const int len = RandomNumber(r, 26, 50);
+      if (RandomNumber(r, 1, 100) > 10) {
+        const string i_data = RandomStr(r, len);
+        v.i_data.assign(i_data);
+      } else {
+        const int startOriginal = RandomNumber(r, 2, (len - 8));
+        const string i_data = RandomStr(r, startOriginal + 1) + "ORIGINAL" + RandomStr(r, len - startOriginal - 7);
+        v.i_data.assign(i_data);
+      }
+      v.i_im_id = RandomNumber(r, 1, 10000);
 
-        checker::SanityCheckItem(&k, &v);
-        const size_t sz = Size(v);
-        total_sz += sz;
-        tbl_item(1)->insert(txn, Encode(k), Encode(obj_buf, v)); // this table is shared, so any partition is OK
+      checker::SanityCheckItem(&k, &v);
+      const size_t sz = Size(v);
+      total_sz += sz;
+      keys.push_back(Encode(k));
+      values.push_back(Encode(obj_buf, v));
+    }
 
-        if (bsize != -1 && !(i % bsize)) {
-          ALWAYS_ASSERT(db->commit_txn(txn));
-          txn = db->new_txn(txn_flags, arena, txn_buf());
-          arena.reset();
+    if (!db->bulk_load(tbl, keys, values)) {
+      const ssize_t bsize = db->txn_max_batch_size();
+      void *txn = db->new_txn(txn_flags, arena, txn_buf());
+      try {
+        for (uint i = 1; i <= NumItems(); i++) {
+          tbl->insert(txn, keys[i - 1], values[i - 1]);
+          if (bsize != -1 && !(i % bsize)) {
+            ALWAYS_ASSERT(db->commit_txn(txn));
+            txn = db->new_txn(txn_flags, arena, txn_buf());
+            arena.reset();
+          }
         }
+        ALWAYS_ASSERT(db->commit_txn(txn));
+      } catch (abstract_db::abstract_abort_exception &ex) {
+        // shouldn't abort on loading!
+        ALWAYS_ASSERT(false);
       }
-      ALWAYS_ASSERT(db->commit_txn(txn));
-    } catch (abstract_db::abstract_abort_exception &ex) {
-      // shouldn't abort on loading!
-      ALWAYS_ASSERT(false);
     }
     if (verbose) {
       cerr << "[INFO] finished loading item" << endl;
@@ -849,7 +879,7 @@ protected:
           if (db->commit_txn(txn)) {
             b++;
           } else {
-            db->abort_txn(txn);
+            // already aborted (and released) by the failed commit
             if (verbose)
               cerr << "[WARNING] stock loader loading abort" << endl;
           }
@@ -1297,6 +1327,13 @@ tpcc_worker::txn_new_order()
     }
     mlock.multilock();
   }
+  if (g_partitioned_execution) {
+    unsigned parts[16];
+    parts[0] = PartitionId(warehouse_id);
+    for (uint i = 0; i < numItems; i++)
+      parts[i + 1] = PartitionId(supplierWarehouseIDs[i]);
+    db->enter_partitions(txn, parts, allLocal ? 1 : numItems + 1);
+  }
   try {
     ssize_t ret = 0;
     const customer::key k_c(warehouse_id, districtID, customerID);
@@ -1456,6 +1493,10 @@ tpcc_worker::txn_delivery()
   scoped_str_arena s_arena(arena);
   scoped_lock_guard<spinlock> slock(
       g_enable_partition_locks ? &LockForPartition(warehouse_id) : nullptr);
+  if (g_partitioned_execution) {
+    const unsigned part = PartitionId(warehouse_id);
+    db->enter_partitions(txn, &part, 1);
+  }
   try {
     ssize_t ret = 0;
     for (uint d = 1; d <= NumDistrictsPerWarehouse(); d++) {
@@ -1578,6 +1619,11 @@ tpcc_worker::txn_payment()
       mlock.enq(LockForPartition(customerWarehouseID));
     mlock.multilock();
   }
+  if (g_partitioned_execution) {
+    const unsigned parts[] =
+      { PartitionId(warehouse_id), PartitionId(customerWarehouseID) };
+    db->enter_partitions(txn, parts, ARRAY_NELEMS(parts));
+  }
   if (customerWarehouseID != warehouse_id)
     ++evt_tpcc_cross_partition_payment_txns;
   try {
@@ -1736,10 +1782,10 @@ tpcc_worker::txn_order_status()
   //   max_read_set_size : 81
   //   max_write_set_size : 0
   //   num_txn_contexts : 4
-  const uint64_t read_only_mask =
-    g_disable_read_only_scans ? 0 : transaction_base::TXN_FLAG_READ_ONLY;
+  const uint64_t read_only_mask = ReadOnlyTxnFlags();
+  // a bounded staleness txn might need a read set after all
   const abstract_db::TxnProfileHint hint =
-    g_disable_read_only_scans ?
+    (g_disable_read_only_scans || g_read_only_staleness_usec) ?
       abstract_db::HINT_TPCC_ORDER_STATUS :
       abstract_db::HINT_TPCC_ORDER_STATUS_READ_ONLY;
   void *txn = db->new_txn(txn_flags | read_only_mask, arena, txn_buf(), hint);
@@ -1893,10 +1939,10 @@ tpcc_worker::txn_stock_level()
   //   n_node_scan_large_instances : 1
   //   n_read_set_large_instances : 2
   //   num_txn_contexts : 3
-  const uint64_t read_only_mask =
-    g_disable_read_only_scans ? 0 : transaction_base::TXN_FLAG_READ_ONLY;
+  const uint64_t read_only_mask = ReadOnlyTxnFlags();
+  // a bounded staleness txn might need a read set after all
   const abstract_db::TxnProfileHint hint =
-    g_disable_read_only_scans ?
+    (g_disable_read_only_scans || g_read_only_staleness_usec) ?
       abstract_db::HINT_TPCC_STOCK_LEVEL :
       abstract_db::HINT_TPCC_STOCK_LEVEL_READ_ONLY;
   void *txn = db->new_txn(txn_flags | read_only_mask, arena, txn_buf(), hint);
@@ -1955,6 +2001,368 @@ tpcc_worker::txn_stock_level()
   return txn_result(false, 0);
 }
 
+// calls fn(key, value) on each record a scan finds
+template <typename Record, typename Fn>
+class record_scan_callback : public abstract_ordered_index::scan_callback {
+public:
+  record_scan_callback(Fn fn) : fn(fn) {}
+  virtual bool invoke(
+      const char *keyp, size_t keylen,
+      const string &value)
+  {
+    INVARIANT(keylen == sizeof(typename Record::key));
+    typename Record::key k_temp;
+    typename Record::value v_temp;
+    fn(*Decode(keyp, k_temp), *Decode(value, v_temp));
+    return true;
+  }
+private:
+  Fn fn;
+};
+
+/**
+ * CH-benCHmark (Cole et al., "The mixed workload CH-benCHmark") analytic
+ * queries, which are TPC-H's over the live TPC-C tables. We run the ones
+ * which need nothing but TPC-C's tables (CH adds supplier, nation and
+ * region): Q1, Q4, Q6, Q12 and Q14.
+ *
+ * Each query is one snapshot txn over every warehouse, so it neither aborts
+ * the OLTP txns nor is aborted by them, but it does hold up GC for as long
+ * as it runs. The tables have TPC-C's times (in ms) for dates, so the date
+ * ranges of the queries become "delivered" (a non-zero ol_delivery_d)
+ */
+class tpcc_ch_worker : public bench_worker, public tpcc_worker_mixin {
+public:
+  tpcc_ch_worker(unsigned int worker_id,
+                 unsigned long seed, abstract_db *db,
+                 const map<string, abstract_ordered_index *> &open_tables,
+                 const map<string, vector<abstract_ordered_index *>> &partitions,
+                 spin_barrier *barrier_a, spin_barrier *barrier_b,
+                 unsigned int pinid)
+    : bench_worker(worker_id, true, seed, db,
+                   open_tables, barrier_a, barrier_b),
+      tpcc_worker_mixin(partitions),
+      pinid(pinid),
+      computation(0.0)
+  {
+    obj_key0.reserve(str_arena::MinStrReserveLength);
+    obj_key1.reserve(str_arena::MinStrReserveLength);
+  }
+
+  txn_result query1();
+
+  static txn_result
+  Query1(bench_worker *w)
+  {
+    return static_cast<tpcc_ch_worker *>(w)->query1();
+  }
+
+  txn_result query4();
+
+  static txn_result
+  Query4(bench_worker *w)
+  {
+    return static_cast<tpcc_ch_worker *>(w)->query4();
+  }
+
+  txn_result query6();
+
+  static txn_result
+  Query6(bench_worker *w)
+  {
+    return static_cast<tpcc_ch_worker *>(w)->query6();
+  }
+
+  txn_result query12();
+
+  static txn_result
+  Query12(bench_worker *w)
+  {
+    return static_cast<tpcc_ch_worker *>(w)->query12();
+  }
+
+  txn_result query14();
+
+  static txn_result
+  Query14(bench_worker *w)
+  {
+    return static_cast<tpcc_ch_worker *>(w)->query14();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    w.push_back(workload_desc("CH-Q1", 0.2, Query1));
+    w.push_back(workload_desc("CH-Q4", 0.2, Query4));
+    w.push_back(workload_desc("CH-Q6", 0.2, Query6));
+    w.push_back(workload_desc("CH-Q12", 0.2, Query12));
+    w.push_back(workload_desc("CH-Q14", 0.2, Query14));
+    return w;
+  }
+
+protected:
+
+  virtual void
+  on_run_setup() OVERRIDE
+  {
+    if (!pin_cpus)
+      return;
+    rcu::s_instance.pin_current_thread(pinid);
+    rcu::s_instance.fault_region();
+  }
+
+private:
+
+  // the orders of a warehouse, in key order, as the joins with order_line
+  // need them
+  struct order_info {
+    int32_t d_id;
+    int32_t o_id;
+    int32_t carrier_id;
+    int8_t ol_cnt;
+    uint32_t entry_d;
+    bool matched;
+  };
+
+  inline void *
+  new_query_txn()
+  {
+    return db->new_txn(
+        txn_flags | transaction_base::TXN_FLAG_READ_ONLY, arena, txn_buf(),
+        abstract_db::HINT_TPCC_CH_QUERY_READ_ONLY);
+  }
+
+  template <typename Fn>
+  void
+  scan_order_lines(void *txn, uint warehouse_id, Fn fn)
+  {
+    const order_line::key k_ol_0(warehouse_id, 0, 0, 0);
+    const order_line::key k_ol_1(warehouse_id + 1, 0, 0, 0);
+    record_scan_callback<order_line, Fn> c(fn);
+    tbl_order_line(warehouse_id)->scan(
+        txn, Encode(obj_key0, k_ol_0), &Encode(obj_key1, k_ol_1), c);
+  }
+
+  void
+  scan_orders(void *txn, uint warehouse_id, vector<order_info> &orders)
+  {
+    orders.clear();
+    const oorder::key k_oo_0(warehouse_id, 0, 0);
+    const oorder::key k_oo_1(warehouse_id + 1, 0, 0);
+    auto fn = [&orders](const oorder::key &k, const oorder::value &v) {
+      orders.push_back(order_info{
+          k.o_d_id, k.o_id, v.o_carrier_id, v.o_ol_cnt, v.o_entry_d, false});
+    };
+    record_scan_callback<oorder, decltype(fn)> c(fn);
+    tbl_oorder(warehouse_id)->scan(
+        txn, Encode(obj_key0, k_oo_0), &Encode(obj_key1, k_oo_1), c);
+  }
+
+  // calls fn(order, key, value) on each order line of warehouse_id, with
+  // the order it belongs to. a merge join, since both tables are in
+  // (district, order) order
+  template <typename Fn>
+  void
+  join_orders_order_lines(void *txn, uint warehouse_id,
+                          vector<order_info> &orders, Fn fn)
+  {
+    scan_orders(txn, warehouse_id, orders);
+    size_t pos = 0;
+    scan_order_lines(txn, warehouse_id,
+        [&](const order_line::key &k, const order_line::value &v) {
+      while (pos < orders.size() &&
+             (orders[pos].d_id < k.ol_d_id ||
+              (orders[pos].d_id == k.ol_d_id && orders[pos].o_id < k.ol_o_id)))
+        pos++;
+      // the same snapshot has both the order and its lines
+      INVARIANT(pos < orders.size());
+      INVARIANT(orders[pos].d_id == k.ol_d_id && orders[pos].o_id == k.ol_o_id);
+      fn(orders[pos], k, v);
+    });
+  }
+
+  inline txn_result
+  commit_query(void *txn, const char *name)
+  {
+    measure_txn_counters(txn, name);
+    if (likely(db->commit_txn(txn)))
+      return txn_result(true, 0);
+    return txn_result(false, 0);
+  }
+
+  const unsigned int pinid;
+
+  string obj_key0;
+  string obj_key1;
+  vector<order_info> orders;
+  vector<bool> promo_items;
+  double computation; // so the aggregates aren't optimized away
+};
+
+static const size_t NMaxOrderLines = 15;
+
+tpcc_ch_worker::txn_result
+tpcc_ch_worker::query1()
+{
+  // select ol_number, sum(ol_quantity), sum(ol_amount), avg(ol_quantity),
+  //        avg(ol_amount), count(*)
+  // from order_line where ol_delivery_d > ? group by ol_number
+  void *txn = new_query_txn();
+  scoped_str_arena s_arena(arena);
+  try {
+    uint64_t sum_qty[NMaxOrderLines + 1] = {0};
+    double sum_amount[NMaxOrderLines + 1] = {0.0};
+    uint64_t count[NMaxOrderLines + 1] = {0};
+    for (uint w = 1; w <= NumWarehouses(); w++)
+      scan_order_lines(txn, w,
+          [&](const order_line::key &k, const order_line::value &v) {
+        if (!v.ol_delivery_d)
+          return;
+        INVARIANT(k.ol_number >= 1 && k.ol_number <= int32_t(NMaxOrderLines));
+        sum_qty[k.ol_number] += v.ol_quantity;
+        sum_amount[k.ol_number] += v.ol_amount;
+        count[k.ol_number]++;
+      });
+    for (size_t i = 1; i <= NMaxOrderLines; i++)
+      if (count[i])
+        computation += sum_qty[i] + sum_amount[i] / double(count[i]);
+    return commit_query(txn, "ch_query1");
+  } catch (abstract_db::abstract_abort_exception &ex) {
+    db->abort_txn(txn);
+  }
+  return txn_result(false, 0);
+}
+
+tpcc_ch_worker::txn_result
+tpcc_ch_worker::query4()
+{
+  // select o_ol_cnt, count(*) from oorder
+  // where exists (select * from order_line
+  //               where o_id = ol_o_id and o_w_id = ol_w_id and
+  //                     o_d_id = ol_d_id and ol_delivery_d >= o_entry_d)
+  // group by o_ol_cnt
+  void *txn = new_query_txn();
+  scoped_str_arena s_arena(arena);
+  try {
+    uint64_t count[NMaxOrderLines + 1] = {0};
+    for (uint w = 1; w <= NumWarehouses(); w++)
+      join_orders_order_lines(txn, w, orders,
+          [&](order_info &o, const order_line::key &, const order_line::value &v) {
+        if (o.matched || v.ol_delivery_d < o.entry_d)
+          return;
+        o.matched = true;
+        INVARIANT(o.ol_cnt >= 0 && size_t(o.ol_cnt) <= NMaxOrderLines);
+        count[o.ol_cnt]++;
+      });
+    for (size_t i = 0; i <= NMaxOrderLines; i++)
+      computation += count[i];
+    return commit_query(txn, "ch_query4");
+  } catch (abstract_db::abstract_abort_exception &ex) {
+    db->abort_txn(txn);
+  }
+  return txn_result(false, 0);
+}
+
+tpcc_ch_worker::txn_result
+tpcc_ch_worker::query6()
+{
+  // select sum(ol_amount) from order_line
+  // where ol_delivery_d > ? and ol_quantity between 1 and 100000
+  void *txn = new_query_txn();
+  scoped_str_arena s_arena(arena);
+  try {
+    double revenue = 0.0;
+    for (uint w = 1; w <= NumWarehouses(); w++)
+      scan_order_lines(txn, w,
+          [&](const order_line::key &, const order_line::value &v) {
+        if (v.ol_delivery_d && v.ol_quantity >= 1)
+          revenue += v.ol_amount;
+      });
+    computation += revenue;
+    return commit_query(txn, "ch_query6");
+  } catch (abstract_db::abstract_abort_exception &ex) {
+    db->abort_txn(txn);
+  }
+  return txn_result(false, 0);
+}
+
+tpcc_ch_worker::txn_result
+tpcc_ch_worker::query12()
+{
+  // select o_ol_cnt,
+  //        sum(case when o_carrier_id = 1 or o_carrier_id = 2 then 1 else 0 end),
+  //        sum(case when o_carrier_id <> 1 and o_carrier_id <> 2 then 1 else 0 end)
+  // from oorder, order_line
+  // where ol_w_id = o_w_id and ol_d_id = o_d_id and ol_o_id = o_id and
+  //       o_entry_d <= ol_delivery_d
+  // group by o_ol_cnt
+  void *txn = new_query_txn();
+  scoped_str_arena s_arena(arena);
+  try {
+    uint64_t high[NMaxOrderLines + 1] = {0};
+    uint64_t low[NMaxOrderLines + 1] = {0};
+    for (uint w = 1; w <= NumWarehouses(); w++)
+      join_orders_order_lines(txn, w, orders,
+          [&](order_info &o, const order_line::key &, const order_line::value &v) {
+        if (v.ol_delivery_d < o.entry_d)
+          return;
+        INVARIANT(o.ol_cnt >= 0 && size_t(o.ol_cnt) <= NMaxOrderLines);
+        if (o.carrier_id == 1 || o.carrier_id == 2)
+          high[o.ol_cnt]++;
+        else
+          low[o.ol_cnt]++;
+      });
+    for (size_t i = 0; i <= NMaxOrderLines; i++)
+      computation += high[i] + low[i];
+    return commit_query(txn, "ch_query12");
+  } catch (abstract_db::abstract_abort_exception &ex) {
+    db->abort_txn(txn);
+  }
+  return txn_result(false, 0);
+}
+
+tpcc_ch_worker::txn_result
+tpcc_ch_worker::query14()
+{
+  // select 100.00 * sum(case when i_data like 'PR%' then ol_amount else 0 end) /
+  //        (1 + sum(ol_amount))
+  // from order_line, item
+  // where ol_i_id = i_id and ol_delivery_d >= ? and ol_delivery_d < ?
+  void *txn = new_query_txn();
+  scoped_str_arena s_arena(arena);
+  try {
+    // item is small, and its ids dense, so the join is with a bitmap of it
+    promo_items.assign(NumItems() + 1, false);
+    const item::key k_i_0(1);
+    const item::key k_i_1(NumItems() + 1);
+    auto fn = [this](const item::key &k, const item::value &v) {
+      INVARIANT(k.i_id >= 1 && uint(k.i_id) <= NumItems());
+      promo_items[k.i_id] =
+        v.i_data.size() >= 2 && v.i_data.data()[0] == 'P' && v.i_data.data()[1] == 'R';
+    };
+    record_scan_callback<item, decltype(fn)> c(fn);
+    tbl_item(1)->scan(txn, Encode(obj_key0, k_i_0), &Encode(obj_key1, k_i_1), c);
+
+    double promo_revenue = 0.0, revenue = 0.0;
+    for (uint w = 1; w <= NumWarehouses(); w++)
+      scan_order_lines(txn, w,
+          [&](const order_line::key &, const order_line::value &v) {
+        if (!v.ol_delivery_d)
+          return;
+        INVARIANT(v.ol_i_id >= 1 && uint(v.ol_i_id) <= NumItems());
+        if (promo_items[v.ol_i_id])
+          promo_revenue += v.ol_amount;
+        revenue += v.ol_amount;
+      });
+    computation += 100.0 * promo_revenue / (1.0 + revenue);
+    return commit_query(txn, "ch_query14");
+  } catch (abstract_db::abstract_abort_exception &ex) {
+    db->abort_txn(txn);
+  }
+  return txn_result(false, 0);
+}
+
 template <typename T>
 static vector<T>
 unique_filter(const vector<T> &v)
@@ -1985,17 +2393,42 @@ private:
            strcmp("oorder_c_id_idx", name) == 0;
   }
 
+  // tables which are never scanned
+  static bool
+  IsTablePointOnly(const char *name)
+  {
+    return strcmp("customer", name) == 0 ||
+           strcmp("district", name) == 0 ||
+           strcmp("item", name) == 0 ||
+           strcmp("stock", name) == 0 ||
+           strcmp("stock_data", name) == 0 ||
+           strcmp("warehouse", name) == 0;
+  }
+
+  static abstract_ordered_index *
+  OpenIndex(abstract_db *db, const char *name, const string &index_name,
+            size_t expected_size)
+  {
+    if (g_enable_point_indexes && IsTablePointOnly(name))
+      return db->open_point_index(index_name, expected_size);
+    return db->open_index(index_name, expected_size, IsTableAppendOnly(name));
+  }
+
   static vector<abstract_ordered_index *>
   OpenTablesForTablespace(abstract_db *db, const char *name, size_t expected_size)
   {
     const bool is_read_only = IsTableReadOnly(name);
-    const bool is_append_only = IsTableAppendOnly(name);
     const string s_name(name);
     vector<abstract_ordered_index *> ret(NumWarehouses());
     if (g_enable_separate_tree_per_partition && !is_read_only) {
       if (NumWarehouses() <= nthreads) {
-        for (size_t i = 0; i < NumWarehouses(); i++)
-          ret[i] = db->open_index(s_name + "_" + to_string(i), expected_size, is_append_only);
+        for (size_t i = 0; i < NumWarehouses(); i++) {
+          ret[i] = OpenIndex(db, name, s_name + "_" + to_string(i), expected_size);
+          if (g_home_partitions)
+            ret[i]->set_numa_node(::allocator::CpuNode(i));
+          if (g_partitioned_execution)
+            ret[i]->set_partition(i);
+        }
       } else {
         const unsigned nwhse_per_partition = NumWarehouses() / nthreads;
         for (size_t partid = 0; partid < nthreads; partid++) {
@@ -2003,13 +2436,17 @@ private:
           const unsigned wend   = (partid + 1 == nthreads) ?
             NumWarehouses() : (partid + 1) * nwhse_per_partition;
           abstract_ordered_index *idx =
-            db->open_index(s_name + "_" + to_string(partid), expected_size, is_append_only);
+            OpenIndex(db, name, s_name + "_" + to_string(partid), expected_size);
+          if (g_home_partitions)
+            idx->set_numa_node(::allocator::CpuNode(partid));
+          if (g_partitioned_execution)
+            idx->set_partition(partid);
           for (size_t i = wstart; i < wend; i++)
             ret[i] = idx;
         }
       }
     } else {
-      abstract_ordered_index *idx = db->open_index(s_name, expected_size, is_append_only);
+      abstract_ordered_index *idx = OpenIndex(db, name, s_name, expected_size);
       for (size_t i = 0; i < NumWarehouses(); i++)
         ret[i] = idx;
     }
@@ -2018,8 +2455,10 @@ private:
 
 public:
   tpcc_bench_runner(abstract_db *db)
-    : bench_runner(db)
+    : bench_runner(db, g_ch_analytic_threads)
   {
+    if (g_partitioned_execution)
+      ALWAYS_ASSERT(db->init_partitions(NPartitions()));
 
 #define OPEN_TABLESPACE_X(x) \
     partitions[#x] = OpenTablesForTablespace(db, #x, sizeof(x));
@@ -2124,6 +2563,25 @@ protected:
     return ret;
   }
 
+  virtual vector<bench_worker *>
+  make_analytic_workers()
+  {
+    const unsigned alignment = coreid::num_cpus_online();
+    const int blockstart =
+      coreid::allocate_contiguous_aligned_block(g_ch_analytic_threads, alignment);
+    ALWAYS_ASSERT(blockstart >= 0);
+    fast_random r(7345091);
+    vector<bench_worker *> ret;
+    for (size_t i = 0; i < g_ch_analytic_threads; i++)
+      ret.push_back(
+        new tpcc_ch_worker(
+          blockstart + i,
+          r.next(), db, open_tables, partitions,
+          &barrier_a, &barrier_b,
+          (nthreads + i) % coreid::num_cpus_online()));
+    return ret;
+  }
+
 private:
   map<string, vector<abstract_ordered_index *>> partitions;
 };
@@ -2139,17 +2597,22 @@ tpcc_do_test(abstract_db *db, int argc, char **argv)
     {
       {"disable-cross-partition-transactions" , no_argument       , &g_disable_xpartition_txn             , 1}   ,
       {"disable-read-only-snapshots"          , no_argument       , &g_disable_read_only_scans            , 1}   ,
+      {"read-only-staleness-usec"             , required_argument , 0                                     , 's'} ,
       {"enable-partition-locks"               , no_argument       , &g_enable_partition_locks             , 1}   ,
       {"enable-separate-tree-per-partition"   , no_argument       , &g_enable_separate_tree_per_partition , 1}   ,
+      {"home-partitions"                      , no_argument       , &g_home_partitions                    , 1}   ,
+      {"partitioned-execution"                , no_argument       , &g_partitioned_execution              , 1}   ,
+      {"enable-point-indexes"                 , no_argument       , &g_enable_point_indexes               , 1}   ,
       {"new-order-remote-item-pct"            , required_argument , 0                                     , 'r'} ,
       {"new-order-fast-id-gen"                , no_argument       , &g_new_order_fast_id_gen              , 1}   ,
       {"uniform-item-dist"                    , no_argument       , &g_uniform_item_dist                  , 1}   ,
       {"order-status-scan-hack"               , no_argument       , &g_order_status_scan_hack             , 1}   ,
       {"workload-mix"                         , required_argument , 0                                     , 'w'} ,
+      {"ch-analytic-threads"                  , required_argument , 0                                     , 'a'} , // CH-benCHmark
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "r:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "r:s:a:", long_options, &option_index);
     if (c == -1)
       break;
     switch (c) {
@@ -2165,6 +2628,14 @@ tpcc_do_test(abstract_db *db, int argc, char **argv)
       did_spec_remote_pct = true;
       break;
 
+    case 's':
+      g_read_only_staleness_usec = strtoull(optarg, NULL, 10);
+      break;
+
+    case 'a':
+      g_ch_analytic_threads = strtoul(optarg, NULL, 10);
+      break;
+
     case 'w':
       {
         const vector<string> toks = split(optarg, ',');
@@ -2194,16 +2665,35 @@ tpcc_do_test(abstract_db *db, int argc, char **argv)
     cerr << "  --new-order-remote-item-pct will have no effect" << endl;
   }
 
+  if (g_partitioned_execution) {
+    if (g_enable_partition_locks) {
+      cerr << "[ERROR] --partitioned-execution cannot be combined with --enable-partition-locks" << endl;
+      exit(1);
+    }
+    // a txn owns its partitions' tables, so each partition needs its own
+    g_enable_separate_tree_per_partition = 1;
+  }
+
+  if (g_home_partitions && !g_enable_separate_tree_per_partition) {
+    cerr << "WARNING: --home-partitions given without --enable-separate-tree-per-partition" << endl;
+    cerr << "  --home-partitions will have no effect" << endl;
+  }
+
   if (verbose) {
     cerr << "tpcc settings:" << endl;
     cerr << "  cross_partition_transactions : " << !g_disable_xpartition_txn << endl;
     cerr << "  read_only_snapshots          : " << !g_disable_read_only_scans << endl;
+    cerr << "  read_only_staleness_usec     : " << g_read_only_staleness_usec << endl;
     cerr << "  partition_locks              : " << g_enable_partition_locks << endl;
     cerr << "  separate_tree_per_partition  : " << g_enable_separate_tree_per_partition << endl;
+    cerr << "  home_partitions              : " << g_home_partitions << endl;
+    cerr << "  partitioned_execution        : " << g_partitioned_execution << endl;
+    cerr << "  point_indexes                : " << g_enable_point_indexes << endl;
     cerr << "  new_order_remote_item_pct    : " << g_new_order_remote_item_pct << endl;
     cerr << "  new_order_fast_id_gen        : " << g_new_order_fast_id_gen << endl;
     cerr << "  uniform_item_dist            : " << g_uniform_item_dist << endl;
     cerr << "  order_status_scan_hack       : " << g_order_status_scan_hack << endl;
+    cerr << "  ch_analytic_threads          : " << g_ch_analytic_threads << endl;
     cerr << "  workload_mix                 : " <<
       format_list(g_txn_workload_mix,
                   g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix)) << endl;
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workload_trace.h"
+
+using namespace std;
+
+static_assert(sizeof(workload_trace_record) == 24, "trace format changed");
+
+int workload_trace::g_fd = -1;
+
+static bool
+WriteFully(int fd, const void *p, size_t n)
+{
+  const char *c = (const char *) p;
+  while (n) {
+    const ssize_t r = write(fd, c, n);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("workload_trace write");
+      return false;
+    }
+    c += r;
+    n -= r;
+  }
+  return true;
+}
+
+void
+workload_trace::Open(const string &path)
+{
+  ALWAYS_ASSERT(g_fd == -1);
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  // magic, record size, version
+  const uint64_t magic = TraceFileMagic;
+  const uint32_t hdr[2] = {sizeof(workload_trace_record), 1};
+  ALWAYS_ASSERT(WriteFully(fd, &magic, sizeof(magic)));
+  ALWAYS_ASSERT(WriteFully(fd, hdr, sizeof(hdr)));
+  g_fd = fd;
+}
+
+void
+workload_trace::Close()
+{
+  if (g_fd == -1)
+    return;
+  if (fsync(g_fd) == -1)
+    perror("fsync");
+  close(g_fd);
+  g_fd = -1;
+}
+
+void
+workload_trace::writer::flush()
+{
+  if (buf_.empty() || g_fd == -1)
+    return;
+  // O_APPEND, and a short write only happens on errors, so a chunk lands
+  // whole, after whatever chunk went before it
+  WriteFully(g_fd, buf_.data(), buf_.size() * sizeof(buf_[0]));
+  buf_.clear();
+}
+
+bool
+workload_trace::Load(const string &path, record_vec &recs)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return false;
+  }
+  uint64_t magic = 0;
+  uint32_t hdr[2] = {0, 0};
+  if (read(fd, &magic, sizeof(magic)) != sizeof(magic) ||
+      read(fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+      magic != TraceFileMagic ||
+      hdr[0] != sizeof(workload_trace_record) || hdr[1] != 1) {
+    cerr << "[ERROR] " << path << " is not a workload trace" << endl;
+    close(fd);
+    return false;
+  }
+
+  recs.clear();
+  workload_trace_record buf[BufferNRecords];
+  size_t nleft = 0; // bytes of a partial record at the start of buf
+  for (;;) {
+    const ssize_t n = read(fd, (char *) buf + nleft, sizeof(buf) - nleft);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("read");
+      close(fd);
+      return false;
+    }
+    if (!n)
+      break;
+    const size_t nbytes = nleft + n;
+    const size_t nrecs = nbytes / sizeof(buf[0]);
+    recs.insert(recs.end(), buf, buf + nrecs);
+    nleft = nbytes - nrecs * sizeof(buf[0]);
+    memmove(buf, (char *) buf + nrecs * sizeof(buf[0]), nleft);
+  }
+  close(fd);
+  if (nleft)
+    cerr << "[WARNING] " << path << " ends in a partial record" << endl;
+  if (recs.empty()) {
+    cerr << "[ERROR] " << path << " has no txns" << endl;
+    return false;
+  }
+
+  uint64_t first_us = recs[0].arrival_us_;
+  for (auto &rec : recs)
+    first_us = min(first_us, rec.arrival_us_);
+  for (auto &rec : recs)
+    rec.arrival_us_ -= first_us;
+  return true;
+}
+
+size_t
+workload_trace::Split(const record_vec &recs, size_t nslots,
+                      vector<record_vec> &slots)
+{
+  INVARIANT(nslots);
+  map<uint32_t, size_t> workers; // id => number
+  for (auto &rec : recs)
+    workers[rec.worker_] = 0;
+  size_t i = 0;
+  for (auto &p : workers)
+    p.second = i++;
+  slots.assign(nslots, record_vec());
+  for (auto &rec : recs)
+    slots[workers[rec.worker_] % nslots].push_back(rec);
+  // a worker's own records are already in order
+  for (auto &s : slots)
+    stable_sort(s.begin(), s.end(),
+        [](const workload_trace_record &a, const workload_trace_record &b) {
+          return a.arrival_us_ < b.arrival_us_;
+        });
+  return workers.size();
+}
+
+void
+workload_trace::Test()
+{
+  char tmpl[] = "/tmp/silo_test_workload_trace.XXXXXX";
+  const int tmpfd = mkstemp(tmpl);
+  ALWAYS_ASSERT(tmpfd != -1);
+  close(tmpfd);
+  const string path = tmpl;
+
+  // two workers, whose writers each flush a few whole chunks and then a
+  // partial one. worker 7 arrives first, and the workers interleave
+  const size_t n = 2 * BufferNRecords + 10;
+  Open(path);
+  {
+    writer a, b;
+    for (size_t i = 0; i < n; i++) {
+      a.add(1000 + 2 * i, i, 7, i % 3);
+      b.add(1001 + 2 * i, n + i, 3, i % 5);
+    }
+  }
+  Close();
+
+  record_vec recs;
+  ALWAYS_ASSERT(Load(path, recs));
+  ALWAYS_ASSERT(recs.size() == 2 * n);
+  vector<record_vec> slots;
+  ALWAYS_ASSERT(Split(recs, 2, slots) == 2);
+  ALWAYS_ASSERT(slots.size() == 2);
+  // worker 3 is numbered first, for its lower id
+  for (size_t s = 0; s < 2; s++) {
+    const uint32_t worker = s ? 7 : 3;
+    ALWAYS_ASSERT(slots[s].size() == n);
+    for (size_t i = 0; i < n; i++) {
+      const workload_trace_record &r = slots[s][i];
+      ALWAYS_ASSERT(r.worker_ == worker);
+      ALWAYS_ASSERT(r.arrival_us_ == 2 * i + (s ? 0 : 1));
+      ALWAYS_ASSERT(r.seed_ == (s ? i : n + i));
+      ALWAYS_ASSERT(r.txn_type_ == (s ? i % 3 : i % 5));
+    }
+  }
+  // one slot takes both, in order of arrival
+  ALWAYS_ASSERT(Split(recs, 1, slots) == 2);
+  ALWAYS_ASSERT(slots.size() == 1 && slots[0].size() == 2 * n);
+  for (size_t i = 0; i < 2 * n; i++)
+    ALWAYS_ASSERT(slots[0][i].arrival_us_ == i);
+
+  // a capture cut short in its last record: the whole ones are kept
+  {
+    const int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    ALWAYS_ASSERT(fd != -1);
+    const workload_trace_record r = {0, 0, 0, 0};
+    ALWAYS_ASSERT(WriteFully(fd, &r, sizeof(r) / 2));
+    close(fd);
+  }
+  ALWAYS_ASSERT(Load(path, recs));
+  ALWAYS_ASSERT(recs.size() == 2 * n);
+
+  // a trace of no txns, and a file which is not a trace
+  Open(path);
+  Close();
+  ALWAYS_ASSERT(!Load(path, recs));
+  {
+    const int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    ALWAYS_ASSERT(fd != -1);
+    const uint64_t magic = TraceFileMagic + 1;
+    const uint32_t hdr[2] = {sizeof(workload_trace_record), 1};
+    const workload_trace_record r = {0, 0, 0, 0};
+    ALWAYS_ASSERT(WriteFully(fd, &magic, sizeof(magic)));
+    ALWAYS_ASSERT(WriteFully(fd, hdr, sizeof(hdr)));
+    ALWAYS_ASSERT(WriteFully(fd, &r, sizeof(r)));
+    close(fd);
+  }
+  ALWAYS_ASSERT(!Load(path, recs));
+
+  unlink(path.c_str());
+  cout << "workload trace test passed" << endl;
+}
@@ -0,0 +1,106 @@
+#ifndef _NDB_WORKLOAD_TRACE_H_
+#define _NDB_WORKLOAD_TRACE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "../macros.h"
+
+/**
+ * A txn a worker ran, as written to a workload trace
+ */
+struct workload_trace_record {
+  uint64_t arrival_us_; // timer::cur_usec() when it arrived (its scheduled
+                        // start, in an open loop). rebased by Load()
+  uint64_t seed_;       // of the worker's fast_random, right before it ran
+  uint32_t worker_;     // the worker's id
+  uint32_t txn_type_;   // its index in the worker's get_workload()
+};
+
+/**
+ * Captures the txns a run's workers run (--workload-trace-file), so that
+ * another run can replay the same txns, at their recorded times or scaled
+ * (--replay-trace-file, see bench_worker::run()).
+ *
+ * A txn's parameters are not written out: the benchmarks draw every one of
+ * them from the worker's fast_random, so the generator's seed stands for all
+ * of them, in 8 bytes. Replaying a txn re-seeds the generator and runs the
+ * same txn fn. Parameters which also depend on the worker (a tpcc worker's
+ * home warehouse, say) only come out the same if the replay runs as many
+ * workers as the capture did.
+ *
+ * Each worker buffers its records in a writer, which appends them to the
+ * file BufferNRecords at a time (with one write(), so the chunks of the
+ * workers never interleave). The file is the 16 byte header (see
+ * TraceFileMagic) followed by the records
+ */
+class workload_trace {
+public:
+
+  static const uint64_t TraceFileMagic = 0x31435254444b4c57ULL; // "WLKDTRC1"
+  static const size_t BufferNRecords = 4096;
+
+  // starts capturing into path, which is truncated
+  static void Open(const std::string &path);
+
+  // the writers must have been flushed
+  static void Close();
+
+  static inline bool
+  IsCapturing()
+  {
+    return g_fd != -1;
+  }
+
+  class writer {
+  public:
+    writer() {}
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+    ~writer() { flush(); }
+
+    inline void
+    add(uint64_t arrival_us, uint64_t seed, unsigned worker, size_t txn_type)
+    {
+      if (buf_.empty())
+        buf_.reserve(BufferNRecords);
+      buf_.push_back(
+          workload_trace_record{arrival_us, seed, worker, uint32_t(txn_type)});
+      if (unlikely(buf_.size() == BufferNRecords))
+        flush();
+    }
+
+    void flush();
+
+  private:
+    std::vector<workload_trace_record> buf_;
+  };
+
+  typedef std::vector<workload_trace_record> record_vec;
+
+  /**
+   * Reads the txns of the trace in path into recs, with arrivals relative to
+   * the first one in the trace. A partial record at the end (of a capture cut
+   * short) is dropped. Returns false, having said why, if path is not a
+   * trace or has no txns
+   */
+  static bool Load(const std::string &path, record_vec &recs);
+
+  /**
+   * Splits the txns of a trace over nslots replaying workers: the recorded
+   * workers are numbered in order of their ids, and the i-th one's txns go
+   * to slot (i % nslots). Each slot's records are in order of arrival.
+   * Returns the number of workers recorded
+   */
+  static size_t Split(const record_vec &recs, size_t nslots,
+                      std::vector<record_vec> &slots);
+
+  static void Test();
+
+private:
+  static int g_fd;
+};
+
+#endif /* _NDB_WORKLOAD_TRACE_H_ */
@@ -4,7 +4,10 @@
 #include <utility>
 #include <string>
 #include <set>
+#include <atomic>
+#include <limits>
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -18,6 +21,7 @@
 #include "../core.h"
 
 #include "bench.h"
+#include "ycsb_key_chooser.h"
 
 using namespace std;
 using namespace util;
@@ -25,20 +29,36 @@ using namespace util;
 static size_t nkeys;
 static const size_t YCSBRecordSize = 100;
 
-// [R, W, RMW, Scan]
+// scans read [1, YCSBMaxScanLength] keys, uniformly
+static const size_t YCSBMaxScanLength = 100;
+
+// [R, W, RMW, Scan, Insert]
 // we're missing remove for now
 // the default is a modification of YCSB "A" we made (80/20 R/W)
-static unsigned g_txn_workload_mix[] = { 80, 20, 0, 0 };
+static unsigned g_txn_workload_mix[] = { 80, 20, 0, 0, 0 };
+
+static ycsb_key_chooser g_key_chooser;
+
+// inserted keys are striped over the workers: the i-th insert of worker w
+// is key nkeys + i * nthreads + w, so workers never contend on handing out
+// keys. each worker publishes how many of its inserts committed, and the
+// keys which exist for sure are those below nkeys + min(inserts) * nthreads,
+// which is what workers pick from (refreshing it every so often)
+static aligned_padded_elem<atomic<uint64_t>> g_ninserted[NMAXCORES];
 
 class ycsb_worker : public bench_worker {
 public:
   ycsb_worker(unsigned int worker_id,
               unsigned long seed, abstract_db *db,
               const map<string, abstract_ordered_index *> &open_tables,
-              spin_barrier *barrier_a, spin_barrier *barrier_b)
+              spin_barrier *barrier_a, spin_barrier *barrier_b,
+              unsigned int insert_stripe)
     : bench_worker(worker_id, true, seed, db,
                    open_tables, barrier_a, barrier_b),
       tbl(open_tables.at("USERTABLE")),
+      insert_stripe(insert_stripe),
+      nkeys_visible(nkeys),
+      npicks_until_refresh(0),
       computation_n(0)
   {
     obj_key0.reserve(str_arena::MinStrReserveLength);
@@ -51,10 +71,17 @@ public:
   {
     void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_GET_PUT);
     scoped_str_arena s_arena(arena);
+    return do_txn_read(txn, u64_varkey(next_key()).str(obj_key0));
+  }
+
+  txn_result
+  do_txn_read(void *txn, const string &k)
+  {
     try {
-      const uint64_t k = r.next() % nkeys;
-      ALWAYS_ASSERT(tbl->get(txn, u64_varkey(k).str(obj_key0), obj_v));
-      computation_n += obj_v.size();
+      const char *v;
+      size_t sz;
+      ALWAYS_ASSERT(tbl->get_view(txn, k, v, sz, obj_v));
+      computation_n += sz;
       measure_txn_counters(txn, "txn_read");
       if (likely(db->commit_txn(txn)))
         return txn_result(true, 0);
@@ -75,8 +102,14 @@ public:
   {
     void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_GET_PUT);
     scoped_str_arena s_arena(arena);
+    return do_txn_write(txn, u64_varkey(next_key()).str(str()), arena);
+  }
+
+  txn_result
+  do_txn_write(void *txn, const string &k, str_arena &arena)
+  {
     try {
-      tbl->put(txn, u64_varkey(r.next() % nkeys).str(str()), str().assign(YCSBRecordSize, 'b'));
+      tbl->put(txn, k, arena.next()->assign(YCSBRecordSize, 'b'));
       measure_txn_counters(txn, "txn_write");
       if (likely(db->commit_txn(txn)))
         return txn_result(true, 0);
@@ -97,11 +130,16 @@ public:
   {
     void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_RMW);
     scoped_str_arena s_arena(arena);
+    return do_txn_rmw(txn, u64_varkey(next_key()).str(obj_key0), arena);
+  }
+
+  txn_result
+  do_txn_rmw(void *txn, const string &k, str_arena &arena)
+  {
     try {
-      const uint64_t key = r.next() % nkeys;
-      ALWAYS_ASSERT(tbl->get(txn, u64_varkey(key).str(obj_key0), obj_v));
+      ALWAYS_ASSERT(tbl->get(txn, k, obj_v));
       computation_n += obj_v.size();
-      tbl->put(txn, obj_key0, str().assign(YCSBRecordSize, 'c'));
+      tbl->put(txn, k, arena.next()->assign(YCSBRecordSize, 'c'));
       measure_txn_counters(txn, "txn_rmw");
       if (likely(db->commit_txn(txn)))
         return txn_result(true, 0);
@@ -134,9 +172,16 @@ public:
   {
     void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_SCAN);
     scoped_str_arena s_arena(arena);
-    const size_t kstart = r.next() % nkeys;
-    const string &kbegin = u64_varkey(kstart).str(obj_key0);
-    const string &kend = u64_varkey(kstart + 100).str(obj_key1);
+    // keys are dense, so a range covers (at most) its length of them
+    const size_t kstart = next_key();
+    return do_txn_scan(
+        txn, u64_varkey(kstart).str(obj_key0),
+        u64_varkey(kstart + next_scan_length()).str(obj_key1));
+  }
+
+  txn_result
+  do_txn_scan(void *txn, const string &kbegin, const string &kend)
+  {
     worker_scan_callback c;
     try {
       tbl->scan(txn, kbegin, &kend, c);
@@ -156,6 +201,116 @@ public:
     return static_cast<ycsb_worker *>(w)->txn_scan();
   }
 
+  txn_result
+  txn_insert()
+  {
+    void * const txn = db->new_txn(txn_flags, arena, txn_buf(), abstract_db::HINT_KV_GET_PUT);
+    scoped_str_arena s_arena(arena);
+    return do_txn_insert(txn, u64_varkey(next_insert_key()).str(obj_key0), arena);
+  }
+
+  // k must be next_insert_key(), with no other insert by this worker since
+  txn_result
+  do_txn_insert(void *txn, const string &k, str_arena &arena)
+  {
+    try {
+      tbl->insert(txn, k, arena.next()->assign(YCSBRecordSize, 'd'));
+      measure_txn_counters(txn, "txn_insert");
+      if (likely(db->commit_txn(txn))) {
+        atomic<uint64_t> &n = g_ninserted[insert_stripe].elem;
+        n.store(n.load(memory_order_relaxed) + 1, memory_order_release);
+        return txn_result(true, 0);
+      }
+    } catch (abstract_db::abstract_abort_exception &ex) {
+      db->abort_txn(txn);
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnInsert(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_insert();
+  }
+
+  // each txn touches one key (or starts its scan at one), so as a coroutine
+  // it first walks the key's path through the table, yielding after each
+  // prefetch, and then runs to completion, mostly out of the cache
+  class ycsb_txn_coroutine : public txn_coroutine {
+  public:
+    ycsb_txn_coroutine(ycsb_worker *w)
+      : w(w), fn(nullptr), txn(nullptr), state(nullptr), ret(false, 0)
+    {
+      txn_obj_buf.resize(w->db->sizeof_txn_object(txn_flags));
+      key0.reserve(str_arena::MinStrReserveLength);
+      key1.reserve(str_arena::MinStrReserveLength);
+    }
+
+    virtual void
+    start(txn_fn_t fn)
+    {
+      this->fn = fn;
+      // an insert's key is only taken once it runs (see resume()), since the
+      // worker's other coroutines might insert before it does
+      const uint64_t k = fn == TxnInsert ? w->next_insert_key() : w->next_key();
+      u64_varkey(k).str(key0);
+      abstract_db::TxnProfileHint hint = abstract_db::HINT_KV_GET_PUT;
+      if (fn == TxnRmw) {
+        hint = abstract_db::HINT_KV_RMW;
+      } else if (fn == TxnScan) {
+        hint = abstract_db::HINT_KV_SCAN;
+        u64_varkey(k + w->next_scan_length()).str(key1);
+      }
+      // the txn is begun first, since its RCU region is what keeps the
+      // nodes the prefetches walk through alive
+      txn = w->db->new_txn(txn_flags, arena, &txn_obj_buf[0], hint);
+      state = nullptr;
+    }
+
+    virtual bool
+    resume()
+    {
+      if (w->tbl->prefetch_step(key0, state))
+        return true;
+      scoped_str_arena s_arena(arena);
+      if (fn == TxnRead)
+        ret = w->do_txn_read(txn, key0);
+      else if (fn == TxnWrite)
+        ret = w->do_txn_write(txn, key0, arena);
+      else if (fn == TxnRmw)
+        ret = w->do_txn_rmw(txn, key0, arena);
+      else if (fn == TxnInsert)
+        ret = w->do_txn_insert(
+            txn, u64_varkey(w->next_insert_key()).str(key0), arena);
+      else
+        ret = w->do_txn_scan(txn, key0, key1);
+      return false;
+    }
+
+    virtual txn_result
+    result() const
+    {
+      return ret;
+    }
+
+  private:
+    ycsb_worker *const w;
+    txn_fn_t fn;
+    void *txn;
+    const void *state;
+    txn_result ret;
+    string key0;
+    string key1;
+    string txn_obj_buf;
+    str_arena arena;
+  };
+
+  virtual txn_coroutine *
+  new_txn_coroutine()
+  {
+    return new ycsb_txn_coroutine(this);
+  }
+
   virtual workload_desc_vec
   get_workload() const
   {
@@ -187,6 +342,8 @@ public:
       w.push_back(workload_desc("ReadModifyWrite",  double(g_txn_workload_mix[2])/100.0, TxnRmw));
     if (g_txn_workload_mix[3])
       w.push_back(workload_desc("Scan",  double(g_txn_workload_mix[3])/100.0, TxnScan));
+    if (g_txn_workload_mix[4])
+      w.push_back(workload_desc("Insert",  double(g_txn_workload_mix[4])/100.0, TxnInsert));
     return w;
   }
 
@@ -197,9 +354,7 @@ protected:
   {
     if (!pin_cpus)
       return;
-    const size_t a = worker_id % coreid::num_cpus_online();
-    const size_t b = a % nthreads;
-    rcu::s_instance.pin_current_thread(b);
+    rcu::s_instance.pin_current_thread(bench_loader::WorkerCpu(worker_id));
   }
 
   inline ALWAYS_INLINE string &
@@ -207,8 +362,39 @@ protected:
     return *arena.next();
   }
 
+  static const unsigned PicksPerRefresh = 64;
+
+  inline uint64_t
+  next_key()
+  {
+    if (g_txn_workload_mix[4] && unlikely(!npicks_until_refresh--)) {
+      uint64_t m = numeric_limits<uint64_t>::max();
+      for (size_t i = 0; i < nthreads; i++)
+        m = min(m, g_ninserted[i].elem.load(memory_order_acquire));
+      nkeys_visible = nkeys + m * nthreads;
+      npicks_until_refresh = PicksPerRefresh;
+    }
+    return g_key_chooser.next(r, nkeys_visible);
+  }
+
+  inline uint64_t
+  next_insert_key() const
+  {
+    const uint64_t i = g_ninserted[insert_stripe].elem.load(memory_order_relaxed);
+    return nkeys + i * nthreads + insert_stripe;
+  }
+
+  inline size_t
+  next_scan_length()
+  {
+    return 1 + r.next() % YCSBMaxScanLength;
+  }
+
 private:
   abstract_ordered_index *tbl;
+  const unsigned int insert_stripe; // in [0, nthreads)
+  uint64_t nkeys_visible;
+  unsigned npicks_until_refresh;
 
   string obj_key0;
   string obj_key1;
@@ -230,7 +416,7 @@ ycsb_load_keyrange(
 {
   if (pin_cpus) {
     ALWAYS_ASSERT(pinid < nthreads);
-    rcu::s_instance.pin_current_thread(pinid);
+    rcu::s_instance.pin_current_thread(bench_loader::WorkerCpu(pinid));
     rcu::s_instance.fault_region();
   }
 
@@ -252,10 +438,9 @@ ycsb_load_keyrange(
         const string v(YCSBRecordSize, 'a');
         tbl->insert(txn, k, v);
       }
+      // a failed commit has already aborted (and released) the txn
       if (db->commit_txn(txn))
         batchid++;
-      else
-        db->abort_txn(txn);
     } catch (abstract_db::abstract_abort_exception &ex) {
       db->abort_txn(txn);
     }
@@ -278,6 +463,22 @@ protected:
   load()
   {
     abstract_ordered_index *tbl = open_tables.at("USERTABLE");
+    {
+      // the only loader of the table, so it can be bulk loaded (u64_varkeys
+      // are big endian, so the keys are sorted)
+      vector<string> keys, values;
+      keys.reserve(nkeys);
+      values.reserve(nkeys);
+      for (size_t i = 0; i < nkeys; i++) {
+        keys.push_back(u64_varkey(i).str());
+        values.emplace_back(YCSBRecordSize, 'a');
+      }
+      if (db->bulk_load(tbl, keys, values)) {
+        if (verbose)
+          cerr << "[INFO] bulk loaded USERTABLE - nkeys: " << nkeys << endl;
+        return;
+      }
+    }
     const size_t nkeysperthd = nkeys / nthreads;
     for (size_t i = 0; i < nthreads; i++) {
       const size_t keystart = i * nkeysperthd;
@@ -414,7 +615,7 @@ protected:
       ret.push_back(
         new ycsb_worker(
           blockstart + i, r.next(), db, open_tables,
-          &barrier_a, &barrier_b));
+          &barrier_a, &barrier_b, i));
     return ret;
   }
 
@@ -466,14 +667,26 @@ ycsb_do_test(abstract_db *db, int argc, char **argv)
   ALWAYS_ASSERT(nkeys > 0);
 
   // parse options
+  ycsb_key_chooser::dist key_dist = ycsb_key_chooser::DIST_UNIFORM;
+  double zipf_theta = 0.99;
+  double hotspot_keys = 0.2;
+  double hotspot_ops = 0.8;
+  bool key_dist_given = false;
+  const ycsb_core_workload *core_workload = nullptr;
+
   optind = 1;
   while (1) {
     static struct option long_options[] = {
-      {"workload-mix" , required_argument , 0 , 'w'},
+      {"workload-mix"     , required_argument , 0 , 'w'}, // R,W,RMW,Scan[,Insert]
+      {"workload"         , required_argument , 0 , 'W'}, // YCSB core workload A-F
+      {"key-dist"         , required_argument , 0 , 'd'}, // see ycsb_key_chooser
+      {"zipf-theta"       , required_argument , 0 , 'z'},
+      {"hotspot-keys"     , required_argument , 0 , 'k'}, // fraction of keys which are hot
+      {"hotspot-ops"      , required_argument , 0 , 'o'}, // fraction of picks of hot keys
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "w:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "w:W:d:z:k:o:", long_options, &option_index);
     if (c == -1)
       break;
     switch (c) {
@@ -486,7 +699,10 @@ ycsb_do_test(abstract_db *db, int argc, char **argv)
     case 'w':
       {
         const vector<string> toks = split(optarg, ',');
-        ALWAYS_ASSERT(toks.size() == ARRAY_NELEMS(g_txn_workload_mix));
+        // mixes from before inserts have no insert share
+        ALWAYS_ASSERT(toks.size() == ARRAY_NELEMS(g_txn_workload_mix) ||
+                      toks.size() == ARRAY_NELEMS(g_txn_workload_mix) - 1);
+        g_txn_workload_mix[ARRAY_NELEMS(g_txn_workload_mix) - 1] = 0;
         unsigned s = 0;
         for (size_t i = 0; i < toks.size(); i++) {
           unsigned p = strtoul(toks[i].c_str(), nullptr, 10);
@@ -498,6 +714,36 @@ ycsb_do_test(abstract_db *db, int argc, char **argv)
       }
       break;
 
+    case 'W':
+      for (auto &w : g_core_workloads)
+        if (toupper(optarg[0]) == w.name_ && !optarg[1])
+          core_workload = &w;
+      if (!core_workload) {
+        cerr << "[ERROR] unknown YCSB workload " << optarg << endl;
+        exit(1);
+      }
+      break;
+
+    case 'd':
+      if (!ycsb_key_chooser::ParseDist(optarg, key_dist)) {
+        cerr << "[ERROR] unknown key distribution " << optarg << endl;
+        exit(1);
+      }
+      key_dist_given = true;
+      break;
+
+    case 'z':
+      zipf_theta = strtod(optarg, nullptr);
+      break;
+
+    case 'k':
+      hotspot_keys = strtod(optarg, nullptr);
+      break;
+
+    case 'o':
+      hotspot_ops = strtod(optarg, nullptr);
+      break;
+
     case '?':
       /* getopt_long already printed an error message. */
       exit(1);
@@ -507,13 +753,31 @@ ycsb_do_test(abstract_db *db, int argc, char **argv)
     }
   }
 
+  // a core workload overrides --workload-mix, but not --key-dist
+  if (core_workload) {
+    NDB_MEMCPY(g_txn_workload_mix, core_workload->mix_, sizeof(g_txn_workload_mix));
+    if (!key_dist_given)
+      key_dist = core_workload->dist_;
+  }
+
   if (verbose) {
     cerr << "ycsb settings:" << endl;
+    if (core_workload)
+      cerr << "  workload    : " << core_workload->name_ << endl;
     cerr << "  workload_mix: "
          << format_list(g_txn_workload_mix, g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix))
          << endl;
+    cerr << "  key_dist    : " << ycsb_key_chooser::DistName(key_dist) << endl;
+    if (key_dist == ycsb_key_chooser::DIST_HOTSPOT) {
+      cerr << "  hotspot_keys: " << hotspot_keys << endl;
+      cerr << "  hotspot_ops : " << hotspot_ops << endl;
+    } else if (key_dist != ycsb_key_chooser::DIST_UNIFORM) {
+      cerr << "  zipf_theta  : " << zipf_theta << endl;
+    }
   }
 
+  g_key_chooser.init(key_dist, nkeys, zipf_theta, hotspot_keys, hotspot_ops);
+
   ycsb_bench_runner r(db);
   r.run();
 }
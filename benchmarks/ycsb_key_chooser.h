@@ -0,0 +1,192 @@
+#ifndef _NDB_BENCH_YCSB_KEY_CHOOSER_H_
+#define _NDB_BENCH_YCSB_KEY_CHOOSER_H_
+
+#include <algorithm>
+#include <string>
+
+#include <math.h>
+#include <stdint.h>
+
+#include "../macros.h"
+#include "../util.h"
+
+/**
+ * Picks the keys txns touch, out of the n which exist (n grows with the
+ * inserts). The distributions are the ones of YCSB's core workloads:
+ *
+ *   uniform           every key equally likely
+ *   zipfian           key i with probability proportional to 1/(i+1)^theta,
+ *                     so the low keys are the hot ones
+ *   scrambled-zipfian zipfian, with the popular keys hashed all over the key
+ *                     space (so they land in different btree leaves)
+ *   latest            zipfian, with the highest keys the hot ones
+ *   hotspot           hot_ops of the picks go (uniformly) to the first
+ *                     hot_keys of the keys, the rest to the others
+ *
+ * Zipfian picks use Gray et al.'s method ("Quickly generating billion-record
+ * synthetic databases"), whose constants (zeta(n) in particular, which is
+ * O(n) to compute) init() precomputes, so a pick is one uniform draw and
+ * one pow(). The zipfian ranks are over the keys loaded (n at init()), which
+ * the picks of the larger key space of later on map onto as YCSB does: the
+ * hot keys of zipfian stay the low ones, latest's follow the newest keys,
+ * and scrambled-zipfian's are hashed over all of them.
+ *
+ * Read only once init()ed, ie shared by all the workers
+ */
+class ycsb_key_chooser {
+public:
+
+  enum dist {
+    DIST_UNIFORM,
+    DIST_ZIPFIAN,
+    DIST_SCRAMBLED_ZIPFIAN,
+    DIST_LATEST,
+    DIST_HOTSPOT,
+  };
+
+  static bool
+  ParseDist(const std::string &s, dist &d)
+  {
+    if (s == "uniform")
+      d = DIST_UNIFORM;
+    else if (s == "zipfian")
+      d = DIST_ZIPFIAN;
+    else if (s == "scrambled-zipfian")
+      d = DIST_SCRAMBLED_ZIPFIAN;
+    else if (s == "latest")
+      d = DIST_LATEST;
+    else if (s == "hotspot")
+      d = DIST_HOTSPOT;
+    else
+      return false;
+    return true;
+  }
+
+  static const char *
+  DistName(dist d)
+  {
+    switch (d) {
+    case DIST_UNIFORM: return "uniform";
+    case DIST_ZIPFIAN: return "zipfian";
+    case DIST_SCRAMBLED_ZIPFIAN: return "scrambled-zipfian";
+    case DIST_LATEST: return "latest";
+    case DIST_HOTSPOT: return "hotspot";
+    }
+    return "<unknown>";
+  }
+
+  ycsb_key_chooser()
+    : d_(DIST_UNIFORM), n_(0), alpha_(0.0), eta_(0.0),
+      zetan_(0.0), half_pow_theta_(0.0), hot_keys_(0.0), hot_ops_(0.0) {}
+
+  void
+  init(dist d, uint64_t n, double theta, double hot_keys, double hot_ops)
+  {
+    ALWAYS_ASSERT(n > 0);
+    d_ = d;
+    n_ = n;
+    if (d == DIST_ZIPFIAN || d == DIST_SCRAMBLED_ZIPFIAN || d == DIST_LATEST) {
+      ALWAYS_ASSERT(theta > 0.0 && theta < 1.0);
+      zetan_ = Zeta(n, theta);
+      alpha_ = 1.0 / (1.0 - theta);
+      eta_ = (1.0 - pow(2.0 / double(n), 1.0 - theta)) /
+             (1.0 - Zeta(2, theta) / zetan_);
+      half_pow_theta_ = 1.0 + pow(0.5, theta);
+    } else if (d == DIST_HOTSPOT) {
+      ALWAYS_ASSERT(hot_keys > 0.0 && hot_keys < 1.0);
+      ALWAYS_ASSERT(hot_ops >= 0.0 && hot_ops <= 1.0);
+      hot_keys_ = hot_keys;
+      hot_ops_ = hot_ops;
+    }
+  }
+
+  // n is the number of keys there are now, at least n at init()
+  inline ALWAYS_INLINE uint64_t
+  next(util::fast_random &r, uint64_t n) const
+  {
+    INVARIANT(n >= n_);
+    switch (d_) {
+    case DIST_UNIFORM:
+      return r.next() % n;
+    case DIST_ZIPFIAN:
+      return next_zipfian(r);
+    case DIST_SCRAMBLED_ZIPFIAN:
+      return Scramble(next_zipfian(r)) % n;
+    case DIST_LATEST:
+      return n - 1 - next_zipfian(r);
+    case DIST_HOTSPOT:
+      {
+        const uint64_t nhot = std::max(uint64_t(1), uint64_t(hot_keys_ * double(n)));
+        if (r.next_uniform() < hot_ops_ || nhot == n)
+          return r.next() % nhot;
+        return nhot + r.next() % (n - nhot);
+      }
+    }
+    ALWAYS_ASSERT(false);
+    return 0;
+  }
+
+private:
+
+  static double
+  Zeta(uint64_t n, double theta)
+  {
+    double sum = 0.0;
+    for (uint64_t i = 1; i <= n; i++)
+      sum += 1.0 / pow(double(i), theta);
+    return sum;
+  }
+
+  // FNV-1a of the key's bytes
+  static inline uint64_t
+  Scramble(uint64_t k)
+  {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(k); i++, k >>= 8) {
+      h ^= k & 0xff;
+      h *= 0x100000001b3ULL;
+    }
+    return h;
+  }
+
+  inline uint64_t
+  next_zipfian(util::fast_random &r) const
+  {
+    const double u = r.next_uniform();
+    const double uz = u * zetan_;
+    if (uz < 1.0)
+      return 0;
+    if (uz < half_pow_theta_)
+      return 1;
+    const uint64_t k = uint64_t(double(n_) * pow(eta_ * u - eta_ + 1.0, alpha_));
+    return std::min(k, n_ - 1);
+  }
+
+  dist d_;
+  uint64_t n_;
+  double alpha_;
+  double eta_;
+  double zetan_;
+  double half_pow_theta_; // 1 + 0.5^theta
+  double hot_keys_;
+  double hot_ops_;
+};
+
+// YCSB's core workloads, as [R, W, RMW, Scan, Insert] mixes and the key
+// distribution they come with
+struct ycsb_core_workload {
+  char name_;
+  unsigned mix_[5];
+  ycsb_key_chooser::dist dist_;
+};
+
+static const ycsb_core_workload g_core_workloads[] = {
+  {'A', { 50, 50,  0,  0, 0}, ycsb_key_chooser::DIST_ZIPFIAN}, // update heavy
+  {'B', { 95,  5,  0,  0, 0}, ycsb_key_chooser::DIST_ZIPFIAN}, // read mostly
+  {'C', {100,  0,  0,  0, 0}, ycsb_key_chooser::DIST_ZIPFIAN}, // read only
+  {'D', { 95,  0,  0,  0, 5}, ycsb_key_chooser::DIST_LATEST},  // read latest
+  {'E', {  0,  0,  0, 95, 5}, ycsb_key_chooser::DIST_ZIPFIAN}, // short ranges
+  {'F', { 50,  0, 50,  0, 0}, ycsb_key_chooser::DIST_ZIPFIAN}, // read-modify-write
+};
+
+#endif /* _NDB_BENCH_YCSB_KEY_CHOOSER_H_ */
@@ -423,6 +423,53 @@ test_varlen_single_layer()
   ALWAYS_ASSERT(btr.size() == 0);
 }
 
+// suffixes short enough to sit in the leaf and longer ones, which still
+// get allocations of their own, moved around by inserts and removes
+static void
+test_inline_suffixes()
+{
+  testing_concurrent_btree btr;
+  vector<string> keys;
+  for (size_t len = 9; len <= 100; len++) {
+    string k(len, 'x');
+    k[0] = 'a' + (len % 26);
+    k[1] = 'A' + (len / 26);
+    keys.push_back(k);
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    ALWAYS_ASSERT(btr.insert(varkey(keys[i]), (typename testing_concurrent_btree::value_type) i));
+    btr.invariant_checker();
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    typename testing_concurrent_btree::value_type v = 0;
+    ALWAYS_ASSERT(btr.search(varkey(keys[i]), v));
+    ALWAYS_ASSERT(size_t(v) == i);
+    // same slice and length, different suffix
+    string k(keys[i]);
+    k[k.size() - 1] = 'y';
+    ALWAYS_ASSERT(!btr.search(varkey(k), v));
+  }
+
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    ALWAYS_ASSERT(btr.remove(varkey(keys[i])));
+    btr.invariant_checker();
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    typename testing_concurrent_btree::value_type v = 0;
+    ALWAYS_ASSERT(btr.search(varkey(keys[i]), v) == bool(i % 2));
+  }
+}
+
+class leaf_count_walk_callback : public testing_concurrent_btree::tree_walk_callback {
+public:
+  leaf_count_walk_callback() : nleaves_(0) {}
+  virtual void on_node_begin(const typename testing_concurrent_btree::node_opaque_t *n) {}
+  virtual void on_node_success() { nleaves_++; }
+  virtual void on_node_failure() {}
+  size_t nleaves_;
+};
+
 static void
 test_varlen_multi_layer()
 {
@@ -453,6 +500,26 @@ test_varlen_multi_layer()
     btr.invariant_checker();
   }
   ALWAYS_ASSERT(btr.size() == 0);
+
+#ifndef NDB_MASSTREE
+  // layers which go empty are dropped, so churn on long keys with a common
+  // prefix leaves nothing behind
+  for (size_t round = 0; round < 10; round++) {
+    vector<string> ks;
+    for (size_t i = 0; i < 1000; i++)
+      ks.push_back(string(8, 'a') + u64_varkey(i).str());
+    for (auto &k : ks)
+      ALWAYS_ASSERT(btr.insert(varkey(k), (typename testing_concurrent_btree::value_type) k.data()));
+    btr.invariant_checker();
+    for (auto &k : ks)
+      ALWAYS_ASSERT(btr.remove(varkey(k)));
+    btr.invariant_checker();
+    leaf_count_walk_callback c;
+    btr.tree_walk(c);
+    ALWAYS_ASSERT(c.nleaves_ == 1);
+  }
+  ALWAYS_ASSERT(btr.size() == 0);
+#endif
 }
 
 static void
@@ -796,6 +863,79 @@ test_random_keys()
     ALWAYS_ASSERT(v == (typename testing_concurrent_btree::value_type) keys[i].data());
   }
 
+  {
+    // the same lookups in batches, with a few keys which aren't there
+    vector<string> absent_keys;
+    for (size_t i = 0; i < nkeys / 10; i++)
+      absent_keys.emplace_back(maxkeylen + 1 + (i % 16), 'a');
+    vector<varkey> batch_keys;
+    vector<const string *> expected;
+    for (size_t i = 0; i < nkeys; i++) {
+      batch_keys.emplace_back(keys[i]);
+      expected.push_back(&keys[i]);
+      if (i % 10 == 0) {
+        batch_keys.emplace_back(absent_keys[i / 10]);
+        expected.push_back(nullptr);
+      }
+    }
+    vector<typename testing_concurrent_btree::value_type> values(batch_keys.size());
+    unique_ptr<bool[]> found(new bool[batch_keys.size()]);
+    ALWAYS_ASSERT(btr.search_batch(
+          batch_keys.data(), batch_keys.size(), values.data(), found.get()) == nkeys);
+    for (size_t i = 0; i < batch_keys.size(); i++) {
+      ALWAYS_ASSERT(found[i] == bool(expected[i]));
+      if (expected[i])
+        ALWAYS_ASSERT(values[i] == (typename testing_concurrent_btree::value_type) expected[i]->data());
+    }
+
+    // stepping down a key's path ends (at its leaf)
+    for (size_t i = 0; i < nkeys; i += 100) {
+      scoped_rcu_region guard;
+      const void *cur = nullptr;
+      size_t nsteps = 0;
+      while (btr.prefetch_step(varkey(keys[i]), cur))
+        ALWAYS_ASSERT(++nsteps < 64);
+      ALWAYS_ASSERT(nsteps && cur);
+    }
+
+    // now insert the absent keys in batches, along with overwrites of (the
+    // same values for) a few present keys
+    vector<varkey> insert_keys;
+    vector<typename testing_concurrent_btree::value_type> insert_values;
+    set<string> new_keys;
+    for (size_t i = 0; i < batch_keys.size(); i++) {
+      if (expected[i] && i % 3)
+        continue;
+      const string &k = expected[i] ? *expected[i] : absent_keys[insert_keys.size() % absent_keys.size()];
+      insert_keys.emplace_back(k);
+      insert_values.push_back((typename testing_concurrent_btree::value_type) k.data());
+      if (!expected[i])
+        new_keys.insert(k);
+    }
+    unique_ptr<bool[]> inserted(new bool[insert_keys.size()]);
+    ALWAYS_ASSERT(btr.insert_batch(
+          insert_keys.data(), insert_values.data(), insert_keys.size(),
+          inserted.get()) == new_keys.size());
+    ALWAYS_ASSERT(btr.size() == keyset.size() + new_keys.size());
+    // a key repeated in the batch is only new the first time, and maps to
+    // its last value
+    map<string, typename testing_concurrent_btree::value_type> last_values;
+    for (size_t i = 0; i < insert_keys.size(); i++) {
+      const string k(
+          (const char *) insert_keys[i].data(), insert_keys[i].size());
+      ALWAYS_ASSERT(inserted[i] == (new_keys.count(k) && !last_values.count(k)));
+      last_values[k] = insert_values[i];
+    }
+    for (auto &p : last_values) {
+      typename testing_concurrent_btree::value_type v = 0;
+      ALWAYS_ASSERT(btr.search(varkey(p.first), v));
+      ALWAYS_ASSERT(v == p.second);
+    }
+    for (auto &k : new_keys)
+      ALWAYS_ASSERT(btr.remove(varkey(k)));
+    ALWAYS_ASSERT(btr.size() == keyset.size());
+  }
+
   test_range_scan_helper::expect ex(keyset);
   test_range_scan_helper tester(btr, varkey(""), NULL, false, ex);
   tester.test();
@@ -813,6 +953,159 @@ test_random_keys()
   ALWAYS_ASSERT(btr.size() == 0);
 }
 
+static void
+test_bulk_load()
+{
+  for (size_t nkeys : {0, 1, 15, 16, 300, 10000}) {
+    testing_concurrent_btree btr;
+    fast_random r(9284 + nkeys);
+
+    // short keys, and long ones sharing prefixes so that some get layers
+    set<string> keyset;
+    while (keyset.size() < nkeys) {
+      string k = r.next_readable_string(r.next() % 10);
+      if (r.next() % 4 == 0)
+        k = string(8, 'a') + k + r.next_readable_string(r.next() % 20);
+      keyset.insert(k);
+    }
+    vector<string> keys(keyset.begin(), keyset.end());
+    vector<varkey> bulk_keys;
+    vector<typename testing_concurrent_btree::value_type> values;
+    for (auto &k : keys) {
+      bulk_keys.emplace_back(k);
+      values.push_back((typename testing_concurrent_btree::value_type) k.data());
+    }
+    btr.bulk_load(bulk_keys.data(), values.data(), nkeys);
+    btr.invariant_checker();
+    ALWAYS_ASSERT(btr.size() == nkeys);
+
+    for (size_t i = 0; i < nkeys; i++) {
+      typename testing_concurrent_btree::value_type v = 0;
+      ALWAYS_ASSERT(btr.search(varkey(keys[i]), v));
+      ALWAYS_ASSERT(v == values[i]);
+    }
+
+    test_range_scan_helper::expect ex(keyset);
+    test_range_scan_helper tester(btr, varkey(""), NULL, false, ex);
+    tester.test();
+
+    // the tree takes regular writes afterwards
+    for (size_t i = 0; i < nkeys; i += 2) {
+      ALWAYS_ASSERT(btr.remove(varkey(keys[i])));
+      btr.invariant_checker();
+    }
+    const string extra = string(8, 'a') + "\x01extra"; // not readable
+    ALWAYS_ASSERT(btr.insert_if_absent(varkey(extra), (typename testing_concurrent_btree::value_type) extra.data()));
+    btr.invariant_checker();
+    ALWAYS_ASSERT(btr.size() == nkeys / 2 + 1);
+  }
+}
+
+class collecting_scan_callback : public testing_concurrent_btree::search_range_callback {
+public:
+  virtual bool
+  invoke(const typename testing_concurrent_btree::string_type &k,
+         typename testing_concurrent_btree::value_type v)
+  {
+    keys_.emplace_back(k.data(), k.length());
+    return true;
+  }
+  vector<string> keys_;
+};
+
+static void
+test_parallel_scan()
+{
+  const size_t nkeys = 20000;
+  testing_concurrent_btree btr;
+  vector<string> keys;
+  for (size_t i = 0; i < nkeys; i++) {
+    keys.push_back(u64_varkey(i).str());
+    ALWAYS_ASSERT(btr.insert(varkey(keys.back()), (typename testing_concurrent_btree::value_type) i));
+  }
+
+  for (size_t n : {1, 2, 7, 32}) {
+    for (auto range : {make_pair(size_t(0), nkeys), make_pair(size_t(1234), size_t(5678))}) {
+      const string lower = keys[range.first];
+      const string upper = range.second < nkeys ? keys[range.second] : string();
+      const varkey uppervk(upper);
+      const varkey *upperp = range.second < nkeys ? &uppervk : nullptr;
+
+      const vector<string> bounds = btr.split_range(varkey(lower), upperp, n);
+      ALWAYS_ASSERT(bounds.size() < n);
+      ALWAYS_ASSERT(n == 1 || !bounds.empty());
+      for (size_t i = 0; i < bounds.size(); i++) {
+        ALWAYS_ASSERT(lower < bounds[i]);
+        ALWAYS_ASSERT(!upperp || bounds[i] < upper);
+        ALWAYS_ASSERT(!i || bounds[i - 1] < bounds[i]);
+      }
+
+      // the subranges, in order, cover the range exactly
+      vector<collecting_scan_callback> cs(n);
+      vector<typename testing_concurrent_btree::low_level_search_range_callback *> cps;
+      for (auto &c : cs)
+        cps.push_back(&c);
+      btr.search_range_call_parallel(varkey(lower), upperp, cps);
+      vector<string> scanned;
+      for (auto &c : cs)
+        scanned.insert(scanned.end(), c.keys_.begin(), c.keys_.end());
+      ALWAYS_ASSERT(scanned == vector<string>(
+            keys.begin() + range.first, keys.begin() + range.second));
+    }
+  }
+}
+
+static void
+test_cursor()
+{
+  // some keys share a 16 byte prefix, so they live in layers
+  const size_t nkeys = 20000;
+  testing_concurrent_btree btr;
+  set<string> keyset;
+  for (size_t i = 0; i < nkeys; i++) {
+    const string k = (i % 3 ? string() : string(16, 'x')) + u64_varkey(i).str();
+    keyset.insert(k);
+    ALWAYS_ASSERT(btr.insert(varkey(k), (typename testing_concurrent_btree::value_type) i));
+  }
+  const vector<string> keys(keyset.begin(), keyset.end());
+
+  for (size_t n : {1, 7, 100}) {
+    for (auto range : {make_pair(size_t(0), nkeys), make_pair(size_t(1234), size_t(5678))}) {
+      const string upper = range.second < nkeys ? keys[range.second] : string();
+      const varkey uppervk(upper);
+      const varkey *upperp = range.second < nkeys ? &uppervk : nullptr;
+
+      scoped_rcu_region guard;
+      collecting_scan_callback c;
+      typename testing_concurrent_btree::cursor cur(btr, varkey(keys[range.first]));
+      size_t nbatches = 0;
+      while (cur.next(c, n, upperp)) {
+        ALWAYS_ASSERT(c.keys_.size() == (nbatches + 1) * n);
+        ALWAYS_ASSERT(cur.position() > c.keys_.back());
+        nbatches++;
+      }
+      ALWAYS_ASSERT(cur.done());
+      ALWAYS_ASSERT(!cur.next(c, n, upperp));
+      ALWAYS_ASSERT(c.keys_ == vector<string>(
+            keys.begin() + range.first, keys.begin() + range.second));
+    }
+  }
+
+  // removing the keys already scanned between batches merges away the
+  // leaves the cursor stopped in
+  {
+    scoped_rcu_region guard;
+    collecting_scan_callback c;
+    typename testing_concurrent_btree::cursor cur(btr, varkey(""));
+    size_t nremoved = 0;
+    while (cur.next(c, 50))
+      for (; nremoved < c.keys_.size(); nremoved++)
+        ALWAYS_ASSERT(btr.remove(varkey(c.keys_[nremoved])));
+    ALWAYS_ASSERT(c.keys_ == keys);
+  }
+  btr.invariant_checker();
+}
+
 static void
 test_insert_remove_mix()
 {
@@ -855,6 +1148,47 @@ test_insert_remove_mix()
   ALWAYS_ASSERT(btr.size() == insert_keys.size());
 }
 
+#ifndef NDB_MASSTREE
+template <unsigned int N>
+static void
+test_fanout()
+{
+  typedef btree<btree_fanout_traits<N, testing_concurrent_btree_traits>> btree_type;
+  static_assert(btree_type::NKeysPerNode == N, "XX");
+  btree_type btr;
+  fast_random r(7734533264);
+
+  // key lengths up to 40 bytes, to get some layers too
+  const size_t nkeys = 20000;
+  vector<string> keys;
+  set<string> seen;
+  while (keys.size() < nkeys) {
+    string k = r.next_readable_string(r.next() % 40);
+    if (!seen.insert(k).second)
+      continue;
+    keys.push_back(k);
+    ALWAYS_ASSERT(btr.insert(varkey(keys.back()), (typename btree_type::value_type) keys.size()));
+  }
+  btr.invariant_checker();
+  ALWAYS_ASSERT(btr.size() == nkeys);
+
+  for (size_t i = 0; i < nkeys; i++) {
+    typename btree_type::value_type v = 0;
+    ALWAYS_ASSERT(btr.search(varkey(keys[i]), v));
+    ALWAYS_ASSERT(v == (typename btree_type::value_type) (i + 1));
+  }
+
+  for (size_t i = 0; i < nkeys; i += 2)
+    ALWAYS_ASSERT(btr.remove(varkey(keys[i])));
+  btr.invariant_checker();
+  ALWAYS_ASSERT(btr.size() == nkeys / 2);
+  for (size_t i = 0; i < nkeys; i++) {
+    typename btree_type::value_type v = 0;
+    ALWAYS_ASSERT(btr.search(varkey(keys[i]), v) == bool(i % 2));
+  }
+}
+#endif
+
 namespace mp_test1_ns {
 
   static const size_t nkeys = 20000;
@@ -1977,6 +2311,7 @@ TestConcurrentBtreeFast()
   test6();
   test7();
   test_varlen_single_layer();
+  test_inline_suffixes();
   test_varlen_multi_layer();
   test_two_layer();
   test_two_layer_range_scan();
@@ -1984,7 +2319,15 @@ TestConcurrentBtreeFast()
   test_null_keys();
   test_null_keys_2();
   test_random_keys();
+  test_bulk_load();
+  test_parallel_scan();
+  test_cursor();
   test_insert_remove_mix();
+#ifndef NDB_MASSTREE
+  test_fanout<11>();
+  test_fanout<31>();
+  test_fanout<63>();
+#endif
   mp_test_pinning();
   mp_test_inserts_removes();
   cout << "testing_concurrent_btree::TestFast passed" << endl;
@@ -14,6 +14,10 @@
 #include <atomic>
 #include <thread>
 
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "log2.hh"
 #include "ndb_type_traits.h"
 #include "varkey.h"
@@ -21,6 +25,7 @@
 #include "macros.h"
 #include "prefetch.h"
 #include "amd64.h"
+#include "queue_lock.h"
 #include "rcu.h"
 #include "util.h"
 #include "small_vector.h"
@@ -90,8 +95,14 @@ namespace private_ {
       uint64_t backoff_shift = 0;
 #endif
       uint64_t v = Load(t);
+      unsigned nspins = 0;
       while ((v & P::HDR_LOCKED_MASK) ||
              !t.compare_exchange_strong(v, v | P::HDR_LOCKED_MASK)) {
+        if (unlikely(++nspins == queue_lock::SpinsBeforeQueueing) &&
+            queue_lock::IsEnabled()) {
+          queue_lock::Acquire(&t, [&t, &v]() { return TryLock(t, v); });
+          break;
+        }
 #ifdef SPINLOCK_BACKOFF
         if (backoff_shift < 63)
           backoff_shift++;
@@ -108,6 +119,14 @@ namespace private_ {
       COMPILER_MEMORY_FENCE;
       return v;
     }
+    // on success, v is the version before it was locked
+    static inline bool
+    TryLock(std::atomic<uint64_t> &t, uint64_t &v)
+    {
+      v = Load(t);
+      return !(v & P::HDR_LOCKED_MASK) &&
+             t.compare_exchange_strong(v, v | P::HDR_LOCKED_MASK);
+    }
     static inline uint64_t
     LockWithSpinCount(std::atomic<uint64_t> &t, unsigned &spins)
     {
@@ -118,6 +137,14 @@ namespace private_ {
       uint64_t v = Load(t);
       while ((v & P::HDR_LOCKED_MASK) ||
              !t.compare_exchange_strong(v, v | P::HDR_LOCKED_MASK)) {
+        if (unlikely(spins + 1 == queue_lock::SpinsBeforeQueueing) &&
+            queue_lock::IsEnabled()) {
+          queue_lock::Acquire(&t, [&t, &v, &spins]() {
+            spins++;
+            return TryLock(t, v);
+          });
+          break;
+        }
 #ifdef SPINLOCK_BACKOFF
         if (backoff_shift < 63)
           backoff_shift++;
@@ -490,6 +517,20 @@ struct single_threaded_btree_traits : public base_btree_config {
   typedef uint64_t VersionType;
 };
 
+/**
+ * Traits for a tree with N keys per node, instead of base_btree_config's.
+ * Narrow nodes suit small, hot trees (an internal node of 11 keys is 3 cache
+ * lines), and wide nodes huge ones (fewer levels to descend).
+ *
+ * N must be more than 10, so that a split always fits a new slice, and no
+ * more than fits in the node header's key_slots_used bits, ie 2^k - 1
+ * (eg 11, 15, 31, 63).
+ */
+template <unsigned int N, typename Traits = concurrent_btree_traits>
+struct btree_fanout_traits : public Traits {
+  static const unsigned int NKeysPerNode = N;
+};
+
 /**
  * A concurrent, variable key length b+-tree, optimized for read heavy
  * workloads.
@@ -581,6 +622,60 @@ private:
       return VersionManip::KeySlotsUsed(hdr_);
     }
 
+    /**
+     * the number of keys in [0, n) which are < k (<= k if inclusive), ie
+     * where k goes in the sorted keys. compares all the keys with a couple of
+     * vector instructions when built for AVX-512/AVX2, and binary searches
+     * otherwise
+     */
+    inline size_t
+    num_keys_below(key_slice k, size_t n, bool inclusive) const
+    {
+      INVARIANT(n <= NKeysPerNode);
+#if defined(__AVX512F__)
+      const __m512i kv = _mm512_set1_epi64(k);
+      size_t ret = 0;
+      for (size_t i = 0; i < n; i += 8) {
+        // masked off lanes are never loaded, so it's fine to run off the end
+        const __mmask8 m = (n - i) >= 8 ? 0xff : ((1u << (n - i)) - 1);
+        const __m512i v = _mm512_maskz_loadu_epi64(m, &keys_[i]);
+        ret += __builtin_popcount(inclusive ?
+            _mm512_mask_cmple_epu64_mask(m, v, kv) :
+            _mm512_mask_cmplt_epu64_mask(m, v, kv));
+      }
+      return ret;
+#elif defined(__AVX2__)
+      // AVX2 only has signed compares, so flip the sign bits
+      const __m256i sign = _mm256_set1_epi64x(int64_t(uint64_t(1) << 63));
+      const __m256i kv = _mm256_xor_si256(_mm256_set1_epi64x(k), sign);
+      size_t ret = 0, i = 0;
+      for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *) &keys_[i]), sign);
+        if (inclusive)
+          ret += 4 - __builtin_popcount(_mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpgt_epi64(v, kv))));
+        else
+          ret += __builtin_popcount(_mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, v))));
+      }
+      for (; i < n; i++)
+        ret += inclusive ? (keys_[i] <= k) : (keys_[i] < k);
+      return ret;
+#else
+      size_t lower = 0;
+      size_t upper = n;
+      while (lower < upper) {
+        const size_t i = (lower + upper) / 2;
+        if (inclusive ? (keys_[i] <= k) : (keys_[i] < k))
+          lower = i + 1;
+        else
+          upper = i;
+      }
+      return lower;
+#endif
+    }
+
     inline void
     set_key_slots_used(size_t n)
     {
@@ -764,9 +859,18 @@ private:
     leaf_node *prev_;
     leaf_node *next_;
 
+    // suffixes of up to LeafSuffixInlineBytes are kept in the array itself,
+    // so keys of up to 62 bytes cost no allocation (and no miss) past the
+    // leaf's suffix array, and each slot is a cache line
+    static const size_t LeafSuffixInlineBytes = 54;
+    typedef base_imstring<false, LeafSuffixInlineBytes> suffix_type;
+    // what suffixes are swapped with, so the ones they replace are freed
+    // through RCU
+    typedef base_imstring<true, LeafSuffixInlineBytes> rcu_suffix_type;
+
     // starts out empty- once set, doesn't get freed until dtor (even if all
     // keys w/ suffixes get removed)
-    imstring *suffixes_;
+    suffix_type *suffixes_;
 
     inline ALWAYS_INLINE varkey
     suffix(size_t i) const
@@ -781,7 +885,7 @@ private:
     {
       INVARIANT(this->is_modifying());
       INVARIANT(!suffixes_);
-      suffixes_ = new imstring[NKeysPerNode];
+      suffixes_ = new suffix_type[NKeysPerNode];
       //++g_evt_suffixes_array_created;
     }
 
@@ -850,19 +954,15 @@ private:
     inline key_search_ret
     key_search(key_slice k, size_t len) const
     {
-      size_t n = this->key_slots_used();
-      ssize_t lower = 0;
-      ssize_t upper = n;
-      while (lower < upper) {
-        ssize_t i = (lower + upper) / 2;
-        key_slice k0 = this->keys_[i];
-        size_t len0 = this->keyslice_length(i);
-        if (k0 < k || (k0 == k && len0 < len))
-          lower = i + 1;
-        else if (k0 == k && len0 == len)
+      const size_t n = this->key_slots_used();
+      // keys sharing the slice k are ordered by length
+      for (size_t i = this->num_keys_below(k, n, false);
+           i < n && this->keys_[i] == k; i++) {
+        const size_t len0 = this->keyslice_length(i);
+        if (len0 == len)
           return key_search_ret(i, n);
-        else
-          upper = i;
+        if (len0 > len)
+          break;
       }
       return key_search_ret(-1, n);
     }
@@ -874,24 +974,13 @@ private:
     inline key_search_ret
     key_lower_bound_search(key_slice k, size_t len) const
     {
-      ssize_t ret = -1;
-      size_t n = this->key_slots_used();
-      ssize_t lower = 0;
-      ssize_t upper = n;
-      while (lower < upper) {
-        ssize_t i = (lower + upper) / 2;
-        key_slice k0 = this->keys_[i];
-        size_t len0 = this->keyslice_length(i);
-        if (k0 < k || (k0 == k && len0 < len)) {
-          ret = i;
-          lower = i + 1;
-        } else if (k0 == k && len0 == len) {
-          return key_search_ret(i, n);
-        } else {
-          upper = i;
-        }
-      }
-      return key_search_ret(ret, n);
+      const size_t n = this->key_slots_used();
+      size_t i = this->num_keys_below(k, n, false);
+      while (i < n && this->keys_[i] == k && this->keyslice_length(i) < len)
+        i++;
+      if (i < n && this->keys_[i] == k && this->keyslice_length(i) == len)
+        return key_search_ret(i, n);
+      return key_search_ret(ssize_t(i) - 1, n);
     }
 
     void
@@ -925,7 +1014,7 @@ private:
       if (unlikely(!n))
         return;
       n->mark_deleting();
-      rcu::s_instance.free_with_fn(n, deleter);
+      rcu::s_instance.free_with_fn(n, deleter, LeafNodeAllocSize);
     }
 
   };
@@ -960,19 +1049,10 @@ private:
     inline key_search_ret
     key_search(key_slice k) const
     {
-      size_t n = this->key_slots_used();
-      ssize_t lower = 0;
-      ssize_t upper = n;
-      while (lower < upper) {
-        ssize_t i = (lower + upper) / 2;
-        key_slice k0 = this->keys_[i];
-        if (k0 == k)
-          return key_search_ret(i, n);
-        else if (k0 > k)
-          upper = i;
-        else
-          lower = i + 1;
-      }
+      const size_t n = this->key_slots_used();
+      const size_t i = this->num_keys_below(k, n, true);
+      if (i && this->keys_[i - 1] == k)
+        return key_search_ret(i - 1, n);
       return key_search_ret(-1, n);
     }
 
@@ -983,23 +1063,9 @@ private:
     inline key_search_ret
     key_lower_bound_search(key_slice k) const
     {
-      ssize_t ret = -1;
-      size_t n = this->key_slots_used();
-      ssize_t lower = 0;
-      ssize_t upper = n;
-      while (lower < upper) {
-        ssize_t i = (lower + upper) / 2;
-        key_slice k0 = this->keys_[i];
-        if (k0 == k)
-          return key_search_ret(i, n);
-        else if (k0 > k)
-          upper = i;
-        else {
-          ret = i;
-          lower = i + 1;
-        }
-      }
-      return key_search_ret(ret, n);
+      // the last key <= k is either k itself or its tightest lower bound
+      const size_t n = this->key_slots_used();
+      return key_search_ret(ssize_t(this->num_keys_below(k, n, true)) - 1, n);
     }
 
     void
@@ -1036,7 +1102,7 @@ private:
       if (unlikely(!n))
         return;
       n->mark_deleting();
-      rcu::s_instance.free_with_fn(n, deleter);
+      rcu::s_instance.free_with_fn(n, deleter, InternalNodeAllocSize);
     }
 
   } PACKED;
@@ -1164,6 +1230,10 @@ private:
   static void recursive_delete(node *n);
 
   node *volatile root_;
+  int numa_node_;
+  unsigned pack_group_;
+  int write_policy_;
+  mutable std::atomic<uint64_t> snapshot_read_tick_;
 
 public:
 
@@ -1176,7 +1246,9 @@ public:
     uint64_t new_version;
   };
 
-  btree() : root_(leaf_node::alloc())
+  btree()
+    : root_(leaf_node::alloc()), numa_node_(-1), pack_group_(0),
+      write_policy_(0), snapshot_read_tick_(0)
   {
     static_assert(
         NKeysPerNode > (sizeof(key_slice) + 2), "XX"); // so we can always do a split
@@ -1202,6 +1274,70 @@ public:
     root_ = NULL;
   }
 
+  /**
+   * Binds the tree to numa node node (-1 unbinds it): the txn layer allocates
+   * its nodes and records on that node (see scoped_alloc_node)
+   */
+  inline void
+  set_numa_node(int node)
+  {
+    numa_node_ = node;
+  }
+
+  inline int
+  numa_node() const
+  {
+    return numa_node_;
+  }
+
+  /**
+   * Packs the tree's records (and the nodes the txn layer's inserts split
+   * off) on hugepages of pack group group, 0 for the shared pool (see
+   * scoped_alloc_pack_group)
+   */
+  inline void
+  set_pack_group(unsigned group)
+  {
+    pack_group_ = group;
+  }
+
+  inline unsigned
+  pack_group() const
+  {
+    return pack_group_;
+  }
+
+  /**
+   * The txn layer's write policy for the tree's records (a
+   * transaction_base::write_policy), and the last read-only tick (plus one,
+   * 0 for never) a snapshot txn read the tree at, for the adaptive policy
+   */
+  inline void
+  set_write_policy(int policy)
+  {
+    write_policy_ = policy;
+  }
+
+  inline int
+  write_policy() const
+  {
+    return write_policy_;
+  }
+
+  inline void
+  note_snapshot_read(uint64_t ro_tick) const
+  {
+    // stores only when the tick moves, so readers share the line
+    if (snapshot_read_tick_.load(std::memory_order_relaxed) < ro_tick + 1)
+      snapshot_read_tick_.store(ro_tick + 1, std::memory_order_relaxed);
+  }
+
+  inline uint64_t
+  last_snapshot_read() const
+  {
+    return snapshot_read_tick_.load(std::memory_order_relaxed);
+  }
+
   /**
    * NOT THREAD SAFE
    */
@@ -1238,6 +1374,45 @@ public:
     return search_impl(k, v, ns, search_info);
   }
 
+  // keys looked up in lockstep by search_batch()
+  static const size_t SearchBatchSize = 16;
+
+  /**
+   * Like search() for each of keys[0, n), but descends SearchBatchSize keys
+   * at a time in lockstep, prefetching each key's next node before reading
+   * any of them, so that their cache misses overlap. found[i] is set to
+   * whether or not keys[i] was found, and if so values[i] is set.
+   *
+   * Returns the number of keys found
+   */
+  size_t search_batch(const key_type *keys, size_t n,
+                      value_type *values, bool *found) const;
+
+  /**
+   * One step of warming up the cache for an operation on k, for callers
+   * which interleave several operations (or txns) on a thread to overlap
+   * their cache misses: reads the node at cur, which the last step
+   * prefetched, and moves cur to (and prefetches) its child on k's path
+   * through the first layer. cur starts null, for the root. Returns false
+   * once cur is k's leaf.
+   *
+   * Node versions aren't validated, so a step can go astray (which only
+   * warms up the wrong nodes), but cur must not outlive the caller's RCU
+   * region
+   */
+  bool prefetch_step(const key_type &k, const void *&cur) const;
+
+  /**
+   * Like insert() for each keys[i] => values[i], i in [0, n), in order, but
+   * warms up the keys' paths SearchBatchSize at a time like search_batch()
+   * does, and under one RCU region. If inserted is not null, inserted[i] is
+   * set to whether or not keys[i] was new.
+   *
+   * Returns the number of new keys
+   */
+  size_t insert_batch(const key_type *keys, const value_type *values,
+                      size_t n, bool *inserted = nullptr);
+
   /**
    * The low level callback interface is as follows:
    *
@@ -1262,6 +1437,12 @@ public:
      */
     virtual bool invoke(const string_type &k, value_type v,
                         const node_opaque_t *n, uint64_t version) = 0;
+
+    /**
+     * The values of a leaf this many entries ahead of the one being
+     * invoked are prefetched (0 for none). Asked once per leaf
+     */
+    virtual unsigned prefetch_distance() const { return 0; }
   };
 
   /**
@@ -1322,12 +1503,23 @@ private:
     }
   };
 
+  // if cur_leaf is not null, it is kept pointing to the leaf being scanned
   bool search_range_at_layer(leaf_node *leaf,
                              string_type &prefix,
                              const key_type &lower,
                              bool inc_lower,
                              const key_type *upper,
-                             low_level_search_range_callback &callback) const;
+                             low_level_search_range_callback &callback,
+                             leaf_node **cur_leaf = nullptr) const;
+
+  // search_range_call(), starting the descent from *hint (a first layer
+  // leaf) if hint is not null- and leaving *hint at the first layer leaf
+  // where the scan stopped
+  void search_range_call_from(const key_type &lower,
+                              const key_type *upper,
+                              low_level_search_range_callback &callback,
+                              string_type *buf,
+                              leaf_node **hint) const;
 
 public:
 
@@ -1374,11 +1566,105 @@ public:
    *   B) no concurrent mutation of string
    * note that string contents upon return are arbitrary
    */
-  void
+  inline void
   search_range_call(const key_type &lower,
                     const key_type *upper,
                     low_level_search_range_callback &callback,
-                    string_type *buf = nullptr) const;
+                    string_type *buf = nullptr) const
+  {
+    search_range_call_from(lower, upper, callback, buf, nullptr);
+  }
+
+  /**
+   * A position in the tree, for scans which page through a range in
+   * batches (see next()). Each batch starts from the leaf the last one
+   * stopped in, instead of descending from the root again: the leaf is only
+   * a hint, so if it has been split or merged in between the scan walks to
+   * the leaf responsible, and if it has been deleted the scan descends from
+   * the root.
+   *
+   * The leaf is not pinned, so the caller must stay in one RCU region across
+   * a cursor's calls (as a txn does).
+   */
+  class cursor {
+  public:
+    cursor(const btree &btr, const key_type &lower)
+      : btr_(&btr), leaf_(nullptr), done_(false)
+    {
+      seek(lower);
+    }
+
+    // moves the cursor to the first key >= k
+    inline void
+    seek(const key_type &k)
+    {
+      pos_.assign((const char *) k.data(), k.size());
+      leaf_ = nullptr;
+      done_ = false;
+    }
+
+    // the cursor is at the first key >= position()
+    inline const string_type &
+    position() const
+    {
+      return pos_;
+    }
+
+    // has a batch run out of keys?
+    inline bool
+    done() const
+    {
+      return done_;
+    }
+
+    /**
+     * Invokes callback (as in search_range_call()) on the next (up to) n
+     * keys < *upper, or with no bound if upper is null, and moves the cursor
+     * past them. If the callback returns false, the batch stops there, and
+     * the cursor is left after that key.
+     *
+     * Returns false once there are no keys left (the batch may still have
+     * invoked some)
+     */
+    bool next(low_level_search_range_callback &callback, size_t n,
+              const key_type *upper = nullptr);
+
+  private:
+    struct batch_callback : public low_level_search_range_callback {
+      batch_callback(low_level_search_range_callback &callback, size_t n)
+        : callback_(&callback), n_(n), ninvoked_(0), stopped_(false) {}
+
+      virtual void
+      on_resp_node(const node_opaque_t *n, uint64_t version)
+      {
+        callback_->on_resp_node(n, version);
+      }
+
+      virtual bool
+      invoke(const string_type &k, value_type v,
+             const node_opaque_t *n, uint64_t version)
+      {
+        last_.assign(k.data(), k.size());
+        ninvoked_++;
+        if (!callback_->invoke(k, v, n, version)) {
+          stopped_ = true;
+          return false;
+        }
+        return ninvoked_ < n_;
+      }
+
+      low_level_search_range_callback *const callback_;
+      const size_t n_;
+      size_t ninvoked_;
+      bool stopped_;
+      string_type last_;
+    };
+
+    const btree *btr_;
+    string_type pos_;
+    leaf_node *leaf_;
+    bool done_;
+  };
 
   // (lower, upper]
   void
@@ -1416,6 +1702,33 @@ public:
     NDB_UNIMPLEMENTED("rsearch_range");
   }
 
+  /**
+   * Splits [lower, *upper) into at most n subranges of roughly the same
+   * number of keys, and returns the keys where the second, third, ...
+   * subranges start (so one less than the number of subranges).
+   *
+   * The split points are separator keys of the first layer's internal nodes,
+   * so a range which is within one leaf (or within the layer of one long-key
+   * prefix) is not split. Concurrent modifications only make the subranges
+   * less even.
+   */
+  std::vector<std::string>
+  split_range(const key_type &lower, const key_type *upper, size_t n) const;
+
+  /**
+   * Like search_range_call(), but [lower, *upper) is split (see
+   * split_range()) into callbacks.size() subranges, which are scanned at the
+   * same time on as many threads (see task_pool): callbacks[i] gets the i-th
+   * subrange, in ascending order, and nothing if the range had fewer
+   * subranges. Pass the same callback more than once if the order across
+   * subranges doesn't matter- it is then invoked concurrently.
+   */
+  void
+  search_range_call_parallel(
+      const key_type &lower,
+      const key_type *upper,
+      const std::vector<low_level_search_range_callback *> &callbacks) const;
+
   /**
    * returns true if key k did not already exist, false otherwise
    * If k exists with a different mapping, still returns false
@@ -1457,7 +1770,21 @@ public:
     return remove_stable_location((node **) &root_, k, old_v);
   }
 
+  /**
+   * Fills an empty tree with keys[i] => values[i] for i in [0, n). The keys
+   * must be sorted and unique. Instead of inserting them one at a time, the
+   * leaves are packed full left to right and the internal levels are built
+   * bottom up over them, and the new root is published at the end.
+   *
+   * NOT THREAD SAFE: nobody else may use the tree until this returns
+   */
+  void bulk_load(const key_type *keys, const value_type *values, size_t n);
+
 private:
+
+  // builds the layer holding the (already shifted) keys, and returns its root
+  node *bulk_load_layer(const key_type *keys, const value_type *values, size_t n);
+
   bool
   insert_stable_location(node **root_location, const key_type &k, value_type v,
                          bool only_if_absent, value_type *old_v,
@@ -1518,6 +1845,24 @@ public:
     return c.get_size();
   }
 
+  /**
+   * The shape of the tree, for memory accounting. Depths count from the
+   * root, and carry on from a leaf into the layers it points to. Like size(),
+   * not consistent given concurrent modifications
+   */
+  struct shape_stats {
+    shape_stats()
+      : nkeys_(0), nkey_slots_(0), nlayers_(0), node_bytes_(0) {}
+    std::vector<size_t> internal_nodes_; // by depth
+    std::vector<size_t> leaf_nodes_; // by depth
+    size_t nkeys_;
+    size_t nkey_slots_; // of every leaf, used or not
+    size_t nlayers_;
+    size_t node_bytes_;
+  };
+
+  void shape(shape_stats &s) const;
+
   static inline uint64_t
   ExtractVersionNumber(const node_opaque_t *n)
   {
@@ -1627,6 +1972,26 @@ private:
 
   leaf_node *leftmost_descend_layer(node *n) const;
 
+  // prefetches all of n (well, its first four cachelines) without reading it
+  static inline ALWAYS_INLINE void
+  PrefetchNode(const node *n)
+  {
+    ::prefetch(n);
+    prefetch_bytes(n, std::max(sizeof(leaf_node), sizeof(internal_node)));
+  }
+
+  // prefetches the header (and first bytes) of the record value v points to
+  static inline ALWAYS_INLINE void
+  PrefetchValue(value_type v)
+  {
+    ::prefetch(v);
+    ::prefetch((const char *) v + CACHELINE_SIZE);
+  }
+
+  // walks the paths of keys[0, m) (m <= SearchBatchSize) through the first
+  // layer, one level per round, prefetching each key's next node
+  void prefetch_paths(const key_type *keys, size_t m) const;
+
   /**
    * Assumes RCU region scope is held
    */
@@ -1647,6 +2012,9 @@ private:
    *
    * note to actually use the info, you still need to validate it (the info is
    * tentative as of the version)
+   *
+   * returns NULL if leaf was the root of an empty layer which has since been
+   * dropped; the caller must retry from the top
    */
   static leaf_node *
   FindRespLeafLowerBound(
@@ -1701,23 +2069,44 @@ private:
     R_REPLACE_NODE,
   };
 
+  // locks n if it is the root of a layer with no keys left
+  static inline bool
+  LockIfEmptyLayer(node *n)
+  {
+    leaf_node *leaf = AsLeafCheck(n);
+    if (likely(!leaf || leaf->key_slots_used()))
+      return false;
+    leaf->lock();
+    if (likely(leaf->is_root() &&
+               !leaf->is_deleting() &&
+               !leaf->key_slots_used()))
+      return true;
+    leaf->unlock();
+    return false;
+  }
+
+  // frees the empty layer hanging off of leaf->values_[pos], whose root the
+  // caller holds locked. the slot is left as a plain value, to be removed
+  // by the caller
+  inline ALWAYS_INLINE void
+  release_empty_layer(leaf_node *leaf, size_t pos)
+  {
+    INVARIANT(leaf->value_is_layer(pos));
+    leaf_node *subroot = AsLeaf(leaf->values_[pos].n_);
+    INVARIANT(subroot->is_lock_owner());
+    INVARIANT(subroot->is_root());
+    INVARIANT(subroot->key_slots_used() == 0);
+    leaf_node::release(subroot);
+    leaf->keyslice_set_length(pos, 9, false);
+  }
+
   inline ALWAYS_INLINE void
   remove_pos_from_leaf_node(leaf_node *leaf, size_t pos, size_t n)
   {
     INVARIANT(leaf->key_slots_used() == n);
     INVARIANT(pos < n);
-    if (leaf->value_is_layer(pos)) {
-#ifdef CHECK_INVARIANTS
-      leaf->values_[pos].n_->lock();
-#endif
-      leaf->values_[pos].n_->mark_deleting();
-      INVARIANT(leaf->values_[pos].n_->is_leaf_node());
-      INVARIANT(leaf->values_[pos].n_->key_slots_used() == 0);
-      leaf_node::release((leaf_node *) leaf->values_[pos].n_);
-#ifdef CHECK_INVARIANTS
-      leaf->values_[pos].n_->unlock();
-#endif
-    }
+    if (leaf->value_is_layer(pos))
+      release_empty_layer(leaf, pos);
     sift_left(leaf->keys_, pos, n);
     sift_left(leaf->values_, pos, n);
     sift_left(leaf->lengths_, pos, n);
@@ -13,6 +13,7 @@
 
 #include "core.h"
 #include "btree.h"
+#include "task_pool.h"
 #include "thread.h"
 #include "txn.h"
 #include "util.h"
@@ -237,7 +238,8 @@ btree<P>::search_impl(const key_type &k, value_type &v,
 {
   INVARIANT(rcu::s_instance.in_rcu_region());
   //ANON_REGION("btree<P>::search_impl:", &btree_search_impl_perf_cg);
-  INVARIANT(leaf_nodes.empty());
+  // a first layer leaf to start from, instead of the root
+  INVARIANT(leaf_nodes.size() <= 1);
 
 retry:
   node *cur;
@@ -353,6 +355,90 @@ process:
   }
 }
 
+template <typename P>
+bool
+btree<P>::prefetch_step(const key_type &k, const void *&cur) const
+{
+  const node *n = reinterpret_cast<const node *>(cur);
+  if (!n) {
+    n = root_;
+    PrefetchNode(n);
+    cur = n;
+    return true;
+  }
+  if (n->is_leaf_node())
+    return false;
+  const internal_node *internal = AsInternal(n);
+  const ssize_t ret = internal->key_lower_bound_search(k.slice()).first;
+  // children_[0] if there is no lower bound
+  const node *child = internal->children_[ret + 1];
+  if (unlikely(!child))
+    return false;
+  PrefetchNode(child);
+  cur = child;
+  return true;
+}
+
+template <typename P>
+void
+btree<P>::prefetch_paths(const key_type *keys, size_t m) const
+{
+  INVARIANT(m <= SearchBatchSize);
+  const void *curs[SearchBatchSize];
+  for (size_t j = 0; j < m; j++)
+    curs[j] = nullptr;
+  bool descending = true;
+  while (descending) {
+    descending = false;
+    for (size_t j = 0; j < m; j++)
+      if (prefetch_step(keys[j], curs[j]))
+        descending = true;
+  }
+}
+
+template <typename P>
+size_t
+btree<P>::search_batch(const key_type *keys, size_t n,
+                       value_type *values, bool *found) const
+{
+  rcu_region guard;
+  typename util::vec<leaf_node *>::type ns;
+  size_t nfound = 0;
+  for (size_t i = 0; i < n; i += SearchBatchSize) {
+    const size_t m = std::min(n - i, SearchBatchSize);
+    prefetch_paths(&keys[i], m);
+    for (size_t j = 0; j < m; j++) {
+      ns.clear();
+      found[i + j] = search_impl(keys[i + j], values[i + j], ns);
+      if (found[i + j])
+        nfound++;
+    }
+  }
+  return nfound;
+}
+
+template <typename P>
+size_t
+btree<P>::insert_batch(const key_type *keys, const value_type *values,
+                       size_t n, bool *inserted)
+{
+  rcu_region guard;
+  size_t ninserted = 0;
+  for (size_t i = 0; i < n; i += SearchBatchSize) {
+    const size_t m = std::min(n - i, SearchBatchSize);
+    prefetch_paths(&keys[i], m);
+    for (size_t j = 0; j < m; j++) {
+      const bool ret = insert_stable_location(
+          (node **) &root_, keys[i + j], values[i + j], false, NULL, NULL);
+      if (inserted)
+        inserted[i + j] = ret;
+      if (ret)
+        ninserted++;
+    }
+  }
+  return ninserted;
+}
+
 template <typename S>
 class string_restore {
 public:
@@ -384,7 +470,8 @@ btree<P>::search_range_at_layer(
     const key_type &lower,
     bool inc_lower,
     const key_type *upper,
-    low_level_search_range_callback &callback) const
+    low_level_search_range_callback &callback,
+    leaf_node **cur_leaf) const
 {
   VERBOSE(std::cerr << "search_range_at_layer: prefix.size()=" << prefix.size() << std::endl);
 
@@ -445,9 +532,20 @@ btree<P>::search_range_at_layer(
     if (unlikely(!leaf->check_version(version)))
       continue;
 
+    if (cur_leaf)
+      *cur_leaf = leaf;
     callback.on_resp_node(leaf, RawVersionManip::Version(version));
 
+    // the values are read by the callback, and may well miss in cache
+    const size_t prefetch_distance = callback.prefetch_distance();
+    for (size_t i = 0; i < std::min(prefetch_distance, buf.size()); i++)
+      if (!buf[i].layer_)
+        PrefetchValue(buf[i].vn_.v_);
+
     for (size_t i = 0; i < buf.size(); i++) {
+      if (prefetch_distance && i + prefetch_distance < buf.size() &&
+          !buf[i + prefetch_distance].layer_)
+        PrefetchValue(buf[i + prefetch_distance].vn_.v_);
       // check to see if we already omitted a key <= buf[i]: if so, don't omit it
       if (emitted_last_keyslice &&
           ((buf[i].key_ < last_keyslice) ||
@@ -517,19 +615,24 @@ btree<P>::search_range_at_layer(
 
 template <typename P>
 void
-btree<P>::search_range_call(const key_type &lower,
-                            const key_type *upper,
-                            low_level_search_range_callback &callback,
-                            string_type *buf) const
+btree<P>::search_range_call_from(const key_type &lower,
+                                 const key_type *upper,
+                                 low_level_search_range_callback &callback,
+                                 string_type *buf,
+                                 leaf_node **hint) const
 {
   rcu_region guard;
   INVARIANT(rcu::s_instance.in_rcu_region());
   if (unlikely(upper && *upper <= lower))
     return;
   typename util::vec<leaf_node *>::type leaf_nodes;
+  if (hint && *hint)
+    leaf_nodes.push_back(*hint);
   value_type v = 0;
   search_impl(lower, v, leaf_nodes);
   INVARIANT(!leaf_nodes.empty());
+  if (hint)
+    *hint = leaf_nodes.front();
   bool first = true;
   string_type prefix_tmp, *prefix_px;
   if (buf)
@@ -553,7 +656,8 @@ btree<P>::search_range_call(const key_type &lower,
 #endif
     if (!search_range_at_layer(
           cur, prefix, lower.shift_many(leaf_nodes.size()),
-          first, layer_has_upper ? &layer_upper : NULL, callback))
+          first, layer_has_upper ? &layer_upper : NULL, callback,
+          leaf_nodes.empty() ? hint : nullptr))
       return;
 #ifdef CHECK_INVARIANTS
     INVARIANT(prefix == prefix_before);
@@ -566,6 +670,111 @@ btree<P>::search_range_call(const key_type &lower,
   }
 }
 
+template <typename P>
+bool
+btree<P>::cursor::next(low_level_search_range_callback &callback, size_t n,
+                       const key_type *upper)
+{
+  if (done_ || !n)
+    return !done_;
+  batch_callback c(callback, n);
+  btr_->search_range_call_from(varkey(pos_), upper, c, nullptr, &leaf_);
+  if (c.ninvoked_ < n && !c.stopped_) {
+    done_ = true;
+    return false;
+  }
+  // the smallest key after the last one invoked
+  pos_.swap(c.last_);
+  pos_.push_back('\0');
+  return true;
+}
+
+template <typename P>
+std::vector<std::string>
+btree<P>::split_range(const key_type &lower, const key_type *upper, size_t n) const
+{
+  std::vector<std::string> bounds;
+  if (n <= 1 || (upper && *upper <= lower))
+    return bounds;
+  rcu_region guard;
+  const key_slice lower_slice = lower.slice();
+  const key_slice upper_slice =
+    upper ? upper->slice() : std::numeric_limits<key_slice>::max();
+
+  // collect the separators within the range level by level, until there are
+  // enough to pick n - 1 evenly spaced ones
+  std::vector<key_slice> seps;
+  std::vector<node *> level(1, (node *) root_);
+  while (!level.empty() && seps.size() + 1 < n) {
+    std::vector<node *> next;
+    for (auto cur : level) {
+    retry:
+      const uint64_t version = cur->stable_version();
+      if (AsLeafCheck(cur, version))
+        continue;
+      internal_node *internal = AsInternal(cur);
+      const size_t sz =
+        std::min(internal->key_slots_used(), size_t(NKeysPerNode));
+      key_slice keys[NKeysPerNode];
+      node *children[NKeysPerNode + 1];
+      std::copy(internal->keys_, internal->keys_ + sz, keys);
+      std::copy(internal->children_, internal->children_ + sz + 1, children);
+      if (unlikely(!internal->check_version(version)))
+        goto retry;
+      // children[i] covers [keys[i - 1], keys[i])
+      for (size_t i = 0; i <= sz; i++) {
+        if (i < sz && keys[i] <= lower_slice)
+          continue;
+        if (i > 0 && keys[i - 1] > upper_slice)
+          break;
+        if (i > 0)
+          seps.push_back(keys[i - 1]);
+        next.push_back(children[i]);
+      }
+    }
+    level.swap(next);
+  }
+
+  std::sort(seps.begin(), seps.end());
+  std::vector<std::string> cands;
+  for (auto s : seps) {
+    const key_slice be = util::big_endian_trfm<key_slice>()(s);
+    std::string b((const char *) &be, sizeof(be));
+    if (varkey(b) <= lower || (upper && !(varkey(b) < *upper)))
+      continue;
+    if (cands.empty() || cands.back() != b)
+      cands.emplace_back(std::move(b));
+  }
+  for (size_t i = 1; i < n; i++) {
+    const size_t idx = i * cands.size() / n;
+    if (idx < cands.size() && (bounds.empty() || bounds.back() < cands[idx]))
+      bounds.push_back(cands[idx]);
+  }
+  return bounds;
+}
+
+template <typename P>
+void
+btree<P>::search_range_call_parallel(
+    const key_type &lower,
+    const key_type *upper,
+    const std::vector<low_level_search_range_callback *> &callbacks) const
+{
+  const std::vector<std::string> bounds =
+    split_range(lower, upper, callbacks.size());
+  std::vector<task_pool::task_t> tasks;
+  for (size_t i = 0; i <= bounds.size() && i < callbacks.size(); i++)
+    tasks.emplace_back([&, i]() {
+      const key_type sub_lower = i ? key_type(bounds[i - 1]) : lower;
+      key_type sub_upper;
+      if (i < bounds.size())
+        sub_upper = key_type(bounds[i]);
+      search_range_call(
+          sub_lower, i < bounds.size() ? &sub_upper : upper, *callbacks[i]);
+    });
+  task_pool::Run(tasks);
+}
+
 template <typename P>
 bool
 btree<P>::remove_stable_location(node **root_location, const key_type &k, value_type *old_v)
@@ -668,6 +877,53 @@ btree<P>::tree_walk(tree_walk_callback &callback) const
   }
 }
 
+template <typename P>
+void
+btree<P>::shape(shape_stats &s) const
+{
+  rcu_region guard;
+  INVARIANT(rcu::s_instance.in_rcu_region());
+  std::vector<std::pair<node *, size_t>> q;
+  std::vector<node *> children;
+  // XXX: not sure if cast is safe
+  q.emplace_back((node *) root_, 0);
+  while (!q.empty()) {
+    node *cur = q.back().first;
+    const size_t depth = q.back().second;
+    q.pop_back();
+    cur->prefetch();
+  process:
+    children.clear();
+    const uint64_t version = cur->stable_version();
+    const size_t n = cur->key_slots_used();
+    if (leaf_node *leaf = AsLeafCheck(cur, version)) {
+      for (size_t i = 0; i < n; i++)
+        if (leaf->is_layer(i))
+          children.push_back(leaf->values_[i].n_);
+      if (unlikely(!cur->check_version(version)))
+        goto process;
+      if (s.leaf_nodes_.size() <= depth)
+        s.leaf_nodes_.resize(depth + 1);
+      s.leaf_nodes_[depth]++;
+      s.nkeys_ += n - children.size();
+      s.nkey_slots_ += NKeysPerNode;
+      s.nlayers_ += children.size();
+      s.node_bytes_ += sizeof(leaf_node);
+    } else {
+      internal_node *internal = AsInternal(cur);
+      children.assign(internal->children_, internal->children_ + n + 1);
+      if (unlikely(!cur->check_version(version)))
+        goto process;
+      if (s.internal_nodes_.size() <= depth)
+        s.internal_nodes_.resize(depth + 1);
+      s.internal_nodes_[depth]++;
+      s.node_bytes_ += sizeof(internal_node);
+    }
+    for (auto c : children)
+      q.emplace_back(c, depth + 1);
+  }
+}
+
 template <typename P>
 void
 btree<P>::size_walk_callback::on_node_begin(const node_opaque_t *n)
@@ -716,9 +972,10 @@ retry:
       leaf = right;
       goto retry;
     }
-    // XXX(stephentu): not sure if we can *really* depend on this,
-    // need to convince ourselves why this is not possible!
-    ALWAYS_ASSERT(false);
+    // a deleted leaf with no siblings is the root of a layer which went
+    // empty and was dropped from its parent layer
+    INVARIANT(leaf->is_root());
+    return NULL;
   }
   if (unlikely(kslice < leaf->min_key_)) {
     // we need to go left
@@ -763,6 +1020,8 @@ btree<P>::FindRespLeafLowerBound(
       ssize_t &idxlowerbound)
 {
   leaf = FindRespLeafNode(leaf, kslice, version);
+  if (unlikely(!leaf))
+    return NULL;
 
   // use 0 for slice length, so we can a pointer <= all elements
   // with the same slice
@@ -805,6 +1064,8 @@ btree<P>::FindRespLeafExact(
       ssize_t &idxmatch)
 {
   leaf = FindRespLeafNode(leaf, kslice, version);
+  if (unlikely(!leaf))
+    return NULL;
   key_search_ret kret = leaf->key_search(kslice, kslicelen);
   idxmatch = kret.first;
   n = kret.second;
@@ -838,6 +1099,8 @@ retry_cur_leaf:
     ssize_t lenmatch, lenlowerbound;
     leaf_node *resp_leaf = FindRespLeafLowerBound(
         leaf, kslice, kslicelen, version, n, lenmatch, lenlowerbound);
+    if (unlikely(!resp_leaf))
+      return UnlockAndReturn(locked_nodes, I_RETRY);
 
     // len match case
     if (lenmatch != -1) {
@@ -891,6 +1154,7 @@ retry_cur_leaf:
           for (;;) {
             resp_leaf = FindRespLeafLowerBound(
                 resp_leaf, kslice, kslicelen, version, n, lenmatch, lenlowerbound);
+            INVARIANT(resp_leaf);
             const uint64_t locked_version = resp_leaf->lock();
             if (likely(btree::CheckVersion(version, locked_version))) {
               locked_nodes.push_back(resp_leaf);
@@ -955,12 +1219,12 @@ retry_cur_leaf:
         new_root->inc_key_slots_used();
         if (new_root->keyslice_length(0) == 9) {
           new_root->alloc_suffixes();
-          rcu_imstring i(old_slice.data() + 8, old_slice.size() - 8);
+          typename leaf_node::rcu_suffix_type i(old_slice.data() + 8, old_slice.size() - 8);
           new_root->suffixes_[0].swap(i);
         }
         resp_leaf->values_[lenmatch].n_ = new_root;
         {
-          rcu_imstring i;
+          typename leaf_node::rcu_suffix_type i;
           resp_leaf->suffixes_[lenmatch].swap(i);
         }
         resp_leaf->value_set_layer(lenmatch);
@@ -1005,10 +1269,10 @@ retry_cur_leaf:
         sift_swap_right(resp_leaf->suffixes_, lenlowerbound + 1, n);
       if (kslicelen == 9) {
         resp_leaf->ensure_suffixes();
-        rcu_imstring i(k.data() + 8, k.size() - 8);
+        typename leaf_node::rcu_suffix_type i(k.data() + 8, k.size() - 8);
         resp_leaf->suffixes_[lenlowerbound + 1].swap(i);
       } else if (resp_leaf->suffixes_) {
-        rcu_imstring i;
+        typename leaf_node::rcu_suffix_type i;
         resp_leaf->suffixes_[lenlowerbound + 1].swap(i);
       }
       resp_leaf->inc_key_slots_used();
@@ -1102,7 +1366,7 @@ retry_cur_leaf:
         new_leaf->keyslice_set_length(0, kslicelen, false);
         if (kslicelen == 9) {
           new_leaf->alloc_suffixes();
-          rcu_imstring i(k.data() + 8, k.size() - 8);
+          typename leaf_node::rcu_suffix_type i(k.data() + 8, k.size() - 8);
           new_leaf->suffixes_[0].swap(i);
         }
         new_leaf->set_key_slots_used(1);
@@ -1167,10 +1431,10 @@ retry_cur_leaf:
           }
           if (kslicelen == 9) {
             new_leaf->ensure_suffixes();
-            rcu_imstring i(k.data() + 8, k.size() - 8);
+            typename leaf_node::rcu_suffix_type i(k.data() + 8, k.size() - 8);
             new_leaf->suffixes_[pos].swap(i);
           } else if (new_leaf->suffixes_) {
-            rcu_imstring i;
+            typename leaf_node::rcu_suffix_type i;
             new_leaf->suffixes_[pos].swap(i);
           }
           if (resp_leaf->suffixes_) {
@@ -1211,10 +1475,10 @@ retry_cur_leaf:
             sift_swap_right(resp_leaf->suffixes_, lenlowerbound + 1, split_point);
           if (kslicelen == 9) {
             resp_leaf->ensure_suffixes();
-            rcu_imstring i(k.data() + 8, k.size() - 8);
+            typename leaf_node::rcu_suffix_type i(k.data() + 8, k.size() - 8);
             resp_leaf->suffixes_[lenlowerbound + 1].swap(i);
           } else if (resp_leaf->suffixes_) {
-            rcu_imstring i;
+            typename leaf_node::rcu_suffix_type i;
             resp_leaf->suffixes_[lenlowerbound + 1].swap(i);
           }
 
@@ -1404,6 +1668,141 @@ retry:
   return false;
 }
 
+template <typename P>
+void
+btree<P>::bulk_load(const key_type *keys, const value_type *values, size_t n)
+{
+  rcu_region guard;
+  node * const old_root = root_;
+  ALWAYS_ASSERT(old_root->is_leaf_node());
+  ALWAYS_ASSERT(!old_root->key_slots_used());
+  if (!n)
+    return;
+  node * const new_root = bulk_load_layer(keys, values, n);
+  COMPILER_MEMORY_FENCE;
+  root_ = new_root;
+#ifdef CHECK_INVARIANTS
+  old_root->lock();
+#endif
+  leaf_node::release(AsLeaf(old_root));
+#ifdef CHECK_INVARIANTS
+  old_root->unlock();
+#endif
+}
+
+template <typename P>
+typename btree<P>::node *
+btree<P>::bulk_load_layer(const key_type *keys, const value_type *values, size_t n)
+{
+  INVARIANT(n);
+  // nodes stay locked (for the invariant checks) until the layer is done
+  std::vector<node *> filled;
+  std::vector<node *> level;
+  std::vector<key_slice> level_min_keys;
+
+  // pack the leaves, never splitting the keys of one slice across leaves
+  leaf_node *leaf = nullptr;
+  size_t i = 0;
+  while (i < n) {
+    const key_slice kslice = keys[i].slice();
+    size_t j = i;
+    size_t nshort = 0;
+    for (; j < n && keys[j].slice() == kslice; j++) {
+      INVARIANT(j == i || keys[j - 1] < keys[j]);
+      if (keys[j].size() <= 8)
+        nshort++;
+    }
+    // keys longer than a slice go after the others, and share a slot
+    const size_t nlong = j - i - nshort;
+    const size_t nslots = nshort + (nlong ? 1 : 0);
+    INVARIANT(!level.size() || kslice > level_min_keys.back());
+    if (!leaf || leaf->key_slots_used() + nslots > NKeysPerNode) {
+      leaf_node * const new_leaf = leaf_node::alloc();
+#ifdef CHECK_INVARIANTS
+      new_leaf->lock();
+      new_leaf->mark_modifying();
+      filled.push_back(new_leaf);
+#endif
+      // the leftmost leaf is responsible for everything to its left
+      new_leaf->min_key_ = leaf ? kslice : 0;
+      new_leaf->prev_ = leaf;
+      if (leaf)
+        leaf->next_ = new_leaf;
+      leaf = new_leaf;
+      level.push_back(leaf);
+      level_min_keys.push_back(kslice);
+    }
+
+    for (; i < j; i++) {
+      const size_t s = leaf->key_slots_used();
+      leaf->keys_[s] = kslice;
+      if (keys[i].size() <= 8) {
+        leaf->keyslice_set_length(s, keys[i].size(), false);
+        leaf->values_[s].v_ = values[i];
+      } else if (nlong == 1) {
+        leaf->keyslice_set_length(s, 9, false);
+        leaf->values_[s].v_ = values[i];
+        leaf->ensure_suffixes();
+        typename leaf_node::rcu_suffix_type suffix(keys[i].data() + 8, keys[i].size() - 8);
+        leaf->suffixes_[s].swap(suffix);
+      } else {
+        // several keys share this slice, so they get a layer of their own
+        std::vector<key_type> shifted;
+        shifted.reserve(nlong);
+        for (size_t k = i; k < j; k++)
+          shifted.push_back(keys[k].shift());
+        leaf->keyslice_set_length(s, 9, true);
+        leaf->values_[s].n_ = bulk_load_layer(&shifted[0], &values[i], nlong);
+        i = j;
+        leaf->inc_key_slots_used();
+        break;
+      }
+      leaf->inc_key_slots_used();
+    }
+  }
+
+  // then the internal levels. each level spreads its children evenly over
+  // as few nodes as possible, so (for more than one node) no node is less
+  // than half full
+  while (level.size() > 1) {
+    std::vector<node *> parents;
+    std::vector<key_slice> parent_min_keys;
+    const size_t nparents =
+      (level.size() + NKeysPerNode) / (NKeysPerNode + 1);
+    size_t c = 0;
+    for (size_t p = 0; p < nparents; p++) {
+      const size_t nchildren = (level.size() - c) / (nparents - p);
+      INVARIANT(nchildren <= NKeysPerNode + 1);
+      INVARIANT(nparents == 1 || nchildren > NMinKeysPerNode);
+      internal_node * const internal = internal_node::alloc();
+#ifdef CHECK_INVARIANTS
+      internal->lock();
+      internal->mark_modifying();
+      filled.push_back(internal);
+#endif
+      internal->children_[0] = level[c];
+      for (size_t k = 1; k < nchildren; k++) {
+        internal->keys_[k - 1] = level_min_keys[c + k];
+        internal->children_[k] = level[c + k];
+      }
+      internal->set_key_slots_used(nchildren - 1);
+      parents.push_back(internal);
+      parent_min_keys.push_back(level_min_keys[c]);
+      c += nchildren;
+    }
+    INVARIANT(c == level.size());
+    level.swap(parents);
+    level_min_keys.swap(parent_min_keys);
+  }
+
+  level[0]->set_root();
+#ifdef CHECK_INVARIANTS
+  for (auto n : filled)
+    n->unlock();
+#endif
+  return level[0];
+}
+
 /**
  * remove is very tricky to get right!
  *
@@ -1433,19 +1832,29 @@ btree<P>::remove0(node *np,
     SINGLE_THREADED_INVARIANT(!left_node || (leaf->prev_ == left_node && AsLeaf(left_node)->next == leaf));
     SINGLE_THREADED_INVARIANT(!right_node || (leaf->next_ == right_node && AsLeaf(right_node)->prev == leaf));
 
+    // set once k has been removed from the layer under k's slot, and that
+    // layer went empty: we then remove the slot itself, holding the lock on
+    // the layer's root so nothing can be inserted into it meanwhile. this is
+    // best effort- if the tree changes under us we leave the layer be, since
+    // k is already gone
+    leaf_node *empty_layer = NULL;
+
 retry_cur_leaf:
     uint64_t version;
     size_t n;
     ssize_t ret;
     leaf_node *resp_leaf = FindRespLeafExact(
         leaf, kslice, kslicelen, version, n, ret);
+    if (unlikely(!resp_leaf))
+      return UnlockAndReturn(locked_nodes, empty_layer ? R_NONE_MOD : R_RETRY);
 
     if (ret == -1) {
       if (unlikely(!resp_leaf->check_version(version)))
         goto retry_cur_leaf;
+      INVARIANT(!empty_layer);
       return UnlockAndReturn(locked_nodes, R_NONE_NOMOD);
     }
-    if (kslicelen == 9) {
+    if (kslicelen == 9 && !empty_layer) {
       if (resp_leaf->is_layer(ret)) {
         node *subroot = resp_leaf->values_[ret].n_;
         INVARIANT(subroot);
@@ -1469,16 +1878,24 @@ retry_cur_leaf:
             sub_locked_nodes);
         switch (status) {
         case R_NONE_NOMOD:
-        case R_NONE_MOD:
         case R_RETRY:
           INVARIANT(sub_locked_nodes.empty());
           return status;
 
+        case R_NONE_MOD:
+          INVARIANT(sub_locked_nodes.empty());
+          if (!LockIfEmptyLayer(subroot))
+            return status;
+          empty_layer = AsLeaf(subroot);
+          locked_nodes.push_back(empty_layer);
+          goto retry_cur_leaf;
+
         case R_REPLACE_NODE:
           INVARIANT(replace_node);
           for (;;) {
             resp_leaf = FindRespLeafExact(
                 resp_leaf, kslice, kslicelen, version, n, ret);
+            INVARIANT(resp_leaf);
             const uint64_t locked_version = resp_leaf->lock();
             if (likely(btree::CheckVersion(version, locked_version))) {
               locked_nodes.push_back(resp_leaf);
@@ -1524,22 +1941,28 @@ retry_cur_leaf:
         goto retry_cur_leaf;
       }
       locked_nodes.push_back(resp_leaf);
-      if (old_v)
+      INVARIANT(!empty_layer || resp_leaf->values_[ret].n_ == empty_layer);
+      if (old_v && !empty_layer)
         *old_v = resp_leaf->values_[ret].v_;
       resp_leaf->mark_modifying();
       remove_pos_from_leaf_node(resp_leaf, ret, n);
       return UnlockAndReturn(locked_nodes, R_NONE_MOD);
     } else {
 
+      // k itself is already removed when dropping an empty layer, so retrying
+      // from the top is not an option then
+      const remove_status retry = empty_layer ? R_NONE_MOD : R_RETRY;
+
       if (unlikely(resp_leaf != leaf))
-        return UnlockAndReturn(locked_nodes, R_RETRY);
+        return UnlockAndReturn(locked_nodes, retry);
       const uint64_t locked_version = leaf->lock();
       if (unlikely(!btree::CheckVersion(version, locked_version))) {
         leaf->unlock();
         goto retry_cur_leaf;
       }
       locked_nodes.push_back(leaf);
-      if (old_v)
+      INVARIANT(!empty_layer || leaf->values_[ret].n_ == empty_layer);
+      if (old_v && !empty_layer)
         *old_v = leaf->values_[ret].v_;
 
       uint64_t leaf_version = leaf->unstable_version();
@@ -1572,11 +1995,11 @@ retry_cur_leaf:
         locked_nodes.push_back(left_sibling);
         leaf->lock();
         if (unlikely(!leaf->check_version(leaf_version)))
-          return UnlockAndReturn(locked_nodes, R_RETRY);
+          return UnlockAndReturn(locked_nodes, retry);
       } else {
         INVARIANT(parents.empty());
         if (unlikely(!leaf->is_root()))
-          return UnlockAndReturn(locked_nodes, R_RETRY);
+          return UnlockAndReturn(locked_nodes, retry);
         //INVARIANT(leaf == root);
       }
 
@@ -1589,7 +2012,7 @@ retry_cur_leaf:
         p->lock();
         locked_nodes.push_back(p);
         if (unlikely(!p->check_version(p_version)))
-          return UnlockAndReturn(locked_nodes, R_RETRY);
+          return UnlockAndReturn(locked_nodes, retry);
         size_t p_n = p->key_slots_used();
         if (p_n > NMinKeysPerNode)
           break;
@@ -1602,19 +2025,26 @@ retry_cur_leaf:
           locked_nodes.push_back(l);
           p->lock();
           if (unlikely(!p->check_version(p_version)))
-            return UnlockAndReturn(locked_nodes, R_RETRY);
+            return UnlockAndReturn(locked_nodes, retry);
         } else {
           if (unlikely(!p->is_root()))
-            return UnlockAndReturn(locked_nodes, R_RETRY);
+            return UnlockAndReturn(locked_nodes, retry);
           //INVARIANT(p == root);
         }
       }
 
       leaf->mark_modifying();
+      // the slot at ret goes away in every case below
+      if (empty_layer)
+        release_empty_layer(leaf, ret);
 
       if (right_sibling) {
         right_sibling->mark_modifying();
         size_t right_n = right_sibling->key_slots_used();
+        // the header admits more slots than the node has when NKeysPerNode
+        // is not 2^k - 1; bound them, so the copies below are provably in
+        // range (and don't trip -Wstringop-overflow)
+        ALWAYS_ASSERT(n <= NKeysPerNode && right_n <= NKeysPerNode);
         if (right_n > NMinKeysPerNode) {
           // steal first contiguous key slices from right
           INVARIANT(right_sibling->keys_[0] > leaf->keys_[n - 1]);
@@ -1719,6 +2149,8 @@ retry_cur_leaf:
       if (left_sibling) {
         left_sibling->mark_modifying();
         size_t left_n = left_sibling->key_slots_used();
+        // as for right_n above
+        ALWAYS_ASSERT(n <= NKeysPerNode && left_n <= NKeysPerNode);
         if (left_n > NMinKeysPerNode) {
           // try to steal from left
           INVARIANT(left_sibling->keys_[left_n - 1] < leaf->keys_[0]);
@@ -1730,6 +2162,7 @@ retry_cur_leaf:
               break;
 
           size_t nstolen = left_n - steal_point;
+          ALWAYS_ASSERT(nstolen <= NKeysPerNode);
           INVARIANT(nstolen <= sizeof(key_slice) + 2);
           INVARIANT(steal_point < left_n);
 
@@ -0,0 +1,476 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <lz4.h>
+
+#include "cold_store.h"
+#include "counter.h"
+#include "learned_index.h"
+#include "point_index.h"
+#include "rcu.h"
+
+using namespace std;
+
+static event_counter evt_cold_evictions("cold_evictions");
+static event_counter evt_cold_bytes_evicted("cold_bytes_evicted");
+static event_counter evt_cold_faults("cold_faults");
+static event_counter evt_cold_sync_reads("cold_sync_reads");
+static event_counter evt_cold_compressions("cold_compressions");
+static event_counter evt_cold_bytes_compressed("cold_bytes_compressed");
+static event_counter evt_cold_incompressible("cold_incompressible");
+static event_counter evt_cold_decompressions("cold_decompressions");
+
+bool cold_store::g_enabled = false;
+
+namespace {
+
+  typedef cold_store::cold_ref cold_ref;
+
+  // keys the sweeper visits per RCU region (and per hold of g_trees_lock)
+  const size_t SweepChunk = 256;
+
+  // a value is only kept compressed if it shrinks to this fraction
+  const size_t MaxCompressedNum = 3, MaxCompressedDen = 4;
+
+  int g_fd = -1;
+  atomic<uint64_t> g_off(0);
+  atomic<uint64_t> g_compressed_seq(0);
+  atomic<bool> g_compressed(false);
+  size_t g_min_value_size = 0;
+
+  // held while a table's tuples are being replaced, so it is not destroyed
+  // under the sweeper or the fault thread
+  mutex g_trees_lock;
+  set<concurrent_btree *> g_trees;
+
+  // the key of a compressed stub comes along (it is not in the file)
+  struct fault {
+    cold_ref r_;
+    string key_;
+  };
+
+  mutex g_fault_lock;
+  condition_variable g_fault_cv;
+  condition_variable g_fault_done_cv;
+  vector<fault> g_faults;
+  unordered_set<uint64_t> g_faulting; // offsets of faults queued or running
+
+  void
+  WriteFully(const char *p, size_t n, uint64_t off)
+  {
+    while (n) {
+      const ssize_t r = pwrite(g_fd, p, n, off);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0) {
+        perror("pwrite");
+        ALWAYS_ASSERT(false);
+      }
+      p += r;
+      n -= r;
+      off += r;
+    }
+  }
+
+  void
+  ReadFully(char *p, size_t n, uint64_t off)
+  {
+    while (n) {
+      const ssize_t r = pread(g_fd, p, n, off);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0) {
+        perror("pread");
+        ALWAYS_ASSERT(false);
+      }
+      p += r;
+      n -= r;
+      off += r;
+    }
+  }
+
+  inline cold_ref
+  RefOf(const dbtuple *tuple)
+  {
+    INVARIANT(tuple->size >= sizeof(cold_ref));
+    cold_ref r;
+    memcpy(&r, tuple->get_value_start(), sizeof(r));
+    return r;
+  }
+
+  // the value of a compressed stub, into dst (of r.len_ bytes)
+  void
+  Decompress(const dbtuple *stub, const cold_ref &r, char *dst)
+  {
+    const size_t skip = sizeof(cold_ref) + r.klen_;
+    INVARIANT(stub->size >= skip);
+    const int ret = LZ4_decompress_safe(
+        (const char *) stub->get_value_start() + skip, dst,
+        stub->size - skip, r.len_);
+    ALWAYS_ASSERT(ret == int(r.len_));
+    ++evt_cold_decompressions;
+  }
+
+  // the record of a compressed stub for value, or empty if it does not
+  // compress well enough
+  string
+  CompressedRecord(concurrent_btree *btr, const string &key,
+                   const string &value)
+  {
+    const size_t skip = sizeof(cold_ref) + key.size();
+    string rec(skip + LZ4_compressBound(value.size()), '\0');
+    const int ret = LZ4_compress_limitedOutput(
+        value.data(), &rec[skip], value.size(),
+        value.size() * MaxCompressedNum / MaxCompressedDen);
+    if (ret <= 0) {
+      ++evt_cold_incompressible;
+      return string();
+    }
+    rec.resize(skip + ret);
+    cold_ref r;
+    r.btr_ = btr;
+    r.off_ = cold_store::CompressedBit |
+      g_compressed_seq.fetch_add(1, memory_order_relaxed);
+    r.len_ = value.size();
+    r.klen_ = key.size();
+    memcpy(&rec[0], &r, sizeof(r));
+    memcpy(&rec[sizeof(r)], key.data(), key.size());
+    return rec;
+  }
+
+  inline bool
+  Evictable(const dbtuple *tuple, dbtuple::version_t v)
+  {
+    return dbtuple::IsLatest(v) &&
+           !dbtuple::IsCold(v) &&
+           !dbtuple::IsDeleting(v) &&
+           !dbtuple::IsLocked(v) &&
+           tuple->version != dbtuple::MAX_TID &&
+           !tuple->get_next() &&
+           tuple->size >= g_min_value_size &&
+           // the stub must actually be smaller
+           dbtuple::AllocSize(sizeof(cold_ref)) <
+             sizeof(dbtuple) + tuple->alloc_size;
+  }
+
+  // puts rep in place of tuple (a latest tuple locked by the caller) in btr
+  void
+  Replace(concurrent_btree *btr, const string &key,
+          dbtuple *tuple, dbtuple *rep)
+  {
+    INVARIANT(tuple->is_locked());
+    concurrent_btree::value_type old_v = 0;
+    if (btr->insert(varkey(key), (concurrent_btree::value_type) rep,
+                    &old_v, NULL))
+      // should already exist in tree
+      INVARIANT(false);
+    INVARIANT(old_v == (concurrent_btree::value_type) tuple);
+    if (point_index * const idx = point_index::For(btr))
+      idx->put(varkey(key), rep);
+    if (learned_index * const idx = learned_index::For(btr))
+      idx->put(varkey(key), rep);
+    tuple->clear_latest();
+    dbtuple::release(tuple);
+  }
+
+  inline bool
+  MapsTo(concurrent_btree *btr, const string &key, const dbtuple *tuple)
+  {
+    concurrent_btree::value_type v = 0;
+    return btr->search(varkey(key), v) &&
+           v == (concurrent_btree::value_type) tuple;
+  }
+
+  // caller is in an RCU region
+  bool
+  Evict(concurrent_btree *btr, const string &key, dbtuple *tuple)
+  {
+    const dbtuple::version_t v = tuple->unstable_version();
+    if (!Evictable(tuple, v))
+      return false;
+    const dbtuple::tid_t version = tuple->version;
+    const size_t sz = tuple->size;
+    if (sz > tuple->alloc_size)
+      return false; // torn read
+    const string value((const char *) tuple->get_value_start(), sz);
+    if (!tuple->reader_check_version(v))
+      return false;
+
+    // the stub's record
+    string rec;
+    if (g_compressed.load(memory_order_acquire)) {
+      rec = CompressedRecord(btr, key, value);
+      if (!rec.empty() &&
+          dbtuple::AllocSize(rec.size()) >= sizeof(dbtuple) + tuple->alloc_size)
+        rec.clear();
+      if (rec.empty() && g_fd < 0)
+        return false;
+    }
+    if (rec.empty()) {
+      const string frec = key + value;
+      cold_ref r;
+      r.btr_ = btr;
+      r.off_ = g_off.fetch_add(frec.size(), memory_order_relaxed);
+      r.len_ = sz;
+      r.klen_ = key.size();
+      WriteFully(frec.data(), frec.size(), r.off_);
+      rec.assign((const char *) &r, sizeof(r));
+    }
+
+    // nothing changed while the value was written out (a write would have
+    // moved the version)
+    const dbtuple::version_t lv = tuple->lock(false);
+    if (!dbtuple::IsLatest(lv) ||
+        !tuple->reader_check_version(v) ||
+        tuple->get_next() ||
+        !MapsTo(btr, key, tuple)) {
+      tuple->unlock();
+      return false;
+    }
+    dbtuple * const stub = dbtuple::alloc_replacement(
+        version, (const uint8_t *) rec.data(), rec.size(), true);
+    Replace(btr, key, tuple, stub);
+    tuple->unlock();
+    ++evt_cold_evictions;
+    evt_cold_bytes_evicted += sz;
+    if (rec.size() > sizeof(cold_ref)) {
+      ++evt_cold_compressions;
+      evt_cold_bytes_compressed += rec.size() - sizeof(cold_ref) - key.size();
+    }
+    return true;
+  }
+
+  struct sweep_callback {
+    sweep_callback() : n_(0), more_(false) {}
+    bool
+    operator()(const concurrent_btree::string_type &k,
+               concurrent_btree::value_type v)
+    {
+      dbtuple * const tuple = reinterpret_cast<dbtuple *>(v);
+      last_.assign(k.data(), k.size());
+      const dbtuple::version_t tv = tuple->unstable_version();
+      if (Evictable(tuple, tv)) {
+        if (tuple->is_referenced())
+          tuple->clear_referenced();
+        else
+          victims_.emplace_back(last_, tuple);
+      } else if (dbtuple::IsCold(tv) && tuple->is_referenced() &&
+                 cold_store::IsCompressed(tuple)) {
+        // see cold_store::Read()
+        tuple->clear_referenced();
+      }
+      // a sweep holding back the tick stops its chunk early
+      if (++n_ == SweepChunk || ticker::s_instance.is_holding_back_tick()) {
+        more_ = true;
+        return false;
+      }
+      return true;
+    }
+    vector<pair<string, dbtuple *>> victims_;
+    string last_;
+    size_t n_;
+    bool more_;
+  };
+
+  size_t
+  SweepTree(concurrent_btree *btr)
+  {
+    size_t n = 0;
+    string start;
+    for (;;) {
+      std::lock_guard<mutex> l(g_trees_lock);
+      if (!g_trees.count(btr))
+        break;
+      scoped_rcu_region guard;
+      sweep_callback c;
+      btr->search_range(varkey(start), nullptr, c);
+      for (auto &p : c.victims_)
+        if (Evict(btr, p.first, p.second))
+          n++;
+      if (!c.more_)
+        break;
+      // the smallest key after the last one visited
+      start = c.last_;
+      start.push_back('\0');
+    }
+    return n;
+  }
+
+  void
+  DoFault(const fault &f)
+  {
+    const cold_ref &r = f.r_;
+    const bool compressed = r.off_ & cold_store::CompressedBit;
+    string rec;
+    if (compressed) {
+      rec.assign(f.key_);
+      rec.resize(r.klen_ + r.len_);
+    } else {
+      rec.resize(r.klen_ + r.len_);
+      ReadFully(&rec[0], rec.size(), r.off_);
+    }
+    const string key(rec, 0, r.klen_);
+
+    std::lock_guard<mutex> l(g_trees_lock);
+    if (!g_trees.count(r.btr_))
+      return;
+    scoped_rcu_region guard;
+    concurrent_btree::value_type v = 0;
+    if (!r.btr_->search(varkey(key), v))
+      return;
+    dbtuple * const stub = reinterpret_cast<dbtuple *>(v);
+    const dbtuple::version_t lv = stub->lock(false);
+    // stubs are only ever replaced, never written, so if this is still the
+    // latest stub for the offset it is the one which was faulted
+    if (!dbtuple::IsLatest(lv) || !dbtuple::IsCold(lv) ||
+        RefOf(stub).off_ != r.off_) {
+      stub->unlock();
+      return;
+    }
+    if (compressed && r.len_)
+      Decompress(stub, r, &rec[r.klen_]);
+    dbtuple * const warm = dbtuple::alloc_replacement(
+        stub->version, (const uint8_t *) rec.data() + r.klen_, r.len_, false);
+    Replace(r.btr_, key, stub, warm);
+    stub->unlock();
+    ++evt_cold_faults;
+  }
+
+  void
+  FaultLoop()
+  {
+    for (;;) {
+      vector<fault> faults;
+      {
+        unique_lock<mutex> l(g_fault_lock);
+        g_fault_cv.wait(l, []() { return !g_faults.empty(); });
+        faults.swap(g_faults);
+      }
+      for (auto &f : faults)
+        DoFault(f);
+      {
+        std::lock_guard<mutex> l(g_fault_lock);
+        for (auto &f : faults)
+          g_faulting.erase(f.r_.off_);
+      }
+      g_fault_done_cv.notify_all();
+    }
+  }
+
+  void
+  SweepLoop(uint64_t sweep_interval_us)
+  {
+    for (;;) {
+      this_thread::sleep_for(chrono::microseconds(sweep_interval_us));
+      cold_store::Sweep();
+    }
+  }
+}
+
+void
+cold_store::Init(const string &path,
+                 uint64_t sweep_interval_us,
+                 size_t min_value_size,
+                 bool compressed)
+{
+  ALWAYS_ASSERT(!g_enabled);
+  ALWAYS_ASSERT(compressed || !path.empty());
+  if (!path.empty()) {
+    g_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (g_fd < 0) {
+      perror("open");
+      ALWAYS_ASSERT(false);
+    }
+  }
+  g_compressed.store(compressed, memory_order_release);
+  g_min_value_size = min_value_size;
+  g_enabled = true;
+  thread(FaultLoop).detach();
+  if (sweep_interval_us)
+    thread(SweepLoop, sweep_interval_us).detach();
+}
+
+void
+cold_store::SetCompressed(bool compressed)
+{
+  ALWAYS_ASSERT(compressed || g_fd >= 0);
+  g_compressed.store(compressed, memory_order_release);
+}
+
+void
+cold_store::RegisterTree(concurrent_btree *btr)
+{
+  std::lock_guard<mutex> l(g_trees_lock);
+  g_trees.insert(btr);
+}
+
+void
+cold_store::UnregisterTree(concurrent_btree *btr)
+{
+  std::lock_guard<mutex> l(g_trees_lock);
+  g_trees.erase(btr);
+}
+
+size_t
+cold_store::Sweep()
+{
+  vector<concurrent_btree *> trees;
+  {
+    std::lock_guard<mutex> l(g_trees_lock);
+    trees.assign(g_trees.begin(), g_trees.end());
+  }
+  size_t n = 0;
+  for (auto btr : trees)
+    n += SweepTree(btr);
+  return n;
+}
+
+void
+cold_store::Fault(const dbtuple *tuple)
+{
+  fault f;
+  f.r_ = RefOf(tuple);
+  if (f.r_.off_ & CompressedBit)
+    f.key_.assign((const char *) tuple->get_value_start() + sizeof(cold_ref),
+                  f.r_.klen_);
+  {
+    std::lock_guard<mutex> l(g_fault_lock);
+    if (!g_faulting.insert(f.r_.off_).second)
+      return; // already on its way in
+    g_faults.push_back(move(f));
+  }
+  g_fault_cv.notify_one();
+}
+
+void
+cold_store::WaitForFaults()
+{
+  unique_lock<mutex> l(g_fault_lock);
+  g_fault_done_cv.wait(l, []() { return g_faulting.empty(); });
+}
+
+void
+cold_store::ReadValue(const dbtuple *tuple, string &v)
+{
+  const cold_ref r = RefOf(tuple);
+  v.resize(r.len_);
+  if (r.off_ & CompressedBit) {
+    if (r.len_)
+      Decompress(tuple, r, &v[0]);
+    return;
+  }
+  if (r.len_)
+    ReadFully(&v[0], r.len_, r.off_ + r.klen_);
+  ++evt_cold_sync_reads;
+}
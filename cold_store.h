@@ -0,0 +1,127 @@
+#ifndef _NDB_COLD_STORE_H_
+#define _NDB_COLD_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "btree_choice.h"
+#include "macros.h"
+#include "tuple.h"
+
+/**
+ * An anti-caching cold tier: the values of tuples nobody reads are moved out
+ * of memory into an append-only file (ideally on an SSD), and faulted back in
+ * when they are needed again.
+ *
+ * Each tuple has a clock bit (dbtuple::referenced), which every read sets. A
+ * background sweeper walks the registered tables every sweep interval,
+ * clearing the bit of each tuple it passes, and evicting those whose bit was
+ * still clear, ie which nobody read since its last pass. Only latest tuples
+ * with no older versions are evicted. The value (with its key) is appended to
+ * the file, and the tuple is replaced in its table by a cold stub: a tuple at
+ * the same version whose record is a cold_ref to where the value went.
+ *
+ * A txn which reads a cold stub (or tries to write one) does not wait for the
+ * disk: the stub is queued to be faulted in, and the txn aborts with
+ * ABORT_REASON_COLD_READ, to be retried once the fault thread has put the
+ * value back in memory (as a new tuple at the same version). Snapshot txns,
+ * which never validate, read the value from the file synchronously instead.
+ *
+ * Space in the file is never reclaimed, and the file is not needed for
+ * recovery (the log has every value it holds), so it is truncated on
+ * Init()
+ *
+ * Values can instead be kept in memory, lz4 compressed, in the stub itself
+ * (see SetCompressed()). Nobody waits for those: any txn reading a compressed
+ * stub decompresses the value into its arena, and only a write (or a second
+ * read between two sweeps, which makes the value warm again) faults it in.
+ * Values which do not compress well go to the file if there is one, and stay
+ * as they are otherwise
+ */
+class cold_store {
+public:
+
+  // the record of a cold stub. a compressed stub's record goes on with the
+  // key, then the compressed value
+  struct cold_ref {
+    concurrent_btree *btr_;
+    uint64_t off_;  // of the key in the file, followed by the value (for a
+                    // compressed stub, CompressedBit | a sequence number)
+    uint32_t len_;  // of the (uncompressed) value
+    uint32_t klen_;
+  } PACKED;
+
+  static const uint64_t CompressedBit = uint64_t(1) << 63;
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_enabled;
+  }
+
+  // should be called before any tables are opened. tuples whose values are
+  // smaller than min_value_size are never evicted. a sweep_interval_us of 0
+  // starts no sweeper (Sweep() can be called by hand). with compressed set,
+  // the path can be empty, for no file at all
+  static void Init(const std::string &path,
+                   uint64_t sweep_interval_us,
+                   size_t min_value_size = 0,
+                   bool compressed = false);
+
+  // whether evictions from now on compress values in memory instead of
+  // writing them out. stubs already made stay as they are
+  static void SetCompressed(bool compressed);
+
+  static inline bool
+  IsCompressed(const dbtuple *tuple)
+  {
+    uint64_t off;
+    memcpy(&off, tuple->get_value_start() + offsetof(cold_ref, off_),
+           sizeof(off));
+    return off & CompressedBit;
+  }
+
+  // tables are registered for their lifetime (see base_txn_btree)
+  static void RegisterTree(concurrent_btree *btr);
+  static void UnregisterTree(concurrent_btree *btr);
+
+  // one pass of the sweeper over every registered table. returns the number
+  // of tuples evicted
+  static size_t Sweep();
+
+  // queues the cold stub tuple to be faulted in
+  static void Fault(const dbtuple *tuple);
+
+  // blocks until every fault queued so far is done
+  static void WaitForFaults();
+
+  // reads the value of the cold stub tuple from the file (or decompresses
+  // it)
+  static void ReadValue(const dbtuple *tuple, std::string &v);
+
+  // reads the value into a string from sa
+  template <typename Reader, typename StringAllocator>
+  static inline bool
+  Read(const dbtuple *tuple, Reader &reader, StringAllocator &sa)
+  {
+    std::string * const v = sa();
+    ReadValue(tuple, *v);
+    if (IsCompressed(tuple)) {
+      // the sweeper clears the bit of compressed stubs, so a stub read twice
+      // between its passes is warm again
+      if (tuple->is_referenced())
+        Fault(tuple);
+      else
+        tuple->mark_referenced();
+    }
+    return reader((const uint8_t *) v->data(), v->size(), sa);
+  }
+
+private:
+  static bool g_enabled;
+};
+
+#endif /* _NDB_COLD_STORE_H_ */
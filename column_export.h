@@ -0,0 +1,191 @@
+#ifndef _NDB_COLUMN_EXPORT_H_
+#define _NDB_COLUMN_EXPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fileutils.h"
+#include "macros.h"
+#include "typed_txn_btree.h"
+
+/**
+ * Exports the records of a typed_txn_btree column by column, as of the
+ * snapshot of a read-only txn, for analytics engines to load without going
+ * through the record encoding. The stream is
+ *
+ *   [Magic (8)][ncolumns (4)]
+ *   per column: [name len (4)][name][type len (4)][type][width (4)]
+ *   row groups of at most RowGroupNRows rows, in key order:
+ *     [nrows (4)], then per column [nrows * width bytes] of values
+ *   terminated by a zero nrows
+ *
+ * all in host byte order. Column 0 is the key, as the schema's key struct
+ * (type "key"). The others are the value's fields, with the names and types
+ * the schema declares them with, each value being the bytes of the field in
+ * the schema's value struct (for inline_str_8/16, its length and then its
+ * whole buffer).
+ *
+ * The range is scanned in nthreads subranges at the same time (see
+ * typed_txn_btree::search_range_call_parallel()). Records are decoded whole,
+ * which for fixed layout schemas is a copy, and appended to the columns of
+ * their subrange's current row group. Full row groups are staged in one
+ * temporary file per subrange, and the files are copied out to fd in key
+ * order once the scan is done.
+ *
+ * The scan reads old versions for as long as it takes, so a big export
+ * should pin its snapshot (see transaction_proto2_static::PinSnapshot())
+ */
+class column_exporter {
+public:
+
+  static const uint64_t Magic = 0x31636f6c6f6c6973ULL; // "silocol1"
+  static const uint32_t RowGroupNRows = 1 << 16;
+
+  // exports the records in [lower, upper) (upper null for no bound). returns
+  // false if fd or a temporary file could not be written to. the txn's
+  // aborts are thrown as usual
+  template <template <typename> class Transaction,
+            typename Schema, typename Traits>
+  static bool
+  Export(Transaction<Traits> &t, typed_txn_btree<Transaction, Schema> &btr,
+         const typename Schema::key_type &lower,
+         const typename Schema::key_type *upper,
+         int fd, size_t nthreads);
+
+private:
+
+  struct file_closer {
+    void operator()(FILE *f) const { fclose(f); }
+  };
+
+  typedef std::unique_ptr<FILE, file_closer> file_ptr;
+
+  // appends the records of one subrange to its row groups
+  template <template <typename> class Transaction, typename Schema>
+  class row_group_writer :
+    public typed_txn_btree<Transaction, Schema>::search_range_callback {
+  public:
+    typedef typename Schema::key_type key_type;
+    typedef typename Schema::value_type value_type;
+    typedef typename Schema::base_type::value_descriptor value_descriptor;
+
+    row_group_writer()
+      : file_(tmpfile()), failed_(!file_), nrows_(0),
+        columns_(value_descriptor::nfields() + 1)
+    {
+      for (auto &c : columns_)
+        c.reserve(4096);
+    }
+
+    virtual bool
+    invoke(const key_type &k, const value_type &v)
+    {
+      columns_[0].append((const char *) &k, sizeof(k));
+      const char * const p = (const char *) &v;
+      for (size_t i = 0; i < value_descriptor::nfields(); i++)
+        columns_[i + 1].append(p + value_descriptor::cstruct_offsetof(i),
+                               value_descriptor::cstruct_sizeof(i));
+      if (++nrows_ == RowGroupNRows)
+        return flush();
+      return true;
+    }
+
+    // writes out the partial row group left. false if any write failed
+    bool
+    flush()
+    {
+      if (failed_ || !nrows_)
+        return !failed_;
+      failed_ = fwrite(&nrows_, sizeof(nrows_), 1, file_.get()) != 1;
+      for (auto &c : columns_) {
+        if (!failed_ && !c.empty())
+          failed_ = fwrite(c.data(), c.size(), 1, file_.get()) != 1;
+        c.clear();
+      }
+      nrows_ = 0;
+      return !failed_;
+    }
+
+    // copies the row groups written so far to fd
+    bool
+    copy_to(int fd)
+    {
+      if (!flush() || fseek(file_.get(), 0, SEEK_SET))
+        return false;
+      char buf[1 << 16];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), file_.get())))
+        if (fileutils::writeall(fd, buf, n))
+          return false;
+      return !ferror(file_.get());
+    }
+
+  private:
+    file_ptr file_;
+    bool failed_;
+    uint32_t nrows_;
+    std::vector<std::string> columns_;
+  };
+
+  static inline void
+  AppendU32(std::string &s, uint32_t v)
+  {
+    s.append((const char *) &v, sizeof(v));
+  }
+
+  static inline void
+  AppendString(std::string &s, const char *p)
+  {
+    AppendU32(s, strlen(p));
+    s.append(p);
+  }
+};
+
+template <template <typename> class Transaction,
+          typename Schema, typename Traits>
+bool
+column_exporter::Export(
+    Transaction<Traits> &t, typed_txn_btree<Transaction, Schema> &btr,
+    const typename Schema::key_type &lower,
+    const typename Schema::key_type *upper,
+    int fd, size_t nthreads)
+{
+  typedef row_group_writer<Transaction, Schema> writer_type;
+  typedef typename writer_type::value_descriptor value_descriptor;
+  INVARIANT(nthreads);
+
+  const uint64_t magic = Magic;
+  std::string header;
+  header.append((const char *) &magic, sizeof(magic));
+  AppendU32(header, value_descriptor::nfields() + 1);
+  AppendString(header, "key");
+  AppendString(header, "key");
+  AppendU32(header, sizeof(typename writer_type::key_type));
+  for (size_t i = 0; i < value_descriptor::nfields(); i++) {
+    AppendString(header, value_descriptor::field_name(i));
+    AppendString(header, value_descriptor::type_name(i));
+    AppendU32(header, value_descriptor::cstruct_sizeof(i));
+  }
+  if (fileutils::writeall(fd, header.data(), header.size()))
+    return false;
+
+  std::vector<std::unique_ptr<writer_type>> writers;
+  std::vector<typename typed_txn_btree<Transaction, Schema>::search_range_callback *> callbacks;
+  for (size_t i = 0; i < nthreads; i++) {
+    writers.emplace_back(new writer_type);
+    callbacks.push_back(writers.back().get());
+  }
+  btr.search_range_call_parallel(t, lower, upper, callbacks);
+  for (auto &w : writers)
+    if (!w->copy_to(fd))
+      return false;
+  const uint32_t end = 0;
+  return !fileutils::writeall(fd, (const char *) &end, sizeof(end));
+}
+
+#endif /* _NDB_COLUMN_EXPORT_H_ */
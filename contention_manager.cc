@@ -0,0 +1,177 @@
+#include "contention_manager.h"
+#include "counter.h"
+#include "amd64.h"
+
+using namespace std;
+using namespace util;
+
+atomic<bool> contention_manager::g_enabled(false);
+atomic<bool> contention_manager::g_hot_locking_enabled(false);
+percore<contention_manager::core_state> contention_manager::g_states;
+aligned_padded_elem<spinlock>
+  contention_manager::g_hot_locks[contention_manager::NHotLocks];
+contention_manager::hot_record
+  contention_manager::g_hot_records[contention_manager::NHotRecords];
+
+static event_counter evt_cm_immediate_retries("cm_immediate_retries");
+static event_counter evt_cm_backoff_retries("cm_backoff_retries");
+static event_counter evt_cm_serialized_retries("cm_serialized_retries");
+static event_avg_counter evt_avg_cm_backoff_spins("avg_cm_backoff_spins");
+static event_counter evt_cm_hot_records("cm_hot_records");
+static event_counter evt_cm_hot_locks("cm_hot_locks");
+static event_counter evt_cm_hot_locks_contended("cm_hot_locks_contended");
+static event_counter evt_cm_hot_locks_failed("cm_hot_locks_failed");
+
+contention_manager::policy
+contention_manager::PolicyFor(transaction_base::abort_reason reason)
+{
+  switch (reason) {
+  case transaction_base::ABORT_REASON_NONE:
+  case transaction_base::ABORT_REASON_USER:
+  case transaction_base::ABORT_REASON_UNSTABLE_READ:
+  case transaction_base::ABORT_REASON_FUTURE_TID_READ:
+    return POLICY_IMMEDIATE;
+  case transaction_base::ABORT_REASON_NODE_SCAN_WRITE_VERSION_CHANGED:
+  case transaction_base::ABORT_REASON_NODE_SCAN_READ_VERSION_CHANGED:
+  case transaction_base::ABORT_REASON_INSERT_NODE_INTERFERENCE:
+  case transaction_base::ABORT_REASON_READ_ABSENCE_INTEREFERENCE:
+  case transaction_base::ABORT_REASON_COLD_READ: // give the fault time
+    return POLICY_BACKOFF;
+  case transaction_base::ABORT_REASON_WRITE_NODE_INTERFERENCE:
+  case transaction_base::ABORT_REASON_READ_NODE_INTEREFERENCE:
+    return POLICY_SERIALIZE;
+  }
+  ALWAYS_ASSERT(false);
+  return POLICY_IMMEDIATE;
+}
+
+void
+contention_manager::release(core_state &s)
+{
+  if (s.held_ == -1)
+    return;
+  g_hot_locks[s.held_]->unlock();
+  s.held_ = -1;
+}
+
+void
+contention_manager::OnAbort(
+    transaction_base::abort_reason reason, const dbtuple *conflict)
+{
+  core_state &s = g_states.my();
+  release(s);
+  s.last_reason_ = reason;
+  s.last_conflict_ = conflict;
+  if (s.backoff_shift_ < MaxBackoffShift)
+    s.backoff_shift_++;
+  if (conflict && IsHotLockingEnabled())
+    record_conflict(conflict);
+}
+
+void
+contention_manager::OnCommit()
+{
+  core_state &s = g_states.my();
+  release(s);
+  s.last_reason_ = transaction_base::ABORT_REASON_NONE;
+  s.last_conflict_ = nullptr;
+  s.backoff_shift_ >>= 1;
+}
+
+void
+contention_manager::BeforeRetry()
+{
+  core_state &s = g_states.my();
+  INVARIANT(s.held_ == -1);
+  policy p = PolicyFor(s.last_reason_);
+  if (p == POLICY_SERIALIZE && !s.last_conflict_)
+    p = POLICY_BACKOFF;
+  switch (p) {
+  case POLICY_IMMEDIATE:
+    ++evt_cm_immediate_retries;
+    break;
+  case POLICY_BACKOFF:
+    {
+      ++evt_cm_backoff_retries;
+      if (unlikely(!s.seed_))
+        s.seed_ = coreid::core_id() + 1;
+      // xorshift64, so cores which aborted together don't retry together
+      s.seed_ ^= s.seed_ << 13;
+      s.seed_ ^= s.seed_ >> 7;
+      s.seed_ ^= s.seed_ << 17;
+      uint64_t spins =
+        (s.seed_ & ((1UL << s.backoff_shift_) - 1)) * BackoffUnitSpins;
+      evt_avg_cm_backoff_spins.offer(spins);
+      while (spins) {
+        nop_pause();
+        spins--;
+      }
+    }
+    break;
+  case POLICY_SERIALIZE:
+    {
+      ++evt_cm_serialized_retries;
+      const size_t slot =
+        (uintptr_t(s.last_conflict_) >> LG_CACHELINE_SIZE) & (NHotLocks - 1);
+      g_hot_locks[slot]->lock();
+      s.held_ = slot;
+    }
+    break;
+  }
+}
+
+void
+contention_manager::record_conflict(const dbtuple *conflict)
+{
+  // the updates race with other cores, which is fine: the table only has to
+  // be roughly right. a slot is taken over by a new record once the conflicts
+  // on other records have worn its score down
+  hot_record &r = hot_record_for(conflict);
+  const uint32_t score = r.score_.load(memory_order_relaxed);
+  if (r.tuple_.load(memory_order_relaxed) == conflict) {
+    if (score < MaxHotScore) {
+      r.score_.store(score + 1, memory_order_relaxed);
+      if (score + 1 == HotThreshold)
+        ++evt_cm_hot_records;
+    }
+  } else if (score <= 1) {
+    r.tuple_.store(conflict, memory_order_relaxed);
+    r.score_.store(1, memory_order_relaxed);
+  } else {
+    r.score_.store(score - 1, memory_order_relaxed);
+  }
+}
+
+bool
+contention_manager::IsHot(const dbtuple *tuple)
+{
+  const hot_record &r = hot_record_for(tuple);
+  return r.tuple_.load(memory_order_relaxed) == tuple &&
+         r.score_.load(memory_order_relaxed) >= HotThreshold;
+}
+
+bool
+contention_manager::LockIfHot(dbtuple *tuple)
+{
+  if (likely(!IsHot(tuple)))
+    return false;
+  hot_record &r = hot_record_for(tuple);
+  const uint32_t score = r.score_.load(memory_order_relaxed);
+  dbtuple::version_t v;
+  if (tuple->try_lock(false, 0, v)) {
+    // nobody else wanted it: let the record cool off
+    ++evt_cm_hot_locks;
+    if (score)
+      r.score_.store(score - 1, memory_order_relaxed);
+    return true;
+  }
+  if (tuple->try_lock(false, HotLockSpins, v)) {
+    ++evt_cm_hot_locks;
+    ++evt_cm_hot_locks_contended;
+    if (score < MaxHotScore)
+      r.score_.store(score + 1, memory_order_relaxed);
+    return true;
+  }
+  ++evt_cm_hot_locks_failed;
+  return false;
+}
@@ -0,0 +1,142 @@
+#ifndef _NDB_CONTENTION_MANAGER_H_
+#define _NDB_CONTENTION_MANAGER_H_
+
+#include <atomic>
+
+#include "macros.h"
+#include "core.h"
+#include "spinlock.h"
+#include "txn.h"
+
+/**
+ * Decides how a core retries its aborted txns, based on why they aborted:
+ *
+ *   POLICY_IMMEDIATE  the conflict is short lived (a read raced with a
+ *                     writer installing its value), so retry right away
+ *   POLICY_BACKOFF    the conflict is structural (a scanned or inserted into
+ *                     btree node changed), so back off exponentially, with
+ *                     jitter
+ *   POLICY_SERIALIZE  a record the txn read or wrote was changed under it.
+ *                     the retry holds a lock (hashed by the record) until it
+ *                     commits or aborts, so retries on the same hot record
+ *                     queue up behind each other instead of aborting each
+ *                     other over and over
+ *
+ * Txns report their outcome with OnCommit() and OnAbort() (which
+ * transaction<> does when the manager is active). Whoever drives the retry
+ * loop calls BeforeRetry() before re-running an aborted txn.
+ *
+ * Independently, with hot record locking enabled, the manager keeps a small
+ * (lossy) table of the records which abort txns the most. A txn which reads
+ * a hot record locks it right away (see LockIfHot()) and holds the lock until
+ * it commits or aborts, so other txns cannot change the record under it, and
+ * its read of that record never fails validation. The lock is taken without
+ * write intent, so it does not block readers (or their validation), only
+ * other lockers.
+ */
+class contention_manager {
+public:
+
+  enum policy {
+    POLICY_IMMEDIATE,
+    POLICY_BACKOFF,
+    POLICY_SERIALIZE,
+  };
+
+  static const unsigned MaxBackoffShift = 16;
+  static const uint64_t BackoffUnitSpins = 100;
+  static const size_t NHotLocks = 1024; // must be a power of two
+
+  static const size_t NHotRecords = 4096; // must be a power of two
+  static const uint32_t HotThreshold = 4; // conflicts before a record is hot
+  static const uint32_t MaxHotScore = 16;
+  static const unsigned HotLockSpins = 64;
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_enabled.load(std::memory_order_relaxed);
+  }
+
+  // should be called before any txns run
+  static inline void
+  Enable(bool enabled = true)
+  {
+    g_enabled.store(enabled, std::memory_order_release);
+  }
+
+  static inline bool
+  IsHotLockingEnabled()
+  {
+    return g_hot_locking_enabled.load(std::memory_order_relaxed);
+  }
+
+  // should be called before any txns run
+  static inline void
+  EnableHotLocking(bool enabled = true)
+  {
+    g_hot_locking_enabled.store(enabled, std::memory_order_release);
+  }
+
+  // whether txns need to report their outcome
+  static inline bool
+  IsActive()
+  {
+    return IsEnabled() || IsHotLockingEnabled();
+  }
+
+  static policy PolicyFor(transaction_base::abort_reason reason);
+
+  // conflict is the record which caused the abort, if known
+  static void OnAbort(transaction_base::abort_reason reason,
+                      const dbtuple *conflict);
+  static void OnCommit();
+
+  // blocks according to the policy for the calling core's last abort
+  static void BeforeRetry();
+
+  static bool IsHot(const dbtuple *tuple);
+
+  // if tuple is hot, tries (for a bounded time, so lock holders never wait
+  // on each other forever) to lock it without write intent. returns true if
+  // the caller now holds the lock
+  static bool LockIfHot(dbtuple *tuple);
+
+private:
+
+  struct core_state {
+    transaction_base::abort_reason last_reason_;
+    const dbtuple *last_conflict_;
+    unsigned backoff_shift_;
+    int held_; // hot lock held by the current retry, -1 if none
+    uint64_t seed_;
+    core_state()
+      : last_reason_(transaction_base::ABORT_REASON_NONE),
+        last_conflict_(nullptr), backoff_shift_(0), held_(-1), seed_(0) {}
+  };
+
+  struct hot_record {
+    std::atomic<const dbtuple *> tuple_;
+    std::atomic<uint32_t> score_;
+    hot_record() : tuple_(nullptr), score_(0) {}
+  };
+
+  static void release(core_state &s);
+
+  static inline hot_record &
+  hot_record_for(const dbtuple *tuple)
+  {
+    return g_hot_records[
+      (uintptr_t(tuple) >> LG_CACHELINE_SIZE) & (NHotRecords - 1)];
+  }
+
+  static void record_conflict(const dbtuple *conflict);
+
+  static std::atomic<bool> g_enabled;
+  static std::atomic<bool> g_hot_locking_enabled;
+  static percore<core_state> g_states;
+  static util::aligned_padded_elem<spinlock> g_hot_locks[NHotLocks];
+  static hot_record g_hot_records[NHotRecords];
+};
+
+#endif /* _NDB_CONTENTION_MANAGER_H_ */
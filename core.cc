@@ -1,7 +1,11 @@
 #include <unistd.h>
+#include <pthread.h>
+#include <vector>
 
 #include "amd64.h"
 #include "core.h"
+#include "lockguard.h"
+#include "spinlock.h"
 #include "util.h"
 
 using namespace std;
@@ -23,6 +27,86 @@ retry:
   return rounded;
 }
 
+static const size_t NMaxReleaseHooks = 8;
+static coreid::release_hook_t g_release_hooks[NMaxReleaseHooks];
+static size_t g_nrelease_hooks = 0;
+
+// ids released by exited threads
+static spinlock g_free_ids_lock;
+static vector<unsigned> *g_free_ids = nullptr;
+
+static pthread_key_t g_exit_key;
+static pthread_once_t g_exit_key_once = PTHREAD_ONCE_INIT;
+
+static void
+OnThreadExit(void *)
+{
+  coreid::release_core_id();
+}
+
+static void
+CreateExitKey()
+{
+  ALWAYS_ASSERT(!pthread_key_create(&g_exit_key, OnThreadExit));
+}
+
+unsigned
+coreid::allocate_core_id()
+{
+  unsigned id;
+  bool reused = false;
+  {
+    ::lock_guard<spinlock> l(g_free_ids_lock);
+    if (g_free_ids && !g_free_ids->empty()) {
+      id = g_free_ids->back();
+      g_free_ids->pop_back();
+      reused = true;
+    }
+  }
+  if (!reused) {
+    id = g_core_count.fetch_add(1, memory_order_acq_rel);
+    // did we exceed max cores?
+    ALWAYS_ASSERT(id < NMaxCores);
+  }
+  // a non-null value, so the key's destructor runs at thread exit
+  ALWAYS_ASSERT(!pthread_once(&g_exit_key_once, CreateExitKey));
+  ALWAYS_ASSERT(!pthread_setspecific(g_exit_key, (void *) 0x1));
+  return id;
+}
+
+void
+coreid::add_release_hook(release_hook_t fn)
+{
+  ALWAYS_ASSERT(g_nrelease_hooks < NMaxReleaseHooks);
+  g_release_hooks[g_nrelease_hooks++] = fn;
+}
+
+void
+coreid::release_core_id()
+{
+  if (tl_core_id == -1)
+    return;
+  const unsigned id = tl_core_id;
+  for (size_t i = 0; i < g_nrelease_hooks; i++)
+    g_release_hooks[i](id);
+  // hooks may have used core_id(), which must not have allocated
+  INVARIANT(tl_core_id == int(id));
+  tl_core_id = -1;
+  if (pthread_getspecific(g_exit_key))
+    ALWAYS_ASSERT(!pthread_setspecific(g_exit_key, nullptr));
+  ::lock_guard<spinlock> l(g_free_ids_lock);
+  if (!g_free_ids)
+    g_free_ids = new vector<unsigned>;
+  g_free_ids->push_back(id);
+}
+
+unsigned
+coreid::nfree_core_ids()
+{
+  ::lock_guard<spinlock> l(g_free_ids_lock);
+  return g_free_ids ? g_free_ids->size() : 0;
+}
+
 unsigned
 coreid::num_cpus_online()
 {
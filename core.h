@@ -6,8 +6,14 @@
 #include "util.h"
 
 /**
- * XXX: CoreIDs are not recyclable for now, so NMAXCORES is really the number
- * of threads which can ever be spawned in the system
+ * Core ids handed out by core_id() are released when their thread exits,
+ * and handed out again to new threads, so NMAXCORES bounds the number of
+ * threads alive at once rather than the number ever spawned. A released id
+ * keeps its per-core state (percore<> elements are never destroyed), which
+ * the release hooks leave ready for the next thread to use it.
+ *
+ * Ids assigned with set_core_id() belong to whoever allocated the block
+ * they came from, and are never released.
  */
 class coreid {
 public:
@@ -16,15 +22,24 @@ public:
   static inline unsigned
   core_id()
   {
-    if (unlikely(tl_core_id == -1)) {
+    if (unlikely(tl_core_id == -1))
       // initialize per-core data structures
-      tl_core_id = g_core_count.fetch_add(1, std::memory_order_acq_rel);
-      // did we exceed max cores?
-      ALWAYS_ASSERT(unsigned(tl_core_id) < NMaxCores);
-    }
+      tl_core_id = allocate_core_id();
     return tl_core_id;
   }
 
+  // run by a thread about to release its core id, with the id still
+  // assigned. hooks can only be added during static initialization
+  typedef void (*release_hook_t)(unsigned core_id);
+  static void add_release_hook(release_hook_t fn);
+
+  // releases the calling thread's core id now instead of at thread exit.
+  // the thread must not be using any per-core state
+  static void release_core_id();
+
+  // the number of core ids released for reuse and not yet reused
+  static unsigned nfree_core_ids();
+
   /**
    * Since our current allocation scheme does not allow for holes in the
    * allocation, this function is quite wasteful. Don't abuse.
@@ -56,10 +71,19 @@ public:
     tl_core_id = cid; // sigh
   }
 
+  // the number of core ids handed out so far, which bounds the ids in use
+  static inline unsigned
+  core_count()
+  {
+    return g_core_count.load(std::memory_order_acquire);
+  }
+
   // actual number of CPUs online for the system
   static unsigned num_cpus_online();
 
 private:
+  static unsigned allocate_core_id();
+
   // the core ID of this core: -1 if not set
   static __thread int tl_core_id;
 
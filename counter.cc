@@ -20,6 +20,25 @@ event_ctx::event_counters_lock()
   return s_lock;
 }
 
+atomic<event_ctx *> &
+event_ctx::event_counters_list()
+{
+  static atomic<event_ctx *> s_head(nullptr);
+  return s_head;
+}
+
+#ifdef ENABLE_EVENT_COUNTERS
+static void
+LinkCounter(event_ctx *ctx)
+{
+  atomic<event_ctx *> &head = event_ctx::event_counters_list();
+  ctx->next_ = head.load(memory_order_relaxed);
+  while (!head.compare_exchange_weak(
+        ctx->next_, ctx, memory_order_release, memory_order_relaxed))
+    ;
+}
+#endif
+
 void
 event_ctx::stat(counter_data &d)
 {
@@ -90,14 +109,29 @@ event_counter::stat(const string &name, counter_data &d)
   return true;
 }
 
+void
+event_counter::for_each_counter(
+    const function<void(const string &, const counter_data &)> &fn)
+{
+  for (event_ctx *p = event_ctx::event_counters_list().load(memory_order_acquire);
+       p; p = p->next_) {
+    counter_data d;
+    p->stat(d);
+    fn(p->name_, d);
+  }
+}
+
 #ifdef ENABLE_EVENT_COUNTERS
 event_counter::event_counter(const string &name)
   : ctx_(name, false)
 {
   spinlock &l = event_ctx::event_counters_lock();
   map<string, event_ctx *> &evts = event_ctx::event_counters();
-  lock_guard<spinlock> sl(l);
-  evts[name] = ctx_.obj();
+  {
+    lock_guard<spinlock> sl(l);
+    evts[name] = ctx_.obj();
+  }
+  LinkCounter(ctx_.obj());
 }
 
 event_avg_counter::event_avg_counter(const string &name)
@@ -105,8 +139,11 @@ event_avg_counter::event_avg_counter(const string &name)
 {
   spinlock &l = event_ctx::event_counters_lock();
   map<string, event_ctx *> &evts = event_ctx::event_counters();
-  lock_guard<spinlock> sl(l);
-  evts[name] = ctx_.obj();
+  {
+    lock_guard<spinlock> sl(l);
+    evts[name] = ctx_.obj();
+  }
+  LinkCounter(ctx_.obj());
 }
 #else
 event_counter::event_counter(const string &name)
@@ -117,3 +154,162 @@ event_avg_counter::event_avg_counter(const string &name)
 {
 }
 #endif
+
+map<string, gauge_ctx *> &
+gauge_ctx::gauges()
+{
+  static map<string, gauge_ctx *> s_gauges;
+  return s_gauges;
+}
+
+spinlock &
+gauge_ctx::gauges_lock()
+{
+  static spinlock s_lock;
+  return s_lock;
+}
+
+#ifdef ENABLE_EVENT_COUNTERS
+event_gauge::event_gauge(const string &name)
+  : ctx_(name)
+{
+  for (size_t i = 0; i < coreid::NMaxCores; i++)
+    ctx_->values_[i] = 0;
+  lock_guard<spinlock> sl(gauge_ctx::gauges_lock());
+  gauge_ctx::gauges()[name] = ctx_.obj();
+}
+#else
+event_gauge::event_gauge(const string &name)
+{
+}
+#endif
+
+map<string, vector<uint64_t>>
+event_gauge::get_all_gauges()
+{
+  map<string, vector<uint64_t>> ret;
+  const size_t ncores = coreid::core_count();
+  lock_guard<spinlock> sl(gauge_ctx::gauges_lock());
+  for (auto &p : gauge_ctx::gauges()) {
+    vector<uint64_t> &v = ret[p.first];
+    for (size_t i = 0; i < ncores; i++)
+      v.push_back(p.second->values_[i]);
+  }
+  return ret;
+}
+
+bool
+event_gauge::stat(const string &name, counter_data &d)
+{
+  gauge_ctx *ctx = nullptr;
+  {
+    lock_guard<spinlock> sl(gauge_ctx::gauges_lock());
+    auto it = gauge_ctx::gauges().find(name);
+    if (it != gauge_ctx::gauges().end())
+      ctx = it->second;
+  }
+  if (!ctx)
+    return false;
+  const size_t ncores = coreid::core_count();
+  for (size_t i = 0; i < ncores; i++) {
+    d.count_ += ctx->values_[i];
+    d.max_ = max(d.max_, ctx->values_[i]);
+  }
+  return true;
+}
+
+event_histogram::event_histogram(const string &name)
+  : name_(name)
+{
+  for (auto &s : shards_)
+    s.store(nullptr, memory_order_relaxed);
+  spinlock &l = histograms_lock();
+  map<string, event_histogram *> &hists = histograms();
+  lock_guard<spinlock> sl(l);
+  hists[name] = this;
+}
+
+map<string, event_histogram *> &
+event_histogram::histograms()
+{
+  static map<string, event_histogram *> s_histograms;
+  return s_histograms;
+}
+
+spinlock &
+event_histogram::histograms_lock()
+{
+  static spinlock s_lock;
+  return s_lock;
+}
+
+event_histogram::shard *
+event_histogram::new_shard(unsigned core)
+{
+  shard *s = nullptr;
+  ALWAYS_ASSERT(!posix_memalign((void **) &s, CACHELINE_SIZE, sizeof(*s)));
+  NDB_MEMSET(s, 0, sizeof(*s));
+  // only core ever stores its shard, so there is nobody to race with
+  shards_[core].store(s, memory_order_release);
+  return s;
+}
+
+void
+event_histogram::stat(histogram_data &d) const
+{
+  for (auto &p : shards_) {
+    const shard * const s = p.load(memory_order_acquire);
+    if (!s)
+      continue;
+    d.count_ += s->count_;
+    d.sum_ += s->sum_;
+    d.max_ = max(d.max_, s->max_);
+    for (size_t b = 0; b < histogram_data::NBuckets; b++)
+      d.buckets_[b] += s->buckets_[b];
+  }
+}
+
+void
+event_histogram::reset()
+{
+  // like reset_all_counters(), races with concurrent offer()s
+  for (auto &p : shards_) {
+    shard * const s = p.load(memory_order_acquire);
+    if (s)
+      NDB_MEMSET(s, 0, sizeof(*s));
+  }
+}
+
+map<string, histogram_data>
+event_histogram::get_all_histograms()
+{
+  map<string, histogram_data> ret;
+  lock_guard<spinlock> sl(histograms_lock());
+  for (auto &p : histograms())
+    p.second->stat(ret[p.first]);
+  return ret;
+}
+
+void
+event_histogram::reset_all_histograms()
+{
+  lock_guard<spinlock> sl(histograms_lock());
+  for (auto &p : histograms())
+    p.second->reset();
+}
+
+bool
+event_histogram::stat(const string &name, histogram_data &d)
+{
+  event_histogram *h = nullptr;
+  {
+    lock_guard<spinlock> sl(histograms_lock());
+    auto it = histograms().find(name);
+    if (it != histograms().end())
+      h = it->second;
+  }
+  if (!h)
+    return false;
+  h->stat(d);
+  return true;
+}
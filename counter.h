@@ -4,11 +4,14 @@
 // system event counters, for
 
 #include <algorithm> // for std::max
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <map>
 #include <string>
 #include <stdint.h>
 
+#include "amd64.h"
 #include "macros.h"
 #include "core.h"
 #include "util.h"
@@ -51,9 +54,12 @@ namespace private_ {
     static std::map<std::string, event_ctx *> &event_counters();
     static spinlock &event_counters_lock();
 
+    // every ctx ever made, newest first, for readers which take no locks
+    static std::atomic<event_ctx *> &event_counters_list();
+
     // tag to avoid making event_ctx virtual
     event_ctx(const std::string &name, bool avg_tag)
-      : name_(name), avg_tag_(avg_tag)
+      : name_(name), avg_tag_(avg_tag), next_(nullptr)
     {}
 
     ~event_ctx()
@@ -69,6 +75,7 @@ namespace private_ {
 
     const std::string name_;
     const bool avg_tag_;
+    event_ctx *next_; // in event_counters_list(), set before it is linked in
 
     // per-thread counts
     percore<uint64_t, false, false> counts_;
@@ -80,6 +87,21 @@ namespace private_ {
     percore<uint64_t, false, false> sums_;
     percore<uint64_t, false, false> highs_;
   };
+
+  // never destructed either
+  struct gauge_ctx {
+    static std::map<std::string, gauge_ctx *> &gauges();
+    static spinlock &gauges_lock();
+
+    gauge_ctx(const std::string &name) : name_(name) {}
+
+    gauge_ctx(const gauge_ctx &) = delete;
+    gauge_ctx &operator=(const gauge_ctx &) = delete;
+    gauge_ctx(gauge_ctx &&) = delete;
+
+    const std::string name_;
+    percore<uint64_t, false, false> values_;
+  };
 }
 
 class event_counter {
@@ -120,6 +142,13 @@ public:
   static bool
   stat(const std::string &name, counter_data &d);
 
+  // calls fn(name, data) for every event_counter and event_avg_counter,
+  // reading their per-core data without taking any locks, so it never holds
+  // up a counter being made. a name made more than once comes up more than
+  // once. WARNING: an expensive operation!
+  static void for_each_counter(
+      const std::function<void(const std::string &, const counter_data &)> &fn);
+
 private:
 #ifdef ENABLE_EVENT_COUNTERS
   unmanaged<private_::event_ctx> ctx_;
@@ -150,6 +179,199 @@ private:
 #endif
 };
 
+// a value per core, as the core last set() it (ie the depth of a per-core
+// queue), read as is. compiled out without event counters, like them
+class event_gauge {
+public:
+  event_gauge(const std::string &name);
+
+  event_gauge(const event_gauge &) = delete;
+  event_gauge &operator=(const event_gauge &) = delete;
+  event_gauge(event_gauge &&) = delete;
+
+  inline ALWAYS_INLINE void
+  set(uint64_t value)
+  {
+#ifdef ENABLE_EVENT_COUNTERS
+    ctx_->values_.my() = value;
+#endif
+  }
+
+  // the values of every core id handed out so far, by core id.
+  // WARNING: an expensive operation!
+  static std::map<std::string, std::vector<uint64_t>> get_all_gauges();
+  // count_ is the sum of the cores' values, max_ the largest of them.
+  // WARNING: an expensive operation!
+  static bool
+  stat(const std::string &name, counter_data &d);
+
+private:
+#ifdef ENABLE_EVENT_COUNTERS
+  unmanaged<private_::gauge_ctx> ctx_;
+#endif
+};
+
+// log-linear buckets: values < NSubBuckets get a bucket each, after which
+// each power of two is split into NSubBuckets buckets, so values are off by
+// at most 1/NSubBuckets of their magnitude
+struct histogram_data {
+  static const size_t LgNSubBuckets = 3;
+  static const size_t NSubBuckets = (1 << LgNSubBuckets);
+  static const size_t NBuckets = (64 - LgNSubBuckets + 1) * NSubBuckets;
+
+  histogram_data() : count_(0), sum_(0), max_(0)
+  {
+    NDB_MEMSET(&buckets_[0], 0, sizeof(buckets_));
+  }
+
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+  uint64_t buckets_[NBuckets];
+
+  static inline size_t
+  BucketFor(uint64_t v)
+  {
+    if (v < NSubBuckets)
+      return v;
+    const size_t msb = 63 - __builtin_clzll(v);
+    const size_t sub = v >> (msb - LgNSubBuckets);
+    return (msb - LgNSubBuckets + 1) * NSubBuckets + (sub - NSubBuckets);
+  }
+
+  // largest value which falls into bucket b
+  static inline uint64_t
+  BucketMax(size_t b)
+  {
+    if (b < NSubBuckets)
+      return b;
+    const size_t e = b / NSubBuckets - 1;
+    const uint64_t sub = (b % NSubBuckets) + NSubBuckets;
+    return (sub << e) + ((uint64_t(1) << e) - 1);
+  }
+
+  // records n occurrences of value
+  inline void
+  offer(uint64_t value, uint64_t n = 1)
+  {
+    count_ += n;
+    sum_ += value * n;
+    max_ = std::max(max_, value);
+    buckets_[BucketFor(value)] += n;
+  }
+
+  // an upper bound on the p-th percentile (p in [0, 100]), 0 if empty
+  uint64_t
+  percentile(double p) const
+  {
+    if (!count_)
+      return 0;
+    uint64_t target = uint64_t(double(count_) * p / 100.0 + 0.5);
+    target = std::max(target, uint64_t(1));
+    uint64_t n = 0;
+    for (size_t b = 0; b < NBuckets; b++)
+      if ((n += buckets_[b]) >= target)
+        return std::min(BucketMax(b), max_);
+    return max_;
+  }
+
+  inline double
+  avg() const
+  {
+    return count_ ? double(sum_)/double(count_) : 0.0;
+  }
+
+  inline histogram_data &
+  operator+=(const histogram_data &that)
+  {
+    count_ += that.count_;
+    sum_   += that.sum_;
+    max_    = std::max(max_, that.max_);
+    for (size_t b = 0; b < NBuckets; b++)
+      buckets_[b] += that.buckets_[b];
+    return *this;
+  }
+};
+
+// a named histogram, which (like event counters) can be looked up by name.
+// like event counters, each core offers into its own shard (made the first
+// time the core offers anything), with plain increments, and readers merge
+// the shards. so offer() is cheap enough to time every txn with. unlike
+// event counters, histograms are always enabled
+class event_histogram {
+public:
+  event_histogram(const std::string &name);
+
+  event_histogram(const event_histogram &) = delete;
+  event_histogram &operator=(const event_histogram &) = delete;
+  event_histogram(event_histogram &&) = delete;
+
+  // records n occurrences of value
+  inline ALWAYS_INLINE void
+  offer(uint64_t value, uint64_t n = 1)
+  {
+    const unsigned core = coreid::core_id();
+    shard *s = shards_[core].load(std::memory_order_relaxed);
+    if (unlikely(!s))
+      s = new_shard(core);
+    s->count_ += n;
+    s->sum_ += value * n;
+    s->buckets_[histogram_data::BucketFor(value)] += n;
+    s->max_ = std::max(s->max_, value);
+  }
+
+  void stat(histogram_data &d) const;
+  void reset();
+
+  inline const std::string &
+  name() const
+  {
+    return name_;
+  }
+
+  // WARNING: an expensive operation!
+  static std::map<std::string, histogram_data> get_all_histograms();
+  // WARNING: an expensive operation!
+  static void reset_all_histograms();
+  // WARNING: an expensive operation!
+  static bool
+  stat(const std::string &name, histogram_data &d);
+
+private:
+  // only ever written by its core. (purposely) never freed, like the
+  // event counters' ctxs
+  struct shard {
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+    uint64_t buckets_[histogram_data::NBuckets];
+  } CACHE_ALIGNED;
+
+  shard *new_shard(unsigned core);
+
+  static std::map<std::string, event_histogram *> &histograms();
+  static spinlock &histograms_lock();
+
+  const std::string name_;
+  std::atomic<shard *> shards_[coreid::NMaxCores];
+};
+
+// offers the cycles (by rdtsc()) from its construction to its destruction
+// to a histogram
+class scoped_cycle_timer {
+public:
+  scoped_cycle_timer(event_histogram &h) : h_(&h), start_(rdtsc()) {}
+  ~scoped_cycle_timer() { h_->offer(rdtsc() - start_); }
+
+  scoped_cycle_timer(const scoped_cycle_timer &) = delete;
+  scoped_cycle_timer &operator=(const scoped_cycle_timer &) = delete;
+  scoped_cycle_timer(scoped_cycle_timer &&) = delete;
+
+private:
+  event_histogram *const h_;
+  const uint64_t start_;
+};
+
 inline std::ostream &
 operator<<(std::ostream &o, const counter_data &d)
 {
@@ -160,4 +382,15 @@ operator<<(std::ostream &o, const counter_data &d)
   return o;
 }
 
+inline std::ostream &
+operator<<(std::ostream &o, const histogram_data &d)
+{
+  o << "count=" << d.count_ << ", avg=" << d.avg()
+    << ", p50=" << d.percentile(50)
+    << ", p99=" << d.percentile(99)
+    << ", p99.9=" << d.percentile(99.9)
+    << ", max=" << d.max_;
+  return o;
+}
+
 #endif /* _COUNTER_H_ */
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.h"
+#include "macros.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+  const uint32_t Poly = 0x82f63b78; // reversed
+
+  struct crc_table {
+    uint32_t t_[256];
+    crc_table()
+    {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; j++)
+          c = (c & 1) ? (c >> 1) ^ Poly : (c >> 1);
+        t_[i] = c;
+      }
+    }
+  };
+
+  const crc_table g_table;
+
+  // crc is not inverted here, see crc32c::Extend()
+  uint32_t
+  extend_sw(uint32_t crc, const uint8_t *p, size_t n)
+  {
+    while (n--)
+      crc = g_table.t_[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+  }
+
+#if defined(__x86_64__)
+
+  __attribute__((target("sse4.2"))) uint32_t
+  extend_hw(uint32_t crc, const uint8_t *p, size_t n)
+  {
+    uint64_t c = crc;
+    for (; n && (uintptr_t(p) & 7); n--)
+      c = __builtin_ia32_crc32qi(c, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+      uint64_t w;
+      memcpy(&w, p, sizeof(w));
+      c = __builtin_ia32_crc32di(c, w);
+    }
+    for (; n; n--)
+      c = __builtin_ia32_crc32qi(c, *p++);
+    return c;
+  }
+
+  bool
+  has_hw()
+  {
+    unsigned a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+  }
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+  uint32_t
+  extend_hw(uint32_t crc, const uint8_t *p, size_t n)
+  {
+    for (; n && (uintptr_t(p) & 7); n--)
+      crc = __crc32cb(crc, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+      uint64_t w;
+      memcpy(&w, p, sizeof(w));
+      crc = __crc32cd(crc, w);
+    }
+    for (; n; n--)
+      crc = __crc32cb(crc, *p++);
+    return crc;
+  }
+
+  bool
+  has_hw()
+  {
+    return true;
+  }
+
+#else
+
+  uint32_t
+  extend_hw(uint32_t crc, const uint8_t *p, size_t n)
+  {
+    return extend_sw(crc, p, n);
+  }
+
+  bool
+  has_hw()
+  {
+    return false;
+  }
+
+#endif
+
+  typedef uint32_t (*extend_fn)(uint32_t, const uint8_t *, size_t);
+
+  const bool g_has_hw = has_hw();
+  const extend_fn g_extend = g_has_hw ? &extend_hw : &extend_sw;
+}
+
+uint32_t
+crc32c::Extend(uint32_t crc, const void *p, size_t n)
+{
+  return ~g_extend(~crc, (const uint8_t *) p, n);
+}
+
+bool
+crc32c::IsHardwareAccelerated()
+{
+  return g_has_hw;
+}
+
+void
+crc32c::Test()
+{
+  ALWAYS_ASSERT(Value("123456789", 9) == 0xe3069283);
+  ALWAYS_ASSERT(Value("", 0) == 0);
+
+  // both paths agree, at every alignment and length, and in pieces
+  fast_random r(9823);
+  uint8_t buf[256];
+  for (auto &b : buf)
+    b = r.next();
+  for (size_t off = 0; off < 8; off++)
+    for (size_t n = 0; n + off <= sizeof(buf); n++) {
+      const uint32_t c = Value(buf + off, n);
+      ALWAYS_ASSERT(c == ~extend_sw(~0U, buf + off, n));
+      ALWAYS_ASSERT(c == Extend(Value(buf + off, n / 3), buf + off + n / 3,
+                                n - n / 3));
+    }
+  cerr << "crc32c tests passed (hardware: " << g_has_hw << ")" << endl;
+}
@@ -0,0 +1,32 @@
+#ifndef _NDB_CRC32C_H_
+#define _NDB_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC32C (Castagnoli), as used by iSCSI and ext4. Computed with the SSE4.2
+ * crc32 instruction on x86-64 cpus which have it (checked once, at startup),
+ * or the ARMv8 CRC extension when built for it, and otherwise a table driven
+ * software fallback, which is an order of magnitude slower
+ */
+class crc32c {
+public:
+
+  // the crc of [p, p + n), continuing from crc (the crc of what came
+  // before, 0 for none)
+  static uint32_t Extend(uint32_t crc, const void *p, size_t n);
+
+  static inline uint32_t
+  Value(const void *p, size_t n)
+  {
+    return Extend(0, p, n);
+  }
+
+  // whether Extend() runs on the crc instructions
+  static bool IsHardwareAccelerated();
+
+  static void Test();
+};
+
+#endif /* _NDB_CRC32C_H_ */
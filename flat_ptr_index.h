@@ -0,0 +1,194 @@
+#ifndef _FLAT_PTR_INDEX_H_
+#define _FLAT_PTR_INDEX_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "macros.h"
+
+/**
+ * An open addressing hash index from pointers to the positions they occupy
+ * in an append-only sequence (a txn's write set), for sequences too long to
+ * scan.
+ *
+ * Slots are in groups of 16, each with a byte of control per slot: either
+ * Empty, or 7 bits of the hash of the slot's pointer. A lookup compares its
+ * tag against all 16 control bytes of a group at once (with SSE2 where we
+ * have it), and only looks at the slots whose tags match. Since nothing is
+ * ever removed, a group with an Empty byte ends the probe.
+ */
+class flat_ptr_index {
+public:
+
+  struct entry {
+    const void *key_;
+    uint32_t first_; // position of the first occurrence of key_
+    uint32_t last_;  // position of the latest occurrence of key_
+  };
+
+  flat_ptr_index()
+    : ctrl_(nullptr), slots_(nullptr), gmask_(0), size_(0), npositions_(0) {}
+
+  ~flat_ptr_index()
+  {
+    free(ctrl_);
+    free(slots_);
+  }
+
+  flat_ptr_index(const flat_ptr_index &) = delete;
+  flat_ptr_index(flat_ptr_index &&) = delete;
+  flat_ptr_index &operator=(const flat_ptr_index &) = delete;
+
+  // the number of positions added so far
+  inline size_t
+  npositions() const
+  {
+    return npositions_;
+  }
+
+  // adds position npositions() for p
+  inline void
+  append(const void *p)
+  {
+    INVARIANT(p);
+    if (unlikely(!ctrl_ || (size_ + 1) * 8 > ngroups() * GroupSize * 7))
+      grow();
+    const uint32_t pos = npositions_++;
+    const uint64_t h = Hash(p);
+    entry * const e = probe(p, h);
+    if (e) {
+      INVARIANT(e->last_ < pos);
+      e->last_ = pos;
+      return;
+    }
+    insert_new(p, h, pos, pos);
+  }
+
+  // forgets every position, keeping the table
+  inline void
+  clear()
+  {
+    if (ctrl_)
+      memset(ctrl_, Empty, ngroups() * GroupSize);
+    size_ = 0;
+    npositions_ = 0;
+  }
+
+  // returns nullptr if p was never added
+  inline const entry *
+  find(const void *p) const
+  {
+    if (!ctrl_)
+      return nullptr;
+    return const_cast<flat_ptr_index *>(this)->probe(p, Hash(p));
+  }
+
+private:
+
+  static const size_t GroupSize = 16;
+  static const uint8_t Empty = 0x80;
+
+  inline size_t
+  ngroups() const
+  {
+    return gmask_ + 1;
+  }
+
+  static inline uint64_t
+  Hash(const void *p)
+  {
+    uint64_t k = reinterpret_cast<uintptr_t>(p);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return k;
+  }
+
+  static inline uint8_t
+  Tag(uint64_t h)
+  {
+    return uint8_t(h >> 57);
+  }
+
+  // bit i is set if the i-th control byte of group g is b
+  inline uint32_t
+  match(size_t g, uint8_t b) const
+  {
+    const uint8_t * const ctrl = &ctrl_[g * GroupSize];
+#ifdef __SSE2__
+    const __m128i c = _mm_load_si128(reinterpret_cast<const __m128i *>(ctrl));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(char(b))));
+#else
+    uint32_t m = 0;
+    for (size_t i = 0; i < GroupSize; i++)
+      m |= uint32_t(ctrl[i] == b) << i;
+    return m;
+#endif
+  }
+
+  inline entry *
+  probe(const void *p, uint64_t h)
+  {
+    const uint8_t tag = Tag(h);
+    // triangular probing visits every group of a power of two table
+    for (size_t g = h & gmask_, n = 1; ; g = (g + n++) & gmask_) {
+      for (uint32_t m = match(g, tag); m; m &= m - 1) {
+        entry * const e = &slots_[g * GroupSize + __builtin_ctz(m)];
+        if (e->key_ == p)
+          return e;
+      }
+      if (likely(match(g, Empty)))
+        return nullptr;
+    }
+  }
+
+  inline void
+  insert_new(const void *p, uint64_t h, uint32_t first, uint32_t last)
+  {
+    for (size_t g = h & gmask_, n = 1; ; g = (g + n++) & gmask_) {
+      const uint32_t m = match(g, Empty);
+      if (!m)
+        continue;
+      const size_t i = g * GroupSize + __builtin_ctz(m);
+      ctrl_[i] = Tag(h);
+      slots_[i].key_ = p;
+      slots_[i].first_ = first;
+      slots_[i].last_ = last;
+      size_++;
+      return;
+    }
+  }
+
+  void
+  grow()
+  {
+    uint8_t * const old_ctrl = ctrl_;
+    entry * const old_slots = slots_;
+    const size_t old_nslots = old_ctrl ? ngroups() * GroupSize : 0;
+    const size_t nslots = old_ctrl ? 2 * old_nslots : 4 * GroupSize;
+    ALWAYS_ASSERT(!posix_memalign((void **) &ctrl_, GroupSize, nslots));
+    memset(ctrl_, Empty, nslots);
+    slots_ = (entry *) malloc(nslots * sizeof(entry));
+    ALWAYS_ASSERT(slots_);
+    gmask_ = nslots / GroupSize - 1;
+    size_ = 0;
+    for (size_t i = 0; i < old_nslots; i++)
+      if (old_ctrl[i] != Empty)
+        insert_new(old_slots[i].key_, Hash(old_slots[i].key_),
+                   old_slots[i].first_, old_slots[i].last_);
+    free(old_ctrl);
+    free(old_slots);
+  }
+
+  uint8_t *ctrl_;
+  entry *slots_;
+  size_t gmask_;
+  size_t size_; // distinct keys
+  uint32_t npositions_;
+};
+
+#endif /* _FLAT_PTR_INDEX_H_ */
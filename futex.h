@@ -0,0 +1,102 @@
+#ifndef _NDB_FUTEX_H_
+#define _NDB_FUTEX_H_
+
+#include <atomic>
+#include <climits>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "amd64.h"
+#include "macros.h"
+
+/**
+ * Blocking waits on 32-bit words, for the threads that would otherwise spin
+ * (or sleep in fixed intervals) while there is nothing for them to do.
+ *
+ * Wait() blocks while the word still holds the value the caller last saw,
+ * so a change (and Wake()) in between is never missed. Both can return
+ * spuriously
+ */
+class futex {
+public:
+
+  // how long the spin-then-block waits spin before blocking, in nop_pause()s
+  static const unsigned SpinsBeforeBlocking = 1 << 12;
+
+  // timeout_us of 0 waits for as long as it takes
+  static inline void
+  Wait(const std::atomic<uint32_t> &word, uint32_t seen, uint64_t timeout_us = 0)
+  {
+    struct timespec t;
+    if (timeout_us) {
+      t.tv_sec  = timeout_us / 1000000;
+      t.tv_nsec = (timeout_us % 1000000) * 1000;
+    }
+    syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, seen,
+            timeout_us ? &t : nullptr, nullptr, 0);
+  }
+
+  static inline void
+  WakeAll(const std::atomic<uint32_t> &word)
+  {
+    syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  }
+};
+
+/**
+ * An event threads wait on for a condition which other threads notify() of
+ * after making it true. Waiters spin for a little while, and then block
+ * until notified, so a waiter for something which is about to happen wakes
+ * up as fast as a spinner, while an idle one takes no cpu.
+ *
+ * notify() only costs a syscall when there are blocked waiters
+ */
+class futex_event {
+public:
+
+  futex_event() : seq_(0), nwaiters_(0) {}
+
+  futex_event(const futex_event &) = delete;
+  futex_event(futex_event &&) = delete;
+  futex_event &operator=(const futex_event &) = delete;
+
+  // returns once done() is true. if timeout_us, blocks for at most that long
+  // at a time, for conditions nobody notify()s of
+  template <typename Done>
+  inline void
+  wait_until(Done done, uint64_t timeout_us = 0)
+  {
+    for (unsigned i = 0; i < futex::SpinsBeforeBlocking; i++) {
+      if (done())
+        return;
+      nop_pause();
+    }
+    for (;;) {
+      const uint32_t seen = seq_.load(std::memory_order_acquire);
+      if (done())
+        return;
+      // pairs with notify(): either we see its bump, or it sees us waiting
+      nwaiters_.fetch_add(1, std::memory_order_seq_cst);
+      if (seq_.load(std::memory_order_seq_cst) == seen)
+        futex::Wait(seq_, seen, timeout_us);
+      nwaiters_.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  inline void
+  notify()
+  {
+    seq_.fetch_add(1, std::memory_order_seq_cst);
+    if (unlikely(nwaiters_.load(std::memory_order_seq_cst)))
+      futex::WakeAll(seq_);
+  }
+
+private:
+  std::atomic<uint32_t> seq_;
+  std::atomic<uint32_t> nwaiters_;
+};
+
+#endif /* _NDB_FUTEX_H_ */
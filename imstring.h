@@ -15,12 +15,18 @@
 
 /**
  * Not-really-immutable string, for perf reasons. Also can use
- * RCU for GC
+ * RCU for GC. Strings of up to N bytes are kept inline, without an
+ * allocation (see btree::leaf_node::suffixes_)
+ *
+ * Readers may race a swap() (btree leaves are read optimistically): the
+ * string is inline iff p is NULL, and an allocated string keeps its length
+ * in front of its bytes, so a reader which takes both from a single read of
+ * p (see read()) never gets a length its bytes do not have
  */
-template <bool RCU>
+template <bool RCU, size_t N = 0>
 class base_imstring {
 
-  template <bool R>
+  template <bool R, size_t M>
   friend class base_imstring;
 
   // we can't really support keys > 65536, but most DBs impose
@@ -42,19 +48,21 @@ public:
   base_imstring() : p(NULL), l(0) {}
 
   base_imstring(const uint8_t *src, size_t l)
-    : p(new uint8_t[l]), l(CheckBounds(l))
+    : p(l > N ? new uint8_t[sizeof(internal_size_type) + l] : NULL),
+      l(CheckBounds(l))
   {
-    g_evt_imstring_bytes_allocated += l;
+    if (p) {
+      const internal_size_type n = l;
+      NDB_MEMCPY(p, &n, sizeof(n));
+      g_evt_imstring_bytes_allocated += l;
+    }
     g_evt_avg_imstring_len.offer(l);
-    NDB_MEMCPY(p, src, l);
+    NDB_MEMCPY(p ? p + sizeof(internal_size_type) : &buf[0], src, l);
   }
 
   base_imstring(const std::string &s)
-    : p(new uint8_t[s.size()]), l(CheckBounds(s.size()))
+    : base_imstring((const uint8_t *) s.data(), s.size())
   {
-    g_evt_imstring_bytes_allocated += l;
-    g_evt_avg_imstring_len.offer(l);
-    NDB_MEMCPY(p, s.data(), l);
   }
 
   base_imstring(const base_imstring &) = delete;
@@ -63,7 +71,7 @@ public:
 
   template <bool R>
   inline void
-  swap(base_imstring<R> &that)
+  swap(base_imstring<R, N> &that)
   {
     // std::swap() doesn't work for packed elems
     uint8_t * const temp_p = p;
@@ -72,25 +80,55 @@ public:
     internal_size_type const temp_l = l;
     l = that.l;
     that.l = temp_l;
+    if (N) {
+      uint8_t temp_buf[N ? N : 1];
+      NDB_MEMCPY(&temp_buf[0], &buf[0], N);
+      NDB_MEMCPY(&buf[0], &that.buf[0], N);
+      NDB_MEMCPY(&that.buf[0], &temp_buf[0], N);
+    }
   }
 
   inline
   ~base_imstring()
   {
     release();
-    g_evt_imstring_bytes_freed += l;
   }
 
   inline const uint8_t *
   data() const
   {
-    return p;
+    const uint8_t *d;
+    size_t n;
+    read(d, n);
+    return d;
   }
 
   inline size_t
   size() const
   {
-    return l;
+    const uint8_t *d;
+    size_t n;
+    read(d, n);
+    return n;
+  }
+
+  // the bytes and the length, from a single read of p. under a concurrent
+  // swap() they can be stale, or (inline) torn, but n bytes can always be
+  // read from d
+  inline void
+  read(const uint8_t *&d, size_t &n) const
+  {
+    const uint8_t * const px = p;
+    COMPILER_MEMORY_FENCE;
+    if (px) {
+      internal_size_type x;
+      NDB_MEMCPY(&x, px, sizeof(x));
+      d = px + sizeof(internal_size_type);
+      n = x;
+    } else {
+      d = &buf[0];
+      n = std::min(size_t(l), N);
+    }
   }
 
 private:
@@ -103,21 +141,23 @@ private:
         rcu::s_instance.free_array(p);
       else
         delete [] p;
+      g_evt_imstring_bytes_freed += l;
     }
   }
 
-  uint8_t *p;
+  uint8_t *p; // NULL if inline
   internal_size_type l;
+  uint8_t buf[N];
 } PACKED;
 
-template <bool RCU>
-event_counter base_imstring<RCU>::g_evt_imstring_bytes_allocated("imstring_bytes_allocated");
+template <bool RCU, size_t N>
+event_counter base_imstring<RCU, N>::g_evt_imstring_bytes_allocated("imstring_bytes_allocated");
 
-template <bool RCU>
-event_counter base_imstring<RCU>::g_evt_imstring_bytes_freed("imstring_bytes_freed");
+template <bool RCU, size_t N>
+event_counter base_imstring<RCU, N>::g_evt_imstring_bytes_freed("imstring_bytes_freed");
 
-template <bool RCU>
-event_avg_counter base_imstring<RCU>::g_evt_avg_imstring_len("avg_imstring_len");
+template <bool RCU, size_t N>
+event_avg_counter base_imstring<RCU, N>::g_evt_avg_imstring_len("avg_imstring_len");
 
 typedef base_imstring<false> imstring;
 typedef base_imstring<true>  rcu_imstring;
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string.h>
+
+#include "learned_index.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "rcu.h"
+#include "spinlock.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+static event_counter evt_learned_index_hits("learned_index_hits");
+static event_counter evt_learned_index_misses("learned_index_misses");
+static event_counter evt_learned_index_builds("learned_index_builds");
+
+static const void *const IndexTombstone = (const void *) 0x1;
+static spinlock g_registry_lock;
+
+atomic<size_t> learned_index::g_nregistered(0);
+learned_index::registry_entry learned_index::g_registry[learned_index::NMaxIndexes];
+
+learned_index::learned_index()
+  : table_(nullptr)
+{
+}
+
+learned_index::~learned_index()
+{
+  delete table_.load(memory_order_acquire);
+}
+
+uint64_t
+learned_index::KeyPrefix(const uint8_t *k, size_t len)
+{
+  uint64_t p = 0;
+  for (size_t i = 0; i < 8; i++)
+    p = (p << 8) | (i < len ? k[i] : 0);
+  return p;
+}
+
+void
+learned_index::build(const vector<string> &keys,
+                     const vector<dbtuple *> &tuples)
+{
+  INVARIANT(keys.size() == tuples.size());
+  std::lock_guard<mutex> l(build_mutex_);
+  const size_t n = keys.size();
+  table * const t = new table;
+  t->prefixes_.reserve(n);
+  t->key_offsets_.reserve(n + 1);
+  t->tuples_.reset(new atomic<dbtuple *>[n]);
+  for (size_t i = 0; i < n; i++) {
+    INVARIANT(!i || keys[i - 1] < keys[i]);
+    t->prefixes_.push_back(
+        KeyPrefix((const uint8_t *) keys[i].data(), keys[i].size()));
+    t->key_offsets_.push_back(t->key_bytes_.size());
+    t->key_bytes_ += keys[i];
+    t->tuples_[i].store(tuples[i], memory_order_relaxed);
+  }
+  t->key_offsets_.push_back(t->key_bytes_.size());
+
+  // fits segments to (prefix, position of its first key) greedily: a
+  // segment takes points for as long as some slope keeps all of them within
+  // MaxError of their positions (the slopes which do narrow to a cone)
+  double lo = 0, hi = numeric_limits<double>::infinity();
+  for (size_t i = 0; i < n; i++) {
+    if (i && t->prefixes_[i] == t->prefixes_[i - 1])
+      continue;
+    if (t->segments_.empty()) {
+      t->segments_.push_back(segment{t->prefixes_[i], 0, i});
+      continue;
+    }
+    segment &s = t->segments_.back();
+    const double dx = double(t->prefixes_[i] - s.first_);
+    const double dy = double(i - s.pos_);
+    const double new_lo = max(lo, (dy - MaxError) / dx);
+    const double new_hi = min(hi, (dy + MaxError) / dx);
+    if (new_lo <= new_hi) {
+      lo = new_lo;
+      hi = new_hi;
+      continue;
+    }
+    s.slope_ = hi == numeric_limits<double>::infinity() ? 0 : (lo + hi) / 2;
+    t->segments_.push_back(segment{t->prefixes_[i], 0, i});
+    lo = 0;
+    hi = numeric_limits<double>::infinity();
+  }
+  if (!t->segments_.empty())
+    t->segments_.back().slope_ =
+      hi == numeric_limits<double>::infinity() ? 0 : (lo + hi) / 2;
+
+  ++evt_learned_index_builds;
+  table * const old = table_.exchange(t, memory_order_acq_rel);
+  if (old) {
+    scoped_rcu_region guard;
+    rcu::s_instance.free(old);
+  }
+}
+
+size_t
+learned_index::Find(const table &t, const varkey &k)
+{
+  const size_t n = t.size();
+  if (!n)
+    return n;
+  const uint64_t p = KeyPrefix(k.data(), k.size());
+  auto sit = upper_bound(
+      t.segments_.begin(), t.segments_.end(), p,
+      [](uint64_t p, const segment &s) { return p < s.first_; });
+  size_t pred = 0;
+  if (sit != t.segments_.begin()) {
+    --sit;
+    const double pos = sit->pos_ + sit->slope_ * double(p - sit->first_);
+    pred = pos <= 0 ? 0 : min(size_t(pos), n - 1);
+  }
+
+  // the first key with prefix p (or beyond). the model only bounds where the
+  // keys it was fit to are, so anything else can fall outside the window,
+  // and is searched for in the rest of the array
+  const size_t a = pred > MaxError + 1 ? pred - MaxError - 1 : 0;
+  const size_t b = min(n, pred + MaxError + 2);
+  const uint64_t *const px = t.prefixes_.data();
+  const uint64_t *it = lower_bound(px + a, px + b, p);
+  if (it == px + a && a && px[a - 1] >= p)
+    it = lower_bound(px, px + a, p);
+  else if (it == px + b && b < n)
+    it = lower_bound(px + b, px + n, p);
+  const uint64_t *end = upper_bound(it, px + n, p);
+
+  // then the full keys among those with prefix p
+  size_t lo = it - px, hi = end - px;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (t.key(mid) < k)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < size_t(end - px) && t.key(lo) == k)
+    return lo;
+  return n;
+}
+
+dbtuple *
+learned_index::lookup(const varkey &k) const
+{
+  INVARIANT(rcu::s_instance.in_rcu_region());
+  const table * const t = table_.load(memory_order_acquire);
+  if (t) {
+    const size_t i = Find(*t, k);
+    if (i < t->size()) {
+      dbtuple * const tuple = t->tuples_[i].load(memory_order_acquire);
+      if (tuple) {
+        ++evt_learned_index_hits;
+        return tuple;
+      }
+    }
+  }
+  ++evt_learned_index_misses;
+  return nullptr;
+}
+
+void
+learned_index::put(const varkey &k, dbtuple *tuple)
+{
+  table * const t = table_.load(memory_order_acquire);
+  if (!t)
+    return;
+  const size_t i = Find(*t, k);
+  if (i < t->size())
+    t->tuples_[i].store(tuple, memory_order_release);
+}
+
+void
+learned_index::remove(const varkey &k, const dbtuple *tuple)
+{
+  table * const t = table_.load(memory_order_acquire);
+  if (!t)
+    return;
+  const size_t i = Find(*t, k);
+  if (i == t->size())
+    return;
+  dbtuple *expected = const_cast<dbtuple *>(tuple);
+  t->tuples_[i].compare_exchange_strong(
+      expected, nullptr, memory_order_acq_rel);
+}
+
+void
+learned_index::clear()
+{
+  delete table_.exchange(nullptr, memory_order_acq_rel);
+}
+
+size_t
+learned_index::size() const
+{
+  const table * const t = table_.load(memory_order_acquire);
+  return t ? t->size() : 0;
+}
+
+size_t
+learned_index::nsegments() const
+{
+  const table * const t = table_.load(memory_order_acquire);
+  return t ? t->segments_.size() : 0;
+}
+
+void
+learned_index::Register(const void *btr, learned_index *idx)
+{
+  INVARIANT(btr && btr != IndexTombstone);
+  ::lock_guard<spinlock> l(g_registry_lock);
+  for (size_t i = SlotFor(btr), n = 0;
+       n < NMaxIndexes;
+       i = (i + 1) & (NMaxIndexes - 1), n++) {
+    const void * const px = g_registry[i].btr_.load(memory_order_acquire);
+    INVARIANT(px != btr);
+    if (!px || px == IndexTombstone) {
+      g_registry[i].idx_ = idx;
+      g_registry[i].btr_.store(btr, memory_order_release);
+      g_nregistered.fetch_add(1, memory_order_release);
+      return;
+    }
+  }
+  ALWAYS_ASSERT(false); // too many indexes
+}
+
+void
+learned_index::Unregister(const void *btr)
+{
+  ::lock_guard<spinlock> l(g_registry_lock);
+  for (size_t i = SlotFor(btr), n = 0;
+       n < NMaxIndexes;
+       i = (i + 1) & (NMaxIndexes - 1), n++) {
+    const void * const px = g_registry[i].btr_.load(memory_order_acquire);
+    if (px == btr) {
+      g_registry[i].btr_.store(IndexTombstone, memory_order_release);
+      g_nregistered.fetch_sub(1, memory_order_release);
+      return;
+    }
+    if (!px)
+      break;
+  }
+  ALWAYS_ASSERT(false);
+}
+
+void
+learned_index::Test()
+{
+  // dense and sparse integers, then strings sharing long prefixes
+  fast_random r(2381);
+  for (size_t round = 0; round < 3; round++) {
+    vector<string> keys;
+    for (size_t i = 0; i < 20000; i++) {
+      if (round == 2) {
+        keys.push_back("prefix__" + to_string(r.next() % 100000));
+        continue;
+      }
+      const uint64_t v = round == 0 ? i : r.next();
+      string k(8, 0);
+      for (size_t j = 0; j < 8; j++)
+        k[j] = char(v >> (56 - 8 * j));
+      keys.push_back(k);
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    vector<dbtuple *> tuples;
+    for (size_t i = 0; i < keys.size(); i++)
+      tuples.push_back((dbtuple *) (uintptr_t(i + 1) << 4));
+
+    learned_index idx;
+    idx.build(keys, tuples);
+    ALWAYS_ASSERT(idx.size() == keys.size());
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < keys.size(); i++)
+      ALWAYS_ASSERT(idx.lookup(varkey(keys[i])) == tuples[i]);
+    for (size_t i = 0; i < 1000; i++) {
+      const string k = keys[r.next() % keys.size()] + "x";
+      ALWAYS_ASSERT(!binary_search(keys.begin(), keys.end(), k));
+      ALWAYS_ASSERT(!idx.lookup(varkey(k)));
+    }
+    ALWAYS_ASSERT(!idx.lookup(varkey(string())));
+
+    // replaced, then unlinked
+    idx.put(varkey(keys[0]), tuples[1]);
+    ALWAYS_ASSERT(idx.lookup(varkey(keys[0])) == tuples[1]);
+    idx.remove(varkey(keys[0]), tuples[0]);
+    ALWAYS_ASSERT(idx.lookup(varkey(keys[0])) == tuples[1]);
+    idx.remove(varkey(keys[0]), tuples[1]);
+    ALWAYS_ASSERT(!idx.lookup(varkey(keys[0])));
+    cerr << "learned_index: " << keys.size() << " keys in "
+         << idx.nsegments() << " segments" << endl;
+  }
+  cerr << "learned_index tests passed" << endl;
+}
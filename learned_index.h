@@ -0,0 +1,151 @@
+#ifndef _NDB_LEARNED_INDEX_H_
+#define _NDB_LEARNED_INDEX_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "varkey.h"
+
+class dbtuple;
+
+/**
+ * A learned index from keys to the latest dbtuple of each key, for tables
+ * which are loaded once and then (mostly) only read (see learned_txn_btree).
+ *
+ * The keys are kept in one sorted array, next to their tuples. A piecewise
+ * linear model maps the first 8 bytes of a key to its position in the array
+ * (its segments are fit greedily, so that no key is more than MaxError slots
+ * from where its segment puts it), which leaves a binary search over a few
+ * cache lines of the array: a handful of misses instead of one per level of
+ * the tree.
+ *
+ * Like point_index, it sits in front of the table's underlying btree, and
+ * never has a mapping the btree does not have. Keys inserted after the array
+ * was built only live in the btree, which is where misses go (as do absent
+ * reads, for their node versions). A tuple which replaces one in the array
+ * is put in its slot, and an unlinked tuple is taken out of it, where
+ * point_index's mappings are put and removed.
+ *
+ * Readers never lock. build() must not run concurrently with writes to the
+ * table; the array it replaces is RCU freed.
+ */
+class learned_index {
+public:
+
+  static const size_t MaxError = 32; // slots, either way
+
+  learned_index();
+  ~learned_index();
+
+  learned_index(const learned_index &) = delete;
+  learned_index(learned_index &&) = delete;
+  learned_index &operator=(const learned_index &) = delete;
+
+  // replaces the array with keys[i] => tuples[i], the keys being sorted and
+  // distinct
+  void build(const std::vector<std::string> &keys,
+             const std::vector<dbtuple *> &tuples);
+
+  // caller must be in an RCU region. nullptr if k is not in the array, or
+  // its tuple was unlinked
+  dbtuple *lookup(const varkey &k) const;
+
+  // maps k => tuple, if k is in the array
+  void put(const varkey &k, dbtuple *tuple);
+
+  // removes k's mapping if it is to tuple
+  void remove(const varkey &k, const dbtuple *tuple);
+
+  // not thread-safe
+  void clear();
+
+  size_t size() const;
+  size_t nsegments() const;
+
+  // the (big-endian) first 8 bytes of k, zero padded. keys sort no lower
+  // than the keys before them
+  static uint64_t KeyPrefix(const uint8_t *k, size_t len);
+
+  // indexes are found by their table's underlying btree, by the code which
+  // links and unlinks tuples generically (commit, GC), as point_index's are
+  static void Register(const void *btr, learned_index *idx);
+  static void Unregister(const void *btr);
+
+  static inline learned_index *
+  For(const void *btr)
+  {
+    if (likely(!g_nregistered.load(std::memory_order_acquire)))
+      return nullptr;
+    for (size_t i = SlotFor(btr), n = 0;
+         n < NMaxIndexes;
+         i = (i + 1) & (NMaxIndexes - 1), n++) {
+      const void * const px = g_registry[i].btr_.load(std::memory_order_acquire);
+      if (px == btr)
+        return g_registry[i].idx_;
+      if (!px)
+        break;
+    }
+    return nullptr;
+  }
+
+  static void Test();
+
+private:
+
+  // keys with prefixes from first_ on (up to the next segment's) are
+  // predicted at pos_ + slope_ * (prefix - first_)
+  struct segment {
+    uint64_t first_;
+    double slope_;
+    size_t pos_;
+  };
+
+  struct table {
+    std::vector<segment> segments_;
+    std::vector<uint64_t> prefixes_;
+    std::vector<size_t> key_offsets_; // one past the last, too
+    std::string key_bytes_;
+    std::unique_ptr<std::atomic<dbtuple *>[]> tuples_;
+
+    inline size_t
+    size() const
+    {
+      return prefixes_.size();
+    }
+
+    inline varkey
+    key(size_t i) const
+    {
+      return varkey((const uint8_t *) key_bytes_.data() + key_offsets_[i],
+                    key_offsets_[i + 1] - key_offsets_[i]);
+    }
+  };
+
+  // the slot of k in t, or t.size() if there is none
+  static size_t Find(const table &t, const varkey &k);
+
+  std::atomic<table *> table_;
+  std::mutex build_mutex_;
+
+  static const size_t NMaxIndexes = 1024;
+
+  static inline size_t
+  SlotFor(const void *btr)
+  {
+    return (uintptr_t(btr) >> 4) & (NMaxIndexes - 1);
+  }
+
+  struct registry_entry {
+    std::atomic<const void *> btr_;
+    learned_index *idx_;
+  };
+
+  static std::atomic<size_t> g_nregistered;
+  static registry_entry g_registry[NMaxIndexes];
+};
+
+#endif /* _NDB_LEARNED_INDEX_H_ */
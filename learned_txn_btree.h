@@ -0,0 +1,49 @@
+#ifndef _NDB_LEARNED_TXN_BTREE_H_
+#define _NDB_LEARNED_TXN_BTREE_H_
+
+#include <string>
+
+#include "txn_btree.h"
+
+/**
+ * A txn_btree for tables which are loaded once and then (mostly) only read,
+ * such as catalogs: point reads of the keys present at the last bulk_load()
+ * or rebuild_index() go through a learned index (see learned_index) instead
+ * of descending the tree. Reads are recorded and validated like any other.
+ *
+ * The tree stays the table of record, so writes work as usual: updates
+ * of indexed keys keep the index current, while keys inserted since the
+ * last build are only found by descending the tree, until the next
+ * rebuild_index()
+ */
+template <template <typename> class Transaction>
+class learned_txn_btree : public txn_btree<Transaction> {
+  typedef txn_btree<Transaction> super_type;
+public:
+
+  typedef typename super_type::size_type size_type;
+
+  learned_txn_btree(size_type value_size_hint = 128,
+                    const std::string &name = "<unknown>")
+    : super_type(value_size_hint, false, name)
+  {
+    this->enable_learned_index();
+  }
+
+  // indexes the keys the table has now. no writes to the table may run
+  // concurrently (reads may)
+  inline void
+  rebuild_index()
+  {
+    this->build_learned_index();
+  }
+
+  // the number of keys indexed
+  inline size_t
+  index_size() const
+  {
+    return this->learned_idx->size();
+  }
+};
+
+#endif /* _NDB_LEARNED_TXN_BTREE_H_ */
@@ -25,6 +25,7 @@
 #include "util.h"
 #include "small_vector.h"
 #include "ownership_checker.h"
+#include "task_pool.h"
 
 #include "masstree/masstree_scan.hh"
 #include "masstree/masstree_insert.hh"
@@ -228,7 +229,8 @@ private:
 public:
 #endif
 
-  mbtree() {
+  mbtree()
+    : numa_node_(-1), pack_group_(0), write_policy_(0), snapshot_read_tick_(0) {
     threadinfo ti;
     table_.initialize(ti);
   }
@@ -249,6 +251,70 @@ public:
     table_.initialize(ti);
   }
 
+  /**
+   * Binds the tree to numa node node (-1 unbinds it): the txn layer allocates
+   * its nodes and records on that node (see scoped_alloc_node)
+   */
+  inline void
+  set_numa_node(int node)
+  {
+    numa_node_ = node;
+  }
+
+  inline int
+  numa_node() const
+  {
+    return numa_node_;
+  }
+
+  /**
+   * Packs the tree's records (and the nodes the txn layer's inserts split
+   * off) on hugepages of pack group group, 0 for the shared pool (see
+   * scoped_alloc_pack_group)
+   */
+  inline void
+  set_pack_group(unsigned group)
+  {
+    pack_group_ = group;
+  }
+
+  inline unsigned
+  pack_group() const
+  {
+    return pack_group_;
+  }
+
+  /**
+   * The txn layer's write policy for the tree's records (a
+   * transaction_base::write_policy), and the last read-only tick (plus one,
+   * 0 for never) a snapshot txn read the tree at, for the adaptive policy
+   */
+  inline void
+  set_write_policy(int policy)
+  {
+    write_policy_ = policy;
+  }
+
+  inline int
+  write_policy() const
+  {
+    return write_policy_;
+  }
+
+  inline void
+  note_snapshot_read(uint64_t ro_tick) const
+  {
+    // stores only when the tick moves, so readers share the line
+    if (snapshot_read_tick_.load(std::memory_order_relaxed) < ro_tick + 1)
+      snapshot_read_tick_.store(ro_tick + 1, std::memory_order_relaxed);
+  }
+
+  inline uint64_t
+  last_snapshot_read() const
+  {
+    return snapshot_read_tick_.load(std::memory_order_relaxed);
+  }
+
   /** Note: invariant checking is not thread safe */
   inline void invariant_checker() const {
   }
@@ -259,6 +325,38 @@ public:
   inline bool search(const key_type &k, value_type &v,
                      versioned_node_t *search_info = nullptr) const;
 
+  // keys looked up in lockstep by search_batch()
+  static const size_t SearchBatchSize = 16;
+
+  /**
+   * Like search() for each of keys[0, n), but descends SearchBatchSize keys
+   * at a time in lockstep, prefetching each key's next node before reading
+   * any of them, so that their cache misses overlap. found[i] is set to
+   * whether or not keys[i] was found, and if so values[i] is set.
+   *
+   * Returns the number of keys found
+   */
+  inline size_t search_batch(const key_type *keys, size_t n,
+                             value_type *values, bool *found) const;
+
+  /**
+   * One step of warming up the cache for an operation on k. Same interface
+   * as btree::prefetch_step(): cur starts null, and the caller must stay in
+   * one RCU region over all of k's steps
+   */
+  inline bool prefetch_step(const key_type &k, const void *&cur) const;
+
+  /**
+   * Like insert() for each keys[i] => values[i], i in [0, n), in order, but
+   * warms up the keys' paths SearchBatchSize at a time like search_batch()
+   * does, under one RCU region and threadinfo. If inserted is not null,
+   * inserted[i] is set to whether or not keys[i] was new.
+   *
+   * Returns the number of new keys
+   */
+  inline size_t insert_batch(const key_type *keys, const value_type *values,
+                             size_t n, bool *inserted = nullptr);
+
   /**
    * The low level callback interface is as follows:
    *
@@ -283,6 +381,12 @@ public:
      */
     virtual bool invoke(const string_type &k, value_type v,
                         const node_opaque_t *n, uint64_t version) = 0;
+
+    /**
+     * As in btree. Masstree scans visit one value at a time, so there is no
+     * leaf to prefetch ahead in, and this is never asked
+     */
+    virtual unsigned prefetch_distance() const { return 0; }
   };
 
   /**
@@ -358,6 +462,79 @@ public:
     virtual bool invoke(const string_type &k, value_type v) = 0;
   };
 
+  /**
+   * A position in the tree, for scans which page through a range in
+   * batches. Same interface as btree::cursor, but each batch is a new
+   * masstree scan from the position (which does not expose a way to resume
+   * from a leaf).
+   */
+  class cursor {
+  public:
+    cursor(const mbtree &btr, const key_type &lower)
+      : btr_(&btr), done_(false)
+    {
+      seek(lower);
+    }
+
+    inline void
+    seek(const key_type &k)
+    {
+      pos_.assign((const char *) k.data(), k.size());
+      done_ = false;
+    }
+
+    inline const std::string &
+    position() const
+    {
+      return pos_;
+    }
+
+    inline bool
+    done() const
+    {
+      return done_;
+    }
+
+    // see btree::cursor::next()
+    bool next(low_level_search_range_callback &callback, size_t n,
+              const key_type *upper = nullptr);
+
+  private:
+    struct batch_callback : public low_level_search_range_callback {
+      batch_callback(low_level_search_range_callback &callback, size_t n)
+        : callback_(&callback), n_(n), ninvoked_(0), stopped_(false) {}
+
+      virtual void
+      on_resp_node(const node_opaque_t *n, uint64_t version)
+      {
+        callback_->on_resp_node(n, version);
+      }
+
+      virtual bool
+      invoke(const string_type &k, value_type v,
+             const node_opaque_t *n, uint64_t version)
+      {
+        last_.assign(k.data(), k.length());
+        ninvoked_++;
+        if (!callback_->invoke(k, v, n, version)) {
+          stopped_ = true;
+          return false;
+        }
+        return ninvoked_ < n_;
+      }
+
+      low_level_search_range_callback *const callback_;
+      const size_t n_;
+      size_t ninvoked_;
+      bool stopped_;
+      std::string last_;
+    };
+
+    const mbtree *btr_;
+    std::string pos_;
+    bool done_;
+  };
+
   /**
    * [lower, *upper)
    *
@@ -384,6 +561,24 @@ public:
                 F& callback,
                 std::string *buf = nullptr) const;
 
+  /**
+   * Splits [lower, *upper) into at most n subranges of roughly the same
+   * number of keys, and returns the keys where the second, third, ...
+   * subranges start. See btree::split_range()
+   */
+  std::vector<std::string>
+  split_range(const key_type &lower, const key_type *upper, size_t n) const;
+
+  /**
+   * Scans callbacks.size() subranges of [lower, *upper) at the same time.
+   * See btree::search_range_call_parallel()
+   */
+  void
+  search_range_call_parallel(
+      const key_type &lower,
+      const key_type *upper,
+      const std::vector<low_level_search_range_callback *> &callbacks) const;
+
   /**
    * returns true if key k did not already exist, false otherwise
    * If k exists with a different mapping, still returns false
@@ -413,6 +608,19 @@ public:
   inline bool
   remove(const key_type &k, value_type *old_v = NULL);
 
+  /**
+   * Fills an empty tree with keys[i] => values[i] for i in [0, n). The keys
+   * must be sorted and unique.
+   *
+   * masstree nodes cannot be built bottom up from out here, so this just
+   * inserts in order under a single rcu region- sorted inserts always land
+   * on the rightmost leaf, which stays in cache.
+   *
+   * NOT THREAD SAFE: nobody else may use the tree until this returns
+   */
+  inline void
+  bulk_load(const key_type *keys, const value_type *values, size_t n);
+
   /**
    * The tree walk API is a bit strange, due to the optimistic nature of the
    * btree.
@@ -443,6 +651,24 @@ public:
    */
   inline size_t size() const;
 
+  /**
+   * The shape of the tree, for memory accounting. Depths count from the
+   * root, and carry on from a leaf into the layers it points to. Like size(),
+   * not consistent given concurrent modifications
+   */
+  struct shape_stats {
+    shape_stats()
+      : nkeys_(0), nkey_slots_(0), nlayers_(0), node_bytes_(0) {}
+    std::vector<size_t> internal_nodes_; // by depth
+    std::vector<size_t> leaf_nodes_; // by depth
+    size_t nkeys_;
+    size_t nkey_slots_; // of every leaf, used or not
+    size_t nlayers_;
+    size_t node_bytes_; // not counting the leaves' key suffixes
+  };
+
+  void shape(shape_stats &s) const;
+
   static inline uint64_t
   ExtractVersionNumber(const node_opaque_t *n) {
     // XXX(stephentu): I think we must use stable_version() for
@@ -473,8 +699,15 @@ public:
 
  private:
   Masstree::basic_table<P> table_;
+  int numa_node_;
+  unsigned pack_group_;
+  int write_policy_;
+  mutable std::atomic<uint64_t> snapshot_read_tick_;
 
   static leaf_type* leftmost_descend_layer(node_base_type* n);
+  // walks the paths of keys[0, m) (m <= SearchBatchSize) through the first
+  // layer, one level per round, prefetching each key's next node
+  void prefetch_paths(const key_type *keys, size_t m) const;
   class size_walk_callback;
   template <bool Reverse> class search_range_scanner_base;
   template <bool Reverse> class low_level_search_range_scanner;
@@ -535,6 +768,51 @@ void mbtree<P>::tree_walk(tree_walk_callback &callback) const {
   }
 }
 
+template <typename P>
+void mbtree<P>::shape(shape_stats &s) const {
+  rcu_region guard;
+  INVARIANT(rcu::s_instance.in_rcu_region());
+  std::vector<std::pair<node_base_type *, size_t>> q;
+  std::vector<node_base_type *> children;
+  q.emplace_back(table_.root(), 0);
+  while (!q.empty()) {
+    node_base_type *cur = q.back().first;
+    const size_t depth = q.back().second;
+    q.pop_back();
+    prefetch(cur);
+  process:
+    children.clear();
+    auto version = cur->stable();
+    if (cur->isleaf()) {
+      leaf_type *leaf = static_cast<leaf_type *>(cur);
+      auto perm = leaf->permutation();
+      for (int i = 0; i != perm.size(); ++i)
+        if (leaf->is_layer(perm[i]))
+          children.push_back(leaf->lv_[perm[i]].layer());
+      if (unlikely(leaf->has_changed(version)))
+        goto process;
+      if (s.leaf_nodes_.size() <= depth)
+        s.leaf_nodes_.resize(depth + 1);
+      s.leaf_nodes_[depth]++;
+      s.nkeys_ += perm.size() - children.size();
+      s.nkey_slots_ += leaf_type::width;
+      s.nlayers_ += children.size();
+      s.node_bytes_ += sizeof(leaf_type);
+    } else {
+      internode_type *in = static_cast<internode_type *>(cur);
+      children.assign(in->child_, in->child_ + in->size() + 1);
+      if (unlikely(in->has_changed(version)))
+        goto process;
+      if (s.internal_nodes_.size() <= depth)
+        s.internal_nodes_.resize(depth + 1);
+      s.internal_nodes_[depth]++;
+      s.node_bytes_ += sizeof(internode_type);
+    }
+    for (auto c : children)
+      q.emplace_back(c, depth + 1);
+  }
+}
+
 template <typename P>
 class mbtree<P>::size_walk_callback : public tree_walk_callback {
  public:
@@ -595,6 +873,101 @@ inline bool mbtree<P>::search(const key_type &k, value_type &v,
   return found;
 }
 
+template <typename P>
+inline bool mbtree<P>::prefetch_step(const key_type &k, const void *&cur) const
+{
+  node_base_type *n =
+    const_cast<node_base_type *>(reinterpret_cast<const node_base_type *>(cur));
+  if (!n) {
+    n = table_.root();
+    prefetch(n);
+    prefetch_bytes(n, sizeof(internode_type));
+    cur = n;
+    return true;
+  }
+  if (n->isleaf())
+    return false;
+  internode_type *in = static_cast<internode_type *>(n);
+  const key_slice kslice = k.slice();
+  int kp = 0;
+  while (kp < in->size() && in->ikey0_[kp] <= kslice)
+    kp++;
+  node_base_type *child = in->child_[kp];
+  if (unlikely(!child))
+    return false;
+  prefetch(child);
+  prefetch_bytes(child, std::max(sizeof(leaf_type), sizeof(internode_type)));
+  cur = child;
+  return true;
+}
+
+template <typename P>
+void mbtree<P>::prefetch_paths(const key_type *keys, size_t m) const
+{
+  INVARIANT(m <= SearchBatchSize);
+  const void *curs[SearchBatchSize];
+  for (size_t j = 0; j < m; j++)
+    curs[j] = nullptr;
+  bool descending = true;
+  while (descending) {
+    descending = false;
+    for (size_t j = 0; j < m; j++)
+      if (prefetch_step(keys[j], curs[j]))
+        descending = true;
+  }
+}
+
+template <typename P>
+inline size_t mbtree<P>::search_batch(const key_type *keys, size_t n,
+                                      value_type *values, bool *found) const
+{
+  rcu_region guard;
+  threadinfo ti;
+  size_t nfound = 0;
+  for (size_t i = 0; i < n; i += SearchBatchSize) {
+    const size_t m = std::min(n - i, SearchBatchSize);
+    prefetch_paths(&keys[i], m);
+    for (size_t j = 0; j < m; j++) {
+      const key_type &k = keys[i + j];
+      Masstree::unlocked_tcursor<P> lp(table_, k.data(), k.length());
+      found[i + j] = lp.find_unlocked(ti);
+      if (found[i + j]) {
+        values[i + j] = lp.value();
+        nfound++;
+      }
+    }
+  }
+  return nfound;
+}
+
+template <typename P>
+inline size_t mbtree<P>::insert_batch(const key_type *keys,
+                                      const value_type *values,
+                                      size_t n, bool *inserted)
+{
+  rcu_region guard;
+  threadinfo ti;
+  size_t ninserted = 0;
+  for (size_t i = 0; i < n; i += SearchBatchSize) {
+    const size_t m = std::min(n - i, SearchBatchSize);
+    prefetch_paths(&keys[i], m);
+    for (size_t j = 0; j < m; j++) {
+      const key_type &k = keys[i + j];
+      Masstree::tcursor<P> lp(table_, k.data(), k.length());
+      const bool found = lp.find_insert(ti);
+      if (!found) {
+        ti.advance_timestamp(lp.node_timestamp());
+        ninserted++;
+      }
+      lp.value() = values[i + j];
+      lp.finish(1, ti);
+      if (inserted)
+        inserted[i + j] = !found;
+    }
+  }
+  return ninserted;
+}
+
 template <typename P>
 inline bool mbtree<P>::insert(const key_type &k, value_type v,
                               value_type *old_v,
@@ -658,6 +1031,23 @@ inline bool mbtree<P>::remove(const key_type &k, value_type *old_v)
   return found;
 }
 
+template <typename P>
+inline void mbtree<P>::bulk_load(const key_type *keys, const value_type *values,
+                                 size_t n)
+{
+  rcu_region guard;
+  threadinfo ti;
+  for (size_t i = 0; i < n; i++) {
+    INVARIANT(!i || keys[i - 1] < keys[i]);
+    Masstree::tcursor<P> lp(table_, keys[i].data(), keys[i].length());
+    const bool found = lp.find_insert(ti);
+    ALWAYS_ASSERT(!found);
+    ti.advance_timestamp(lp.node_timestamp());
+    lp.value() = values[i];
+    lp.finish(1, ti);
+  }
+}
+
 template <typename P>
 template <bool Reverse>
 class mbtree<P>::search_range_scanner_base {
@@ -749,6 +1139,110 @@ inline void mbtree<P>::search_range_call(const key_type &lower,
   table_.scan(lcdf::Str(lower.data(), lower.length()), true, scanner, ti);
 }
 
+template <typename P>
+bool
+mbtree<P>::cursor::next(low_level_search_range_callback &callback, size_t n,
+                        const key_type *upper)
+{
+  if (done_ || !n)
+    return !done_;
+  batch_callback c(callback, n);
+  btr_->search_range_call(varkey(pos_), upper, c);
+  if (c.ninvoked_ < n && !c.stopped_) {
+    done_ = true;
+    return false;
+  }
+  pos_.swap(c.last_);
+  pos_.push_back('\0');
+  return true;
+}
+
+template <typename P>
+std::vector<std::string>
+mbtree<P>::split_range(const key_type &lower, const key_type *upper, size_t n) const
+{
+  std::vector<std::string> bounds;
+  if (n <= 1 || (upper && *upper <= lower))
+    return bounds;
+  rcu_region guard;
+  const key_slice lower_slice = lower.slice();
+  const key_slice upper_slice =
+    upper ? upper->slice() : std::numeric_limits<key_slice>::max();
+
+  // collect the separators within the range level by level, until there are
+  // enough to pick n - 1 evenly spaced ones
+  std::vector<key_slice> seps;
+  std::vector<node_base_type *> level(1, table_.root());
+  while (!level.empty() && seps.size() + 1 < n) {
+    std::vector<node_base_type *> next;
+    for (auto cur : level) {
+      if (cur->isleaf())
+        continue;
+      internode_type *in = static_cast<internode_type *>(cur);
+    retry:
+      const nodeversion_type version = cur->stable();
+      const int sz = std::min(int(in->size()), int(internode_type::width));
+      key_slice keys[internode_type::width];
+      node_base_type *children[internode_type::width + 1];
+      std::copy(in->ikey0_, in->ikey0_ + sz, keys);
+      std::copy(in->child_, in->child_ + sz + 1, children);
+      if (unlikely(in->has_changed(version)))
+        goto retry;
+      // children[i] covers [keys[i - 1], keys[i])
+      for (int i = 0; i <= sz; i++) {
+        if (i < sz && keys[i] <= lower_slice)
+          continue;
+        if (i > 0 && keys[i - 1] > upper_slice)
+          break;
+        if (i > 0)
+          seps.push_back(keys[i - 1]);
+        next.push_back(children[i]);
+      }
+    }
+    level.swap(next);
+  }
+
+  std::sort(seps.begin(), seps.end());
+  std::vector<std::string> cands;
+  for (auto s : seps) {
+    const key_slice be = util::big_endian_trfm<key_slice>()(s);
+    std::string b((const char *) &be, sizeof(be));
+    if (varkey(b) <= lower || (upper && !(varkey(b) < *upper)))
+      continue;
+    if (cands.empty() || cands.back() != b)
+      cands.emplace_back(std::move(b));
+  }
+  for (size_t i = 1; i < n; i++) {
+    const size_t idx = i * cands.size() / n;
+    if (idx < cands.size() && (bounds.empty() || bounds.back() < cands[idx]))
+      bounds.push_back(cands[idx]);
+  }
+  return bounds;
+}
+
+template <typename P>
+void
+mbtree<P>::search_range_call_parallel(
+    const key_type &lower,
+    const key_type *upper,
+    const std::vector<low_level_search_range_callback *> &callbacks) const
+{
+  const std::vector<std::string> bounds =
+    split_range(lower, upper, callbacks.size());
+  std::vector<task_pool::task_t> tasks;
+  for (size_t i = 0; i <= bounds.size() && i < callbacks.size(); i++)
+    tasks.emplace_back([&, i]() {
+      rcu_region guard;
+      const key_type sub_lower = i ? key_type(bounds[i - 1]) : lower;
+      key_type sub_upper;
+      if (i < bounds.size())
+        sub_upper = key_type(bounds[i]);
+      search_range_call(
+          sub_lower, i < bounds.size() ? &sub_upper : upper, *callbacks[i]);
+    });
+  task_pool::Run(tasks);
+}
+
 template <typename P>
 inline void mbtree<P>::rsearch_range_call(const key_type &upper,
                                           const key_type *lower,
@@ -0,0 +1,572 @@
+/**
+ * Micro-benchmarks of the core primitives (the index tree, dbtuple reads,
+ * rcu allocation and txn commit), each measured in isolation, so that work
+ * on one of them doesn't have to wait for a full TPC-C run to be judged.
+ *
+ * Every benchmark is run for each thread count (and key size, for the ones
+ * whose cost depends on it), on threads pinned like the dbtest workers,
+ * with a warmup before the measured interval. Each run prints the ns per
+ * op (per thread), the aggregate ops/sec and the scaling efficiency, which
+ * is the per-thread throughput relative to the run with the fewest threads
+ */
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "btree_choice.h"
+#include "core.h"
+#include "macros.h"
+#include "rcu.h"
+#include "spinbarrier.h"
+#include "str_arena.h"
+#include "tuple.h"
+#include "txn.h"
+#include "txn_btree.h"
+#include "txn_proto2_impl.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+// ops between checks of whether the run is over
+static const size_t BatchSize = 64;
+
+// keys per btree_scan op
+static const size_t ScanLength = 100;
+
+static size_t g_nkeys = 1 << 20;
+static size_t g_value_size = 64;
+static double g_warmup_secs = 1.0;
+static double g_runtime_secs = 2.0;
+
+// keysz bytes: a common prefix, then i big endian, so that longer keys share
+// longer prefixes (as the composite keys of real tables do)
+static inline void
+SetKeyIndex(string &k, uint64_t i)
+{
+  INVARIANT(k.size() >= sizeof(i));
+  const uint64_t be = big_endian_trfm<uint64_t>()(i);
+  NDB_MEMCPY(&k[k.size() - sizeof(be)], &be, sizeof(be));
+}
+
+static string
+MakeKey(uint64_t i, size_t keysz)
+{
+  string k(keysz, 'k');
+  SetKeyIndex(k, i);
+  return k;
+}
+
+static vector<string>
+MakeKeys(size_t n, size_t keysz)
+{
+  vector<string> ret;
+  ret.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    ret.emplace_back(MakeKey(i, keysz));
+  return ret;
+}
+
+/**
+ * A primitive under test. Everything but run_ops() runs on the main thread,
+ * while no run is in progress
+ */
+class microbench {
+public:
+  microbench(const string &name, bool keyed)
+    : name(name), keyed(keyed) {}
+  virtual ~microbench() {}
+
+  // before the runs with key size keysz (0 if !keyed)
+  virtual void setup(size_t keysz) {}
+
+  virtual void begin_run(size_t nthreads) {}
+
+  // n ops on thread tid, in [0, nthreads)
+  virtual void run_ops(size_t tid, fast_random &r, size_t n) = 0;
+
+  // after the last run with the key size of setup()
+  virtual void teardown() {}
+
+  const string name;
+  const bool keyed; // the cost depends on the key size
+};
+
+class btree_search_bench : public microbench {
+public:
+  btree_search_bench(const string &name = "btree_search")
+    : microbench(name, true) {}
+
+  virtual void
+  setup(size_t keysz)
+  {
+    keys = MakeKeys(g_nkeys, keysz);
+    btr.reset(new concurrent_btree);
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < keys.size(); i++)
+      btr->insert(varkey(keys[i]), (typename concurrent_btree::value_type) i);
+  }
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < n; i++) {
+      typename concurrent_btree::value_type v = 0;
+      const bool found UNUSED =
+        btr->search(varkey(keys[r.next() % keys.size()]), v);
+      INVARIANT(found);
+    }
+  }
+
+  virtual void
+  teardown()
+  {
+    btr.reset();
+    keys.clear();
+  }
+
+protected:
+  vector<string> keys;
+  unique_ptr<concurrent_btree> btr;
+};
+
+// each thread inserts its own (ascending) keys into a tree which starts out
+// empty every run
+class btree_insert_bench : public microbench {
+public:
+  btree_insert_bench() : microbench("btree_insert", true), keysz(0) {}
+
+  virtual void
+  setup(size_t keysz)
+  {
+    this->keysz = keysz;
+  }
+
+  virtual void
+  begin_run(size_t nthreads)
+  {
+    btr.reset(new concurrent_btree);
+    for (size_t i = 0; i < nthreads; i++) {
+      *bufs[i] = string(keysz, 'k');
+      *next[i] = 0;
+    }
+    this->nthreads = nthreads;
+  }
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    scoped_rcu_region guard;
+    string &k = *bufs[tid];
+    uint64_t &i = *next[tid];
+    for (size_t j = 0; j < n; j++, i++) {
+      SetKeyIndex(k, i * nthreads + tid);
+      btr->insert(varkey(k), (typename concurrent_btree::value_type) i);
+    }
+  }
+
+  virtual void
+  teardown()
+  {
+    btr.reset();
+  }
+
+private:
+  size_t keysz;
+  size_t nthreads;
+  unique_ptr<concurrent_btree> btr;
+  static aligned_padded_elem<string> bufs[NMAXCORES];
+  static aligned_padded_elem<uint64_t> next[NMAXCORES];
+};
+
+aligned_padded_elem<string> btree_insert_bench::bufs[NMAXCORES];
+aligned_padded_elem<uint64_t> btree_insert_bench::next[NMAXCORES];
+
+// an op is a scan of ScanLength keys from a random key
+class btree_scan_bench : public btree_search_bench {
+public:
+  btree_scan_bench() : btree_search_bench("btree_scan") {}
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < n; i++) {
+      limit_callback c;
+      btr->search_range_call(
+          varkey(keys[r.next() % keys.size()]), nullptr, c);
+    }
+  }
+
+private:
+  class limit_callback : public concurrent_btree::search_range_callback {
+  public:
+    limit_callback() : n(0) {}
+    virtual bool
+    invoke(const typename concurrent_btree::string_type &k,
+           typename concurrent_btree::value_type v)
+    {
+      return ++n < ScanLength;
+    }
+  private:
+    size_t n;
+  };
+};
+
+// stable_read()s of the latest version of random records, as a txn's read
+// does once the index has found the record
+class tuple_stable_read_bench : public microbench {
+public:
+  tuple_stable_read_bench() : microbench("tuple_stable_read", false) {}
+
+  // the tuples are latest versions, which nothing but a txn btree's purge
+  // ever frees, so they are kept until exit
+  virtual void
+  setup(size_t keysz)
+  {
+    const string v(g_value_size, 'v');
+    tuples.reserve(g_nkeys);
+    for (size_t i = 0; i < g_nkeys; i++) {
+      dbtuple * const tuple = dbtuple::alloc_first(v.size(), false);
+      NDB_MEMCPY(tuple->get_value_start(), v.data(), v.size());
+      tuple->version = 1;
+      tuples.push_back(tuple);
+    }
+  }
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    str_arena arena;
+    string v;
+    txn_btree_::single_value_reader reader(&v, string::npos);
+    for (size_t i = 0; i < n; i++) {
+      const dbtuple * const tuple = tuples[r.next() % tuples.size()];
+      dbtuple::tid_t start_t = 0;
+      const dbtuple::ReadStatus s UNUSED = tuple->stable_read(
+          dbtuple::MAX_TID - 1, start_t, reader, arena, false);
+      INVARIANT(s == dbtuple::READ_RECORD);
+    }
+  }
+
+private:
+  vector<const dbtuple *> tuples;
+};
+
+// an op is an alloc() and an rcu dealloc, as a record which is replaced
+class rcu_alloc_free_bench : public microbench {
+public:
+  rcu_alloc_free_bench() : microbench("rcu_alloc_free", false) {}
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    const size_t sz = dbtuple::AllocSize(g_value_size);
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < n; i++) {
+      void * const p = rcu::s_instance.alloc(sz);
+      rcu::s_instance.dealloc_rcu(p, sz);
+    }
+  }
+};
+
+struct microbench_txn_traits : public default_transaction_traits {
+  typedef str_arena StringAllocator;
+};
+
+/**
+ * Txns against a txn_btree of g_nkeys records: ones which touch nothing
+ * (begin and commit alone), read one random record, or read and then
+ * rewrite one record of the thread's own (so that none of them conflict)
+ */
+class txn_bench : public microbench {
+public:
+  enum kind { EMPTY, READ, READ_WRITE };
+
+  txn_bench(kind k)
+    : microbench(k == EMPTY ? "txn_empty" : k == READ ? "txn_read" : "txn_rmw",
+                 k != EMPTY),
+      k(k), nthreads(1) {}
+
+  virtual void
+  setup(size_t keysz)
+  {
+    if (k == EMPTY)
+      return;
+    keys = MakeKeys(g_nkeys, keysz);
+    btr.reset(new txn_btree<transaction_proto2>(g_value_size));
+    const string v(g_value_size, 'v');
+    str_arena arena;
+    for (size_t i = 0; i < keys.size(); i++) {
+      arena.reset();
+      transaction_proto2<microbench_txn_traits> t(0, arena);
+      btr->insert(t, keys[i], v);
+      t.commit(true);
+    }
+  }
+
+  virtual void
+  begin_run(size_t nthreads)
+  {
+    this->nthreads = nthreads;
+  }
+
+  virtual void
+  run_ops(size_t tid, fast_random &r, size_t n)
+  {
+    str_arena arena;
+    string v;
+    for (size_t i = 0; i < n; i++) {
+      arena.reset();
+      transaction_proto2<microbench_txn_traits> t(0, arena);
+      if (k == READ) {
+        btr->search(t, keys[r.next() % keys.size()], v);
+      } else if (k == READ_WRITE) {
+        const size_t nmine = keys.size() / nthreads;
+        const string &key = keys[(r.next() % nmine) * nthreads + tid];
+        btr->search(t, key, v);
+        btr->put(t, key, v);
+      }
+      const bool committed UNUSED = t.commit(false);
+      INVARIANT(committed);
+    }
+  }
+
+  virtual void
+  teardown()
+  {
+    btr.reset();
+    keys.clear();
+  }
+
+private:
+  const kind k;
+  size_t nthreads;
+  vector<string> keys;
+  unique_ptr<txn_btree<transaction_proto2>> btr;
+};
+
+// ops done by each thread of the current run
+static aligned_padded_elem<atomic<uint64_t>> g_nops[NMAXCORES];
+
+static inline uint64_t
+TotalOps(size_t nthreads)
+{
+  uint64_t n = 0;
+  for (size_t i = 0; i < nthreads; i++)
+    n += g_nops[i]->load(memory_order_acquire);
+  return n;
+}
+
+// returns the ops done, and the usec they took, after the warmup
+static pair<uint64_t, uint64_t>
+RunOnce(microbench &b, size_t nthreads)
+{
+  b.begin_run(nthreads);
+  spin_barrier barrier_a(nthreads), barrier_b(1);
+  atomic<bool> running(true);
+  vector<thread> thds;
+  for (size_t i = 0; i < nthreads; i++) {
+    g_nops[i]->store(0, memory_order_relaxed);
+    thds.emplace_back([&b, &barrier_a, &barrier_b, &running, i]() {
+      // like the dbtest workers. the allocator's regions are mapped on
+      // demand instead of faulted in up front, as --per-core-memory only
+      // bounds them
+      rcu::s_instance.pin_current_thread(i);
+      fast_random r(8544290 + i);
+      barrier_a.count_down();
+      barrier_b.wait_for();
+      uint64_t n = 0;
+      while (running.load(memory_order_acquire)) {
+        b.run_ops(i, r, BatchSize);
+        n += BatchSize;
+        g_nops[i]->store(n, memory_order_release);
+      }
+    });
+  }
+  barrier_a.wait_for();
+  barrier_b.count_down();
+  this_thread::sleep_for(chrono::duration<double>(g_warmup_secs));
+  const uint64_t n0 = TotalOps(nthreads);
+  timer t;
+  this_thread::sleep_for(chrono::duration<double>(g_runtime_secs));
+  const uint64_t n1 = TotalOps(nthreads);
+  const uint64_t usec = t.lap();
+  running.store(false, memory_order_release);
+  for (auto &thd : thds)
+    thd.join();
+  return make_pair(n1 - n0, usec);
+}
+
+static void
+Run(microbench &b, const vector<size_t> &nthreads, size_t keysz)
+{
+  b.setup(keysz);
+  double base_per_thread = 0.0;
+  for (auto n : nthreads) {
+    const pair<uint64_t, uint64_t> r = RunOnce(b, n);
+    const double ops_per_sec = double(r.first) / (double(r.second) / 1000000.0);
+    const double ns_per_op = double(r.second) * 1000.0 * n / double(r.first);
+    if (!base_per_thread)
+      base_per_thread = ops_per_sec / n;
+    cout << b.name
+         << " key_size=" << (b.keyed ? to_string(keysz) : string("-"))
+         << " threads=" << n
+         << " ns/op=" << fixed << setprecision(1) << ns_per_op
+         << " ops/sec=" << setprecision(0) << ops_per_sec
+         << " scaling=" << setprecision(2) << (ops_per_sec / n) / base_per_thread
+         << endl;
+  }
+  b.teardown();
+}
+
+static size_t
+parse_memory_spec(const string &s)
+{
+  string x(s);
+  size_t mult = 1;
+  if (x.back() == 'G') {
+    mult = static_cast<size_t>(1) << 30;
+    x.pop_back();
+  } else if (x.back() == 'M') {
+    mult = static_cast<size_t>(1) << 20;
+    x.pop_back();
+  } else if (x.back() == 'K') {
+    mult = static_cast<size_t>(1) << 10;
+    x.pop_back();
+  }
+  return strtoul(x.c_str(), nullptr, 10) * mult;
+}
+
+int
+main(int argc, char **argv)
+{
+  const size_t ncpus = coreid::num_cpus_online();
+  vector<size_t> nthreads;
+  for (size_t n = 1; n <= ncpus; n *= 2)
+    nthreads.push_back(n);
+  if (nthreads.back() != ncpus)
+    nthreads.push_back(ncpus);
+  vector<size_t> keyszs = {8, 32, 128};
+  set<string> only;
+  size_t per_core_memory = static_cast<size_t>(4) << 30;
+
+  while (1) {
+    static struct option long_options[] =
+    {
+      {"bench"           , required_argument , 0 , 'b'} , // comma separated names
+      {"num-threads"     , required_argument , 0 , 't'} , // comma separated, ranges ok
+      {"key-sizes"       , required_argument , 0 , 'k'} , // comma separated, >= 8
+      {"num-keys"        , required_argument , 0 , 'n'} ,
+      {"value-size"      , required_argument , 0 , 'v'} ,
+      {"warmup"          , required_argument , 0 , 'w'} , // seconds
+      {"runtime"         , required_argument , 0 , 'r'} , // seconds
+      {"per-core-memory" , required_argument , 0 , 'm'} ,
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "b:t:k:n:v:w:r:m:", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case 'b':
+      for (auto &s : split(optarg, ','))
+        only.insert(s);
+      break;
+
+    case 't':
+      nthreads = ParseCSVString<size_t, RangeAwareParser<size_t>>(optarg);
+      break;
+
+    case 'k':
+      keyszs = ParseCSVString<size_t, RangeAwareParser<size_t>>(optarg);
+      break;
+
+    case 'n':
+      g_nkeys = strtoul(optarg, nullptr, 10);
+      break;
+
+    case 'v':
+      g_value_size = strtoul(optarg, nullptr, 10);
+      break;
+
+    case 'w':
+      g_warmup_secs = strtod(optarg, nullptr);
+      break;
+
+    case 'r':
+      g_runtime_secs = strtod(optarg, nullptr);
+      break;
+
+    case 'm':
+      per_core_memory = parse_memory_spec(optarg);
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+  ALWAYS_ASSERT(!nthreads.empty());
+  for (auto n : nthreads)
+    // one thread per allocator region
+    ALWAYS_ASSERT(n >= 1 && n <= ncpus);
+  for (auto k : keyszs)
+    ALWAYS_ASSERT(k >= sizeof(uint64_t));
+  ALWAYS_ASSERT(g_nkeys >= ncpus);
+  ALWAYS_ASSERT(g_value_size > 0);
+  ALWAYS_ASSERT(g_runtime_secs > 0.0);
+
+#ifndef NDEBUG
+  cerr << "WARNING: benchmark built in DEBUG mode!!!" << endl;
+#endif
+#ifdef CHECK_INVARIANTS
+  cerr << "WARNING: invariant checking is enabled - should disable for benchmark" << endl;
+#endif
+
+  ::allocator::Initialize(ncpus, per_core_memory);
+#ifdef PROTO2_CAN_DISABLE_GC
+  transaction_proto2_static::InitGC();
+#endif
+
+  vector<unique_ptr<microbench>> benches;
+  benches.emplace_back(new btree_search_bench);
+  benches.emplace_back(new btree_insert_bench);
+  benches.emplace_back(new btree_scan_bench);
+  benches.emplace_back(new tuple_stable_read_bench);
+  benches.emplace_back(new rcu_alloc_free_bench);
+  benches.emplace_back(new txn_bench(txn_bench::EMPTY));
+  benches.emplace_back(new txn_bench(txn_bench::READ));
+  benches.emplace_back(new txn_bench(txn_bench::READ_WRITE));
+
+  for (auto &b : benches) {
+    if (!only.empty() && !only.count(b->name))
+      continue;
+    if (b->keyed)
+      for (auto k : keyszs)
+        Run(*b, nthreads, k);
+    else
+      Run(*b, nthreads, 0);
+  }
+  return 0;
+}
@@ -44,6 +44,10 @@ public:
 
   virtual void reset_ntxn_persisted() { }
 
+  // bytes written to the log since the last reset_ntxn_persisted(), 0 if
+  // the database does not log
+  virtual uint64_t get_nbytes_logged() const { return 0; }
+
   enum TxnProfileHint {
     HINT_DEFAULT,
 
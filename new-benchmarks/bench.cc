@@ -43,6 +43,7 @@ int slow_exit = 0;
 int retry_aborted_transaction = 0;
 int no_reset_counters = 0;
 int backoff_aborted_transaction = 0;
+ssize_t load_batch_size = 0;
 
 template <typename T>
 static vector<T>
@@ -122,7 +123,9 @@ bench_worker::run()
         const auto ret = workload[i].fn(this);
         if (likely(ret.first)) {
           ++ntxn_commits;
-          latency_numer_us += t.lap();
+          const uint64_t latency_us = t.lap();
+          latency_numer_us += latency_us;
+          latency_hist.offer(latency_us);
           backoff_shifts >>= 1;
         } else {
           ++ntxn_aborts;
@@ -235,12 +238,15 @@ bench_runner::run()
   size_t n_commits = 0;
   size_t n_aborts = 0;
   uint64_t latency_numer_us = 0;
+  histogram_data latency_hist;
   for (size_t i = 0; i < nthreads; i++) {
     n_commits += workers[i]->get_ntxn_commits();
     n_aborts += workers[i]->get_ntxn_aborts();
     latency_numer_us += workers[i]->get_latency_numer_us();
+    latency_hist += workers[i]->get_latency_hist();
   }
   const auto persisted_info = db->get_ntxn_persisted();
+  const uint64_t nbytes_logged = db->get_nbytes_logged();
 
   const unsigned long elapsed = t.lap(); // lap() must come after do_txn_finish(),
                                          // because do_txn_finish() potentially
@@ -274,6 +280,11 @@ bench_runner::run()
   const double avg_latency_ms = avg_latency_us / 1000.0;
   const double avg_persist_latency_ms =
     get<2>(persisted_info) / 1000.0;
+  const double p99_latency_ms = double(latency_hist.percentile(99)) / 1000.0;
+
+  // normalized, so that databases which log differently compare
+  const double bytes_logged_per_txn =
+    n_commits ? double(nbytes_logged) / double(n_commits) : 0.0;
 
   if (verbose) {
     const pair<uint64_t, uint64_t> mem_info_after = get_system_memory_info();
@@ -325,6 +336,8 @@ bench_runner::run()
     cerr << "avg_per_core_persist_throughput: " << avg_per_core_persist_throughput << " ops/sec/core" << endl;
     cerr << "avg_latency: " << avg_latency_ms << " ms" << endl;
     cerr << "avg_persist_latency: " << avg_persist_latency_ms << " ms" << endl;
+    cerr << "p99_latency: " << p99_latency_ms << " ms" << endl;
+    cerr << "bytes_logged_per_txn: " << bytes_logged_per_txn << " bytes" << endl;
     cerr << "agg_abort_rate: " << agg_abort_rate << " aborts/sec" << endl;
     cerr << "avg_per_core_abort_rate: " << avg_per_core_abort_rate << " aborts/sec/core" << endl;
     cerr << "txn breakdown: " << format_list(agg_txn_counts.begin(), agg_txn_counts.end()) << endl;
@@ -349,12 +362,16 @@ bench_runner::run()
 #endif
   }
 
-  // output for plotting script
+  // output for plotting script (the normalized metrics come last, so the
+  // scripts which read the first five columns are unaffected)
   cout << agg_throughput << " "
        << agg_persist_throughput << " "
        << avg_latency_ms << " "
        << avg_persist_latency_ms << " "
-       << agg_abort_rate << endl;
+       << agg_abort_rate << " "
+       << avg_per_core_throughput << " "
+       << p99_latency_ms << " "
+       << bytes_logged_per_txn << endl;
   cout.flush();
 
   if (!slow_exit)
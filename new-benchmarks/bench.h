@@ -10,6 +10,7 @@
 #include <string>
 
 #include "abstract_db.h"
+#include "../counter.h"
 #include "../macros.h"
 #include "../thread.h"
 #include "../util.h"
@@ -34,6 +35,21 @@ extern void tpcc_do_test(
     const persistconfig &cfg,
     int argc, char **argv);
 
+extern void ycsb_do_test(
+    const std::string &dbtype,
+    const persistconfig &cfg,
+    int argc, char **argv);
+
+extern void queue_do_test(
+    const std::string &dbtype,
+    const persistconfig &cfg,
+    int argc, char **argv);
+
+extern void bid_do_test(
+    const std::string &dbtype,
+    const persistconfig &cfg,
+    int argc, char **argv);
+
 enum { RUNMODE_TIME = 0,
        RUNMODE_OPS  = 1};
 
@@ -52,6 +68,16 @@ extern int slow_exit;
 extern int retry_aborted_transaction;
 extern int no_reset_counters;
 extern int backoff_aborted_transaction;
+extern ssize_t load_batch_size;
+
+// the max number of records a loader puts in one txn (-1 for no max). every
+// database's loaders use --load-batch-size when it is given, so that they
+// load alike; otherwise each uses its own abstract_db::txn_max_batch_size()
+static inline ssize_t
+LoadBatchSize(const abstract_db *db)
+{
+  return load_batch_size ? load_batch_size : db->txn_max_batch_size();
+}
 
 // NOTE: the typed_* versions of classes exist so we don't have to convert all
 // classes to templatetized [for sanity in compliation times]; we trade off
@@ -179,6 +205,13 @@ public:
     return double(latency_numer_us) / double(ntxn_commits);
   }
 
+  // of committed txns, in us
+  inline const histogram_data &
+  get_latency_hist() const
+  {
+    return latency_hist;
+  }
+
   std::map<std::string, size_t> get_txn_counts() const;
 
   typedef abstract_db::counter_map counter_map;
@@ -209,6 +242,7 @@ private:
   size_t ntxn_commits;
   size_t ntxn_aborts;
   uint64_t latency_numer_us;
+  histogram_data latency_hist;
   unsigned backoff_shifts;
 
 protected:
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../macros.h"
+#include "../util.h"
+#include "../record/encoder.h"
+
+#include "bench.h"
+#include "run_bench.h"
+
+using namespace std;
+using namespace util;
+
+static size_t nusers;
+static size_t nproducts;
+static const float pricefactor = 10000.0; // bids range from [0, 10000.0)
+
+#define BIDUSER_REC_KEY_FIELDS(x, y) \
+  x(uint32_t,uid)
+#define BIDUSER_REC_VALUE_FIELDS(x, y) \
+  x(uint32_t,bid)
+DO_STRUCT(biduser_rec, BIDUSER_REC_KEY_FIELDS, BIDUSER_REC_VALUE_FIELDS)
+
+#define BID_REC_KEY_FIELDS(x, y) \
+  x(uint32_t,uid) \
+  y(uint32_t,bid)
+#define BID_REC_VALUE_FIELDS(x, y) \
+  x(uint32_t,pid) \
+  y(float,amount)
+DO_STRUCT(bid_rec, BID_REC_KEY_FIELDS, BID_REC_VALUE_FIELDS)
+
+#define BIDMAX_REC_KEY_FIELDS(x, y) \
+  x(uint32_t,pid)
+#define BIDMAX_REC_VALUE_FIELDS(x, y) \
+  x(float,amount)
+DO_STRUCT(bidmax_rec, BIDMAX_REC_KEY_FIELDS, BIDMAX_REC_VALUE_FIELDS)
+
+template <typename Database>
+struct bid_tables {
+  typename Database::template IndexType<schema<biduser_rec>>::ptr_type biduser;
+  typename Database::template IndexType<schema<bid_rec>>::ptr_type bid;
+  typename Database::template IndexType<schema<bidmax_rec>>::ptr_type bidmax;
+};
+
+template <typename Database>
+class bid_worker : public bench_worker {
+public:
+  bid_worker(
+      unsigned int worker_id,
+      unsigned long seed, Database *db,
+      const bid_tables<Database> &tables,
+      spin_barrier *barrier_a, spin_barrier *barrier_b)
+    : bench_worker(worker_id, false, seed, db,
+                   barrier_a, barrier_b),
+      tables(tables)
+  {
+  }
+
+  txn_result
+  txn_bid()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      // pick user at random
+      const biduser_rec::key biduser_key(this->r.next() % nusers);
+      biduser_rec::value biduser_value;
+      ALWAYS_ASSERT(tables.biduser->search(txn, biduser_key, biduser_value));
+
+      // update the user's bid
+      const uint32_t bid = biduser_value.bid;
+      biduser_value.bid++;
+      tables.biduser->put(txn, biduser_key, biduser_value);
+
+      // insert the new bid
+      const bid_rec::key bid_key(biduser_key.uid, bid);
+      const bid_rec::value bid_value(
+          this->r.next() % nproducts, this->r.next_uniform() * pricefactor);
+      tables.bid->insert(txn, bid_key, bid_value);
+
+      // fold the bid into the product's max, at commit (so bids on a
+      // product do not conflict on it)
+      const bidmax_rec::key bidmax_key(bid_value.pid);
+      const bidmax_rec::value bidmax_value(bid_value.amount);
+      ALWAYS_ASSERT(tables.bidmax->template aggregate<AGGREGATE_MAX>(
+            txn, bidmax_key, bidmax_value));
+
+      if (likely(txn.commit()))
+        return txn_result(true, 0);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnBid(bench_worker *w)
+  {
+    return static_cast<bid_worker *>(w)->txn_bid();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    w.push_back(workload_desc("Bid", 1.0, TxnBid));
+    return w;
+  }
+
+private:
+  bid_tables<Database> tables;
+};
+
+template <typename Database>
+class bid_loader : public typed_bench_loader<Database> {
+public:
+  bid_loader(unsigned long seed,
+             Database *db,
+             const bid_tables<Database> &tables)
+    : typed_bench_loader<Database>(seed, db), tables(tables)
+  {}
+
+protected:
+  virtual void
+  load()
+  {
+    const size_t batchsize =
+      (LoadBatchSize(this->typed_db()) == -1) ?
+        10000 : LoadBatchSize(this->typed_db());
+    try {
+      for (size_t b = 0; b < nusers; b += batchsize) {
+        scoped_str_arena s_arena(this->arena);
+        typename Database::template
+          TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+        const size_t bend = min(b + batchsize, nusers);
+        for (size_t j = b; j < bend; j++)
+          tables.biduser->insert(txn, biduser_rec::key(j), biduser_rec::value(0));
+        ALWAYS_ASSERT(txn.commit());
+      }
+      if (verbose)
+        cerr << "[INFO] finished loading BIDUSER table" << endl;
+
+      for (size_t b = 0; b < nproducts; b += batchsize) {
+        scoped_str_arena s_arena(this->arena);
+        typename Database::template
+          TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+        const size_t bend = min(b + batchsize, nproducts);
+        for (size_t j = b; j < bend; j++)
+          tables.bidmax->insert(txn, bidmax_rec::key(j), bidmax_rec::value(0.0));
+        ALWAYS_ASSERT(txn.commit());
+      }
+      if (verbose)
+        cerr << "[INFO] finished loading BIDMAX table" << endl;
+    } catch (typename Database::abort_exception_type &e) {
+      // shouldn't abort on loading!
+      ALWAYS_ASSERT(false);
+    }
+  }
+
+private:
+  bid_tables<Database> tables;
+};
+
+template <typename Database>
+class bid_bench_runner : public typed_bench_runner<Database> {
+public:
+  bid_bench_runner(Database *db)
+    : typed_bench_runner<Database>(db)
+  {
+    tables.biduser = db->template open_index<schema<biduser_rec>>(
+        "biduser", sizeof(biduser_rec::value), false);
+    tables.bid = db->template open_index<schema<bid_rec>>(
+        "bid", sizeof(bid_rec::value), false);
+    tables.bidmax = db->template open_index<schema<bidmax_rec>>(
+        "bidmax", sizeof(bidmax_rec::value), false);
+    this->open_tables["biduser"] = tables.biduser;
+    this->open_tables["bid"] = tables.bid;
+    this->open_tables["bidmax"] = tables.bidmax;
+  }
+
+protected:
+  virtual vector<unique_ptr<bench_loader>>
+  make_loaders()
+  {
+    vector<unique_ptr<bench_loader>> ret;
+    ret.emplace_back(new bid_loader<Database>(0, this->typed_db(), tables));
+    return ret;
+  }
+
+  virtual vector<unique_ptr<bench_worker>>
+  make_workers()
+  {
+    fast_random r(36578943);
+    vector<unique_ptr<bench_worker>> ret;
+    for (size_t i = 0; i < nthreads; i++)
+      ret.emplace_back(
+        new bid_worker<Database>(
+          i, r.next(), this->typed_db(), tables,
+          &this->barrier_a, &this->barrier_b));
+    return ret;
+  }
+
+private:
+  bid_tables<Database> tables;
+};
+
+void
+bid_do_test(const string &dbtype,
+            const persistconfig &cfg,
+            int argc, char **argv)
+{
+  nusers = size_t(scale_factor * 1000.0);
+  nproducts = size_t(scale_factor * 1000.0);
+  ALWAYS_ASSERT(nusers > 0);
+  ALWAYS_ASSERT(nproducts > 0);
+  RunBench<bid_bench_runner>(dbtype, cfg);
+}
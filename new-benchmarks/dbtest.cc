@@ -90,10 +90,11 @@ main(int argc, char **argv)
       {"disable-snapshots"          , no_argument       , &cfg.disable_snapshots_    , 1}   ,
       {"stats-server-sockfile"      , required_argument , 0                          , 'x'} ,
       {"no-reset-counters"          , no_argument       , &no_reset_counters         , 1}   ,
+      {"load-batch-size"            , required_argument , 0                          , 'L'} ,
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "b:s:t:d:B:f:r:n:o:m:l:a:x:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "b:s:t:d:B:f:r:n:o:m:l:a:x:L:", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -171,6 +172,11 @@ main(int argc, char **argv)
       stats_server_sockfile = optarg;
       break;
 
+    case 'L':
+      load_batch_size = strtol(optarg, NULL, 10);
+      ALWAYS_ASSERT(load_batch_size > 0);
+      break;
+
     case '?':
       /* getopt_long already printed an error message. */
       exit(1);
@@ -180,8 +186,14 @@ main(int argc, char **argv)
     }
   }
 
-  if (bench_type == "tpcc")
+  if (bench_type == "ycsb")
+    test_fn = ycsb_do_test;
+  else if (bench_type == "tpcc")
     test_fn = tpcc_do_test;
+  else if (bench_type == "queue")
+    test_fn = queue_do_test;
+  else if (bench_type == "bid")
+    test_fn = bid_do_test;
   else
     ALWAYS_ASSERT(false);
 
@@ -218,13 +230,20 @@ main(int argc, char **argv)
     ::allocator::Initialize(nthreads, maxpercpu);
   }
 
-  const set<string> can_persist({"ndb-proto2"});
+  const set<string> can_persist({"ndb-proto2", "wal-kv"});
   if (!cfg.logfiles_.empty() && !can_persist.count(db_type)) {
     cerr << "[ERROR] benchmark " << db_type
          << " does not have persistence implemented" << endl;
     return 1;
   }
 
+  if (db_type == "wal-kv" &&
+      (cfg.logfiles_.size() > 1 || !cfg.assignments_.empty() ||
+       cfg.do_compress_ || cfg.fake_writes_)) {
+    cerr << "[ERROR] wal-kv logs to one logfile, uncompressed" << endl;
+    return 1;
+  }
+
 #ifdef PROTO2_CAN_DISABLE_GC
   const set<string> has_gc({"ndb-proto1", "ndb-proto2"});
   if (cfg.disable_gc_ && !has_gc.count(db_type)) {
@@ -276,6 +295,7 @@ main(int argc, char **argv)
     cerr << "  db-type     : " << db_type                   << endl;
     cerr << "  basedir     : " << basedir                   << endl;
     cerr << "  txn-flags   : " << hexify(txn_flags)         << endl;
+    cerr << "  load-batch  : " << load_batch_size           << endl;
     if (run_mode == RUNMODE_TIME)
       cerr << "  runtime     : " << runtime                 << endl;
     else
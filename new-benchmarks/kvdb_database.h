@@ -2,6 +2,7 @@
 #define _KVDB_WRAPPER_IMPL_H_
 
 #include <vector>
+#include <functional>
 #include <limits>
 #include <utility>
 
@@ -544,6 +545,26 @@ public:
       kvdb_txn &t, const key_type &k, value_type &v,
       FieldsMask fm = FieldsMask());
 
+  // typed_txn_btree::index_join(), one search() at a time
+  template <typename Outer, typename InnerKey, typename Callback,
+            typename FieldsMask = AllFields>
+  inline size_t
+  index_join(kvdb_txn &t, const std::vector<Outer> &outer,
+             InnerKey inner_key, Callback callback,
+             FieldsMask fm = FieldsMask())
+  {
+    size_t nfound = 0;
+    for (auto &o : outer) {
+      const key_type k = inner_key(o);
+      value_type v;
+      if (search(t, k, v, fm)) {
+        callback(o, k, v);
+        nfound++;
+      }
+    }
+    return nfound;
+  }
+
   template <typename FieldsMask = AllFields>
   inline void search_range_call(
       kvdb_txn &t, const key_type &lower, const key_type *upper,
@@ -568,6 +589,37 @@ public:
   inline void remove(
       kvdb_txn &t, const key_type &k);
 
+  // see typed_txn_btree::add_secondary_index()
+  template <typename IndexSchema>
+  void add_secondary_index(
+      kvdb_index<IndexSchema, UseConcurrencyControl> &idx,
+      bool (*extract)(const key_type &k, const value_type &v,
+                      typename IndexSchema::key_type &ik,
+                      typename IndexSchema::value_type &iv))
+  {
+    kvdb_index<IndexSchema, UseConcurrencyControl> * const px = &idx;
+    secondary_indexes.push_back(
+        [px, extract](kvdb_txn &t, const key_type &k,
+                      const value_type *old_v, const value_type *new_v) {
+          typename IndexSchema::key_type old_ik, ik;
+          typename IndexSchema::value_type old_iv, iv;
+          const bool has_old = old_v && extract(k, *old_v, old_ik, old_iv);
+          const bool has_new = new_v && extract(k, *new_v, ik, iv);
+          const bool moved = has_old && (!has_new || old_ik != ik);
+          if (moved)
+            px->remove(t, old_ik);
+          if (has_new && (!has_old || moved || old_iv != iv))
+            px->put(t, ik, iv);
+        });
+  }
+
+  // see typed_txn_btree::aggregate(). without txns to defer it to, the
+  // record is simply read, folded into and written back
+  template <aggregate_op Op, typename FieldsMask = AllFields>
+  inline bool aggregate(
+      kvdb_txn &t, const key_type &k, const value_type &v,
+      FieldsMask fm = FieldsMask());
+
 private:
 
   template <typename Callback, typename KeyReader, typename ValueReader>
@@ -575,7 +627,39 @@ private:
       kvdb_txn &t, const key_type &lower, const key_type *upper,
       Callback &callback, KeyReader &kr, ValueReader &vr);
 
+  // replaces the entries of old_v (the record at k, if any) with those of
+  // new_v (null for a removal)
+  inline void
+  update_secondary_entries(kvdb_txn &t, const key_type &k,
+                           const value_type *old_v, const value_type *new_v)
+  {
+    for (auto &f : secondary_indexes)
+      f(t, k, old_v, new_v);
+  }
+
+  // update_secondary_entries() for a write of the fields in fields of v (a
+  // removal if v is null) to k
+  inline void
+  write_secondary_entries(kvdb_txn &t, const key_type &k,
+                          const value_type *v, uint64_t fields)
+  {
+    value_type old_v, new_v;
+    const bool had = search(t, k, old_v);
+    if (v) {
+      new_v = *v;
+      if (had && !typed_txn_btree_<Schema>::IsAllFields(fields)) {
+        new_v = old_v;
+        typed_txn_btree_<Schema>::CopyFields(&new_v, v, fields);
+      }
+    }
+    update_secondary_entries(t, k, had ? &old_v : nullptr, v ? &new_v : nullptr);
+  }
+
   std::string name;
+  std::vector<
+    std::function<void (kvdb_txn &, const key_type &,
+                        const value_type *, const value_type *)>>
+    secondary_indexes;
   typedef
     typename std::conditional<
       UseConcurrencyControl,
@@ -702,6 +786,8 @@ kvdb_index<Schema, UseConcurrencyControl>::put(
     // XXX: currently unsupported- need to ensure locked values
     // are the canonical versions pointed to by the tree
     ALWAYS_ASSERT(false);
+  if (unlikely(!secondary_indexes.empty()))
+    write_secondary_entries(t, key, &value, FieldsMask::value);
   value_writer vw(&value, FieldsMask::value);
   typename my_btree::value_type v = 0, v_old = 0;
   if (btr.search(varkey(*keypx), v)) {
@@ -727,7 +813,6 @@ kvdb_index<Schema, UseConcurrencyControl>::put(
     kvdb_record * const r = (kvdb_record *) v_old;
     kvdb_record::release(r);
   }
-  return;
 }
 
 template <typename Schema, bool UseConcurrencyControl>
@@ -746,12 +831,30 @@ kvdb_index<Schema, UseConcurrencyControl>::insert(
   kvdb_record * const rec = kvdb_record::alloc(sz);
   vw((uint8_t *) &rec->data[0], 0);
   rec->set_size(sz);
-  if (likely(btr.insert_if_absent(varkey(*keypx), (typename my_btree::value_type) rec, nullptr)))
+  if (likely(btr.insert_if_absent(varkey(*keypx), (typename my_btree::value_type) rec, nullptr))) {
+    if (unlikely(!secondary_indexes.empty()))
+      update_secondary_entries(t, k, nullptr, &v);
     return;
+  }
   kvdb_record::release_no_rcu(rec);
   put(t, k, v);
 }
 
+template <typename Schema, bool UseConcurrencyControl>
+template <aggregate_op Op, typename FieldsMask>
+bool
+kvdb_index<Schema, UseConcurrencyControl>::aggregate(
+    kvdb_txn &t, const key_type &k, const value_type &v,
+    FieldsMask fm)
+{
+  value_type cur;
+  if (!search(t, k, cur, fm))
+    return false;
+  typed_txn_btree_<Schema>::aggregate_fields(&cur, &v, FieldsMask::value, Op);
+  put(t, k, cur, fm);
+  return true;
+}
+
 template <typename Schema, bool UseConcurrencyControl>
 void
 kvdb_index<Schema, UseConcurrencyControl>::remove(
@@ -764,6 +867,8 @@ kvdb_index<Schema, UseConcurrencyControl>::remove(
   if (UseConcurrencyControl)
     // XXX: currently unsupported- see above
     ALWAYS_ASSERT(false);
+  if (unlikely(!secondary_indexes.empty()))
+    write_secondary_entries(t, k, nullptr, 0);
   typename my_btree::value_type v = 0;
   if (likely(btr.remove(varkey(*keypx), &v))) {
     kvdb_record * const r = reinterpret_cast<kvdb_record *>(v);
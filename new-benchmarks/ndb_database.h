@@ -57,6 +57,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = true;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -69,6 +70,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = false;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -81,6 +83,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = true;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -91,6 +94,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = true;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -101,6 +105,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = false;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -111,6 +116,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = false;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -121,6 +127,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = false;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -133,6 +140,7 @@ namespace private_ {
     static const bool stable_input_memory = true;
     static const bool hard_expected_sizes = false;
     static const bool read_own_writes = false;
+    static const bool read_only = false;
     typedef str_arena StringAllocator;
   };
 
@@ -182,6 +190,7 @@ public:
   inline typename TransactionType<hint>::ptr_type
   new_txn(uint64_t txn_flags, str_arena &arena) const
   {
+    txn_logger::Admit(txn_flags);
     return std::make_shared<typename TransactionType<hint>::type>(txn_flags, arena);
   }
 
@@ -225,6 +234,12 @@ public:
     txn_epoch_sync<Transaction>::reset_ntxn_persisted();
   }
 
+  uint64_t
+  get_nbytes_logged() const OVERRIDE
+  {
+    return txn_epoch_sync<Transaction>::compute_nbytes_logged();
+  }
+
   template <typename Schema>
   inline typename IndexType<Schema>::ptr_type
   open_index(const std::string &name,
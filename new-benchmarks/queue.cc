@@ -0,0 +1,229 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+#include <limits>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../macros.h"
+#include "../util.h"
+#include "../record/encoder.h"
+#include "../record/inline_str.h"
+
+#include "bench.h"
+#include "run_bench.h"
+
+using namespace std;
+using namespace util;
+
+static size_t nkeys;
+
+#define QUEUE_KEY_FIELDS(x, y) \
+  x(uint64_t,q_id) \
+  y(uint64_t,q_seq)
+#define QUEUE_VALUE_FIELDS(x, y) \
+  x(inline_str_fixed<8>,q_value)
+DO_STRUCT(queue_rec, QUEUE_KEY_FIELDS, QUEUE_VALUE_FIELDS)
+
+static const string queue_values("ABCDEFGH");
+
+template <typename Database>
+class queue_worker : public bench_worker {
+public:
+  typedef typename Database::template IndexType<schema<queue_rec>>::type table_type;
+
+  queue_worker(unsigned int worker_id,
+               unsigned long seed, Database *db,
+               const shared_ptr<table_type> &tbl,
+               spin_barrier *barrier_a, spin_barrier *barrier_b,
+               uint64_t id, bool consumer)
+    : bench_worker(worker_id, false, seed, db,
+                   barrier_a, barrier_b),
+      tbl(tbl), id(id), consumer(consumer),
+      ctr(consumer ? 0 : nkeys)
+  {
+    v.q_value.assign(queue_values);
+  }
+
+  txn_result
+  txn_produce()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      tbl->insert(txn, queue_rec::key(id, ctr), v);
+      if (likely(txn.commit())) {
+        ctr++;
+        return txn_result(true, queue_values.size());
+      }
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnProduce(bench_worker *w)
+  {
+    return static_cast<queue_worker *>(w)->txn_produce();
+  }
+
+  txn_result
+  txn_consume()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      const queue_rec::key lowk(id, 0);
+      const queue_rec::key highk(id, numeric_limits<uint64_t>::max());
+      static_limit_callback<table_type, 1, false> c;
+      tbl->search_range_call(txn, lowk, &highk, c);
+      ssize_t ret = 0;
+      if (likely(c.size())) {
+        tbl->remove(txn, c.key(0));
+        ret = -queue_values.size();
+      }
+      if (likely(txn.commit()))
+        return txn_result(true, ret);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnConsume(bench_worker *w)
+  {
+    return static_cast<queue_worker *>(w)->txn_consume();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    if (consumer)
+      w.push_back(workload_desc("Consume", 1.0, TxnConsume));
+    else
+      w.push_back(workload_desc("Produce", 1.0, TxnProduce));
+    return w;
+  }
+
+private:
+  shared_ptr<table_type> tbl;
+  uint64_t id;
+  bool consumer;
+  uint64_t ctr;
+  queue_rec::value v;
+};
+
+template <typename Database>
+class queue_table_loader : public typed_bench_loader<Database> {
+public:
+  typedef typename Database::template IndexType<schema<queue_rec>>::type table_type;
+
+  queue_table_loader(unsigned long seed,
+                     Database *db,
+                     const shared_ptr<table_type> &tbl)
+    : typed_bench_loader<Database>(seed, db), tbl(tbl)
+  {}
+
+protected:
+  virtual void
+  load()
+  {
+    const size_t batchsize =
+      (LoadBatchSize(this->typed_db()) == -1) ?
+        10000 : LoadBatchSize(this->typed_db());
+    queue_rec::value v;
+    v.q_value.assign(queue_values);
+    try {
+      for (size_t id = 0; id < nthreads / 2; id++) {
+        for (size_t b = 0; b < nkeys; b += batchsize) {
+          scoped_str_arena s_arena(this->arena);
+          typename Database::template
+            TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+          const size_t bend = min(b + batchsize, nkeys);
+          for (size_t j = b; j < bend; j++)
+            tbl->insert(txn, queue_rec::key(id, j), v);
+          ALWAYS_ASSERT(txn.commit());
+        }
+      }
+    } catch (typename Database::abort_exception_type &e) {
+      // shouldn't abort on loading!
+      ALWAYS_ASSERT(false);
+    }
+    if (verbose)
+      cerr << "[INFO] finished loading table" << endl;
+  }
+
+private:
+  shared_ptr<table_type> tbl;
+};
+
+template <typename Database>
+class queue_bench_runner : public typed_bench_runner<Database> {
+public:
+  queue_bench_runner(Database *db)
+    : typed_bench_runner<Database>(db), write_only(true)
+  {
+    tbl = db->template open_index<schema<queue_rec>>(
+        "table", queue_values.size(), true);
+    this->open_tables["table"] = tbl;
+  }
+
+protected:
+  virtual vector<unique_ptr<bench_loader>>
+  make_loaders()
+  {
+    vector<unique_ptr<bench_loader>> ret;
+    ret.emplace_back(new queue_table_loader<Database>(0, this->typed_db(), tbl));
+    return ret;
+  }
+
+  virtual vector<unique_ptr<bench_worker>>
+  make_workers()
+  {
+    fast_random r(8544290);
+    vector<unique_ptr<bench_worker>> ret;
+    if (write_only) {
+      for (size_t i = 0; i < nthreads; i++)
+        ret.emplace_back(
+          new queue_worker<Database>(
+            i, r.next(), this->typed_db(), tbl,
+            &this->barrier_a, &this->barrier_b, i, false));
+    } else {
+      ALWAYS_ASSERT(nthreads >= 2);
+      if (verbose && (nthreads % 2))
+        cerr << "queue_bench_runner: odd number of workers given" << endl;
+      for (size_t i = 0; i < nthreads / 2; i++) {
+        ret.emplace_back(
+          new queue_worker<Database>(
+            i, r.next(), this->typed_db(), tbl,
+            &this->barrier_a, &this->barrier_b, i, true));
+        ret.emplace_back(
+          new queue_worker<Database>(
+            i + 1, r.next(), this->typed_db(), tbl,
+            &this->barrier_a, &this->barrier_b, i, false));
+      }
+    }
+    return ret;
+  }
+
+private:
+  typename Database::template IndexType<schema<queue_rec>>::ptr_type tbl;
+  bool write_only;
+};
+
+void
+queue_do_test(const string &dbtype,
+              const persistconfig &cfg,
+              int argc, char **argv)
+{
+  nkeys = size_t(scale_factor * 1000.0);
+  ALWAYS_ASSERT(nkeys > 0);
+  RunBench<queue_bench_runner>(dbtype, cfg);
+}
@@ -0,0 +1,108 @@
+#ifndef _NDB_BENCH_RUN_BENCH_H_
+#define _NDB_BENCH_RUN_BENCH_H_
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../macros.h"
+#include "../txn_proto2_impl.h"
+
+#include "bench.h"
+#include "ndb_database.h"
+#include "kvdb_database.h"
+#include "wal_database.h"
+
+/**
+ * Opens the database dbtype names, and runs the runner make(db) returns over
+ * it. make is a functor with a
+ *
+ *   template <typename Database>
+ *   std::unique_ptr<bench_runner> operator()(Database *db) const;
+ *
+ * so every benchmark runs over the same set of databases, with the same
+ * persistence config:
+ *
+ *   ndb-proto2: ndb, logging with txn_logger when cfg has logfiles
+ *   kvdb-st:    ndb's btrees without txns, single threaded
+ *   wal-kv:     an embedded store with a memtable and a write-ahead log (see
+ *               wal_log), logging to cfg's (one) logfile if it has one
+ */
+template <typename MakeRunner>
+static void
+RunBenchWith(const std::string &dbtype, const persistconfig &cfg,
+             const MakeRunner &make)
+{
+  std::unique_ptr<abstract_db> db;
+  std::unique_ptr<bench_runner> r;
+
+  if (dbtype == "ndb-proto2") {
+    if (!cfg.logfiles_.empty()) {
+      std::vector<std::vector<unsigned>> assignments_used;
+      txn_logger::Init(
+          nthreads, cfg.logfiles_, cfg.assignments_, &assignments_used,
+          !cfg.nofsync_,
+          cfg.do_compress_,
+          cfg.fake_writes_);
+      if (verbose) {
+        std::cerr << "[logging subsystem]" << std::endl;
+        std::cerr << "  assignments: " << assignments_used  << std::endl;
+        std::cerr << "  call fsync : " << !cfg.nofsync_     << std::endl;
+        std::cerr << "  compression: " << cfg.do_compress_  << std::endl;
+        std::cerr << "  fake_writes: " << cfg.fake_writes_  << std::endl;
+      }
+    }
+#ifdef PROTO2_CAN_DISABLE_GC
+    if (!cfg.disable_gc_)
+      transaction_proto2_static::InitGC();
+#endif
+#ifdef PROTO2_CAN_DISABLE_SNAPSHOTS
+    if (cfg.disable_snapshots_)
+      transaction_proto2_static::DisableSnapshots();
+#endif
+    typedef ndb_database<transaction_proto2> Database;
+    Database *raw = new Database;
+    db.reset(raw);
+    r = make(raw);
+  } else if (dbtype == "kvdb-st") {
+    typedef kvdb_database<false> Database;
+    Database *raw = new Database;
+    db.reset(raw);
+    r = make(raw);
+  } else if (dbtype == "wal-kv") {
+    ALWAYS_ASSERT(cfg.logfiles_.size() <= 1);
+    typedef wal_database Database;
+    Database *raw = new Database(
+        cfg.logfiles_.empty() ? std::string() : cfg.logfiles_[0],
+        !cfg.nofsync_);
+    db.reset(raw);
+    r = make(raw);
+  } else
+    ALWAYS_ASSERT(false);
+
+  r->run();
+}
+
+template <template <typename> class Runner>
+struct bench_runner_maker {
+  template <typename Database>
+  inline std::unique_ptr<bench_runner>
+  operator()(Database *db) const
+  {
+    return std::unique_ptr<bench_runner>(new Runner<Database>(db));
+  }
+};
+
+/**
+ * RunBenchWith() for the benchmarks whose runner only depends on the type
+ * of the database
+ */
+template <template <typename> class Runner>
+static void
+RunBench(const std::string &dbtype, const persistconfig &cfg)
+{
+  RunBenchWith(dbtype, cfg, bench_runner_maker<Runner>());
+}
+
+#endif /* _NDB_BENCH_RUN_BENCH_H_ */
@@ -24,8 +24,7 @@
 #include "bench.h"
 #include "tpcc.h"
 
-#include "ndb_database.h"
-#include "kvdb_database.h"
+#include "run_bench.h"
 
 using namespace std;
 using namespace util;
@@ -677,7 +676,7 @@ protected:
   virtual void
   load()
   {
-    const ssize_t bsize = this->typed_db()->txn_max_batch_size();
+    const ssize_t bsize = LoadBatchSize(this->typed_db());
     auto txn = this->typed_db()->template new_txn<abstract_db::HINT_DEFAULT>(txn_flags, this->arena);
     uint64_t total_sz = 0;
     try {
@@ -757,8 +756,8 @@ protected:
 
     for (uint w = w_start; w <= w_end; w++) {
       const size_t batchsize =
-        (this->typed_db()->txn_max_batch_size() == -1) ?
-          NumItems() : this->typed_db()->txn_max_batch_size();
+        (LoadBatchSize(this->typed_db()) == -1) ?
+          NumItems() : LoadBatchSize(this->typed_db());
       const size_t nbatches = (batchsize > NumItems()) ? 1 : (NumItems() / batchsize);
 
       if (pin_cpus)
@@ -855,7 +854,7 @@ protected:
   virtual void
   load()
   {
-    const ssize_t bsize = this->typed_db()->txn_max_batch_size();
+    const ssize_t bsize = LoadBatchSize(this->typed_db());
     auto txn = this->typed_db()->template new_txn<abstract_db::HINT_DEFAULT>(txn_flags, this->arena);
     uint64_t district_total_sz = 0, n_districts = 0;
     try {
@@ -932,8 +931,8 @@ protected:
     const uint w_end   = (warehouse_id == -1) ?
       NumWarehouses() : static_cast<uint>(warehouse_id);
     const size_t batchsize =
-      (this->typed_db()->txn_max_batch_size() == -1) ?
-        NumCustomersPerDistrict() : this->typed_db()->txn_max_batch_size();
+      (LoadBatchSize(this->typed_db()) == -1) ?
+        NumCustomersPerDistrict() : LoadBatchSize(this->typed_db());
     const size_t nbatches =
       (batchsize > NumCustomersPerDistrict()) ?
         1 : (NumCustomersPerDistrict() / batchsize);
@@ -988,17 +987,9 @@ protected:
               checker::SanityCheckCustomer(&k, &v);
               const size_t sz = Size(v);
               total_sz += sz;
+              // (also makes the customer_name_idx entry)
               tables.tbl_customer(w)->insert(txn, k, v);
 
-              // customer name index
-              const customer_name_idx::key k_idx(k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
-              const customer_name_idx::value v_idx(k.c_id);
-
-              // index structure is:
-              // (c_w_id, c_d_id, c_last, c_first) -> (c_id)
-
-              tables.tbl_customer_name_idx(w)->insert(txn, k_idx, v_idx);
-
               history::key k_hist;
               k_hist.h_c_id = c;
               k_hist.h_c_d_id = d;
@@ -1110,13 +1101,9 @@ protected:
             const size_t sz = Size(v_oo);
             oorder_total_sz += sz;
             n_oorders++;
+            // (also makes the oorder_c_id_idx entry)
             tables.tbl_oorder(w)->insert(txn, k_oo, v_oo);
 
-            const oorder_c_id_idx::key k_oo_idx(k_oo.o_w_id, k_oo.o_d_id, v_oo.o_c_id, k_oo.o_id);
-            const oorder_c_id_idx::value v_oo_idx(0);
-
-            tables.tbl_oorder_c_id_idx(w)->insert(txn, k_oo_idx, v_oo_idx);
-
             if (c >= 2101) {
               const new_order::key k_no(w, d, c);
               const new_order::value v_no;
@@ -1316,14 +1303,10 @@ tpcc_worker<Database, AllowReadOnlyScans>::txn_new_order()
     v_oo.o_entry_d = GetCurrentTimeMillis();
 
     const size_t oorder_sz = Size(v_oo);
+    // (also makes the oorder_c_id_idx entry)
     tables.tbl_oorder(warehouse_id)->insert(txn, k_oo, v_oo);
     ret += oorder_sz;
 
-    const oorder_c_id_idx::key k_oo_idx(warehouse_id, districtID, customerID, k_no.no_o_id);
-    const oorder_c_id_idx::value v_oo_idx(0);
-
-    tables.tbl_oorder_c_id_idx(warehouse_id)->insert(txn, k_oo_idx, v_oo_idx);
-
     for (uint ol_number = 1; ol_number <= numItems; ol_number++) {
       const uint ol_supply_w_id = supplierWarehouseIDs[ol_number - 1];
       const uint ol_i_id = itemIDs[ol_number - 1];
@@ -1877,7 +1860,6 @@ public:
 
 STATIC_COUNTER_DECL(scopedperf::tod_ctr, stock_level_probe0_tod, stock_level_probe0_cg)
 STATIC_COUNTER_DECL(scopedperf::tod_ctr, stock_level_probe1_tod, stock_level_probe1_cg)
-STATIC_COUNTER_DECL(scopedperf::tod_ctr, stock_level_probe2_tod, stock_level_probe2_cg)
 
 static event_avg_counter evt_avg_stock_level_loop_join_lookups("stock_level_loop_join_lookups");
 
@@ -1934,19 +1916,24 @@ tpcc_worker<Database, AllowReadOnlyScans>::txn_stock_level()
           txn, k_ol_0, &k_ol_1, c, nfields);
     }
     {
+      ANON_REGION("StockLevelLoopJoin:", &stock_level_probe1_cg);
       small_unordered_map<uint, bool, 512> s_i_ids_distinct;
+      vector<uint> s_i_ids;
+      s_i_ids.reserve(c.s_i_ids.size());
       for (auto &p : c.s_i_ids) {
-        ANON_REGION("StockLevelLoopJoinIter:", &stock_level_probe1_cg);
-        const stock::key k_s(warehouse_id, p.first);
-        stock::value v_s;
         INVARIANT(p.first >= 1 && p.first <= NumItems());
-        {
-          ANON_REGION("StockLevelLoopJoinGet:", &stock_level_probe2_cg);
-          ALWAYS_ASSERT(tables.tbl_stock(warehouse_id)->search(txn, k_s, v_s, GUARDED_FIELDS(stock::value::s_quantity_field)));
-        }
-        if (v_s.s_quantity < int(threshold))
-          s_i_ids_distinct[p.first] = 1;
+        s_i_ids.push_back(p.first);
       }
+      // the stock lookups are batched, so their misses overlap
+      const size_t nfound = tables.tbl_stock(warehouse_id)->index_join(
+          txn, s_i_ids,
+          [warehouse_id](uint i_id) { return stock::key(warehouse_id, i_id); },
+          [&](uint i_id, const stock::key &k_s, const stock::value &v_s) {
+            if (v_s.s_quantity < int(threshold))
+              s_i_ids_distinct[i_id] = 1;
+          },
+          GUARDED_FIELDS(stock::value::s_quantity_field));
+      ALWAYS_ASSERT(nfound == s_i_ids.size());
       evt_avg_stock_level_loop_join_lookups.offer(c.s_i_ids.size());
       // NB(stephentu): s_i_ids_distinct.size() is the computed result of this txn
     }
@@ -1990,6 +1977,30 @@ private:
            strcmp("oorder_c_id_idx", name) == 0;
   }
 
+  // index structure is:
+  // (c_w_id, c_d_id, c_last, c_first) -> (c_id)
+  static bool
+  CustomerNameIdxEntry(const customer::key &k, const customer::value &v,
+                       customer_name_idx::key &k_idx,
+                       customer_name_idx::value &v_idx)
+  {
+    k_idx = customer_name_idx::key(
+        k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
+    v_idx = customer_name_idx::value(k.c_id);
+    return true;
+  }
+
+  // (o_w_id, o_d_id, o_c_id, o_id) -> ()
+  static bool
+  OOrderCIdIdxEntry(const oorder::key &k, const oorder::value &v,
+                    oorder_c_id_idx::key &k_idx,
+                    oorder_c_id_idx::value &v_idx)
+  {
+    k_idx = oorder_c_id_idx::key(k.o_w_id, k.o_d_id, v.o_c_id, k.o_id);
+    v_idx = oorder_c_id_idx::value(0);
+    return true;
+  }
+
   template <typename Schema>
   static vector<shared_ptr<typename Database::template IndexType<Schema>::type>>
   OpenTablesForTablespace(Database *db, const char *name, size_t expected_size)
@@ -2039,6 +2050,16 @@ public:
 
 #undef OPEN_TABLESPACE_X
 
+    // a table and its index are partitioned alike
+    for (size_t i = 0; i < NumWarehouses(); i++) {
+      if (i && tables.tbl_customer_vec[i] == tables.tbl_customer_vec[i - 1])
+        continue;
+      tables.tbl_customer_vec[i]->add_secondary_index(
+          *tables.tbl_customer_name_idx_vec[i], &CustomerNameIdxEntry);
+      tables.tbl_oorder_vec[i]->add_secondary_index(
+          *tables.tbl_oorder_c_id_idx_vec[i], &OOrderCIdIdxEntry);
+    }
+
     if (g_enable_partition_locks) {
       static_assert(sizeof(aligned_padded_elem<spinlock>) == CACHELINE_SIZE, "xx");
       void * const px = memalign(CACHELINE_SIZE, sizeof(aligned_padded_elem<spinlock>) * nthreads);
@@ -2142,15 +2163,17 @@ private:
   tpcc_tables<Database> tables;
 };
 
-template <typename Database>
-static unique_ptr<bench_runner>
-MakeBenchRunner(Database *db)
-{
-  return unique_ptr<bench_runner>(
-    g_disable_read_only_scans ?
-      static_cast<bench_runner *>(new tpcc_bench_runner<Database, false>(db)) :
-      static_cast<bench_runner *>(new tpcc_bench_runner<Database, true>(db)));
-}
+struct tpcc_runner_maker {
+  template <typename Database>
+  unique_ptr<bench_runner>
+  operator()(Database *db) const
+  {
+    return unique_ptr<bench_runner>(
+      g_disable_read_only_scans ?
+        static_cast<bench_runner *>(new tpcc_bench_runner<Database, false>(db)) :
+        static_cast<bench_runner *>(new tpcc_bench_runner<Database, true>(db)));
+  }
+};
 
 void
 tpcc_do_test(const string &dbtype,
@@ -2233,44 +2256,5 @@ tpcc_do_test(const string &dbtype,
                   g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix)) << endl;
   }
 
-  unique_ptr<abstract_db> db;
-  unique_ptr<bench_runner> r;
-
-  if (dbtype == "ndb-proto2") {
-    if (!cfg.logfiles_.empty()) {
-      vector<vector<unsigned>> assignments_used;
-      txn_logger::Init(
-          nthreads, cfg.logfiles_, cfg.assignments_, &assignments_used,
-          !cfg.nofsync_,
-          cfg.do_compress_,
-          cfg.fake_writes_);
-      if (verbose) {
-        cerr << "[logging subsystem]" << endl;
-        cerr << "  assignments: " << assignments_used  << endl;
-        cerr << "  call fsync : " << !cfg.nofsync_     << endl;
-        cerr << "  compression: " << cfg.do_compress_  << endl;
-        cerr << "  fake_writes: " << cfg.fake_writes_  << endl;
-      }
-    }
-#ifdef PROTO2_CAN_DISABLE_GC
-    if (!cfg.disable_gc_)
-      transaction_proto2_static::InitGC();
-#endif
-#ifdef PROTO2_CAN_DISABLE_SNAPSHOTS
-    if (cfg.disable_snapshots_)
-      transaction_proto2_static::DisableSnapshots();
-#endif
-    typedef ndb_database<transaction_proto2> Database;
-    Database *raw = new Database;
-    db.reset(raw);
-    r = MakeBenchRunner(raw);
-  } else if (dbtype == "kvdb-st") {
-    typedef kvdb_database<false> Database;
-    Database *raw = new Database;
-    db.reset(raw);
-    r = MakeBenchRunner(raw);
-  } else
-    ALWAYS_ASSERT(false);
-
-  r->run();
+  RunBenchWith(dbtype, cfg, tpcc_runner_maker());
 }
@@ -0,0 +1,700 @@
+#ifndef _WAL_DATABASE_H_
+#define _WAL_DATABASE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "abstract_db.h"
+#include "../btree_choice.h"
+#include "../fileutils.h"
+#include "../macros.h"
+#include "../rcu.h"
+#include "../txn.h"
+#include "../typed_txn_btree.h"
+
+/**
+ * An embedded key-value store with the write path of the usual LSM stores
+ * (RocksDB, LevelDB), for the benchmarks to compare ndb against. It stands in
+ * for such a store here, since none can be built alongside the tree.
+ *
+ * Each index is a memtable of immutable records (a concurrent_btree of
+ * pointers to them, the old records being freed through RCU), which is never
+ * flushed. A txn buffers its writes in a write batch. At commit, it queues
+ * its batch, and commits go in groups, as in those stores: the committer at
+ * the head of the queue leads the batches queued behind it, appending them to
+ * the write-ahead log in one write (fdatasync'ing it once unless
+ * --log-nofsync), then applying them to the memtables in queue order, then
+ * waking their committers. So commits are atomic and durable, and a log sync
+ * is shared by the txns which came in while the one before it ran, but
+ * nothing is isolated: reads see the
+ * latest committed records, plus the txn's own pending point writes (not in
+ * scans), as with a plain WriteBatch. Txns never abort.
+ *
+ * A batch is logged as [nops (4)], then per op
+ * [index id (4)][klen (4)][vlen (4), ~0 for a remove][key][value]. The log is
+ * only written, never replayed. Txns are made by the benchmarks from just
+ * their flags and arena, so there is one log per process (see Instance())
+ */
+class wal_log {
+public:
+
+  static const uint32_t RemoveLen = std::numeric_limits<uint32_t>::max();
+
+  // an immutable record of the memtable
+  struct record {
+    uint32_t alloc_size;
+    uint32_t size;
+    char data[0];
+
+    static record *
+    alloc(const std::string &v)
+    {
+      const size_t alloc_sz = sizeof(record) + v.size();
+      record * const r =
+        reinterpret_cast<record *>(rcu::s_instance.alloc(alloc_sz));
+      INVARIANT(r);
+      r->alloc_size = alloc_sz;
+      r->size = v.size();
+      NDB_MEMCPY(&r->data[0], v.data(), v.size());
+      return r;
+    }
+
+    static void
+    deleter(void *p)
+    {
+      record * const r = reinterpret_cast<record *>(p);
+      rcu::s_instance.dealloc(r, r->alloc_size);
+    }
+
+    static void
+    release(record *r)
+    {
+      if (r)
+        rcu::s_instance.free_with_fn(r, deleter);
+    }
+  } PACKED;
+
+  // the memtable of an index
+  struct memtable {
+    memtable(uint32_t id) : id(id) {}
+
+    uint32_t id;
+    concurrent_btree btr;
+
+    // caller is in an RCU region
+    inline const record *
+    get(const std::string &k) const
+    {
+      concurrent_btree::value_type v = 0;
+      if (!btr.search(varkey(k), v))
+        return nullptr;
+      return reinterpret_cast<const record *>(v);
+    }
+
+    // only called by the committer. v is null for a remove
+    void
+    apply(const std::string &k, const std::string *v)
+    {
+      concurrent_btree::value_type old = 0;
+      if (v) {
+        btr.insert(varkey(k), (concurrent_btree::value_type) record::alloc(*v),
+                   &old, nullptr);
+      } else if (!btr.remove(varkey(k), &old)) {
+        return;
+      }
+      record::release(reinterpret_cast<record *>(old));
+    }
+
+    // not thread safe
+    void
+    clear()
+    {
+      struct walker : public concurrent_btree::tree_walk_callback {
+        virtual void
+        on_node_begin(const concurrent_btree::node_opaque_t *n)
+        {
+          values = concurrent_btree::ExtractValues(n);
+        }
+        virtual void
+        on_node_success()
+        {
+          for (auto &p : values)
+            record::deleter((void *) p.first);
+          values.clear();
+        }
+        virtual void
+        on_node_failure()
+        {
+          values.clear();
+        }
+        std::vector<std::pair<concurrent_btree::value_type, bool>> values;
+      } w;
+      btr.tree_walk(w);
+      btr.clear();
+    }
+  };
+
+  // a write of the batch. removed writes have no value
+  struct write {
+    memtable *table;
+    const std::string *key;
+    const std::string *value;
+  };
+
+  // a group is cut once its log records reach this many bytes (but has the
+  // leader's at least)
+  static const size_t MaxGroupBytes = 1 << 20;
+
+  // fname empty for no log
+  wal_log(const std::string &fname, bool fsync)
+    : fd(-1), fsync(fsync), nbytes_logged(0)
+  {
+    if (fname.empty())
+      return;
+    fd = open(fname.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0664);
+    ALWAYS_ASSERT(fd >= 0);
+  }
+
+  ~wal_log()
+  {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // the log of the open wal_database
+  static wal_log *&
+  Instance()
+  {
+    static wal_log *s_log;
+    return s_log;
+  }
+
+  void
+  commit(const std::vector<write> &batch)
+  {
+    if (batch.empty())
+      return;
+    std::string &buf = logbuf();
+    if (fd >= 0) {
+      buf.clear();
+      Append(buf, batch.size());
+      for (auto &w : batch) {
+        Append(buf, w.table->id);
+        Append(buf, w.key->size());
+        Append(buf, w.value ? w.value->size() : RemoveLen);
+        buf.append(*w.key);
+        if (w.value)
+          buf.append(*w.value);
+      }
+    }
+    committer me{&batch, &buf, false};
+    std::unique_lock<std::mutex> l(mutex);
+    queue.push_back(&me);
+    cv.wait(l, [this, &me]() { return me.done || queue.front() == &me; });
+    if (me.done)
+      return;
+
+    // the leader: the queue's head stays put until the group is done, so
+    // one group at a time is logged and applied
+    size_t n = 0, nbytes = 0;
+    while (n < queue.size() &&
+           (!n || nbytes + queue[n]->buf->size() <= MaxGroupBytes))
+      nbytes += queue[n++]->buf->size();
+    const std::vector<committer *> group(queue.begin(), queue.begin() + n);
+    l.unlock();
+    if (fd >= 0) {
+      groupbuf.clear();
+      for (auto c : group)
+        groupbuf.append(*c->buf);
+      ALWAYS_ASSERT(!fileutils::writeall(fd, groupbuf.data(), groupbuf.size()));
+      if (fsync)
+        ALWAYS_ASSERT(!fdatasync(fd));
+      nbytes_logged.fetch_add(groupbuf.size(), std::memory_order_relaxed);
+    }
+    for (auto c : group)
+      for (auto &w : *c->batch)
+        w.table->apply(*w.key, w.value);
+    l.lock();
+    queue.erase(queue.begin(), queue.begin() + n);
+    for (auto c : group)
+      c->done = true;
+    l.unlock();
+    // the group's committers return, and the next head leads
+    cv.notify_all();
+  }
+
+  std::atomic<uint64_t> &
+  nbytes()
+  {
+    return nbytes_logged;
+  }
+
+private:
+
+  // a commit waiting in the queue
+  struct committer {
+    const std::vector<write> *batch;
+    const std::string *buf; // its log records
+    bool done;
+  };
+
+  static inline void
+  Append(std::string &buf, uint32_t v)
+  {
+    buf.append((const char *) &v, sizeof(v));
+  }
+
+  static std::string &
+  logbuf()
+  {
+    static __thread std::string *tl_buf;
+    if (unlikely(!tl_buf))
+      tl_buf = new std::string;
+    return *tl_buf;
+  }
+
+  int fd;
+  bool fsync;
+  std::mutex mutex; // guards queue and the committers' done
+  std::condition_variable cv;
+  std::deque<committer *> queue; // the head leads
+  std::string groupbuf; // only used by the leader
+  std::atomic<uint64_t> nbytes_logged;
+};
+
+class wal_txn {
+public:
+  inline wal_txn(uint64_t, str_arena &a)
+    : a(&a), log(wal_log::Instance())
+  {
+    INVARIANT(log);
+  }
+  inline str_arena & string_allocator() { return *a; }
+
+  inline bool
+  commit()
+  {
+    log->commit(batch);
+    batch.clear();
+    return true;
+  }
+
+  inline void
+  abort()
+  {
+    batch.clear();
+  }
+
+  // the txn's latest pending write of k in table, null if none
+  inline const wal_log::write *
+  pending(const wal_log::memtable *table, const std::string &k) const
+  {
+    for (auto it = batch.rbegin(); it != batch.rend(); ++it)
+      if (it->table == table && *it->key == k)
+        return &*it;
+    return nullptr;
+  }
+
+  // k and v are from the txn's string allocator, so live until it ends
+  inline void
+  add(wal_log::memtable *table, const std::string *k, const std::string *v)
+  {
+    batch.push_back({table, k, v});
+  }
+
+private:
+  str_arena *a;
+  wal_log *log;
+  std::vector<wal_log::write> batch;
+  scoped_rcu_region region;
+};
+
+template <typename Schema>
+class wal_index : public abstract_ordered_index {
+public:
+
+  typedef typename Schema::base_type base_type;
+  typedef typename Schema::key_type key_type;
+  typedef typename Schema::value_type value_type;
+  typedef typename Schema::value_descriptor_type value_descriptor_type;
+  typedef typename Schema::key_encoder_type key_encoder_type;
+  typedef typename Schema::value_encoder_type value_encoder_type;
+
+  static const uint64_t AllFieldsMask = typed_txn_btree_<Schema>::AllFieldsMask;
+  typedef util::Fields<AllFieldsMask> AllFields;
+
+  struct search_range_callback {
+  public:
+    virtual ~search_range_callback() {}
+    virtual bool invoke(const key_type &k, const value_type &v) = 0;
+  };
+
+  struct bytes_search_range_callback {
+  public:
+    virtual ~bytes_search_range_callback() {}
+    virtual bool invoke(const std::string &k, const std::string &v) = 0;
+  };
+
+private:
+
+  typedef txn_btree_::key_reader bytes_key_reader;
+  typedef txn_btree_::value_reader bytes_value_reader;
+
+  typedef typename typed_txn_btree_<Schema>::key_writer key_writer;
+  typedef typename typed_txn_btree_<Schema>::key_reader key_reader;
+  typedef typename typed_txn_btree_<Schema>::value_writer value_writer;
+  typedef
+    typename typed_txn_btree_<Schema>::single_value_reader
+    single_value_reader;
+  typedef typename typed_txn_btree_<Schema>::value_reader value_reader;
+
+  template <typename Callback, typename KeyReader, typename ValueReader>
+  class wal_search_range_callback :
+    public concurrent_btree::search_range_callback {
+  public:
+    wal_search_range_callback(
+        Callback &upcall, KeyReader &kr, ValueReader &vr, str_arena &arena)
+      : upcall(&upcall), kr(&kr), vr(&vr), arena(&arena) {}
+
+    virtual bool
+    invoke(const concurrent_btree::string_type &k,
+           concurrent_btree::value_type v)
+    {
+      const wal_log::record * const r =
+        reinterpret_cast<const wal_log::record *>(v);
+      (*vr)((const uint8_t *) &r->data[0], r->size, *arena);
+      return upcall->invoke((*kr)(k), vr->results());
+    }
+
+  private:
+    Callback *upcall;
+    KeyReader *kr;
+    ValueReader *vr;
+    str_arena *arena;
+  };
+
+public:
+
+  wal_index(uint32_t id, const std::string &name)
+    : table(id), name(name)
+  {}
+
+  // virtual interface
+
+  virtual size_t
+  size() const OVERRIDE
+  {
+    return table.btr.size();
+  }
+
+  virtual std::map<std::string, uint64_t>
+  clear() OVERRIDE
+  {
+    table.clear();
+    return std::map<std::string, uint64_t>();
+  }
+
+  // templated interface, as kvdb_index's
+
+  template <typename FieldsMask = AllFields>
+  inline bool
+  search(wal_txn &t, const key_type &k, value_type &v,
+         FieldsMask fm = FieldsMask())
+  {
+    const std::string *keypx = encode_key(t, k);
+    const uint8_t *data;
+    size_t sz;
+    if (!lookup(t, *keypx, data, sz))
+      return false;
+    single_value_reader vr(v, FieldsMask::value);
+    return vr(data, sz, t.string_allocator());
+  }
+
+  // typed_txn_btree::index_join(), one search() at a time
+  template <typename Outer, typename InnerKey, typename Callback,
+            typename FieldsMask = AllFields>
+  inline size_t
+  index_join(wal_txn &t, const std::vector<Outer> &outer,
+             InnerKey inner_key, Callback callback,
+             FieldsMask fm = FieldsMask())
+  {
+    size_t nfound = 0;
+    for (auto &o : outer) {
+      const key_type k = inner_key(o);
+      value_type v;
+      if (search(t, k, v, fm)) {
+        callback(o, k, v);
+        nfound++;
+      }
+    }
+    return nfound;
+  }
+
+  template <typename FieldsMask = AllFields>
+  inline void
+  search_range_call(
+      wal_txn &t, const key_type &lower, const key_type *upper,
+      search_range_callback &callback,
+      bool no_key_results = false,
+      FieldsMask fm = FieldsMask())
+  {
+    key_reader kr(no_key_results);
+    value_reader vr(FieldsMask::value);
+    do_search_range_call(t, lower, upper, callback, kr, vr);
+  }
+
+  inline void
+  bytes_search_range_call(
+      wal_txn &t, const key_type &lower, const key_type *upper,
+      bytes_search_range_callback &callback,
+      size_t value_fields_prefix = std::numeric_limits<size_t>::max())
+  {
+    const value_encoder_type value_encoder;
+    bytes_key_reader kr;
+    bytes_value_reader vr(
+        value_encoder.encode_max_nbytes_prefix(value_fields_prefix));
+    do_search_range_call(t, lower, upper, callback, kr, vr);
+  }
+
+  template <typename FieldsMask = AllFields>
+  inline void
+  put(wal_txn &t, const key_type &k, const value_type &v,
+      FieldsMask fm = FieldsMask())
+  {
+    if (unlikely(!secondary_indexes.empty()))
+      update_secondary_entries(t, k, &v, FieldsMask::value);
+    const std::string *keypx = encode_key(t, k);
+    const uint8_t *data;
+    size_t sz;
+    const bool exists = lookup(t, *keypx, data, sz);
+    value_writer vw(&v, FieldsMask::value);
+    if (exists && !typed_txn_btree_<Schema>::IsAllFields(FieldsMask::value)) {
+      // the fields not written are carried over from the current record
+      const size_t needed = vw.compute_needed(data, sz);
+      std::string * const px = t.string_allocator()();
+      px->assign((const char *) data, sz);
+      px->resize(std::max(sz, needed));
+      vw((uint8_t *) &(*px)[0], sz);
+      px->resize(needed);
+      t.add(&table, keypx, px);
+      return;
+    }
+    t.add(&table, keypx, vw.fully_materialize(false, t.string_allocator()));
+  }
+
+  // k is not searched for (but by the secondary indexes, if any), so that
+  // loading a big batch does not search the batch for every key
+  inline void
+  insert(wal_txn &t, const key_type &k, const value_type &v)
+  {
+    if (unlikely(!secondary_indexes.empty()))
+      update_secondary_entries(t, k, &v, AllFieldsMask);
+    const std::string *keypx = encode_key(t, k);
+    value_writer vw(&v, AllFieldsMask);
+    t.add(&table, keypx, vw.fully_materialize(false, t.string_allocator()));
+  }
+
+  inline void
+  remove(wal_txn &t, const key_type &k)
+  {
+    if (unlikely(!secondary_indexes.empty()))
+      update_secondary_entries(t, k, nullptr, 0);
+    t.add(&table, encode_key(t, k), nullptr);
+  }
+
+  // see typed_txn_btree::add_secondary_index()
+  template <typename IndexSchema>
+  void
+  add_secondary_index(
+      wal_index<IndexSchema> &idx,
+      bool (*extract)(const key_type &k, const value_type &v,
+                      typename IndexSchema::key_type &ik,
+                      typename IndexSchema::value_type &iv))
+  {
+    wal_index<IndexSchema> * const px = &idx;
+    secondary_indexes.push_back(
+        [px, extract](wal_txn &t, const key_type &k,
+                      const value_type *old_v, const value_type *new_v) {
+          typename IndexSchema::key_type old_ik, ik;
+          typename IndexSchema::value_type old_iv, iv;
+          const bool has_old = old_v && extract(k, *old_v, old_ik, old_iv);
+          const bool has_new = new_v && extract(k, *new_v, ik, iv);
+          const bool moved = has_old && (!has_new || old_ik != ik);
+          if (moved)
+            px->remove(t, old_ik);
+          if (has_new && (!has_old || moved || old_iv != iv))
+            px->put(t, ik, iv);
+        });
+  }
+
+  // see typed_txn_btree::aggregate(). the record is read, folded into and
+  // written back
+  template <aggregate_op Op, typename FieldsMask = AllFields>
+  inline bool
+  aggregate(wal_txn &t, const key_type &k, const value_type &v,
+            FieldsMask fm = FieldsMask())
+  {
+    value_type cur;
+    if (!search(t, k, cur, fm))
+      return false;
+    typed_txn_btree_<Schema>::aggregate_fields(&cur, &v, FieldsMask::value, Op);
+    put(t, k, cur, fm);
+    return true;
+  }
+
+private:
+
+  inline const std::string *
+  encode_key(wal_txn &t, const key_type &k)
+  {
+    key_writer kw(&k);
+    return kw.fully_materialize(false, t.string_allocator());
+  }
+
+  // the txn's pending write of k if it has one, else the committed record
+  inline bool
+  lookup(wal_txn &t, const std::string &k, const uint8_t *&data, size_t &sz)
+  {
+    const wal_log::write * const w = t.pending(&table, k);
+    if (w) {
+      if (!w->value)
+        return false;
+      data = (const uint8_t *) w->value->data();
+      sz = w->value->size();
+      return true;
+    }
+    const wal_log::record * const r = table.get(k);
+    if (!r)
+      return false;
+    data = (const uint8_t *) &r->data[0];
+    sz = r->size;
+    return true;
+  }
+
+  template <typename Callback, typename KeyReader, typename ValueReader>
+  inline void
+  do_search_range_call(
+      wal_txn &t, const key_type &lower, const key_type *upper,
+      Callback &callback, KeyReader &kr, ValueReader &vr)
+  {
+    const std::string * const lower_str = encode_key(t, lower);
+    const std::string * const upper_str =
+      upper ? encode_key(t, *upper) : nullptr;
+    wal_search_range_callback<Callback, KeyReader, ValueReader>
+      c(callback, kr, vr, t.string_allocator());
+    varkey uppervk;
+    if (upper_str)
+      uppervk = varkey(*upper_str);
+    table.btr.search_range_call(
+        varkey(*lower_str), upper_str ? &uppervk : nullptr, c,
+        t.string_allocator()());
+  }
+
+  // replaces the entries of the record at k (as the txn sees it) with those
+  // of the record a write of the fields in fields of v (a removal if v is
+  // null) makes
+  inline void
+  update_secondary_entries(wal_txn &t, const key_type &k,
+                           const value_type *v, uint64_t fields)
+  {
+    value_type old_v, new_v;
+    const bool had = search(t, k, old_v);
+    if (v) {
+      new_v = *v;
+      if (had && !typed_txn_btree_<Schema>::IsAllFields(fields)) {
+        new_v = old_v;
+        typed_txn_btree_<Schema>::CopyFields(&new_v, v, fields);
+      }
+    }
+    for (auto &f : secondary_indexes)
+      f(t, k, had ? &old_v : nullptr, v ? &new_v : nullptr);
+  }
+
+  wal_log::memtable table;
+  std::string name;
+  std::vector<
+    std::function<void (wal_txn &, const key_type &,
+                        const value_type *, const value_type *)>>
+    secondary_indexes;
+};
+
+class wal_database : public abstract_db {
+public:
+
+  template <typename Schema>
+  struct IndexType {
+    typedef wal_index<Schema> type;
+    typedef std::shared_ptr<type> ptr_type;
+  };
+
+  template <enum abstract_db::TxnProfileHint hint>
+  struct TransactionType
+  {
+    typedef wal_txn type;
+    typedef std::shared_ptr<type> ptr_type;
+  };
+
+  // logfile empty for no log. only one can be open at a time
+  wal_database(const std::string &logfile, bool fsync)
+    : log(new wal_log(logfile, fsync)), next_index_id(0)
+  {
+    ALWAYS_ASSERT(!wal_log::Instance());
+    wal_log::Instance() = log.get();
+  }
+
+  ~wal_database()
+  {
+    wal_log::Instance() = nullptr;
+  }
+
+  template <enum abstract_db::TxnProfileHint hint>
+  inline typename TransactionType<hint>::ptr_type
+  new_txn(uint64_t txn_flags, str_arena &arena) const
+  {
+    return std::make_shared<typename TransactionType<hint>::type>(
+        txn_flags, arena);
+  }
+
+  typedef transaction_abort_exception abort_exception_type;
+
+  uint64_t
+  get_nbytes_logged() const OVERRIDE
+  {
+    return log->nbytes().load(std::memory_order_acquire);
+  }
+
+  void
+  reset_ntxn_persisted() OVERRIDE
+  {
+    log->nbytes().store(0, std::memory_order_release);
+  }
+
+  template <typename Schema>
+  inline typename IndexType<Schema>::ptr_type
+  open_index(const std::string &name,
+             size_t value_size_hint,
+             bool mostly_append)
+  {
+    return std::make_shared<typename IndexType<Schema>::type>(
+        next_index_id++, name);
+  }
+
+private:
+  std::unique_ptr<wal_log> log;
+  std::atomic<uint32_t> next_index_id;
+};
+
+#endif /* _WAL_DATABASE_H_ */
@@ -0,0 +1,519 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+#include <atomic>
+#include <limits>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "../macros.h"
+#include "../util.h"
+#include "../core.h"
+#include "../record/encoder.h"
+#include "../record/inline_str.h"
+#include "../benchmarks/ycsb_key_chooser.h"
+
+#include "bench.h"
+#include "run_bench.h"
+
+using namespace std;
+using namespace util;
+
+static size_t nkeys;
+static const size_t YCSBRecordSize = 100;
+
+// scans read [1, YCSBMaxScanLength] keys, uniformly
+static const size_t YCSBMaxScanLength = 100;
+
+// [R, W, RMW, Scan, Insert], as in benchmarks/ycsb.cc
+static unsigned g_txn_workload_mix[] = { 80, 20, 0, 0, 0 };
+
+static ycsb_key_chooser g_key_chooser;
+
+// inserted keys are striped over the workers, as in benchmarks/ycsb.cc: the
+// i-th insert of worker w is key nkeys + i * nthreads + w, and the keys which
+// exist for sure are those below nkeys + min(inserts) * nthreads
+static aligned_padded_elem<atomic<uint64_t>> g_ninserted[NMAXCORES];
+
+#define USERTABLE_KEY_FIELDS(x, y) \
+  x(uint64_t,k)
+#define USERTABLE_VALUE_FIELDS(x, y) \
+  x(inline_str_fixed<YCSBRecordSize>,v)
+DO_STRUCT(usertable, USERTABLE_KEY_FIELDS, USERTABLE_VALUE_FIELDS)
+
+template <typename Database>
+class ycsb_worker : public bench_worker {
+public:
+  typedef typename Database::template IndexType<schema<usertable>>::type table_type;
+
+  ycsb_worker(unsigned int worker_id,
+              unsigned long seed, Database *db,
+              const shared_ptr<table_type> &tbl,
+              spin_barrier *barrier_a, spin_barrier *barrier_b,
+              unsigned int insert_stripe)
+    : bench_worker(worker_id, true, seed, db,
+                   barrier_a, barrier_b),
+      tbl(tbl),
+      insert_stripe(insert_stripe),
+      nkeys_visible(nkeys),
+      npicks_until_refresh(0),
+      computation_n(0)
+  {
+  }
+
+  txn_result
+  txn_read()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_KV_GET_PUT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      const usertable::key k(next_key());
+      usertable::value v;
+      ALWAYS_ASSERT(tbl->search(txn, k, v));
+      computation_n += v.v.size();
+      if (likely(txn.commit()))
+        return txn_result(true, 0);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnRead(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_read();
+  }
+
+  txn_result
+  txn_write()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_KV_GET_PUT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      const usertable::key k(next_key());
+      tbl->put(txn, k, Value('b'));
+      if (likely(txn.commit()))
+        return txn_result(true, 0);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnWrite(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_write();
+  }
+
+  txn_result
+  txn_rmw()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_KV_RMW>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      const usertable::key k(next_key());
+      usertable::value v;
+      ALWAYS_ASSERT(tbl->search(txn, k, v));
+      computation_n += v.v.size();
+      tbl->put(txn, k, Value('c'));
+      if (likely(txn.commit()))
+        return txn_result(true, 0);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnRmw(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_rmw();
+  }
+
+  class worker_scan_callback : public table_type::bytes_search_range_callback {
+  public:
+    worker_scan_callback() : n(0) {}
+    virtual bool
+    invoke(const string &key, const string &value)
+    {
+      n += value.size();
+      return true;
+    }
+    size_t n;
+  };
+
+  txn_result
+  txn_scan()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_KV_SCAN>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      // keys are dense, so a range covers (at most) its length of them
+      const uint64_t kstart = next_key();
+      const usertable::key lower(kstart);
+      const usertable::key upper(kstart + next_scan_length());
+      worker_scan_callback c;
+      tbl->bytes_search_range_call(txn, lower, &upper, c);
+      computation_n += c.n;
+      if (likely(txn.commit()))
+        return txn_result(true, 0);
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnScan(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_scan();
+  }
+
+  txn_result
+  txn_insert()
+  {
+    typename Database::template
+      TransactionType<abstract_db::HINT_KV_GET_PUT>::type txn(txn_flags, this->arena);
+    scoped_str_arena s_arena(this->arena);
+    try {
+      const usertable::key k(next_insert_key());
+      tbl->insert(txn, k, Value('d'));
+      if (likely(txn.commit())) {
+        atomic<uint64_t> &n = g_ninserted[insert_stripe].elem;
+        n.store(n.load(memory_order_relaxed) + 1, memory_order_release);
+        return txn_result(true, YCSBRecordSize);
+      }
+    } catch (typename Database::abort_exception_type &e) {
+      txn.abort();
+    }
+    return txn_result(false, 0);
+  }
+
+  static txn_result
+  TxnInsert(bench_worker *w)
+  {
+    return static_cast<ycsb_worker *>(w)->txn_insert();
+  }
+
+  virtual workload_desc_vec
+  get_workload() const
+  {
+    workload_desc_vec w;
+    unsigned m = 0;
+    for (size_t i = 0; i < ARRAY_NELEMS(g_txn_workload_mix); i++)
+      m += g_txn_workload_mix[i];
+    ALWAYS_ASSERT(m == 100);
+    if (g_txn_workload_mix[0])
+      w.push_back(workload_desc("Read",  double(g_txn_workload_mix[0])/100.0, TxnRead));
+    if (g_txn_workload_mix[1])
+      w.push_back(workload_desc("Write",  double(g_txn_workload_mix[1])/100.0, TxnWrite));
+    if (g_txn_workload_mix[2])
+      w.push_back(workload_desc("ReadModifyWrite",  double(g_txn_workload_mix[2])/100.0, TxnRmw));
+    if (g_txn_workload_mix[3])
+      w.push_back(workload_desc("Scan",  double(g_txn_workload_mix[3])/100.0, TxnScan));
+    if (g_txn_workload_mix[4])
+      w.push_back(workload_desc("Insert",  double(g_txn_workload_mix[4])/100.0, TxnInsert));
+    return w;
+  }
+
+  static usertable::value
+  Value(char c)
+  {
+    usertable::value v;
+    v.v.assign(string(YCSBRecordSize, c));
+    return v;
+  }
+
+protected:
+
+  virtual void
+  on_run_setup() OVERRIDE
+  {
+    if (!pin_cpus)
+      return;
+    const size_t a = worker_id % coreid::num_cpus_online();
+    const size_t b = a % nthreads;
+    rcu::s_instance.pin_current_thread(b);
+  }
+
+  static const unsigned PicksPerRefresh = 64;
+
+  inline uint64_t
+  next_key()
+  {
+    if (g_txn_workload_mix[4] && unlikely(!npicks_until_refresh--)) {
+      uint64_t m = numeric_limits<uint64_t>::max();
+      for (size_t i = 0; i < nthreads; i++)
+        m = min(m, g_ninserted[i].elem.load(memory_order_acquire));
+      nkeys_visible = nkeys + m * nthreads;
+      npicks_until_refresh = PicksPerRefresh;
+    }
+    return g_key_chooser.next(this->r, nkeys_visible);
+  }
+
+  inline uint64_t
+  next_insert_key() const
+  {
+    const uint64_t i = g_ninserted[insert_stripe].elem.load(memory_order_relaxed);
+    return nkeys + i * nthreads + insert_stripe;
+  }
+
+  inline size_t
+  next_scan_length()
+  {
+    return 1 + this->r.next() % YCSBMaxScanLength;
+  }
+
+private:
+  shared_ptr<table_type> tbl;
+  const unsigned int insert_stripe; // in [0, nthreads)
+  uint64_t nkeys_visible;
+  unsigned npicks_until_refresh;
+
+  uint64_t computation_n;
+};
+
+// loads keys [keystart, keyend), on cpu pinid if pinid != -1
+template <typename Database>
+class ycsb_usertable_loader : public typed_bench_loader<Database> {
+public:
+  typedef typename Database::template IndexType<schema<usertable>>::type table_type;
+
+  ycsb_usertable_loader(unsigned long seed,
+                        Database *db,
+                        const shared_ptr<table_type> &tbl,
+                        ssize_t pinid,
+                        uint64_t keystart,
+                        uint64_t keyend)
+    : typed_bench_loader<Database>(seed, db),
+      tbl(tbl), pinid(pinid), keystart(keystart), keyend(keyend)
+  {
+    INVARIANT(keyend > keystart);
+  }
+
+protected:
+  virtual void
+  load()
+  {
+    if (pin_cpus && pinid != -1) {
+      rcu::s_instance.pin_current_thread(pinid);
+      rcu::s_instance.fault_region();
+    }
+    const size_t batchsize =
+      (LoadBatchSize(this->typed_db()) == -1) ?
+        10000 : LoadBatchSize(this->typed_db());
+    const usertable::value v(ycsb_worker<Database>::Value('a'));
+    for (uint64_t b = keystart; b < keyend;) {
+      scoped_str_arena s_arena(this->arena);
+      typename Database::template
+        TransactionType<abstract_db::HINT_DEFAULT>::type txn(txn_flags, this->arena);
+      const uint64_t bend = min(b + batchsize, keyend);
+      try {
+        for (uint64_t i = b; i < bend; i++)
+          tbl->insert(txn, usertable::key(i), v);
+        if (txn.commit())
+          b = bend;
+      } catch (typename Database::abort_exception_type &e) {
+        txn.abort();
+      }
+    }
+    if (verbose)
+      cerr << "[INFO] finished loading USERTABLE range [kstart="
+        << keystart << ", kend=" << keyend << ")" << endl;
+  }
+
+private:
+  shared_ptr<table_type> tbl;
+  ssize_t pinid;
+  uint64_t keystart;
+  uint64_t keyend;
+};
+
+template <typename Database>
+class ycsb_bench_runner : public typed_bench_runner<Database> {
+public:
+  ycsb_bench_runner(Database *db)
+    : typed_bench_runner<Database>(db)
+  {
+    tbl = db->template open_index<schema<usertable>>(
+        "USERTABLE", sizeof(usertable::value), false);
+    this->open_tables["USERTABLE"] = tbl;
+  }
+
+protected:
+  virtual vector<unique_ptr<bench_loader>>
+  make_loaders()
+  {
+    vector<unique_ptr<bench_loader>> ret;
+    if (enable_parallel_loading && nkeys >= nthreads) {
+      // each worker's cpu loads a slice, so the slices land on the workers'
+      // numa nodes
+      const size_t nkeysperloader = nkeys / nthreads;
+      for (size_t i = 0; i < nthreads; i++) {
+        const uint64_t kend = (i + 1 == nthreads) ?
+          nkeys : (i + 1) * nkeysperloader;
+        ret.emplace_back(
+            new ycsb_usertable_loader<Database>(
+              0, this->typed_db(), tbl, i, i * nkeysperloader, kend));
+      }
+    } else {
+      ret.emplace_back(
+          new ycsb_usertable_loader<Database>(
+            0, this->typed_db(), tbl, -1, 0, nkeys));
+    }
+    return ret;
+  }
+
+  virtual vector<unique_ptr<bench_worker>>
+  make_workers()
+  {
+    const unsigned alignment = coreid::num_cpus_online();
+    const int blockstart =
+      coreid::allocate_contiguous_aligned_block(nthreads, alignment);
+    ALWAYS_ASSERT(blockstart >= 0);
+    ALWAYS_ASSERT((blockstart % alignment) == 0);
+    fast_random r(8544290);
+    vector<unique_ptr<bench_worker>> ret;
+    for (size_t i = 0; i < nthreads; i++)
+      ret.emplace_back(
+        new ycsb_worker<Database>(
+          blockstart + i, r.next(), this->typed_db(), tbl,
+          &this->barrier_a, &this->barrier_b, i));
+    return ret;
+  }
+
+private:
+  typename Database::template IndexType<schema<usertable>>::ptr_type tbl;
+};
+
+void
+ycsb_do_test(const string &dbtype,
+             const persistconfig &cfg,
+             int argc, char **argv)
+{
+  nkeys = size_t(scale_factor * 1000.0);
+  ALWAYS_ASSERT(nkeys > 0);
+
+  // parse options
+  ycsb_key_chooser::dist key_dist = ycsb_key_chooser::DIST_UNIFORM;
+  double zipf_theta = 0.99;
+  double hotspot_keys = 0.2;
+  double hotspot_ops = 0.8;
+  bool key_dist_given = false;
+  const ycsb_core_workload *core_workload = nullptr;
+
+  optind = 1;
+  while (1) {
+    static struct option long_options[] = {
+      {"workload-mix"     , required_argument , 0 , 'w'}, // R,W,RMW,Scan[,Insert]
+      {"workload"         , required_argument , 0 , 'W'}, // YCSB core workload A-F
+      {"key-dist"         , required_argument , 0 , 'd'}, // see ycsb_key_chooser
+      {"zipf-theta"       , required_argument , 0 , 'z'},
+      {"hotspot-keys"     , required_argument , 0 , 'k'}, // fraction of keys which are hot
+      {"hotspot-ops"      , required_argument , 0 , 'o'}, // fraction of picks of hot keys
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "w:W:d:z:k:o:", long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 0:
+      if (long_options[option_index].flag != 0)
+        break;
+      abort();
+      break;
+
+    case 'w':
+      {
+        const vector<string> toks = split(optarg, ',');
+        ALWAYS_ASSERT(toks.size() == ARRAY_NELEMS(g_txn_workload_mix) ||
+                      toks.size() == ARRAY_NELEMS(g_txn_workload_mix) - 1);
+        g_txn_workload_mix[ARRAY_NELEMS(g_txn_workload_mix) - 1] = 0;
+        unsigned s = 0;
+        for (size_t i = 0; i < toks.size(); i++) {
+          unsigned p = strtoul(toks[i].c_str(), nullptr, 10);
+          ALWAYS_ASSERT(p >= 0 && p <= 100);
+          s += p;
+          g_txn_workload_mix[i] = p;
+        }
+        ALWAYS_ASSERT(s == 100);
+      }
+      break;
+
+    case 'W':
+      for (auto &w : g_core_workloads)
+        if (toupper(optarg[0]) == w.name_ && !optarg[1])
+          core_workload = &w;
+      if (!core_workload) {
+        cerr << "[ERROR] unknown YCSB workload " << optarg << endl;
+        exit(1);
+      }
+      break;
+
+    case 'd':
+      if (!ycsb_key_chooser::ParseDist(optarg, key_dist)) {
+        cerr << "[ERROR] unknown key distribution " << optarg << endl;
+        exit(1);
+      }
+      key_dist_given = true;
+      break;
+
+    case 'z':
+      zipf_theta = strtod(optarg, nullptr);
+      break;
+
+    case 'k':
+      hotspot_keys = strtod(optarg, nullptr);
+      break;
+
+    case 'o':
+      hotspot_ops = strtod(optarg, nullptr);
+      break;
+
+    case '?':
+      /* getopt_long already printed an error message. */
+      exit(1);
+
+    default:
+      abort();
+    }
+  }
+
+  // a core workload overrides --workload-mix, but not --key-dist
+  if (core_workload) {
+    NDB_MEMCPY(g_txn_workload_mix, core_workload->mix_, sizeof(g_txn_workload_mix));
+    if (!key_dist_given)
+      key_dist = core_workload->dist_;
+  }
+
+  if (verbose) {
+    cerr << "ycsb settings:" << endl;
+    if (core_workload)
+      cerr << "  workload    : " << core_workload->name_ << endl;
+    cerr << "  workload_mix: "
+         << format_list(g_txn_workload_mix, g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix))
+         << endl;
+    cerr << "  key_dist    : " << ycsb_key_chooser::DistName(key_dist) << endl;
+    if (key_dist == ycsb_key_chooser::DIST_HOTSPOT) {
+      cerr << "  hotspot_keys: " << hotspot_keys << endl;
+      cerr << "  hotspot_ops : " << hotspot_ops << endl;
+    } else if (key_dist != ycsb_key_chooser::DIST_UNIFORM) {
+      cerr << "  zipf_theta  : " << zipf_theta << endl;
+    }
+  }
+
+  g_key_chooser.init(key_dist, nkeys, zipf_theta, hotspot_keys, hotspot_ops);
+
+  RunBench<ycsb_bench_runner>(dbtype, cfg);
+}
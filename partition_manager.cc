@@ -0,0 +1,32 @@
+#include <malloc.h>
+#include <new>
+
+#include "partition_manager.h"
+
+using namespace std;
+using namespace util;
+
+size_t partition_manager::g_npartitions = 0;
+aligned_padded_elem<spinlock> *partition_manager::g_locks = nullptr;
+
+void
+partition_manager::Init(size_t npartitions)
+{
+  if (g_locks) {
+    for (size_t i = 0; i < g_npartitions; i++) {
+      ALWAYS_ASSERT(!g_locks[i].elem.is_locked());
+      g_locks[i].~aligned_padded_elem<spinlock>();
+    }
+    free(g_locks);
+    g_locks = nullptr;
+  }
+  g_npartitions = npartitions;
+  if (!npartitions)
+    return;
+  void * const px =
+    memalign(CACHELINE_SIZE, sizeof(aligned_padded_elem<spinlock>) * npartitions);
+  ALWAYS_ASSERT(px);
+  g_locks = reinterpret_cast<aligned_padded_elem<spinlock> *>(px);
+  for (size_t i = 0; i < npartitions; i++)
+    new (&g_locks[i]) aligned_padded_elem<spinlock>();
+}
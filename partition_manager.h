@@ -0,0 +1,66 @@
+#ifndef _NDB_PARTITION_MANAGER_H_
+#define _NDB_PARTITION_MANAGER_H_
+
+#include "macros.h"
+#include "spinlock.h"
+#include "util.h"
+
+/**
+ * Partitioned (shared-nothing) execution. Tables may be bound to one of
+ * NPartitions() partitions (see base_txn_btree::set_partition()), usually by
+ * opening a table per partition and routing each key to the table of the
+ * partition which owns it. A txn may enter the partitions it touches before
+ * it does anything else (see transaction::enter_partitions()), and then holds
+ * their locks, in partition order, until it commits or aborts:
+ *
+ *   - a txn which entered a single partition is the only one running
+ *     against that partition's tables. its reads of them are not tracked, so
+ *     they are neither validated at commit nor can they abort it (and their
+ *     cache lines stay on the core which runs the partition). its reads of
+ *     other tables are tracked as usual
+ *   - a txn which entered several partitions runs the normal protocol,
+ *     validating everything it read
+ *
+ * Its writes are installed as usual either way, so txns which do not enter
+ * any partition can still read partitioned tables (and are validated as
+ * usual). But once partitioned txns are running, every txn which writes to a
+ * partitioned table must have entered the table's partition.
+ */
+class partition_manager {
+public:
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_npartitions;
+  }
+
+  // should be called before any txns run. 0 disables partitioned execution
+  static void Init(size_t npartitions);
+
+  static inline size_t
+  NPartitions()
+  {
+    return g_npartitions;
+  }
+
+  static inline void
+  Lock(unsigned p)
+  {
+    INVARIANT(p < g_npartitions);
+    g_locks[p].elem.lock();
+  }
+
+  static inline void
+  Unlock(unsigned p)
+  {
+    INVARIANT(p < g_npartitions);
+    g_locks[p].elem.unlock();
+  }
+
+private:
+  static size_t g_npartitions;
+  static util::aligned_padded_elem<spinlock> *g_locks;
+};
+
+#endif /* _NDB_PARTITION_MANAGER_H_ */
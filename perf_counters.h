@@ -0,0 +1,149 @@
+#ifndef _NDB_PERF_COUNTERS_H_
+#define _NDB_PERF_COUNTERS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "macros.h"
+
+/**
+ * The hardware counters of the calling thread (user space only), read as
+ * one group through perf_event_open(2), for attributing the cost of txns to
+ * cache and TLB behavior without a kernel module (which scopedperf's rdpmc
+ * counters need).
+ *
+ * Counters the hardware (or the VM) doesn't have read as 0. A group the
+ * kernel won't give us at all (ie perf_event_paranoid) is not open(), and
+ * reads nothing
+ */
+class perf_counter_group {
+public:
+
+  enum ctr {
+    CYCLES,
+    INSTRUCTIONS,
+    LLC_MISSES,
+    DTLB_MISSES,
+    BRANCH_MISSES,
+    NCounters,
+  };
+
+  static inline const char *
+  Name(size_t c)
+  {
+    static const char *const names[NCounters] = {
+      "cycles",
+      "instructions",
+      "llc_misses",
+      "dtlb_misses",
+      "branch_misses",
+    };
+    INVARIANT(c < NCounters);
+    return names[c];
+  }
+
+  perf_counter_group() : nopen_(0)
+  {
+    for (size_t c = 0; c < NCounters; c++)
+      fds_[c] = -1;
+  }
+
+  ~perf_counter_group()
+  {
+    for (size_t c = 0; c < NCounters; c++)
+      if (fds_[c] != -1)
+        close(fds_[c]);
+  }
+
+  perf_counter_group(const perf_counter_group &) = delete;
+  perf_counter_group(perf_counter_group &&) = delete;
+  perf_counter_group &operator=(const perf_counter_group &) = delete;
+
+  // starts counting for the calling thread. returns false if not even the
+  // cycle counter could be opened
+  bool
+  open()
+  {
+    INVARIANT(!is_open());
+    for (size_t c = 0; c < NCounters; c++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      Config(ctr(c), attr);
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      const int leader = fds_[CYCLES];
+      fds_[c] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fds_[c] == -1) {
+        if (c == CYCLES)
+          return false;
+        continue;
+      }
+      // a group's values are read in the order its counters were opened
+      slots_[nopen_++] = c;
+    }
+    return true;
+  }
+
+  inline bool
+  is_open() const
+  {
+    return fds_[CYCLES] != -1;
+  }
+
+  // v has NCounters values
+  inline void
+  read(uint64_t *v) const
+  {
+    memset(v, 0, NCounters * sizeof(*v));
+    if (!is_open())
+      return;
+    uint64_t buf[1 + NCounters];
+    const ssize_t sz = (1 + nopen_) * sizeof(uint64_t);
+    if (::read(fds_[CYCLES], buf, sz) != sz)
+      return;
+    INVARIANT(buf[0] == nopen_);
+    for (size_t i = 0; i < nopen_; i++)
+      v[slots_[i]] = buf[1 + i];
+  }
+
+private:
+
+  static void
+  Config(ctr c, struct perf_event_attr &attr)
+  {
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (c) {
+    case CYCLES:
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case INSTRUCTIONS:
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case LLC_MISSES:
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case BRANCH_MISSES:
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case DTLB_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    default:
+      ALWAYS_ASSERT(false);
+    }
+  }
+
+  int fds_[NCounters];
+  size_t slots_[NCounters];
+  size_t nopen_;
+};
+
+#endif /* _NDB_PERF_COUNTERS_H_ */
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "cold_store.h"
+#include "counter.h"
+#include "pinned_snapshot.h"
+#include "rcu.h"
+#include "ticker.h"
+#include "txn_proto2_impl.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+static event_counter evt_pinned_snapshot_images("pinned_snapshot_images");
+static event_counter evt_pinned_snapshot_expirations("pinned_snapshot_expirations");
+
+atomic<unsigned> pinned_snapshot::g_nactive(0);
+
+namespace {
+
+  // keys a scan visits per RCU region
+  const size_t ScanChunk = 256;
+
+  // held while the snapshots are walked on commit, so none is destroyed
+  // under a committer. taken before any snapshot's own lock
+  spinlock g_snapshots_lock;
+  vector<pinned_snapshot *> g_snapshots;
+
+  struct key_chunk_callback {
+    key_chunk_callback() : more_(false) {}
+    bool
+    operator()(const concurrent_btree::string_type &k,
+               concurrent_btree::value_type v)
+    {
+      keys_.emplace_back(k.data(), k.size());
+      if (keys_.size() == ScanChunk) {
+        more_ = true;
+        return false;
+      }
+      return true;
+    }
+    vector<string> keys_;
+    bool more_;
+  };
+
+  enum class latest_read { RECORD, ABSENT, NEWER };
+
+  // reads the latest version of key in btr, if it is no newer than tid.
+  // caller is in an RCU region
+  latest_read
+  ReadLatest(concurrent_btree *btr, const string &key, uint64_t tid,
+             string &value)
+  {
+    for (;;) {
+      concurrent_btree::value_type px = 0;
+      if (!btr->search(varkey(key), px))
+        return latest_read::NEWER; // removed since, if it was ever there
+      const dbtuple * const tuple = reinterpret_cast<const dbtuple *>(px);
+      const dbtuple::version_t v = tuple->reader_stable_version(true);
+      if (!dbtuple::IsLatest(v))
+        continue; // replaced: find the new one
+      if (tuple->version > tid)
+        // its before-image was recorded before the version moved
+        return latest_read::NEWER;
+      const size_t sz = tuple->size;
+      const bool absent = dbtuple::IsDeleting(v) || !sz;
+      if (!absent && dbtuple::IsCold(v))
+        cold_store::ReadValue(tuple, value);
+      else if (!absent && sz <= tuple->alloc_size)
+        value.assign((const char *) tuple->get_value_start(), sz);
+      if (!tuple->reader_check_version(v) || sz > tuple->alloc_size)
+        continue;
+      return absent ? latest_read::ABSENT : latest_read::RECORD;
+    }
+  }
+}
+
+pinned_snapshot::pinned_snapshot(const vector<concurrent_btree *> &trees,
+                                 size_t max_bytes,
+                                 uint64_t max_age_us)
+  : trees_(trees.begin(), trees.end()),
+    max_bytes_(max_bytes),
+    deadline_us_(max_age_us ? timer::cur_usec() + max_age_us : 0),
+    tid_(0), expired_(false), nbytes_(0)
+{
+  {
+    ::lock_guard<spinlock> l(g_snapshots_lock);
+    g_snapshots.push_back(this);
+  }
+  g_nactive.fetch_add(1, memory_order_seq_cst);
+
+  // every overwrite from here on is being recorded. a commit which missed
+  // this snapshot got its tid by the current tick, so once the snapshot
+  // covers the tick nothing past it was missed
+  const uint64_t e = ticker::s_instance.global_current_tick();
+  uint64_t tid;
+  for (;;) {
+    tid = transaction_proto2_static::ComputeReadOnlyTid(
+        ticker::s_instance.global_last_tick_exclusive());
+    if (tid && transaction_proto2_static::EpochId(tid) >= e)
+      break;
+    this_thread::sleep_for(chrono::microseconds(ticker::TickUsec()));
+  }
+
+  // keep only the first overwrite past the snapshot per key, and only if
+  // what it overwrote was in the snapshot (if it was newer, the key was
+  // inserted after the snapshot)
+  ::lock_guard<spinlock> l(lock_);
+  nbytes_ = 0;
+  for (auto &t : images_) {
+    for (auto it = t.second.begin(); it != t.second.end();) {
+      const before_image *first = nullptr;
+      for (auto &img : it->second)
+        if (img.overwritten_at_ > tid &&
+            (!first || img.overwritten_at_ < first->overwritten_at_))
+          first = &img;
+      if (!first || first->version_ > tid) {
+        it = t.second.erase(it);
+        continue;
+      }
+      if (first != &it->second[0])
+        it->second[0] = move(*first);
+      it->second.resize(1);
+      nbytes_ += it->first.size() + it->second[0].value_.size() +
+                 sizeof(before_image);
+      ++it;
+    }
+  }
+  tid_ = tid;
+  check_expiry();
+}
+
+pinned_snapshot::~pinned_snapshot()
+{
+  ::lock_guard<spinlock> l(g_snapshots_lock);
+  g_snapshots.erase(find(g_snapshots.begin(), g_snapshots.end(), this));
+  g_nactive.fetch_sub(1, memory_order_release);
+}
+
+bool
+pinned_snapshot::expired()
+{
+  ::lock_guard<spinlock> l(lock_);
+  return check_expiry();
+}
+
+size_t
+pinned_snapshot::retained_bytes()
+{
+  ::lock_guard<spinlock> l(lock_);
+  return nbytes_;
+}
+
+bool
+pinned_snapshot::get(concurrent_btree *btr, const string &key,
+                     string &value, bool &found)
+{
+  INVARIANT(trees_.count(btr));
+  {
+    scoped_rcu_region guard;
+    switch (ReadLatest(btr, key, tid_, value)) {
+    case latest_read::RECORD:
+      found = true;
+      return !expired();
+    case latest_read::ABSENT:
+      found = false;
+      return !expired();
+    case latest_read::NEWER:
+      break;
+    }
+  }
+  ::lock_guard<spinlock> l(lock_);
+  if (check_expiry())
+    return false;
+  const before_image * const img = image_of(btr, key);
+  found = img != nullptr;
+  if (found)
+    value = img->value_;
+  return true;
+}
+
+bool
+pinned_snapshot::scan(concurrent_btree *btr,
+                      const string &lower, const string *upper,
+                      const scan_callback &cb)
+{
+  INVARIANT(trees_.count(btr));
+  string start(lower);
+  for (;;) {
+    key_chunk_callback c;
+    {
+      scoped_rcu_region guard;
+      if (upper) {
+        const varkey vupper(*upper);
+        btr->search_range(varkey(start), &vupper, c);
+      } else {
+        btr->search_range(varkey(start), nullptr, c);
+      }
+    }
+
+    // keys removed from the tree since the snapshot are only among the
+    // before-images
+    vector<string> keys;
+    {
+      ::lock_guard<spinlock> l(lock_);
+      if (check_expiry())
+        return false;
+      auto it = images_.find(btr);
+      if (it != images_.end()) {
+        auto end = c.more_ ? it->second.upper_bound(c.keys_.back()) :
+                   upper ? it->second.lower_bound(*upper) : it->second.end();
+        for (auto p = it->second.lower_bound(start); p != end; ++p)
+          keys.push_back(p->first);
+      }
+    }
+    const size_t nimages = keys.size();
+    keys.insert(keys.end(), c.keys_.begin(), c.keys_.end());
+    inplace_merge(keys.begin(), keys.begin() + nimages, keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    string value;
+    for (auto &k : keys) {
+      bool found;
+      if (!get(btr, k, value, found))
+        return false;
+      if (found && !cb(k, value))
+        return true;
+    }
+    if (!c.more_)
+      return true;
+    // the smallest key after the last one visited
+    start = c.keys_.back();
+    start.push_back('\0');
+  }
+}
+
+void
+pinned_snapshot::DoOnOverwrite(concurrent_btree *btr, const string &key,
+                               const dbtuple *tuple, uint64_t commit_tid)
+{
+  ::lock_guard<spinlock> l(g_snapshots_lock);
+  for (auto s : g_snapshots) {
+    if (!s->trees_.count(btr))
+      continue;
+    ::lock_guard<spinlock> sl(s->lock_);
+    s->record(btr, key, tuple, commit_tid);
+  }
+}
+
+void
+pinned_snapshot::record(concurrent_btree *btr, const string &key,
+                        const dbtuple *tuple, uint64_t commit_tid)
+{
+  INVARIANT(tuple->is_locked());
+  if (check_expiry())
+    return;
+  if (tid_ && tuple->version > tid_)
+    // overwritten since the snapshot, or inserted after it
+    return;
+  vector<before_image> &imgs = images_[btr][key];
+  if (tid_ && !imgs.empty())
+    return;
+  before_image img;
+  img.version_ = tuple->version;
+  img.overwritten_at_ = commit_tid;
+  img.present_ = !tuple->is_deleting() && tuple->size;
+  if (img.present_ && tuple->is_cold())
+    cold_store::ReadValue(tuple, img.value_);
+  else if (img.present_)
+    img.value_.assign((const char *) tuple->get_value_start(), tuple->size);
+  nbytes_ += key.size() + img.value_.size() + sizeof(before_image);
+  imgs.emplace_back(move(img));
+  ++evt_pinned_snapshot_images;
+  if (max_bytes_ && nbytes_ > max_bytes_)
+    expire();
+}
+
+bool
+pinned_snapshot::check_expiry()
+{
+  if (!expired_ && deadline_us_ && timer::cur_usec() > deadline_us_)
+    expire();
+  return expired_;
+}
+
+void
+pinned_snapshot::expire()
+{
+  expired_ = true;
+  images_.clear();
+  nbytes_ = 0;
+  ++evt_pinned_snapshot_expirations;
+}
+
+const pinned_snapshot::before_image *
+pinned_snapshot::image_of(concurrent_btree *btr, const string &key)
+{
+  INVARIANT(tid_);
+  auto it = images_.find(btr);
+  if (it == images_.end())
+    return nullptr;
+  auto p = it->second.find(key);
+  if (p == it->second.end() || !p->second[0].present_)
+    return nullptr;
+  return &p->second[0];
+}
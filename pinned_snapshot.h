@@ -0,0 +1,130 @@
+#ifndef _NDB_PINNED_SNAPSHOT_H_
+#define _NDB_PINNED_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree_choice.h"
+#include "macros.h"
+#include "spinlock.h"
+#include "tuple.h"
+
+/**
+ * A snapshot of a few tables which stays readable for as long as it is held
+ * (say, for an hour long report), without holding back GC for anyone.
+ *
+ * A read-only txn reads old versions off the version chains, so a long one
+ * either loses them to GC or (see transaction_proto2_static::PinSnapshot())
+ * keeps every old version of every table alive. A pinned_snapshot instead
+ * copies what it needs out of the way, and only for its own tables: the
+ * first time a commit overwrites (or deletes) a record as of the snapshot,
+ * the record's before-image is copied into the snapshot first. Reads only
+ * look at the latest tuple of a key: if it is no newer than the snapshot it
+ * is what the snapshot sees, otherwise the before-image is. Version chains
+ * are left to GC as usual.
+ *
+ * The before-images are bounded by max_bytes, and the snapshot by max_age_us
+ * (either 0 for no bound). Past either, the snapshot expires: its
+ * before-images are dropped, and every read from then on fails.
+ *
+ * While any snapshot is held, commits which overwrite records of any table
+ * take a global spinlock (see OnOverwrite()). Tables must outlive the
+ * snapshots taken of them
+ */
+class pinned_snapshot {
+public:
+
+  // returning false stops the scan
+  typedef std::function<bool (const std::string &, const std::string &)>
+    scan_callback;
+
+  // trees are the underlying btrees of the tables (see
+  // base_txn_btree::get_underlying_btree()). blocks until a snapshot taken
+  // after the call is consistently readable (up to a read only epoch)
+  pinned_snapshot(const std::vector<concurrent_btree *> &trees,
+                  size_t max_bytes = 0,
+                  uint64_t max_age_us = 0);
+
+  ~pinned_snapshot();
+
+  pinned_snapshot(const pinned_snapshot &) = delete;
+  pinned_snapshot(pinned_snapshot &&) = delete;
+  pinned_snapshot &operator=(const pinned_snapshot &) = delete;
+
+  inline uint64_t
+  tid() const
+  {
+    return tid_;
+  }
+
+  bool expired();
+
+  // bytes of before-images kept so far
+  size_t retained_bytes();
+
+  // returns false if the snapshot has expired. otherwise found says whether
+  // key was in btr as of the snapshot, and value is its value if so
+  bool get(concurrent_btree *btr, const std::string &key,
+           std::string &value, bool &found);
+
+  // calls cb on the records of btr in [lower, upper) (upper null for no
+  // bound) as of the snapshot, in key order. returns false if the snapshot
+  // has expired (possibly part way through)
+  bool scan(concurrent_btree *btr,
+            const std::string &lower, const std::string *upper,
+            const scan_callback &cb);
+
+  // called on commit, before tuple (the latest version of key in btr,
+  // locked) is overwritten by the txn committing at commit_tid
+  static inline void
+  OnOverwrite(concurrent_btree *btr, const std::string &key,
+              const dbtuple *tuple, uint64_t commit_tid)
+  {
+    if (unlikely(g_nactive.load(std::memory_order_acquire)))
+      DoOnOverwrite(btr, key, tuple, commit_tid);
+  }
+
+private:
+
+  struct before_image {
+    uint64_t version_;        // of the tuple overwritten
+    uint64_t overwritten_at_; // tid of the txn which overwrote it
+    bool present_;
+    std::string value_;
+  };
+
+  // only the first overwrite past the snapshot is kept per key, but until
+  // tid_ is known every overwrite is
+  typedef std::map<std::string, std::vector<before_image>> image_map;
+
+  static void DoOnOverwrite(concurrent_btree *btr, const std::string &key,
+                            const dbtuple *tuple, uint64_t commit_tid);
+
+  // all with lock_ held
+  void record(concurrent_btree *btr, const std::string &key,
+              const dbtuple *tuple, uint64_t commit_tid);
+  bool check_expiry();
+  void expire();
+  // the image of key as of the snapshot, null if the key was absent
+  const before_image *image_of(concurrent_btree *btr, const std::string &key);
+
+  const std::set<concurrent_btree *> trees_;
+  const size_t max_bytes_;
+  const uint64_t deadline_us_; // 0 for none
+
+  spinlock lock_;
+  uint64_t tid_; // 0 until known
+  bool expired_;
+  size_t nbytes_;
+  std::map<concurrent_btree *, image_map> images_;
+
+  static std::atomic<unsigned> g_nactive;
+};
+
+#endif /* _NDB_PINNED_SNAPSHOT_H_ */
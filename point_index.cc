@@ -0,0 +1,229 @@
+#include <stdlib.h>
+
+#include "point_index.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "log2.hh"
+#include "rcu.h"
+
+using namespace std;
+
+static event_counter evt_point_index_hits("point_index_hits");
+static event_counter evt_point_index_misses("point_index_misses");
+static event_counter evt_point_index_grows("point_index_grows");
+
+static const void *const IndexTombstone = (const void *) 0x1;
+static spinlock g_registry_lock;
+
+atomic<size_t> point_index::g_nregistered(0);
+point_index::registry_entry point_index::g_registry[point_index::NMaxIndexes];
+
+point_index::point_index(size_t nbuckets_hint)
+  : table_(AllocTable(round_up_to_pow2(max(nbuckets_hint, size_t(16)))))
+{
+}
+
+point_index::~point_index()
+{
+  FreeTable(table_.load(memory_order_acquire));
+}
+
+point_index::entry *
+point_index::AllocEntry(uint64_t hash, const uint8_t *key, size_t len,
+                        dbtuple *tuple)
+{
+  entry * const e = (entry *) malloc(sizeof(entry) + len);
+  ALWAYS_ASSERT(e);
+  new (&e->next_) atomic<entry *>(nullptr);
+  new (&e->tuple_) atomic<dbtuple *>(tuple);
+  e->hash_ = hash;
+  e->len_ = len;
+  NDB_MEMCPY(e->key_, key, len);
+  return e;
+}
+
+point_index::table *
+point_index::AllocTable(size_t nbuckets)
+{
+  INVARIANT(!(nbuckets & (nbuckets - 1)));
+  table * const t = (table *) malloc(sizeof(table) + nbuckets * sizeof(bucket));
+  ALWAYS_ASSERT(t);
+  t->mask_ = nbuckets - 1;
+  t->moved_ = false;
+  for (size_t i = 0; i < nbuckets; i++) {
+    new (&t->buckets_[i].lock_) spinlock;
+    new (&t->buckets_[i].head_) atomic<entry *>(nullptr);
+  }
+  return t;
+}
+
+void
+point_index::FreeTable(void *p)
+{
+  table * const t = (table *) p;
+  for (size_t i = 0; i <= t->mask_; i++) {
+    entry *e = t->buckets_[i].head_.load(memory_order_relaxed);
+    while (e) {
+      entry * const next = e->next_.load(memory_order_relaxed);
+      free(e);
+      e = next;
+    }
+  }
+  free(t);
+}
+
+dbtuple *
+point_index::lookup(const varkey &k) const
+{
+  INVARIANT(rcu::s_instance.in_rcu_region());
+  const uint64_t h = Hash(k);
+  const table * const t = table_.load(memory_order_acquire);
+  for (const entry *e = t->buckets_[h & t->mask_].head_.load(memory_order_acquire);
+       e; e = e->next_.load(memory_order_acquire)) {
+    if (e->matches(h, k)) {
+      ++evt_point_index_hits;
+      return e->tuple_.load(memory_order_acquire);
+    }
+  }
+  ++evt_point_index_misses;
+  return nullptr;
+}
+
+point_index::bucket &
+point_index::lock_bucket(uint64_t hash)
+{
+  for (;;) {
+    table * const t = table_.load(memory_order_acquire);
+    bucket &b = t->buckets_[hash & t->mask_];
+    b.lock_.lock();
+    if (likely(!t->moved_))
+      return b;
+    b.lock_.unlock();
+  }
+}
+
+void
+point_index::put(const varkey &k, dbtuple *tuple)
+{
+  INVARIANT(tuple);
+  const uint64_t h = Hash(k);
+  bucket &b = lock_bucket(h);
+  table * const t = table_.load(memory_order_acquire);
+  size_t chain = 0;
+  for (entry *e = b.head_.load(memory_order_relaxed);
+       e; e = e->next_.load(memory_order_relaxed), chain++) {
+    if (e->matches(h, k)) {
+      e->tuple_.store(tuple, memory_order_release);
+      b.lock_.unlock();
+      return;
+    }
+  }
+  // published at the head, so readers see a whole entry or none
+  entry * const e = AllocEntry(h, k.data(), k.size(), tuple);
+  e->next_.store(b.head_.load(memory_order_relaxed), memory_order_relaxed);
+  b.head_.store(e, memory_order_release);
+  b.lock_.unlock();
+  if (unlikely(chain >= MaxChainLength))
+    grow(t);
+}
+
+void
+point_index::remove(const varkey &k, const dbtuple *tuple)
+{
+  const uint64_t h = Hash(k);
+  bucket &b = lock_bucket(h);
+  entry *removed = nullptr;
+  atomic<entry *> *prev = &b.head_;
+  for (entry *e = prev->load(memory_order_relaxed);
+       e; prev = &e->next_, e = prev->load(memory_order_relaxed)) {
+    if (!e->matches(h, k))
+      continue;
+    if (e->tuple_.load(memory_order_relaxed) == tuple) {
+      prev->store(e->next_.load(memory_order_relaxed), memory_order_release);
+      removed = e;
+    }
+    break;
+  }
+  b.lock_.unlock();
+  if (removed) {
+    scoped_rcu_region guard;
+    rcu::s_instance.free_with_fn(removed, ::free);
+  }
+}
+
+void
+point_index::clear()
+{
+  table * const t = table_.load(memory_order_acquire);
+  const size_t nbuckets = t->mask_ + 1;
+  FreeTable(t);
+  table_.store(AllocTable(nbuckets), memory_order_release);
+}
+
+void
+point_index::grow(table *t)
+{
+  std::lock_guard<std::mutex> g(grow_mutex_);
+  if (table_.load(memory_order_acquire) != t)
+    // someone beat us to it
+    return;
+  ++evt_point_index_grows;
+  // writers stay out of t while we copy it (readers keep reading it)
+  for (size_t i = 0; i <= t->mask_; i++)
+    t->buckets_[i].lock_.lock();
+  table * const nt = AllocTable(2 * (t->mask_ + 1));
+  for (size_t i = 0; i <= t->mask_; i++)
+    for (entry *e = t->buckets_[i].head_.load(memory_order_relaxed);
+         e; e = e->next_.load(memory_order_relaxed)) {
+      entry * const ne = AllocEntry(
+          e->hash_, e->key_, e->len_, e->tuple_.load(memory_order_relaxed));
+      bucket &b = nt->buckets_[e->hash_ & nt->mask_];
+      ne->next_.store(b.head_.load(memory_order_relaxed), memory_order_relaxed);
+      b.head_.store(ne, memory_order_relaxed);
+    }
+  table_.store(nt, memory_order_release);
+  t->moved_ = true;
+  for (size_t i = 0; i <= t->mask_; i++)
+    t->buckets_[i].lock_.unlock();
+  scoped_rcu_region guard;
+  rcu::s_instance.free_with_fn(t, FreeTable);
+}
+
+void
+point_index::Register(const void *btr, point_index *idx)
+{
+  INVARIANT(btr && btr != IndexTombstone);
+  ::lock_guard<spinlock> l(g_registry_lock);
+  for (size_t i = SlotFor(btr), n = 0;
+       n < NMaxIndexes;
+       i = (i + 1) & (NMaxIndexes - 1), n++) {
+    const void * const px = g_registry[i].btr_.load(memory_order_acquire);
+    INVARIANT(px != btr);
+    if (!px || px == IndexTombstone) {
+      g_registry[i].idx_ = idx;
+      g_registry[i].btr_.store(btr, memory_order_release);
+      g_nregistered.fetch_add(1, memory_order_release);
+      return;
+    }
+  }
+  ALWAYS_ASSERT(false); // too many indexes
+}
+
+void
+point_index::Unregister(const void *btr)
+{
+  ::lock_guard<spinlock> l(g_registry_lock);
+  for (size_t i = SlotFor(btr), n = 0;
+       n < NMaxIndexes;
+       i = (i + 1) & (NMaxIndexes - 1), n++) {
+    const void * const px = g_registry[i].btr_.load(memory_order_acquire);
+    if (px == btr) {
+      g_registry[i].btr_.store(IndexTombstone, memory_order_release);
+      g_nregistered.fetch_sub(1, memory_order_release);
+      return;
+    }
+    if (!px)
+      break;
+  }
+  ALWAYS_ASSERT(false);
+}
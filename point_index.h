@@ -0,0 +1,171 @@
+#ifndef _NDB_POINT_INDEX_H_
+#define _NDB_POINT_INDEX_H_
+
+#include <atomic>
+#include <mutex>
+#include <string.h>
+
+#include "macros.h"
+#include "spinlock.h"
+#include "varkey.h"
+
+class dbtuple;
+
+/**
+ * A concurrent hash index from keys to the latest dbtuple of each key, for
+ * tables which are only ever accessed by key (see txn_btree's point_only
+ * flag).
+ *
+ * The index sits in front of the table's underlying btree, and never has a
+ * mapping the btree does not have: a hit is the tuple the btree maps the key
+ * to (or one it was replaced by a moment ago, which OCC validation rejects
+ * like any other stale read), while a miss falls back to the btree, which
+ * still provides the node versions for absent reads. So readers hashing to a
+ * key take one miss for the bucket and one for the tuple, instead of one per
+ * level of the tree.
+ *
+ * Mappings are put where a txn links a tuple into the btree, and removed
+ * (before it is unlinked) where it is unlinked, so a tuple found in the index
+ * is never freed before readers leave their RCU regions. Removals only remove
+ * the tuple being unlinked, so they never lose the put of a newer tuple for
+ * the same key.
+ *
+ * Readers never lock. Writers lock a bucket; a bucket whose chain grows too
+ * long doubles the table (copying the entries), and the old table is RCU
+ * freed once its readers are gone.
+ */
+class point_index {
+public:
+
+  // chains longer than this double the table
+  static const size_t MaxChainLength = 8;
+
+  explicit point_index(size_t nbuckets_hint = 1 << 12);
+  ~point_index();
+
+  point_index(const point_index &) = delete;
+  point_index(point_index &&) = delete;
+  point_index &operator=(const point_index &) = delete;
+
+  // caller must be in an RCU region
+  dbtuple *lookup(const varkey &k) const;
+
+  // maps k => tuple, replacing any existing mapping
+  void put(const varkey &k, dbtuple *tuple);
+
+  // removes k's mapping if it is to tuple
+  void remove(const varkey &k, const dbtuple *tuple);
+
+  // not thread-safe
+  void clear();
+
+  inline size_t
+  nbuckets() const
+  {
+    return table_.load(std::memory_order_acquire)->mask_ + 1;
+  }
+
+  // indexes are found by their table's underlying btree, by the code which
+  // links and unlinks tuples generically (commit, GC)
+  static void Register(const void *btr, point_index *idx);
+  static void Unregister(const void *btr);
+
+  static inline point_index *
+  For(const void *btr)
+  {
+    if (likely(!g_nregistered.load(std::memory_order_acquire)))
+      return nullptr;
+    for (size_t i = SlotFor(btr), n = 0;
+         n < NMaxIndexes;
+         i = (i + 1) & (NMaxIndexes - 1), n++) {
+      const void * const px = g_registry[i].btr_.load(std::memory_order_acquire);
+      if (px == btr)
+        return g_registry[i].idx_;
+      if (!px)
+        break;
+    }
+    return nullptr;
+  }
+
+  static inline uint64_t
+  Hash(const varkey &k)
+  {
+    const uint8_t *p = k.data();
+    size_t n = k.size();
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+    for (; n >= 8; p += 8, n -= 8) {
+      uint64_t w;
+      memcpy(&w, p, 8);
+      h = (h ^ w) * 0xff51afd7ed558ccdULL;
+      h ^= h >> 32;
+    }
+    if (n) {
+      uint64_t w = 0;
+      memcpy(&w, p, n);
+      h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+
+  struct entry {
+    std::atomic<entry *> next_;
+    std::atomic<dbtuple *> tuple_;
+    uint64_t hash_;
+    uint32_t len_;
+    uint8_t key_[0];
+
+    inline bool
+    matches(uint64_t hash, const varkey &k) const
+    {
+      return hash_ == hash && len_ == k.size() &&
+             !memcmp(key_, k.data(), len_);
+    }
+  };
+
+  struct bucket {
+    spinlock lock_;
+    std::atomic<entry *> head_;
+  };
+
+  struct table {
+    size_t mask_;
+    bool moved_; // set (under every bucket lock) once it has been doubled
+    bucket buckets_[0];
+  };
+
+  static entry *AllocEntry(uint64_t hash, const uint8_t *key, size_t len,
+                           dbtuple *tuple);
+  static table *AllocTable(size_t nbuckets);
+  static void FreeTable(void *p); // and its entries
+
+  // locks the bucket for hash in the current table
+  bucket &lock_bucket(uint64_t hash);
+
+  void grow(table *t);
+
+  std::atomic<table *> table_;
+  std::mutex grow_mutex_;
+
+  static const size_t NMaxIndexes = 1024;
+
+  static inline size_t
+  SlotFor(const void *btr)
+  {
+    return (uintptr_t(btr) >> 4) & (NMaxIndexes - 1);
+  }
+
+  struct registry_entry {
+    std::atomic<const void *> btr_;
+    point_index *idx_;
+  };
+
+  static std::atomic<size_t> g_nregistered;
+  static registry_entry g_registry[NMaxIndexes];
+};
+
+#endif /* _NDB_POINT_INDEX_H_ */
@@ -15,7 +15,7 @@ template <typename T, size_t N> struct basic_px_queue;
 template <typename T, size_t N>
 struct basic_px_group {
   basic_px_group()
-    : next_(nullptr), rcu_tick_(0)
+    : next_(nullptr), rcu_tick_(0), bytes_(0)
   {
     static event_counter evt_px_group_creates(
         util::cxx_typename<T>::value() + std::string("_px_group_creates"));
@@ -42,6 +42,7 @@ private:
   uint64_t rcu_tick_; // all elements in pxs_ are from this tick,
                       // this number is only meaningful if pxs_ is
                       // not empty
+  size_t bytes_; // the elements' bytes (see enqueue())
 };
 
 // not thread safe- should guard with lock for concurrent manipulation
@@ -50,7 +51,7 @@ struct basic_px_queue {
   basic_px_queue()
     : head_(nullptr), tail_(nullptr),
       freelist_head_(nullptr), freelist_tail_(nullptr),
-      ngroups_(0) {}
+      ngroups_(0), bytes_(0) {}
 
   typedef basic_px_group<T, N> px_group;
 
@@ -72,6 +73,7 @@ struct basic_px_queue {
     std::swap(freelist_head_, other.freelist_head_);
     std::swap(freelist_tail_, other.freelist_tail_);
     std::swap(ngroups_, other.ngroups_);
+    std::swap(bytes_, other.bytes_);
   }
 
   template <typename PtrType, typename ObjType>
@@ -147,10 +149,10 @@ struct basic_px_queue {
   inline iterator end() { return iterator(nullptr); }
   inline const_iterator end() const { return iterator(nullptr); }
 
-  // enqueue t in epoch rcu_tick
+  // enqueue t in epoch rcu_tick, accounting bytes to it (see get_bytes())
   // assumption: rcu_ticks can only go up!
   void
-  enqueue(const T &t, uint64_t rcu_tick)
+  enqueue(const T &t, uint64_t rcu_tick, size_t bytes = 0)
   {
     INVARIANT(bool(head_) == bool(tail_));
     INVARIANT(bool(head_) == bool(ngroups_));
@@ -169,6 +171,7 @@ struct basic_px_queue {
       g->next_ = nullptr;
       g->pxs_.clear();
       g->rcu_tick_ = rcu_tick;
+      g->bytes_ = 0;
       ngroups_++;
 
       // adjust ptrs
@@ -186,6 +189,8 @@ struct basic_px_queue {
     INVARIANT(!g->next_);
     INVARIANT(tail_ == g);
     g->pxs_.emplace_back(t);
+    g->bytes_ += bytes;
+    bytes_ += bytes;
     sanity_check();
   }
 
@@ -260,6 +265,8 @@ struct basic_px_queue {
       }
       ngroups_++;
       source.ngroups_--;
+      bytes_ += p->bytes_;
+      source.bytes_ -= p->bytes_;
       source.head_ = p = pnext;
       if (!source.head_)
         source.tail_ = nullptr;
@@ -309,6 +316,7 @@ struct basic_px_queue {
     freelist_head_ = head_;
     head_ = tail_ = nullptr;
     ngroups_ = 0;
+    bytes_ = 0;
   }
 
   // adds n new groups to the freelist
@@ -326,6 +334,18 @@ struct basic_px_queue {
 
   inline size_t get_ngroups() const { return ngroups_; }
 
+  // the bytes the queued elements were enqueued with
+  inline size_t get_bytes() const { return bytes_; }
+
+  inline bool
+  get_earliest_epoch(uint64_t &e) const
+  {
+    if (!head_)
+      return false;
+    e = head_->rcu_tick_;
+    return true;
+  }
+
   inline bool
   get_latest_epoch(uint64_t &e) const
   {
@@ -351,4 +371,5 @@ private:
   px_group *freelist_head_;
   px_group *freelist_tail_;
   size_t ngroups_;
+  size_t bytes_;
 };
@@ -0,0 +1,4 @@
+#include "queue_lock.h"
+
+std::atomic<bool> queue_lock::g_enabled(false);
+queue_lock::slot queue_lock::g_slots[queue_lock::NSlots];
@@ -0,0 +1,130 @@
+#ifndef _QUEUE_LOCK_H_
+#define _QUEUE_LOCK_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "amd64.h"
+#include "macros.h"
+
+/**
+ * Queues the waiters of contended test-and-set locks, for the locks whose
+ * lock bits live in words with no room for a queue (btree node versions,
+ * dbtuple headers) and for spinlock.
+ *
+ * A waiter which fails to get its lock SpinsBeforeQueueing times joins the MCS
+ * queue of its lock, spinning on its own queue node until it is at the head.
+ * Only the head spins on the lock word, and it passes the head on once it has
+ * the lock. So the uncontended path is the same single CAS, while under
+ * contention the lock's cache line moves between the owner and one waiter
+ * instead of all of them, and waiters get the lock in FIFO order.
+ *
+ * The queues' tails live in a table of NSlots, locks hashing to a slot: each
+ * slot lists the tail of every queued lock of the slot's, under a short
+ * test-and-set lock which is never held while waiting. A lock's waiters only
+ * ever wait behind waiters for the same lock, so holding one lock while
+ * queueing for another cannot deadlock with an unrelated lock of the slot's.
+ *
+ * Off by default (see SetEnabled())
+ */
+class queue_lock {
+public:
+
+  static const unsigned SpinsBeforeQueueing = 64;
+  static const size_t NSlots = 1024;
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_enabled.load(std::memory_order_relaxed);
+  }
+
+  static void
+  SetEnabled(bool enabled)
+  {
+    g_enabled.store(enabled, std::memory_order_release);
+  }
+
+  // spins until try_acquire() succeeds, in the queue of the lock at addr.
+  // try_acquire() must not block
+  template <typename TryAcquire>
+  static void
+  Acquire(const void *addr, TryAcquire try_acquire)
+  {
+    qnode me(addr);
+    slot &s = g_slots[SlotFor(addr)];
+    s.lock();
+    qnode **pp = &s.tails_;
+    while (*pp && (*pp)->addr_ != addr)
+      pp = &(*pp)->slot_next_;
+    qnode * const pred = *pp;
+    if (pred) {
+      // me replaces pred as the lock's tail
+      me.slot_next_ = pred->slot_next_;
+      *pp = &me;
+      pred->next_.store(&me, std::memory_order_release);
+    } else {
+      me.slot_next_ = s.tails_;
+      s.tails_ = &me;
+    }
+    s.unlock();
+    if (pred)
+      while (me.waiting_.load(std::memory_order_acquire))
+        nop_pause();
+    while (!try_acquire())
+      nop_pause();
+    s.lock();
+    qnode * const succ = me.next_.load(std::memory_order_relaxed);
+    if (!succ) {
+      // still the tail: the lock has no queue left
+      pp = &s.tails_;
+      while (*pp != &me)
+        pp = &(*pp)->slot_next_;
+      *pp = me.slot_next_;
+    }
+    s.unlock();
+    if (succ)
+      succ->waiting_.store(false, std::memory_order_release);
+  }
+
+  static inline size_t
+  SlotFor(const void *addr)
+  {
+    const uintptr_t p = reinterpret_cast<uintptr_t>(addr);
+    return ((p >> 6) ^ (p >> 16)) & (NSlots - 1);
+  }
+
+private:
+
+  struct qnode {
+    const void * const addr_;
+    qnode *slot_next_; // the slot's next tail, if this node is a tail
+    std::atomic<qnode *> next_;
+    std::atomic<bool> waiting_;
+    qnode(const void *addr)
+      : addr_(addr), slot_next_(nullptr), next_(nullptr), waiting_(true) {}
+  } CACHE_ALIGNED;
+
+  struct slot {
+    std::atomic<bool> locked_;
+    qnode *tails_; // under locked_
+
+    inline void
+    lock()
+    {
+      while (locked_.exchange(true, std::memory_order_acquire))
+        nop_pause();
+    }
+
+    inline void
+    unlock()
+    {
+      locked_.store(false, std::memory_order_release);
+    }
+  } CACHE_ALIGNED;
+
+  static std::atomic<bool> g_enabled;
+  static slot g_slots[NSlots];
+};
+
+#endif /* _QUEUE_LOCK_H_ */
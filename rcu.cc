@@ -13,25 +13,39 @@
 #include "thread.h"
 #include "counter.h"
 #include "lockguard.h"
+#include "thread_placement.h"
 
 using namespace std;
 using namespace util;
 
 rcu rcu::s_instance;
+atomic<size_t> rcu::g_garbage_cap(0);
+atomic<bool> rcu::g_qs_mode(false);
 
 static event_counter evt_rcu_deletes("rcu_deletes");
 static event_counter evt_rcu_frees("rcu_frees");
 static event_counter evt_rcu_local_reaps("rcu_local_reaps");
 static event_counter evt_rcu_incomplete_local_reaps("rcu_incomplete_local_reaps");
 static event_counter evt_rcu_loop_reaps("rcu_loop_reaps");
+static event_counter evt_rcu_backpressure_stalls("rcu_backpressure_stalls");
+static event_counter evt_rcu_qs_epoch_advances("rcu_qs_epoch_advances");
+static event_counter evt_rcu_qs_blocked_advances("rcu_qs_blocked_advances");
 static event_counter *evt_allocator_arena_allocations[::allocator::MAX_ARENAS] = {nullptr};
 static event_counter *evt_allocator_arena_deallocations[::allocator::MAX_ARENAS] = {nullptr};
 static event_counter evt_allocator_large_allocation("allocator_large_allocation");
+static event_counter evt_allocator_homed_allocations("allocator_homed_allocations");
+static event_counter evt_allocator_packed_allocations("allocator_packed_allocations");
 
 static event_avg_counter evt_avg_gc_reaper_queue_len("avg_gc_reaper_queue_len");
+static event_histogram hist_rcu_gc_pause_us("rcu_gc_pause_us");
 static event_avg_counter evt_avg_rcu_delete_queue_len("avg_rcu_delete_queue_len");
 static event_avg_counter evt_avg_rcu_local_delete_queue_len("avg_rcu_local_delete_queue_len");
 static event_avg_counter evt_avg_rcu_sync_try_release("avg_rcu_sync_try_release");
+static event_avg_counter evt_avg_rcu_pending_bytes("avg_rcu_pending_bytes");
+static event_avg_counter evt_avg_rcu_oldest_pending_age_ticks(
+    "avg_rcu_oldest_pending_age_ticks");
+static event_avg_counter evt_avg_rcu_backpressure_stall_usec(
+    "avg_rcu_backpressure_stall_usec");
 static event_avg_counter evt_avg_time_inbetween_rcu_epochs_usec(
     "avg_time_inbetween_rcu_epochs_usec");
 static event_avg_counter evt_avg_time_inbetween_allocator_releases_usec(
@@ -113,14 +127,26 @@ rcu::sync::alloc(size_t sz)
     ++evt_allocator_large_allocation;
     return malloc(sz);
   }
-  ensure_arena(arena);
-  void *p = arenas_[arena];
+  void **head;
+  if (unlikely(alloc_node_ >= 0 && alloc_node_ != local_node_)) {
+    ensure_node_arena(alloc_node_, arena);
+    head = &node_arenas_[alloc_node_][arena];
+    ++evt_allocator_homed_allocations;
+  } else if (unlikely(alloc_group_)) {
+    ensure_group_arena(alloc_group_, arena);
+    head = &group_arenas_[alloc_group_][arena];
+    ++evt_allocator_packed_allocations;
+  } else {
+    ensure_arena(arena);
+    head = &arenas_[arena];
+  }
+  void *p = *head;
   INVARIANT(p);
 #ifdef MEMCHECK_MAGIC
   const size_t alloc_size = (arena + 1) * ::allocator::AllocAlignment;
   check_pointer_or_die(p, alloc_size);
 #endif
-  arenas_[arena] = *reinterpret_cast<void **>(p);
+  *head = *reinterpret_cast<void **>(p);
   evt_allocator_arena_allocations[arena]->inc();
   return p;
 }
@@ -147,17 +173,24 @@ rcu::sync::dealloc(void *p, size_t sz)
   auto sizes = ::allocator::ArenaSize(sz);
   auto arena = sizes.second;
   ALWAYS_ASSERT(arena < ::allocator::MAX_ARENAS);
-  *reinterpret_cast<void **>(p) = arenas_[arena];
+  // memory from another node goes back to that node's list, so it is not
+  // handed out to allocations homed here, and packed memory to its group's
+  const int node = ::allocator::PointerToNode(p);
+  const unsigned group = ::allocator::PointerToPackGroup(p);
+  void ** const head =
+    unlikely(node != local_node_) ? &node_arenas_[node][arena] :
+    unlikely(group) ? &group_arenas_[group][arena] : &arenas_[arena];
+  *reinterpret_cast<void **>(p) = *head;
 #ifdef MEMCHECK_MAGIC
   const size_t alloc_size = (arena + 1) * ::allocator::AllocAlignment;
   ALWAYS_ASSERT( ((uintptr_t)p % alloc_size) == 0 );
   NDB_MEMSET(
       (char *) p + sizeof(void **),
       MEMCHECK_MAGIC, alloc_size - sizeof(void **));
-  ALWAYS_ASSERT(*((void **) p) == arenas_[arena]);
+  ALWAYS_ASSERT(*((void **) p) == *head);
   check_pointer_or_die(p, alloc_size);
 #endif
-  arenas_[arena] = p;
+  *head = p;
   evt_allocator_arena_deallocations[arena]->inc();
   deallocs_[arena]++;
 }
@@ -180,7 +213,7 @@ rcu::sync::try_release()
 }
 
 void
-rcu::sync::do_release()
+rcu::sync::do_release(bool with_groups)
 {
 #ifdef MEMCHECK_MAGIC
   for (size_t i = 0; i < ::allocator::MAX_ARENAS; i++) {
@@ -194,12 +227,29 @@ rcu::sync::do_release()
 #endif
   ::allocator::ReleaseArenas(&arenas_[0]);
   NDB_MEMSET(&arenas_[0], 0, sizeof(arenas_));
+  for (size_t n = 0; n < ::allocator::MAX_NUMA_NODES; n++)
+    ::allocator::ReleaseArenas(&node_arenas_[n][0]);
+  NDB_MEMSET(&node_arenas_[0][0], 0, sizeof(node_arenas_));
+  if (with_groups) {
+    for (size_t g = 1; g < ::allocator::MAX_PACK_GROUPS; g++)
+      ::allocator::ReleaseArenas(&group_arenas_[g][0]);
+    NDB_MEMSET(&group_arenas_[0][0], 0, sizeof(group_arenas_));
+  }
   NDB_MEMSET(&deallocs_[0], 0, sizeof(deallocs_));
 }
 
 void
 rcu::sync::do_cleanup()
 {
+  if (unlikely(IsQuiescentStateMode())) {
+    uint64_t e;
+    if (!queue_.get_earliest_epoch(e))
+      return;
+    if (e + 2 > impl_->qs_epoch_.load(memory_order_acquire))
+      // our oldest garbage is not reclaimable yet
+      impl_->qs_try_advance();
+  }
+
   // compute cleaner epoch
   const uint64_t clean_tick_exclusive = impl_->cleaning_rcu_tick_exclusive();
   if (!clean_tick_exclusive)
@@ -221,12 +271,19 @@ rcu::sync::do_cleanup()
 #endif
   last_reaped_epoch_ = clean_tick;
 
+  evt_avg_rcu_pending_bytes.offer(pending_bytes());
+  evt_avg_rcu_oldest_pending_age_ticks.offer(oldest_pending_age());
+
   scratch_.empty_accept_from(queue_, clean_tick);
   scratch_.transfer_freelist(queue_);
   rcu::px_queue &q = scratch_;
   if (q.empty())
     return;
-  scoped_rcu_region guard;
+#ifdef ENABLE_EVENT_COUNTERS
+  const uint64_t pause_start = timer::cur_usec();
+#endif
+  // not a cleaning region: it must not reap scratch_ again on its way out
+  scoped_rcu_base<false> guard;
   size_t n = 0;
   for (auto it = q.begin(); it != q.end(); ++it, ++n) {
     try {
@@ -250,10 +307,54 @@ rcu::sync::do_cleanup()
     last_release_timestamp_us_ = now;
 #endif
   }
+#ifdef ENABLE_EVENT_COUNTERS
+  // the time this thread spent reaping (and releasing) instead of running txns
+  hist_rcu_gc_pause_us.offer(timer::cur_usec() - pause_start);
+#endif
+}
+
+uint64_t
+rcu::sync::oldest_pending_age() const
+{
+  uint64_t e;
+  if (!queue_.get_earliest_epoch(e))
+    return 0;
+  // entries are queued at the tick after the one they were freed in (or at
+  // the quiescent state epoch they were freed in)
+  const uint64_t cur = IsQuiescentStateMode() ?
+    impl_->qs_epoch_.load(memory_order_acquire) :
+    to_rcu_ticks(ticker::s_instance.global_current_tick()) + 1;
+  return cur > e ? cur - e : 0;
 }
 
 void
-rcu::free_with_fn(void *p, deleter_t fn)
+rcu::sync::do_backpressure()
+{
+  INVARIANT(!depth_);
+  if (in_backpressure_)
+    // a region opened by a deleter we ran ends in here
+    return;
+  in_backpressure_ = true;
+  ++evt_rcu_backpressure_stalls;
+  const uint64_t start = timer::cur_usec();
+  for (;;) {
+    do_cleanup();
+    const size_t cap = GarbageCap();
+    if (!cap || pending_bytes() <= cap)
+      break;
+    // nothing more reclaimable until the cleaning tick moves
+    const uint64_t sleep_ns = ticker::TickUsec() * 1000;
+    struct timespec t;
+    t.tv_sec  = sleep_ns / ONE_SECOND_NS;
+    t.tv_nsec = sleep_ns % ONE_SECOND_NS;
+    nanosleep(&t, nullptr);
+  }
+  evt_avg_rcu_backpressure_stall_usec.offer(timer::cur_usec() - start);
+  in_backpressure_ = false;
+}
+
+void
+rcu::free_with_fn(void *p, deleter_t fn, size_t sz)
 {
   sync &s = mysync();
   uint64_t cur_tick = 0; // ticker units
@@ -261,9 +362,7 @@ rcu::free_with_fn(void *p, deleter_t fn)
   if (!is_guarded)
     INVARIANT(false);
   INVARIANT(s.depth());
-  // all threads are either at cur_tick or cur_tick + 1, so we must wait for
-  // the system to move beyond cur_tick + 1
-  s.queue_.enqueue(delete_entry(p, fn), to_rcu_ticks(cur_tick + 1));
+  s.queue_.enqueue(delete_entry(p, fn), free_tick(cur_tick), sz);
   ++evt_rcu_frees;
 }
 
@@ -276,9 +375,7 @@ rcu::dealloc_rcu(void *p, size_t sz)
   if (!is_guarded)
     INVARIANT(false);
   INVARIANT(s.depth());
-  // all threads are either at cur_tick or cur_tick + 1, so we must wait for
-  // the system to move beyond cur_tick + 1
-  s.queue_.enqueue(delete_entry(p, sz), to_rcu_ticks(cur_tick + 1));
+  s.queue_.enqueue(delete_entry(p, sz), free_tick(cur_tick), sz);
   ++evt_rcu_frees;
 }
 
@@ -288,12 +385,16 @@ rcu::pin_current_thread(size_t cpu)
   sync &s = mysync();
   s.set_pin_cpu(cpu);
   auto node = numa_node_of_cpu(cpu);
+  s.local_node_ = ::allocator::CpuNode(cpu);
   // pin to node
   ALWAYS_ASSERT(!numa_run_on_node(node));
+  // and to the cpu itself, if it was placed there
+  if (thread_placement::IsPlanned())
+    thread_placement::PinCurrentThread(cpu);
   // is numa_run_on_node() guaranteed to take effect immediately?
   ALWAYS_ASSERT(!sched_yield());
   // release current thread-local cache back to allocator
-  s.do_release();
+  s.do_release(true);
 }
 
 void
@@ -305,9 +406,43 @@ rcu::fault_region()
   ::allocator::FaultRegion(s.get_pin_cpu());
 }
 
+void
+rcu::qs_try_advance()
+{
+  uint64_t e = qs_epoch_.load(memory_order_seq_cst);
+  const unsigned n = coreid::core_count();
+  for (unsigned i = 0; i < n; i++) {
+    const uint64_t l = qs_[i].epoch_.load(memory_order_seq_cst);
+    if (l && l != e) {
+      ++evt_rcu_qs_blocked_advances;
+      return;
+    }
+  }
+  if (qs_epoch_.compare_exchange_strong(e, e + 1, memory_order_seq_cst))
+    ++evt_rcu_qs_epoch_advances;
+}
+
+void
+rcu::OnCoreRelease(unsigned core)
+{
+  INVARIANT(!s_instance.qs_[core].epoch_.load(memory_order_acquire));
+  sync * const s = s_instance.syncs_.view(core);
+  if (!s)
+    return;
+  // threads must leave their regions before exiting
+  ALWAYS_ASSERT(!s->depth());
+  s->do_cleanup();
+  s->do_release(true);
+  s->pin_cpu_ = -1;
+  s->local_node_ = -1;
+  s->alloc_node_ = -1;
+  s->alloc_group_ = 0;
+}
+
 rcu::rcu()
-  : syncs_()
+  : syncs_(), qs_epoch_(1)
 {
+  coreid::add_release_hook(OnCoreRelease);
   // XXX: these should really be instance members of RCU
   // we are assuming only one rcu object is ever created
   for (size_t i = 0; i < ::allocator::MAX_ARENAS; i++) {
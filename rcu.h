@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include <atomic>
 #include <map>
 #include <vector>
 #include <list>
@@ -18,6 +19,8 @@
 
 class rcu {
   template <bool> friend class scoped_rcu_base;
+  friend class scoped_alloc_node;
+  friend class scoped_alloc_pack_group;
 public:
   class sync;
   typedef uint64_t epoch_t;
@@ -76,8 +79,17 @@ public:
   static_assert(EpochTimeMultiplier >= 1, "XX");
 
   // legacy helpers
-  static const uint64_t EpochTimeUsec = ticker::tick_us * EpochTimeMultiplier;
-  static const uint64_t EpochTimeNsec = EpochTimeUsec * 1000;
+  static inline uint64_t
+  EpochTimeUsec()
+  {
+    return ticker::TickUsec() * EpochTimeMultiplier;
+  }
+
+  static inline uint64_t
+  EpochTimeNsec()
+  {
+    return EpochTimeUsec() * 1000;
+  }
 
   static const size_t NQueueGroups = 32;
 
@@ -88,11 +100,14 @@ public:
   class sync {
     friend class rcu;
     template <bool> friend class scoped_rcu_base;
+    friend class scoped_alloc_node;
+    friend class scoped_alloc_pack_group;
   public:
     px_queue queue_;
     px_queue scratch_;
     unsigned depth_; // 0 indicates no rcu region
-    unsigned last_reaped_epoch_;
+    uint64_t last_reaped_epoch_;
+    bool in_backpressure_;
 #ifdef ENABLE_EVENT_COUNTERS
     uint64_t last_reaped_timestamp_us_;
     uint64_t last_release_timestamp_us_;
@@ -103,7 +118,16 @@ public:
 
     // local memory allocator
     ssize_t pin_cpu_;
+    int local_node_; // numa node of pin_cpu_
+    int alloc_node_; // -1 to allocate from local_node_ (see scoped_alloc_node)
+    unsigned alloc_group_; // 0 for the shared pool (see scoped_alloc_pack_group)
     void *arenas_[allocator::MAX_ARENAS];
+    // memory from (or freed back from) other nodes, kept apart so it is only
+    // handed out to allocations homed on its node
+    void *node_arenas_[allocator::MAX_NUMA_NODES][allocator::MAX_ARENAS];
+    // chunks of packed hugepages, by pack group (0 unused). kept across
+    // try_release(), so a group's chunks are only handed back to the group
+    void *group_arenas_[allocator::MAX_PACK_GROUPS][allocator::MAX_ARENAS];
     size_t deallocs_[allocator::MAX_ARENAS]; // keeps track of the number of
                                              // un-released deallocations
 
@@ -112,17 +136,23 @@ public:
     sync(rcu *impl)
       : depth_(0)
       , last_reaped_epoch_(0)
+      , in_backpressure_(false)
 #ifdef ENABLE_EVENT_COUNTERS
       , last_reaped_timestamp_us_(0)
       , last_release_timestamp_us_(0)
 #endif
       , impl_(impl)
       , pin_cpu_(-1)
+      , local_node_(-1)
+      , alloc_node_(-1)
+      , alloc_group_(0)
     {
       ALWAYS_ASSERT(((uintptr_t)this % CACHELINE_SIZE) == 0);
       queue_.alloc_freelist(NQueueGroups);
       scratch_.alloc_freelist(NQueueGroups);
       NDB_MEMSET(&arenas_[0], 0, sizeof(arenas_));
+      NDB_MEMSET(&node_arenas_[0][0], 0, sizeof(node_arenas_));
+      NDB_MEMSET(&group_arenas_[0][0], 0, sizeof(group_arenas_));
       NDB_MEMSET(&deallocs_[0], 0, sizeof(deallocs_));
     }
 
@@ -158,9 +188,26 @@ public:
 
     inline unsigned depth() const { return depth_; }
 
+    // bytes queued on this core for reclamation (see free_with_fn())
+    inline size_t
+    pending_bytes() const
+    {
+      return queue_.get_bytes();
+    }
+
+    // rcu ticks the oldest entry queued on this core has waited, 0 if none
+    uint64_t oldest_pending_age() const;
+
+    // while more than the garbage cap is pending here, reclaims what it can
+    // and waits for the rest to become reclaimable. outside rcu regions
+    // only, since waiting in one would hold back reclamation everywhere
+    void do_backpressure();
+
   private:
 
-    void do_release();
+    // packed chunks are only released along with the rest when the core
+    // changes hands (their hugepages then join the shared pool)
+    void do_release(bool with_groups = false);
 
     inline void
     ensure_arena(size_t arena)
@@ -170,6 +217,26 @@ public:
       INVARIANT(pin_cpu_ >= 0);
       arenas_[arena] = allocator::AllocateArenas(pin_cpu_, arena);
     }
+
+    inline void
+    ensure_node_arena(int node, size_t arena)
+    {
+      if (likely(node_arenas_[node][arena]))
+        return;
+      INVARIANT(pin_cpu_ >= 0);
+      node_arenas_[node][arena] =
+        allocator::AllocateArenasOnNode(node, pin_cpu_, arena);
+    }
+
+    inline void
+    ensure_group_arena(unsigned group, size_t arena)
+    {
+      if (likely(group_arenas_[group][arena]))
+        return;
+      INVARIANT(pin_cpu_ >= 0);
+      group_arenas_[group][arena] =
+        allocator::AllocatePackedArenas(pin_cpu_, arena, group);
+    }
   };
 
   // thin forwarders
@@ -207,7 +274,8 @@ public:
     mysync().do_cleanup();
   }
 
-  void free_with_fn(void *p, deleter_t fn);
+  // sz, if known, is accounted to the pending bytes (see SetGarbageCap())
+  void free_with_fn(void *p, deleter_t fn, size_t sz = 0);
 
   template <typename T>
   inline void
@@ -250,9 +318,35 @@ public:
   inline uint64_t
   cleaning_rcu_tick_exclusive() const
   {
+    if (unlikely(IsQuiescentStateMode()))
+      // see qs_try_advance()
+      return qs_epoch_.load(std::memory_order_acquire) - 1;
     return to_rcu_ticks(ticker::s_instance.global_last_tick_exclusive());
   }
 
+  /**
+   * In quiescent state mode, grace periods are tracked by rcu itself instead
+   * of by ticker epochs: each thread announces the epoch it enters its
+   * outermost region in, and the epoch advances as soon as every thread in a
+   * region has announced the current one. So a grace period takes as long
+   * as the longest region running when it starts, rather than a couple of
+   * ticks, and garbage is reclaimed within microseconds under short regions.
+   * Threads with garbage advance the epoch when they leave their regions.
+   *
+   * Must be set before any thread enters an rcu region
+   */
+  static void
+  SetQuiescentStateMode(bool enabled)
+  {
+    g_qs_mode.store(enabled, std::memory_order_release);
+  }
+
+  static inline bool
+  IsQuiescentStateMode()
+  {
+    return g_qs_mode.load(std::memory_order_relaxed);
+  }
+
   // pin the current thread to CPU.
   //
   // this CPU number corresponds to the ones exposed by
@@ -263,6 +357,23 @@ public:
 
   void fault_region();
 
+  // a thread leaving its rcu region with more than bytes queued for
+  // reclamation waits until it is back under bytes (see
+  // sync::do_backpressure()), so a thread stalled in a region slows down
+  // the others' deallocations rather than letting garbage grow without
+  // bound. 0 (the default) for no cap
+  static void
+  SetGarbageCap(size_t bytes)
+  {
+    g_garbage_cap.store(bytes, std::memory_order_release);
+  }
+
+  static inline size_t
+  GarbageCap()
+  {
+    return g_garbage_cap.load(std::memory_order_relaxed);
+  }
+
   static rcu s_instance CACHE_ALIGNED; // system wide instance
 
   static void Test();
@@ -279,7 +390,61 @@ private:
 
   inline sync &mysync() { return syncs_.my(this); }
 
+  // readies core's sync for the next thread to get the core id: reaps what
+  // it can and gives its arenas back, leaving the rest of its queue to
+  // the next owner
+  static void OnCoreRelease(unsigned core);
+
+  // the epoch a free at cur_tick (in ticker units) is reclaimable after
+  inline uint64_t
+  free_tick(uint64_t cur_tick) const
+  {
+    if (unlikely(IsQuiescentStateMode()))
+      return qs_epoch_.load(std::memory_order_seq_cst);
+    // all threads are either at cur_tick or cur_tick + 1, so we must wait for
+    // the system to move beyond cur_tick + 1
+    return to_rcu_ticks(cur_tick + 1);
+  }
+
+  inline void
+  qs_enter()
+  {
+    qsinfo &q = qs_[coreid::core_id()];
+    uint64_t e = qs_epoch_.load(std::memory_order_acquire);
+    for (;;) {
+      q.epoch_.store(e, std::memory_order_seq_cst);
+      // an epoch advanced before we were visible does not count us
+      const uint64_t e1 = qs_epoch_.load(std::memory_order_seq_cst);
+      if (likely(e1 == e))
+        return;
+      e = e1;
+    }
+  }
+
+  inline void
+  qs_exit()
+  {
+    qs_[coreid::core_id()].epoch_.store(0, std::memory_order_release);
+  }
+
+  // advances the epoch if every thread in a region has announced it. garbage
+  // freed in epoch e is reclaimable once the epoch is e + 2: every region
+  // which could have seen it began before the advance to e + 1
+  void qs_try_advance();
+
   percore_lazy<sync> syncs_;
+
+  struct qsinfo {
+    // epoch announced on entering the outermost region, 0 outside of one
+    std::atomic<uint64_t> epoch_;
+    qsinfo() : epoch_(0) {}
+  };
+
+  percore<qsinfo> qs_;
+  std::atomic<uint64_t> qs_epoch_;
+
+  static std::atomic<size_t> g_garbage_cap;
+  static std::atomic<bool> g_qs_mode;
 };
 
 template <bool DoCleanup>
@@ -295,7 +460,8 @@ public:
     : sync_(&rcu::s_instance.mysync()),
       guard_(ticker::s_instance)
   {
-    sync_->depth_++;
+    if (!sync_->depth_++ && unlikely(rcu::IsQuiescentStateMode()))
+      rcu::s_instance.qs_enter();
   }
 
   ~scoped_rcu_base()
@@ -303,10 +469,15 @@ public:
     INVARIANT(sync_->depth_);
     const unsigned new_depth = --sync_->depth_;
     guard_.destroy();
+    if (!new_depth && unlikely(rcu::IsQuiescentStateMode()))
+      rcu::s_instance.qs_exit();
     if (new_depth || !DoCleanup)
       return;
     // out of RCU region now, check if we need to run cleaner
     sync_->do_cleanup();
+    const size_t cap = rcu::GarbageCap();
+    if (unlikely(cap && sync_->pending_bytes() > cap))
+      sync_->do_backpressure();
   }
 
   inline ticker::guard *
@@ -328,6 +499,75 @@ private:
 
 typedef scoped_rcu_base<true> scoped_rcu_region;
 
+/**
+ * Homes the current thread's allocations on a numa node while in scope, so
+ * a table bound to a node (see concurrent_btree::set_numa_node()) keeps its
+ * nodes and records in that node's memory no matter which core inserts them.
+ * A node < 0 leaves allocations on the thread's own node
+ */
+class scoped_alloc_node {
+public:
+  scoped_alloc_node(const scoped_alloc_node &) = delete;
+  scoped_alloc_node &operator=(const scoped_alloc_node &) = delete;
+
+  explicit scoped_alloc_node(int node)
+    : sync_(nullptr), prev_(-1)
+  {
+    if (likely(node < 0))
+      return;
+    INVARIANT(size_t(node) < allocator::MAX_NUMA_NODES);
+    sync_ = &rcu::s_instance.mysync();
+    prev_ = sync_->alloc_node_;
+    sync_->alloc_node_ = node;
+  }
+
+  ~scoped_alloc_node()
+  {
+    if (sync_)
+      sync_->alloc_node_ = prev_;
+  }
+
+private:
+  rcu::sync *sync_;
+  int prev_;
+};
+
+/**
+ * Packs the current thread's allocations into the hugepages of pack group
+ * group while in scope, so the records of a table given a group of its own
+ * (see concurrent_btree::set_pack_group()) sit on a few hugepages instead of
+ * being spread over every table's, and scans over it touch fewer TLB
+ * entries. Chunks freed go back to their group's lists on whichever core
+ * frees them. A group of 0 leaves allocations in the shared pool, as does a
+ * table homed on a remote node (see scoped_alloc_node)
+ */
+class scoped_alloc_pack_group {
+public:
+  scoped_alloc_pack_group(const scoped_alloc_pack_group &) = delete;
+  scoped_alloc_pack_group &operator=(const scoped_alloc_pack_group &) = delete;
+
+  explicit scoped_alloc_pack_group(unsigned group)
+    : sync_(nullptr), prev_(0)
+  {
+    if (likely(!group))
+      return;
+    INVARIANT(group < allocator::MAX_PACK_GROUPS);
+    sync_ = &rcu::s_instance.mysync();
+    prev_ = sync_->alloc_group_;
+    sync_->alloc_group_ = group;
+  }
+
+  ~scoped_alloc_pack_group()
+  {
+    if (sync_)
+      sync_->alloc_group_ = prev_;
+  }
+
+private:
+  rcu::sync *sync_;
+  unsigned prev_;
+};
+
 class disabled_rcu_region {};
 
 #endif /* _RCU_H_ */
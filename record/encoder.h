@@ -2,6 +2,7 @@
 #define _NDB_BENCH_ENCODER_H_
 
 #include <string>
+#include <type_traits>
 #include <stdint.h>
 #include "serializer.h"
 #include "../util.h"
@@ -13,6 +14,73 @@
 
 // the C preprocessor is absolutely wonderful...
 
+// the ways a field can be folded into another without reading it first:
+// the result does not depend on the order the values are folded in (see
+// typed_txn_btree::aggregate()). counts are sums of ones
+enum aggregate_op {
+  AGGREGATE_SUM,
+  AGGREGATE_MAX,
+  AGGREGATE_MIN,
+};
+
+// folds the field at src into the field at dst (neither need be aligned).
+// only numeric fields can be aggregated
+typedef void (*generic_aggregate_fn)(uint8_t *, const uint8_t *);
+
+template <typename T, bool = std::is_arithmetic<T>::value>
+struct generic_aggregator {
+  static void
+  add(uint8_t *dst, const uint8_t *src)
+  {
+    ALWAYS_ASSERT(false);
+  }
+
+  static void
+  max(uint8_t *dst, const uint8_t *src)
+  {
+    ALWAYS_ASSERT(false);
+  }
+
+  static void
+  min(uint8_t *dst, const uint8_t *src)
+  {
+    ALWAYS_ASSERT(false);
+  }
+};
+
+template <typename T>
+struct generic_aggregator<T, true> {
+  static void
+  add(uint8_t *dst, const uint8_t *src)
+  {
+    T a, b;
+    NDB_MEMCPY(&a, dst, sizeof(T));
+    NDB_MEMCPY(&b, src, sizeof(T));
+    a += b;
+    NDB_MEMCPY(dst, &a, sizeof(T));
+  }
+
+  static void
+  max(uint8_t *dst, const uint8_t *src)
+  {
+    T a, b;
+    NDB_MEMCPY(&a, dst, sizeof(T));
+    NDB_MEMCPY(&b, src, sizeof(T));
+    if (b > a)
+      NDB_MEMCPY(dst, &b, sizeof(T));
+  }
+
+  static void
+  min(uint8_t *dst, const uint8_t *src)
+  {
+    T a, b;
+    NDB_MEMCPY(&a, dst, sizeof(T));
+    NDB_MEMCPY(&b, src, sizeof(T));
+    if (b < a)
+      NDB_MEMCPY(dst, &b, sizeof(T));
+  }
+};
+
 template <typename T> struct encoder {};
 
 template <typename T>
@@ -122,6 +190,13 @@ Size(const T &t)
     obj->name = trfm(tpe, obj->name); \
   } while (0);
 
+// varints are decoded a word at a time while a full word of buf remains
+#define SERIALIZE_BOUNDED_READ_FIELD(tpe, name, compress, trfm) \
+  do { \
+    buf = serializer< tpe, compress >::read(buf, end, &obj->name); \
+    obj->name = trfm(tpe, obj->name); \
+  } while (0);
+
 #define SERIALIZE_PREFIX_READ_FIELD(tpe, name, compress, trfm) \
   do { \
     buf = serializer< tpe, compress >::read(buf, &obj->name); \
@@ -156,6 +231,11 @@ Size(const T &t)
 #define SERIALIZE_MAX_NBYTES_VALUE_FIELD_Y(tpe, name) \
   + serializer< tpe, true >::max_nbytes()
 
+#define SERIALIZE_FIXED_WIDTH_VALUE_FIELD_X(tpe, name) \
+  serializer< tpe, true >::fixed_width()
+#define SERIALIZE_FIXED_WIDTH_VALUE_FIELD_Y(tpe, name) \
+  && serializer< tpe, true >::fixed_width()
+
 #define SERIALIZE_MAX_NBYTES_PREFIX_KEY_FIELD_X(tpe, name) \
   do { \
     ret += serializer< tpe, false >::max_nbytes(); \
@@ -180,6 +260,11 @@ Size(const T &t)
 #define SERIALIZE_READ_VALUE_FIELD_X(tpe, name) \
   SERIALIZE_READ_FIELD(tpe, name, true, IDENT_TRANSFORM)
 
+#define SERIALIZE_BOUNDED_READ_KEY_FIELD_X(tpe, name) \
+  SERIALIZE_BOUNDED_READ_FIELD(tpe, name, false, BIG_TO_HOST_TRANSFORM)
+#define SERIALIZE_BOUNDED_READ_VALUE_FIELD_X(tpe, name) \
+  SERIALIZE_BOUNDED_READ_FIELD(tpe, name, true, IDENT_TRANSFORM)
+
 #define SERIALIZE_PREFIX_READ_KEY_FIELD_X(tpe, name) \
   SERIALIZE_PREFIX_READ_FIELD(tpe, name, false, BIG_TO_HOST_TRANSFORM)
 #define SERIALIZE_PREFIX_READ_VALUE_FIELD_X(tpe, name) \
@@ -207,12 +292,22 @@ Size(const T &t)
   &generic_serializer< serializer< tpe, true > >::skip,
 #define DESCRIPTOR_VALUE_FAILSAFE_SKIP_FN_X(tpe, name) \
   &generic_serializer< serializer< tpe, true > >::failsafe_skip,
+#define DESCRIPTOR_VALUE_ADD_FN_X(tpe, name) \
+  &generic_aggregator< tpe >::add,
+#define DESCRIPTOR_VALUE_MAX_FN_X(tpe, name) \
+  &generic_aggregator< tpe >::max,
+#define DESCRIPTOR_VALUE_MIN_FN_X(tpe, name) \
+  &generic_aggregator< tpe >::min,
 #define DESCRIPTOR_VALUE_MAX_NBYTES_X(tpe, name) \
   serializer< tpe, true >::max_nbytes(),
 #define DESCRIPTOR_VALUE_OFFSETOF_X(tpe, name) \
   offsetof(value, name),
 #define DESCRIPTOR_VALUE_SIZEOF_X(tpe, name) \
   sizeof(tpe),
+#define DESCRIPTOR_VALUE_FIELD_NAME_X(tpe, name) \
+  #name,
+#define DESCRIPTOR_VALUE_TYPE_NAME_X(tpe, name) \
+  #tpe,
 
 // semantics:
 
@@ -234,6 +329,12 @@ Size(const T &t)
 // const T *
 // read(const uint8_t *buf, T *obj)
 
+// Same as above, but [buf, end) is exactly the encoding, which lets varint
+// fields be decoded without reading byte by byte
+//
+// const T *
+// read(const uint8_t *buf, const uint8_t *end, T *obj)
+
 // Returns the number of bytes required to encode this specific instance
 // of obj.
 //
@@ -245,24 +346,48 @@ Size(const T &t)
   inline ALWAYS_INLINE const uint8_t * \
   write(uint8_t *buf, const struct name *obj) const \
   { \
-    encode_write(buf, obj); \
+    if (encode_fixed_layout()) \
+      *((struct name *) buf) = *obj; \
+    else \
+      encode_write(buf, obj); \
     return buf; \
   } \
   inline ALWAYS_INLINE const struct name * \
   read(const uint8_t *buf, struct name *obj) const \
   { \
-    encode_read(buf, obj); \
+    if (encode_fixed_layout()) \
+      *obj = *((const struct name *) buf); \
+    else \
+      encode_read(buf, obj); \
+    return obj; \
+  } \
+  inline ALWAYS_INLINE const struct name * \
+  read(const uint8_t *buf, const uint8_t *end, struct name *obj) const \
+  { \
+    if (encode_fixed_layout()) \
+      *obj = *((const struct name *) buf); \
+    else \
+      encode_read(buf, end, obj); \
     return obj; \
   } \
   inline ALWAYS_INLINE const struct name * \
   prefix_read(const uint8_t *buf, struct name *obj, size_t prefix) const \
   { \
-    encode_prefix_read(buf, obj, prefix); \
+    if (encode_fixed_layout()) \
+      *obj = *((const struct name *) buf); \
+    else \
+      encode_prefix_read(buf, obj, prefix); \
     return obj; \
   } \
   inline ALWAYS_INLINE const struct name * \
   failsafe_read(const uint8_t *buf, size_t nbytes, struct name *obj) const \
   { \
+    if (encode_fixed_layout()) { \
+      if (unlikely(nbytes < sizeof(*obj))) \
+        return nullptr; \
+      *obj = *((const struct name *) buf); \
+      return obj; \
+    } \
     if (unlikely(!encode_failsafe_read(buf, nbytes, obj))) \
       return nullptr; \
     return obj; \
@@ -270,6 +395,8 @@ Size(const T &t)
   inline ALWAYS_INLINE size_t \
   nbytes(const struct name *obj) const \
   { \
+    if (encode_fixed_layout()) \
+      return sizeof(*obj); \
     return encode_nbytes(obj); \
   }
 
@@ -288,6 +415,12 @@ Size(const T &t)
     return obj; \
   } \
   inline ALWAYS_INLINE const struct name * \
+  read(const uint8_t *buf, const uint8_t *end, struct name *obj) const \
+  { \
+    *obj = *((const struct name *) buf); \
+    return obj; \
+  } \
+  inline ALWAYS_INLINE const struct name * \
   prefix_read(const uint8_t *buf, struct name *obj, size_t prefix) const \
   { \
     *obj = *((const struct name *) buf); \
@@ -312,7 +445,8 @@ Size(const T &t)
   inline ALWAYS_INLINE const struct name * \
   read(lcdf::Str buf, struct name *obj) const       \
   { \
-    return read((const uint8_t *) buf.data(), obj); \
+    return read((const uint8_t *) buf.data(), \
+                (const uint8_t *) buf.data() + buf.length(), obj); \
   }
 #else
 #define DO_STRUCT_MASSTREE(name)
@@ -337,7 +471,8 @@ Size(const T &t)
   inline ALWAYS_INLINE const struct name * \
   read(const std::string &buf, struct name *obj) const \
   { \
-    return read((const uint8_t *) buf.data(), obj); \
+    return read((const uint8_t *) buf.data(), \
+                (const uint8_t *) buf.data() + buf.size(), obj); \
   } \
   DO_STRUCT_MASSTREE(name) \
   inline ALWAYS_INLINE const struct name * \
@@ -364,6 +499,10 @@ Size(const T &t)
 
 #define APPLY_X_AND_Y(x, y) x(y, y)
 
+// a struct whose fields all have fixed_width() serializers encodes to
+// exactly its (packed) in-memory layout, so its encoder is a copy and its
+// fields sit at their cstruct_offsetof()
+
 // the main macro
 #define DO_STRUCT(name, keyfields, valuefields) \
   struct name { \
@@ -458,11 +597,37 @@ Size(const T &t)
       }; \
       return failsafe_skip_fns[i]; \
     } \
+    static inline generic_aggregate_fn \
+    aggregate_fn(size_t i, aggregate_op op) \
+    { \
+      static generic_aggregate_fn add_fns[] = { \
+        APPLY_X_AND_Y(valuefields, DESCRIPTOR_VALUE_ADD_FN_X) \
+      }; \
+      static generic_aggregate_fn max_fns[] = { \
+        APPLY_X_AND_Y(valuefields, DESCRIPTOR_VALUE_MAX_FN_X) \
+      }; \
+      static generic_aggregate_fn min_fns[] = { \
+        APPLY_X_AND_Y(valuefields, DESCRIPTOR_VALUE_MIN_FN_X) \
+      }; \
+      switch (op) { \
+      case AGGREGATE_SUM: return add_fns[i]; \
+      case AGGREGATE_MAX: return max_fns[i]; \
+      case AGGREGATE_MIN: return min_fns[i]; \
+      } \
+      ALWAYS_ASSERT(false); \
+      return nullptr; \
+    } \
     static inline constexpr size_t \
     nfields() \
     { \
       return static_cast<size_t>(value::NFIELDS); \
     } \
+    static inline constexpr bool \
+    fixed_layout() \
+    { \
+      return valuefields(SERIALIZE_FIXED_WIDTH_VALUE_FIELD_X, \
+                         SERIALIZE_FIXED_WIDTH_VALUE_FIELD_Y); \
+    } \
     static inline size_t \
     max_nbytes(size_t i) \
     { \
@@ -487,6 +652,22 @@ Size(const T &t)
       }; \
       return sizeofs[i]; \
     } \
+    static inline const char * \
+    field_name(size_t i) \
+    { \
+      static const char *field_names[] = { \
+        APPLY_X_AND_Y(valuefields, DESCRIPTOR_VALUE_FIELD_NAME_X) \
+      }; \
+      return field_names[i]; \
+    } \
+    static inline const char * \
+    type_name(size_t i) \
+    { \
+      static const char *type_names[] = { \
+        APPLY_X_AND_Y(valuefields, DESCRIPTOR_VALUE_TYPE_NAME_X) \
+      }; \
+      return type_names[i]; \
+    } \
   }; \
   }; \
   inline std::ostream & \
@@ -520,6 +701,11 @@ Size(const T &t)
     APPLY_X_AND_Y(keyfields, SERIALIZE_READ_KEY_FIELD_X) \
   } \
   inline void \
+  encode_read(const uint8_t *buf, const uint8_t *end, struct name::key *obj) const \
+  { \
+    APPLY_X_AND_Y(keyfields, SERIALIZE_BOUNDED_READ_KEY_FIELD_X) \
+  } \
+  inline void \
   encode_prefix_read(const uint8_t *buf, struct name::key *obj, size_t prefix) const \
   { \
     size_t i = 0; \
@@ -542,6 +728,11 @@ Size(const T &t)
     return keyfields(SERIALIZE_MAX_NBYTES_KEY_FIELD_X, \
                      SERIALIZE_MAX_NBYTES_KEY_FIELD_Y); \
   } \
+  static inline constexpr bool \
+  encode_fixed_layout() \
+  { \
+    return false; /* fields are stored big-endian */ \
+  } \
   inline ALWAYS_INLINE size_t \
   encode_max_nbytes_prefix(size_t nfields) const \
   { \
@@ -574,6 +765,11 @@ Size(const T &t)
     APPLY_X_AND_Y(valuefields, SERIALIZE_READ_VALUE_FIELD_X) \
   } \
   inline void \
+  encode_read(const uint8_t *buf, const uint8_t *end, struct name::value *obj) const \
+  { \
+    APPLY_X_AND_Y(valuefields, SERIALIZE_BOUNDED_READ_VALUE_FIELD_X) \
+  } \
+  inline void \
   encode_prefix_read(const uint8_t *buf, struct name::value *obj, size_t prefix) const \
   { \
     size_t i = 0; \
@@ -598,6 +794,11 @@ Size(const T &t)
     return valuefields(SERIALIZE_MAX_NBYTES_VALUE_FIELD_X, \
                        SERIALIZE_MAX_NBYTES_VALUE_FIELD_Y); \
   } \
+  static inline constexpr bool \
+  encode_fixed_layout() \
+  { \
+    return name::value_descriptor::fixed_layout(); \
+  } \
   inline ALWAYS_INLINE size_t \
   encode_max_nbytes_prefix(size_t nfields) const \
   { \
@@ -622,4 +823,23 @@ struct schema {
   typedef encoder<value_type> value_encoder_type;
 };
 
+// a table split into hot and cold fields (see vertical_txn_btree) is two
+// structs over the same key fields: name, with the hot fields, and
+// name##_cold, with the cold ones
+#define DO_SPLIT_STRUCT(name, keyfields, hotfields, coldfields) \
+  DO_STRUCT(name, keyfields, hotfields) \
+  DO_STRUCT(name##_cold, keyfields, coldfields)
+
+// the schema of the cold part of a split table: Hot's keys (so both parts
+// are keyed by the same type), and Cold's values
+template <typename Hot, typename Cold>
+struct cold_schema {
+  typedef Cold base_type;
+  typedef typename Hot::key key_type;
+  typedef typename Cold::value value_type;
+  typedef typename Cold::value_descriptor value_descriptor_type;
+  typedef encoder<key_type> key_encoder_type;
+  typedef encoder<value_type> value_encoder_type;
+};
+
 #endif /* _NDB_BENCH_ENCODER_H_ */
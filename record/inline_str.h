@@ -293,6 +293,14 @@ struct serializer< inline_str_base<IntSizeType, N>, Compress > {
     return buf + obj->sz;
   }
 
+  static const uint8_t *
+  read(const uint8_t *buf, const uint8_t *end, obj_type *obj)
+  {
+    buf = serializer<IntSizeType, Compress>::read(buf, end, &obj->sz);
+    NDB_MEMCPY(&obj->buf[0], buf, obj->sz);
+    return buf + obj->sz;
+  }
+
   static const uint8_t *
   failsafe_read(const uint8_t *buf, size_t nbytes, obj_type *obj)
   {
@@ -347,6 +355,12 @@ struct serializer< inline_str_base<IntSizeType, N>, Compress > {
   {
     return serializer<IntSizeType, Compress>::max_bytes() + N;
   }
+
+  static inline constexpr bool
+  fixed_width()
+  {
+    return false;
+  }
 };
 
 #endif /* _NDB_BENCH_INLINE_STR_H_ */
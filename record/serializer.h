@@ -83,6 +83,13 @@ struct serializer {
     return (const uint8_t *) (p + 1);
   }
 
+  // like read(), but knows the encoding ends at or before end
+  static inline const uint8_t *
+  read(const uint8_t *buf, const uint8_t *end, T *obj)
+  {
+    return read(buf, obj);
+  }
+
   static inline const uint8_t *
   failsafe_read(const uint8_t *buf, size_t nbytes, T *obj)
   {
@@ -120,6 +127,13 @@ struct serializer {
   {
     return sizeof(T);
   }
+
+  // whether every value encodes to max_nbytes(), as a copy of its bytes
+  static inline constexpr bool
+  fixed_width()
+  {
+    return true;
+  }
 };
 
 // serializer<T, True> specializations
@@ -139,6 +153,14 @@ struct serializer<uint32_t, true> {
     return read_uvint32(buf, obj);
   }
 
+  static inline const uint8_t *
+  read(const uint8_t *buf, const uint8_t *end, uint32_t *obj)
+  {
+    if (likely(end - buf >= 8))
+      return read_uvint32_word(buf, obj);
+    return read_uvint32(buf, obj);
+  }
+
   static inline const uint8_t *
   failsafe_read(const uint8_t *buf, size_t nbytes, uint32_t *obj)
   {
@@ -168,6 +190,12 @@ struct serializer<uint32_t, true> {
   {
     return 5;
   }
+
+  static inline constexpr bool
+  fixed_width()
+  {
+    return false;
+  }
 };
 
 template <>
@@ -190,6 +218,15 @@ struct serializer<int32_t, true> {
     return buf;
   }
 
+  static inline const uint8_t *
+  read(const uint8_t *buf, const uint8_t *end, int32_t *obj)
+  {
+    uint32_t v;
+    buf = serializer<uint32_t, true>::read(buf, end, &v);
+    *obj = decode(v);
+    return buf;
+  }
+
   static inline const uint8_t *
   failsafe_read(const uint8_t *buf, size_t nbytes, int32_t *obj)
   {
@@ -226,6 +263,12 @@ struct serializer<int32_t, true> {
     return 5;
   }
 
+  static inline constexpr bool
+  fixed_width()
+  {
+    return false;
+  }
+
 private:
   // zig-zag encoding from:
   // http://code.google.com/p/protobuf/source/browse/trunk/src/google/protobuf/wire_format_lite.h
@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+
+# compares two files of benchmark results, as written by dbtest's
+# --json-output (a json object per line, one per run), and flags the
+# metrics which regressed. runs are grouped by their config, so a file may
+# hold repeated runs of several configurations; the repeats are what tell a
+# regression apart from noise.
+#
+# exits with status 1 if anything regressed, for use from nightly scripts:
+#
+#   ./scripts/bench_compare.py baseline.json candidate.json
+
+from __future__ import print_function
+
+import argparse
+import json
+import math
+import sys
+
+# config keys which do not change what a run measures
+IGNORED_CONFIG_KEYS = set(['cmdline'])
+
+LATENCY_PERCENTILES = ['p50_us', 'p99_us', 'p99.9_us']
+
+def metrics(run):
+  # yields (name, value, higher_is_better)
+  yield 'agg_throughput', run['agg_throughput'], True
+  yield 'agg_abort_rate', run['agg_abort_rate'], False
+  yield ('agg_persist_throughput',
+         run['persistence']['agg_persist_throughput'], True)
+  for p in LATENCY_PERCENTILES:
+    yield 'latency.%s' % p, run['latency'][p], False
+  for reason, rate in run['abort_rates'].items():
+    yield 'abort_rates.%s' % reason, rate, False
+  for txn, d in run['txns'].items():
+    if d['latency']['count']:
+      yield 'txns.%s.latency.p99_us' % txn, d['latency']['p99_us'], False
+
+def config_key(run):
+  return tuple(sorted((k, v) for k, v in run['config'].items()
+                      if k not in IGNORED_CONFIG_KEYS))
+
+def load(fname):
+  groups = {}
+  with open(fname) as f:
+    for line in f:
+      line = line.strip()
+      if not line:
+        continue
+      run = json.loads(line)
+      groups.setdefault(config_key(run), []).append(run)
+  return groups
+
+def mean_stddev(xs):
+  m = sum(xs) / float(len(xs))
+  if len(xs) < 2:
+    return m, 0.0
+  return m, math.sqrt(sum((x - m) ** 2 for x in xs) / float(len(xs) - 1))
+
+def by_metric(runs):
+  ret = {}
+  for run in runs:
+    for name, v, higher_is_better in metrics(run):
+      ret.setdefault(name, ([], higher_is_better))[0].append(float(v))
+  return ret
+
+def compare(base_runs, cand_runs, threshold, sigmas):
+  # returns a list of (name, base_mean, cand_mean, change, regressed)
+  ret = []
+  base, cand = by_metric(base_runs), by_metric(cand_runs)
+  for name in sorted(set(base) & set(cand)):
+    bxs, higher_is_better = base[name]
+    cxs, _ = cand[name]
+    bm, bs = mean_stddev(bxs)
+    cm, cs = mean_stddev(cxs)
+    if bm == 0.0 and cm == 0.0:
+      continue
+    change = (cm - bm) / abs(bm) if bm != 0.0 else float('inf')
+    worse = -change if higher_is_better else change
+    regressed = worse > threshold
+    # with repeated runs, the difference must also stand out of the noise
+    if regressed and len(bxs) > 1 and len(cxs) > 1:
+      stderr = math.sqrt(bs ** 2 / len(bxs) + cs ** 2 / len(cxs))
+      regressed = abs(cm - bm) > sigmas * stderr
+    ret.append((name, bm, cm, change, regressed))
+  return ret
+
+def describe(key):
+  d = dict(key)
+  return ' '.join('%s=%s' % (k, d[k]) for k in
+                  ('bench', 'db-type', 'num-threads', 'scale-factor', 'bench-opts')
+                  if d.get(k))
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='flag regressions between two files of benchmark results')
+  parser.add_argument('baseline')
+  parser.add_argument('candidate')
+  parser.add_argument('--threshold', type=float, default=5.0,
+                      help='%% change in the worse direction to flag (default 5)')
+  parser.add_argument('--sigmas', type=float, default=2.0,
+                      help='std errors the change must exceed, with repeated runs (default 2)')
+  parser.add_argument('--all', action='store_true',
+                      help='print every metric, not just the regressed ones')
+  args = parser.parse_args()
+
+  base, cand = load(args.baseline), load(args.candidate)
+  nregressed = 0
+  for key in sorted(set(base) | set(cand)):
+    if key not in base or key not in cand:
+      print('[WARNING] config only in %s: %s' %
+            (args.baseline if key in base else args.candidate, describe(key)),
+            file=sys.stderr)
+      continue
+    rows = compare(base[key], cand[key], args.threshold / 100.0, args.sigmas)
+    print('%s (%d vs %d runs)' % (describe(key), len(base[key]), len(cand[key])))
+    for name, bm, cm, change, regressed in rows:
+      if regressed or args.all:
+        print('  %s %-50s %14.2f -> %14.2f (%+.1f%%)' %
+              ('REGRESSED' if regressed else '         ',
+               name, bm, cm, change * 100.0))
+      nregressed += regressed
+  print('%d regressions' % nregressed)
+  return 1 if nregressed else 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,455 @@
+#ifndef _NDB_SHARDED_TXN_BTREE_H_
+#define _NDB_SHARDED_TXN_BTREE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crc32c.h"
+#include "rcu.h"
+#include "ticker.h"
+#include "txn_btree.h"
+
+/**
+ * A table kept in several txn_btrees (shards), for tables whose inserts all
+ * land at one end of the key space (sequential ids, timestamps): in a single
+ * tree, those all lock and bump the versions of the same rightmost nodes.
+ *
+ * An immutable router cuts the key space into ranges, each of which goes to
+ * one shard, or is striped over several by a hash of the key (so that
+ * consecutive keys land on different shards). Point reads and writes go to
+ * their key's shard. Scans merge the shards a range touches in key order,
+ * a chunk of ScanChunkNRecords records from each at a time, all within the
+ * scanning txn. Only forward scans are supported.
+ *
+ * resplit() replaces the router while the table is in use. The records
+ * whose shard changes are moved in txns of their own, and until they all
+ * have been, reads and writes of a key look in both its old and new shards
+ * (so they serialize against the moves like any other conflicting txns).
+ *
+ * The shards are fixed at construction, and are logged as tables of their
+ * own; the router is not, so a table recovered from the log must be given
+ * the ranges it had.
+ */
+template <template <typename> class Transaction>
+class sharded_txn_btree {
+public:
+
+  typedef txn_btree<Transaction> shard_type;
+  typedef typename shard_type::key_type key_type;
+  typedef typename shard_type::value_type value_type;
+  typedef typename shard_type::string_type string_type;
+  typedef typename shard_type::keystring_type keystring_type;
+  typedef typename shard_type::size_type size_type;
+  typedef typename shard_type::search_range_callback search_range_callback;
+
+  static const size_t ScanChunkNRecords = 64;
+  static const size_t MoveChunkNRecords = 256;
+
+  // keys in [lower_, the next range's lower_) go to shards_[0], or are
+  // striped over shards_ if there are several
+  struct range {
+    std::string lower_;
+    std::vector<size_t> shards_;
+  };
+
+  // starts out as one range striped over all nshards shards, which are
+  // named name + "_" + i
+  sharded_txn_btree(size_t nshards,
+                    size_type value_size_hint = 128,
+                    bool mostly_append = false,
+                    const std::string &name = "<unknown>")
+    : name(name), routes(nullptr)
+  {
+    ALWAYS_ASSERT(nshards);
+    range all;
+    for (size_t i = 0; i < nshards; i++) {
+      shards.emplace_back(new shard_type(
+            value_size_hint, mostly_append, name + "_" + std::to_string(i)));
+      all.shards_.push_back(i);
+    }
+    routes.store(new router{{all}, nullptr}, std::memory_order_release);
+  }
+
+  ~sharded_txn_btree()
+  {
+    delete routes.load(std::memory_order_acquire);
+  }
+
+  inline const std::string &
+  get_name() const
+  {
+    return name;
+  }
+
+  inline size_t
+  nshards() const
+  {
+    return shards.size();
+  }
+
+  inline shard_type &
+  shard(size_t i)
+  {
+    return *shards[i];
+  }
+
+  inline size_t
+  size_estimate() const
+  {
+    size_t n = 0;
+    for (auto &s : shards)
+      n += s->size_estimate();
+    return n;
+  }
+
+  // the ranges keys are routed by
+  std::vector<range>
+  get_ranges() const
+  {
+    scoped_rcu_region guard;
+    return cur_router()->ranges_;
+  }
+
+  template <typename Traits>
+  inline bool
+  search(Transaction<Traits> &t, const key_type &k, value_type &v)
+  {
+    const router &r = *cur_router();
+    shard_type &s = shard_for(r, k);
+    if (s.search(t, k, v))
+      return true;
+    shard_type * const from = moving_from(r, k, s);
+    return from && from->search(t, k, v);
+  }
+
+  template <typename Traits>
+  inline void
+  put(Transaction<Traits> &t, const key_type &k, const value_type &v)
+  {
+    const router &r = *cur_router();
+    shard_type &s = shard_for(r, k);
+    s.put(t, k, v);
+    remove_moving(t, r, k, s);
+  }
+
+  template <typename Traits>
+  inline void
+  insert(Transaction<Traits> &t, const key_type &k, const value_type &v)
+  {
+    const router &r = *cur_router();
+    shard_type &s = shard_for(r, k);
+    s.insert(t, k, v);
+    remove_moving(t, r, k, s);
+  }
+
+  template <typename Traits>
+  inline void
+  remove(Transaction<Traits> &t, const key_type &k)
+  {
+    const router &r = *cur_router();
+    shard_type &s = shard_for(r, k);
+    s.remove(t, k);
+    remove_moving(t, r, k, s);
+  }
+
+  // the records in [lower, upper) (upper null for no bound), in key order
+  template <typename Traits>
+  void search_range_call(Transaction<Traits> &t,
+                         const key_type &lower,
+                         const key_type *upper,
+                         search_range_callback &callback);
+
+  template <typename Traits, typename T>
+  inline void
+  search_range(Transaction<Traits> &t,
+               const key_type &lower,
+               const key_type *upper,
+               T &callback)
+  {
+    type_callback_wrapper<T> w(&callback);
+    search_range_call(t, lower, upper, w);
+  }
+
+  /**
+   * Routes keys by ranges from now on, which must start at "" and be in
+   * order. Moves the records whose shard changes in txns of
+   * MoveChunkNRecords keys, at most max_per_sec of them a second (0 for no
+   * limit), and returns once all have moved. Resplits are serialized
+   */
+  template <typename Traits>
+  void resplit(const std::vector<range> &ranges, uint64_t max_per_sec = 0);
+
+private:
+
+  struct router {
+    std::vector<range> ranges_;
+    // during resplit(), the router the records are still moving from
+    const router *moving_from_;
+  };
+
+  template <typename T>
+  class type_callback_wrapper : public search_range_callback {
+  public:
+    constexpr type_callback_wrapper(T *callback)
+      : callback(callback) {}
+    virtual bool
+    invoke(const keystring_type &k, const string_type &v)
+    {
+      return callback->operator()(k, v);
+    }
+  private:
+    T *const callback;
+  };
+
+  // valid for as long as the caller stays in its RCU region (txns do)
+  inline const router *
+  cur_router() const
+  {
+    return routes.load(std::memory_order_acquire);
+  }
+
+  static inline size_t
+  RangeOf(const router &r, const std::string &k)
+  {
+    auto it = std::upper_bound(
+        r.ranges_.begin(), r.ranges_.end(), k,
+        [](const std::string &k, const range &rg) { return k < rg.lower_; });
+    INVARIANT(it != r.ranges_.begin());
+    return (it - r.ranges_.begin()) - 1;
+  }
+
+  inline size_t
+  shard_index_for(const router &r, const std::string &k) const
+  {
+    const std::vector<size_t> &ss = r.ranges_[RangeOf(r, k)].shards_;
+    if (ss.size() == 1)
+      return ss[0];
+    return ss[crc32c::Value(k.data(), k.size()) % ss.size()];
+  }
+
+  inline shard_type &
+  shard_for(const router &r, const std::string &k)
+  {
+    return *shards[shard_index_for(r, k)];
+  }
+
+  // k's shard under the router records are moving from, if not s
+  inline shard_type *
+  moving_from(const router &r, const std::string &k, shard_type &s)
+  {
+    if (likely(!r.moving_from_))
+      return nullptr;
+    shard_type &from = shard_for(*r.moving_from_, k);
+    return &from == &s ? nullptr : &from;
+  }
+
+  // a write of k to s also takes k out of its old shard, if it is still
+  // there
+  template <typename Traits>
+  inline void
+  remove_moving(Transaction<Traits> &t, const router &r,
+                const key_type &k, shard_type &s)
+  {
+    shard_type * const from = moving_from(r, k, s);
+    if (likely(!from))
+      return;
+    value_type v;
+    if (from->search(t, k, v))
+      from->remove(t, k);
+  }
+
+  // the shards which may hold keys in [lower, upper) under r
+  void add_shards_of(const router &r, const key_type &lower,
+                     const key_type *upper, std::vector<size_t> &ss) const;
+
+  // moves the records of shard i which r routes elsewhere. returns the
+  // number moved
+  template <typename Traits>
+  size_t move_misplaced(size_t i, const router &r,
+                        uint64_t max_per_sec, uint64_t t0, size_t &nscanned);
+
+  const std::string name;
+  std::vector<std::unique_ptr<shard_type>> shards;
+  // replaced as a whole (the old router freed by RCU)
+  std::atomic<const router *> routes;
+  std::mutex resplit_lock;
+};
+
+template <template <typename> class Transaction>
+void
+sharded_txn_btree<Transaction>::add_shards_of(
+    const router &r, const key_type &lower, const key_type *upper,
+    std::vector<size_t> &ss) const
+{
+  const size_t first = RangeOf(r, lower);
+  for (size_t i = first; i < r.ranges_.size(); i++) {
+    if (upper && i > first && r.ranges_[i].lower_ >= *upper)
+      break;
+    for (auto s : r.ranges_[i].shards_)
+      if (std::find(ss.begin(), ss.end(), s) == ss.end())
+        ss.push_back(s);
+  }
+}
+
+template <template <typename> class Transaction>
+template <typename Traits>
+void
+sharded_txn_btree<Transaction>::search_range_call(
+    Transaction<Traits> &t,
+    const key_type &lower,
+    const key_type *upper,
+    search_range_callback &callback)
+{
+  const router &r = *cur_router();
+  std::vector<size_t> ss;
+  add_shards_of(r, lower, upper, ss);
+  if (r.moving_from_)
+    add_shards_of(*r.moving_from_, lower, upper, ss);
+  if (ss.size() == 1) {
+    shards[ss[0]]->search_range_call(t, lower, upper, callback);
+    return;
+  }
+
+  // a chunk of each shard's records at a time, refilled (from just past
+  // its last key) when used up
+  struct stream {
+    shard_type *s_;
+    std::vector<std::pair<std::string, std::string>> recs_;
+    size_t pos_;
+    std::string next_;
+    bool last_chunk_;
+  };
+  std::vector<stream> streams;
+  for (auto i : ss)
+    streams.push_back(stream{shards[i].get(), {}, 0, lower, false});
+  auto fill = [&t, upper](stream &st) {
+    st.recs_.clear();
+    st.pos_ = 0;
+    auto collect = [&st](const keystring_type &k, const string_type &v) {
+      st.recs_.emplace_back(std::string(k.data(), k.length()), v);
+      return st.recs_.size() < ScanChunkNRecords;
+    };
+    st.s_->search_range(t, st.next_, upper, collect);
+    st.last_chunk_ = st.recs_.size() < ScanChunkNRecords;
+    if (!st.last_chunk_) {
+      st.next_ = st.recs_.back().first;
+      st.next_.push_back('\0');
+    }
+  };
+  for (auto &st : streams)
+    fill(st);
+  for (;;) {
+    stream *min = nullptr;
+    for (auto &st : streams) {
+      if (st.pos_ == st.recs_.size())
+        continue;
+      if (!min || st.recs_[st.pos_].first < min->recs_[min->pos_].first)
+        min = &st;
+    }
+    if (!min)
+      return;
+    const std::pair<std::string, std::string> &rec = min->recs_[min->pos_++];
+    if (!callback.invoke(keystring_type(rec.first.data(), rec.first.size()),
+                         rec.second))
+      return;
+    if (min->pos_ == min->recs_.size() && !min->last_chunk_)
+      fill(*min);
+  }
+}
+
+template <template <typename> class Transaction>
+template <typename Traits>
+size_t
+sharded_txn_btree<Transaction>::move_misplaced(
+    size_t i, const router &r,
+    uint64_t max_per_sec, uint64_t t0, size_t &nscanned)
+{
+  shard_type &src = *shards[i];
+  std::string after;
+  std::vector<std::string> keys;
+  size_t nmoved = 0;
+  for (;;) {
+    // the chunk's keys are read off the tree, and its records by the txn
+    keys.clear();
+    size_t nseen = 0;
+    std::string last;
+    {
+      scoped_rcu_region guard;
+      auto next_key =
+        [this, &r, i, &after, &keys, &nseen, &last](
+            const std::string &k, typename concurrent_btree::value_type) {
+          if (k == after)
+            return true;
+          nseen++;
+          last = k;
+          if (shard_index_for(r, k) != i)
+            keys.push_back(k);
+          return nseen < MoveChunkNRecords;
+        };
+      src.get_underlying_btree()->search_range(varkey(after), nullptr, next_key);
+    }
+    size_t n = 0;
+    {
+      typename Traits::StringAllocator arena;
+      Transaction<Traits> t(0, arena);
+      try {
+        value_type v;
+        for (auto &k : keys)
+          if (src.search(t, k, v)) {
+            shard_for(r, k).put(t, k, v);
+            src.remove(t, k);
+            n++;
+          }
+        t.commit(true);
+      } catch (transaction_abort_exception &ex) {
+        continue;
+      }
+    }
+    nmoved += n;
+    nscanned += nseen;
+    if (nseen < MoveChunkNRecords)
+      return nmoved;
+    after = last;
+    ticker::Throttle(max_per_sec, t0, nscanned);
+  }
+}
+
+template <template <typename> class Transaction>
+template <typename Traits>
+void
+sharded_txn_btree<Transaction>::resplit(
+    const std::vector<range> &ranges, uint64_t max_per_sec)
+{
+  ALWAYS_ASSERT(!ranges.empty() && ranges[0].lower_.empty());
+  for (size_t i = 0; i < ranges.size(); i++) {
+    ALWAYS_ASSERT(!ranges[i].shards_.empty());
+    ALWAYS_ASSERT(!i || ranges[i - 1].lower_ < ranges[i].lower_);
+    for (auto s : ranges[i].shards_)
+      ALWAYS_ASSERT(s < shards.size());
+  }
+
+  std::lock_guard<std::mutex> l(resplit_lock);
+  const router * const old = routes.load(std::memory_order_acquire);
+  const router * const moving = new router{ranges, old};
+  routes.store(moving, std::memory_order_release);
+  // no txn routes by the old router alone from here on
+  ticker::WaitOutCurrentTick();
+
+  const uint64_t t0 = util::timer::cur_usec();
+  size_t nscanned = 0;
+  for (size_t i = 0; i < shards.size(); i++)
+    move_misplaced<Traits>(i, *moving, max_per_sec, t0, nscanned);
+
+  routes.store(new router{ranges, nullptr}, std::memory_order_release);
+  scoped_rcu_region guard;
+  rcu::s_instance.free(const_cast<router *>(old));
+  rcu::s_instance.free(const_cast<router *>(moving));
+}
+
+#endif /* _NDB_SHARDED_TXN_BTREE_H_ */
@@ -1,18 +1,22 @@
 #ifndef _SPINBARRIER_H_
 #define _SPINBARRIER_H_
 
+#include <atomic>
+
 #include "amd64.h"
+#include "futex.h"
 #include "macros.h"
 #include "util.h"
 
 /**
- * Barrier implemented by spinning
+ * Barrier implemented by spinning, and then blocking (so threads waiting on
+ * a barrier for a long time, ie while the db loads, don't burn their cores)
  */
 
 class spin_barrier {
 public:
   spin_barrier(size_t n)
-    : n(n)
+    : n(n), released(0)
   {
     ALWAYS_ASSERT(n > 0);
   }
@@ -34,20 +38,33 @@ public:
     for (;;) {
       size_t copy = n;
       ALWAYS_ASSERT(copy > 0);
-      if (__sync_bool_compare_and_swap(&n, copy, copy - 1))
+      if (__sync_bool_compare_and_swap(&n, copy, copy - 1)) {
+        if (copy == 1) {
+          released.store(1, std::memory_order_release);
+          // unconditionally: a waiter seeing released can destroy us, so we
+          // can't look at anything else of ours (the futex is just an address)
+          futex::WakeAll(released);
+        }
         return;
+      }
     }
   }
 
   void
   wait_for()
   {
-    while (n > 0)
+    for (unsigned i = 0; i < futex::SpinsBeforeBlocking; i++) {
+      if (released.load(std::memory_order_acquire))
+        return;
       nop_pause();
+    }
+    while (!released.load(std::memory_order_acquire))
+      futex::Wait(released, 0);
   }
 
 private:
   volatile size_t n;
+  std::atomic<uint32_t> released; // set once n hits 0
 };
 
 #endif /* _SPINBARRIER_H_ */
@@ -5,6 +5,7 @@
 
 #include "amd64.h"
 #include "macros.h"
+#include "queue_lock.h"
 #include "util.h"
 
 class spinlock {
@@ -20,7 +21,13 @@ public:
   {
     // XXX: implement SPINLOCK_BACKOFF
     uint32_t v = value;
+    unsigned spins = 0;
     while (v || !__sync_bool_compare_and_swap(&value, 0, 1)) {
+      if (unlikely(++spins == queue_lock::SpinsBeforeQueueing) &&
+          queue_lock::IsEnabled()) {
+        queue_lock::Acquire(this, [this]() { return try_lock(); });
+        break;
+      }
       nop_pause();
       v = value;
     }
@@ -30,7 +37,7 @@ public:
   inline bool
   try_lock()
   {
-    return __sync_bool_compare_and_swap(&value, 0, 1);
+    return !value && __sync_bool_compare_and_swap(&value, 0, 1);
   }
 
   inline void
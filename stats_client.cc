@@ -26,6 +26,12 @@ main(int argc, char **argv)
 {
   if (argc != 3) {
     cerr << "[usage] " << argv[0] << " sockfile counterspec" << endl;
+    cerr << "  counterspec is a ':' separated list of counter names. names" << endl;
+    cerr << "  prefixed with '@' refer to histograms. '#k' refers to the k keys" << endl;
+    cerr << "  which most often abort sampled txns. '*' dumps every counter and" << endl;
+    cerr << "  histogram in the Prometheus text format, '%' the running" << endl;
+    cerr << "  benchmark's memory report, and '^s' the access heatmap of" << endl;
+    cerr << "  each table over the last s seconds ('^' for all sampled)" << endl;
     return 1;
   }
 
@@ -51,9 +57,41 @@ main(int argc, char **argv)
   int r;
   timer loop_timer;
   for (;;) {
-    for (auto &name : counter_names) {
+    for (auto &spec : counter_names) {
+      const bool is_hist = !spec.empty() && spec[0] == '@';
+      const bool is_samples = !spec.empty() && spec[0] == '#';
+      const bool is_heatmap = !spec.empty() && spec[0] == '^';
+      if (spec == "*" || spec == "%" || is_heatmap) {
+        string req(1, (char) (is_heatmap ? stats_command::GET_ACCESS_HEATMAP :
+            spec == "*" ? stats_command::GET_ALL_METRICS :
+            stats_command::GET_MEMORY_REPORT));
+        if (is_heatmap)
+          req += spec.substr(1);
+        pkt.assign(req);
+        if ((r = pkt.sendpkt(fd))) {
+          perror("send - disconnecting");
+          return 1;
+        }
+        // as many packets as it takes, then an empty one
+        for (;;) {
+          if ((r = pkt.recvpkt(fd))) {
+            if (r == EOF)
+              return 0;
+            perror("recv - disconnecting");
+            return 1;
+          }
+          if (!pkt.size())
+            break;
+          cout.write(pkt.data(), pkt.size());
+        }
+        cout.flush();
+        continue;
+      }
+      const string name = (is_hist || is_samples) ? spec.substr(1) : spec;
       uint8_t buf[1 + name.size()];
-      buf[0] = (uint8_t) stats_command::GET_COUNTER_VALUE;
+      buf[0] = (uint8_t) (is_samples ? stats_command::GET_ABORT_SAMPLES :
+          is_hist ? stats_command::GET_HISTOGRAM_VALUE :
+          stats_command::GET_COUNTER_VALUE);
       memcpy(&buf[1], name.data(), name.size());
       pkt.assign((const char *) &buf[0], sizeof(buf));
       if ((r = pkt.sendpkt(fd))) {
@@ -66,6 +104,26 @@ main(int argc, char **argv)
         perror("recv - disconnecting");
         return 1;
       }
+      if (is_samples) {
+        // table key count error, one key per line
+        const string text(pkt.data(), pkt.size());
+        for (auto &line : split(text, '\n'))
+          if (!line.empty())
+            cout << "abort_sample " << line << endl;
+        continue;
+      }
+      if (is_hist) {
+        const get_histogram_value_t *resp =
+          (const get_histogram_value_t *) pkt.data();
+        cout << name                        << " "
+             << resp->timestamp_us_         << " "
+             << resp->d_.count_             << " "
+             << resp->d_.percentile(50)     << " "
+             << resp->d_.percentile(99)     << " "
+             << resp->d_.percentile(99.9)   << " "
+             << resp->d_.max_               << endl;
+        continue;
+      }
       const get_counter_value_t *resp = (const get_counter_value_t *) pkt.data();
       cout << name                << " "
            << resp->timestamp_us_ << " "
@@ -4,13 +4,34 @@
 #include "macros.h"
 #include "fileutils.h"
 
-enum class stats_command : uint8_t { GET_COUNTER_VALUE = 0x1 };
+enum class stats_command : uint8_t {
+  GET_COUNTER_VALUE = 0x1,
+  GET_HISTOGRAM_VALUE = 0x2,
+  GET_ABORT_SAMPLES = 0x3, // arg is the (decimal) # of keys, reply is text
+  // no arg. reply is every counter and histogram as text in the Prometheus
+  // exposition format (see stats_server::MetricsText()), in as many packets
+  // as it takes, followed by an empty packet
+  GET_ALL_METRICS = 0x4,
+  // no arg. reply is the running benchmark's memory report (see
+  // stats_server::SetMemoryReportFn()) as text, in packets like
+  // GET_ALL_METRICS
+  GET_MEMORY_REPORT = 0x5,
+  // arg is the (decimal) # of seconds back to look, none for all the
+  // accesses kept. reply is access_sampler::HeatmapString() as text, in
+  // packets like GET_ALL_METRICS
+  GET_ACCESS_HEATMAP = 0x6,
+};
 
 struct get_counter_value_t {
   uint64_t timestamp_us_; // usec
   counter_data d_;
 };
 
+struct get_histogram_value_t {
+  uint64_t timestamp_us_; // usec
+  histogram_data d_;
+};
+
 class packet {
 public:
   static const size_t MAX_DATA = 0xFFFF - 4;
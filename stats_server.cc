@@ -1,10 +1,16 @@
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <system_error>
 #include <thread>
 
 #include <unistd.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "abort_sampler.h"
+#include "access_sampler.h"
 #include "counter.h"
 #include "stats_server.h"
 #include "util.h"
@@ -12,9 +18,19 @@
 using namespace std;
 using namespace util;
 
+static mutex g_memory_report_lock;
+static function<string()> g_memory_report_fn;
+
 stats_server::stats_server(const string &sockfile)
   : sockfile_(sockfile) {}
 
+void
+stats_server::SetMemoryReportFn(function<string()> fn)
+{
+  lock_guard<mutex> l(g_memory_report_lock);
+  g_memory_report_fn = move(fn);
+}
+
 void
 stats_server::serve_forever()
 {
@@ -47,18 +63,198 @@ stats_server::serve_forever()
   }
 }
 
+void
+stats_server::ServeHttpForever(unsigned port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    throw system_error(errno, system_category(), "creating TCP socket");
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (::bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    throw system_error(errno, system_category(),
+        "binding to port " + to_string(port));
+
+  if (listen(fd, 16) < 0)
+    throw system_error(errno, system_category(),
+        "listening on port " + to_string(port));
+
+  for (;;) {
+    int cfd = accept(fd, nullptr, 0);
+    if (cfd < 0)
+      throw system_error(errno, system_category(), "accept failed");
+    thread(&stats_server::ServeHttpClient, cfd).detach();
+  }
+}
+
+// metric names are [a-zA-Z_:][a-zA-Z0-9_:]*
+static string
+MetricName(const string &name)
+{
+  string ret = "silo_";
+  for (char c : name)
+    ret.push_back(isalnum(c) || c == '_' || c == ':' ? c : '_');
+  return ret;
+}
+
+string
+stats_server::MetricsText()
+{
+  // counters made more than once (ie in a header) are summed, like
+  // event_counter::get_all_counters() would
+  map<string, counter_data> ctrs;
+  event_counter::for_each_counter([&ctrs](const string &name, const counter_data &d) {
+    counter_data &c = ctrs[name];
+    c.type_ = d.type_;
+    c += d;
+  });
+  ostringstream o;
+  for (auto &p : ctrs) {
+    const string name = MetricName(p.first);
+    if (p.second.type_ == counter_data::TYPE_COUNT) {
+      o << "# TYPE " << name << " counter\n"
+        << name << "_total " << p.second.count_ << "\n";
+      continue;
+    }
+    o << "# TYPE " << name << " summary\n"
+      << name << "_count " << p.second.count_ << "\n"
+      << name << "_sum " << p.second.sum_ << "\n"
+      << "# TYPE " << name << "_max gauge\n"
+      << name << "_max " << p.second.max_ << "\n";
+  }
+  for (auto &p : event_gauge::get_all_gauges()) {
+    const string name = MetricName(p.first);
+    o << "# TYPE " << name << " gauge\n";
+    for (size_t i = 0; i < p.second.size(); i++)
+      o << name << "{core=\"" << i << "\"} " << p.second[i] << "\n";
+  }
+  for (auto &p : event_histogram::get_all_histograms()) {
+    const string name = MetricName(p.first);
+    const histogram_data &d = p.second;
+    o << "# TYPE " << name << " summary\n"
+      << name << "{quantile=\"0.5\"} " << d.percentile(50) << "\n"
+      << name << "{quantile=\"0.99\"} " << d.percentile(99) << "\n"
+      << name << "{quantile=\"0.999\"} " << d.percentile(99.9) << "\n"
+      << name << "_count " << d.count_ << "\n"
+      << name << "_sum " << d.sum_ << "\n"
+      << "# TYPE " << name << "_max gauge\n"
+      << name << "_max " << d.max_ << "\n";
+  }
+  return o.str();
+}
+
+void
+stats_server::ServeHttpClient(int fd)
+{
+  // one request per connection: we only need to know it is a GET
+  char buf[4096];
+  const ssize_t n = read(fd, buf, sizeof(buf));
+  if (n > 0) {
+    const bool is_get = n >= 4 && !memcmp(buf, "GET ", 4);
+    const string body = is_get ? MetricsText() : string();
+    ostringstream o;
+    if (is_get)
+      o << "HTTP/1.0 200 OK\r\n"
+        << "Content-Type: text/plain; version=0.0.4\r\n";
+    else
+      o << "HTTP/1.0 405 Method Not Allowed\r\n";
+    o << "Content-Length: " << body.size() << "\r\n"
+      << "Connection: close\r\n\r\n"
+      << body;
+    const string resp = o.str();
+    if (fileutils::writeall(fd, resp.data(), resp.size()))
+      perror("send");
+  }
+  close(fd);
+}
 
 bool
 stats_server::handle_cmd_get_counter_value(const string &name, packet &pkt)
 {
   get_counter_value_t ret;
   ret.timestamp_us_ = timer::cur_usec();
-  if (!event_counter::stat(name, ret.d_))
+  // gauges read as their sum (and max) over the cores
+  if (!event_counter::stat(name, ret.d_) &&
+      !event_gauge::stat(name, ret.d_))
     cerr << "could not find counter " << name << endl;
   pkt.assign((const char *) &ret, sizeof(ret));
   return true;
 }
 
+bool
+stats_server::handle_cmd_get_histogram_value(const string &name, packet &pkt)
+{
+  get_histogram_value_t ret;
+  ret.timestamp_us_ = timer::cur_usec();
+  if (!event_histogram::stat(name, ret.d_))
+    cerr << "could not find histogram " << name << endl;
+  pkt.assign((const char *) &ret, sizeof(ret));
+  return true;
+}
+
+bool
+stats_server::handle_cmd_get_abort_samples(const string &arg, packet &pkt)
+{
+  const size_t k = arg.empty() ? abort_sampler::K : strtoul(arg.c_str(), nullptr, 10);
+  string s = abort_sampler::TopKString(k);
+  if (s.size() > packet::MAX_DATA)
+    s.resize(packet::MAX_DATA);
+  pkt.assign(s);
+  return true;
+}
+
+bool
+stats_server::handle_cmd_get_all_metrics(int fd, packet &pkt)
+{
+  return SendText(fd, MetricsText(), pkt);
+}
+
+bool
+stats_server::handle_cmd_get_memory_report(int fd, packet &pkt)
+{
+  string s;
+  {
+    lock_guard<mutex> l(g_memory_report_lock);
+    if (g_memory_report_fn)
+      s = g_memory_report_fn();
+  }
+  return SendText(fd, s, pkt);
+}
+
+bool
+stats_server::handle_cmd_get_access_heatmap(const string &arg, int fd, packet &pkt)
+{
+  const uint64_t secs = arg.empty() ? 0 : strtoul(arg.c_str(), nullptr, 10);
+  return SendText(fd, access_sampler::HeatmapString(secs * 1000000), pkt);
+}
+
+bool
+stats_server::SendText(int fd, const string &s, packet &pkt)
+{
+  // split at line ends, so every packet is whole lines
+  for (size_t off = 0; off < s.size();) {
+    size_t n = s.size() - off;
+    if (n > packet::MAX_DATA) {
+      n = packet::MAX_DATA;
+      const size_t eol = s.rfind('\n', off + n - 1);
+      if (eol != string::npos && eol >= off)
+        n = eol + 1 - off;
+    }
+    pkt.assign(s.data() + off, n);
+    if (pkt.sendpkt(fd))
+      return false;
+    off += n;
+  }
+  pkt.clear();
+  return !pkt.sendpkt(fd);
+}
+
 void
 stats_server::serve_client(int fd)
 {
@@ -86,6 +282,51 @@ stats_server::serve_client(int fd)
         pkt.sendpkt(fd);
         break;
       }
+    case static_cast<uint8_t>(stats_command::GET_HISTOGRAM_VALUE):
+      {
+        scratch.assign(pkt.data() + 1, pkt.size() - 1);
+        if (!handle_cmd_get_histogram_value(scratch, pkt)) {
+          cerr << "error on handle_cmd_get_histogram_value(), dropping" << endl;
+          return;
+        }
+        pkt.sendpkt(fd);
+        break;
+      }
+    case static_cast<uint8_t>(stats_command::GET_ABORT_SAMPLES):
+      {
+        scratch.assign(pkt.data() + 1, pkt.size() - 1);
+        if (!handle_cmd_get_abort_samples(scratch, pkt)) {
+          cerr << "error on handle_cmd_get_abort_samples(), dropping" << endl;
+          return;
+        }
+        pkt.sendpkt(fd);
+        break;
+      }
+    case static_cast<uint8_t>(stats_command::GET_ALL_METRICS):
+      {
+        if (!handle_cmd_get_all_metrics(fd, pkt)) {
+          cerr << "error on handle_cmd_get_all_metrics(), dropping" << endl;
+          return;
+        }
+        break;
+      }
+    case static_cast<uint8_t>(stats_command::GET_MEMORY_REPORT):
+      {
+        if (!handle_cmd_get_memory_report(fd, pkt)) {
+          cerr << "error on handle_cmd_get_memory_report(), dropping" << endl;
+          return;
+        }
+        break;
+      }
+    case static_cast<uint8_t>(stats_command::GET_ACCESS_HEATMAP):
+      {
+        scratch.assign(pkt.data() + 1, pkt.size() - 1);
+        if (!handle_cmd_get_access_heatmap(scratch, fd, pkt)) {
+          cerr << "error on handle_cmd_get_access_heatmap(), dropping" << endl;
+          return;
+        }
+        break;
+      }
     default:
       cerr << "bad command- dropping connection" << endl;
       return;
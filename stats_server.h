@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include "stats_common.h"
 
@@ -8,8 +9,31 @@ class stats_server {
 public:
   stats_server(const std::string &sockfile);
   void serve_forever(); // blocks current thread
+
+  // also answers every HTTP GET on port with MetricsText(), for Prometheus
+  // (or anything else speaking its text format) to scrape. blocks current
+  // thread
+  static void ServeHttpForever(unsigned port);
+
+  // every event counter, avg counter, gauge (by core) and histogram, in the
+  // Prometheus text exposition format. counters are read without taking any
+  // locks
+  static std::string MetricsText();
+
+  // what GET_MEMORY_REPORT replies with is made by fn, on the server's
+  // thread, until fn is replaced (nullptr for no report). replacing waits
+  // out any report being made
+  static void SetMemoryReportFn(std::function<std::string()> fn);
+
 private:
   bool handle_cmd_get_counter_value(const std::string &name, packet &pkt);
+  bool handle_cmd_get_histogram_value(const std::string &name, packet &pkt);
+  bool handle_cmd_get_abort_samples(const std::string &arg, packet &pkt);
+  bool handle_cmd_get_all_metrics(int fd, packet &pkt);
+  bool handle_cmd_get_memory_report(int fd, packet &pkt);
+  bool handle_cmd_get_access_heatmap(const std::string &arg, int fd, packet &pkt);
+  static bool SendText(int fd, const std::string &s, packet &pkt);
   void serve_client(int fd);
+  static void ServeHttpClient(int fd);
   std::string sockfile_;
 };
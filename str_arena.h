@@ -1,21 +1,37 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <vector>
+#include <stdint.h>
 #include "small_vector.h"
 
-// XXX: str arena hardcoded now to handle at most 1024 strings
+/**
+ * Hands out the strings (and raw byte buffers) a txn reads into. The first
+ * NStrs strings are inline; past those the arena grows in slabs of SlabNStrs
+ * strings, and bytes come from ByteChunkSize chunks. reset() rewinds the
+ * arena without freeing the slabs or chunks, so the next txns (arenas are
+ * owned by a single worker thread) reuse them, strings reserve and all.
+ */
 class str_arena {
 public:
 
   static const size_t PreAllocBufSize = 256;
   static const size_t NStrs = 1024;
+  static const size_t SlabNStrs = 1024;
+  static const size_t ByteChunkSize = 1 << 16;
+
+  // byte buffers bigger than this get a chunk of their own (which, unlike
+  // the others, reset() frees)
+  static const size_t MaxChunkedBytes = ByteChunkSize / 4;
 
   static const size_t MinStrReserveLength = 2 * CACHELINE_SIZE;
   static_assert(PreAllocBufSize >= MinStrReserveLength, "xx");
 
   str_arena()
-    : n(0)
+    : n(0), chunk_idx(0), chunk_off(0), nbytes(0),
+      max_nstrs(0), max_nbytes(0)
   {
     for (size_t i = 0; i < NStrs; i++)
       strs[i].reserve(PreAllocBufSize);
@@ -29,8 +45,13 @@ public:
   inline void
   reset()
   {
+    max_nstrs = std::max(max_nstrs, n);
+    max_nbytes = std::max(max_nbytes, nbytes);
     n = 0;
-    overflow.clear();
+    chunk_idx = 0;
+    chunk_off = 0;
+    nbytes = 0;
+    big_chunks.clear();
   }
 
   // next() is guaranteed to return an empty string
@@ -43,11 +64,13 @@ public:
       INVARIANT(manages(px));
       return px;
     }
-    // only loaders need this- and this allows us to use a unified
-    // str_arena for loaders/workers
-    overflow.emplace_back(new std::string);
-    ++n;
-    return overflow.back().get();
+    // only loaders and big scans get here
+    const size_t i = n++ - NStrs;
+    if (unlikely(i / SlabNStrs == slabs.size()))
+      slabs.emplace_back(new slab);
+    std::string * const px = &slabs[i / SlabNStrs]->strs[i % SlabNStrs];
+    px->clear();
+    return px;
   }
 
   inline std::string *
@@ -63,14 +86,90 @@ public:
     --n;
   }
 
+  // returns sz uninitialized bytes, 8-byte aligned, which are valid until
+  // the next reset()
+  inline uint8_t *
+  next_bytes(size_t sz)
+  {
+    sz = (sz + 7) & ~size_t(7);
+    nbytes += sz;
+    if (likely(chunk_idx < chunks.size() &&
+               chunk_off + sz <= ByteChunkSize)) {
+      uint8_t * const px = chunks[chunk_idx].get() + chunk_off;
+      chunk_off += sz;
+      return px;
+    }
+    return next_bytes_slow(sz);
+  }
+
   bool
   manages(const std::string *px) const
   {
-    return manages_local(px) || manages_overflow(px);
+    if (manages_local(px))
+      return true;
+    for (auto &p : slabs)
+      if (px >= &p->strs[0] && px < &p->strs[SlabNStrs])
+        return true;
+    return false;
+  }
+
+  // the most strings (bytes) a single txn has used so far, to size the
+  // arena by
+  inline size_t
+  nstrs_high_water_mark() const
+  {
+    return std::max(max_nstrs, n);
+  }
+
+  inline size_t
+  nbytes_high_water_mark() const
+  {
+    return std::max(max_nbytes, nbytes);
+  }
+
+  // how far past its inline strings the arena has grown
+  inline size_t
+  nslabs() const
+  {
+    return slabs.size();
+  }
+
+  inline size_t
+  nchunks() const
+  {
+    return chunks.size();
   }
 
 private:
 
+  struct slab {
+    slab()
+    {
+      for (size_t i = 0; i < SlabNStrs; i++)
+        strs[i].reserve(PreAllocBufSize);
+    }
+    std::string strs[SlabNStrs];
+  };
+
+  uint8_t *
+  next_bytes_slow(size_t sz)
+  {
+    if (sz > MaxChunkedBytes) {
+      big_chunks.emplace_back(new uint8_t[sz]);
+      return big_chunks.back().get();
+    }
+    if (chunk_idx < chunks.size()) {
+      // the rest of this chunk is too small
+      chunk_idx++;
+      chunk_off = 0;
+    }
+    if (chunk_idx == chunks.size())
+      chunks.emplace_back(new uint8_t[ByteChunkSize]);
+    uint8_t * const px = chunks[chunk_idx].get();
+    chunk_off = sz;
+    return px;
+  }
+
   bool
   manages_local(const std::string *px) const
   {
@@ -82,19 +181,19 @@ private:
                   reinterpret_cast<const char *>(&strs[0])) % sizeof(std::string));
   }
 
-  bool
-  manages_overflow(const std::string *px) const
-  {
-    for (auto &p : overflow)
-      if (p.get() == px)
-        return true;
-    return false;
-  }
-
 private:
   std::string strs[NStrs];
-  std::vector<std::unique_ptr<std::string>> overflow;
+  std::vector<std::unique_ptr<slab>> slabs;
   size_t n;
+
+  std::vector<std::unique_ptr<uint8_t[]>> chunks;
+  std::vector<std::unique_ptr<uint8_t[]>> big_chunks;
+  size_t chunk_idx;
+  size_t chunk_off;
+  size_t nbytes;
+
+  size_t max_nstrs;
+  size_t max_nbytes;
 };
 
 class scoped_str_arena {
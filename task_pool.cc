@@ -0,0 +1,79 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "task_pool.h"
+#include "counter.h"
+
+using namespace std;
+
+namespace {
+  struct batch {
+    mutex mutex_;
+    condition_variable cv_;
+    size_t npending_;
+  };
+
+  struct queued_task {
+    task_pool::task_t *task_;
+    batch *batch_;
+  };
+}
+
+static event_counter evt_task_pool_batches("task_pool_batches");
+static event_counter evt_task_pool_tasks("task_pool_tasks");
+
+static mutex g_mutex;
+static condition_variable g_cv;
+static deque<queued_task> g_queue;
+static size_t g_nthreads = 0;
+
+static void
+Finish(batch &b)
+{
+  std::lock_guard<mutex> l(b.mutex_);
+  if (!--b.npending_)
+    b.cv_.notify_all();
+}
+
+static void
+WorkerLoop()
+{
+  for (;;) {
+    queued_task t;
+    {
+      std::unique_lock<mutex> l(g_mutex);
+      g_cv.wait(l, [] { return !g_queue.empty(); });
+      t = g_queue.front();
+      g_queue.pop_front();
+    }
+    (*t.task_)();
+    Finish(*t.batch_);
+  }
+}
+
+void
+task_pool::Run(vector<task_t> &tasks)
+{
+  if (tasks.empty())
+    return;
+  ++evt_task_pool_batches;
+  evt_task_pool_tasks += tasks.size();
+  batch b;
+  b.npending_ = tasks.size() - 1;
+  if (b.npending_) {
+    {
+      std::lock_guard<mutex> l(g_mutex);
+      for (size_t i = 1; i < tasks.size(); i++)
+        g_queue.push_back(queued_task{&tasks[i], &b});
+      const size_t nwanted = min(tasks.size() - 1, MaxThreads);
+      for (; g_nthreads < nwanted; g_nthreads++)
+        thread(WorkerLoop).detach();
+    }
+    g_cv.notify_all();
+  }
+  tasks[0]();
+  std::unique_lock<mutex> l(b.mutex_);
+  b.cv_.wait(l, [&b] { return !b.npending_; });
+}
@@ -0,0 +1,29 @@
+#ifndef _NDB_TASK_POOL_H_
+#define _NDB_TASK_POOL_H_
+
+#include <functional>
+#include <vector>
+
+#include "macros.h"
+
+/**
+ * A pool of threads to run a batch of tasks on at once, for the parallel
+ * range scans (see btree::search_range_call_parallel()).
+ *
+ * The threads are started on demand and are never torn down, so batches
+ * don't pay for starting threads (and taking core ids, see coreid).
+ */
+class task_pool {
+public:
+
+  // batches larger than this have their extra tasks queued
+  static const size_t MaxThreads = 32;
+
+  typedef std::function<void()> task_t;
+
+  // runs tasks[0] on the calling thread and the rest on the pool, and returns
+  // once they are all done. tasks must not throw
+  static void Run(std::vector<task_t> &tasks);
+};
+
+#endif /* _NDB_TASK_POOL_H_ */
@@ -3,23 +3,37 @@
 #include <unordered_map>
 #include <tuple>
 #include <set>
+#include <thread>
 #include <unistd.h>
 
 #include "circbuf.h"
+#include "spinbarrier.h"
 #include "pxqueue.h"
 #include "core.h"
+#include "rcu.h"
 #include "thread.h"
 #include "txn.h"
 #include "txn_btree.h"
 #include "varint.h"
+#include "imstring.h"
+#include "crc32c.h"
+#include "learned_index.h"
+#include "thread_placement.h"
 #include "small_vector.h"
 #include "static_vector.h"
 #include "small_unordered_map.h"
 #include "static_unordered_map.h"
 #include "counter.h"
+#include "str_arena.h"
+#include "spinlock.h"
+#include "queue_lock.h"
+#include "txn_executor.h"
+#include "batch_executor.h"
 #include "record/encoder.h"
 #include "record/inline_str.h"
 #include "record/cursor.h"
+#include "benchmarks/kvdb_wrapper_impl.h"
+#include "benchmarks/workload_trace.h"
 
 #ifdef PROTO2_CAN_DISABLE_GC
 #include "txn_proto2_impl.h"
@@ -46,12 +60,22 @@ DO_STRUCT(myrec, MYREC_KEY_FIELDS, MYREC_VALUE_FIELDS)
   y(int8_t,v6)
 DO_STRUCT(cursorrec, CURSORREC_KEY_FIELDS, CURSORREC_VALUE_FIELDS)
 
+#define FIXEDREC_KEY_FIELDS(x, y) \
+  x(int32_t,k0)
+#define FIXEDREC_VALUE_FIELDS(x, y) \
+  x(int64_t,v0) \
+  y(float,v1) \
+  y(inline_str_fixed<10>,v2) \
+  y(int16_t,v3)
+DO_STRUCT(fixedrec, FIXEDREC_KEY_FIELDS, FIXEDREC_VALUE_FIELDS)
+
 using namespace std;
 using namespace util;
 
 static event_counter evt_test("test");
 static event_counter evt_test1("test1");
 static event_avg_counter evt_test_avg("test_avg");
+static event_histogram hist_test("test_hist");
 
 namespace varkeytest {
   void
@@ -251,6 +275,45 @@ CounterTest()
 
   cout << "event counters test passed" << endl;
 #endif
+
+  for (uint64_t v = 0; v < 100000; v++) {
+    const size_t b = histogram_data::BucketFor(v);
+    ALWAYS_ASSERT(b < histogram_data::NBuckets);
+    ALWAYS_ASSERT(histogram_data::BucketMax(b) >= v);
+    ALWAYS_ASSERT(!b || histogram_data::BucketMax(b - 1) < v);
+  }
+  for (uint64_t v = 1; v <= 1000; v++)
+    hist_test.offer(v);
+  hist_test.offer(100000, 2);
+  histogram_data h;
+  ALWAYS_ASSERT(event_histogram::stat("test_hist", h));
+  ALWAYS_ASSERT(h.count_ == 1002);
+  ALWAYS_ASSERT(h.max_ == 100000);
+  ALWAYS_ASSERT(h.percentile(50) >= 500 && h.percentile(50) <= 500 * 9 / 8);
+  ALWAYS_ASSERT(h.percentile(99.9) == 100000);
+  ALWAYS_ASSERT(h.percentile(100) == 100000);
+  hist_test.reset();
+  histogram_data h1;
+  hist_test.stat(h1);
+  ALWAYS_ASSERT(h1.count_ == 0 && h1.percentile(99) == 0);
+
+  // every core offers into its own shard, which stat() merges
+  vector<thread> thds;
+  for (uint64_t t = 0; t < 4; t++)
+    thds.emplace_back([t]() {
+      for (uint64_t v = 1; v <= 1000; v++)
+        hist_test.offer(v + t * 1000);
+    });
+  for (auto &t : thds)
+    t.join();
+  histogram_data h2;
+  hist_test.stat(h2);
+  ALWAYS_ASSERT(h2.count_ == 4000);
+  ALWAYS_ASSERT(h2.sum_ == 4000 * 4001 / 2);
+  ALWAYS_ASSERT(h2.max_ == 4000);
+  ALWAYS_ASSERT(h2.percentile(50) >= 2000 && h2.percentile(50) <= 2000 * 9 / 8);
+  hist_test.reset();
+  cout << "histogram test passed" << endl;
 }
 
 void
@@ -887,6 +950,26 @@ TestCursor()
   cerr << "v0: " << v2 << endl;
 }
 
+void
+TestFixedLayout()
+{
+  static_assert(fixedrec::value_descriptor::fixed_layout(), "xx");
+  static_assert(!cursorrec::value_descriptor::fixed_layout(), "xx");
+
+  const fixedrec::value v(1ULL << 40, 2.5, "abc", -7);
+  const string enc_v = Encode(v);
+  ALWAYS_ASSERT(enc_v.size() == sizeof(v));
+  ALWAYS_ASSERT(!memcmp(enc_v.data(), &v, sizeof(v)));
+  for (size_t i = 0; i < fixedrec::value_descriptor::nfields(); i++)
+    ALWAYS_ASSERT(!memcmp(
+        enc_v.data() + fixedrec::value_descriptor::cstruct_offsetof(i),
+        (const uint8_t *) &v + fixedrec::value_descriptor::cstruct_offsetof(i),
+        fixedrec::value_descriptor::cstruct_sizeof(i)));
+  fixedrec::value v0;
+  ALWAYS_ASSERT(Decode(enc_v, v0) == &v0);
+  ALWAYS_ASSERT(v == v0);
+}
+
 void
 Test()
 {
@@ -948,12 +1031,336 @@ Test()
   }
 
   TestCursor();
+  TestFixedLayout();
 
   cout << "encoder test passed" << endl;
 }
 
 }
 
+static void
+StrArenaTest()
+{
+  str_arena a;
+  const size_t nstrs = str_arena::NStrs + 2 * str_arena::SlabNStrs + 5;
+  vector<string *> pxs;
+  for (size_t i = 0; i < nstrs; i++) {
+    string * const px = a.next();
+    ALWAYS_ASSERT(px->empty());
+    ALWAYS_ASSERT(a.manages(px));
+    px->assign(i % 512, 'a');
+    pxs.push_back(px);
+  }
+  ALWAYS_ASSERT(set<string *>(pxs.begin(), pxs.end()).size() == nstrs);
+  ALWAYS_ASSERT(a.nslabs() == 3);
+  for (size_t i = 0; i < nstrs; i++)
+    ALWAYS_ASSERT(pxs[i]->size() == i % 512);
+
+  vector<uint8_t *> bufs;
+  for (size_t i = 0; i < 3 * str_arena::ByteChunkSize / 100; i++) {
+    uint8_t * const px = a.next_bytes(100);
+    ALWAYS_ASSERT(!(uintptr_t(px) & 7));
+    memset(px, i, 100);
+    bufs.push_back(px);
+  }
+  uint8_t * const big = a.next_bytes(str_arena::ByteChunkSize);
+  memset(big, 0xff, str_arena::ByteChunkSize);
+  for (size_t i = 0; i < bufs.size(); i++)
+    ALWAYS_ASSERT(bufs[i][0] == uint8_t(i) && bufs[i][99] == uint8_t(i));
+  const size_t nchunks = a.nchunks();
+  ALWAYS_ASSERT(nchunks >= 3);
+
+  // the next txn reuses what the last one grew
+  a.reset();
+  for (size_t i = 0; i < nstrs; i++) {
+    string * const px = a.next();
+    ALWAYS_ASSERT(px == pxs[i]);
+    ALWAYS_ASSERT(px->empty());
+  }
+  ALWAYS_ASSERT(a.next_bytes(100) == bufs[0]);
+  ALWAYS_ASSERT(a.nslabs() == 3);
+  ALWAYS_ASSERT(a.nchunks() == nchunks);
+  ALWAYS_ASSERT(a.nstrs_high_water_mark() == nstrs);
+  ALWAYS_ASSERT(a.nbytes_high_water_mark() >=
+                bufs.size() * 100 + str_arena::ByteChunkSize);
+
+  cout << "str_arena test passed" << endl;
+}
+
+static void
+CoreIdRecyclingTest()
+{
+  // more threads than core ids, but never more than one at once
+  const unsigned before = coreid::core_count();
+  for (unsigned i = 0; i < coreid::NMaxCores + 8; i++) {
+    thread t([]() {
+      ALWAYS_ASSERT(coreid::core_id() < coreid::NMaxCores);
+      scoped_rcu_region guard;
+      rcu::s_instance.free_with_fn(new int, rcu::deleter<int>);
+    });
+    t.join();
+  }
+  ALWAYS_ASSERT(coreid::core_count() <= before + 1);
+  ALWAYS_ASSERT(coreid::nfree_core_ids() >= 1);
+  cout << "core id recycling test passed" << endl;
+}
+
+static void
+TxnExecutorTest()
+{
+  const size_t nworkers = 4, ntasks = 10000;
+  atomic<size_t> nran(0), nmisplaced(0);
+  {
+    txn_executor e(nworkers);
+    for (size_t i = 0; i < ntasks; i++) {
+      const int hint = (i % 3) ? int(i % 7) : txn_executor::NoHint;
+      const bool pinned = !(i % 5) && hint != txn_executor::NoHint;
+      e.submit([&e, &nran, &nmisplaced, hint, pinned]() {
+        ALWAYS_ASSERT(e.current_worker() != -1);
+        if (pinned && size_t(e.current_worker()) != size_t(hint) % e.nworkers())
+          ++nmisplaced;
+        ++nran;
+      }, hint, pinned);
+    }
+    ALWAYS_ASSERT(e.current_worker() == -1);
+    e.stop();
+  }
+  ALWAYS_ASSERT(nran.load() == ntasks);
+  ALWAYS_ASSERT(!nmisplaced.load());
+  cout << "txn executor test passed" << endl;
+}
+
+static void
+BatchExecutorTest()
+{
+  typedef batch_executor::key_ref key_ref;
+  const int table = 0;
+  const vector<key_ref> a{{&table, "a"}}, b{{&table, "b"}},
+                        ab{{&table, "a"}, {&table, "b"}};
+  const vector<size_t> waves =
+    batch_executor::Schedule({&a, &b, &a, &ab, &b, &a});
+  ALWAYS_ASSERT(waves == vector<size_t>({0, 0, 1, 2, 3, 3}));
+
+  // txns sharing a key run one at a time, in submission order
+  const size_t nkeys = 4, ntxns = 2000;
+  vector<size_t> last(nkeys, 0);
+  atomic<unsigned> running[nkeys] = {};
+  atomic<size_t> ndone(0), noverlaps(0), nreordered(0);
+  {
+    txn_executor e(4);
+    batch_executor be(e);
+    for (size_t i = 1; i <= ntxns; i++) {
+      const size_t k0 = i % nkeys, k1 = (i / nkeys) % nkeys;
+      vector<key_ref> keys{{&table, to_string(k0)}, {&table, to_string(k1)}};
+      be.submit(move(keys), [&, i, k0, k1]() {
+        for (auto k : {k0, k1}) {
+          if (running[k]++)
+            ++noverlaps;
+          if (last[k] > i)
+            ++nreordered;
+          last[k] = i;
+        }
+        for (auto k : {k0, k1})
+          --running[k];
+        return true;
+      }, [&ndone]() { ++ndone; });
+    }
+  }
+  ALWAYS_ASSERT(ndone.load() == ntxns);
+  ALWAYS_ASSERT(!noverlaps.load());
+  ALWAYS_ASSERT(!nreordered.load());
+  cout << "batch executor test passed" << endl;
+}
+
+static void
+QueueLockTest()
+{
+  // enough contention for the waiters to queue
+  const size_t nthreads = 8, niters = 200000;
+  queue_lock::SetEnabled(true);
+  spinlock l;
+  size_t n = 0;
+  vector<thread> thds;
+  for (size_t i = 0; i < nthreads; i++)
+    thds.emplace_back([&l, &n]() {
+      for (size_t j = 0; j < niters; j++) {
+        l.lock();
+        n++;
+        l.unlock();
+      }
+    });
+  for (auto &t : thds)
+    t.join();
+  ALWAYS_ASSERT(n == nthreads * niters);
+  ALWAYS_ASSERT(!l.is_locked());
+
+  // two locks of a slot: while a waiter for a (which this thread holds) heads
+  // the queue, this thread queues for b, and must not wait behind it
+  vector<spinlock> locks(2 * queue_lock::NSlots);
+  spinlock *a = &locks[0], *b = nullptr;
+  for (size_t i = 1; !b && i < locks.size(); i++)
+    if (queue_lock::SlotFor(&locks[i]) == queue_lock::SlotFor(a))
+      b = &locks[i];
+  ALWAYS_ASSERT(b);
+  a->lock();
+  b->lock();
+  thread waiter([a]() { a->lock(); a->unlock(); });
+  thread holder([b]() {
+    this_thread::sleep_for(chrono::milliseconds(50));
+    b->unlock();
+  });
+  this_thread::sleep_for(chrono::milliseconds(10));
+  b->lock();
+  a->unlock();
+  b->unlock();
+  waiter.join();
+  holder.join();
+  queue_lock::SetEnabled(false);
+  cout << "queue lock test passed" << endl;
+}
+
+static void
+SpinBarrierTest()
+{
+  // the waiters outlast their spins, and block
+  const size_t nthreads = 4;
+  for (size_t round = 0; round < 10; round++) {
+    spin_barrier *b = new spin_barrier(nthreads);
+    atomic<size_t> nreleased(0);
+    vector<thread> thds;
+    for (size_t i = 0; i < nthreads; i++)
+      thds.emplace_back([b, &nreleased]() {
+        b->wait_for();
+        ++nreleased;
+      });
+    for (size_t i = 0; i < nthreads; i++) {
+      this_thread::sleep_for(chrono::milliseconds(1));
+      ALWAYS_ASSERT(!nreleased.load());
+      b->count_down();
+    }
+    // a waiter can destroy the barrier as soon as it is released
+    b->wait_for();
+    delete b;
+    for (auto &t : thds)
+      t.join();
+    ALWAYS_ASSERT(nreleased.load() == nthreads);
+  }
+  cout << "spin barrier test passed" << endl;
+}
+
+static void
+ImstringRaceTest()
+{
+  // a writer swaps a string between inline and allocated, as btree leaves
+  // do their suffixes, while readers take varkeys of it: a reader must never
+  // get the length of one with the bytes of the other
+  const size_t nreaders = 4, niters = 200000;
+  typedef base_imstring<false, 8> slot_type;
+  typedef base_imstring<true, 8> rcu_slot_type;
+  const string shorts(4, 'a'), longs(32, 'b');
+  slot_type s;
+  atomic<bool> done(false);
+  atomic<size_t> nlong(0);
+  vector<thread> thds;
+  for (size_t i = 0; i < nreaders; i++)
+    thds.emplace_back([&]() {
+      while (!done.load()) {
+        scoped_rcu_region guard;
+        const varkey k(s);
+        ALWAYS_ASSERT(k.size() <= longs.size());
+        if (k.size() > 8) {
+          ALWAYS_ASSERT(memcmp(k.data(), longs.data(), k.size()) == 0);
+          ++nlong;
+        }
+      }
+    });
+  for (size_t i = 0; i < niters; i++) {
+    scoped_rcu_region guard;
+    rcu_slot_type t(i % 2 ? longs : shorts);
+    s.swap(t);
+  }
+  done.store(true);
+  for (auto &t : thds)
+    t.join();
+  ALWAYS_ASSERT(nlong.load());
+  cout << "imstring race test passed" << endl;
+}
+
+static void
+KvIndexTest()
+{
+  // the index ndb serves unlogged kv indexes from (see
+  // abstract_db::open_kv_index())
+  kvdb_ordered_index<true> idx("kv");
+  abstract_ordered_index &kv = idx;
+  const string big(256, 'x');
+  {
+    scoped_rcu_region guard;
+    string v;
+    ALWAYS_ASSERT(!kv.get(nullptr, "a", v));
+    const string zero("0"), one("1");
+    // absent: only puts without an expected value
+    ALWAYS_ASSERT(!kv.compare_and_put(nullptr, "a", &zero, one));
+    ALWAYS_ASSERT(kv.compare_and_put(nullptr, "a", nullptr, zero));
+    ALWAYS_ASSERT(kv.get(nullptr, "a", v) && v == zero);
+    // present: only puts over the expected value
+    ALWAYS_ASSERT(!kv.compare_and_put(nullptr, "a", nullptr, one));
+    ALWAYS_ASSERT(!kv.compare_and_put(nullptr, "a", &one, one));
+    ALWAYS_ASSERT(kv.compare_and_put(nullptr, "a", &zero, one));
+    ALWAYS_ASSERT(kv.get(nullptr, "a", v) && v == one);
+    // too big to write in place: the record is replaced
+    ALWAYS_ASSERT(kv.compare_and_put(nullptr, "a", &one, big));
+    ALWAYS_ASSERT(kv.get(nullptr, "a", v) && v == big);
+    kv.remove(nullptr, "a");
+    ALWAYS_ASSERT(!kv.get(nullptr, "a", v));
+    ALWAYS_ASSERT(!kv.compare_and_put(nullptr, "a", &big, one));
+    ALWAYS_ASSERT(kv.size() == 0);
+  }
+
+  // concurrent increments by compare_and_put, while a writer replaces and
+  // removes a neighbouring key, are each applied exactly once
+  const size_t nthreads = 4, nincs = 10000;
+  {
+    scoped_rcu_region guard;
+    kv.put(nullptr, "ctr", "0");
+  }
+  atomic<bool> done(false);
+  thread churn([&]() {
+    for (size_t i = 0; !done.load(); i++) {
+      scoped_rcu_region guard;
+      if (i % 3 == 2)
+        kv.remove(nullptr, "other");
+      else
+        kv.put(nullptr, "other", i % 3 ? big : string("y"));
+    }
+  });
+  vector<thread> thds;
+  for (size_t i = 0; i < nthreads; i++)
+    thds.emplace_back([&]() {
+      for (size_t n = 0; n < nincs;) {
+        scoped_rcu_region guard;
+        string cur;
+        ALWAYS_ASSERT(kv.get(nullptr, "ctr", cur));
+        // the value grows now and then (9 to 10, ...), so puts may have to
+        // replace the record
+        const string next = to_string(stoul(cur) + 1);
+        if (kv.compare_and_put(nullptr, "ctr", &cur, next))
+          n++;
+      }
+    });
+  for (auto &t : thds)
+    t.join();
+  done.store(true);
+  churn.join();
+  {
+    scoped_rcu_region guard;
+    string v;
+    ALWAYS_ASSERT(kv.get(nullptr, "ctr", v));
+    ALWAYS_ASSERT(v == to_string(nthreads * nincs));
+  }
+  cout << "kv index test passed" << endl;
+}
+
 class main_thread : public ndb_thread {
 public:
   main_thread(int argc, char **argv)
@@ -970,6 +1377,10 @@ public:
     cerr << "PID: " << getpid() << endl;
 
     CircbufTest();
+    SpinBarrierTest();
+    StrArenaTest();
+    QueueLockTest();
+    crc32c::Test();
 
     // initialize the numa allocator subsystem with the number of CPUs running
     // + reasonable size per core
@@ -977,6 +1388,14 @@ public:
 #ifdef PROTO2_CAN_DISABLE_GC
     transaction_proto2_static::InitGC();
 #endif
+    CoreIdRecyclingTest();
+    ImstringRaceTest();
+    KvIndexTest();
+    workload_trace::Test();
+    learned_index::Test();
+    thread_placement::Test();
+    TxnExecutorTest();
+    BatchExecutorTest();
     //varkeytest::Test();
     //pxqueuetest::Test();
     //CounterTest();
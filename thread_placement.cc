@@ -0,0 +1,235 @@
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include <sched.h>
+#include <stdio.h>
+
+#include "thread_placement.h"
+#include "core.h"
+#include "macros.h"
+
+using namespace std;
+
+bool thread_placement::g_planned = false;
+thread_placement::plan thread_placement::g_plan;
+vector<thread_placement::cpu_info> thread_placement::g_cpus;
+
+static int
+ReadSysfsInt(unsigned cpu, const char *name)
+{
+  ifstream ifs("/sys/devices/system/cpu/cpu" + to_string(cpu) +
+               "/topology/" + name);
+  int v = -1;
+  if (!(ifs >> v))
+    return -1;
+  return v;
+}
+
+vector<thread_placement::cpu_info>
+thread_placement::ReadTopology()
+{
+  vector<cpu_info> cpus;
+  const unsigned n = coreid::num_cpus_online();
+  for (unsigned c = 0; c < n; c++) {
+    const int core = ReadSysfsInt(c, "core_id");
+    const int socket = ReadSysfsInt(c, "physical_package_id");
+    if (core < 0 || socket < 0)
+      cpus.push_back(cpu_info{c, c, 0});
+    else
+      cpus.push_back(cpu_info{c, unsigned(core), unsigned(socket)});
+  }
+  return cpus;
+}
+
+thread_placement::plan
+thread_placement::MakePlan(const vector<cpu_info> &cpus,
+                           size_t nworkers, size_t nloggers, size_t ngc)
+{
+  INVARIANT(!cpus.empty());
+  // socket => core => the core's cpus (its SMT siblings), in order
+  map<unsigned, map<unsigned, vector<unsigned>>> sockets;
+  map<unsigned, unsigned> socket_of;
+  for (auto &c : cpus) {
+    sockets[c.socket_][c.core_].push_back(c.cpu_);
+    socket_of[c.cpu_] = c.socket_;
+  }
+
+  // the workers' order: the first sibling of each core of each socket, then
+  // the second siblings, and so on
+  vector<unsigned> order;
+  for (size_t level = 0; order.size() < cpus.size(); level++)
+    for (auto &s : sockets)
+      for (auto &core : s.second)
+        if (level < core.second.size())
+          order.push_back(core.second[level]);
+
+  plan p;
+  map<unsigned, size_t> nthreads_on; // cpu => threads placed on it
+  for (size_t w = 0; w < nworkers; w++) {
+    p.workers_.push_back(order[w % order.size()]);
+    nthreads_on[p.workers_.back()]++;
+  }
+
+  // a background thread serving workers on socket
+  auto place = [&](unsigned socket) -> unsigned {
+    const auto worker_socket = sockets.find(socket);
+    // idle cores, then idle siblings, on socket, then the same elsewhere
+    for (int pass = 0; pass < 4; pass++) {
+      const bool on_socket = pass < 2;
+      const bool whole_core = !(pass & 1);
+      for (auto &s : sockets) {
+        if (on_socket != (s.first == socket))
+          continue;
+        for (auto &core : s.second) {
+          bool core_idle = true;
+          for (auto c : core.second)
+            if (nthreads_on[c])
+              core_idle = false;
+          if (whole_core && !core_idle)
+            continue;
+          for (auto c : core.second)
+            if (!nthreads_on[c]) {
+              nthreads_on[c]++;
+              return c;
+            }
+        }
+      }
+    }
+    // every cpu is busy: the least shared of the socket's
+    unsigned best = cpus[0].cpu_;
+    size_t best_n = numeric_limits<size_t>::max();
+    for (auto &core : worker_socket->second)
+      for (auto c : core.second)
+        if (nthreads_on[c] < best_n) {
+          best = c;
+          best_n = nthreads_on[c];
+        }
+    nthreads_on[best]++;
+    return best;
+  };
+  auto socket_of_worker = [&](size_t w) {
+    return nworkers ? socket_of[p.workers_[w % nworkers]] : sockets.begin()->first;
+  };
+
+  // loggers first: they are on the commit path
+  for (size_t i = 0; i < nloggers; i++)
+    p.loggers_.push_back(place(socket_of_worker(i * nworkers / nloggers)));
+  p.ticker_ = place(socket_of_worker(0));
+  for (size_t i = 0; i < ngc; i++)
+    p.gc_threads_.push_back(place(socket_of_worker(i)));
+  return p;
+}
+
+void
+thread_placement::Plan(size_t nworkers, size_t nloggers, size_t ngc)
+{
+  ALWAYS_ASSERT(!g_planned);
+  g_cpus = ReadTopology();
+  g_plan = MakePlan(g_cpus, nworkers, nloggers, ngc);
+  g_planned = true;
+}
+
+int
+thread_placement::WorkerCpu(size_t w)
+{
+  if (!g_planned || g_plan.workers_.empty())
+    return -1;
+  return g_plan.workers_[w % g_plan.workers_.size()];
+}
+
+int
+thread_placement::LoggerCpu(size_t i)
+{
+  if (!g_planned || i >= g_plan.loggers_.size())
+    return -1;
+  return g_plan.loggers_[i];
+}
+
+int
+thread_placement::GCCpu(size_t i)
+{
+  if (!g_planned || i >= g_plan.gc_threads_.size())
+    return -1;
+  return g_plan.gc_threads_[i];
+}
+
+int
+thread_placement::TickerCpu()
+{
+  return g_planned ? int(g_plan.ticker_) : -1;
+}
+
+string
+thread_placement::Describe()
+{
+  if (!g_planned)
+    return "";
+  map<unsigned, const cpu_info *> info;
+  for (auto &c : g_cpus)
+    info[c.cpu_] = &c;
+  ostringstream o;
+  auto line = [&](const string &name, unsigned cpu) {
+    const cpu_info &c = *info[cpu];
+    o << name << ": cpu " << cpu << " (socket " << c.socket_
+      << ", core " << c.core_ << ")" << endl;
+  };
+  for (size_t i = 0; i < g_plan.workers_.size(); i++)
+    line("worker" + to_string(i), g_plan.workers_[i]);
+  for (size_t i = 0; i < g_plan.loggers_.size(); i++)
+    line("logger" + to_string(i), g_plan.loggers_[i]);
+  for (size_t i = 0; i < g_plan.gc_threads_.size(); i++)
+    line("gc" + to_string(i), g_plan.gc_threads_[i]);
+  line("ticker", g_plan.ticker_);
+  return o.str();
+}
+
+void
+thread_placement::PinCurrentThread(unsigned cpu)
+{
+  cpu_set_t s;
+  CPU_ZERO(&s);
+  CPU_SET(cpu, &s);
+  if (sched_setaffinity(0, sizeof(s), &s) == -1)
+    perror("sched_setaffinity");
+}
+
+void
+thread_placement::Test()
+{
+  // 2 sockets of 4 cores, 2 siblings each: cpu (s * 4 + c) and its sibling
+  // (8 + s * 4 + c), as linux usually numbers them
+  vector<cpu_info> cpus;
+  for (unsigned t = 0; t < 2; t++)
+    for (unsigned s = 0; s < 2; s++)
+      for (unsigned c = 0; c < 4; c++)
+        cpus.push_back(cpu_info{t * 8 + s * 4 + c, c, s});
+
+  // workers fill socket 0's cores, then socket 1's; the background threads
+  // take socket 0's idle siblings
+  plan p = MakePlan(cpus, 6, 1, 2);
+  ALWAYS_ASSERT((p.workers_ == vector<unsigned>{0, 1, 2, 3, 4, 5}));
+  ALWAYS_ASSERT(p.loggers_ == vector<unsigned>{8});
+  ALWAYS_ASSERT(p.ticker_ == 9);
+  // gc1 serves worker 1, on socket 0
+  ALWAYS_ASSERT((p.gc_threads_ == vector<unsigned>{10, 11}));
+
+  // spare cores are taken before siblings
+  p = MakePlan(cpus, 2, 2, 0);
+  ALWAYS_ASSERT((p.loggers_ == vector<unsigned>{2, 3}));
+  ALWAYS_ASSERT(p.ticker_ == 8);
+
+  // the second logger serves workers on socket 1
+  p = MakePlan(cpus, 8, 2, 0);
+  ALWAYS_ASSERT((p.loggers_ == vector<unsigned>{8, 12}));
+
+  // every cpu busy: background threads share their socket's
+  p = MakePlan(cpus, 16, 1, 1);
+  ALWAYS_ASSERT(p.workers_[8] == 8 && p.workers_[15] == 15);
+  ALWAYS_ASSERT(p.loggers_ == vector<unsigned>{0});
+  ALWAYS_ASSERT(p.ticker_ == 8);
+
+  cerr << "thread_placement tests passed" << endl;
+}
@@ -0,0 +1,80 @@
+#ifndef _NDB_THREAD_PLACEMENT_H_
+#define _NDB_THREAD_PLACEMENT_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * A plan of the cpu each of a run's long lived threads runs on, made from the
+ * machine's topology (read from sysfs: the physical core of each cpu, and the
+ * socket of each core).
+ *
+ * Workers go on distinct physical cores first, filling the cores of a socket
+ * before the next socket's, and only go on SMT siblings once every core has a
+ * worker. Then each background thread (the loggers, the GC threads and the
+ * ticker) goes on the socket of the workers it serves: on a core no worker is
+ * on, else on an idle sibling of a worker's core, else on an idle cpu of
+ * another socket. Only once no cpu is idle does it share one, the least
+ * shared of its socket's.
+ *
+ * With a plan, rcu::pin_current_thread() restricts a thread to its cpu rather
+ * than to the cpu's numa node. Plan() runs once, before the threads it places
+ * are started
+ */
+class thread_placement {
+public:
+
+  struct cpu_info {
+    unsigned cpu_;
+    unsigned core_;   // physical core, unique within its socket
+    unsigned socket_;
+  };
+
+  struct plan {
+    std::vector<unsigned> workers_;
+    std::vector<unsigned> loggers_;
+    std::vector<unsigned> gc_threads_;
+    unsigned ticker_;
+  };
+
+  // the i-th logger is taken to serve the i-th of nloggers even ranges of the
+  // workers (txn_logger's default assignment), and the i-th GC thread the
+  // workers w with w % ngc == i (see hand_off_to_gc())
+  static void Plan(size_t nworkers, size_t nloggers, size_t ngc);
+
+  static inline bool
+  IsPlanned()
+  {
+    return g_planned;
+  }
+
+  // -1 if there is no plan
+  static int WorkerCpu(size_t w);
+  static int LoggerCpu(size_t i);
+  static int GCCpu(size_t i);
+  static int TickerCpu();
+
+  // a line per thread
+  static std::string Describe();
+
+  // the online cpus, with cores and sockets from sysfs (where sysfs has none,
+  // each cpu is a core of socket 0)
+  static std::vector<cpu_info> ReadTopology();
+
+  static plan MakePlan(const std::vector<cpu_info> &cpus,
+                       size_t nworkers, size_t nloggers, size_t ngc);
+
+  // restricts the calling thread to cpu
+  static void PinCurrentThread(unsigned cpu);
+
+  static void Test();
+
+private:
+  static bool g_planned;
+  static plan g_plan;
+  static std::vector<cpu_info> g_cpus;
+};
+
+#endif /* _NDB_THREAD_PLACEMENT_H_ */
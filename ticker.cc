@@ -1,3 +1,13 @@
 #include "ticker.h"
 
+std::atomic<uint64_t> ticker::s_tick_us(ticker::DefaultTickUsec);
+std::atomic<uint64_t> ticker::s_adaptive_min_us(0);
+std::atomic<uint64_t> ticker::s_adaptive_max_us(0);
+std::atomic<uint64_t> ticker::s_adaptive_target_guards(0);
+std::atomic<bool> ticker::s_idle_parking(false);
+std::atomic<int> ticker::s_cpu(-1);
+
+event_counter ticker::s_evt_stragglers("ticker_stragglers");
+event_counter ticker::s_evt_straggler_wait_us("ticker_straggler_wait_us");
+
 ticker ticker::s_instance;
@@ -5,21 +5,86 @@
 #include <thread>
 
 #include "core.h"
+#include "counter.h"
+#include "futex.h"
 #include "macros.h"
 #include "spinlock.h"
 #include "lockguard.h"
+#include "thread_placement.h"
 
 class ticker {
 public:
 
 #ifdef CHECK_INVARIANTS
-  static const uint64_t tick_us = 1 * 1000; /* 1 ms */
+  static const uint64_t DefaultTickUsec = 1 * 1000; /* 1 ms */
 #else
-  static const uint64_t tick_us = 40 * 1000; /* 40 ms */
+  static const uint64_t DefaultTickUsec = 40 * 1000; /* 40 ms */
 #endif
 
+  static const uint64_t MinTickUsec = 100;
+  static const uint64_t MaxTickUsec = 1000 * 1000; /* 1 s */
+
+  // the length of the current tick. it can change at any time, so code
+  // which waits for a tick should re-read it each time
+  static inline uint64_t
+  TickUsec()
+  {
+    return s_tick_us.load(std::memory_order_acquire);
+  }
+
+  // takes effect from the next tick on, and disables adaptive ticks
+  static void
+  SetTickUsec(uint64_t tick_us)
+  {
+    s_adaptive_max_us.store(0, std::memory_order_release);
+    s_tick_us.store(Clamp(tick_us), std::memory_order_release);
+  }
+
+  // lets the ticker pick each tick's length in [min_us, max_us], aiming for
+  // target_guards guards (roughly, txns) per tick. light load gets short
+  // ticks, so durability (which is epoch granular) comes sooner, and heavy
+  // load gets long ticks, which amortize the per-epoch work of the logger
+  // and GC over more txns
+  static void
+  SetAdaptiveTickUsec(uint64_t min_us, uint64_t max_us, uint64_t target_guards)
+  {
+    min_us = Clamp(min_us);
+    max_us = std::max(Clamp(max_us), min_us);
+    INVARIANT(target_guards > 0);
+    s_adaptive_min_us.store(min_us, std::memory_order_release);
+    s_adaptive_target_guards.store(target_guards, std::memory_order_release);
+    s_adaptive_max_us.store(max_us, std::memory_order_release);
+  }
+
+  static inline bool
+  IsAdaptive()
+  {
+    return s_adaptive_max_us.load(std::memory_order_acquire);
+  }
+
+  // once nobody has entered a guard for IdleTicksBeforeParking ticks (and
+  // nobody is in one), the ticker blocks until the next guard wakes it, or
+  // for at most MaxTickUsec: code which waits for ticks outside of guards
+  // gets them that slowly while the system is idle. off by default
+  static const uint64_t IdleTicksBeforeParking = 8;
+
+  static void
+  SetIdleParking(bool enabled)
+  {
+    s_idle_parking.store(enabled, std::memory_order_release);
+  }
+
+  // the ticker thread moves to cpu (see thread_placement) by its next tick.
+  // -1 leaves it where it is
+  static void
+  SetCpu(int cpu)
+  {
+    s_cpu.store(cpu, std::memory_order_release);
+  }
+
   ticker()
-    : current_tick_(1), last_tick_inclusive_(0)
+    : current_tick_(1), last_tick_inclusive_(0), last_nguards_(0),
+      parked_(0), park_nguards_(0), nidle_ticks_(0)
   {
     std::thread thd(&ticker::tickerloop, this);
     thd.detach();
@@ -75,6 +140,27 @@ public:
     return is_locally_guarded(c);
   }
 
+  // true if the calling core is in a guard which the ticker is waiting on to
+  // finish the last tick, ie it is holding back the epoch (and with it GC,
+  // RCU and durability) for everyone. long-running read paths which can
+  // stop at any point (chunked scans) should end their chunk early then, to
+  // leave their guard
+  inline bool
+  is_holding_back_tick() const
+  {
+    uint64_t cur_tick;
+    return is_locally_guarded(cur_tick) && cur_tick < global_current_tick();
+  }
+
+  // # of times core held the ticker up for longer than a tick (see
+  // tickerloop())
+  inline uint64_t
+  nstraggles(uint64_t core_id) const
+  {
+    INVARIANT(core_id < ticks_.size());
+    return ticks_[core_id].nstraggles_.load(std::memory_order_acquire);
+  }
+
   inline spinlock &
   lock_for(uint64_t core_id)
   {
@@ -95,6 +181,11 @@ public:
       // grab the lock
       if (!prev_depth) {
         ti.lock_.lock();
+        // the lock is a full barrier after our depth_ store, which pairs
+        // with the ticker's parked_ store then depth_ loads (see maybe_park())
+        if (unlikely(impl_->parked_.load(std::memory_order_acquire)))
+          impl_->unpark();
+        util::non_atomic_fetch_add(ti.nguards_, 1UL);
         // read epoch # (try to advance forward)
         tick_ = impl_->global_current_tick();
         INVARIANT(ti.current_tick_.load(std::memory_order_acquire) <= tick_);
@@ -175,18 +266,125 @@ public:
 
   static ticker s_instance CACHE_ALIGNED; // system wide ticker
 
+  // returns once tick is over, ie every guard entered by then was left
+  static void
+  WaitForTick(uint64_t tick)
+  {
+    while (s_instance.global_last_tick_exclusive() <= tick)
+      std::this_thread::sleep_for(std::chrono::microseconds(TickUsec()));
+  }
+
+  // returns once every guard (and so every txn) in at the call is over
+  static inline void
+  WaitOutCurrentTick()
+  {
+    WaitForTick(s_instance.global_current_tick());
+  }
+
+  // sleeps long enough for n units of background work done since t0 (in
+  // usec) to stay within max_per_sec (0 for no limit)
+  static void
+  Throttle(uint64_t max_per_sec, uint64_t t0, uint64_t n)
+  {
+    if (!max_per_sec)
+      return;
+    const uint64_t due_us = n * 1000000 / max_per_sec;
+    const uint64_t elapsed_us = util::timer::cur_usec() - t0;
+    if (due_us > elapsed_us)
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(due_us - elapsed_us));
+  }
+
 private:
 
+  static inline uint64_t
+  Clamp(uint64_t tick_us)
+  {
+    return std::min(std::max(tick_us, MinTickUsec), MaxTickUsec);
+  }
+
+  // moves the tick length halfway towards the one which would have seen
+  // the target # of guards last tick (so a burst does not swing it fully)
+  void
+  adapt(uint64_t last_tick_us)
+  {
+    const uint64_t max_us = s_adaptive_max_us.load(std::memory_order_acquire);
+    if (!max_us)
+      return;
+    uint64_t nguards = 0;
+    for (size_t i = 0; i < ticks_.size(); i++)
+      nguards += ticks_[i].nguards_.load(std::memory_order_acquire);
+    const uint64_t delta = nguards - last_nguards_;
+    last_nguards_ = nguards;
+    const uint64_t min_us = s_adaptive_min_us.load(std::memory_order_acquire);
+    const uint64_t target = s_adaptive_target_guards.load(std::memory_order_acquire);
+    const uint64_t ideal_us = delta ?
+      uint64_t(std::min(double(last_tick_us) * double(target) / double(delta),
+                        double(max_us))) :
+      min_us;
+    const uint64_t next_us =
+      std::min(std::max((TickUsec() + ideal_us) / 2, min_us), max_us);
+    s_tick_us.store(next_us, std::memory_order_release);
+  }
+
+  void
+  unpark()
+  {
+    parked_.store(0, std::memory_order_release);
+    futex::WakeAll(parked_);
+  }
+
+  inline bool
+  anyone_guarded() const
+  {
+    for (size_t i = 0; i < ticks_.size(); i++)
+      if (ticks_[i].depth_.load(std::memory_order_seq_cst))
+        return true;
+    return false;
+  }
+
+  // returns true if it parked
+  bool
+  maybe_park()
+  {
+    if (!s_idle_parking.load(std::memory_order_acquire))
+      return false;
+    uint64_t nguards = 0;
+    for (size_t i = 0; i < ticks_.size(); i++)
+      nguards += ticks_[i].nguards_.load(std::memory_order_acquire);
+    if (nguards != park_nguards_ || anyone_guarded()) {
+      park_nguards_ = nguards;
+      nidle_ticks_ = 0;
+      return false;
+    }
+    if (++nidle_ticks_ < IdleTicksBeforeParking)
+      return false;
+    parked_.store(1, std::memory_order_seq_cst);
+    // a guard which began before it could see parked_ shows up here
+    if (!anyone_guarded())
+      futex::Wait(parked_, 1, MaxTickUsec);
+    parked_.store(0, std::memory_order_release);
+    nidle_ticks_ = 0;
+    return true;
+  }
+
   void
   tickerloop()
   {
     // runs as daemon
     util::timer loop_timer;
     struct timespec t;
+    int cpu = -1;
     for (;;) {
 
+      const int want_cpu = s_cpu.load(std::memory_order_acquire);
+      if (unlikely(want_cpu != cpu) && want_cpu >= 0) {
+        thread_placement::PinCurrentThread(want_cpu);
+        cpu = want_cpu;
+      }
+
       const uint64_t last_loop_usec = loop_timer.lap();
-      const uint64_t delay_time_usec = tick_us;
+      const uint64_t delay_time_usec = TickUsec();
       if (last_loop_usec < delay_time_usec) {
         const uint64_t sleep_ns = (delay_time_usec - last_loop_usec) * 1000;
         t.tv_sec  = sleep_ns / ONE_SECOND_NS;
@@ -209,11 +407,27 @@ private:
                   thread_cur_tick == cur_tick);
         if (thread_cur_tick == cur_tick)
           continue;
-        lock_guard<spinlock> lg(ti.lock_);
+        if (!ti.lock_.try_lock()) {
+          // still in a guard which began last tick
+          util::timer wait_timer;
+          ti.lock_.lock();
+          const uint64_t wait_us = wait_timer.lap();
+          if (wait_us >= delay_time_usec) {
+            ti.nstraggles_.fetch_add(1, std::memory_order_acq_rel);
+            ++s_evt_stragglers;
+            s_evt_straggler_wait_us += wait_us;
+          }
+        }
         ti.current_tick_.store(cur_tick, std::memory_order_release);
+        ti.lock_.unlock();
       }
 
       last_tick_inclusive_.store(last_tick, std::memory_order_release);
+
+      adapt(std::max(last_loop_usec, delay_time_usec));
+
+      if (maybe_park())
+        loop_timer.lap(); // the park is not lag
     }
   }
 
@@ -224,9 +438,11 @@ private:
                                          // (implies completion through current_tick_ - 1)
     std::atomic<uint64_t> depth_; // 0 if not in RCU section
     std::atomic<uint64_t> start_us_; // 0 if not in RCU section
+    std::atomic<uint64_t> nguards_; // # of outermost guards ever entered
+    std::atomic<uint64_t> nstraggles_; // see nstraggles()
 
     tickinfo()
-      : current_tick_(1), depth_(0), start_us_(0)
+      : current_tick_(1), depth_(0), start_us_(0), nguards_(0), nstraggles_(0)
     {
       ALWAYS_ASSERT(((uintptr_t)this % CACHELINE_SIZE) == 0);
     }
@@ -238,4 +454,22 @@ private:
   std::atomic<uint64_t> last_tick_inclusive_;
     // all threads have *completed* ticks <= last_tick_inclusive_
     // (< current_tick_)
+
+  uint64_t last_nguards_; // only touched by the ticker thread
+
+  // 1 while the ticker is parked, on its own line since guards read it
+  std::atomic<uint32_t> parked_ CACHE_ALIGNED;
+  CACHE_PADOUT;
+  uint64_t park_nguards_; // only touched by the ticker thread
+  uint64_t nidle_ticks_; // only touched by the ticker thread
+
+  static std::atomic<uint64_t> s_tick_us;
+  static std::atomic<uint64_t> s_adaptive_min_us;
+  static std::atomic<uint64_t> s_adaptive_max_us; // 0 if not adaptive
+  static std::atomic<uint64_t> s_adaptive_target_guards;
+  static std::atomic<bool> s_idle_parking;
+  static std::atomic<int> s_cpu;
+
+  static event_counter s_evt_stragglers;
+  static event_counter s_evt_straggler_wait_us;
 };
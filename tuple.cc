@@ -59,6 +59,7 @@ dbtuple::VersionInfoStr(version_t v)
   buf << (IsWriteIntent(v) ? "WR" : "-") << " | ";
   buf << (IsModifying(v) ? "MOD" : "-") << " | ";
   buf << (IsLatest(v) ? "LATEST" : "-") << " | ";
+  buf << (IsCold(v) ? "COLD" : "-") << " | ";
   buf << Version(v);
   buf << "]";
   return buf.str();
@@ -89,7 +90,7 @@ dbtuple::print(ostream &o, unsigned len) const
 
   size_t n = 0;
   for (const dbtuple *p = this;
-       p && n < len;
+       p && p != TruncatedChain() && n < len;
        p = p->get_next(), ++n) {
     o << "  ";
     format_tuple(o, *p);
@@ -103,3 +104,40 @@ operator<<(ostream &o, const dbtuple &t)
   t.print(o, 1);
   return o;
 }
+
+atomic<unsigned> tuple_prefetcher::g_distance(4);
+
+static event_counter evt_tuple_prefetch_runs("tuple_prefetch_runs");
+static event_counter evt_tuple_prefetch_runs_on("tuple_prefetch_runs_on");
+
+void
+tuple_prefetcher::next_phase()
+{
+  const uint64_t now = rdtsc();
+  const uint64_t cycles = now - start_;
+  start_ = now;
+  n_ = 0;
+  switch (phase_) {
+  case PHASE_SAMPLE_OFF:
+    distance_ = g_distance.load(memory_order_relaxed);
+    if (!distance_) {
+      phase_ = PHASE_RUN;
+      return;
+    }
+    off_cycles_ = cycles;
+    phase_ = PHASE_SAMPLE_ON;
+    return;
+  case PHASE_SAMPLE_ON:
+    if (cycles * 8 > off_cycles_ * 7)
+      distance_ = 0;
+    else
+      ++evt_tuple_prefetch_runs_on;
+    ++evt_tuple_prefetch_runs;
+    phase_ = PHASE_RUN;
+    return;
+  case PHASE_RUN:
+    distance_ = 0;
+    phase_ = PHASE_SAMPLE_OFF;
+    return;
+  }
+}
@@ -19,6 +19,7 @@
 #include "rcu.h"
 #include "thread.h"
 #include "spinlock.h"
+#include "queue_lock.h"
 #include "small_unordered_map.h"
 #include "prefetch.h"
 #include "ownership_checker.h"
@@ -96,7 +97,12 @@ private:
   static const version_t HDR_LATEST_SHIFT = 4;
   static const version_t HDR_LATEST_MASK = 0x1 << HDR_LATEST_SHIFT;
 
-  static const version_t HDR_VERSION_SHIFT = 5;
+  // set on a cold stub (see cold_store), whose record is a reference to
+  // where the value was evicted to instead of the value itself
+  static const version_t HDR_COLD_SHIFT = 5;
+  static const version_t HDR_COLD_MASK = 0x1 << HDR_COLD_SHIFT;
+
+  static const version_t HDR_VERSION_SHIFT = 6;
   static const version_t HDR_VERSION_MASK = ((version_t)-1) << HDR_VERSION_SHIFT;
 
 public:
@@ -122,10 +128,15 @@ public:
   // event, so we let it happen
   //
   // <-- low bits
-  // [ locked | deleting | write_intent | modifying | latest | version ]
-  // [  0..1  |   1..2   |    2..3      |   3..4    |  4..5  |  5..32  ]
+  // [ locked | deleting | write_intent | modifying | latest | cold | version ]
+  // [  0..1  |   1..2   |    2..3      |   3..4    |  4..5  | 5..6 |  6..32  ]
   volatile version_t hdr;
 
+  // the clock bit of the cold tier (see cold_store): set by reads, cleared by
+  // the sweeper, which evicts tuples it finds still clear on its next pass.
+  // kept out of hdr so that readers never write the version word
+  volatile uint8_t referenced;
+
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
   std::thread::id lock_owner;
 #endif
@@ -183,6 +194,7 @@ private:
       hdr(HDR_LATEST_MASK |
           (acquire_lock ? (HDR_LOCKED_MASK | HDR_WRITE_INTENT_MASK) : 0) |
           (!size ? HDR_DELETING_MASK : 0))
+      , referenced(1)
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
       , lock_owner()
 #endif
@@ -224,6 +236,7 @@ private:
       magic(TUPLE_MAGIC),
 #endif
       hdr(set_latest ? HDR_LATEST_MASK : 0)
+      , referenced(1)
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
       , lock_owner()
 #endif
@@ -263,6 +276,7 @@ private:
       magic(TUPLE_MAGIC),
 #endif
       hdr((set_latest ? HDR_LATEST_MASK : 0) | (!new_size ? HDR_DELETING_MASK : 0))
+      , referenced(1)
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
       , lock_owner()
 #endif
@@ -288,6 +302,42 @@ private:
     g_evt_dbtuple_bytes_allocated += alloc_size + sizeof(dbtuple);
   }
 
+  // creates a latest, unlocked record at version holding r, in place of
+  // another one (see cold_store)- either a cold stub, or the value it
+  // referenced
+  dbtuple(tid_t version,
+          const_record_type r,
+          size_type size,
+          size_type alloc_size,
+          bool cold)
+    :
+#ifdef TUPLE_MAGIC
+      magic(TUPLE_MAGIC),
+#endif
+      hdr(HDR_LATEST_MASK | (cold ? HDR_COLD_MASK : 0))
+      , referenced(!cold)
+#ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
+      , lock_owner()
+#endif
+      , version(version)
+      , size(CheckBounds(size))
+      , alloc_size(CheckBounds(alloc_size))
+      , next(nullptr)
+#ifdef TUPLE_CHECK_KEY
+      , key()
+      , tree(nullptr)
+#endif
+#ifdef CHECK_INVARIANTS
+      , opaque(0)
+#endif
+  {
+    INVARIANT(size);
+    INVARIANT(size <= alloc_size);
+    NDB_MEMCPY(&value_start[0], r, size);
+    ++g_evt_dbtuple_creates;
+    g_evt_dbtuple_bytes_allocated += alloc_size + sizeof(dbtuple);
+  }
+
   friend class rcu;
   ~dbtuple();
 
@@ -301,6 +351,8 @@ public:
     READ_FAILED,
     READ_EMPTY,
     READ_RECORD,
+    READ_COLD, // the version read is a cold stub: nothing was read, and the
+               // value has to come from the cold_store
   };
 
   inline void
@@ -352,8 +404,18 @@ public:
     const version_t lockmask = write_intent ?
       (HDR_LOCKED_MASK | HDR_WRITE_INTENT_MASK) :
       (HDR_LOCKED_MASK);
+    unsigned n = 0;
     while (IsLocked(v) ||
            !__sync_bool_compare_and_swap(&hdr, v, v | lockmask)) {
+      if (unlikely(++n == queue_lock::SpinsBeforeQueueing) &&
+          queue_lock::IsEnabled()) {
+        queue_lock::Acquire(this, [this, lockmask]() {
+          const version_t v = hdr;
+          return !IsLocked(v) &&
+                 __sync_bool_compare_and_swap(&hdr, v, v | lockmask);
+        });
+        break;
+      }
       nop_pause();
       v = hdr;
 #ifdef ENABLE_EVENT_COUNTERS
@@ -375,6 +437,49 @@ public:
     return hdr;
   }
 
+  // like lock(), but gives up after spins attempts. returns true if the lock
+  // was acquired, in which case v is set to what lock() would have returned
+  inline bool
+  try_lock(bool write_intent, unsigned int spins, version_t &v)
+  {
+    CheckMagic();
+    v = hdr;
+    const version_t lockmask = write_intent ?
+      (HDR_LOCKED_MASK | HDR_WRITE_INTENT_MASK) :
+      (HDR_LOCKED_MASK);
+    while (IsLocked(v) ||
+           !__sync_bool_compare_and_swap(&hdr, v, v | lockmask)) {
+      if (!spins--)
+        return false;
+      nop_pause();
+      v = hdr;
+    }
+#ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
+    lock_owner = std::this_thread::get_id();
+    AddTupleToLockRegion(this);
+    INVARIANT(is_lock_owner());
+#endif
+    COMPILER_MEMORY_FENCE;
+    INVARIANT(IsLocked(hdr));
+    INVARIANT(!write_intent || IsWriteIntent(hdr));
+    INVARIANT(!IsModifying(hdr));
+    v = hdr;
+    return true;
+  }
+
+  // turns a lock(false) held by the caller into a lock(true)
+  inline version_t
+  upgrade_lock()
+  {
+    CheckMagic();
+    INVARIANT(is_locked());
+    INVARIANT(is_lock_owner());
+    INVARIANT(!IsModifying(hdr));
+    hdr = hdr | HDR_WRITE_INTENT_MASK;
+    COMPILER_MEMORY_FENCE;
+    return hdr;
+  }
+
   inline void
   unlock()
   {
@@ -499,6 +604,49 @@ public:
     hdr &= ~HDR_LATEST_MASK;
   }
 
+  inline bool
+  is_cold() const
+  {
+    return IsCold(hdr);
+  }
+
+  static inline bool
+  IsCold(version_t v)
+  {
+    return v & HDR_COLD_MASK;
+  }
+
+  // once a stub's row is deleted, the stub no longer refers to the cold file
+  inline void
+  clear_cold()
+  {
+    CheckMagic();
+    INVARIANT(is_locked());
+    INVARIANT(is_lock_owner());
+    hdr &= ~HDR_COLD_MASK;
+  }
+
+  // only writes the cache line if the bit is clear, so hot tuples are not
+  // dirtied by every read
+  inline ALWAYS_INLINE void
+  mark_referenced() const
+  {
+    if (unlikely(!referenced))
+      const_cast<dbtuple *>(this)->referenced = 1;
+  }
+
+  inline void
+  clear_referenced()
+  {
+    referenced = 0;
+  }
+
+  inline bool
+  is_referenced() const
+  {
+    return referenced;
+  }
+
   static inline version_t
   Version(version_t v)
   {
@@ -596,6 +744,15 @@ public:
     this->next = nullptr;
   }
 
+  // where a chain is cut when chains are bounded (see
+  // transaction_proto2_static::TrimVersionChain()): readers which would
+  // walk past it fail instead
+  static inline dbtuple *
+  TruncatedChain()
+  {
+    return reinterpret_cast<dbtuple *>(0x1);
+  }
+
   inline ALWAYS_INLINE uint8_t *
   get_value_start()
   {
@@ -649,6 +806,8 @@ private:
     const bool found = current->is_not_behind(t);
     if (found) {
       start_t = current->version;
+      if (unlikely(IsCold(v)))
+        return READ_COLD;
       const size_t read_sz = IsDeleting(v) ? 0 : current->size;
       if (unlikely(read_sz && !reader(current->get_value_start(), read_sz, sa)))
         goto retry;
@@ -660,6 +819,8 @@ private:
     }
     if (unlikely(!current->reader_check_version(v)))
       goto retry;
+    if (unlikely(p == TruncatedChain()))
+      return READ_FAILED;
     if (p) {
       current = p;
       goto loop;
@@ -703,6 +864,8 @@ private:
       //if (unlikely(!IsLatest(v)))
       //  return READ_FAILED;
       start_t = version;
+      if (unlikely(IsCold(v)))
+        return READ_COLD;
       const size_t read_sz = IsDeleting(v) ? 0 : size;
       if (unlikely(read_sz && !reader(get_value_start(), read_sz, sa)))
         goto retry;
@@ -714,6 +877,8 @@ private:
     }
     if (unlikely(!reader_check_version(v)))
       goto retry;
+    if (unlikely(p == TruncatedChain()))
+      return READ_FAILED;
     if (p)
       return record_at_chain(p, t, start_t, reader, sa, allow_write_intent);
     // NB(stephentu): if we reach the end of a chain then we assume that
@@ -837,6 +1002,12 @@ public:
     TUPLE_WRITER_COMPUTE_DELTA_NEEDED, // last two args ignored
     TUPLE_WRITER_DO_WRITE,
     TUPLE_WRITER_DO_DELTA_WRITE,
+    // only for commutative writes (see transaction::write_record_t): the
+    // first arg is a delta, which RESOLVE_DELTA turns into the value to write
+    // given the record's current value (in the last two args), and which
+    // ADD_DELTA adds into the (unencoded) value pointed to by the third arg
+    TUPLE_WRITER_RESOLVE_DELTA,
+    TUPLE_WRITER_ADD_DELTA,
   };
   typedef size_t (*tuple_writer_t)(TupleWriterMode, const void *, uint8_t *, size_t);
 
@@ -849,11 +1020,16 @@ public:
    * ret.second = old version of tuple, iff no overwrite (can be nullptr)
    *
    * Note: if this != ret.first, then we need a tree replacement
+   *
+   * If drop_old_versions, the record is overwritten in place (if it fits)
+   * even if a snapshot could read the version it replaces, and the chain is
+   * cut, so such snapshot reads fail rather than see an older version
    */
   template <typename Transaction>
   write_record_ret
   write_record_at(const Transaction *txn, tid_t t,
-                  const void *v, tuple_writer_t writer)
+                  const void *v, tuple_writer_t writer,
+                  bool drop_old_versions = false)
   {
 #ifndef DISABLE_OVERWRITE_IN_PLACE
     CheckMagic();
@@ -872,7 +1048,8 @@ public:
       ++g_evt_dbtuple_logical_deletes;
 
     // try to overwrite this record
-    if (likely(txn->can_overwrite_record_tid(version, t) && old_sz)) {
+    const bool same_snapshots = txn->can_overwrite_record_tid(version, t);
+    if (likely((same_snapshots || drop_old_versions) && old_sz)) {
       INVARIANT(!is_deleting());
       // see if we have enough space
       if (likely(new_sz <= alloc_size)) {
@@ -880,6 +1057,9 @@ public:
         mark_modifying();
         if (v)
           writer(TUPLE_WRITER_DO_WRITE, v, get_value_start(), old_sz);
+        if (!same_snapshots && get_next() != TruncatedChain())
+          // the versions past this one are already queued for GC
+          set_next(TruncatedChain());
         version = t;
         size = new_sz;
         if (!new_sz)
@@ -989,17 +1169,21 @@ public:
   // NB: we round up allocation sizes because jemalloc will do this
   // internally anyways, so we might as well grab more usable space (really
   // just internal vs external fragmentation)
+  static inline size_t
+  AllocSize(size_type sz)
+  {
+    const size_t max_alloc_sz =
+      std::numeric_limits<node_size_type>::max() + sizeof(dbtuple);
+    return std::min(
+        util::round_up<size_t, allocator::LgAllocAlignment>(sizeof(dbtuple) + sz),
+        max_alloc_sz);
+  }
 
   static inline dbtuple *
   alloc_first(size_type sz, bool acquire_lock)
   {
     INVARIANT(sz <= std::numeric_limits<node_size_type>::max());
-    const size_t max_alloc_sz =
-      std::numeric_limits<node_size_type>::max() + sizeof(dbtuple);
-    const size_t alloc_sz =
-      std::min(
-          util::round_up<size_t, allocator::LgAllocAlignment>(sizeof(dbtuple) + sz),
-          max_alloc_sz);
+    const size_t alloc_sz = AllocSize(sz);
     char *p = reinterpret_cast<char *>(rcu::s_instance.alloc(alloc_sz));
     INVARIANT(p);
     INVARIANT((alloc_sz - sizeof(dbtuple)) >= sz);
@@ -1010,12 +1194,7 @@ public:
   static inline dbtuple *
   alloc(tid_t version, struct dbtuple *base, bool set_latest)
   {
-    const size_t max_alloc_sz =
-      std::numeric_limits<node_size_type>::max() + sizeof(dbtuple);
-    const size_t alloc_sz =
-      std::min(
-          util::round_up<size_t, allocator::LgAllocAlignment>(sizeof(dbtuple) + base->size),
-          max_alloc_sz);
+    const size_t alloc_sz = AllocSize(base->size);
     char *p = reinterpret_cast<char *>(rcu::s_instance.alloc(alloc_sz));
     INVARIANT(p);
     return new (p) dbtuple(
@@ -1032,12 +1211,7 @@ public:
 
     const size_t needed_sz =
       copy_old_value ? std::max(newsz, oldsz) : newsz;
-    const size_t max_alloc_sz =
-      std::numeric_limits<node_size_type>::max() + sizeof(dbtuple);
-    const size_t alloc_sz =
-      std::min(
-          util::round_up<size_t, allocator::LgAllocAlignment>(sizeof(dbtuple) + needed_sz),
-          max_alloc_sz);
+    const size_t alloc_sz = AllocSize(needed_sz);
     char *p = reinterpret_cast<char *>(rcu::s_instance.alloc(alloc_sz));
     INVARIANT(p);
     return new (p) dbtuple(
@@ -1045,6 +1219,17 @@ public:
         alloc_sz - sizeof(dbtuple), next, set_latest, copy_old_value);
   }
 
+  // a tuple to put in place of a latest tuple at version (see cold_store)
+  static inline dbtuple *
+  alloc_replacement(tid_t version, const_record_type r, size_type sz, bool cold)
+  {
+    INVARIANT(sz <= std::numeric_limits<node_size_type>::max());
+    const size_t alloc_sz = AllocSize(sz);
+    char *p = reinterpret_cast<char *>(rcu::s_instance.alloc(alloc_sz));
+    INVARIANT(p);
+    return new (p) dbtuple(
+        version, r, sz, alloc_sz - sizeof(dbtuple), cold);
+  }
 
 private:
   static inline void
@@ -1073,7 +1258,7 @@ public:
       return;
     INVARIANT(n->is_locked());
     INVARIANT(!n->is_latest());
-    rcu::s_instance.free_with_fn(n, deleter);
+    rcu::s_instance.free_with_fn(n, deleter, sizeof(dbtuple) + n->alloc_size);
   }
 
   static inline void
@@ -1096,4 +1281,56 @@ PACKED
 #endif
 ;
 
+/**
+ * Decides, for one scan, whether the tuples of each leaf are prefetched
+ * ahead of the records being handed to the scan's callback (see
+ * low_level_search_range_callback::prefetch_distance()).
+ *
+ * Prefetching only pays off when the tuples miss in cache (say, a table far
+ * bigger than the LLC), and costs a little when they do not, so the scan
+ * measures: every RunNRecords records it times SampleNRecords records
+ * without prefetching and as many with, and keeps prefetching on for the
+ * next run only if that was at least 1/8 faster. The cycles a record takes
+ * stand in for its misses, which cannot be counted per scan
+ */
+class tuple_prefetcher {
+public:
+  static const unsigned SampleNRecords = 64;
+  static const unsigned RunNRecords = 4096;
+
+  // how many records ahead of the one being read to prefetch. 0 turns
+  // prefetching off
+  static std::atomic<unsigned> g_distance;
+
+  tuple_prefetcher()
+    : phase_(PHASE_SAMPLE_OFF), distance_(0), n_(0),
+      start_(rdtsc()), off_cycles_(0) {}
+
+  inline unsigned
+  distance() const
+  {
+    return distance_;
+  }
+
+  // called as each record is read
+  inline void
+  on_record()
+  {
+    if (likely(++n_ < (phase_ == PHASE_RUN ? RunNRecords : SampleNRecords)))
+      return;
+    next_phase();
+  }
+
+private:
+  enum phase { PHASE_SAMPLE_OFF, PHASE_SAMPLE_ON, PHASE_RUN };
+
+  void next_phase();
+
+  phase phase_;
+  unsigned distance_;
+  unsigned n_;
+  uint64_t start_;
+  uint64_t off_cycles_;
+};
+
 #endif /* _NDB_TUPLE_H_ */
@@ -64,4 +64,27 @@ event_counter transaction_base::g_evt_dbtuple_write_insert_failed
 
 event_counter transaction_base::evt_local_search_lookups("local_search_lookups");
 event_counter transaction_base::evt_local_search_write_set_hits("local_search_write_set_hits");
+event_counter transaction_base::evt_local_search_expired("local_search_expired");
 event_counter transaction_base::evt_dbtuple_latest_replacement("dbtuple_latest_replacement");
+event_counter transaction_base::evt_commutative_writes_resolved("commutative_writes_resolved");
+event_counter transaction_base::evt_single_read_commits("single_read_commits");
+event_counter transaction_base::evt_single_write_commits("single_write_commits");
+event_counter transaction_base::evt_field_read_validations("field_read_validations");
+event_counter transaction_base::evt_txn_resets("txn_resets");
+event_counter transaction_base::evt_single_partition_txns("single_partition_txns");
+event_counter transaction_base::evt_cross_partition_txns("cross_partition_txns");
+event_counter transaction_base::evt_untracked_partition_reads("untracked_partition_reads");
+event_counter transaction_base::evt_early_validations("early_validations");
+event_counter transaction_base::evt_early_aborts("early_aborts");
+
+atomic<size_t> transaction_base::g_early_validation_reads(0);
+
+event_histogram transaction_base::g_hist_commit_cycles("txn_commit_cycles");
+event_histogram transaction_base::g_hist_commit_lock_cycles("txn_commit_lock_cycles");
+event_histogram transaction_base::g_hist_commit_tid_cycles("txn_commit_tid_cycles");
+event_histogram transaction_base::g_hist_commit_read_validation_cycles
+    ("txn_commit_read_validation_cycles");
+event_histogram transaction_base::g_hist_commit_node_validation_cycles
+    ("txn_commit_node_validation_cycles");
+event_histogram transaction_base::g_hist_commit_install_cycles("txn_commit_install_cycles");
+event_histogram transaction_base::g_hist_commit_log_cycles("txn_commit_log_cycles");
@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <pthread.h>
 
+#include <atomic>
 #include <map>
 #include <iostream>
 #include <vector>
@@ -29,6 +30,7 @@
 #include "thread.h"
 #include "spinlock.h"
 #include "small_unordered_map.h"
+#include "flat_ptr_index.h"
 #include "static_unordered_map.h"
 #include "static_vector.h"
 #include "prefetch.h"
@@ -71,9 +73,46 @@ public:
     // txn is aborted
     TXN_FLAG_READ_ONLY = 0x2,
 
+    // with TXN_FLAG_READ_ONLY, a txn reads from the read-only snapshot only
+    // if it is at most MaxStalenessUsec(flags) old. otherwise it reads the
+    // latest values and validates them at commit, like a regular txn (and so
+    // can abort). see BoundedStalenessFlags()
+    TXN_FLAG_BOUNDED_STALENESS = 0x4,
+
     // XXX: more flags in the future, things like consistency levels
   };
 
+  // how commits write over the records of a table (see
+  // base_txn_btree::set_write_policy())
+  enum write_policy {
+    // a record's old version is kept whenever a snapshot could read it
+    WRITE_POLICY_VERSIONED = 0,
+    // records are overwritten in place whenever they fit, as if no snapshot
+    // ever read the table. a snapshot read which would have needed a dropped
+    // version aborts
+    WRITE_POLICY_IN_PLACE,
+    // WRITE_POLICY_IN_PLACE while no snapshot has read the table for a
+    // couple of read-only epochs, WRITE_POLICY_VERSIONED otherwise
+    WRITE_POLICY_ADAPTIVE,
+  };
+
+  // the staleness bound lives in the high bits of the flags
+  static const unsigned int StalenessShift = 32;
+
+  static inline uint64_t
+  BoundedStalenessFlags(uint64_t max_staleness_usec)
+  {
+    INVARIANT(max_staleness_usec < (uint64_t(1) << (64 - StalenessShift)));
+    return TXN_FLAG_READ_ONLY | TXN_FLAG_BOUNDED_STALENESS |
+           (max_staleness_usec << StalenessShift);
+  }
+
+  static inline uint64_t
+  MaxStalenessUsec(uint64_t flags)
+  {
+    return flags >> StalenessShift;
+  }
+
 #define ABORT_REASONS(x) \
     x(ABORT_REASON_NONE) \
     x(ABORT_REASON_USER) \
@@ -84,7 +123,8 @@ public:
     x(ABORT_REASON_WRITE_NODE_INTERFERENCE) \
     x(ABORT_REASON_INSERT_NODE_INTERFERENCE) \
     x(ABORT_REASON_READ_NODE_INTEREFERENCE) \
-    x(ABORT_REASON_READ_ABSENCE_INTEREFERENCE)
+    x(ABORT_REASON_READ_ABSENCE_INTEREFERENCE) \
+    x(ABORT_REASON_COLD_READ)
 
   enum abort_reason {
 #define ENUM_X(x) x,
@@ -109,7 +149,9 @@ public:
   transaction_base(uint64_t flags)
     : state(TXN_EMBRYO),
       reason(ABORT_REASON_NONE),
-      flags(flags) {}
+      flags(flags),
+      conflict_tuple(nullptr),
+      conflict_node(nullptr) {}
 
   transaction_base(const transaction_base &) = delete;
   transaction_base(transaction_base &&) = delete;
@@ -152,6 +194,28 @@ public:
     return flags;
   }
 
+  inline abort_reason
+  get_abort_reason() const
+  {
+    return reason;
+  }
+
+  // the record whose change made the txn abort, if known (for a read set
+  // entry which failed validation, the first such entry), so that a retry
+  // can re-read it first. cleared by a reset()
+  inline const dbtuple *
+  get_conflict_tuple() const
+  {
+    return conflict_tuple;
+  }
+
+  // a txn which tracks its reads re-validates them mid-way (see
+  // early_validate()) once it has made this many, then each time the count
+  // doubles, and whenever a read finds a committer writing the tuple. so a
+  // long txn whose reads went stale aborts early instead of finishing its
+  // work first. 0 (the default) only validates at commit
+  static std::atomic<size_t> g_early_validation_reads;
+
 protected:
 
   // the read set is a mapping from (tuple -> tid_read).
@@ -179,11 +243,45 @@ protected:
   friend std::ostream &
   operator<<(std::ostream &o, const read_record_t &r);
 
+public:
+
+  // a read of only some fields of a fixed layout record, for tables which
+  // validate reads by field (see typed_txn_btree::set_field_validation()):
+  // the read then only conflicts with writes which change those fields
+  struct field_read_t {
+    uint64_t mask;
+    // the fields read, at their offsets within the record
+    const uint8_t *value;
+    size_t size;
+    // whether the fields in mask of the record rec (of sz bytes) are the
+    // same as those of value
+    bool (*same)(const uint8_t *rec, size_t sz,
+                 const uint8_t *value, uint64_t mask);
+  };
+
+protected:
+
+  // a field_read_t which went into the read set, with a copy of the fields
+  // (owned by the txn's string allocator)
+  struct field_read_record_t {
+    const dbtuple *tuple;
+    tid_t t;
+    uint64_t mask;
+    const uint8_t *value;
+    bool (*same)(const uint8_t *, size_t, const uint8_t *, uint64_t);
+  };
+
   // the write set is logically a mapping from (tuple -> value_to_write).
+  //
+  // a commutative write's value is a delta, which is only combined with the
+  // record's value at commit, under the record's lock (so the txn never has
+  // to read the record). the value is owned by the txn, and turned into the
+  // value to write with TUPLE_WRITER_RESOLVE_DELTA
   struct write_record_t {
     enum {
-      FLAGS_INSERT  = 0x1,
-      FLAGS_DOWRITE = 0x1 << 1,
+      FLAGS_INSERT      = 0x1,
+      FLAGS_DOWRITE     = 0x1 << 1,
+      FLAGS_COMMUTATIVE = 0x1 << 2,
     };
 
     constexpr inline write_record_t()
@@ -196,14 +294,17 @@ protected:
                           const void *r,
                           dbtuple::tuple_writer_t w,
                           concurrent_btree *btr,
-                          bool insert)
+                          bool insert,
+                          bool commutative = false)
       : tuple(tuple),
         k(k),
         r(r),
         w(w),
         btr(btr)
     {
-      this->btr.set_flags(insert ? FLAGS_INSERT : 0);
+      INVARIANT(!insert || !commutative);
+      this->btr.set_flags((insert ? FLAGS_INSERT : 0) |
+                          (commutative ? FLAGS_COMMUTATIVE : 0));
     }
     inline dbtuple *
     get_tuple()
@@ -221,6 +322,11 @@ protected:
       return btr.get_flags() & FLAGS_INSERT;
     }
     inline bool
+    is_commutative() const
+    {
+      return btr.get_flags() & FLAGS_COMMUTATIVE;
+    }
+    inline bool
     do_write() const
     {
       return btr.get_flags() & FLAGS_DOWRITE;
@@ -251,19 +357,30 @@ protected:
     {
       return w;
     }
+    inline void
+    set_value(const void *r)
+    {
+      this->r = r;
+    }
   private:
     dbtuple *tuple;
     const string_type *k;
     const void *r;
     dbtuple::tuple_writer_t w;
-    marked_ptr<concurrent_btree> btr; // first bit for inserted, 2nd for dowrite
+    marked_ptr<concurrent_btree> btr; // first bit for inserted, 2nd for dowrite,
+                                      // 3rd for commutative
   };
 
   friend std::ostream &
   operator<<(std::ostream &o, const write_record_t &r);
 
-  // the absent set is a mapping from (btree_node -> version_number).
-  struct absent_record_t { uint64_t version; };
+  // the absent set is a sequence of (btree_node, version_number), appended to
+  // without looking for the node first (see do_node_read()). a node can be in
+  // it more than once; entries whose node is null are duplicates folded away
+  struct absent_record_t {
+    const concurrent_btree::node_opaque_t *node;
+    uint64_t version;
+  };
 
   friend std::ostream &
   operator<<(std::ostream &o, const absent_record_t &r);
@@ -332,7 +449,28 @@ protected:
 
   static event_counter evt_local_search_lookups;
   static event_counter evt_local_search_write_set_hits;
+  static event_counter evt_local_search_expired;
   static event_counter evt_dbtuple_latest_replacement;
+  static event_counter evt_commutative_writes_resolved;
+  static event_counter evt_single_read_commits;
+  static event_counter evt_single_write_commits;
+  static event_counter evt_field_read_validations;
+  static event_counter evt_txn_resets;
+  static event_counter evt_single_partition_txns;
+  static event_counter evt_cross_partition_txns;
+  static event_counter evt_untracked_partition_reads;
+  static event_counter evt_early_validations;
+  static event_counter evt_early_aborts;
+
+  // timed only with event counters enabled. the phases of commit() are
+  // each timed from the end of the one before (see COMMIT_PHASE_END())
+  static event_histogram g_hist_commit_cycles;
+  static event_histogram g_hist_commit_lock_cycles;
+  static event_histogram g_hist_commit_tid_cycles;
+  static event_histogram g_hist_commit_read_validation_cycles;
+  static event_histogram g_hist_commit_node_validation_cycles;
+  static event_histogram g_hist_commit_install_cycles;
+  static event_histogram g_hist_commit_log_cycles;
 
   CLASS_STATIC_COUNTER_DECL(scopedperf::tsc_ctr, g_txn_commit_probe0, g_txn_commit_probe0_cg);
   CLASS_STATIC_COUNTER_DECL(scopedperf::tsc_ctr, g_txn_commit_probe1, g_txn_commit_probe1_cg);
@@ -345,6 +483,8 @@ protected:
   txn_state state;
   abort_reason reason;
   const uint64_t flags;
+  const dbtuple *conflict_tuple; // the record which caused the abort, if known
+  const void *conflict_node; // or the btree node
 };
 
 // type specializations
@@ -398,7 +538,7 @@ operator<<(
 inline ALWAYS_INLINE std::ostream &
 operator<<(std::ostream &o, const transaction_base::absent_record_t &r)
 {
-  o << "[v=" << r.version << "]";
+  o << "[node=" << util::hexify(r.node) << ", v=" << r.version << "]";
   return o;
 }
 
@@ -413,6 +553,8 @@ struct default_transaction_traits {
                                             // performance penality [you should not need this behavior to
                                             // write txns, since you *know* the values you inserted]
 
+  static const bool read_only = false; // see read_only_transaction_traits
+
   typedef util::default_string_allocator StringAllocator;
 };
 
@@ -420,6 +562,19 @@ struct default_stable_transaction_traits : public default_transaction_traits {
   static const bool stable_input_memory = true;
 };
 
+// txns with these traits are read-only by type: TXN_FLAG_READ_ONLY is
+// implied, they always read from the snapshot (so TXN_FLAG_BOUNDED_STALENESS,
+// which may fall back on validated reads, is not allowed), and commit() just
+// marks them committed. the read-write paths fold away at compile time, and
+// the read/write/absent sets keep next to no inline space. writes abort, as
+// they do for any read-only txn
+struct read_only_transaction_traits : public default_transaction_traits {
+  static const size_t read_set_expected_size = 1;
+  static const size_t absent_set_expected_size = 1;
+  static const size_t write_set_expected_size = 1;
+  static const bool read_only = true;
+};
+
 template <template <typename> class Protocol, typename Traits>
 class transaction : public transaction_base {
   // XXX: weaker than necessary
@@ -531,8 +686,8 @@ protected:
   typedef small_vector<
     write_record_t,
     traits_type::write_set_expected_size> write_set_map_small;
-  typedef small_unordered_map<
-    const typename concurrent_btree::node_opaque_t *, absent_record_t,
+  typedef small_vector<
+    absent_record_t,
     traits_type::absent_set_expected_size> absent_set_map_small;
 
   // static types
@@ -542,8 +697,8 @@ protected:
   typedef static_vector<
     write_record_t,
     traits_type::write_set_expected_size> write_set_map_static;
-  typedef static_unordered_map<
-    const typename concurrent_btree::node_opaque_t *, absent_record_t,
+  typedef static_vector<
+    absent_record_t,
     traits_type::absent_set_expected_size> absent_set_map_static;
 
   // helper types for log writing
@@ -619,6 +774,70 @@ protected:
           { return lhs.get_tuple() < rhs.get_tuple(); });
   }
 
+  // write sets at least this long are put in lock order by radix sort
+  static const size_t RadixSortThreshold = 256;
+
+  // sorts dbtuples by operator<, for dbtuples built in pos order
+  static void radix_sort_dbtuples(dbtuple_write_info_vec &dbtuples);
+
+  // tuples LockPrefetchAhead entries ahead of the one being locked at commit
+  // are prefetched
+  static const size_t LockPrefetchAhead = 8;
+
+  // read set entries are validated in chunks of ValidateBatchSize, with the
+  // tuples ValidatePrefetchAhead entries ahead being prefetched
+  static const size_t ValidateBatchSize = 8;
+  static const size_t ValidatePrefetchAhead = 8;
+
+  // are all the tuples in the read set still at the versions we read? if
+  // not, sets conflict_tuple to the first one which changed
+  bool validate_read_set(const dbtuple_write_info_vec &write_dbtuples);
+
+  // is r's tuple still at the version read, or else still the latest
+  // version and not locked, with the fields read unchanged? locked is
+  // whether this txn holds the tuple's lock
+  static bool validate_field_read(const field_read_record_t &r, bool locked);
+
+  // most hot records (see contention_manager) a txn locks as it reads them
+  static const size_t MaxHotLocks = 8;
+
+  inline bool
+  holds_hot_lock(const dbtuple *tuple) const
+  {
+    for (auto it = hot_locks.begin(); it != hot_locks.end(); ++it)
+      if (*it == tuple)
+        return true;
+    return false;
+  }
+
+  // if the txn holds a hot lock on tuple, hands the lock over to the caller
+  inline bool
+  take_hot_lock(const dbtuple *tuple)
+  {
+    for (auto it = hot_locks.begin(); it != hot_locks.end(); ++it)
+      if (*it == tuple) {
+        *it = nullptr;
+        return true;
+      }
+    return false;
+  }
+
+  inline void release_hot_locks();
+
+  // checks the reads and node versions so far are still current, and
+  // aborts the txn if not. commit() checks them all again: a read which is
+  // current now can still be overwritten before the txn commits
+  void early_validate();
+
+  inline void release_partition_locks();
+
+  // offers the key behind the abort to abort_sampler, and to
+  // access_sampler as a conflict, if sampled
+  inline void sample_abort();
+
+  // offers the keys read and written to access_sampler, if sampled
+  inline void sample_accesses();
+
 public:
 
   inline transaction(uint64_t flags, string_allocator_type &sa);
@@ -638,6 +857,21 @@ public:
 
   void dump_debug_info() const;
 
+  // releases what a resolved txn holds (its RCU region), but keeps the
+  // containers it has grown, so that a retry can reset() it instead of
+  // building a new txn. a parked txn can only be reset() or destroyed
+  inline void park();
+
+  // makes a resolved (or parked) txn new again, with the same flags and
+  // string allocator. its read/write/absent sets keep their capacity
+  inline void reset();
+
+  inline bool
+  is_parked() const
+  {
+    return parked;
+  }
+
 #ifdef DIE_ON_ABORT
   void
   abort_trap(abort_reason reason)
@@ -657,10 +891,34 @@ public:
 
   std::map<std::string, uint64_t> get_txn_counters() const;
 
+  // read-only txns read from a snapshot, unless the snapshot was too stale
+  // for TXN_FLAG_BOUNDED_STALENESS
   inline ALWAYS_INLINE bool
   is_snapshot() const
   {
-    return get_flags() & TXN_FLAG_READ_ONLY;
+    return Traits::read_only || snapshot;
+  }
+
+  inline ALWAYS_INLINE bool
+  is_read_only() const
+  {
+    return Traits::read_only || (get_flags() & TXN_FLAG_READ_ONLY);
+  }
+
+  // partitioned execution (see partition_manager): takes the locks of the
+  // partitions [parts, parts + n) (in partition order, duplicates allowed),
+  // and holds them until the txn commits or aborts. must be called before
+  // the txn does anything else, and at most once
+  void enter_partitions(const unsigned *parts, size_t n);
+
+  // the txn's reads of tables bound to partition p are not tracked (and so
+  // not validated) iff it entered p and no other partition. p < 0 stands for
+  // an unpartitioned table
+  inline ALWAYS_INLINE bool
+  owns_partition(int p) const
+  {
+    return p >= 0 && entered_partitions.size() == 1 &&
+           int(entered_partitions[0]) == p;
   }
 
   // for debugging purposes only
@@ -719,12 +977,42 @@ protected:
 
   // reads the contents of tuple into v
   // within this transaction context
+  //
+  // if !track, the read is left out of the read set (see owns_partition()).
+  // a record at a tid <= expired_tid reads as absent (see txn_ttl)
   template <typename ValueReader>
   bool
-  do_tuple_read(const dbtuple *tuple, ValueReader &value_reader);
-
+  do_tuple_read(const dbtuple *tuple, ValueReader &value_reader,
+                bool track = true, tid_t expired_tid = 0,
+                const field_read_t *field_read = nullptr);
+
+  // do_tuple_read() for snapshot txns, minus all the bookkeeping, so that
+  // other threads can read on the txn's behalf (into their own string
+  // allocators). READ_FAILED must be turned into an abort by the txn's own
+  // thread
+  template <typename ValueReader, typename StringAllocator>
+  dbtuple::ReadStatus
+  do_snapshot_tuple_read(const dbtuple *tuple, ValueReader &value_reader,
+                         StringAllocator &sa, tid_t expired_tid = 0) const;
+
+  // if !track, the read is left out of the absent set (see owns_partition())
   void
-  do_node_read(const typename concurrent_btree::node_opaque_t *n, uint64_t version);
+  do_node_read(const typename concurrent_btree::node_opaque_t *n, uint64_t version,
+               bool track = true);
+
+  // sampled txns (see abort_sampler, access_sampler) remember which key (of btr) each tuple
+  // or node they touch belongs to, so they can tell which key aborted them
+  inline ALWAYS_INLINE bool
+  is_sampling_keys() const
+  {
+    return sampling_keys;
+  }
+
+  inline void
+  note_key(const void *px, const concurrent_btree *btr, const std::string &key)
+  {
+    sampled_keys.push_back(sampled_key{px, btr, key});
+  }
 
 public:
   // expected public overrides
@@ -734,6 +1022,17 @@ public:
    */
   bool can_overwrite_record_tid(tid_t prev, tid_t cur) const;
 
+  /**
+   * May the commit overwrite the records of btr in place whatever their tids
+   * (see transaction_base::write_policy)? Their old versions are dropped
+   */
+  bool can_drop_old_versions(const concurrent_btree *btr) const;
+
+  /**
+   * A snapshot txn is about to read btr (see WRITE_POLICY_ADAPTIVE)
+   */
+  void note_snapshot_read(const concurrent_btree *btr) const;
+
   inline string_allocator_type &
   string_allocator()
   {
@@ -768,6 +1067,10 @@ protected:
   // with the resolution (commited, aborted) of this txn
   void on_tid_finish(tid_t commit_tid);
 
+  // called after a traced txn (see txn_tracer) commits at commit_tid, so the
+  // protocol can txn_tracer::RecordDurable() it once it is durable
+  void on_trace_durable(tid_t commit_tid);
+
   void on_post_rcu_region_completion();
 
 protected:
@@ -794,9 +1097,52 @@ protected:
     return const_cast<transaction *>(this)->find_read_set(tuple);
   }
 
+  // write sets longer than this are looked up through write_set_index
+  static const size_t WriteSetIndexThreshold = 64;
+
+  // the bits of tuple in write_set_filter: two of the 64, picked by a
+  // multiplicative hash of the pointer
+  static inline uint64_t
+  WriteSetFilterBits(const dbtuple *tuple)
+  {
+    const uint64_t h =
+      reinterpret_cast<uintptr_t>(tuple) * 0x9e3779b97f4a7c15ULL;
+    return (1ULL << (h >> 58)) | (1ULL << ((h >> 52) & 63));
+  }
+
+  // brings write_set_filter up to date with the (append-only) write set, and
+  // returns false if tuple is certainly not in it. most reads do not hit the
+  // txn's own writes, so this spares them the search of the write set
+  inline bool
+  write_set_may_contain(const dbtuple *tuple)
+  {
+    for (size_t i = write_set_filter_npositions; i < write_set.size(); i++)
+      write_set_filter |= WriteSetFilterBits(write_set[i].get_tuple());
+    write_set_filter_npositions = write_set.size();
+    const uint64_t b = WriteSetFilterBits(tuple);
+    return (write_set_filter & b) == b;
+  }
+
+  // brings write_set_index up to date with the (append-only) write set, and
+  // returns tuple's entry in it, if any
+  inline const flat_ptr_index::entry *
+  lookup_write_set_index(const dbtuple *tuple)
+  {
+    INVARIANT(write_set.size() > WriteSetIndexThreshold);
+    for (size_t i = write_set_index.npositions(); i < write_set.size(); i++)
+      write_set_index.append(write_set[i].get_tuple());
+    return write_set_index.find(tuple);
+  }
+
   typename write_set_map::iterator
   find_write_set(dbtuple *tuple)
   {
+    if (!write_set_may_contain(tuple))
+      return write_set.end();
+    if (unlikely(write_set.size() > WriteSetIndexThreshold)) {
+      const flat_ptr_index::entry * const e = lookup_write_set_index(tuple);
+      return e ? write_set.begin() + e->first_ : write_set.end();
+    }
     // linear scan- returns the *first* entry found
     // (a tuple can exist in the write_set more than once)
     typename write_set_map::iterator it     = write_set.begin();
@@ -813,14 +1159,79 @@ protected:
     return const_cast<transaction *>(this)->find_write_set(tuple);
   }
 
+  // like find_write_set(), but returns the *latest* entry found
+  typename write_set_map::iterator
+  find_last_write_set(dbtuple *tuple)
+  {
+    if (!write_set_may_contain(tuple))
+      return write_set.end();
+    if (unlikely(write_set.size() > WriteSetIndexThreshold)) {
+      const flat_ptr_index::entry * const e = lookup_write_set_index(tuple);
+      return e ? write_set.begin() + e->last_ : write_set.end();
+    }
+    for (typename write_set_map::iterator it = write_set.end();
+         it != write_set.begin();) {
+      --it;
+      if (it->get_tuple() == tuple)
+        return it;
+    }
+    return write_set.end();
+  }
+
+  // absent sets longer than this are looked up through absent_set_index
+  static const size_t AbsentSetIndexThreshold = 16;
+
+  // folds the entries appended since the last call into absent_set_index,
+  // nulling out the node of each one whose node is already in the set.
+  // returns false if a duplicate was read at a different version
+  bool fold_absent_set();
+
   inline bool
   handle_last_tuple_in_group(
       dbtuple_write_info &info, bool did_group_insert);
 
   read_set_map read_set;
+  // reads validated by the values of the fields read, rather than by
+  // version (see field_read_t)
+  std::vector<field_read_record_t> field_read_set;
   write_set_map write_set;
   absent_set_map absent_set;
 
+  // built lazily, once the write set passes WriteSetIndexThreshold
+  flat_ptr_index write_set_index;
+  // a Bloom filter over the tuples of write_set[0, write_set_filter_npositions)
+  // (see write_set_may_contain())
+  uint64_t write_set_filter;
+  size_t write_set_filter_npositions;
+  // built lazily, once the absent set passes AbsentSetIndexThreshold and an
+  // insert needs to find a node in it
+  flat_ptr_index absent_set_index;
+
+  // hot records locked at read time, until the txn commits or aborts. an
+  // entry is nulled out when its lock is handed over to the write set
+  small_vector<dbtuple *, MaxHotLocks> hot_locks;
+
+  // partitions the txn holds the locks of, in partition order (see
+  // enter_partitions())
+  small_vector<unsigned> entered_partitions;
+
+  struct sampled_key {
+    const void *px_;
+    const concurrent_btree *btr_;
+    std::string key_;
+  };
+  const bool sampling_keys;
+  std::vector<sampled_key> sampled_keys;
+
+  // cleared by the protocol if a bounded staleness snapshot is too stale
+  bool snapshot;
+
+  // see park()
+  bool parked;
+
+  // the read set size to run early_validate() at, 0 for never
+  size_t next_early_validation;
+
   string_allocator_type *sa;
 
   unmanaged<scoped_rcu_region> rcu_guard_;
@@ -858,6 +1269,8 @@ struct txn_epoch_sync {
   // the last reset invocation?
   static inline std::pair<uint64_t, double>
     compute_ntxn_persisted() { return {0, 0.0}; }
+  // how many bytes have we logged, from the last reset invocation?
+  static inline uint64_t compute_nbytes_logged() { return 0; }
   // reset the persisted counters
   static inline void reset_ntxn_persisted() {}
 };
@@ -1,19 +1,34 @@
 #include <unistd.h>
+#include <fstream>
 #include <limits>
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <thread>
 
+#include "access_sampler.h"
+#include "contention_manager.h"
 #include "txn.h"
 #include "txn_proto2_impl.h"
 #include "txn_btree.h"
 #include "typed_txn_btree.h"
+#include "vertical_txn_btree.h"
+#include "sharded_txn_btree.h"
+#include "learned_txn_btree.h"
 #include "thread.h"
+#include "spinbarrier.h"
 #include "util.h"
 #include "macros.h"
 #include "tuple.h"
+#include "cold_store.h"
+#include "pinned_snapshot.h"
+#include "txn_ttl.h"
+#include "txn_checkpoint.h"
+#include "txn_recovery.h"
+#include "column_export.h"
 #include "record/encoder.h"
 #include "record/inline_str.h"
+#include "record/serializer.h"
 
 #include "scopedperf.hh"
 
@@ -130,10 +145,33 @@ test1()
       ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
       ALWAYS_ASSERT_COND_IN_TXN(t, !v.empty());
       AssertByteEquality(rec(0), v);
+      const uint8_t *px = nullptr;
+      size_t sz = 0;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search_view(t, u64_varkey(0), px, sz));
+      ALWAYS_ASSERT_COND_IN_TXN(t, sz == v.size() && !memcmp(px, v.data(), sz));
       AssertSuccessfulCommit(t);
       VERBOSE(cerr << "------" << endl);
     }
 
+    {
+      // a moved in value is taken over, not copied, so what the caller
+      // later does with the string does not change what is written
+      TxnType<Traits> t(txn_flags, arena);
+      const rec r0(0);
+      string v((const char *) &r0, sizeof(r0));
+      btr.put(t, u64_varkey(0).str(), std::move(v));
+      v.assign(sizeof(r0), 'x');
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+      AssertByteEquality(rec(0), v);
+      AssertSuccessfulCommit(t);
+    }
+
     {
       TxnType<Traits>
         t0(txn_flags, arena), t1(txn_flags, arena);
@@ -286,6 +324,110 @@ test_absent_key_race()
   }
 }
 
+#ifdef ENABLE_EVENT_COUNTERS
+static uint64_t
+EventCount(const string &name)
+{
+  counter_data d;
+  ALWAYS_ASSERT(event_counter::stat(name, d));
+  return d.count_;
+}
+#endif
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_single_key_commits()
+{
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  for (size_t i = 0; i < 2; i++) {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(i), rec(0));
+    AssertSuccessfulCommit(t);
+  }
+
+#ifdef ENABLE_EVENT_COUNTERS
+  const uint64_t nreads0 = EventCount("single_read_commits");
+  const uint64_t nwrites0 = EventCount("single_write_commits");
+#endif
+
+  {
+    // a single read commits without validation, even though its record
+    // has since been overwritten: it serializes before the writer
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v));
+    AssertByteEquality(rec(0), v);
+    btr.insert_object(t1, u64_varkey(0), rec(1));
+    AssertSuccessfulCommit(t1);
+    AssertSuccessfulCommit(t0);
+  }
+
+  {
+    // but two reads are validated
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(1), v));
+    btr.insert_object(t1, u64_varkey(0), rec(2));
+    AssertSuccessfulCommit(t1);
+    AssertFailedCommit(t0);
+  }
+
+  {
+    // a single blind write orders itself against a multi-key txn which
+    // read the record it overwrites
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v));
+    AssertByteEquality(rec(2), v);
+    btr.insert_object(t0, u64_varkey(1), rec(3));
+    btr.insert_object(t1, u64_varkey(0), rec(4));
+    AssertSuccessfulCommit(t1);
+    AssertFailedCommit(t0);
+  }
+
+  {
+    // and loses to a multi-key txn which overwrote it first
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(1), v));
+    btr.insert_object(t0, u64_varkey(0), rec(5));
+    AssertSuccessfulCommit(t0);
+    btr.insert_object(t1, u64_varkey(0), rec(6));
+    AssertSuccessfulCommit(t1);
+  }
+
+  {
+    // a single blind insert of a new key
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(2), rec(7));
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    TxnType<Traits> t(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+    AssertByteEquality(rec(6), v);
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+    AssertByteEquality(rec(0), v);
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(2), v));
+    AssertByteEquality(rec(7), v);
+    AssertSuccessfulCommit(t);
+  }
+
+#ifdef ENABLE_EVENT_COUNTERS
+  // t0 of the first case
+  ALWAYS_ASSERT(EventCount("single_read_commits") - nreads0 == 1);
+  // t1 of the first three cases, t1 of the fourth, and the insert
+  ALWAYS_ASSERT(EventCount("single_write_commits") - nwrites0 == 5);
+#endif
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
 template <template <typename> class TxnType, typename Traits>
 static void
 test_inc_value_size()
@@ -344,6 +486,77 @@ test_multi_btree()
   }
 }
 
+template <template <typename> class TxnType, typename Traits>
+static void
+test_sharded_btree()
+{
+  typedef sharded_txn_btree<TxnType> table_type;
+  table_type btr(4, 128, true, "sharded");
+  typename Traits::StringAllocator arena;
+  const size_t n = 1000;
+
+  auto check = [&btr, &arena, n]() {
+    TxnType<Traits> t(0, arena);
+    string v;
+    for (size_t i = 0; i < n; i++) {
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i).str(), v));
+      AssertByteEquality(rec(i), v);
+    }
+    // merged across shards, in key order
+    size_t next = 0;
+    auto scan = [&next](const typename table_type::keystring_type &k,
+                        const typename table_type::string_type &v) {
+      ALWAYS_ASSERT(std::string(k.data(), k.length()) == u64_varkey(next).str());
+      next++;
+      return true;
+    };
+    btr.search_range(t, u64_varkey(0).str(), nullptr, scan);
+    ALWAYS_ASSERT(next == n);
+    const string upper = u64_varkey(n / 2).str();
+    next = 10;
+    btr.search_range(t, u64_varkey(10).str(), &upper, scan);
+    ALWAYS_ASSERT(next == n / 2);
+    AssertSuccessfulCommit(t);
+  };
+
+  // sequential keys are striped over every shard
+  for (size_t i = 0; i < n; i++) {
+    TxnType<Traits> t(0, arena);
+    const rec r(i);
+    btr.insert(t, u64_varkey(i).str(), string((const char *) &r, sizeof(r)));
+    AssertSuccessfulCommit(t);
+  }
+  for (size_t i = 0; i < btr.nshards(); i++)
+    ALWAYS_ASSERT(btr.shard(i).size_estimate() > n / 8);
+  check();
+
+  // the first half to shard 0, the rest striped over shards 1 and 2
+  std::vector<typename table_type::range> ranges(2);
+  ranges[0].shards_ = {0};
+  ranges[1].lower_ = u64_varkey(n / 2).str();
+  ranges[1].shards_ = {1, 2};
+  btr.template resplit<Traits>(ranges);
+  check();
+  {
+    TxnType<Traits> t(0, arena);
+    size_t m = 0;
+    auto count = [&m](const typename table_type::keystring_type &,
+                      const typename table_type::string_type &) {
+      m++;
+      return true;
+    };
+    btr.shard(0).search_range(t, u64_varkey(0).str(), nullptr, count);
+    ALWAYS_ASSERT(m == n / 2);
+    m = 0;
+    btr.shard(3).search_range(t, u64_varkey(0).str(), nullptr, count);
+    ALWAYS_ASSERT(m == 0);
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
 template <template <typename> class TxnType, typename Traits>
 static void
 test_read_only_snapshot()
@@ -385,11 +598,262 @@ test_read_only_snapshot()
       AssertSuccessfulCommit(t1);
     }
 
+    {
+      // no snapshot is fresh enough for t2, so it reads the latest value
+      TxnType<Traits>
+        t2(txn_flags | transaction_base::BoundedStalenessFlags(0), arena),
+        t3(txn_flags | transaction_base::BoundedStalenessFlags(
+              (uint64_t(1) << (64 - transaction_base::StalenessShift)) - 1),
+           arena);
+      ALWAYS_ASSERT(!t2.is_snapshot());
+      ALWAYS_ASSERT(t3.is_snapshot());
+      string v2;
+      ALWAYS_ASSERT_COND_IN_TXN(t2, btr.search(t2, u64_varkey(0), v2));
+      AssertByteEquality(rec(1), v2);
+      AssertSuccessfulCommit(t2);
+      AssertSuccessfulCommit(t3);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+
+    {
+      // read-only by type: the snapshot is read whatever the flags say
+      typename read_only_transaction_traits::StringAllocator ro_arena;
+      TxnType<read_only_transaction_traits> t4(txn_flags, ro_arena);
+      ALWAYS_ASSERT(t4.is_snapshot() && t4.is_read_only());
+      string v4;
+      ALWAYS_ASSERT_COND_IN_TXN(t4, btr.search(t4, u64_varkey(0), v4));
+      AssertByteEquality(rec(1), v4);
+      AssertSuccessfulCommit(t4);
+
+      TxnType<read_only_transaction_traits> t5(txn_flags, ro_arena);
+      try {
+        btr.insert_object(t5, u64_varkey(1), rec(1));
+        ALWAYS_ASSERT(false);
+      } catch (transaction_abort_exception &e) {
+      }
+      AssertFailedCommit(t5);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_write_policy()
+{
+  typename Traits::StringAllocator arena;
+  for (auto policy : {transaction_base::WRITE_POLICY_IN_PLACE,
+                      transaction_base::WRITE_POLICY_ADAPTIVE}) {
+    txn_btree<TxnType> btr;
+    btr.set_write_policy(policy);
+
+    {
+      TxnType<Traits> t(0, arena);
+      btr.insert_object(t, u64_varkey(0), rec(0));
+      AssertSuccessfulCommit(t);
+    }
+    txn_epoch_sync<TxnType>::sync();
+
+    TxnType<Traits>
+      t0(0, arena),
+      t1(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v1;
+    ALWAYS_ASSERT_COND_IN_TXN(t1, btr.search(t1, u64_varkey(0), v1));
+    AssertByteEquality(rec(0), v1);
+
+    btr.insert_object(t0, u64_varkey(0), rec(1));
+    AssertSuccessfulCommit(t0);
+
+    // an adaptive table was just read by a snapshot, so it keeps the old
+    // version. an in-place table may have dropped it, in which case the
+    // snapshot read fails rather than see anything else
+    try {
+      ALWAYS_ASSERT_COND_IN_TXN(t1, btr.search(t1, u64_varkey(0), v1));
+      AssertByteEquality(rec(0), v1);
+      AssertSuccessfulCommit(t1);
+    } catch (transaction_abort_exception &e) {
+      ALWAYS_ASSERT(policy == transaction_base::WRITE_POLICY_IN_PLACE);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+  cerr << "test_write_policy() passed" << endl;
+}
+
+template <template <typename> class Protocol>
+class collecting_scan_callback : public txn_btree<Protocol>::search_range_callback {
+public:
+  virtual bool
+  invoke(const typename txn_btree<Protocol>::keystring_type &k, const string &v)
+  {
+    rows_.emplace_back(string(k.data(), k.length()), v);
+    return true;
+  }
+  vector<pair<string, string>> rows_;
+};
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_scan_node_set()
+{
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+    // enough leaves for the absent set to be folded through its index
+    const size_t nkeys = 2000;
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+    for (size_t i = 0; i < nkeys; i++) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(2 * i), rec(i));
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      // scanning twice puts every leaf in the set twice. inserting into the
+      // range bumps the leaf's version, and both copies have to agree
+      TxnType<Traits> t(txn_flags, arena);
+      for (size_t n = 0; n < 2; n++) {
+        collecting_scan_callback<TxnType> c;
+        btr.search_range_call(t, u64_varkey(0), nullptr, c);
+        ALWAYS_ASSERT_COND_IN_TXN(t, c.rows_.size() >= nkeys);
+        btr.insert_object(t, u64_varkey(2 * (nkeys / 2) + 1 - 2 * n), rec(n));
+      }
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      // a phantom in the scanned range
+      TxnType<Traits> t0(txn_flags, arena), t1(txn_flags, arena);
+      collecting_scan_callback<TxnType> c;
+      btr.search_range_call(t0, u64_varkey(0), nullptr, c);
+      btr.insert_object(t0, u64_varkey(1), rec(1));
+      btr.insert_object(t1, u64_varkey(2 * nkeys - 1), rec(1));
+      AssertSuccessfulCommit(t1);
+      AssertFailedCommit(t0);
+    }
+
     txn_epoch_sync<TxnType>::sync();
     txn_epoch_sync<TxnType>::finish();
   }
 }
 
+template <template <typename> class TxnType, typename Traits>
+static void
+test_early_validation()
+{
+  const size_t nkeys = 8;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    AssertSuccessfulCommit(t);
+  }
+
+  // validated at 4 reads, then at 8
+  transaction_base::g_early_validation_reads.store(4);
+  {
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    for (size_t i = 0; i < nkeys / 2; i++)
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(i), v));
+    btr.insert_object(t1, u64_varkey(0), rec(100));
+    AssertSuccessfulCommit(t1);
+    bool aborted = false;
+    try {
+      for (size_t i = nkeys / 2; i < nkeys; i++)
+        btr.search(t0, u64_varkey(i), v);
+    } catch (transaction_abort_exception &e) {
+      aborted = true;
+    }
+    ALWAYS_ASSERT(aborted);
+    ALWAYS_ASSERT(t0.get_abort_reason() ==
+                  transaction_base::ABORT_REASON_READ_NODE_INTEREFERENCE);
+  }
+  transaction_base::g_early_validation_reads.store(0);
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_bulk_load()
+{
+  const size_t nkeys = 1000;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+
+  // u64_varkeys are big endian, so these are sorted
+  vector<string> keys, values;
+  for (size_t i = 0; i < nkeys; i++) {
+    const rec r(i);
+    keys.push_back(u64_varkey(i).str());
+    values.emplace_back((const char *) &r, sizeof(r));
+  }
+  ALWAYS_ASSERT(btr.bulk_load(keys, values));
+
+  {
+    TxnType<Traits> t(0, arena);
+    for (size_t i = 0; i < nkeys; i++) {
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+      AssertByteEquality(rec(i), v);
+    }
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(nkeys), v));
+    AssertSuccessfulCommit(t);
+  }
+
+  // loaded records take regular writes
+  {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(0), rec(nkeys));
+    btr.insert_object(t, u64_varkey(nkeys), rec(nkeys));
+    AssertSuccessfulCommit(t);
+  }
+  {
+    TxnType<Traits> t(0, arena);
+    string v0, v1;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v0));
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(nkeys), v1));
+    AssertByteEquality(rec(nkeys), v0);
+    AssertByteEquality(rec(nkeys), v1);
+    AssertSuccessfulCommit(t);
+  }
+
+  // a snapshot which includes the writes above
+  txn_epoch_sync<TxnType>::sync();
+
+  // parallel scans see every row once, in order across the callbacks
+  for (uint64_t flags : {uint64_t(0), uint64_t(transaction_base::TXN_FLAG_READ_ONLY)}) {
+    TxnType<Traits> t(flags, arena);
+    vector<collecting_scan_callback<TxnType>> cs(4);
+    vector<typename txn_btree<TxnType>::search_range_callback *> cps;
+    for (auto &c : cs)
+      cps.push_back(&c);
+    btr.search_range_call_parallel(t, u64_varkey(0).str(), nullptr, cps);
+    size_t i = 0;
+    for (auto &c : cs)
+      for (auto &p : c.rows_) {
+        ALWAYS_ASSERT(p.first == u64_varkey(i).str());
+        AssertByteEquality(rec(i ? i : nkeys), p.second);
+        i++;
+      }
+    ALWAYS_ASSERT(i == nkeys + 1);
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
 namespace test_long_keys_ns {
 
 static inline string
@@ -530,163 +994,2323 @@ test_long_keys2()
       AssertSuccessfulCommit(t);
     }
 
-    {
-      TxnType<Traits> t(txn_flags, arena);
-      counting_scan_callback<TxnType> c(12345);
-      const varkey highkey(highkey_s);
-      btr.search_range_call(t, varkey(lowkey_s), &highkey, c);
-      AssertSuccessfulCommit(t);
-      ALWAYS_ASSERT_COND_IN_TXN(t, c.ctr == 1);
-    }
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      counting_scan_callback<TxnType> c(12345);
+      const varkey highkey(highkey_s);
+      btr.search_range_call(t, varkey(lowkey_s), &highkey, c);
+      AssertSuccessfulCommit(t);
+      ALWAYS_ASSERT_COND_IN_TXN(t, c.ctr == 1);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_insert_same_key()
+{
+  using namespace test_insert_same_key_ns;
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(0), rec0('a'));
+      btr.insert_object(t, u64_varkey(0), rec1('b'));
+      btr.insert_object(t, u64_varkey(0), rec2('c'));
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(0), rec3('d'));
+      btr.insert_object(t, u64_varkey(0), rec4('e'));
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_point_only()
+{
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+
+    // enough keys to double the hash index a few times
+    const size_t nkeys = 20000;
+    txn_btree<TxnType> btr(sizeof(rec), false, "<point_only>", true);
+    ALWAYS_ASSERT(btr.is_point_only());
+    typename Traits::StringAllocator arena;
+
+    for (size_t i = 0; i < nkeys; i++) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(i), rec(i));
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      for (size_t i = 0; i < nkeys; i++) {
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+        AssertByteEquality(rec(i), v);
+      }
+      ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(nkeys), v));
+      AssertSuccessfulCommit(t);
+    }
+
+    // an aborted insert leaves nothing behind
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(nkeys), rec(nkeys));
+      t.abort();
+    }
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(nkeys), v));
+      AssertSuccessfulCommit(t);
+    }
+
+    // a value which outgrows its tuple replaces the tuple, and a reader of
+    // the old tuple must not commit
+    {
+      const string big(1024, 'a');
+      TxnType<Traits> t0(txn_flags, arena), t1(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v));
+      btr.insert(t1, u64_varkey(0), (const uint8_t *) big.data(), big.size());
+      AssertSuccessfulCommit(t1);
+      btr.insert_object(t0, u64_varkey(1), rec(2));
+      AssertFailedCommit(t0);
+
+      TxnType<Traits> t2(txn_flags, arena);
+      ALWAYS_ASSERT_COND_IN_TXN(t2, btr.search(t2, u64_varkey(0), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t2, v == big);
+      AssertSuccessfulCommit(t2);
+    }
+
+    for (size_t i = 0; i < nkeys; i += 2) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.remove(t, u64_varkey(i));
+      AssertSuccessfulCommit(t);
+    }
+    txn_epoch_sync<TxnType>::sync();
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      for (size_t i = 0; i < nkeys; i++)
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v) == bool(i % 2));
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_learned_btree()
+{
+  const size_t nkeys = 20000;
+  learned_txn_btree<TxnType> btr(sizeof(rec), "<learned>");
+  {
+    vector<string> keys, values;
+    for (size_t i = 0; i < nkeys; i++) {
+      const rec r(i);
+      keys.push_back(u64_varkey(i).str());
+      values.emplace_back((const char *) &r, sizeof(r));
+    }
+    ALWAYS_ASSERT(btr.bulk_load(keys, values));
+  }
+  ALWAYS_ASSERT(btr.index_size() == nkeys);
+  typename Traits::StringAllocator arena;
+
+  {
+    TxnType<Traits> t(0, arena);
+    string v;
+    for (size_t i = 0; i < nkeys; i++) {
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+      AssertByteEquality(rec(i), v);
+    }
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(nkeys), v));
+    AssertSuccessfulCommit(t);
+  }
+
+  // a value which outgrows its tuple replaces the tuple in the index, and a
+  // reader of the old tuple must not commit
+  {
+    const string big(1024, 'a');
+    TxnType<Traits> t0(0, arena), t1(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v));
+    btr.insert(t1, u64_varkey(0), (const uint8_t *) big.data(), big.size());
+    AssertSuccessfulCommit(t1);
+    btr.insert_object(t0, u64_varkey(1), rec(2));
+    AssertFailedCommit(t0);
+
+    TxnType<Traits> t2(0, arena);
+    ALWAYS_ASSERT_COND_IN_TXN(t2, btr.search(t2, u64_varkey(0), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t2, v == big);
+    AssertSuccessfulCommit(t2);
+  }
+
+  // keys inserted since the build are found in the tree, as are keys
+  // removed and inserted again
+  for (size_t i = 0; i < nkeys; i += 2) {
+    TxnType<Traits> t(0, arena);
+    btr.remove(t, u64_varkey(i));
+    AssertSuccessfulCommit(t);
+  }
+  txn_epoch_sync<TxnType>::sync();
+  for (size_t i = 0; i < 100; i += 2) {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    btr.insert_object(t, u64_varkey(nkeys + i), rec(nkeys + i));
+    AssertSuccessfulCommit(t);
+  }
+  {
+    TxnType<Traits> t(0, arena);
+    string v;
+    for (size_t i = 0; i < nkeys + 100; i++) {
+      const bool present = i >= nkeys ? !(i % 2) : (i % 2 || i < 100);
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v) == present);
+      if (present)
+        AssertByteEquality(rec(i), v);
+    }
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_numa_home()
+{
+  // the last cpu's node, which is remote whenever the machine has several
+  const int node = ::allocator::CpuNode(coreid::num_cpus_online() - 1);
+  rcu::s_instance.pin_current_thread(0);
+
+  {
+    scoped_alloc_node home(node);
+    void * const p = rcu::s_instance.alloc(sizeof(rec));
+    ALWAYS_ASSERT(::allocator::ManagesPointer(p));
+    ALWAYS_ASSERT(::allocator::PointerToNode(p) == node);
+    rcu::s_instance.dealloc(p, sizeof(rec));
+  }
+
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+
+    const size_t nkeys = 1000;
+    txn_btree<TxnType> btr;
+    btr.set_numa_node(node);
+    typename Traits::StringAllocator arena;
+
+    for (size_t i = 0; i < nkeys; i++) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(i), rec(i));
+      AssertSuccessfulCommit(t);
+    }
+
+    // outgrows the tuples, so commit allocates them again
+    const string big(256, 'a');
+    for (size_t i = 0; i < nkeys; i += 2) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(i), (const uint8_t *) big.data(), big.size());
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      for (size_t i = 0; i < nkeys; i++) {
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+        if (i % 2)
+          AssertByteEquality(rec(i), v);
+        else
+          ALWAYS_ASSERT_COND_IN_TXN(t, v == big);
+      }
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_pack_group()
+{
+  static const size_t hugepgsize = ::allocator::GetHugepageSize();
+  rcu::s_instance.pin_current_thread(0);
+
+  {
+    scoped_alloc_pack_group pack(1);
+    void * const p = rcu::s_instance.alloc(sizeof(rec));
+    void * const q = rcu::s_instance.alloc(sizeof(rec));
+    ALWAYS_ASSERT(::allocator::PointerToPackGroup(p) == 1);
+    ALWAYS_ASSERT((uintptr_t(p) & ~(hugepgsize - 1)) ==
+                  (uintptr_t(q) & ~(hugepgsize - 1)));
+    rcu::s_instance.dealloc(q, sizeof(rec));
+    rcu::s_instance.dealloc(p, sizeof(rec));
+    // freed back to the group, not the shared pool
+    void * const r = rcu::s_instance.alloc(sizeof(rec));
+    ALWAYS_ASSERT(r == p);
+    rcu::s_instance.dealloc(r, sizeof(rec));
+  }
+  {
+    void * const p = rcu::s_instance.alloc(sizeof(rec));
+    ALWAYS_ASSERT(!::allocator::PointerToPackGroup(p));
+    rcu::s_instance.dealloc(p, sizeof(rec));
+  }
+
+  const size_t nkeys = 1000;
+  txn_btree<TxnType> btr;
+  btr.set_pack_group(2);
+  typename Traits::StringAllocator arena;
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    AssertSuccessfulCommit(t);
+  }
+  {
+    scoped_rcu_region guard;
+    for (size_t i = 0; i < nkeys; i++) {
+      typename concurrent_btree::value_type v = 0;
+      ALWAYS_ASSERT(btr.get_underlying_btree()->search(u64_varkey(i), v));
+      ALWAYS_ASSERT(::allocator::PointerToPackGroup((const void *) v) == 2);
+    }
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_gc_threads()
+{
+  if (!transaction_proto2_static::NumGCThreads())
+    transaction_proto2_static::StartGCThreads(1);
+
+  const size_t nkeys = 1000;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    AssertSuccessfulCommit(t);
+  }
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(0, arena);
+    btr.remove(t, u64_varkey(i));
+    AssertSuccessfulCommit(t);
+  }
+
+  // the worker no longer reaps its own delete queue: each txn hands what has
+  // become reapable to the gc thread, which unlinks the removed keys
+  auto nlinked = [&btr]() {
+    scoped_rcu_region guard;
+    size_t n = 0;
+    for (size_t i = 0; i < nkeys; i++) {
+      typename concurrent_btree::value_type v = 0;
+      if (btr.get_underlying_btree()->search(u64_varkey(i), v))
+        n++;
+    }
+    return n;
+  };
+  ALWAYS_ASSERT(nlinked() == nkeys);
+  const uint64_t t0 = util::timer::cur_usec();
+  while (nlinked()) {
+    ALWAYS_ASSERT(util::timer::cur_usec() - t0 < 30 * 1000000);
+    {
+      TxnType<Traits> t(0, arena);
+      AssertSuccessfulCommit(t);
+    }
+    ticker::WaitOutCurrentTick();
+  }
+
+  {
+    TxnType<Traits> t(0, arena);
+    string v;
+    for (size_t i = 0; i < nkeys; i++)
+      ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(i), v));
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_version_chain_bound()
+{
+  if (!transaction_proto2_static::NumGCThreads())
+    transaction_proto2_static::StartGCThreads(1);
+
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  {
+    TxnType<Traits> t(0, arena);
+    btr.insert_object(t, u64_varkey(0), rec(0));
+    AssertSuccessfulCommit(t);
+  }
+  // until snapshots see it
+  for (;;) {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    const bool found = btr.search(t, u64_varkey(0), v);
+    AssertSuccessfulCommit(t);
+    if (found)
+      break;
+    ticker::WaitOutCurrentTick();
+  }
+
+  // chains are cut right after their head, so once key 0 is overwritten
+  // past this snapshot, the snapshot can no longer get to rec(0)
+  transaction_proto2_static::SetMaxVersionChainLength(1);
+  {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    // from another core, as this one holds the tick back: the write is
+    // always in a later read only epoch than the snapshot, so it spills
+    std::thread writer([&btr]() {
+      typename Traits::StringAllocator warena;
+      TxnType<Traits> t(0, warena);
+      btr.insert_object(t, u64_varkey(0), rec(1));
+      AssertSuccessfulCommit(t);
+    });
+    writer.join();
+    bool aborted = false;
+    try {
+      string v;
+      btr.search(t, u64_varkey(0), v);
+    } catch (transaction_abort_exception &e) {
+      aborted = true;
+    }
+    ALWAYS_ASSERT(aborted);
+    ALWAYS_ASSERT(t.get_abort_reason() ==
+                  transaction_base::ABORT_REASON_UNSTABLE_READ);
+  }
+  transaction_proto2_static::SetMaxVersionChainLength(0);
+
+  {
+    TxnType<Traits> t(0, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+    AssertByteEquality(rec(1), v);
+    btr.remove(t, u64_varkey(0));
+    AssertSuccessfulCommit(t);
+  }
+
+  // the cut chain is still reaped
+  auto linked = [&btr]() {
+    scoped_rcu_region guard;
+    typename concurrent_btree::value_type v = 0;
+    return btr.get_underlying_btree()->search(u64_varkey(0), v);
+  };
+  const uint64_t t0 = util::timer::cur_usec();
+  while (linked()) {
+    ALWAYS_ASSERT(util::timer::cur_usec() - t0 < 30 * 1000000);
+    {
+      TxnType<Traits> t(0, arena);
+      AssertSuccessfulCommit(t);
+    }
+    ticker::WaitOutCurrentTick();
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_large_write_set()
+{
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+
+    // enough writes for the txn to index its write set
+    const size_t nkeys = 1000;
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      for (size_t i = 0; i < nkeys; i++)
+        btr.insert_object(t, u64_varkey(i), rec(i));
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      for (size_t i = 0; i < nkeys; i++) {
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+        AssertByteEquality(rec(i), v);
+        btr.insert_object(t, u64_varkey(i), rec(i + 1));
+      }
+      // each read is of our own write now
+      for (size_t i = 0; i < nkeys; i++) {
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+        AssertByteEquality(rec(i + 1), v);
+      }
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      for (size_t i = 0; i < nkeys; i++) {
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+        AssertByteEquality(rec(i + 1), v);
+      }
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_txn_reset()
+{
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert_object(t, u64_varkey(0), rec(0));
+      AssertSuccessfulCommit(t);
+    }
+
+    {
+      TxnType<Traits> t0(txn_flags, arena), t1(txn_flags, arena);
+      string v0, v1;
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v0));
+      AssertByteEquality(rec(0), v0);
+      btr.insert_object(t0, u64_varkey(0), rec(1));
+
+      ALWAYS_ASSERT_COND_IN_TXN(t1, btr.search(t1, u64_varkey(0), v1));
+      btr.insert_object(t1, u64_varkey(0), rec(2));
+      AssertSuccessfulCommit(t1);
+
+      AssertFailedCommit(t0);
+      ALWAYS_ASSERT(t0.get_abort_reason() != transaction_base::ABORT_REASON_NONE);
+
+      // the retry starts over, and sees t1's write
+      t0.park();
+      ALWAYS_ASSERT(t0.is_parked());
+      t0.reset();
+      ALWAYS_ASSERT(!t0.is_parked());
+      ALWAYS_ASSERT(t0.get_abort_reason() == transaction_base::ABORT_REASON_NONE);
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v0));
+      AssertByteEquality(rec(2), v0);
+      btr.insert_object(t0, u64_varkey(0), rec(3));
+      AssertSuccessfulCommit(t0);
+
+      // parked txns are destroyed without their RCU region
+      t1.park();
+    }
+
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+      AssertByteEquality(rec(3), v);
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_access_heatmap()
+{
+  access_sampler::Enable(1);
+  {
+    txn_btree<TxnType> btr(128, false, "access_heatmap");
+    typename Traits::StringAllocator arena;
+
+    for (size_t i = 0; i < 100; i++) {
+      TxnType<Traits> t(0, arena);
+      btr.insert_object(t, u64_varkey(i), rec(i));
+      AssertSuccessfulCommit(t);
+    }
+    {
+      TxnType<Traits> t(0, arena);
+      string v;
+      for (size_t i = 0; i < 50; i++)
+        ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(i), v));
+      AssertSuccessfulCommit(t);
+    }
+    {
+      // t0 aborts on key 0
+      TxnType<Traits> t0(0, arena), t1(0, arena);
+      string v0, v1;
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, u64_varkey(0), v0));
+      btr.insert_object(t0, u64_varkey(0), rec(1));
+      ALWAYS_ASSERT_COND_IN_TXN(t1, btr.search(t1, u64_varkey(0), v1));
+      btr.insert_object(t1, u64_varkey(0), rec(2));
+      AssertSuccessfulCommit(t1);
+      AssertFailedCommit(t0);
+    }
+
+    bool found = false;
+    for (auto &h : access_sampler::Heatmap(0)) {
+      if (h.table_ != "access_heatmap")
+        continue;
+      found = true;
+      // t0's accesses count too, though it aborted
+      ALWAYS_ASSERT(h.nwrites_ == 102);
+      ALWAYS_ASSERT(h.nreads_ == 52);
+      ALWAYS_ASSERT(h.nconflicts_ == 1);
+      // keys [0, 100) in 32 ranges of 4
+      ALWAYS_ASSERT(h.buckets_.size() == 25);
+      ALWAYS_ASSERT(h.buckets_[0].lo_ == 0 && h.buckets_[0].hi_ == 3);
+      ALWAYS_ASSERT(h.buckets_[0].nwrites_ == 6);
+      ALWAYS_ASSERT(h.buckets_[0].nreads_ == 6);
+      ALWAYS_ASSERT(h.buckets_[0].nconflicts_ == 1);
+      ALWAYS_ASSERT(h.buckets_[24].lo_ == 96 && h.buckets_[24].hi_ == 99);
+      ALWAYS_ASSERT(h.buckets_[24].nreads_ == 0);
+    }
+    ALWAYS_ASSERT(found);
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+  access_sampler::Enable(0);
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_pinned_snapshot()
+{
+  const uint64_t txn_flags = 0;
+  const size_t nkeys = 10;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  const string val0(100, 'a'), val1(100, 'b');
+
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(txn_flags, arena);
+    btr.insert(t, u64_varkey(i), (const uint8_t *) val0.data(), val0.size());
+    AssertSuccessfulCommit(t);
+  }
+
+  pinned_snapshot snap({btr.get_underlying_btree()});
+  pinned_snapshot tiny({btr.get_underlying_btree()}, 1);
+  ALWAYS_ASSERT(!snap.expired());
+  ALWAYS_ASSERT(!tiny.expired());
+
+  // overwrite key 1, remove key 2 and insert key nkeys past the snapshot.
+  // the removal is GC-ed out of the tree once the epochs move on
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    btr.insert(t, u64_varkey(1), (const uint8_t *) val1.data(), val1.size());
+    btr.remove(t, u64_varkey(2));
+    btr.insert(t, u64_varkey(nkeys), (const uint8_t *) val1.data(), val1.size());
+    AssertSuccessfulCommit(t);
+  }
+  txn_epoch_sync<TxnType>::sync();
+
+  // one before-image is past the budget
+  ALWAYS_ASSERT(tiny.expired());
+  string v;
+  bool found;
+  ALWAYS_ASSERT(!tiny.get(btr.get_underlying_btree(), u64_varkey(0).str(), v, found));
+
+  for (size_t i = 0; i <= nkeys; i++) {
+    ALWAYS_ASSERT(snap.get(btr.get_underlying_btree(), u64_varkey(i).str(), v, found));
+    ALWAYS_ASSERT(found == (i < nkeys));
+    ALWAYS_ASSERT(!found || v == val0);
+  }
+  size_t n = 0;
+  ALWAYS_ASSERT(snap.scan(btr.get_underlying_btree(), "", nullptr,
+        [&n, &val0](const string &k, const string &v) {
+          ALWAYS_ASSERT(k == u64_varkey(n).str());
+          ALWAYS_ASSERT(v == val0);
+          n++;
+          return true;
+        }));
+  ALWAYS_ASSERT(n == nkeys);
+  ALWAYS_ASSERT(snap.retained_bytes() > 0);
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_standby_read_tid()
+{
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  const string val0(10, 'a'), val1(10, 'b');
+
+  {
+    TxnType<Traits> t(0, arena);
+    btr.insert(t, u64_varkey(0), (const uint8_t *) val0.data(), val0.size());
+    AssertSuccessfulCommit(t);
+  }
+  txn_epoch_sync<TxnType>::sync();
+
+  // read-only txns stay at a pinned snapshot, as on a standby which has
+  // applied the primary up to it (see txn_log_follower)
+  uint64_t tid;
+  {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    tid = t.snapshot_tid();
+    transaction_proto2_static::PinSnapshot(tid);
+    AssertSuccessfulCommit(t);
+  }
+  transaction_proto2_static::SetStandbyReadTid(tid);
+  {
+    TxnType<Traits> t(0, arena);
+    btr.insert(t, u64_varkey(0), (const uint8_t *) val1.data(), val1.size());
+    AssertSuccessfulCommit(t);
+  }
+  txn_epoch_sync<TxnType>::sync();
+  {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, t.snapshot_tid() == tid);
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v == val0);
+    AssertSuccessfulCommit(t);
+  }
+
+  transaction_proto2_static::SetStandbyReadTid(0);
+  {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v == val1);
+    AssertSuccessfulCommit(t);
+  }
+  transaction_proto2_static::UnpinSnapshot(tid);
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_standby_read_tid() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_admission_control()
+{
+  txn_btree<TxnType> btr;
+  const string val(10, 'a');
+
+  // nothing is logged, so the persistent epoch stays behind the current
+  // one. once it is g_max_lag_epochs behind, every read-write txn waits out
+  // a whole tick (short ones, for the test)
+  const uint64_t tick_us = ticker::TickUsec();
+  ticker::SetTickUsec(1000);
+  txn_logger::SetAdmissionLagEpochs(txn_logger::g_max_lag_epochs - 1);
+  while (ticker::s_instance.global_current_tick() <= txn_logger::g_max_lag_epochs)
+    this_thread::sleep_for(chrono::milliseconds(1));
+  ALWAYS_ASSERT(txn_logger::AdmissionDelayUsec() == ticker::TickUsec());
+
+  atomic<bool> stop(false);
+  atomic<size_t> ntxns(0);
+  thread worker([&]() {
+    typename Traits::StringAllocator arena;
+    while (!stop.load()) {
+      txn_logger::Admit(0);
+      TxnType<Traits> t(0, arena);
+      btr.insert(t, u64_varkey(ntxns.load()),
+                 (const uint8_t *) val.data(), val.size());
+      AssertSuccessfulCommit(t);
+      ++ntxns;
+    }
+  });
+
+  // the worker is waiting nearly all of the time, and the epoch goes on
+  // advancing meanwhile
+  const size_t nticks = 20;
+  const uint64_t tick0 = ticker::s_instance.global_current_tick();
+  const uint64_t t0 = timer::cur_usec();
+  this_thread::sleep_for(chrono::microseconds(nticks * ticker::TickUsec()));
+  const uint64_t tick1 = ticker::s_instance.global_current_tick();
+  stop.store(true);
+  worker.join();
+  const uint64_t elapsed_us = timer::cur_usec() - t0;
+  ALWAYS_ASSERT(tick1 - tick0 >= nticks / 2);
+  ALWAYS_ASSERT(ntxns.load() >= 1);
+  ALWAYS_ASSERT(ntxns.load() <= elapsed_us / ticker::TickUsec() + 1);
+
+  // read-only txns are never held back
+  {
+    const uint64_t t = timer::cur_usec();
+    txn_logger::Admit(transaction_base::TXN_FLAG_READ_ONLY);
+    ALWAYS_ASSERT(timer::cur_usec() - t < ticker::TickUsec());
+  }
+  txn_logger::SetAdmissionLagEpochs(0);
+  ticker::SetTickUsec(tick_us);
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_admission_control() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_ttl()
+{
+  txn_ttl::Init(0);
+  const uint64_t txn_flags = 0;
+  const size_t nkeys = 100;
+  txn_btree<TxnType> btr;
+  btr.set_ttl(1000);
+  typename Traits::StringAllocator arena;
+
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(txn_flags, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    AssertSuccessfulCommit(t);
+  }
+
+  // a pass samples a tick past the inserts, and the next one (a TTL later)
+  // expires them
+  const uint64_t tick = ticker::s_instance.global_current_tick();
+  while (ticker::s_instance.global_current_tick() == tick)
+    nop_pause();
+  ALWAYS_ASSERT(txn_ttl::Reap() == 0);
+  usleep(2000);
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    btr.insert_object(t, u64_varkey(nkeys), rec(nkeys));
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(txn_ttl::Reap() == nkeys);
+  {
+    scoped_rcu_region guard;
+    ALWAYS_ASSERT(txn_ttl::CutoffFor(btr.get_underlying_btree(), "", 0));
+  }
+
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(0), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(nkeys), v));
+    AssertByteEquality(rec(nkeys), v);
+    size_t ctr = 0;
+    test_callback_ctr cb(&ctr);
+    btr.search_range(t, u64_varkey(0), nullptr, cb);
+    ALWAYS_ASSERT_COND_IN_TXN(t, ctr == 1);
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_range_delete()
+{
+  if (!txn_ttl::IsInitialized())
+    txn_ttl::Init(0);
+  const uint64_t txn_flags = 0;
+  const size_t nkeys = 100;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+
+  for (size_t i = 0; i < nkeys; i++) {
+    TxnType<Traits> t(txn_flags, arena);
+    btr.insert_object(t, u64_varkey(i), rec(i));
+    AssertSuccessfulCommit(t);
+  }
+
+  const string lower = u64_varkey(10).str(), upper = u64_varkey(20).str();
+  btr.delete_range(lower, &upper);
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(9), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(10), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(19), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(20), v));
+    // written after the delete, so not covered by it
+    btr.insert_object(t, u64_varkey(15), rec(15));
+    AssertSuccessfulCommit(t);
+  }
+
+  // a pass expires the range's rows, and the next finds none left and drops
+  // the range
+  ALWAYS_ASSERT(txn_ttl::Reap() == 9);
+  ALWAYS_ASSERT(txn_ttl::Reap() == 0);
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    size_t ctr = 0;
+    test_callback_ctr cb(&ctr);
+    btr.search_range(t, u64_varkey(0), nullptr, cb);
+    ALWAYS_ASSERT_COND_IN_TXN(t, ctr == nkeys - 9);
+    AssertSuccessfulCommit(t);
+  }
+
+  btr.truncate();
+  {
+    TxnType<Traits> t(txn_flags, arena);
+    size_t ctr = 0;
+    test_callback_ctr cb(&ctr);
+    btr.search_range(t, u64_varkey(0), nullptr, cb);
+    ALWAYS_ASSERT_COND_IN_TXN(t, ctr == 0);
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(txn_ttl::Reap() == nkeys - 9);
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+// appends a txn of (table, key, value) writes in the log's layout
+static void
+append_logged_txn(string &buf, txn_logger::txn_encoder &enc, uint64_t tid,
+                  const vector<tuple<uint32_t, string, string>> &writes)
+{
+  serializer<uint32_t, true> vs_uint32_t;
+  uint8_t tmp[64];
+  buf.append((const char *) tmp, enc.write_txn(tmp, tid, writes.size()) - tmp);
+  for (auto &w : writes) {
+    INVARIANT(get<1>(w).size() < 32);
+    uint8_t *p = enc.write_key(tmp, get<0>(w),
+        (const uint8_t *) get<1>(w).data(), get<1>(w).size());
+    p = vs_uint32_t.write(p, get<2>(w).size());
+    buf.append((const char *) tmp, p - tmp);
+    buf.append(get<2>(w));
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_coalesce_writes()
+{
+  txn_btree<TxnType> whole(128, false, "coalesce_whole");
+  txn_btree<TxnType> typed(128, false, "coalesce_typed");
+  txn_logger::SetTableFieldsMask(typed.get_underlying_btree(), 0x3);
+  const uint32_t whole_id = txn_logger::TableIdFromName("coalesce_whole");
+  const uint32_t typed_id = txn_logger::TableIdFromName("coalesce_typed");
+  auto delta = [](uint64_t fields, const string &v) {
+    return string((const char *) &fields, sizeof(fields)) + v;
+  };
+
+  for (int compact = 0; compact < 2; compact++) {
+    // the first txn's writes are replaced by the second's, a removal and a
+    // whole record. the delta on top of the whole record stays
+    string buf;
+    txn_logger::txn_encoder enc(compact, 0);
+    append_logged_txn(buf, enc, 10,
+        {make_tuple(whole_id, string("key0"), string("x")),
+         make_tuple(typed_id, string("key1"), delta(0x1, "d"))});
+    append_logged_txn(buf, enc, 11,
+        {make_tuple(whole_id, string("key0"), string()),
+         make_tuple(whole_id, string("key00"), string("y")),
+         make_tuple(typed_id, string("key1"), delta(0x3, "de"))});
+    append_logged_txn(buf, enc, 12,
+        {make_tuple(typed_id, string("key1"), delta(0x2, "e"))});
+
+    string expected;
+    txn_logger::txn_encoder expected_enc(compact, 0);
+    append_logged_txn(expected, expected_enc, 10, {});
+    append_logged_txn(expected, expected_enc, 11,
+        {make_tuple(whole_id, string("key0"), string()),
+         make_tuple(whole_id, string("key00"), string("y")),
+         make_tuple(typed_id, string("key1"), delta(0x3, "de"))});
+    append_logged_txn(expected, expected_enc, 12,
+        {make_tuple(typed_id, string("key1"), delta(0x2, "e"))});
+
+    const size_t n =
+      txn_logger::CoalesceWrites((uint8_t *) &buf[0], buf.size(), compact);
+    ALWAYS_ASSERT(n == expected.size());
+    ALWAYS_ASSERT(buf.compare(0, n, expected) == 0);
+
+    // nothing to drop
+    const size_t m =
+      txn_logger::CoalesceWrites((uint8_t *) &buf[0], n, compact);
+    ALWAYS_ASSERT(m == n);
+    ALWAYS_ASSERT(buf.compare(0, m, expected) == 0);
+
+    // and the keys (and tids) decode back, prefixes and all
+    txn_logger::txn_decoder dec(compact);
+    serializer<uint32_t, true> vs_uint32_t;
+    const uint8_t *p = (const uint8_t *) expected.data();
+    const uint8_t * const end = p + expected.size();
+    vector<string> keys;
+    for (uint64_t tid = 10; tid <= 12; tid++) {
+      uint64_t tid0;
+      uint32_t nwrites;
+      p = dec.read_txn(p, end, tid0, nwrites);
+      ALWAYS_ASSERT(p && tid0 == tid);
+      for (uint32_t i = 0; i < nwrites; i++) {
+        uint32_t table_id, klen, vlen;
+        const uint8_t *k;
+        p = dec.read_key(p, end, table_id, k, klen);
+        ALWAYS_ASSERT(p);
+        keys.emplace_back((const char *) k, klen);
+        p = vs_uint32_t.read(p, &vlen) + vlen;
+      }
+    }
+    ALWAYS_ASSERT(p == end);
+    ALWAYS_ASSERT(keys == vector<string>({"key0", "key00", "key1", "key1"}));
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+}
+
+// a fresh directory under /tmp, for tests which write files
+static string
+MakeTestDir(const string &name)
+{
+  string tmpl = "/tmp/silo_test_" + name + ".XXXXXX";
+  ALWAYS_ASSERT(mkdtemp(&tmpl[0]));
+  return tmpl;
+}
+
+static void
+RemoveTestDir(const string &dir)
+{
+  const string cmd = "rm -rf " + dir;
+  int ret UNUSED = system(cmd.c_str());
+}
+
+typedef vector<tuple<uint32_t, string, string>> logged_writes;
+
+// appends a log buffer of (tid, writes) txns to log, laid out as a logger
+// writes it out, compact encoding and all
+static void
+append_log_buffer(string &log, bool compact,
+                  const vector<pair<uint64_t, logged_writes>> &txns)
+{
+  INVARIANT(!txns.empty());
+  string data;
+  txn_logger::txn_encoder enc(compact, 0);
+  for (auto &t : txns)
+    append_logged_txn(data, enc, t.first, t.second);
+  txn_logger::logbuf_header hdr;
+  hdr.nentries_ = txns.size() | (compact ? txn_logger::CompactBufferBit : 0);
+  hdr.last_tid_ = txns.back().first;
+  hdr.crc_ = txn_logger::BufferChecksum(
+      hdr, (const uint8_t *) data.data(), data.size());
+  log.append((const char *) &hdr, sizeof(hdr));
+  log.append(data);
+}
+
+// appends log to logfile, then replaces its persistent epoch file (whole, so
+// that a follower reading along never sees a torn one)
+static void
+write_test_log(const string &logfile, const string &log, uint64_t pepoch)
+{
+  ofstream(logfile, ios::binary | ios::app).write(log.data(), log.size());
+  const string pepoch_file = logfile + txn_logger::g_pepoch_suffix;
+  ofstream(pepoch_file + ".tmp", ios::binary)
+    .write((const char *) &pepoch, sizeof(pepoch));
+  ALWAYS_ASSERT(!rename((pepoch_file + ".tmp").c_str(), pepoch_file.c_str()));
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_log_format_detection()
+{
+  typedef txn_log_replayer::table_type table_type;
+  const string dir = MakeTestDir("log_format");
+  const string logfile = dir + "/log";
+  typename Traits::StringAllocator arena;
+  {
+    table_type btr(128, false, "logfmt_test");
+    const uint32_t id = txn_logger::TableIdFromName("logfmt_test");
+    auto key = [](uint64_t k) { return u64_varkey(k).str(); };
+
+    // a compact buffer, then one which is not: each is decoded as marked
+    string log;
+    append_log_buffer(log, true,
+        {{transaction_proto2_static::MakeTid(0, 1, 1),
+          {make_tuple(id, key(0), string("a0")),
+           make_tuple(id, key(1), string("a1"))}},
+         {transaction_proto2_static::MakeTid(0, 2, 1),
+          {make_tuple(id, key(2), string("a2"))}}});
+    append_log_buffer(log, false,
+        {{transaction_proto2_static::MakeTid(0, 3, 2),
+          {make_tuple(id, key(0), string("b0"))}}});
+    write_test_log(logfile, log, 2);
+
+    const txn_log_replayer::replay_stats stats =
+      txn_log_replayer::Replay({logfile}, "", {{"logfmt_test", &btr}}, 1, false);
+    ALWAYS_ASSERT(stats.nbuffers_ == 2);
+    ALWAYS_ASSERT(stats.ntxns_ == 3);
+    ALWAYS_ASSERT(!stats.nfiles_truncated_);
+
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v) && v == "b0");
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v) && v == "a1");
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(2), v) && v == "a2");
+    AssertSuccessfulCommit(t);
+  }
+  RemoveTestDir(dir);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_log_format_detection() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_log_no_pepoch()
+{
+  typedef txn_log_replayer::table_type table_type;
+  const string dir = MakeTestDir("log_no_pepoch");
+  typename Traits::StringAllocator arena;
+  const uint32_t id = txn_logger::TableIdFromName("nopepoch_test");
+  auto key = [](uint64_t k) { return u64_varkey(k).str(); };
+  auto buffer = [&](uint64_t core, uint64_t num, uint64_t epoch, uint64_t k) {
+    string log;
+    append_log_buffer(log, false,
+        {{transaction_proto2_static::MakeTid(core, num, epoch),
+          {make_tuple(id, key(k), string("v"))}}});
+    return log;
+  };
+
+  // replays log, which has no persistent epoch file: only the epochs every
+  // core has moved past are replayed. returns the # of buffers skipped
+  auto replay = [&](const string &name, const string &log, bool replayed) {
+    const string logfile = dir + "/" + name;
+    ofstream(logfile, ios::binary).write(log.data(), log.size());
+    table_type btr(128, false, "nopepoch_test");
+    const txn_log_replayer::replay_stats stats =
+      txn_log_replayer::Replay({logfile}, "", {{"nopepoch_test", &btr}}, 1, false);
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v) == replayed);
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(2), v));
+    AssertSuccessfulCommit(t);
+    return stats.nbuffers_skipped_;
+  };
+
+  // core 0 has completed epoch 0 (and core 1 epoch 1)
+  ALWAYS_ASSERT(replay("complete",
+        buffer(0, 1, 0, 0) + buffer(0, 2, 1, 2) +
+        buffer(1, 1, 1, 1) + buffer(1, 2, 2, 3), true) == 3);
+
+  // core 1 has only been seen in epoch 0, so no epoch is complete, not even
+  // epoch 0
+  ALWAYS_ASSERT(replay("epoch0_only",
+        buffer(0, 1, 0, 0) + buffer(0, 2, 1, 2) + buffer(1, 1, 0, 1),
+        false) == 3);
+
+  RemoveTestDir(dir);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_log_no_pepoch() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_log_corruption()
+{
+  typedef txn_log_replayer::table_type table_type;
+  const string dir = MakeTestDir("log_corruption");
+  typename Traits::StringAllocator arena;
+  const uint32_t id = txn_logger::TableIdFromName("logcorrupt_test");
+  auto key = [](uint64_t k) { return u64_varkey(k).str(); };
+  auto buffer = [&](uint64_t num, uint64_t epoch, uint64_t k, const string &v) {
+    string log;
+    append_log_buffer(log, true,
+        {{transaction_proto2_static::MakeTid(0, num, epoch),
+          {make_tuple(id, key(k), v)}}});
+    return log;
+  };
+  const string b1 = buffer(1, 1, 0, "a0") + buffer(2, 1, 1, "a1");
+  const string b2 = buffer(3, 2, 0, "b0");
+  const string b3 = buffer(4, 3, 2, "c2");
+
+  // replays log (with every buffer persistent), expecting only the first
+  // nvalid buffers back
+  auto replay = [&](const string &name, const string &log, size_t nvalid) {
+    const string logfile = dir + "/" + name;
+    write_test_log(logfile, log, 3);
+    table_type btr(128, false, "logcorrupt_test");
+    const txn_log_replayer::replay_stats stats =
+      txn_log_replayer::Replay({logfile}, "", {{"logcorrupt_test", &btr}}, 1, false);
+    ALWAYS_ASSERT(stats.nbuffers_ == nvalid);
+    ALWAYS_ASSERT(stats.nfiles_truncated_ == 1);
+
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v) && v == "a0");
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v) && v == "a1");
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, u64_varkey(2), v));
+    AssertSuccessfulCommit(t);
+  };
+
+  // a flipped byte in the second buffer's value: it decodes, but fails its
+  // checksum, so it and the (valid) buffer after it are dropped
+  string log = b1 + b2 + b3;
+  log[b1.size() + b2.size() - 1] ^= 0xff;
+  replay("flipped_value", log, 2);
+
+  // a flipped byte in its header's entry count
+  log = b1 + b2 + b3;
+  log[b1.size() + offsetof(txn_logger::logbuf_header, nentries_)] ^= 0x2;
+  replay("flipped_header", log, 2);
+
+  // a torn last buffer
+  log = b1 + b2.substr(0, b2.size() - 1);
+  replay("torn", log, 2);
+
+  RemoveTestDir(dir);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_log_corruption() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_log_follower()
+{
+  typedef txn_log_replayer::table_type table_type;
+  const string dir = MakeTestDir("log_follower");
+  const string logfile = dir + "/log";
+  typename Traits::StringAllocator arena;
+  {
+    table_type btr(128, false, "follow_test");
+    txn_log_replayer::string_table_handler h(&btr);
+    const uint32_t id = txn_logger::TableIdFromName("follow_test");
+    auto key = [](uint64_t k) { return u64_varkey(k).str(); };
+    auto buffer = [&](uint64_t num, uint64_t epoch, uint64_t k, const string &v) {
+      string log;
+      append_log_buffer(log, false,
+          {{transaction_proto2_static::MakeTid(0, num, epoch),
+            {make_tuple(id, key(k), v)}}});
+      return log;
+    };
+    // reads at the follower's snapshot
+    auto lookup = [&](uint64_t k, string &v) {
+      TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+      const bool found = btr.search(t, u64_varkey(k), v);
+      AssertSuccessfulCommit(t);
+      return found;
+    };
+    string v;
+
+    // epochs 1 and 2 are persistent, epoch 3 is logged but not yet
+    write_test_log(logfile,
+        buffer(1, 1, 0, "a0") + buffer(2, 1, 1, "a1") +
+        buffer(3, 2, 0, "b0") + buffer(4, 3, 2, "c2"), 2);
+    txn_log_follower f({logfile}, {{"follow_test", &h}}, false, 0, 100);
+    f.wait_for_epoch(2);
+    ALWAYS_ASSERT(f.applied_epoch() == 2);
+    ALWAYS_ASSERT(lookup(0, v) && v == "b0");
+    ALWAYS_ASSERT(lookup(1, v) && v == "a1");
+    ALWAYS_ASSERT(!lookup(2, v));
+
+    // the front of an epoch 4 buffer: the follower waits for the rest
+    const string b4 = buffer(5, 4, 1, "d1");
+    const size_t half = b4.size() / 2;
+    write_test_log(logfile, b4.substr(0, half), 3);
+    f.wait_for_epoch(3);
+    ALWAYS_ASSERT(lookup(2, v) && v == "c2");
+    ALWAYS_ASSERT(lookup(1, v) && v == "a1");
+
+    write_test_log(logfile, b4.substr(half), 4);
+    f.wait_for_epoch(4);
+    ALWAYS_ASSERT(f.applied_epoch() == 4);
+    ALWAYS_ASSERT(lookup(1, v) && v == "d1");
+  }
+  RemoveTestDir(dir);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_log_follower() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_checkpoint_deltas()
+{
+  typedef txn_checkpointer::table_type table_type;
+  const string dir = MakeTestDir("checkpoint_deltas");
+  const string val(10, 'a');
+  typename Traits::StringAllocator arena;
+  const size_t nkeys = 10;
+
+  unique_ptr<table_type> a(new table_type(128, false, "ckp_test_a"));
+  unique_ptr<table_type> b(new table_type(128, false, "ckp_test_b"));
+  auto put = [&](table_type &btr, uint64_t k) {
+    TxnType<Traits> t(0, arena);
+    btr.insert(t, u64_varkey(k), (const uint8_t *) val.data(), val.size());
+    AssertSuccessfulCommit(t);
+  };
+  auto remove = [&](table_type &btr, uint64_t k) {
+    TxnType<Traits> t(0, arena);
+    btr.remove(t, u64_varkey(k));
+    AssertSuccessfulCommit(t);
+  };
+  for (size_t i = 0; i < nkeys; i++) {
+    put(*a, i);
+    put(*b, i);
+  }
+  txn_epoch_sync<TxnType>::sync();
+
+  {
+    // never checkpoints on its own
+    txn_checkpointer ckp(dir, {{"ckp_test_a", a.get()}, {"ckp_test_b", b.get()}},
+                         1 << 30, 0, false, 2);
+    ALWAYS_ASSERT(ckp.checkpoint_once());
+    ALWAYS_ASSERT(!ckp.ndeltas());
+
+    // removed from the trees by GC (and so journaled) or not, deletes go
+    // into the deltas
+    remove(*a, 0);
+    remove(*b, 0);
+    put(*a, nkeys);
+    txn_epoch_sync<TxnType>::sync();
+    remove(*a, 1);
+    ALWAYS_ASSERT(ckp.checkpoint_once());
+    ALWAYS_ASSERT(ckp.ndeltas() == 1);
+    txn_checkpointer::manifest m;
+    ALWAYS_ASSERT(txn_checkpointer::ReadManifest(dir, m));
+    ALWAYS_ASSERT(m.deltas_.size() == 1);
+
+    // the second delta is merged into a new full checkpoint
+    remove(*a, 2);
+    txn_epoch_sync<TxnType>::sync();
+    ALWAYS_ASSERT(ckp.checkpoint_once());
+    ALWAYS_ASSERT(ckp.ndeltas() == 2);
+    ALWAYS_ASSERT(txn_checkpointer::ReadManifest(dir, m));
+    ALWAYS_ASSERT(m.deltas_.empty());
+
+    // and deltas go on on top of it
+    remove(*b, 1);
+    txn_epoch_sync<TxnType>::sync();
+    ALWAYS_ASSERT(ckp.checkpoint_once());
+    ALWAYS_ASSERT(ckp.ndeltas() == 3);
+    ALWAYS_ASSERT(txn_checkpointer::ReadManifest(dir, m));
+    ALWAYS_ASSERT(m.deltas_.size() == 1);
+  }
+  txn_epoch_sync<TxnType>::sync();
+
+  // the checkpoint alone recovers the tables as they were at the last delta
+  a.reset();
+  b.reset();
+  a.reset(new table_type(128, false, "ckp_test_a"));
+  b.reset(new table_type(128, false, "ckp_test_b"));
+  txn_log_replayer::Replay(
+      vector<string>(), dir, {{"ckp_test_a", a.get()}, {"ckp_test_b", b.get()}},
+      1, false);
+  {
+    TxnType<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    string v;
+    for (size_t i = 0; i <= nkeys; i++) {
+      ALWAYS_ASSERT_COND_IN_TXN(t, a->search(t, u64_varkey(i), v) == (i >= 3));
+      ALWAYS_ASSERT_COND_IN_TXN(t,
+          b->search(t, u64_varkey(i), v) == (i >= 2 && i < nkeys));
+    }
+    AssertSuccessfulCommit(t);
+  }
+
+  a.reset();
+  b.reset();
+  RemoveTestDir(dir);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "test_checkpoint_deltas() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_cold_tier()
+{
+  // once enabled, every table opened from here on is swept
+  if (!cold_store::IsEnabled())
+    cold_store::Init("/tmp/silo_test_cold_tier", 0);
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+    const size_t nkeys = 100;
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+    const string val0(200, 'a'), val1(200, 'b');
+
+    for (size_t i = 0; i < nkeys; i++) {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(i), (const uint8_t *) val0.data(), val0.size());
+      AssertSuccessfulCommit(t);
+    }
+    txn_epoch_sync<TxnType>::sync();
+
+    // the first sweep clears every clock bit. only key 0 is read before the
+    // next one
+    ALWAYS_ASSERT(cold_store::Sweep() == 0);
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+      AssertSuccessfulCommit(t);
+    }
+    ALWAYS_ASSERT(cold_store::Sweep() == nkeys - 1);
+    // key 0 is evicted a pass later
+    ALWAYS_ASSERT(cold_store::Sweep() == 1);
+
+    // snapshots read cold values in place
+    {
+      TxnType<Traits> t(txn_flags | transaction_base::TXN_FLAG_READ_ONLY, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val0);
+      AssertSuccessfulCommit(t);
+    }
+
+    // anyone else aborts, and finds the value back in memory on retry
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      try {
+        btr.search(t, u64_varkey(1), v);
+        ALWAYS_ASSERT(false);
+      } catch (transaction_abort_exception &e) {
+        ALWAYS_ASSERT(t.get_abort_reason() ==
+                      transaction_base::ABORT_REASON_COLD_READ);
+      }
+    }
+    cold_store::WaitForFaults();
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val0);
+      AssertSuccessfulCommit(t);
+    }
+
+    // as does a blind write
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(2), (const uint8_t *) val1.data(), val1.size());
+      AssertFailedCommit(t);
+    }
+    cold_store::WaitForFaults();
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(2), (const uint8_t *) val1.data(), val1.size());
+      AssertSuccessfulCommit(t);
+    }
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(2), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val1);
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_compressed_cold_tier()
+{
+  if (!cold_store::IsEnabled())
+    cold_store::Init("/tmp/silo_test_cold_tier", 0);
+  cold_store::SetCompressed(true);
+  fast_random r(7183);
+  for (size_t txn_flags_idx = 0;
+       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
+       txn_flags_idx++) {
+    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+    const size_t nkeys = 10;
+    txn_btree<TxnType> btr;
+    typename Traits::StringAllocator arena;
+    const string val0(200, 'a'), val1(200, 'b');
+    // the last key's value does not compress, so it goes to the file
+    string noise(200, '\0');
+    for (auto &c : noise)
+      c = r.next();
+
+    for (size_t i = 0; i < nkeys; i++) {
+      TxnType<Traits> t(txn_flags, arena);
+      const string &v = i == nkeys - 1 ? noise : val0;
+      btr.insert(t, u64_varkey(i), (const uint8_t *) v.data(), v.size());
+      AssertSuccessfulCommit(t);
+    }
+    txn_epoch_sync<TxnType>::sync();
+    ALWAYS_ASSERT(cold_store::Sweep() == 0);
+    ALWAYS_ASSERT(cold_store::Sweep() == nkeys);
+
+    // compressed values are read in place by anyone
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val0);
+      AssertSuccessfulCommit(t);
+    }
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      try {
+        btr.search(t, u64_varkey(nkeys - 1), v);
+        ALWAYS_ASSERT(false);
+      } catch (transaction_abort_exception &e) {
+        ALWAYS_ASSERT(t.get_abort_reason() ==
+                      transaction_base::ABORT_REASON_COLD_READ);
+      }
+    }
+
+    // a second read before the next sweep faults it in: the warm tuple is
+    // evicted again two sweeps later
+    {
+      TxnType<Traits> t(txn_flags | transaction_base::TXN_FLAG_READ_ONLY, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val0);
+      AssertSuccessfulCommit(t);
+    }
+    cold_store::WaitForFaults();
+    ALWAYS_ASSERT(cold_store::Sweep() == 0);
+    ALWAYS_ASSERT(cold_store::Sweep() == 2); // and the other fault
+
+    // writes still fault first
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(2), (const uint8_t *) val1.data(), val1.size());
+      AssertFailedCommit(t);
+    }
+    cold_store::WaitForFaults();
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      btr.insert(t, u64_varkey(2), (const uint8_t *) val1.data(), val1.size());
+      AssertSuccessfulCommit(t);
+    }
+    {
+      TxnType<Traits> t(txn_flags, arena);
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(2), v));
+      ALWAYS_ASSERT_COND_IN_TXN(t, v == val1);
+      AssertSuccessfulCommit(t);
+    }
+
+    txn_epoch_sync<TxnType>::sync();
+    txn_epoch_sync<TxnType>::finish();
+  }
+  cold_store::SetCompressed(false);
+}
+
+#define TESTREC_KEY_FIELDS(x, y) \
+  x(int32_t,k0) \
+  y(int32_t,k1)
+#define TESTREC_VALUE_FIELDS(x, y) \
+  x(int32_t,v0) \
+  y(int16_t,v1) \
+  y(inline_str_fixed<10>,v2)
+DO_STRUCT(testrec, TESTREC_KEY_FIELDS, TESTREC_VALUE_FIELDS)
+
+// testrec by v0
+#define TESTREC_V0_IDX_KEY_FIELDS(x, y) \
+  x(int32_t,v0) \
+  y(int32_t,k0) \
+  y(int32_t,k1)
+#define TESTREC_V0_IDX_VALUE_FIELDS(x, y) \
+  x(int16_t,v1)
+DO_STRUCT(testrec_v0_idx, TESTREC_V0_IDX_KEY_FIELDS, TESTREC_V0_IDX_VALUE_FIELDS)
+
+namespace test_typed_btree_ns {
+
+static const pair<testrec::key, testrec::value> scan_values[] = {
+  {testrec::key(10, 1), testrec::value(123456 + 1, 10, "A")},
+  {testrec::key(10, 2), testrec::value(123456 + 2, 10, "B")},
+  {testrec::key(10, 3), testrec::value(123456 + 3, 10, "C")},
+  {testrec::key(10, 4), testrec::value(123456 + 4, 10, "D")},
+  {testrec::key(10, 5), testrec::value(123456 + 5, 10, "E")},
+};
+
+template <template <typename> class Protocol>
+class scan_callback : public typed_txn_btree<Protocol, schema<testrec>>::search_range_callback {
+public:
+  constexpr scan_callback() : n(0) {}
+
+  virtual bool
+  invoke(const testrec::key &key,
+         const testrec::value &value)
+  {
+    ALWAYS_ASSERT(n < ARRAY_NELEMS(scan_values));
+    ALWAYS_ASSERT(scan_values[n].first == key);
+    ALWAYS_ASSERT(scan_values[n].second.v2 == value.v2);
+    n++;
+    return true;
+  }
+
+private:
+  size_t n;
+};
+
+// passes the records with an odd v0
+struct odd_v0_predicate {
+  inline bool
+  operator()(const testrec::value &v) const
+  {
+    return v.v0 % 2;
+  }
+};
+
+template <template <typename> class Protocol>
+class filtered_scan_callback : public typed_txn_btree<Protocol, schema<testrec>>::search_range_callback {
+public:
+  constexpr filtered_scan_callback() : n(0) {}
+
+  virtual bool
+  invoke(const testrec::key &key,
+         const testrec::value &value)
+  {
+    ALWAYS_ASSERT(value.v0 % 2);
+    ALWAYS_ASSERT(n < ARRAY_NELEMS(scan_values));
+    while (!(scan_values[n].second.v0 % 2))
+      n++;
+    ALWAYS_ASSERT(scan_values[n].first == key);
+    ALWAYS_ASSERT(scan_values[n].second.v2 == value.v2);
+    n++;
+    nmatched++;
+    return true;
+  }
+
+  size_t n;
+  size_t nmatched = 0;
+};
+
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_typed_btree()
+{
+  using namespace test_typed_btree_ns;
+
+  typedef typed_txn_btree<TxnType, schema<testrec>> ttxn_btree_type;
+  ttxn_btree_type btr;
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
+
+  const testrec::key k0(1, 1);
+  const testrec::value v0(2, 3, "hello");
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, k0, v));
+    btr.insert(t, k0, v0);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k0, v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v0 == v);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    const bool ret = btr.search(t, k0, v, FIELDS(1, 2));
+    ALWAYS_ASSERT_COND_IN_TXN(t, ret);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v1 == v0.v1);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v2 == v0.v2);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    const bool ret = btr.search(t, k0, v, FIELDS(0, 2));
+    ALWAYS_ASSERT_COND_IN_TXN(t, ret);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v0 == v0.v0);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v2 == v0.v2);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    // neither txn reads the record, so both commit
+    txn_type t0(0, arena), t1(0, arena);
+    testrec::value d;
+    d.v0 = 5;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.increment(t0, k0, d, FIELDS(0)));
+    d.v0 = 7;
+    ALWAYS_ASSERT_COND_IN_TXN(t1, btr.increment(t1, k0, d, FIELDS(0)));
+    ALWAYS_ASSERT_COND_IN_TXN(t1, btr.increment(t1, k0, d, FIELDS(0)));
+    AssertSuccessfulCommit(t0);
+    AssertSuccessfulCommit(t1);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k0, v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v0 == v0.v0 + 19);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v1 == v0.v1);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v2 == v0.v2);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    // nor do txns keeping a max
+    txn_type t0(0, arena), t1(0, arena);
+    testrec::value d;
+    d.v1 = 10;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.template aggregate<AGGREGATE_MAX>(t0, k0, d, FIELDS(1)));
+    d.v1 = 4;
+    ALWAYS_ASSERT_COND_IN_TXN(t1, btr.template aggregate<AGGREGATE_MAX>(t1, k0, d, FIELDS(1)));
+    AssertSuccessfulCommit(t0);
+    AssertSuccessfulCommit(t1);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value d;
+    d.v1 = 6;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.template aggregate<AGGREGATE_MIN>(t, k0, d, FIELDS(1)));
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    testrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k0, v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v0 == v0.v0 + 19);
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.v1 == 6);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    // a removed record is absent to increments, which then commit
+    const testrec::key kr(0, 100);
+    testrec::value d;
+    d.v0 = 1;
+    txn_type t0(0, arena);
+    btr.insert(t0, kr, v0);
+    AssertSuccessfulCommit(t0);
+    txn_type t1(0, arena);
+    btr.remove(t1, kr);
+    ALWAYS_ASSERT_COND_IN_TXN(t1, !btr.increment(t1, kr, d, FIELDS(0)));
+    AssertSuccessfulCommit(t1);
+    txn_type t2(0, arena);
+    ALWAYS_ASSERT_COND_IN_TXN(t2, !btr.increment(t2, kr, d, FIELDS(0)));
+    AssertSuccessfulCommit(t2);
+  }
+
+  {
+    // out of order, and the last put of (0, 1) wins
+    const testrec::key ks[] = {
+      testrec::key(0, 3), testrec::key(0, 1), testrec::key(0, 2) };
+    const testrec::value vs[] = {
+      testrec::value(3, 0, "c"), testrec::value(1, 0, "a"),
+      testrec::value(2, 0, "b") };
+    txn_type t0(0, arena);
+    btr.insert_batch(t0, ks, vs, ARRAY_NELEMS(ks));
+    AssertSuccessfulCommit(t0);
+
+    const testrec::key pks[] = { testrec::key(0, 1), testrec::key(0, 1) };
+    const testrec::value pvs[] = {
+      testrec::value(10, 0, "x"), testrec::value(11, 0, "y") };
+    txn_type t1(0, arena);
+    btr.put_batch(t1, pks, pvs, ARRAY_NELEMS(pks), FIELDS(0));
+    AssertSuccessfulCommit(t1);
+
+    txn_type t2(0, arena);
+    testrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t2, btr.search(t2, ks[1], v));
+    ALWAYS_ASSERT_COND_IN_TXN(t2, v.v0 == 11 && v.v2 == vs[1].v2);
+    ALWAYS_ASSERT_COND_IN_TXN(t2, btr.search(t2, ks[2], v));
+    ALWAYS_ASSERT_COND_IN_TXN(t2, v == vs[2]);
+    AssertSuccessfulCommit(t2);
+  }
+
+  {
+    txn_type t(0, arena);
+    for (size_t i = 0; i < ARRAY_NELEMS(scan_values); i++)
+      btr.insert(t, scan_values[i].first, scan_values[i].second);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    const testrec::key begin(10, 0);
+    scan_callback<TxnType> cb;
+    btr.search_range_call(t, begin, nullptr, cb, false, FIELDS(2));
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    txn_type t(0, arena);
+    const testrec::key begin(10, 0);
+    filtered_scan_callback<TxnType> cb;
+    btr.search_range_call_if(
+        t, begin, nullptr, odd_v0_predicate(), cb, FIELDS(0), false, FIELDS(2));
+    ALWAYS_ASSERT_COND_IN_TXN(t, cb.nmatched == 3);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    // a record the predicate filtered out was still read, so a concurrent
+    // change to it aborts the scanning txn
+    txn_type t0(0, arena), t1(0, arena);
+    const testrec::key begin(10, 0);
+    filtered_scan_callback<TxnType> cb;
+    btr.search_range_call_if(
+        t0, begin, nullptr, odd_v0_predicate(), cb, FIELDS(0), false, FIELDS(2));
+    testrec::value v(scan_values[1].second);
+    v.v0++;
+    btr.put(t1, scan_values[1].first, v);
+    AssertSuccessfulCommit(t1);
+    btr.put(t0, testrec::key(10, 6), scan_values[0].second);
+    AssertFailedCommit(t0);
+  }
+
+  if (btr.set_field_validation(true)) {
+    // a read of v2 survives puts which change only v0, but not one which
+    // changes v2
+    const testrec::key k(10, 1);
+    for (int i = 0; i < 3; i++) {
+      txn_type t0(0, arena), t1(0, arena);
+      testrec::value v;
+      ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search(t0, k, v, FIELDS(2)));
+      testrec::value w(scan_values[0].second);
+      w.v0 += 100 + i;
+      if (i == 2)
+        w.v2.assign("Z");
+      btr.put(t1, k, w);
+      AssertSuccessfulCommit(t1);
+      btr.put(t0, testrec::key(10, 7 + i), scan_values[0].second);
+      if (i < 2)
+        AssertSuccessfulCommit(t0);
+      else
+        AssertFailedCommit(t0);
+    }
+    btr.set_field_validation(false);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_typed_btree() passed" << endl;
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_index_join()
+{
+  using namespace test_typed_btree_ns;
+
+  typedef typed_txn_btree<TxnType, schema<testrec>> ttxn_btree_type;
+  ttxn_btree_type btr;
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
+
+  {
+    txn_type t(0, arena);
+    for (auto &p : scan_values)
+      btr.insert(t, p.first, p.second);
+    AssertSuccessfulCommit(t);
+  }
+
+  {
+    // the outer rows are found out of key order, and one is not found. the
+    // absent key is validated like a search()'s, so an insert of it aborts
+    // the join's txn
+    txn_type t0(0, arena), t1(0, arena);
+    const vector<int> outer = {4, 9, 1, 5};
+    vector<int> seen;
+    const size_t n = btr.index_join(
+        t0, outer,
+        [](int i) { return testrec::key(10, i); },
+        [&seen](int i, const testrec::key &k, const testrec::value &v) {
+          ALWAYS_ASSERT(k.k1 == i);
+          ALWAYS_ASSERT(v == scan_values[i - 1].second);
+          seen.push_back(i);
+        });
+    ALWAYS_ASSERT_COND_IN_TXN(t0, n == 3);
+    ALWAYS_ASSERT_COND_IN_TXN(t0, (seen == vector<int>{4, 1, 5}));
+    btr.insert(t1, testrec::key(10, 9), scan_values[0].second);
+    AssertSuccessfulCommit(t1);
+    btr.put(t0, testrec::key(10, 1), scan_values[1].second);
+    AssertFailedCommit(t0);
+  }
 
-    txn_epoch_sync<TxnType>::sync();
-    txn_epoch_sync<TxnType>::finish();
+  {
+    txn_type t(0, arena);
+    const testrec::key keys[] = {testrec::key(10, 9), testrec::key(10, 2)};
+    testrec::value vs[2];
+    bool found[2];
+    btr.multi_search(t, keys, 2, vs, found, FIELDS(2));
+    ALWAYS_ASSERT_COND_IN_TXN(t, found[0] && found[1]);
+    ALWAYS_ASSERT_COND_IN_TXN(t, vs[0].v2 == scan_values[0].second.v2);
+    ALWAYS_ASSERT_COND_IN_TXN(t, vs[1].v2 == scan_values[1].second.v2);
+    AssertSuccessfulCommit(t);
   }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_index_join() passed" << endl;
 }
 
 template <template <typename> class TxnType, typename Traits>
 static void
-test_insert_same_key()
+test_column_export()
 {
-  using namespace test_insert_same_key_ns;
-  for (size_t txn_flags_idx = 0;
-       txn_flags_idx < ARRAY_NELEMS(TxnFlags);
-       txn_flags_idx++) {
-    const uint64_t txn_flags = TxnFlags[txn_flags_idx];
+  typedef typed_txn_btree<TxnType, schema<testrec>> ttxn_btree_type;
+  ttxn_btree_type btr;
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
+  const size_t nrows = 1000;
 
-    txn_btree<TxnType> btr;
-    typename Traits::StringAllocator arena;
+  {
+    txn_type t(0, arena);
+    for (size_t i = 0; i < nrows; i++)
+      btr.insert(t, testrec::key(i / 100, i % 100),
+                 testrec::value(i, i % 7, "x"));
+    AssertSuccessfulCommit(t);
+  }
+  txn_epoch_sync<TxnType>::sync();
 
-    {
-      TxnType<Traits> t(txn_flags, arena);
-      btr.insert_object(t, u64_varkey(0), rec0('a'));
-      btr.insert_object(t, u64_varkey(0), rec1('b'));
-      btr.insert_object(t, u64_varkey(0), rec2('c'));
-      AssertSuccessfulCommit(t);
-    }
+  FILE * const f = tmpfile();
+  ALWAYS_ASSERT(f);
+  {
+    txn_type t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    const testrec::key lower(0, 0);
+    ALWAYS_ASSERT(column_exporter::Export(t, btr, lower, nullptr, fileno(f), 4));
+    AssertSuccessfulCommit(t);
+  }
 
-    {
-      TxnType<Traits> t(txn_flags, arena);
-      btr.insert_object(t, u64_varkey(0), rec3('d'));
-      btr.insert_object(t, u64_varkey(0), rec4('e'));
-      AssertSuccessfulCommit(t);
+  rewind(f);
+  uint64_t magic;
+  uint32_t ncols;
+  ALWAYS_ASSERT(fread(&magic, sizeof(magic), 1, f) == 1);
+  ALWAYS_ASSERT(magic == column_exporter::Magic);
+  ALWAYS_ASSERT(fread(&ncols, sizeof(ncols), 1, f) == 1);
+  ALWAYS_ASSERT(ncols == 4);
+  vector<string> names;
+  vector<uint32_t> widths;
+  for (uint32_t i = 0; i < ncols; i++) {
+    string s[2];
+    for (auto &x : s) {
+      uint32_t n;
+      ALWAYS_ASSERT(fread(&n, sizeof(n), 1, f) == 1);
+      x.resize(n);
+      ALWAYS_ASSERT(fread(&x[0], n, 1, f) == 1);
+    }
+    uint32_t w;
+    ALWAYS_ASSERT(fread(&w, sizeof(w), 1, f) == 1);
+    names.push_back(s[0]);
+    widths.push_back(w);
+  }
+  ALWAYS_ASSERT(names[1] == "v0" && names[3] == "v2");
+  ALWAYS_ASSERT(widths[0] == sizeof(testrec::key));
+  ALWAYS_ASSERT(widths[2] == sizeof(int16_t));
+
+  // the rows come back in key order, however the scan was split
+  size_t n = 0;
+  for (;;) {
+    uint32_t rg;
+    ALWAYS_ASSERT(fread(&rg, sizeof(rg), 1, f) == 1);
+    if (!rg)
+      break;
+    vector<string> cols(ncols);
+    for (uint32_t i = 0; i < ncols; i++) {
+      cols[i].resize(rg * widths[i]);
+      ALWAYS_ASSERT(fread(&cols[i][0], cols[i].size(), 1, f) == 1);
+    }
+    for (uint32_t r = 0; r < rg; r++, n++) {
+      testrec::key k;
+      int32_t v0;
+      int16_t v1;
+      memcpy(&k, cols[0].data() + r * widths[0], sizeof(k));
+      memcpy(&v0, cols[1].data() + r * widths[1], sizeof(v0));
+      memcpy(&v1, cols[2].data() + r * widths[2], sizeof(v1));
+      ALWAYS_ASSERT(k == testrec::key(n / 100, n % 100));
+      ALWAYS_ASSERT(v0 == int32_t(n));
+      ALWAYS_ASSERT(v1 == int16_t(n % 7));
     }
-
-    txn_epoch_sync<TxnType>::sync();
-    txn_epoch_sync<TxnType>::finish();
   }
+  ALWAYS_ASSERT(n == nrows);
+  fclose(f);
+
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_column_export() passed" << endl;
 }
 
-#define TESTREC_KEY_FIELDS(x, y) \
-  x(int32_t,k0) \
-  y(int32_t,k1)
-#define TESTREC_VALUE_FIELDS(x, y) \
-  x(int32_t,v0) \
-  y(int16_t,v1) \
-  y(inline_str_fixed<10>,v2)
-DO_STRUCT(testrec, TESTREC_KEY_FIELDS, TESTREC_VALUE_FIELDS)
+static bool
+testrec_v0_idx_entry(const testrec::key &k, const testrec::value &v,
+                     testrec_v0_idx::key &ik, testrec_v0_idx::value &iv)
+{
+  if (v.v0 < 0)
+    return false;
+  ik = testrec_v0_idx::key(v.v0, k.k0, k.k1);
+  iv = testrec_v0_idx::value(v.v1);
+  return true;
+}
 
-namespace test_typed_btree_ns {
+template <template <typename> class TxnType, typename Traits>
+static void
+test_secondary_index()
+{
+  typedef typed_txn_btree<TxnType, schema<testrec>> ttxn_btree_type;
+  typedef typed_txn_btree<TxnType, schema<testrec_v0_idx>> tidx_btree_type;
+  ttxn_btree_type btr;
+  tidx_btree_type idx;
+  btr.add_secondary_index(idx, &testrec_v0_idx_entry);
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
 
-static const pair<testrec::key, testrec::value> scan_values[] = {
-  {testrec::key(10, 1), testrec::value(123456 + 1, 10, "A")},
-  {testrec::key(10, 2), testrec::value(123456 + 2, 10, "B")},
-  {testrec::key(10, 3), testrec::value(123456 + 3, 10, "C")},
-  {testrec::key(10, 4), testrec::value(123456 + 4, 10, "D")},
-  {testrec::key(10, 5), testrec::value(123456 + 5, 10, "E")},
-};
+  {
+    txn_type t(0, arena);
+    btr.insert(t, testrec::key(1, 1), testrec::value(5, 1, "a"));
+    btr.put(t, testrec::key(1, 2), testrec::value(-1, 2, "b")); // no entry
+    const testrec::key ks[] = { testrec::key(2, 2), testrec::key(2, 1) };
+    const testrec::value vs[] = {
+      testrec::value(7, 3, "c"), testrec::value(6, 4, "d") };
+    btr.insert_batch(t, ks, vs, ARRAY_NELEMS(ks));
+    AssertSuccessfulCommit(t);
+  }
 
-template <template <typename> class Protocol>
-class scan_callback : public typed_txn_btree<Protocol, schema<testrec>>::search_range_callback {
-public:
-  constexpr scan_callback() : n(0) {}
+  auto has_entry = [&](int32_t v0, int32_t k0, int32_t k1, int16_t v1) {
+    txn_type t(0, arena);
+    testrec_v0_idx::value iv;
+    const bool found = idx.search(t, testrec_v0_idx::key(v0, k0, k1), iv);
+    AssertSuccessfulCommit(t);
+    ALWAYS_ASSERT(!found || iv.v1 == v1);
+    return found;
+  };
+  ALWAYS_ASSERT(has_entry(5, 1, 1, 1));
+  ALWAYS_ASSERT(!has_entry(-1, 1, 2, 2));
+  ALWAYS_ASSERT(has_entry(6, 2, 1, 4));
+  ALWAYS_ASSERT(has_entry(7, 2, 2, 3));
 
-  virtual bool
-  invoke(const testrec::key &key,
-         const testrec::value &value)
   {
-    ALWAYS_ASSERT(n < ARRAY_NELEMS(scan_values));
-    ALWAYS_ASSERT(scan_values[n].first == key);
-    ALWAYS_ASSERT(scan_values[n].second.v2 == value.v2);
-    n++;
-    return true;
+    // a put of an indexed field moves the entry, and one of the value of
+    // an entry rewrites it
+    txn_type t(0, arena);
+    btr.put(t, testrec::key(1, 1), testrec::value(8, 1, "a"));
+    btr.put(t, testrec::key(2, 1), testrec::value(0, 9, ""), FIELDS(1));
+    AssertSuccessfulCommit(t);
   }
+  ALWAYS_ASSERT(!has_entry(5, 1, 1, 1));
+  ALWAYS_ASSERT(has_entry(8, 1, 1, 1));
+  ALWAYS_ASSERT(has_entry(6, 2, 1, 9));
 
-private:
-  size_t n;
-};
+  {
+    // a record which stops (or starts) having an entry
+    txn_type t(0, arena);
+    btr.put(t, testrec::key(1, 1), testrec::value(-1, 0, ""), FIELDS(0));
+    btr.put(t, testrec::key(1, 2), testrec::value(3, 0, ""), FIELDS(0));
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(!has_entry(8, 1, 1, 1));
+  ALWAYS_ASSERT(has_entry(3, 1, 2, 2));
+
+  {
+    // a removed record takes its entry along
+    txn_type t(0, arena);
+    btr.remove(t, testrec::key(2, 2));
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(!has_entry(7, 2, 2, 3));
+
+  {
+    // and an insert over the deleted record makes a new one
+    txn_type t(0, arena);
+    btr.insert(t, testrec::key(2, 2), testrec::value(4, 5, "e"));
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(has_entry(4, 2, 2, 5));
+  ALWAYS_ASSERT(!has_entry(7, 2, 2, 3));
+
+  {
+    // and the entries of a batch are kept in order
+    txn_type t(0, arena);
+    const testrec::key ks[] = { testrec::key(3, 1), testrec::key(3, 1) };
+    const testrec::value vs[] = {
+      testrec::value(10, 6, "f"), testrec::value(11, 7, "g") };
+    btr.put_batch(t, ks, vs, ARRAY_NELEMS(ks));
+    AssertSuccessfulCommit(t);
+  }
+  ALWAYS_ASSERT(!has_entry(10, 3, 1, 6));
+  ALWAYS_ASSERT(has_entry(11, 3, 1, 7));
 
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_secondary_index() passed" << endl;
 }
 
 template <template <typename> class TxnType, typename Traits>
 static void
-test_typed_btree()
+test_online_index_build()
 {
-  using namespace test_typed_btree_ns;
-
   typedef typed_txn_btree<TxnType, schema<testrec>> ttxn_btree_type;
+  typedef typed_txn_btree<TxnType, schema<testrec_v0_idx>> tidx_btree_type;
   ttxn_btree_type btr;
+  tidx_btree_type idx;
   typename Traits::StringAllocator arena;
   typedef TxnType<Traits> txn_type;
 
-  const testrec::key k0(1, 1);
-  const testrec::value v0(2, 3, "hello");
+  // v0 is negative (no entry) for every 7th record
+  auto value_of = [](int32_t i) {
+    return testrec::value(i % 7 ? i : -1, int16_t(i), "x");
+  };
+  const int32_t nbefore = 2000, nduring = 500;
+  for (int32_t i = 0; i < nbefore; i++) {
+    txn_type t(0, arena);
+    btr.insert(t, testrec::key(i, 0), value_of(i));
+    AssertSuccessfulCommit(t);
+  }
+
+  // while the index is built, records keep coming in, and some of those
+  // already there are removed, or get another v0
+  auto removed = [](int32_t i) { return i < nduring && !(i % 11); };
+  auto moved = [](int32_t i) { return i < nduring && i % 11 && !(i % 13); };
+  auto final_value_of = [&](int32_t i) {
+    return moved(i) ? testrec::value(i + 100000, int16_t(i), "x") : value_of(i);
+  };
+  std::thread writer([&]() {
+    typename Traits::StringAllocator warena;
+    for (int32_t i = nbefore; i < nbefore + nduring; i++) {
+      const int32_t j = i - nbefore;
+      for (;;) {
+        txn_type t(0, warena);
+        try {
+          btr.insert(t, testrec::key(i, 0), value_of(i));
+          if (removed(j))
+            btr.remove(t, testrec::key(j, 0));
+          else if (moved(j))
+            btr.put(t, testrec::key(j, 0), final_value_of(j), FIELDS(0));
+          if (t.commit(false))
+            break;
+        } catch (transaction_abort_exception &ex) {
+        }
+      }
+    }
+  });
+  ALWAYS_ASSERT(btr.template build_secondary_index<Traits>(
+                  idx, &testrec_v0_idx_entry, 4, 200000) >=
+                size_t(nbefore - nbefore / 7 - 1));
+  writer.join();
 
   {
+    // and after it is switched over, straight into idx
     txn_type t(0, arena);
-    testrec::value v;
-    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, k0, v));
-    btr.insert(t, k0, v0);
+    btr.insert(t, testrec::key(nbefore + nduring, 0),
+               value_of(nbefore + nduring));
+    AssertSuccessfulCommit(t);
+  }
+
+  for (int32_t i = 0; i <= nbefore + nduring; i++) {
+    txn_type t(0, arena);
+    const testrec::value v = final_value_of(i);
+    testrec_v0_idx::value iv;
+    const bool found = idx.search(t, testrec_v0_idx::key(v.v0, i, 0), iv);
+    ALWAYS_ASSERT_COND_IN_TXN(t, found == (v.v0 >= 0 && !removed(i)));
+    ALWAYS_ASSERT_COND_IN_TXN(t, !found || iv.v1 == int16_t(i));
+    if (moved(i))
+      ALWAYS_ASSERT_COND_IN_TXN(t,
+          !idx.search(t, testrec_v0_idx::key(value_of(i).v0, i, 0), iv));
     AssertSuccessfulCommit(t);
   }
 
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_online_index_build() passed" << endl;
+}
+
+#define SPLITREC_KEY_FIELDS(x, y) \
+  x(int32_t,k0)
+#define SPLITREC_HOT_FIELDS(x, y) \
+  x(int64_t,balance) \
+  y(int32_t,npayments)
+#define SPLITREC_COLD_FIELDS(x, y) \
+  x(inline_str_fixed<200>,data)
+DO_SPLIT_STRUCT(splitrec, SPLITREC_KEY_FIELDS, SPLITREC_HOT_FIELDS,
+                SPLITREC_COLD_FIELDS)
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_vertical_btree()
+{
+  typedef vertical_txn_btree<TxnType, splitrec, splitrec_cold> vtxn_btree_type;
+  vtxn_btree_type btr;
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
+
+  const splitrec::key k(1), k1(2);
   {
     txn_type t(0, arena);
-    testrec::value v;
-    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k0, v));
-    ALWAYS_ASSERT_COND_IN_TXN(t, v0 == v);
+    btr.insert(t, k, splitrec::value(100, 0), splitrec_cold::value("history"));
     AssertSuccessfulCommit(t);
   }
 
+  {
+    // a write of hot fields leaves the cold part alone, so a reader of the
+    // cold part does not conflict with it
+    txn_type t0(0, arena), t1(0, arena);
+    splitrec_cold::value cv;
+    ALWAYS_ASSERT_COND_IN_TXN(t0, btr.search_cold(t0, k, cv));
+    ALWAYS_ASSERT_COND_IN_TXN(t0, cv.data == "history");
+    splitrec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t1, btr.search(t1, k, v));
+    v.balance -= 10;
+    v.npayments++;
+    btr.put(t1, k, v);
+    AssertSuccessfulCommit(t1);
+    btr.insert(t0, k1, splitrec::value(0, 0), cv);
+    AssertSuccessfulCommit(t0);
+  }
+
   {
     txn_type t(0, arena);
-    testrec::value v;
-    const bool ret = btr.search(t, k0, v, FIELDS(1, 2));
-    ALWAYS_ASSERT_COND_IN_TXN(t, ret);
-    ALWAYS_ASSERT_COND_IN_TXN(t, v.v1 == v0.v1);
-    ALWAYS_ASSERT_COND_IN_TXN(t, v.v2 == v0.v2);
+    splitrec::value v;
+    splitrec_cold::value cv;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k, v, cv));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.balance == 90 && v.npayments == 1);
+    ALWAYS_ASSERT_COND_IN_TXN(t, cv.data == "history");
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, k1, v, cv));
+    ALWAYS_ASSERT_COND_IN_TXN(t, cv.data == "history");
+    btr.remove(t, k1);
     AssertSuccessfulCommit(t);
   }
 
   {
     txn_type t(0, arena);
-    testrec::value v;
-    const bool ret = btr.search(t, k0, v, FIELDS(0, 2));
-    ALWAYS_ASSERT_COND_IN_TXN(t, ret);
-    ALWAYS_ASSERT_COND_IN_TXN(t, v.v0 == v0.v0);
-    ALWAYS_ASSERT_COND_IN_TXN(t, v.v2 == v0.v2);
+    splitrec::value v;
+    splitrec_cold::value cv;
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search(t, k1, v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, !btr.search_cold(t, k1, cv));
+    AssertSuccessfulCommit(t);
+  }
+
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+
+  cerr << "test_vertical_btree() passed" << endl;
+}
+
+#define EVOLVEREC_KEY_FIELDS(x, y) \
+  x(int32_t,k0)
+#define EVOLVEREC_V0_VALUE_FIELDS(x, y) \
+  x(int32_t,a) \
+  y(int32_t,b)
+#define EVOLVEREC_VALUE_FIELDS(x, y) \
+  EVOLVEREC_V0_VALUE_FIELDS(x, y) \
+  y(int64_t,c)
+DO_STRUCT(evolverec_v0, EVOLVEREC_KEY_FIELDS, EVOLVEREC_V0_VALUE_FIELDS)
+DO_STRUCT(evolverec, EVOLVEREC_KEY_FIELDS, EVOLVEREC_VALUE_FIELDS)
+
+template <template <typename> class TxnType, typename Traits>
+static void
+test_schema_evolution()
+{
+  typedef typed_txn_btree<TxnType, schema<evolverec>> ttxn_btree_type;
+  ttxn_btree_type btr;
+  typename Traits::StringAllocator arena;
+  typedef TxnType<Traits> txn_type;
+
+  // the table was loaded before c was added
+  {
+    const encoder<evolverec::key> key_encoder;
+    const encoder<evolverec_v0::value> value_encoder;
+    vector<string> ks, vs;
+    for (int32_t i = 1; i <= 3; i++) {
+      const evolverec::key k(i);
+      const evolverec_v0::value v(i, 2 * i);
+      ks.emplace_back();
+      key_encoder.write(ks.back(), &k);
+      vs.emplace_back();
+      value_encoder.write(vs.back(), &v);
+    }
+    vector<varkey> keys;
+    vector<const uint8_t *> values;
+    vector<size_t> sizes;
+    for (size_t i = 0; i < ks.size(); i++) {
+      keys.emplace_back(ks[i]);
+      values.push_back((const uint8_t *) vs[i].data());
+      sizes.push_back(vs[i].size());
+    }
+    btr.bulk_load_records(keys.data(), values.data(), sizes.data(), keys.size());
+  }
+
+  {
+    txn_type t(0, arena);
+    evolverec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, evolverec::key(1), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.a == 1 && v.b == 2 && v.c == 0);
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, evolverec::key(2), v, FIELDS(2)));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.c == 0);
+    v.c = 7;
+    btr.put(t, evolverec::key(2), v, FIELDS(2));
     AssertSuccessfulCommit(t);
   }
 
   {
     txn_type t(0, arena);
-    for (size_t i = 0; i < ARRAY_NELEMS(scan_values); i++)
-      btr.insert(t, scan_values[i].first, scan_values[i].second);
+    evolverec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, evolverec::key(2), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.a == 2 && v.b == 4 && v.c == 7);
     AssertSuccessfulCommit(t);
   }
 
+  // the rest are rewritten by the background pass
+  const evolverec::key lower(0);
+  ALWAYS_ASSERT(btr.template upgrade_old_records<Traits>(lower, nullptr) == 2);
+  ALWAYS_ASSERT(btr.template upgrade_old_records<Traits>(lower, nullptr) == 0);
+
   {
     txn_type t(0, arena);
-    const testrec::key begin(10, 0);
-    scan_callback<TxnType> cb;
-    btr.search_range_call(t, begin, nullptr, cb, false, FIELDS(2));
+    evolverec::value v;
+    ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, evolverec::key(3), v));
+    ALWAYS_ASSERT_COND_IN_TXN(t, v.a == 3 && v.b == 6 && v.c == 0);
     AssertSuccessfulCommit(t);
   }
 
   txn_epoch_sync<TxnType>::sync();
   txn_epoch_sync<TxnType>::finish();
 
-  cerr << "test_typed_btree() passed" << endl;
+  cerr << "test_schema_evolution() passed" << endl;
 }
 
 template <template <typename> class Protocol>
@@ -1572,6 +4196,133 @@ mp_test_simple_write_skew()
   }
 }
 
+namespace mp_test_hot_locking_ns {
+
+  static const size_t nwriters = 3;
+  static const size_t niters = 2000;
+
+  static atomic<bool> running(true);
+
+  // scores tuple as hot, as if txns kept aborting on it
+  static void
+  MakeHot(const dbtuple *tuple)
+  {
+    while (!contention_manager::IsHot(tuple))
+      contention_manager::OnAbort(
+          transaction_base::ABORT_REASON_WRITE_NODE_INTERFERENCE, tuple);
+    contention_manager::OnCommit();
+  }
+
+  template <template <typename> class TxnType>
+  static const dbtuple *
+  TupleOf(txn_btree<TxnType> &btr, uint64_t k)
+  {
+    typename concurrent_btree::value_type v = 0;
+    ALWAYS_ASSERT(btr.get_underlying_btree()->search(u64_varkey(k), v));
+    return (const dbtuple *) v;
+  }
+}
+
+template <template <typename> class TxnType, typename Traits>
+static void
+mp_test_hot_locking()
+{
+  using namespace mp_test_hot_locking_ns;
+  txn_btree<TxnType> btr;
+  typename Traits::StringAllocator arena;
+  {
+    TxnType<Traits> t(0, arena);
+    for (size_t i = 0; i < 5; i++)
+      btr.insert_object(t, u64_varkey(i), rec(0));
+    AssertSuccessfulCommit(t);
+  }
+  contention_manager::EnableHotLocking(true);
+
+  // key 0 is overwritten as fast as the writers can, while a txn which reads
+  // keys 0 and 1 commits. whenever it got the hot lock on key 0, it must
+  // commit, as nobody could change key 0 under it
+  running.store(true);
+  vector<std::thread> writers;
+  for (size_t i = 0; i < nwriters; i++)
+    writers.emplace_back([&btr, i]() {
+      typename Traits::StringAllocator warena;
+      for (uint64_t n = 0; running.load(); n++) {
+        TxnType<Traits> t(0, warena);
+        btr.insert_object(t, u64_varkey(0), rec(i * niters + n));
+        t.commit(false);
+      }
+    });
+  size_t nhot = 0, nreads_failed = 0;
+  for (size_t i = 0; i < niters; i++) {
+    MakeHot(TupleOf(btr, 0));
+    TxnType<Traits> t(0, arena);
+    uint64_t hot = 0;
+    try {
+      string v;
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(0), v));
+      hot = t.get_txn_counters()["hot_locks"];
+      ALWAYS_ASSERT_COND_IN_TXN(t, btr.search(t, u64_varkey(1), v));
+      btr.insert_object(t, u64_varkey(2), rec(i));
+      if (t.commit(false)) {
+        nhot += hot;
+        continue;
+      }
+    } catch (transaction_abort_exception &e) {
+    }
+    ALWAYS_ASSERT(!hot);
+    nreads_failed++;
+  }
+  running.store(false);
+  for (auto &w : writers)
+    w.join();
+  cerr << "hot locked reads: " << nhot
+       << ", failed unlocked reads: " << nreads_failed << endl;
+  ALWAYS_ASSERT(nhot);
+
+  // two txns each hot lock the record the other then writes: neither can
+  // wait for the other's lock forever, so at least one aborts, and the
+  // other is free to commit
+  size_t ncrossed = 0;
+  for (size_t i = 0; i < niters; i++) {
+    MakeHot(TupleOf(btr, 3));
+    MakeHot(TupleOf(btr, 4));
+    spin_barrier b(2);
+    bool hot[2] = {false, false}, committed[2] = {false, false};
+    auto cross = [&](size_t me) {
+      typename Traits::StringAllocator carena;
+      TxnType<Traits> t(0, carena);
+      bool read = false;
+      try {
+        string v;
+        read = btr.search(t, u64_varkey(me ? 4 : 3), v);
+        hot[me] = t.get_txn_counters()["hot_locks"];
+      } catch (transaction_abort_exception &e) {
+      }
+      b.count_down();
+      b.wait_for();
+      if (!read)
+        return;
+      try {
+        btr.insert_object(t, u64_varkey(me ? 3 : 4), rec(i));
+        committed[me] = t.commit(false);
+      } catch (transaction_abort_exception &e) {
+      }
+    };
+    std::thread other(cross, 1);
+    cross(0);
+    other.join();
+    ALWAYS_ASSERT(!committed[0] || !committed[1]);
+    ncrossed += hot[0] && hot[1];
+  }
+  cerr << "crossed hot locks: " << ncrossed << endl;
+  ALWAYS_ASSERT(ncrossed);
+
+  contention_manager::EnableHotLocking(false);
+  txn_epoch_sync<TxnType>::sync();
+  txn_epoch_sync<TxnType>::finish();
+  cerr << "mp_test_hot_locking passed" << endl;
+}
+
 namespace mp_test_batch_processing_ns {
 
   volatile bool running = true;
@@ -1883,15 +4634,45 @@ void txn_btree_test()
 {
   cerr << "Test proto2" << endl;
   test_typed_btree<transaction_proto2, default_stable_transaction_traits>();
+  test_index_join<transaction_proto2, default_stable_transaction_traits>();
+  test_column_export<transaction_proto2, default_stable_transaction_traits>();
+  test_secondary_index<transaction_proto2, default_stable_transaction_traits>();
+  test_online_index_build<transaction_proto2, default_stable_transaction_traits>();
+  test_vertical_btree<transaction_proto2, default_stable_transaction_traits>();
+  test_schema_evolution<transaction_proto2, default_stable_transaction_traits>();
   test1<transaction_proto2, default_transaction_traits>();
   test2<transaction_proto2, default_transaction_traits>();
   test_absent_key_race<transaction_proto2, default_transaction_traits>();
+  test_scan_node_set<transaction_proto2, default_transaction_traits>();
+  test_early_validation<transaction_proto2, default_transaction_traits>();
+  test_single_key_commits<transaction_proto2, default_transaction_traits>();
   test_inc_value_size<transaction_proto2, default_transaction_traits>();
   test_multi_btree<transaction_proto2, default_transaction_traits>();
+  test_sharded_btree<transaction_proto2, default_transaction_traits>();
   test_read_only_snapshot<transaction_proto2, default_transaction_traits>();
+  test_write_policy<transaction_proto2, default_transaction_traits>();
+  test_bulk_load<transaction_proto2, default_transaction_traits>();
   test_long_keys<transaction_proto2, default_transaction_traits>();
   test_long_keys2<transaction_proto2, default_transaction_traits>();
   test_insert_same_key<transaction_proto2, default_transaction_traits>();
+  test_point_only<transaction_proto2, default_transaction_traits>();
+  test_learned_btree<transaction_proto2, default_transaction_traits>();
+  test_numa_home<transaction_proto2, default_transaction_traits>();
+  test_pack_group<transaction_proto2, default_transaction_traits>();
+  test_large_write_set<transaction_proto2, default_transaction_traits>();
+  test_txn_reset<transaction_proto2, default_transaction_traits>();
+  test_access_heatmap<transaction_proto2, default_transaction_traits>();
+  test_pinned_snapshot<transaction_proto2, default_transaction_traits>();
+  test_standby_read_tid<transaction_proto2, default_transaction_traits>();
+  test_admission_control<transaction_proto2, default_transaction_traits>();
+  test_ttl<transaction_proto2, default_transaction_traits>();
+  test_range_delete<transaction_proto2, default_transaction_traits>();
+  test_coalesce_writes<transaction_proto2, default_transaction_traits>();
+  test_log_format_detection<transaction_proto2, default_transaction_traits>();
+  test_log_no_pepoch<transaction_proto2, default_transaction_traits>();
+  test_log_corruption<transaction_proto2, default_transaction_traits>();
+  test_log_follower<transaction_proto2, default_transaction_traits>();
+  test_checkpoint_deltas<transaction_proto2, default_transaction_traits>();
 
   //mp_stress_test_allocator<transaction_proto2, default_transaction_traits>();
   mp_stress_test_insert_removes<transaction_proto2, default_transaction_traits>();
@@ -1899,8 +4680,16 @@ void txn_btree_test()
   mp_test2<transaction_proto2, default_transaction_traits>();
   mp_test3<transaction_proto2, default_transaction_traits>();
   mp_test_simple_write_skew<transaction_proto2, default_transaction_traits>();
+  mp_test_hot_locking<transaction_proto2, default_transaction_traits>();
   mp_test_batch_processing<transaction_proto2, default_transaction_traits>();
 
+  // last, since the cold tier cannot be turned off again
+  test_cold_tier<transaction_proto2, default_transaction_traits>();
+  test_compressed_cold_tier<transaction_proto2, default_transaction_traits>();
+  // nor can the gc threads be stopped
+  test_gc_threads<transaction_proto2, default_transaction_traits>();
+  test_version_chain_bound<transaction_proto2, default_transaction_traits>();
+
   //read_only_perf<transaction_proto1>();
   //read_only_perf<transaction_proto2>();
 }
@@ -82,6 +82,36 @@ struct txn_btree_ {
     size_t max_bytes_read;
   };
 
+  // points at the record's bytes instead of copying them (see
+  // txn_btree::search_view())
+  class view_value_reader {
+  public:
+    typedef std::string value_type;
+
+    constexpr view_value_reader() : data(nullptr), sz(0) {}
+
+    template <typename StringAllocator>
+    inline bool
+    operator()(const uint8_t *data, size_t sz, StringAllocator &sa)
+    {
+      this->data = data;
+      this->sz = sz;
+      return true;
+    }
+
+    // the txn's own write, which lives as long as the txn
+    template <typename StringAllocator>
+    inline void
+    dup(const std::string &vdup, StringAllocator &sa)
+    {
+      data = (const uint8_t *) vdup.data();
+      sz = vdup.size();
+    }
+
+    const uint8_t *data;
+    size_t sz;
+  };
+
   class value_reader {
   public:
     typedef std::string value_type;
@@ -169,6 +199,9 @@ struct txn_btree_ {
     case dbtuple::TUPLE_WRITER_DO_DELTA_WRITE:
       NDB_MEMCPY(p, vx->data(), vx->size());
       return 0;
+    case dbtuple::TUPLE_WRITER_RESOLVE_DELTA:
+    case dbtuple::TUPLE_WRITER_ADD_DELTA:
+      break; // not commutative
     }
     ALWAYS_ASSERT(false);
     return 0;
@@ -262,6 +295,17 @@ private:
     return px;
   }
 
+  // takes s's bytes without copying them: s is left with the arena
+  // string's old buffer, for the caller to reuse
+  template <typename Traits>
+  static inline const std::string *
+  stablize(Transaction<Traits> &t, std::string &&s)
+  {
+    std::string * const px = t.string_allocator()();
+    px->swap(s);
+    return px;
+  }
+
   template <typename Traits>
   static inline const std::string *
   stablize(Transaction<Traits> &t, const uint8_t *p, size_t sz)
@@ -280,14 +324,46 @@ private:
     return stablize(t, k.data(), k.size());
   }
 
+  // where prefetch_step() leaves cur once it has prefetched the tuple
+  static inline const void *
+  PrefetchedTuple()
+  {
+    return reinterpret_cast<const void *>(0x1);
+  }
+
 public:
 
+  // a point_only tree also indexes its keys in a hash index, for point
+  // reads (see point_index). it can still be scanned, but should not be
   txn_btree(size_type value_size_hint = 128,
             bool mostly_append = false,
-            const std::string &name = "<unknown>")
-    : super_type(value_size_hint, mostly_append, name)
+            const std::string &name = "<unknown>",
+            bool point_only = false)
+    : super_type(value_size_hint, mostly_append, name, point_only)
   {}
 
+  /**
+   * One step of warming up the cache for a search of k, ending with a
+   * prefetch of k's tuple (see concurrent_btree::prefetch_step()). cur
+   * starts null; returns false once there is nothing left to prefetch. The
+   * caller must stay in one RCU region (e.g. keep a txn active) over all of
+   * k's steps
+   */
+  inline bool
+  prefetch_step(const varkey &k, const void *&cur) const
+  {
+    if (cur == PrefetchedTuple())
+      return false;
+    if (this->underlying_btree.prefetch_step(k, cur))
+      return true;
+    // cur is k's leaf, which the last step prefetched
+    typename concurrent_btree::value_type v = 0;
+    if (this->underlying_btree.search(k, v))
+      ::prefetch(reinterpret_cast<const dbtuple *>(v));
+    cur = PrefetchedTuple();
+    return true;
+  }
+
   template <typename Traits>
   inline bool
   search(Transaction<Traits> &t,
@@ -311,6 +387,39 @@ public:
     return this->do_search(t, k, r);
   }
 
+  /**
+   * Like search(), but without copying the value: on success, [data, data +
+   * sz) are the record's bytes, which stay readable until t ends (its RCU
+   * region keeps the tuple around). The read is validated at commit like any
+   * other, but a concurrent writer can still change the bytes under the view
+   * (t then fails to commit), so anything decoded from them before commit
+   * must be sanity checked, as with any optimistic read
+   */
+  template <typename Traits>
+  inline bool
+  search_view(Transaction<Traits> &t,
+              const key_type &k,
+              const uint8_t *&data,
+              size_t &sz)
+  {
+    txn_btree_::view_value_reader r;
+    if (!this->do_search(t, k, r))
+      return false;
+    data = r.data;
+    sz = r.sz;
+    return true;
+  }
+
+  template <typename Traits>
+  inline bool
+  search_view(Transaction<Traits> &t,
+              const varkey &k,
+              const uint8_t *&data,
+              size_t &sz)
+  {
+    return search_view(t, to_string_type(k), data, sz);
+  }
+
   template <typename Traits>
   inline void
   search_range_call(Transaction<Traits> &t,
@@ -337,6 +446,23 @@ public:
     this->do_rsearch_range_call(t, upper, lower, callback, kr, vr);
   }
 
+  // like search_range_call(), but split into callbacks.size() subranges,
+  // callbacks[i] getting the i-th one. snapshot txns scan them at the same
+  // time, so the callbacks are invoked concurrently (see
+  // base_txn_btree::do_parallel_search_range_call())
+  template <typename Traits>
+  inline void
+  search_range_call_parallel(Transaction<Traits> &t,
+                             const key_type &lower,
+                             const key_type *upper,
+                             const std::vector<search_range_callback *> &callbacks,
+                             size_type max_bytes_read = string_type::npos)
+  {
+    key_reader_type kr;
+    value_reader_type vr(max_bytes_read);
+    this->do_parallel_search_range_call(t, lower, upper, callbacks, kr, vr);
+  }
+
   template <typename Traits>
   inline void
   search_range_call(Transaction<Traits> &t,
@@ -424,6 +550,45 @@ public:
         txn_btree_::tuple_writer, true);
   }
 
+  // put() and insert() which take over v's buffer rather than copy it into
+  // the txn (v is left holding some other, unspecified string), so the
+  // value's only copy is the one into the record at commit
+  template <typename Traits>
+  inline void
+  put(Transaction<Traits> &t, const key_type &k, value_type &&v)
+  {
+    INVARIANT(!v.empty());
+    this->do_tree_put(
+        t, stablize(t, k), stablize(t, std::move(v)),
+        txn_btree_::tuple_writer, false);
+  }
+
+  template <typename Traits>
+  inline void
+  insert(Transaction<Traits> &t, const key_type &k, value_type &&v)
+  {
+    INVARIANT(!v.empty());
+    this->do_tree_put(
+        t, stablize(t, k), stablize(t, std::move(v)),
+        txn_btree_::tuple_writer, true);
+  }
+
+  // fills the table, which must be empty and not yet in use, with
+  // keys[i] => values[i], the keys being sorted. outside of any txn, and not
+  // logged (see base_txn_btree::do_bulk_load()), so it is refused while the
+  // protocol logs txns: returns false, loading nothing, in that case
+  inline bool
+  bulk_load(const std::vector<key_type> &keys,
+            const std::vector<value_type> &values)
+  {
+    ALWAYS_ASSERT(keys.size() == values.size());
+    if (!base_txn_btree_handler<Transaction>::can_bulk_load())
+      return false;
+    this->do_bulk_load(keys.data(), values.data(), keys.size(),
+        txn_btree_::tuple_writer);
+    return true;
+  }
+
   // insert() methods below are for legacy use
 
   template <typename Traits>
@@ -0,0 +1,1320 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txn_checkpoint.h"
+#include "cold_store.h"
+#include "fileutils.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "spinlock.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+static event_counter evt_checkpoint_rows("checkpoint_rows");
+static event_counter evt_checkpoint_bytes("checkpoint_bytes");
+static event_counter evt_checkpoint_chunk_retries("checkpoint_chunk_retries");
+static event_avg_counter evt_avg_checkpoint_time_ms("avg_checkpoint_time_ms");
+static event_counter evt_checkpoint_delta_rows("checkpoint_delta_rows");
+static event_counter evt_checkpoint_delta_removals("checkpoint_delta_removals");
+static event_counter evt_checkpoint_merges("checkpoint_merges");
+static event_counter evt_backup_rows("backup_rows");
+static event_counter evt_backup_bytes("backup_bytes");
+static event_counter evt_backup_chunk_retries("backup_chunk_retries");
+
+atomic<uint64_t> txn_checkpointer::g_last_checkpoint_epoch(0);
+atomic<bool> txn_checkpointer::g_journal_removals(false);
+
+static spinlock g_journal_lock;
+static vector<txn_checkpointer::removal> g_journal;
+
+namespace {
+
+  struct checkpoint_traits : public default_transaction_traits {};
+
+  // collects up to ChunkNRows rows, encoded as [klen][key][vlen][value].
+  // the chunk ends early if the scan is holding back the tick
+  class chunk_callback : public txn_checkpointer::table_type::search_range_callback {
+  public:
+    chunk_callback(string &rows) : rows_(&rows), n_(0), more_(false) {}
+
+    virtual bool
+    invoke(const txn_checkpointer::table_type::keystring_type &k,
+           const txn_checkpointer::table_type::string_type &v)
+    {
+      serializer<uint32_t, true> vs_uint32_t;
+      uint8_t buf[16];
+      rows_->append((const char *) buf, vs_uint32_t.write(buf, k.length()) - buf);
+      rows_->append(k.data(), k.length());
+      rows_->append((const char *) buf, vs_uint32_t.write(buf, v.size()) - buf);
+      rows_->append(v.data(), v.size());
+      last_key_.assign(k.data(), k.length());
+      more_ = ++n_ == txn_checkpointer::ChunkNRows ||
+        ticker::s_instance.is_holding_back_tick();
+      return !more_;
+    }
+
+    inline size_t nrows() const { return n_; }
+    inline const string &last_key() const { return last_key_; }
+
+    // whether the scan stopped before the end of the range
+    inline bool more() const { return more_; }
+
+    inline void
+    reset()
+    {
+      rows_->clear();
+      n_ = 0;
+      more_ = false;
+    }
+
+  private:
+    string *rows_;
+    size_t n_;
+    bool more_;
+    string last_key_;
+  };
+
+  void
+  sync_or_die(int fd)
+  {
+    if (fsync(fd) == -1) {
+      perror("fsync");
+      ALWAYS_ASSERT(false);
+    }
+  }
+
+  void
+  sync_dir(const string &dir)
+  {
+    const int fd = open(dir.c_str(), O_RDONLY);
+    if (fd == -1) {
+      perror("open");
+      ALWAYS_ASSERT(false);
+    }
+    sync_or_die(fd);
+    close(fd);
+  }
+
+  // relative to the checkpoint dir
+  inline string
+  table_fname(uint64_t seq, uint32_t id)
+  {
+    return "ckp." + to_string(seq) + "." + to_string(id);
+  }
+
+  // compresses one block and appends it to out as [uint32_t clen][lz4 data]
+  void
+  encode_block(uint64_t tid, uint32_t nrows,
+               const char *rows, size_t rows_len, string &out)
+  {
+    serializer<uint32_t, true> vs_uint32_t;
+    serializer<uint64_t, false> s_uint64_t;
+    serializer<uint32_t, false> s_uint32_t;
+    string raw;
+    uint8_t buf[16];
+    raw.append((const char *) buf, s_uint64_t.write(buf, tid) - buf);
+    raw.append((const char *) buf, vs_uint32_t.write(buf, nrows) - buf);
+    raw.append(rows, rows_len);
+    INVARIANT(raw.size() <= txn_checkpointer::BlockSize);
+    const size_t off = out.size();
+    out.resize(off + sizeof(uint32_t) + LZ4_compressBound(raw.size()));
+    const int ret = LZ4_compress(
+        raw.data(), &out[off + sizeof(uint32_t)], raw.size());
+    ALWAYS_ASSERT(ret > 0);
+    s_uint32_t.write((uint8_t *) &out[off], ret);
+    out.resize(off + sizeof(uint32_t) + ret);
+  }
+
+  // splits the rows of one chunk into blocks of at most BlockSize bytes,
+  // appended to out. rows of a chunk at RowTids start with their tids
+  void
+  encode_chunk(uint64_t tid, const string &rows, string &out)
+  {
+    serializer<uint32_t, true> vs_uint32_t;
+    const uint8_t *p = (const uint8_t *) rows.data();
+    const uint8_t * const end = p + rows.size();
+    const uint8_t *block_start = p;
+    uint32_t nrows = 0;
+    // leave room for the block header
+    const size_t max_rows_len = txn_checkpointer::BlockSize - 16;
+    while (p < end) {
+      const uint8_t *q = p;
+      uint32_t klen, vlen;
+      if (tid == txn_checkpointer::RowTids)
+        q += sizeof(uint64_t);
+      q = vs_uint32_t.read(q, &klen);
+      q += klen;
+      q = vs_uint32_t.read(q, &vlen);
+      q += vlen;
+      ALWAYS_ASSERT(size_t(q - p) <= max_rows_len); // row too big
+      if (size_t(q - block_start) > max_rows_len) {
+        encode_block(tid, nrows, (const char *) block_start,
+                     p - block_start, out);
+        block_start = p;
+        nrows = 0;
+      }
+      p = q;
+      nrows++;
+    }
+    if (nrows)
+      encode_block(tid, nrows, (const char *) block_start,
+                   p - block_start, out);
+  }
+
+  // appends a row of a chunk at RowTids
+  void
+  append_row(string &rows, uint64_t tid,
+             const char *k, size_t klen, const char *v, size_t vlen)
+  {
+    serializer<uint32_t, true> vs_uint32_t;
+    serializer<uint64_t, false> s_uint64_t;
+    uint8_t buf[16];
+    rows.append((const char *) buf, s_uint64_t.write(buf, tid) - buf);
+    rows.append((const char *) buf, vs_uint32_t.write(buf, klen) - buf);
+    rows.append(k, klen);
+    rows.append((const char *) buf, vs_uint32_t.write(buf, vlen) - buf);
+    rows.append(v, vlen);
+  }
+
+  // reads tuple, the latest version of its key, as of now. changed is set
+  // if its tid is from an epoch > prev_epoch, in which case value is read
+  // too (empty if deleted). returns false if the tuple was replaced (the
+  // new one is in the tree). caller is in an RCU region
+  bool
+  read_latest(const dbtuple *tuple, uint64_t prev_epoch,
+              uint64_t &tid, bool &changed, string &value)
+  {
+    for (;;) {
+      const dbtuple::version_t v = tuple->reader_stable_version(true);
+      if (!dbtuple::IsLatest(v))
+        return false;
+      tid = tuple->version;
+      // a tentative insert is only in the log once it commits
+      changed = tid != dbtuple::MAX_TID &&
+        transaction_proto2_static::EpochId(tid) > prev_epoch;
+      const size_t sz = tuple->size;
+      value.clear();
+      if (changed && !dbtuple::IsDeleting(v) && sz) {
+        if (dbtuple::IsCold(v))
+          cold_store::ReadValue(tuple, value);
+        else if (sz <= tuple->alloc_size)
+          value.assign((const char *) tuple->get_value_start(), sz);
+      }
+      if (tuple->reader_check_version(v) && sz <= tuple->alloc_size)
+        return true;
+    }
+  }
+
+  // collects the changed rows (see read_latest()) among up to ChunkNRows
+  // keys of a table's underlying btree, as a chunk at RowTids. the chunk
+  // ends early if the scan is holding back the tick
+  class delta_chunk_callback {
+  public:
+    delta_chunk_callback(uint64_t prev_epoch, string &rows)
+      : prev_epoch_(prev_epoch), rows_(&rows),
+        n_(0), nrows_(0), max_tid_(0), more_(false) {}
+
+    bool
+    operator()(const concurrent_btree::string_type &k,
+               concurrent_btree::value_type v)
+    {
+      last_key_.assign(k.data(), k.size());
+      if (!add(reinterpret_cast<const dbtuple *>(v), last_key_))
+        replaced_.push_back(last_key_);
+      more_ = ++n_ == txn_checkpointer::ChunkNRows ||
+        ticker::s_instance.is_holding_back_tick();
+      return !more_;
+    }
+
+    // returns false if tuple was replaced
+    bool
+    add(const dbtuple *tuple, const string &key)
+    {
+      uint64_t tid;
+      bool changed;
+      if (!read_latest(tuple, prev_epoch_, tid, changed, value_))
+        return false;
+      if (changed) {
+        append_row(*rows_, tid, key.data(), key.size(),
+                   value_.data(), value_.size());
+        nrows_++;
+        max_tid_ = max(max_tid_, tid);
+      }
+      return true;
+    }
+
+    // re-reads the keys whose tuples were replaced under the scan
+    void
+    add_replaced(concurrent_btree *btr)
+    {
+      for (auto &k : replaced_)
+        for (;;) {
+          concurrent_btree::value_type v = 0;
+          // if it is gone, its removal was journaled
+          if (!btr->search(varkey(k), v) ||
+              add(reinterpret_cast<const dbtuple *>(v), k))
+            break;
+        }
+    }
+
+    inline size_t nrows() const { return nrows_; }
+    inline uint64_t max_tid() const { return max_tid_; }
+    inline const string &last_key() const { return last_key_; }
+    inline bool more() const { return more_; }
+
+  private:
+    const uint64_t prev_epoch_;
+    string *rows_;
+    size_t n_;
+    size_t nrows_;
+    uint64_t max_tid_;
+    bool more_;
+    string last_key_;
+    string value_;
+    vector<string> replaced_;
+  };
+
+  inline string
+  image_fname(uint64_t seq, uint32_t id)
+  {
+    return "img." + to_string(seq) + "." + to_string(id);
+  }
+
+  // writes out a table_image, a chunk at a time
+  class image_writer {
+  public:
+    image_writer(int fd) : fd_(fd), off_(0), nrows_(0) {}
+
+    void
+    write_chunk(uint64_t tid, const string &rows)
+    {
+      serializer<uint32_t, true> vs_uint32_t;
+      const uint8_t *p = (const uint8_t *) rows.data();
+      const uint8_t * const end = p + rows.size();
+      while (p < end) {
+        uint32_t klen, vlen;
+        p = vs_uint32_t.read(p, &klen);
+        const uint8_t * const k = p;
+        p += klen;
+        p = vs_uint32_t.read(p, &vlen);
+        if (!(nrows_++ % txn_checkpointer::ImageBlockNRows))
+          index_.push_back(off_ + buf_.size());
+        append(&tid, sizeof(tid));
+        append(&klen, sizeof(klen));
+        append(&vlen, sizeof(vlen));
+        append(k, klen);
+        append(p, vlen);
+        p += vlen;
+      }
+      if (buf_.size() >= txn_checkpointer::BlockSize)
+        flush();
+    }
+
+    void
+    finish()
+    {
+      const uint64_t index_off = off_ + buf_.size();
+      append(index_.data(), index_.size() * sizeof(uint64_t));
+      const uint64_t nblocks = index_.size();
+      const uint64_t magic = txn_checkpointer::ImageMagic;
+      append(&nrows_, sizeof(nrows_));
+      append(&nblocks, sizeof(nblocks));
+      append(&index_off, sizeof(index_off));
+      append(&magic, sizeof(magic));
+      flush();
+    }
+
+  private:
+    inline void
+    append(const void *p, size_t n)
+    {
+      buf_.append((const char *) p, n);
+    }
+
+    void
+    flush()
+    {
+      if (fileutils::writeall(fd_, buf_.data(), buf_.size()) < 0) {
+        perror("write");
+        ALWAYS_ASSERT(false);
+      }
+      evt_checkpoint_bytes.inc(buf_.size());
+      off_ += buf_.size();
+      buf_.clear();
+    }
+
+    int fd_;
+    uint64_t off_; // written so far
+    uint64_t nrows_;
+    string buf_;
+    vector<uint64_t> index_;
+  };
+
+  void
+  sleep_us(uint64_t us)
+  {
+    const uint64_t sleep_ns = us * 1000;
+    struct timespec t;
+    t.tv_sec  = sleep_ns / ONE_SECOND_NS;
+    t.tv_nsec = sleep_ns % ONE_SECOND_NS;
+    nanosleep(&t, nullptr);
+  }
+
+  // writes m to dir/MANIFEST, atomically replacing the previous one
+  void
+  write_manifest(const string &dir, const txn_checkpointer::manifest &m)
+  {
+    const string manifest_fname = dir + "/MANIFEST";
+    const string tmp_fname = manifest_fname + ".tmp";
+    {
+      ostringstream buf;
+      buf << "seq " << m.seq_ << endl;
+      buf << "epoch " << m.epoch_ << endl;
+      if (m.image_)
+        buf << "format image" << endl;
+      for (auto &f : m.files_)
+        buf << "table " << f.first << " " << f.second << endl;
+      for (auto &d : m.deltas_) {
+        buf << "delta" << endl;
+        for (auto &f : d)
+          buf << "table " << f.first << " " << f.second << endl;
+      }
+      const string s = buf.str();
+      const int fd = open(tmp_fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+      if (fd == -1) {
+        perror("open");
+        ALWAYS_ASSERT(false);
+      }
+      if (fileutils::writeall(fd, s.data(), s.size()) < 0) {
+        perror("write");
+        ALWAYS_ASSERT(false);
+      }
+      sync_or_die(fd);
+      close(fd);
+    }
+    if (rename(tmp_fname.c_str(), manifest_fname.c_str()) == -1) {
+      perror("rename");
+      ALWAYS_ASSERT(false);
+    }
+    sync_dir(dir);
+  }
+
+  // unlinks the files of from which are not in to
+  void
+  unlink_files(const string &dir, const txn_checkpointer::manifest &from,
+               const txn_checkpointer::manifest &to)
+  {
+    set<string> keep;
+    for (auto &f : to.files_)
+      keep.insert(f.second);
+    for (auto &d : to.deltas_)
+      for (auto &f : d)
+        keep.insert(f.second);
+    auto drop = [&](const txn_checkpointer::file_list &files) {
+      for (auto &f : files)
+        if (!keep.count(f.second))
+          unlink((dir + "/" + f.second).c_str());
+    };
+    drop(from.files_);
+    for (auto &d : from.deltas_)
+      drop(d);
+  }
+
+  // the snapshot tid of a new read-only txn: everything committed in its
+  // epoch or before is already installed
+  uint64_t
+  current_snapshot_tid()
+  {
+    for (;;) {
+      checkpoint_traits::StringAllocator sa;
+      transaction_proto2<checkpoint_traits> t(
+          transaction_base::TXN_FLAG_READ_ONLY, sa);
+      const uint64_t tid = t.snapshot_tid();
+      t.abort();
+      if (likely(tid))
+        return tid;
+      // nothing is consistently readable yet
+      sleep_us(ticker::TickUsec());
+    }
+  }
+
+  // pins the snapshot of a read-only txn while the txn still runs (see
+  // transaction_proto2_static::PinSnapshot()), and returns its tid
+  uint64_t
+  pin_current_snapshot()
+  {
+    for (;;) {
+      checkpoint_traits::StringAllocator sa;
+      transaction_proto2<checkpoint_traits> t(
+          transaction_base::TXN_FLAG_READ_ONLY, sa);
+      const uint64_t tid = t.snapshot_tid();
+      if (likely(tid))
+        transaction_proto2_static::PinSnapshot(tid);
+      t.abort();
+      if (likely(tid))
+        return tid;
+      // nothing is consistently readable yet
+      sleep_us(ticker::TickUsec());
+    }
+  }
+
+  struct scoped_snapshot_unpin {
+    scoped_snapshot_unpin(uint64_t tid) : tid_(tid) {}
+    ~scoped_snapshot_unpin()
+    {
+      transaction_proto2_static::UnpinSnapshot(tid_);
+    }
+    const uint64_t tid_;
+  };
+
+  // sleeps long enough for nbytes written since start_us to stay within
+  // max_bytes_per_sec (0 for unlimited)
+  void
+  throttle_to(uint64_t max_bytes_per_sec, uint64_t start_us, uint64_t nbytes)
+  {
+    if (!max_bytes_per_sec)
+      return;
+    const uint64_t target_us = nbytes * 1000000 / max_bytes_per_sec;
+    const uint64_t elapsed_us = timer::cur_usec() - start_us;
+    if (elapsed_us < target_us)
+      sleep_us(target_us - elapsed_us);
+  }
+}
+
+txn_checkpointer::txn_checkpointer(
+    const string &dir,
+    const map<string, table_type *> &tables,
+    uint64_t interval_sec,
+    uint64_t max_bytes_per_sec,
+    bool image,
+    size_t max_deltas)
+  : dir_(dir), tables_(tables),
+    interval_sec_(interval_sec),
+    max_bytes_per_sec_(max_bytes_per_sec),
+    image_(image), max_deltas_(max_deltas),
+    seq_(0), own_last_(false), throttle_start_us_(0), throttle_nbytes_(0),
+    running_(true), ncheckpoints_(0), ndeltas_(0)
+{
+  ALWAYS_ASSERT(!image || !max_deltas);
+  if (mkdir(dir.c_str(), 0775) == -1 && errno != EEXIST) {
+    perror("mkdir");
+    ALWAYS_ASSERT(false);
+  }
+  if (ReadManifest(dir, last_))
+    seq_ = last_.seq_ + 1;
+  if (max_deltas) {
+    bool expected = false;
+    ALWAYS_ASSERT(g_journal_removals.compare_exchange_strong(expected, true));
+  }
+  thd_ = thread(&txn_checkpointer::loop, this);
+}
+
+txn_checkpointer::~txn_checkpointer()
+{
+  running_.store(false, memory_order_release);
+  thd_.join();
+  if (max_deltas_) {
+    g_journal_removals.store(false, memory_order_release);
+    ::lock_guard<spinlock> l(g_journal_lock);
+    vector<removal>().swap(g_journal);
+  }
+}
+
+void
+txn_checkpointer::loop()
+{
+  for (;;) {
+    // sleep in small increments so shutdown is not delayed by a whole
+    // interval
+    for (uint64_t slept_us = 0; slept_us < interval_sec_ * 1000000;
+         slept_us += ticker::TickUsec()) {
+      if (!running_.load(memory_order_acquire))
+        return;
+      sleep_us(ticker::TickUsec());
+    }
+    if (!checkpoint_once())
+      return;
+  }
+}
+
+void
+txn_checkpointer::throttle(uint64_t nbytes)
+{
+  throttle_nbytes_ += nbytes;
+  throttle_to(max_bytes_per_sec_, throttle_start_us_, throttle_nbytes_);
+}
+
+bool
+txn_checkpointer::write_table(
+    table_type *btr, const string &fname, uint64_t &first_snapshot_tid)
+{
+  const int fd = open(fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+  if (fd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  string rows, out;
+  image_writer iw(fd);
+  chunk_callback c(rows);
+  string start_key;
+  for (;;) {
+    if (!running_.load(memory_order_acquire)) {
+      close(fd);
+      return false;
+    }
+    uint64_t snapshot_tid;
+    c.reset();
+    {
+      checkpoint_traits::StringAllocator sa;
+      transaction_proto2<checkpoint_traits> t(
+          transaction_base::TXN_FLAG_READ_ONLY, sa);
+      snapshot_tid = t.snapshot_tid();
+      if (unlikely(!snapshot_tid)) {
+        // nothing is consistently readable yet
+        t.abort();
+        sleep_us(ticker::TickUsec());
+        continue;
+      }
+      try {
+        btr->search_range_call(t, start_key, nullptr, c);
+        t.commit(true);
+      } catch (transaction_abort_exception &ex) {
+        ++evt_checkpoint_chunk_retries;
+        continue;
+      }
+    }
+    if (!first_snapshot_tid || snapshot_tid < first_snapshot_tid)
+      first_snapshot_tid = snapshot_tid;
+    if (c.nrows()) {
+      if (image_) {
+        iw.write_chunk(snapshot_tid, rows);
+      } else {
+        out.clear();
+        encode_chunk(snapshot_tid, rows, out);
+        if (fileutils::writeall(fd, out.data(), out.size()) < 0) {
+          perror("write");
+          ALWAYS_ASSERT(false);
+        }
+        evt_checkpoint_bytes.inc(out.size());
+      }
+      evt_checkpoint_rows.inc(c.nrows());
+      throttle(rows.size());
+    }
+    if (!c.more())
+      break;
+    // the smallest key greater than the last one seen
+    start_key = c.last_key();
+    start_key.push_back('\0');
+  }
+  if (image_) {
+    iw.finish();
+  } else {
+    const uint32_t zero = 0;
+    if (fileutils::writeall(fd, (const char *) &zero, sizeof(zero)) < 0) {
+      perror("write");
+      ALWAYS_ASSERT(false);
+    }
+  }
+  sync_or_die(fd);
+  close(fd);
+  return true;
+}
+
+bool
+txn_checkpointer::write_delta(
+    table_type *btr, const string &fname, uint64_t prev_epoch,
+    uint64_t &max_tid)
+{
+  const int fd = open(fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+  if (fd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  concurrent_btree * const ubtr = btr->get_underlying_btree();
+  string rows, out;
+  auto flush = [&]() {
+    out.clear();
+    encode_chunk(RowTids, rows, out);
+    if (fileutils::writeall(fd, out.data(), out.size()) < 0) {
+      perror("write");
+      ALWAYS_ASSERT(false);
+    }
+    evt_checkpoint_bytes.inc(out.size());
+    throttle(rows.size());
+    rows.clear();
+  };
+
+  // the latest version of every key, not a snapshot: a row changed after the
+  // delta's epoch is in the log too, and replaying it again is harmless
+  string start_key;
+  for (;;) {
+    if (!running_.load(memory_order_acquire)) {
+      close(fd);
+      return false;
+    }
+    delta_chunk_callback c(prev_epoch, rows);
+    {
+      scoped_rcu_region guard;
+      ubtr->search_range(varkey(start_key), nullptr, c);
+      c.add_replaced(ubtr);
+    }
+    max_tid = max(max_tid, c.max_tid());
+    evt_checkpoint_delta_rows.inc(c.nrows());
+    if (rows.size() >= BlockSize)
+      flush();
+    if (!c.more())
+      break;
+    // the smallest key greater than the last one seen
+    start_key = c.last_key();
+    start_key.push_back('\0');
+  }
+
+  // a key the scan did not find was removed before it got there, and so
+  // was journaled by now. the other tables' removals stay in the journal,
+  // for their own deltas (of this checkpoint or, once theirs is written, of
+  // the next one)
+  vector<removal> &removals = pending_removals_[ubtr];
+  {
+    ::lock_guard<spinlock> l(g_journal_lock);
+    auto it = partition(g_journal.begin(), g_journal.end(),
+        [ubtr](const removal &r) { return r.btr_ != ubtr; });
+    move(it, g_journal.end(), back_inserter(removals));
+    g_journal.erase(it, g_journal.end());
+  }
+  for (auto &r : removals)
+    if (transaction_proto2_static::EpochId(r.tid_) > prev_epoch) {
+      append_row(rows, r.tid_, r.key_.data(), r.key_.size(), nullptr, 0);
+      max_tid = max(max_tid, r.tid_);
+      ++evt_checkpoint_delta_removals;
+    }
+  if (!rows.empty())
+    flush();
+
+  const uint32_t zero = 0;
+  if (fileutils::writeall(fd, (const char *) &zero, sizeof(zero)) < 0) {
+    perror("write");
+    ALWAYS_ASSERT(false);
+  }
+  sync_or_die(fd);
+  close(fd);
+  return true;
+}
+
+txn_checkpointer::manifest
+txn_checkpointer::merge_deltas(const manifest &m, uint64_t seq)
+{
+  manifest ret;
+  ret.seq_ = seq;
+  ret.epoch_ = m.epoch_;
+  for (auto &f : m.files_) {
+    // the deltas are small next to the full checkpoint, so they are put
+    // together in memory, and merged into its rows (which are in key order)
+    // as they stream by
+    map<string, pair<uint64_t, string>> changed;
+    struct delta_callback : public row_callback {
+      delta_callback(map<string, pair<uint64_t, string>> &changed)
+        : changed_(&changed) {}
+      virtual void
+      invoke(uint64_t tid,
+             const uint8_t *k, size_t klen,
+             const uint8_t *v, size_t vlen)
+      {
+        pair<uint64_t, string> &e =
+          (*changed_)[string((const char *) k, klen)];
+        if (tid >= e.first) {
+          e.first = tid;
+          e.second.assign((const char *) v, vlen);
+        }
+      }
+      map<string, pair<uint64_t, string>> *changed_;
+    };
+    delta_callback dc(changed);
+    for (auto &d : m.deltas_)
+      for (auto &df : d) {
+        if (df.first != f.first)
+          continue;
+        const string fname = dir_ + "/" + df.second;
+        ALWAYS_ASSERT(VisitFile(fname, dc));
+      }
+
+    const string fname = table_fname(seq, f.first);
+    const int fd = open((dir_ + "/" + fname).c_str(),
+                        O_CREAT|O_WRONLY|O_TRUNC, 0664);
+    if (fd == -1) {
+      perror("open");
+      ALWAYS_ASSERT(false);
+    }
+    struct merge_callback : public row_callback {
+      merge_callback(txn_checkpointer *ckp, int fd,
+                     map<string, pair<uint64_t, string>> &changed)
+        : ckp_(ckp), fd_(fd), changed_(&changed), it_(changed.begin()) {}
+      virtual void
+      invoke(uint64_t tid,
+             const uint8_t *k, size_t klen,
+             const uint8_t *v, size_t vlen)
+      {
+        const string key((const char *) k, klen);
+        while (it_ != changed_->end() && it_->first < key)
+          add_changed();
+        if (it_ != changed_->end() && it_->first == key &&
+            it_->second.first >= tid) {
+          add_changed();
+          return;
+        }
+        if (it_ != changed_->end() && it_->first == key)
+          ++it_;
+        add(tid, key, (const char *) v, vlen);
+      }
+      void
+      finish()
+      {
+        while (it_ != changed_->end())
+          add_changed();
+        if (!rows_.empty())
+          flush();
+        const uint32_t zero = 0;
+        if (fileutils::writeall(fd_, (const char *) &zero, sizeof(zero)) < 0) {
+          perror("write");
+          ALWAYS_ASSERT(false);
+        }
+      }
+      // a deleted row has nothing older left to hide
+      void
+      add_changed()
+      {
+        if (!it_->second.second.empty())
+          add(it_->second.first, it_->first,
+              it_->second.second.data(), it_->second.second.size());
+        ++it_;
+      }
+      void
+      add(uint64_t tid, const string &key, const char *v, size_t vlen)
+      {
+        append_row(rows_, tid, key.data(), key.size(), v, vlen);
+        if (rows_.size() >= BlockSize)
+          flush();
+      }
+      void
+      flush()
+      {
+        out_.clear();
+        encode_chunk(RowTids, rows_, out_);
+        if (fileutils::writeall(fd_, out_.data(), out_.size()) < 0) {
+          perror("write");
+          ALWAYS_ASSERT(false);
+        }
+        evt_checkpoint_bytes.inc(out_.size());
+        ckp_->throttle(rows_.size());
+        rows_.clear();
+      }
+      txn_checkpointer *ckp_;
+      int fd_;
+      map<string, pair<uint64_t, string>> *changed_;
+      map<string, pair<uint64_t, string>>::iterator it_;
+      string rows_, out_;
+    };
+    merge_callback mc(this, fd, changed);
+    ALWAYS_ASSERT(VisitFile(dir_ + "/" + f.second, mc));
+    mc.finish();
+    sync_or_die(fd);
+    close(fd);
+    ret.files_.emplace_back(f.first, fname);
+  }
+  ++evt_checkpoint_merges;
+  return ret;
+}
+
+bool
+txn_checkpointer::checkpoint_once()
+{
+  timer t;
+  const uint64_t seq = seq_++;
+  throttle_start_us_ = timer::cur_usec();
+  throttle_nbytes_ = 0;
+
+  // a delta needs the previous checkpoint to be this checkpointer's own: a
+  // key deleted before a restart left nothing behind to journal
+  const bool delta = max_deltas_ && own_last_;
+  manifest m;
+  m.seq_ = seq;
+  m.image_ = image_;
+  uint64_t first_snapshot_tid = 0, last_snapshot_tid = 0;
+  if (delta) {
+    m.files_ = last_.files_;
+    m.deltas_ = last_.deltas_;
+    m.deltas_.emplace_back();
+    // the delta holds at least everything committed up to here
+    first_snapshot_tid = last_snapshot_tid = current_snapshot_tid();
+  } else if (max_deltas_) {
+    // a full checkpoint has no use for what was journaled before it
+    pending_removals_.clear();
+    ::lock_guard<spinlock> l(g_journal_lock);
+    g_journal.clear();
+  }
+  set<uint32_t> seen;
+  for (auto &p : tables_) {
+    // the same table can be given under multiple names
+    const uint32_t id = txn_logger::TableIdFromName(p.second->get_name());
+    if (!seen.insert(id).second)
+      continue;
+    const string fname = image_ ? image_fname(seq, id) : table_fname(seq, id);
+    if (delta) {
+      uint64_t max_tid = 0;
+      if (!write_delta(p.second, dir_ + "/" + fname, last_.epoch_, max_tid))
+        return false;
+      last_snapshot_tid = max(last_snapshot_tid, max_tid);
+      m.deltas_.back().emplace_back(id, fname);
+      continue;
+    }
+    uint64_t table_snapshot_tid = 0;
+    if (!write_table(p.second, dir_ + "/" + fname, table_snapshot_tid))
+      return false;
+    if (!first_snapshot_tid || table_snapshot_tid < first_snapshot_tid)
+      first_snapshot_tid = table_snapshot_tid;
+    last_snapshot_tid = max(last_snapshot_tid, table_snapshot_tid);
+    m.files_.emplace_back(id, fname);
+  }
+  m.epoch_ = transaction_proto2_static::EpochId(first_snapshot_tid);
+
+  // recovery replays the log on top of the checkpoint, so do not publish the
+  // checkpoint until the log has caught up with everything it contains
+  if (txn_logger::IsPersistenceEnabled()) {
+    const uint64_t last_epoch =
+      transaction_proto2_static::EpochId(last_snapshot_tid);
+    while (txn_logger::persistent_epoch() < last_epoch) {
+      if (!running_.load(memory_order_acquire))
+        return false;
+      sleep_us(ticker::TickUsec());
+    }
+  }
+
+  write_manifest(dir_, m);
+  // the deltas hold every removal taken from the journal, until one is
+  // published they are kept to be written again
+  pending_removals_.clear();
+
+  // once there are enough deltas, they are folded into a new full checkpoint
+  if (delta && m.deltas_.size() >= max_deltas_) {
+    manifest merged = merge_deltas(m, seq_++);
+    write_manifest(dir_, merged);
+    unlink_files(dir_, m, merged);
+    m = move(merged);
+  }
+
+  // anything of the previous checkpoint not carried over is now garbage
+  unlink_files(dir_, last_, m);
+  last_ = m;
+  own_last_ = true;
+  if (delta)
+    ndeltas_.fetch_add(1, memory_order_acq_rel);
+
+  g_last_checkpoint_epoch.store(m.epoch_, memory_order_release);
+  // the log is only needed from the checkpoint's epoch onwards now
+  if (txn_logger::IsPersistenceEnabled())
+    txn_logger::AdvanceTruncationEpoch(m.epoch_);
+  ncheckpoints_.fetch_add(1, memory_order_acq_rel);
+  evt_avg_checkpoint_time_ms.offer(t.lap_ms());
+  return true;
+}
+
+bool
+txn_checkpointer::ReadManifest(const string &dir, manifest &m)
+{
+  ifstream ifs(dir + "/MANIFEST");
+  if (!ifs)
+    return false;
+  manifest ret;
+  bool saw_seq = false, saw_epoch = false;
+  string tok;
+  while (ifs >> tok) {
+    if (tok == "seq") {
+      ifs >> ret.seq_;
+      saw_seq = true;
+    } else if (tok == "epoch") {
+      ifs >> ret.epoch_;
+      saw_epoch = true;
+    } else if (tok == "format") {
+      string fmt;
+      ifs >> fmt;
+      if (fmt == "image")
+        ret.image_ = true;
+      else if (fmt != "lz4")
+        return false;
+    } else if (tok == "table") {
+      uint32_t id;
+      string fname;
+      ifs >> id >> fname;
+      (ret.deltas_.empty() ? ret.files_ : ret.deltas_.back())
+        .emplace_back(id, fname);
+    } else if (tok == "delta") {
+      ret.deltas_.emplace_back();
+    } else {
+      return false;
+    }
+    if (!ifs)
+      return false;
+  }
+  if (!saw_seq || !saw_epoch || (ret.image_ && !ret.deltas_.empty()))
+    return false;
+  m = move(ret);
+  return true;
+}
+
+bool
+txn_checkpointer::VisitFile(const string &fname, row_callback &callback)
+{
+  const int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !st.st_size) {
+    close(fd);
+    return false;
+  }
+  void *px = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (px == MAP_FAILED)
+    return false;
+  madvise(px, st.st_size, MADV_SEQUENTIAL);
+
+  serializer<uint32_t, true> vs_uint32_t;
+  serializer<uint32_t, false> s_uint32_t;
+  serializer<uint64_t, false> s_uint64_t;
+  vector<uint8_t> raw(BlockSize);
+  const uint8_t *p = (const uint8_t *) px;
+  const uint8_t * const end = p + st.st_size;
+  bool ok = false;
+  for (;;) {
+    uint32_t clen;
+    if (!(p = s_uint32_t.failsafe_read(p, end - p, &clen)))
+      break;
+    if (!clen) {
+      ok = true;
+      break;
+    }
+    if (size_t(end - p) < clen)
+      break;
+    const int ret = LZ4_decompress_safe(
+        (const char *) p, (char *) &raw[0], clen, raw.size());
+    if (ret < 0)
+      break;
+    p += clen;
+    const uint8_t *q = &raw[0];
+    const uint8_t * const qend = q + ret;
+    uint64_t tid;
+    uint32_t nrows;
+    if (!(q = s_uint64_t.failsafe_read(q, qend - q, &tid)) ||
+        !(q = vs_uint32_t.failsafe_read(q, qend - q, &nrows)))
+      break;
+    const bool row_tids = tid == RowTids;
+    uint32_t i;
+    for (i = 0; i < nrows; i++) {
+      uint32_t klen, vlen;
+      if (row_tids && !(q = s_uint64_t.failsafe_read(q, qend - q, &tid)))
+        break;
+      if (!(q = vs_uint32_t.failsafe_read(q, qend - q, &klen)) ||
+          size_t(qend - q) < klen)
+        break;
+      const uint8_t * const k = q;
+      q += klen;
+      if (!(q = vs_uint32_t.failsafe_read(q, qend - q, &vlen)) ||
+          size_t(qend - q) < vlen)
+        break;
+      callback.invoke(tid, k, klen, q, vlen);
+      q += vlen;
+    }
+    if (i != nrows)
+      break;
+  }
+  munmap(px, st.st_size);
+  return ok;
+}
+
+void
+txn_checkpointer::JournalRemoval(const concurrent_btree *btr, const varkey &k,
+                                 uint64_t tid)
+{
+  removal r;
+  r.btr_ = btr;
+  r.key_.assign((const char *) k.data(), k.size());
+  r.tid_ = tid;
+  ::lock_guard<spinlock> l(g_journal_lock);
+  g_journal.push_back(move(r));
+}
+
+bool
+txn_checkpointer::Export(int fd,
+                         const map<string, table_type *> &tables,
+                         uint64_t max_bytes_per_sec,
+                         uint64_t *snapshot_tid)
+{
+  // the same table can be given under multiple names
+  vector<pair<uint32_t, table_type *>> todo;
+  set<uint32_t> seen;
+  for (auto &p : tables) {
+    const uint32_t id = txn_logger::TableIdFromName(p.second->get_name());
+    if (seen.insert(id).second)
+      todo.emplace_back(id, p.second);
+  }
+
+  const uint64_t tid = pin_current_snapshot();
+  scoped_snapshot_unpin unpin(tid);
+  if (snapshot_tid)
+    *snapshot_tid = tid;
+
+  const uint64_t start_us = timer::cur_usec();
+  uint64_t nbytes = 0;
+  string out;
+  auto flush = [&]() -> bool {
+    if (fileutils::writeall(fd, out.data(), out.size()) < 0)
+      return false;
+    nbytes += out.size();
+    evt_backup_bytes.inc(out.size());
+    out.clear();
+    throttle_to(max_bytes_per_sec, start_us, nbytes);
+    return true;
+  };
+
+  const uint64_t magic = BackupMagic;
+  const uint32_t ntables = todo.size();
+  out.append((const char *) &magic, sizeof(magic));
+  out.append((const char *) &tid, sizeof(tid));
+  out.append((const char *) &ntables, sizeof(ntables));
+  if (!flush())
+    return false;
+
+  string rows;
+  chunk_callback c(rows);
+  for (auto &p : todo) {
+    const string &name = p.second->get_name();
+    const uint32_t namelen = name.size();
+    out.append((const char *) &p.first, sizeof(p.first));
+    out.append((const char *) &namelen, sizeof(namelen));
+    out.append(name);
+    string start_key;
+    for (;;) {
+      c.reset();
+      {
+        checkpoint_traits::StringAllocator sa;
+        transaction_proto2<checkpoint_traits> t(
+            transaction_base::TXN_FLAG_READ_ONLY, sa);
+        t.set_snapshot_tid(tid);
+        try {
+          p.second->search_range_call(t, start_key, nullptr, c);
+          t.commit(true);
+        } catch (transaction_abort_exception &ex) {
+          ++evt_backup_chunk_retries;
+          continue;
+        }
+      }
+      // outside of the txn, so a slow fd does not hold up the RCU region
+      if (c.nrows()) {
+        encode_chunk(tid, rows, out);
+        evt_backup_rows.inc(c.nrows());
+      }
+      if (!flush())
+        return false;
+      if (!c.more())
+        break;
+      // the smallest key greater than the last one seen
+      start_key = c.last_key();
+      start_key.push_back('\0');
+    }
+    const uint32_t zero = 0;
+    out.append((const char *) &zero, sizeof(zero));
+  }
+  return flush();
+}
+
+bool
+txn_checkpointer::Restore(int fd, const string &dir)
+{
+  manifest m;
+  if (ReadManifest(dir, m)) {
+    cerr << "[ERROR] " << dir << " already holds a checkpoint" << endl;
+    return false;
+  }
+  if (mkdir(dir.c_str(), 0775) == -1 && errno != EEXIST) {
+    perror("mkdir");
+    ALWAYS_ASSERT(false);
+  }
+  uint64_t magic, tid;
+  uint32_t ntables;
+  if (fileutils::readall(fd, (char *) &magic, sizeof(magic)) ||
+      magic != BackupMagic ||
+      fileutils::readall(fd, (char *) &tid, sizeof(tid)) ||
+      fileutils::readall(fd, (char *) &ntables, sizeof(ntables)))
+    return false;
+  m.seq_ = 0;
+  m.epoch_ = transaction_proto2_static::EpochId(tid);
+
+  // each table's blocks are copied as they are into its checkpoint file
+  const size_t max_clen = LZ4_compressBound(BlockSize);
+  vector<char> buf(max_clen);
+  for (uint32_t i = 0; i < ntables; i++) {
+    uint32_t id, namelen;
+    string name;
+    if (fileutils::readall(fd, (char *) &id, sizeof(id)) ||
+        fileutils::readall(fd, (char *) &namelen, sizeof(namelen)) ||
+        namelen > buf.size() ||
+        fileutils::readall(fd, &buf[0], namelen))
+      return false;
+    name.assign(&buf[0], namelen);
+    if (id != txn_logger::TableIdFromName(name))
+      return false;
+    const string fname = table_fname(m.seq_, id);
+    const int ofd = open((dir + "/" + fname).c_str(),
+                         O_CREAT|O_WRONLY|O_TRUNC, 0664);
+    if (ofd == -1) {
+      perror("open");
+      ALWAYS_ASSERT(false);
+    }
+    bool ok = false;
+    for (;;) {
+      uint32_t clen;
+      if (fileutils::readall(fd, (char *) &clen, sizeof(clen)) ||
+          clen > max_clen ||
+          (clen && fileutils::readall(fd, &buf[0], clen)))
+        break;
+      if (fileutils::writeall(ofd, (const char *) &clen, sizeof(clen)) < 0 ||
+          fileutils::writeall(ofd, &buf[0], clen) < 0) {
+        perror("write");
+        ALWAYS_ASSERT(false);
+      }
+      if (!clen) {
+        ok = true;
+        break;
+      }
+    }
+    if (ok)
+      sync_or_die(ofd);
+    close(ofd);
+    if (!ok)
+      return false;
+    m.files_.emplace_back(id, fname);
+  }
+  write_manifest(dir, m);
+  return true;
+}
+
+txn_checkpointer::table_image::~table_image()
+{
+  if (p_)
+    munmap((void *) p_, sz_);
+}
+
+bool
+txn_checkpointer::table_image::map(const string &fname)
+{
+  ALWAYS_ASSERT(!p_);
+  const int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  const size_t footer_len = 4 * sizeof(uint64_t);
+  if (fstat(fd, &st) == -1 || size_t(st.st_size) < footer_len) {
+    close(fd);
+    return false;
+  }
+  void *px = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (px == MAP_FAILED)
+    return false;
+  p_ = (const uint8_t *) px;
+  sz_ = st.st_size;
+
+  uint64_t footer[4];
+  memcpy(footer, p_ + sz_ - footer_len, footer_len);
+  const uint64_t index_off = footer[2];
+  if (footer[3] != ImageMagic ||
+      index_off > sz_ - footer_len ||
+      (sz_ - footer_len - index_off) / sizeof(uint64_t) != footer[1] ||
+      footer[1] != (footer[0] + ImageBlockNRows - 1) / ImageBlockNRows) {
+    munmap(px, sz_);
+    p_ = nullptr;
+    return false;
+  }
+  nrows_ = footer[0];
+  nblocks_ = footer[1];
+  index_ = (const uint64_t *) (p_ + index_off);
+  for (uint64_t i = 0; i < nblocks_; i++)
+    if (index_[i] >= index_off) {
+      munmap(px, sz_);
+      p_ = nullptr;
+      return false;
+    }
+  return true;
+}
+
+const uint8_t *
+txn_checkpointer::table_image::block_row(uint64_t i) const
+{
+  return p_ + index_[i / ImageBlockNRows];
+}
+
+const uint8_t *
+txn_checkpointer::table_image::read_row(const uint8_t *p, row &r)
+{
+  memcpy(&r.tid_, p, sizeof(r.tid_));
+  p += sizeof(r.tid_);
+  memcpy(&r.klen_, p, sizeof(r.klen_));
+  p += sizeof(r.klen_);
+  memcpy(&r.vlen_, p, sizeof(r.vlen_));
+  p += sizeof(r.vlen_);
+  r.k_ = p;
+  p += r.klen_;
+  r.v_ = p;
+  return p + r.vlen_;
+}
+
+static inline int
+compare_keys(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen)
+{
+  const int ret = memcmp(a, b, min(alen, blen));
+  if (ret)
+    return ret;
+  return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+bool
+txn_checkpointer::table_image::find(const uint8_t *k, size_t klen, row &r) const
+{
+  // the last block whose first key is <= k
+  uint64_t lo = 0, hi = nblocks_;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    row first;
+    read_row(p_ + index_[mid], first);
+    if (compare_keys(first.k_, first.klen_, k, klen) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (!lo)
+    return false;
+  const uint64_t block = lo - 1;
+  const uint64_t n =
+    min<uint64_t>(ImageBlockNRows, nrows_ - block * ImageBlockNRows);
+  const uint8_t *p = p_ + index_[block];
+  for (uint64_t i = 0; i < n; i++) {
+    p = read_row(p, r);
+    const int c = compare_keys(r.k_, r.klen_, k, klen);
+    if (!c)
+      return true;
+    if (c > 0)
+      return false;
+  }
+  return false;
+}
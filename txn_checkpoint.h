@@ -0,0 +1,295 @@
+#ifndef _NDB_TXN_CHECKPOINT_H_
+#define _NDB_TXN_CHECKPOINT_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+
+#include "txn_proto2_impl.h"
+
+/**
+ * Fuzzy checkpoints of txn_btrees, taken with read-only snapshot txns.
+ *
+ * Each table is scanned in chunks of at most ChunkNRows rows. Every chunk is
+ * its own read-only txn (so the RCU region, and therefore GC, is never held
+ * up for long), and is written out together with the snapshot TID it was
+ * read at. Since recovery keeps the highest TID write per key, replaying the
+ * log from the epoch of the *first* chunk's snapshot onwards on top of the
+ * checkpoint yields a consistent state, even though later chunks were read
+ * at later snapshots.
+ *
+ * A checkpoint lives in a directory:
+ *   <dir>/ckp.<seq>.<table id>   one per table, a sequence of
+ *                                [uint32_t clen][lz4 data] blocks
+ *                                terminated by a zero clen
+ *   <dir>/MANIFEST               the last complete checkpoint
+ *
+ * Each uncompressed block is [snapshot tid (8 bytes)][nrows (varint)]
+ * followed by nrows [klen (varint)][key][vlen (varint)][value] rows. The
+ * MANIFEST is written (and renamed into place) only after every table file
+ * is durable, so a crash mid-checkpoint leaves the previous one intact.
+ *
+ * Completing a checkpoint allows the logger to recycle log segments which
+ * the checkpoint covers, so every logged table should be checkpointed.
+ *
+ * An image checkpoint (MANIFEST line "format image") instead writes each
+ * table as a table_image, which recovery maps and bulk loads (see
+ * txn_log_replayer) rather than re-inserting every row with txns.
+ *
+ * An incremental checkpoint (a delta) only writes the rows written since
+ * the previous checkpoint's epoch, each versioned by its own tid (in blocks
+ * whose snapshot tid is RowTids, where every row starts with its tid), and
+ * rows deleted since as empty values. Keys removed from the tree by GC
+ * before the delta gets to them are journaled (see JournalRemoval()). The
+ * MANIFEST lists the deltas after the full checkpoint they build on, each
+ * starting with a "delta" line, and recovery loads them all, the highest tid
+ * of a key winning as usual. Once there are max_deltas of them, they are
+ * merged with the full checkpoint into a new one, from the files alone.
+ */
+class txn_checkpointer {
+public:
+  typedef txn_btree<transaction_proto2> table_type;
+
+  static const size_t ChunkNRows = 1024;
+  static const size_t BlockSize = (1 << 17); // uncompressed bytes per block
+
+  // rows per block of a table_image
+  static const size_t ImageBlockNRows = 256;
+
+  // the snapshot tid of a block whose rows each carry their own tid
+  static const uint64_t RowTids = 0;
+
+  typedef std::vector<std::pair<uint32_t, std::string>> file_list; // (table id, file)
+
+  struct manifest {
+    uint64_t seq_;
+    uint64_t epoch_; // replay the log from epochs > epoch_
+    bool image_;     // the files are table_images
+    file_list files_;
+    std::vector<file_list> deltas_; // on top of files_, oldest first
+    manifest() : seq_(0), epoch_(0), image_(false) {}
+  };
+
+  /**
+   * A table of an image checkpoint, mapped read-only. The file is the
+   * table's rows, uncompressed and in key order, followed by an index of
+   * where each block of ImageBlockNRows rows starts, and a footer:
+   *
+   *   [row]*                   [tid (8)][klen (4)][vlen (4)][key][value]
+   *   [block offset (8)]*      one per block
+   *   [nrows (8)][nblocks (8)][index offset (8)][ImageMagic (8)]
+   *
+   * All offsets are from the start of the file, so the image can be mapped
+   * anywhere, and read in place: row i is the (i % ImageBlockNRows)-th row of
+   * block (i / ImageBlockNRows), so threads can each take a range of rows
+   * without a pass over the ones before it, and a key is found by a binary
+   * search over the first keys of the blocks
+   */
+  class table_image {
+  public:
+    struct row {
+      uint64_t tid_;
+      const uint8_t *k_;
+      uint32_t klen_;
+      const uint8_t *v_;
+      uint32_t vlen_;
+    };
+
+    table_image()
+      : p_(nullptr), sz_(0), nrows_(0), nblocks_(0), index_(nullptr) {}
+    ~table_image();
+
+    table_image(const table_image &) = delete;
+    table_image(table_image &&) = delete;
+    table_image &operator=(const table_image &) = delete;
+
+    // returns false if the file is missing or corrupt
+    bool map(const std::string &fname);
+
+    inline uint64_t nrows() const { return nrows_; }
+
+    // calls f(i, row) for each row i in [begin, end)
+    template <typename F>
+    void
+    visit(uint64_t begin, uint64_t end, F f) const
+    {
+      INVARIANT(begin <= end && end <= nrows_);
+      if (begin == end)
+        return;
+      const uint8_t *p = nullptr;
+      for (uint64_t i = begin; i < end; i++) {
+        if (!p || !(i % ImageBlockNRows))
+          p = block_row(i);
+        row r;
+        p = read_row(p, r);
+        f(i, r);
+      }
+    }
+
+    // returns false if the image has no row for key k
+    bool find(const uint8_t *k, size_t klen, row &r) const;
+
+  private:
+    // the start of row i
+    const uint8_t *block_row(uint64_t i) const;
+    static const uint8_t *read_row(const uint8_t *p, row &r);
+
+    const uint8_t *p_;
+    size_t sz_;
+    uint64_t nrows_;
+    uint64_t nblocks_;
+    const uint64_t *index_;
+  };
+
+  static const uint64_t ImageMagic = 0x73696c6f696d6731ULL;
+
+  // starts a background thread which checkpoints the given tables into dir
+  // every interval_sec seconds. the scan rate is limited to max_bytes_per_sec
+  // (0 for unlimited) so the checkpointer does not compete with workers.
+  // with image, the checkpoints are image checkpoints. with max_deltas, the
+  // checkpoints after this checkpointer's first full one are deltas, merged
+  // every max_deltas of them. only one checkpointer can take deltas at once
+  txn_checkpointer(const std::string &dir,
+                   const std::map<std::string, table_type *> &tables,
+                   uint64_t interval_sec,
+                   uint64_t max_bytes_per_sec,
+                   bool image = false,
+                   size_t max_deltas = 0);
+
+  // stops (and waits for) the background thread. an in-progress checkpoint
+  // is abandoned
+  ~txn_checkpointer();
+
+  txn_checkpointer(const txn_checkpointer &) = delete;
+  txn_checkpointer(txn_checkpointer &&) = delete;
+  txn_checkpointer &operator=(const txn_checkpointer &) = delete;
+
+  // returns false if the checkpoint was abandoned
+  bool checkpoint_once();
+
+  inline uint64_t
+  ncheckpoints() const
+  {
+    return ncheckpoints_.load(std::memory_order_acquire);
+  }
+
+  inline uint64_t
+  ndeltas() const
+  {
+    return ndeltas_.load(std::memory_order_acquire);
+  }
+
+  // epoch of the last completed checkpoint by any checkpointer, 0 if none
+  static inline uint64_t
+  LastCheckpointEpoch()
+  {
+    return g_last_checkpoint_epoch.load(std::memory_order_acquire);
+  }
+
+  // returns false if dir does not contain a complete checkpoint
+  static bool ReadManifest(const std::string &dir, manifest &m);
+
+  struct row_callback {
+    virtual ~row_callback() {}
+    virtual void invoke(uint64_t tid,
+                        const uint8_t *k, size_t klen,
+                        const uint8_t *v, size_t vlen) = 0;
+  };
+
+  // visits every row of a checkpoint table file. returns false if the file
+  // is missing or corrupt
+  static bool VisitFile(const std::string &fname, row_callback &callback);
+
+  // called by GC just before it removes the deleted key k, deleted at tid,
+  // from btr, while a checkpointer takes deltas
+  static inline bool
+  IsJournalingRemovals()
+  {
+    return g_journal_removals.load(std::memory_order_acquire);
+  }
+  static void JournalRemoval(const concurrent_btree *btr, const varkey &k,
+                             uint64_t tid);
+
+  struct removal {
+    const concurrent_btree *btr_;
+    std::string key_;
+    uint64_t tid_;
+  };
+
+  static const uint64_t BackupMagic = 0x73696c6f62616b31ULL;
+
+  /**
+   * Streams a transactionally consistent copy of tables to fd (a file, pipe
+   * or socket) without quiescing anything: every table is read at one
+   * snapshot, which stays pinned until the export is done (see
+   * transaction_proto2_static::PinSnapshot()). Like a checkpoint, each
+   * table is read in chunks of ChunkNRows rows, each its own read-only txn,
+   * and written out at no more than max_bytes_per_sec (0 for unlimited). The
+   * stream is
+   *
+   *   [BackupMagic (8)][snapshot tid (8)][ntables (4)]
+   *   per table: [table id (4)][name length (4)][name]
+   *              [uint32_t clen][lz4 data] blocks, terminated by a zero clen
+   *
+   * where the blocks are those of a checkpoint table file, so Restore()
+   * turns the stream back into a checkpoint. Returns false if fd could not
+   * be written to
+   */
+  static bool Export(int fd,
+                     const std::map<std::string, table_type *> &tables,
+                     uint64_t max_bytes_per_sec = 0,
+                     uint64_t *snapshot_tid = nullptr);
+
+  // reads a stream written by Export() from fd into a new checkpoint in dir,
+  // which recovery then loads like any other (replaying the log from the
+  // snapshot's epoch on top). returns false if the stream is corrupt, or
+  // dir already holds a checkpoint
+  static bool Restore(int fd, const std::string &dir);
+
+private:
+  void loop();
+
+  // returns false if abandoned
+  bool write_table(table_type *btr, const std::string &fname,
+                   uint64_t &first_snapshot_tid);
+
+  typedef std::map<const concurrent_btree *, std::vector<removal>> removal_map;
+
+  // writes the rows of btr changed in epochs > prev_epoch, and the removals
+  // of its keys, taking those journaled since into pending_removals_.
+  // max_tid is the newest row written. returns false if abandoned
+  bool write_delta(table_type *btr, const std::string &fname,
+                   uint64_t prev_epoch, uint64_t &max_tid);
+
+  // writes the full checkpoint which m (with deltas) adds up to as seq
+  manifest merge_deltas(const manifest &m, uint64_t seq);
+
+  void throttle(uint64_t nbytes);
+
+  const std::string dir_;
+  const std::map<std::string, table_type *> tables_;
+  const uint64_t interval_sec_;
+  const uint64_t max_bytes_per_sec_;
+  const bool image_;
+  const size_t max_deltas_;
+
+  uint64_t seq_;
+  manifest last_;  // the current checkpoint in dir_
+  bool own_last_;  // last_ was taken by this checkpointer (deltas need it)
+  removal_map pending_removals_; // taken from the journal by deltas not
+                                // yet published
+  uint64_t throttle_start_us_;
+  uint64_t throttle_nbytes_;
+
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> ncheckpoints_;
+  std::atomic<uint64_t> ndeltas_;
+  std::thread thd_;
+
+  static std::atomic<uint64_t> g_last_checkpoint_epoch;
+  static std::atomic<bool> g_journal_removals;
+};
+
+#endif /* _NDB_TXN_CHECKPOINT_H_ */
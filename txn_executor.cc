@@ -0,0 +1,169 @@
+#include "txn_executor.h"
+#include "core.h"
+#include "counter.h"
+#include "lockguard.h"
+#include "rcu.h"
+
+using namespace std;
+
+static event_counter evt_txn_executor_tasks("txn_executor_tasks");
+static event_counter evt_txn_executor_steals("txn_executor_steals");
+static event_counter evt_txn_executor_sleeps("txn_executor_sleeps");
+
+__thread const txn_executor *txn_executor::tl_executor = nullptr;
+__thread int txn_executor::tl_worker_id = -1;
+
+txn_executor::txn_executor(size_t nworkers,
+                           bool pin_cpus,
+                           function<void()> thread_init,
+                           function<void()> thread_end)
+  : pin_cpus_(pin_cpus),
+    thread_init_(thread_init),
+    thread_end_(thread_end),
+    npending_(0),
+    nidle_(0),
+    next_worker_(0),
+    stopping_(false),
+    stopped_(false)
+{
+  ALWAYS_ASSERT(nworkers > 0);
+  for (size_t i = 0; i < nworkers; i++)
+    workers_.emplace_back(new worker);
+  for (size_t i = 0; i < nworkers; i++)
+    workers_[i]->thd_ = thread(&txn_executor::run_worker, this, i);
+}
+
+txn_executor::~txn_executor()
+{
+  stop();
+}
+
+void
+txn_executor::submit(task_t task, int hint, bool pinned)
+{
+  INVARIANT(!stopping_.load(memory_order_acquire));
+  INVARIANT(!pinned || hint != NoHint);
+  size_t id;
+  if (hint != NoHint)
+    id = size_t(hint) % workers_.size();
+  else if (current_worker() != -1)
+    id = current_worker();
+  else
+    id = next_worker_.fetch_add(1, memory_order_relaxed) % workers_.size();
+  worker &w = *workers_[id];
+  {
+    ::lock_guard<spinlock> l(w.lock_);
+    if (pinned) {
+      w.pinned_.emplace_back(move(task));
+    } else {
+      w.shared_.emplace_back(move(task));
+      w.nshared_.fetch_add(1, memory_order_release);
+    }
+  }
+  npending_.fetch_add(1, memory_order_seq_cst);
+  // pairs with the idle worker's ++nidle_ then load of npending_: either it
+  // sees our task, or we see it idle
+  if (nidle_.load(memory_order_seq_cst)) {
+    std::lock_guard<std::mutex> l(mutex_);
+    // pinned tasks can only be run by one worker, which we can't wake alone
+    if (pinned)
+      cv_.notify_all();
+    else
+      cv_.notify_one();
+  }
+}
+
+void
+txn_executor::stop()
+{
+  if (stopped_)
+    return;
+  stopped_ = true;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    stopping_.store(true, memory_order_release);
+  }
+  cv_.notify_all();
+  for (auto &w : workers_)
+    w->thd_.join();
+  INVARIANT(!npending_.load(memory_order_acquire));
+}
+
+bool
+txn_executor::pop_local(worker &w, task_t &task)
+{
+  ::lock_guard<spinlock> l(w.lock_);
+  if (!w.pinned_.empty()) {
+    task = move(w.pinned_.front());
+    w.pinned_.pop_front();
+    return true;
+  }
+  if (!w.shared_.empty()) {
+    task = move(w.shared_.front());
+    w.shared_.pop_front();
+    w.nshared_.fetch_sub(1, memory_order_release);
+    return true;
+  }
+  return false;
+}
+
+bool
+txn_executor::steal(size_t id, task_t &task)
+{
+  for (size_t i = 1; i < workers_.size(); i++) {
+    worker &v = *workers_[(id + i) % workers_.size()];
+    if (!v.nshared_.load(memory_order_acquire))
+      continue;
+    ::lock_guard<spinlock> l(v.lock_);
+    if (v.shared_.empty())
+      continue;
+    // from the back: the victim runs its oldest tasks itself
+    task = move(v.shared_.back());
+    v.shared_.pop_back();
+    v.nshared_.fetch_sub(1, memory_order_release);
+    ++evt_txn_executor_steals;
+    return true;
+  }
+  return false;
+}
+
+void
+txn_executor::run_worker(size_t id)
+{
+  tl_executor = this;
+  tl_worker_id = id;
+  if (pin_cpus_)
+    rcu::s_instance.pin_current_thread(id % coreid::num_cpus_online());
+  if (thread_init_)
+    thread_init_();
+  worker &w = *workers_[id];
+  task_t task;
+  for (;;) {
+    if (pop_local(w, task) || steal(id, task)) {
+      npending_.fetch_sub(1, memory_order_release);
+      task();
+      task = nullptr;
+      ++evt_txn_executor_tasks;
+      continue;
+    }
+    std::unique_lock<std::mutex> l(mutex_);
+    nidle_.fetch_add(1, memory_order_seq_cst);
+    // what is pending might be pinned elsewhere, so check back once in a while
+    // rather than spinning on it
+    if (!npending_.load(memory_order_seq_cst)) {
+      if (stopping_.load(memory_order_acquire)) {
+        nidle_.fetch_sub(1, memory_order_relaxed);
+        break;
+      }
+      ++evt_txn_executor_sleeps;
+      cv_.wait(l);
+    } else {
+      cv_.wait_for(l, chrono::microseconds(100));
+    }
+    nidle_.fetch_sub(1, memory_order_relaxed);
+  }
+  if (thread_end_)
+    thread_end_();
+  tl_executor = nullptr;
+  tl_worker_id = -1;
+}
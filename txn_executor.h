@@ -0,0 +1,127 @@
+#ifndef _NDB_TXN_EXECUTOR_H_
+#define _NDB_TXN_EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "macros.h"
+#include "spinlock.h"
+
+/**
+ * Runs txns (or any tasks) submitted by any thread on a fixed set of worker
+ * threads, for a server taking requests of uneven cost instead of running
+ * the benchmarks' closed loops.
+ *
+ * Every worker has its own run queues. A task submitted with a routing hint
+ * (the partition it touches, say its warehouse) goes to worker
+ * hint % nworkers(), so the txns of a partition run on the same core, on its
+ * per-core TID and log buffer state and with the partition's data in its
+ * cache. Tasks without a hint go to the submitting worker's queue if there is
+ * one (txns spawned by a txn stay local), or round robin otherwise.
+ *
+ * Workers run their own queues first. A worker with nothing to run steals
+ * from the other workers' queues, except for tasks submitted as pinned,
+ * which only ever run on their home worker. Workers with nothing to run or
+ * steal sleep until something is submitted.
+ */
+class txn_executor {
+public:
+
+  typedef std::function<void()> task_t;
+
+  static const int NoHint = -1;
+
+  // thread_init/thread_end (if any) are run on each worker as it starts and
+  // stops, to set up the thread for the db (ie abstract_db::thread_init()).
+  // if pin_cpus, worker i is pinned to cpu i % ncpus (see
+  // rcu::pin_current_thread())
+  txn_executor(size_t nworkers,
+               bool pin_cpus = false,
+               std::function<void()> thread_init = nullptr,
+               std::function<void()> thread_end = nullptr);
+
+  // stops the executor if it hasn't been
+  ~txn_executor();
+
+  txn_executor(const txn_executor &) = delete;
+  txn_executor(txn_executor &&) = delete;
+  txn_executor &operator=(const txn_executor &) = delete;
+
+  inline size_t
+  nworkers() const
+  {
+    return workers_.size();
+  }
+
+  // tasks must not throw. pinned tasks need a hint
+  void submit(task_t task, int hint = NoHint, bool pinned = false);
+
+  // runs what has been submitted, then stops the workers. nothing can be
+  // submitted once stop() is called
+  void stop();
+
+  // the index of the calling thread's worker, -1 if it isn't one of ours
+  inline int
+  current_worker() const
+  {
+    return tl_executor == this ? tl_worker_id : -1;
+  }
+
+private:
+
+  struct worker {
+    spinlock lock_;
+    std::deque<task_t> pinned_;
+    std::deque<task_t> shared_;
+    std::atomic<size_t> nshared_; // so thieves can skip empty queues unlocked
+    std::thread thd_;
+    worker() : nshared_(0) {}
+
+    // plain new only aligns to alignof(max_align_t)
+    static void *
+    operator new(size_t sz)
+    {
+      void *p = nullptr;
+      ALWAYS_ASSERT(!posix_memalign(&p, CACHELINE_SIZE, sz));
+      return p;
+    }
+
+    static void
+    operator delete(void *p)
+    {
+      free(p);
+    }
+  } CACHE_ALIGNED;
+
+  void run_worker(size_t id);
+
+  bool pop_local(worker &w, task_t &task);
+  bool steal(size_t id, task_t &task);
+
+  const bool pin_cpus_;
+  const std::function<void()> thread_init_;
+  const std::function<void()> thread_end_;
+  std::vector<std::unique_ptr<worker>> workers_;
+
+  std::atomic<size_t> npending_; // submitted but not yet popped
+  std::atomic<size_t> nidle_;
+  std::atomic<size_t> next_worker_;
+  std::atomic<bool> stopping_;
+  bool stopped_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  static __thread const txn_executor *tl_executor;
+  static __thread int tl_worker_id;
+};
+
+#endif /* _NDB_TXN_EXECUTOR_H_ */
@@ -3,14 +3,45 @@
 
 #include "txn.h"
 #include "lockguard.h"
+#include "contention_manager.h"
+#include "partition_manager.h"
+#include "abort_sampler.h"
+#include "access_sampler.h"
+#include "txn_tracer.h"
+#include "cold_store.h"
+#include "learned_index.h"
+#include "point_index.h"
+#include "pinned_snapshot.h"
+
+// cycle counts of the phases of commit(), into the per-core
+// transaction_base::g_hist_commit_<phase>_cycles histograms (with event
+// counters) and the trace record of a traced txn (see commit_phase_timer). a
+// phase ends where the one before it ended, so every cycle goes to one phase
+#define COMMIT_PHASES_BEGIN(rec) \
+  commit_phase_timer commit_phases(rec)
+#define COMMIT_PHASE_END(phase) \
+  commit_phases.end(transaction_base::g_hist_commit_ ## phase ## _cycles, \
+                    txn_trace_record::phase ## _phase)
 
 // base definitions
 
 template <template <typename> class Protocol, typename Traits>
 transaction<Protocol, Traits>::transaction(uint64_t flags, string_allocator_type &sa)
-  : transaction_base(flags), sa(&sa)
+  : transaction_base(Traits::read_only ? flags | TXN_FLAG_READ_ONLY : flags),
+    write_set_filter(0),
+    write_set_filter_npositions(0),
+    // | rather than ||, so both samplers count every txn
+    sampling_keys(abort_sampler::ShouldSample() |
+                  access_sampler::ShouldSample()),
+    snapshot(get_flags() & TXN_FLAG_READ_ONLY),
+    parked(false),
+    next_early_validation(
+        transaction_base::g_early_validation_reads.load(
+          std::memory_order_relaxed)),
+    sa(&sa)
 {
   INVARIANT(rcu::s_instance.in_rcu_region());
+  ALWAYS_ASSERT(!Traits::read_only || !(flags & TXN_FLAG_BOUNDED_STALENESS));
 #ifdef BTREE_LOCK_OWNERSHIP_CHECKING
   concurrent_btree::NodeLockRegionBegin();
 #endif
@@ -22,6 +53,10 @@ transaction<Protocol, Traits>::~transaction()
   // transaction shouldn't fall out of scope w/o resolution
   // resolution means TXN_EMBRYO, TXN_COMMITED, and TXN_ABRT
   INVARIANT(state != TXN_ACTIVE);
+  // an embryo txn may have entered partitions
+  release_partition_locks();
+  if (parked)
+    return;
   INVARIANT(rcu::s_instance.in_rcu_region());
   const unsigned cur_depth = rcu_guard_->sync()->depth();
   rcu_guard_.destroy();
@@ -44,6 +79,61 @@ transaction<Protocol, Traits>::clear()
   // have to end in a valid state
 }
 
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::park()
+{
+  INVARIANT(state != TXN_ACTIVE);
+  INVARIANT(hot_locks.empty());
+  release_partition_locks();
+  if (parked)
+    return;
+  // leave the RCU region like the destructor does
+  cast()->on_park();
+  INVARIANT(rcu::s_instance.in_rcu_region());
+  const unsigned cur_depth = rcu_guard_->sync()->depth();
+  rcu_guard_.destroy();
+  if (cur_depth == 1) {
+    INVARIANT(!rcu::s_instance.in_rcu_region());
+    cast()->on_post_rcu_region_completion();
+  }
+#ifdef BTREE_LOCK_OWNERSHIP_CHECKING
+  concurrent_btree::AssertAllNodeLocksReleased();
+#endif
+  // clear() keeps the memory the containers have grown
+  read_set.clear();
+  field_read_set.clear();
+  write_set.clear();
+  absent_set.clear();
+  write_set_index.clear();
+  write_set_filter = 0;
+  write_set_filter_npositions = 0;
+  absent_set_index.clear();
+  sampled_keys.clear();
+  parked = true;
+}
+
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::reset()
+{
+  park();
+  rcu_guard_.reconstruct();
+#ifdef BTREE_LOCK_OWNERSHIP_CHECKING
+  concurrent_btree::NodeLockRegionBegin();
+#endif
+  state = TXN_EMBRYO;
+  reason = ABORT_REASON_NONE;
+  conflict_tuple = nullptr;
+  conflict_node = nullptr;
+  snapshot = get_flags() & TXN_FLAG_READ_ONLY;
+  parked = false;
+  next_early_validation =
+    transaction_base::g_early_validation_reads.load(std::memory_order_relaxed);
+  ++evt_txn_resets;
+  cast()->on_reset();
+}
+
 template <template <typename> class Protocol, typename Traits>
 void
 transaction<Protocol, Traits>::abort_impl(abort_reason reason)
@@ -60,6 +150,16 @@ transaction<Protocol, Traits>::abort_impl(abort_reason reason)
   }
   state = TXN_ABRT;
   this->reason = reason;
+  if (contention_manager::IsActive())
+    contention_manager::OnAbort(reason, conflict_tuple);
+  release_hot_locks();
+  sample_abort();
+  sample_accesses();
+  if (unlikely(txn_tracer::ShouldSample())) {
+    txn_trace_record rec;
+    txn_tracer::BeginTxn(rec, read_set.size(), write_set.size(), absent_set.size());
+    txn_tracer::EndTxn(rec, reason, 0);
+  }
 
   // on abort, we need to go over all insert nodes and
   // release the locks
@@ -73,10 +173,114 @@ transaction<Protocol, Traits>::abort_impl(abort_reason reason)
       tuple->unlock();
     }
   }
+  release_partition_locks();
 
   clear();
 }
 
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::release_hot_locks()
+{
+  if (likely(hot_locks.empty()))
+    return;
+  for (auto it = hot_locks.begin(); it != hot_locks.end(); ++it)
+    if (*it)
+      // locked w/o write intent, so this does not bump the version
+      (*it)->unlock();
+  hot_locks.clear();
+}
+
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::release_partition_locks()
+{
+  if (likely(entered_partitions.empty()))
+    return;
+  for (auto it = entered_partitions.begin(); it != entered_partitions.end(); ++it)
+    partition_manager::Unlock(*it);
+  entered_partitions.clear();
+}
+
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::enter_partitions(const unsigned *parts, size_t n)
+{
+  INVARIANT(state == TXN_EMBRYO);
+  INVARIANT(entered_partitions.empty());
+  INVARIANT(partition_manager::IsEnabled());
+  INVARIANT(n > 0);
+  for (size_t i = 0; i < n; i++) {
+    bool seen = false;
+    for (auto it = entered_partitions.begin(); it != entered_partitions.end(); ++it)
+      if (*it == parts[i]) {
+        seen = true;
+        break;
+      }
+    if (!seen)
+      entered_partitions.push_back(parts[i]);
+  }
+  // in partition order, so txns entering overlapping partitions cannot
+  // deadlock
+  entered_partitions.sort();
+  for (auto it = entered_partitions.begin(); it != entered_partitions.end(); ++it)
+    partition_manager::Lock(*it);
+  if (entered_partitions.size() == 1)
+    ++evt_single_partition_txns;
+  else
+    ++evt_cross_partition_txns;
+}
+
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::sample_abort()
+{
+  if (likely(!sampling_keys))
+    return;
+  const void * const px = conflict_tuple ?
+    static_cast<const void *>(conflict_tuple) : conflict_node;
+  if (!px)
+    return;
+  const void *btr = nullptr;
+  const std::string *key = nullptr;
+  for (auto &k : sampled_keys)
+    if (k.px_ == px) {
+      btr = k.btr_;
+      key = &k.key_;
+      break;
+    }
+  // records which were only written are not noted
+  if (!key)
+    for (auto &w : write_set)
+      if (w.get_tuple() == px) {
+        btr = w.get_btree();
+        key = &w.get_key();
+        break;
+      }
+  if (!key)
+    return;
+  if (abort_sampler::IsEnabled())
+    abort_sampler::Record(btr, *key);
+  if (access_sampler::IsEnabled())
+    access_sampler::Record(btr, *key, access_sampler::ACCESS_CONFLICT,
+                           util::timer::cur_usec());
+}
+
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::sample_accesses()
+{
+  if (likely(!sampling_keys) || !access_sampler::IsEnabled())
+    return;
+  const uint64_t now = util::timer::cur_usec();
+  // nodes read by scans count as reads of the scan's lower bound
+  for (auto &k : sampled_keys)
+    access_sampler::Record(k.btr_, k.key_, access_sampler::ACCESS_READ, now);
+  for (auto &w : write_set)
+    access_sampler::Record(w.get_btree(), w.get_key(),
+                           access_sampler::ACCESS_WRITE, now);
+}
+
 template <template <typename> class Protocol, typename Traits>
 void
 transaction<Protocol, Traits>::cleanup_inserted_tuple_marker(
@@ -86,6 +290,10 @@ transaction<Protocol, Traits>::cleanup_inserted_tuple_marker(
   INVARIANT(marker->version == dbtuple::MAX_TID);
   INVARIANT(marker->is_locked());
   INVARIANT(marker->is_lock_owner());
+  if (point_index * const idx = point_index::For(btr))
+    idx->remove(varkey(key), marker);
+  if (learned_index * const idx = learned_index::For(btr))
+    idx->remove(varkey(key), marker);
   typename concurrent_btree::value_type removed = 0;
   const bool did_remove = btr->remove(varkey(key), &removed);
   if (unlikely(!did_remove)) {
@@ -163,8 +371,8 @@ transaction<Protocol, Traits>::dump_debug_info() const
   // absent-set
   for (typename absent_set_map::const_iterator as_it = absent_set.begin();
        as_it != absent_set.end(); ++as_it)
-    std::cerr << "      B-tree Node " << util::hexify(as_it->first)
-              << " : " << as_it->second << std::endl;
+    if (as_it->node)
+      std::cerr << "      " << *as_it << std::endl;
 
 }
 
@@ -186,6 +394,9 @@ transaction<Protocol, Traits>::get_txn_counters() const
   ret["write_set_size"] = write_set.size();
   ret["write_set_is_large?"] = !write_set.is_small_type();
 
+  // hot records locked at read time (see contention_manager)
+  ret["hot_locks"] = hot_locks.size();
+
   return ret;
 }
 
@@ -215,7 +426,18 @@ transaction<Protocol, Traits>::handle_last_tuple_in_group(
       // again in sorted order
       return false; // signal abort
     }
-    const dbtuple::version_t v = tuple->lock(true); // lock for write
+    dbtuple::version_t v;
+    if (unlikely(take_hot_lock(tuple))) {
+      // we have held it since we read it
+      v = tuple->upgrade_lock();
+    } else if (likely(hot_locks.empty())) {
+      v = tuple->lock(true); // lock for write
+    } else if (unlikely(!tuple->try_lock(
+            true, contention_manager::HotLockSpins, v))) {
+      // whoever holds it could be waiting on one of our hot locks, so we
+      // cannot wait for it indefinitely
+      return false; // signal abort
+    }
     INVARIANT(dbtuple::IsLatest(v) == tuple->is_latest());
     last.mark_locked();
     if (unlikely(!dbtuple::IsLatest(v) ||
@@ -223,6 +445,11 @@ transaction<Protocol, Traits>::handle_last_tuple_in_group(
       // XXX(stephentu): overly conservative (with the can_read_tid() check)
       return false; // signal abort
     }
+    if (unlikely(dbtuple::IsCold(v))) {
+      // a cold stub is never written: fault the value in, and retry
+      cold_store::Fault(tuple);
+      return false; // signal abort
+    }
     last.entry->set_do_write();
   }
   return true;
@@ -241,6 +468,10 @@ transaction<Protocol, Traits>::commit(bool doThrow)
         std::string(__PRETTY_FUNCTION__) + std::string(":total:")));
   ANON_REGION(probe0_name.c_str(), &transaction_base::g_txn_commit_probe0_cg);
 
+#ifdef ENABLE_EVENT_COUNTERS
+  scoped_cycle_timer commit_timer(transaction_base::g_hist_commit_cycles);
+#endif
+
   switch (state) {
   case TXN_EMBRYO:
   case TXN_ACTIVE:
@@ -253,6 +484,45 @@ transaction<Protocol, Traits>::commit(bool doThrow)
     return false;
   }
 
+  // read-only by type: nothing was tracked, so there is nothing to validate
+  if (Traits::read_only) {
+    INVARIANT(read_set.empty() && write_set.empty() && absent_set.empty());
+    release_partition_locks();
+    state = TXN_COMMITED;
+    if (contention_manager::IsActive())
+      contention_manager::OnCommit();
+    sample_accesses();
+    clear();
+    return true;
+  }
+
+  txn_trace_record trace_rec;
+  txn_trace_record * const trace =
+    unlikely(txn_tracer::ShouldSample()) ? &trace_rec : nullptr;
+  if (unlikely(trace))
+    txn_tracer::BeginTxn(trace_rec, read_set.size(), write_set.size(), absent_set.size());
+
+  // a txn which did nothing but a single read (a common case for key-value
+  // workloads) has nothing to validate: the read was of a stable version,
+  // so the txn can serialize at the read
+  if (!is_snapshot() &&
+      write_set.empty() &&
+      absent_set.empty() &&
+      read_set.size() + field_read_set.size() <= 1) {
+    ++evt_single_read_commits;
+    release_hot_locks();
+    release_partition_locks();
+    state = TXN_COMMITED;
+    if (contention_manager::IsActive())
+      contention_manager::OnCommit();
+    if (unlikely(trace))
+      txn_tracer::EndTxn(trace_rec, ABORT_REASON_NONE, 0);
+    sample_accesses();
+    clear();
+    return true;
+  }
+
+  COMMIT_PHASES_BEGIN(trace);
   dbtuple_write_info_vec write_dbtuples;
   std::pair<bool, tid_t> commit_tid(false, 0);
 
@@ -284,22 +554,60 @@ transaction<Protocol, Traits>::commit(bool doThrow)
           static std::string probe2_name(
             std::string(__PRETTY_FUNCTION__) + std::string(":lock_write_nodes:")));
       ANON_REGION(probe2_name.c_str(), &transaction_base::g_txn_commit_probe2_cg);
+      // a txn which did nothing but a single blind write (a common case for
+      // key-value workloads) has nothing to sort and nothing to validate:
+      // it serializes at the lock of the one record it writes, which orders
+      // it against any txn that read or writes that record
+      if (write_dbtuples.size() == 1 &&
+          read_set.empty() &&
+          field_read_set.empty() &&
+          absent_set.empty() &&
+          !write_dbtuples.front().entry->is_commutative()) {
+        dbtuple_write_info &w = write_dbtuples.front();
+        if (w.is_insert()) {
+          INVARIANT(w.is_locked());
+          w.entry->set_do_write();
+        } else if (unlikely(!handle_last_tuple_in_group(w, false))) {
+          conflict_tuple = w.get_tuple();
+          abort_trap((reason = ABORT_REASON_WRITE_NODE_INTERFERENCE));
+          goto do_abort;
+        }
+        COMMIT_PHASE_END(lock);
+        commit_tid.first = true;
+        commit_tid.second = cast()->gen_commit_tid(write_dbtuples);
+        COMMIT_PHASE_END(tid);
+        ++evt_single_write_commits;
+        goto do_install;
+      }
       // lock the logical nodes in sort order
       {
         PERF_DECL(
             static std::string probe6_name(
               std::string(__PRETTY_FUNCTION__) + std::string(":sort_write_nodes:")));
         ANON_REGION(probe6_name.c_str(), &transaction_base::g_txn_commit_probe6_cg);
-        write_dbtuples.sort(); // in-place
+        if (unlikely(write_dbtuples.size() >= RadixSortThreshold))
+          radix_sort_dbtuples(write_dbtuples);
+        else if (likely(write_dbtuples.size() > 1))
+          write_dbtuples.sort(); // in-place
       }
       typename dbtuple_write_info_vec::iterator it     = write_dbtuples.begin();
       typename dbtuple_write_info_vec::iterator it_end = write_dbtuples.end();
+      // the lock words of big write sets are mostly cold, so they are
+      // fetched ahead of the CASes which need them
+      typename dbtuple_write_info_vec::iterator pf     = it;
+      for (size_t i = 0; pf != it_end && i < LockPrefetchAhead; ++pf, ++i)
+        ::prefetch(pf->get_tuple());
       dbtuple_write_info *last_px = nullptr;
       bool inserted_last_run = false;
       for (; it != it_end; last_px = &(*it), ++it) {
+        if (pf != it_end) {
+          ::prefetch(pf->get_tuple());
+          ++pf;
+        }
         if (likely(last_px && last_px->tuple != it->tuple)) {
           // on boundary
           if (unlikely(!handle_last_tuple_in_group(*last_px, inserted_last_run))) {
+            conflict_tuple = last_px->get_tuple();
             abort_trap((reason = ABORT_REASON_WRITE_NODE_INTERFERENCE));
             goto do_abort;
           }
@@ -318,15 +626,38 @@ transaction<Protocol, Traits>::commit(bool doThrow)
       }
       if (likely(last_px) &&
           unlikely(!handle_last_tuple_in_group(*last_px, inserted_last_run))) {
+        conflict_tuple = last_px->get_tuple();
         abort_trap((reason = ABORT_REASON_WRITE_NODE_INTERFERENCE));
         goto do_abort;
       }
+      // the records are locked, so commutative writes can now be resolved
+      // against their current values
+      for (it = write_dbtuples.begin(); it != it_end; ++it) {
+        write_record_t * const entry = it->entry;
+        if (likely(!entry->is_commutative()) || !entry->do_write())
+          continue;
+        dbtuple * const tuple = it->get_tuple();
+        INVARIANT(tuple->is_locked());
+        INVARIANT(tuple->is_write_intent());
+        if (unlikely(tuple->is_deleting())) {
+          // deleted since the txn found it
+          conflict_tuple = tuple;
+          abort_trap((reason = ABORT_REASON_WRITE_NODE_INTERFERENCE));
+          goto do_abort;
+        }
+        entry->get_writer()(
+            dbtuple::TUPLE_WRITER_RESOLVE_DELTA, entry->get_value(),
+            tuple->get_value_start(), tuple->size);
+        ++evt_commutative_writes_resolved;
+      }
+      COMMIT_PHASE_END(lock);
       commit_tid.first = true;
       PERF_DECL(
           static std::string probe5_name(
             std::string(__PRETTY_FUNCTION__) + std::string(":gen_commit_tid:")));
       ANON_REGION(probe5_name.c_str(), &transaction_base::g_txn_commit_probe5_cg);
       commit_tid.second = cast()->gen_commit_tid(write_dbtuples);
+      COMMIT_PHASE_END(tid);
       VERBOSE(std::cerr << "commit tid: " << g_proto_version_str(commit_tid.second) << std::endl);
     } else {
       VERBOSE(std::cerr << "commit tid: <read-only>" << std::endl);
@@ -340,50 +671,35 @@ transaction<Protocol, Traits>::commit(bool doThrow)
       ANON_REGION(probe3_name.c_str(), &transaction_base::g_txn_commit_probe3_cg);
 
       // check the nodes we actually read are still the latest version
-      if (!read_set.empty()) {
-        typename read_set_map::iterator it     = read_set.begin();
-        typename read_set_map::iterator it_end = read_set.end();
-        for (; it != it_end; ++it) {
-          VERBOSE(std::cerr << "validating dbtuple " << util::hexify(it->get_tuple())
-                            << " at snapshot_tid "
-                            << g_proto_version_str(cast()->snapshot_tid())
-                            << std::endl);
-          const bool found = sorted_dbtuples_contains(
-              write_dbtuples, it->get_tuple());
-          if (likely(found ?
-                it->get_tuple()->is_latest_version(it->get_tid()) :
-                it->get_tuple()->stable_is_latest_version(it->get_tid())))
-            continue;
-
-          VERBOSE(std::cerr << "validating dbtuple " << util::hexify(it->get_tuple()) << " at snapshot_tid "
-                            << g_proto_version_str(cast()->snapshot_tid()) << " FAILED" << std::endl
-                            << "  txn read version: " << g_proto_version_str(it->get_tid()) << std::endl
-                            << "  tuple=" << *it->get_tuple() << std::endl);
-
-          //std::cerr << "failed tuple: " << *it->get_tuple() << std::endl;
-
-          abort_trap((reason = ABORT_REASON_READ_NODE_INTEREFERENCE));
-          goto do_abort;
-        }
+      if ((!read_set.empty() || !field_read_set.empty()) &&
+          unlikely(!validate_read_set(write_dbtuples))) {
+        abort_trap((reason = ABORT_REASON_READ_NODE_INTEREFERENCE));
+        goto do_abort;
       }
+      COMMIT_PHASE_END(read_validation);
 
       // check btree versions have not changed
       if (!absent_set.empty()) {
         typename absent_set_map::iterator it     = absent_set.begin();
         typename absent_set_map::iterator it_end = absent_set.end();
         for (; it != it_end; ++it) {
-          const uint64_t v = concurrent_btree::ExtractVersionNumber(it->first);
-          if (unlikely(v != it->second.version)) {
-            VERBOSE(std::cerr << "expected node " << util::hexify(it->first) << " at v="
-                              << it->second.version << ", got v=" << v << std::endl);
+          if (unlikely(!it->node))
+            continue;
+          const uint64_t v = concurrent_btree::ExtractVersionNumber(it->node);
+          if (unlikely(v != it->version)) {
+            VERBOSE(std::cerr << "expected node " << util::hexify(it->node) << " at v="
+                              << it->version << ", got v=" << v << std::endl);
+            conflict_node = it->node;
             abort_trap((reason = ABORT_REASON_NODE_SCAN_READ_VERSION_CHANGED));
             goto do_abort;
           }
         }
       }
+      COMMIT_PHASE_END(node_validation);
     }
 
     // commit actual records
+do_install:
     if (!write_dbtuples.empty()) {
       PERF_DECL(
           static std::string probe4_name(
@@ -405,10 +721,15 @@ transaction<Protocol, Traits>::commit(bool doThrow)
                                               // w/o creating a new chain
         } else {
           tuple->prefetch();
+          pinned_snapshot::OnOverwrite(
+              it->get_btree(), it->get_key(), tuple, commit_tid.second);
+          scoped_alloc_node home(it->get_btree()->numa_node());
+          scoped_alloc_pack_group pack(it->get_btree()->pack_group());
           const dbtuple::write_record_ret ret =
             tuple->write_record_at(
                 cast(), commit_tid.second,
-                it->get_value(), it->get_writer());
+                it->get_value(), it->get_writer(),
+                cast()->can_drop_old_versions(it->get_btree()));
           bool unlock_head = false;
           if (unlikely(ret.head_ != tuple)) {
             // tuple was replaced by ret.head_
@@ -424,6 +745,10 @@ transaction<Protocol, Traits>::commit(bool doThrow)
               // should already exist in tree
               INVARIANT(false);
             INVARIANT(old_v == (typename concurrent_btree::value_type) tuple);
+            if (point_index * const idx = point_index::For(it->get_btree()))
+              idx->put(varkey(it->get_key()), ret.head_);
+            if (learned_index * const idx = learned_index::For(it->get_btree()))
+              idx->put(varkey(it->get_key()), ret.head_);
             // we don't RCU free this, because it is now part of the chain
             // (the cleaners will take care of this)
             ++evt_dbtuple_latest_replacement;
@@ -448,11 +773,25 @@ transaction<Protocol, Traits>::commit(bool doThrow)
         else
           INVARIANT(!it->is_insert());
       }
+      COMMIT_PHASE_END(install);
     }
   }
+  release_hot_locks();
+  release_partition_locks();
   state = TXN_COMMITED;
-  if (commit_tid.first)
+  if (contention_manager::IsActive())
+    contention_manager::OnCommit();
+  if (commit_tid.first) {
     cast()->on_tid_finish(commit_tid.second);
+    COMMIT_PHASE_END(log);
+  }
+  if (unlikely(trace)) {
+    txn_tracer::EndTxn(
+        trace_rec, ABORT_REASON_NONE, commit_tid.first ? commit_tid.second : 0);
+    if (commit_tid.first)
+      cast()->on_trace_durable(commit_tid.second);
+  }
+  sample_accesses();
   clear();
   return true;
 
@@ -479,9 +818,17 @@ do_abort:
     }
   }
 
+  release_hot_locks();
+  release_partition_locks();
   state = TXN_ABRT;
+  if (contention_manager::IsActive())
+    contention_manager::OnAbort(reason, conflict_tuple);
+  sample_abort();
+  sample_accesses();
   if (commit_tid.first)
     cast()->on_tid_finish(commit_tid.second);
+  if (unlikely(trace))
+    txn_tracer::EndTxn(trace_rec, reason, 0);
   clear();
   if (doThrow)
     throw transaction_abort_exception(reason);
@@ -495,6 +842,162 @@ do_abort:
 #endif
 }
 
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::radix_sort_dbtuples(
+    dbtuple_write_info_vec &dbtuples)
+{
+  // LSD radix sort by [tuple, !is_insert] a byte at a time. it is stable, so
+  // entries of the same key stay in pos order, as operator< wants. bytes
+  // all the keys share (most of the pointer's high bytes) are skipped
+  const size_t n = dbtuples.size();
+  std::vector<dbtuple_write_info> a(dbtuples.begin(), dbtuples.end()), b(n);
+  const auto key = [](const dbtuple_write_info &e) {
+    return (uint64_t(uintptr_t(e.get_tuple())) << 1) | !e.is_insert();
+  };
+  uint64_t key_or = 0, key_and = ~uint64_t(0);
+  for (size_t i = 0; i < n; i++) {
+    key_or |= key(a[i]);
+    key_and &= key(a[i]);
+  }
+  for (unsigned shift = 0; shift < 64; shift += 8) {
+    if (!(((key_or ^ key_and) >> shift) & 0xFF))
+      continue;
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < n; i++)
+      offsets[(key(a[i]) >> shift) & 0xFF]++;
+    for (size_t d = 0, sum = 0; d < 256; d++) {
+      const size_t c = offsets[d];
+      offsets[d] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < n; i++)
+      b[offsets[(key(a[i]) >> shift) & 0xFF]++] = a[i];
+    a.swap(b);
+  }
+  size_t i = 0;
+  for (auto it = dbtuples.begin(); it != dbtuples.end(); ++it, ++i) {
+    INVARIANT(!i || a[i - 1] < a[i]);
+    *it = a[i];
+  }
+}
+
+template <template <typename> class Protocol, typename Traits>
+bool
+transaction<Protocol, Traits>::validate_read_set(
+    const dbtuple_write_info_vec &write_dbtuples)
+{
+  // same checks as dbtuple::stable_is_latest_version(), but split into
+  // passes over a chunk: the stable versions of the whole chunk are read
+  // first, then compared all at once, and finally re-checked all at once.
+  // the comparisons are branch-free, so the compiler can vectorize them,
+  // and the tuples (which are usually cold) are prefetched well ahead
+  typename read_set_map::const_iterator it     = read_set.begin();
+  typename read_set_map::const_iterator it_end = read_set.end();
+  typename read_set_map::const_iterator pf     = it;
+  for (size_t i = 0; pf != it_end && i < ValidatePrefetchAhead; ++pf, ++i)
+    ::prefetch(pf->get_tuple());
+
+  const dbtuple *tuples[ValidateBatchSize];
+  dbtuple::version_t vs[ValidateBatchSize];
+  tid_t read_tids[ValidateBatchSize];
+  tid_t cur_tids[ValidateBatchSize];
+  while (it != it_end) {
+    size_t n = 0;
+    for (; it != it_end && n < ValidateBatchSize; ++it) {
+      if (pf != it_end) {
+        ::prefetch(pf->get_tuple());
+        ++pf;
+      }
+      const dbtuple * const tuple = it->get_tuple();
+      VERBOSE(std::cerr << "validating dbtuple " << util::hexify(tuple)
+                        << " at snapshot_tid "
+                        << g_proto_version_str(cast()->snapshot_tid())
+                        << std::endl);
+      if (sorted_dbtuples_contains(write_dbtuples, tuple)) {
+        // we hold the lock, so its version cannot change under us
+        if (unlikely(!tuple->is_latest_version(it->get_tid()))) {
+          conflict_tuple = tuple;
+          goto failed;
+        }
+        continue;
+      }
+      dbtuple::version_t v;
+      if (unlikely(!tuple->try_writer_stable_version(v, 16))) {
+        conflict_tuple = tuple;
+        goto failed;
+      }
+      tuples[n] = tuple;
+      vs[n] = v;
+      read_tids[n] = it->get_tid();
+      cur_tids[n] = tuple->version;
+      n++;
+    }
+
+    bool ok = true;
+    for (size_t j = 0; j < n; j++)
+      ok &= dbtuple::IsLatest(vs[j]) & (cur_tids[j] <= read_tids[j]);
+    if (unlikely(!ok)) {
+      for (size_t j = 0; j < n; j++)
+        if (!dbtuple::IsLatest(vs[j]) || cur_tids[j] > read_tids[j]) {
+          conflict_tuple = tuples[j];
+          break;
+        }
+      goto failed;
+    }
+
+    COMPILER_MEMORY_FENCE;
+    for (size_t j = 0; j < n; j++)
+      ok &= (tuples[j]->unstable_version() == vs[j]);
+    if (unlikely(!ok)) {
+      for (size_t j = 0; j < n; j++)
+        if (tuples[j]->unstable_version() != vs[j]) {
+          conflict_tuple = tuples[j];
+          break;
+        }
+      goto failed;
+    }
+  }
+
+  for (auto &r : field_read_set)
+    if (unlikely(!validate_field_read(
+            r, sorted_dbtuples_contains(write_dbtuples, r.tuple)))) {
+      conflict_tuple = r.tuple;
+      goto failed;
+    }
+  return true;
+
+failed:
+  VERBOSE(std::cerr << "validating read set at snapshot_tid "
+                    << g_proto_version_str(cast()->snapshot_tid())
+                    << " FAILED" << std::endl);
+  return false;
+}
+
+template <template <typename> class Protocol, typename Traits>
+bool
+transaction<Protocol, Traits>::validate_field_read(
+    const field_read_record_t &r, bool locked)
+{
+  const dbtuple * const tuple = r.tuple;
+  if (locked)
+    return tuple->is_latest_version(r.t);
+  dbtuple::version_t v;
+  if (unlikely(!tuple->try_writer_stable_version(v, 16)))
+    return false;
+  if (unlikely(!dbtuple::IsLatest(v)))
+    return false;
+  if (tuple->version > r.t) {
+    // written since, but maybe only other fields
+    if (dbtuple::IsDeleting(v) || dbtuple::IsCold(v) ||
+        !r.same(tuple->get_value_start(), tuple->size, r.value, r.mask))
+      return false;
+    ++evt_field_read_validations;
+  }
+  COMPILER_MEMORY_FENCE;
+  return tuple->unstable_version() == v;
+}
+
 template <template <typename> class Protocol, typename Traits>
 std::pair< dbtuple *, bool >
 transaction<Protocol, Traits>::try_insert_new_tuple(
@@ -508,6 +1011,11 @@ transaction<Protocol, Traits>::try_insert_new_tuple(
     value ? writer(dbtuple::TUPLE_WRITER_COMPUTE_NEEDED,
       value, nullptr, 0) : 0;
 
+  // the tuple, and any nodes the insert splits off, live on btr's node (and
+  // hugepages)
+  scoped_alloc_node home(btr.numa_node());
+  scoped_alloc_pack_group pack(btr.pack_group());
+
   // perf: ~900 tsc/alloc on istc11.csail.mit.edu
   dbtuple * const tuple = dbtuple::alloc_first(sz, true);
   if (value)
@@ -545,17 +1053,32 @@ transaction<Protocol, Traits>::try_insert_new_tuple(
   // update node #s
   INVARIANT(insert_info.node);
   if (!absent_set.empty()) {
-    auto it = absent_set.find(insert_info.node);
-    if (it != absent_set.end()) {
-      if (unlikely(it->second.version != insert_info.old_version)) {
+    // short sets are searched whole, bumping every entry of the node. longer
+    // ones are folded first, so the node has at most one live entry
+    typename absent_set_map::iterator it     = absent_set.begin();
+    typename absent_set_map::iterator it_end = absent_set.end();
+    if (unlikely(absent_set.size() > AbsentSetIndexThreshold)) {
+      if (unlikely(!fold_absent_set())) {
+        abort_trap((reason = ABORT_REASON_NODE_SCAN_READ_VERSION_CHANGED));
+        return std::make_pair(tuple, true);
+      }
+      const flat_ptr_index::entry * const e =
+        absent_set_index.find(insert_info.node);
+      it = e ? absent_set.begin() + e->first_ : it_end;
+      it_end = e ? it + 1 : it_end;
+    }
+    for (; it != it_end; ++it) {
+      if (it->node != insert_info.node)
+        continue;
+      if (unlikely(it->version != insert_info.old_version)) {
         abort_trap((reason = ABORT_REASON_WRITE_NODE_INTERFERENCE));
         return std::make_pair(tuple, true);
       }
-      VERBOSE(std::cerr << "bump node=" << util::hexify(it->first) << " from v=" << insert_info.old_version
+      VERBOSE(std::cerr << "bump node=" << util::hexify(it->node) << " from v=" << insert_info.old_version
                         << " -> v=" << insert_info.new_version << std::endl);
       // otherwise, bump the version
-      it->second.version = insert_info.new_version;
-      SINGLE_THREADED_INVARIANT(concurrent_btree::ExtractVersionNumber(it->first) == it->second);
+      it->version = insert_info.new_version;
+      SINGLE_THREADED_INVARIANT(concurrent_btree::ExtractVersionNumber(it->node) == it->version);
     }
   }
   return std::make_pair(tuple, false);
@@ -565,7 +1088,8 @@ template <template <typename> class Protocol, typename Traits>
 template <typename ValueReader>
 bool
 transaction<Protocol, Traits>::do_tuple_read(
-    const dbtuple *tuple, ValueReader &value_reader)
+    const dbtuple *tuple, ValueReader &value_reader, bool track,
+    tid_t expired_tid, const field_read_t *field_read)
 {
   INVARIANT(tuple);
   ++evt_local_search_lookups;
@@ -593,16 +1117,52 @@ transaction<Protocol, Traits>::do_tuple_read(
 
   // do the actual tuple read
   dbtuple::ReadStatus stat;
+  bool contended;
   {
     PERF_DECL(static std::string probe0_name(std::string(__PRETTY_FUNCTION__) + std::string(":do_read:")));
     ANON_REGION(probe0_name.c_str(), &private_::txn_btree_search_probe0_cg);
     tuple->prefetch();
+    // a committer writing the tuple is a sign our other reads are being
+    // overwritten too
+    contended = next_early_validation && !is_snapshot_txn &&
+      dbtuple::IsWriteIntent(tuple->unstable_version());
+    // a hot record is locked before it is read, so nobody can change it
+    // before we commit (and our read of it cannot fail validation)
+    if (unlikely(!is_snapshot_txn && track &&
+                 contention_manager::IsHotLockingEnabled() &&
+                 hot_locks.size() < MaxHotLocks &&
+                 !holds_hot_lock(tuple) &&
+                 contention_manager::LockIfHot(const_cast<dbtuple *>(tuple))))
+      hot_locks.push_back(const_cast<dbtuple *>(tuple));
     stat = tuple->stable_read(snapshot_tid, start_t, value_reader, this->string_allocator(), is_snapshot_txn);
+    if (unlikely(expired_tid && stat != dbtuple::READ_FAILED &&
+                 start_t <= expired_tid)) {
+      // nobody needs an expired value, even one which is out on disk
+      ++evt_local_search_expired;
+      stat = dbtuple::READ_EMPTY;
+    }
     if (unlikely(stat == dbtuple::READ_FAILED)) {
       const transaction_base::abort_reason r = transaction_base::ABORT_REASON_UNSTABLE_READ;
+      this->conflict_tuple = tuple;
       abort_impl(r);
       throw transaction_abort_exception(r);
     }
+    if (unlikely(stat == dbtuple::READ_COLD)) {
+      if (is_snapshot_txn || cold_store::IsCompressed(tuple)) {
+        // nothing to validate, so it might as well wait for the disk (and
+        // nobody waits for a value which is only compressed)
+        stat = cold_store::Read(tuple, value_reader, this->string_allocator()) ?
+          dbtuple::READ_RECORD : dbtuple::READ_EMPTY;
+      } else {
+        // retried once the value is back in memory
+        cold_store::Fault(tuple);
+        const transaction_base::abort_reason r = transaction_base::ABORT_REASON_COLD_READ;
+        abort_impl(r);
+        throw transaction_abort_exception(r);
+      }
+    }
+    if (cold_store::IsEnabled())
+      tuple->mark_referenced();
   }
   if (unlikely(!cast()->can_read_tid(start_t))) {
     const transaction_base::abort_reason r = transaction_base::ABORT_REASON_FUTURE_TID_READ;
@@ -614,30 +1174,142 @@ transaction<Protocol, Traits>::do_tuple_read(
   const bool v_empty = (stat == dbtuple::READ_EMPTY);
   if (v_empty)
     ++transaction_base::g_evt_read_logical_deleted_node_search;
-  if (!is_snapshot_txn)
+  if (unlikely(!track))
+    // nobody else can write the tuple until we commit
+    ++evt_untracked_partition_reads;
+  else if (!is_snapshot_txn) {
     // read-only txns do not need read-set tracking
     // (b/c we know the values are consistent)
-    read_set.emplace_back(tuple, start_t);
+    if (field_read && !v_empty) {
+      std::string * const px = this->string_allocator()();
+      px->assign(reinterpret_cast<const char *>(field_read->value),
+                 field_read->size);
+      field_read_set.push_back(field_read_record_t{
+          tuple, start_t, field_read->mask,
+          reinterpret_cast<const uint8_t *>(px->data()), field_read->same});
+    } else {
+      read_set.emplace_back(tuple, start_t);
+    }
+  }
+  if (unlikely(next_early_validation &&
+               (read_set.size() + field_read_set.size() >=
+                  next_early_validation || contended)))
+    early_validate();
   return !v_empty;
 }
 
+template <template <typename> class Protocol, typename Traits>
+void
+transaction<Protocol, Traits>::early_validate()
+{
+  INVARIANT(!is_snapshot());
+  ++evt_early_validations;
+  next_early_validation = std::max(
+      2 * (read_set.size() + field_read_set.size()),
+      transaction_base::g_early_validation_reads.load(std::memory_order_relaxed));
+  transaction_base::abort_reason r = transaction_base::ABORT_REASON_NONE;
+  for (typename read_set_map::const_iterator it = read_set.begin();
+       it != read_set.end(); ++it)
+    if (unlikely(!it->get_tuple()->stable_is_latest_version(it->get_tid()))) {
+      this->conflict_tuple = it->get_tuple();
+      r = transaction_base::ABORT_REASON_READ_NODE_INTEREFERENCE;
+      break;
+    }
+  if (r == transaction_base::ABORT_REASON_NONE)
+    for (auto &fr : field_read_set)
+      if (unlikely(!validate_field_read(fr, false))) {
+        this->conflict_tuple = fr.tuple;
+        r = transaction_base::ABORT_REASON_READ_NODE_INTEREFERENCE;
+        break;
+      }
+  if (r == transaction_base::ABORT_REASON_NONE)
+    for (typename absent_set_map::const_iterator it = absent_set.begin();
+         it != absent_set.end(); ++it)
+      if (it->node &&
+          unlikely(concurrent_btree::ExtractVersionNumber(it->node) != it->version)) {
+        this->conflict_node = it->node;
+        r = transaction_base::ABORT_REASON_NODE_SCAN_READ_VERSION_CHANGED;
+        break;
+      }
+  if (likely(r == transaction_base::ABORT_REASON_NONE))
+    return;
+  ++evt_early_aborts;
+  abort_impl(r);
+  throw transaction_abort_exception(r);
+}
+
+template <template <typename> class Protocol, typename Traits>
+template <typename ValueReader, typename StringAllocator>
+dbtuple::ReadStatus
+transaction<Protocol, Traits>::do_snapshot_tuple_read(
+    const dbtuple *tuple, ValueReader &value_reader, StringAllocator &sa,
+    tid_t expired_tid) const
+{
+  INVARIANT(tuple);
+  INVARIANT(is_snapshot());
+  ++evt_local_search_lookups;
+  transaction_base::tid_t start_t = 0;
+  tuple->prefetch();
+  dbtuple::ReadStatus stat =
+    tuple->stable_read(cast()->snapshot_tid(), start_t, value_reader, sa, true);
+  if (unlikely(expired_tid && stat != dbtuple::READ_FAILED &&
+               start_t <= expired_tid)) {
+    ++evt_local_search_expired;
+    stat = dbtuple::READ_EMPTY;
+  }
+  if (unlikely(stat == dbtuple::READ_COLD))
+    stat = cold_store::Read(tuple, value_reader, sa) ?
+      dbtuple::READ_RECORD : dbtuple::READ_FAILED;
+  else if (cold_store::IsEnabled())
+    tuple->mark_referenced();
+  if (stat == dbtuple::READ_EMPTY)
+    ++transaction_base::g_evt_read_logical_deleted_node_search;
+  return stat;
+}
+
 template <template <typename> class Protocol, typename Traits>
 void
 transaction<Protocol, Traits>::do_node_read(
-    const typename concurrent_btree::node_opaque_t *n, uint64_t v)
+    const typename concurrent_btree::node_opaque_t *n, uint64_t v, bool track)
 {
   INVARIANT(n);
-  if (is_snapshot())
+  if (is_snapshot() || !track)
     return;
-  auto it = absent_set.find(n);
-  if (it == absent_set.end()) {
-    absent_set[n].version = v;
-  } else if (it->second.version != v) {
+  // a scan reports each leaf it crosses (sometimes more than once in a row),
+  // so a long one would pay a lookup per leaf for nodes which are nearly
+  // always new. only a repeat of the last node is caught here; other
+  // duplicates are folded away when an insert needs the set searched, and
+  // are otherwise just validated twice at commit
+  if (!absent_set.empty() && absent_set.back().node == n) {
+    if (likely(absent_set.back().version == v))
+      return;
+    this->conflict_node = n;
     const transaction_base::abort_reason r =
       transaction_base::ABORT_REASON_NODE_SCAN_READ_VERSION_CHANGED;
     abort_impl(r);
     throw transaction_abort_exception(r);
   }
+  absent_set.push_back(transaction_base::absent_record_t{n, v});
+}
+
+template <template <typename> class Protocol, typename Traits>
+bool
+transaction<Protocol, Traits>::fold_absent_set()
+{
+  for (size_t i = absent_set_index.npositions(); i < absent_set.size(); i++) {
+    transaction_base::absent_record_t &r = absent_set[i];
+    const flat_ptr_index::entry * const e = absent_set_index.find(r.node);
+    const size_t first = e ? e->first_ : i;
+    absent_set_index.append(r.node);
+    if (first == i)
+      continue;
+    if (absent_set[first].version != r.version) {
+      this->conflict_node = r.node;
+      return false;
+    }
+    r.node = nullptr;
+  }
+  return true;
 }
 
 #endif /* _NDB_TXN_IMPL_H_ */
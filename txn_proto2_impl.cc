@@ -1,14 +1,33 @@
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <thread>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <fstream>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <limits.h>
 #include <numa.h>
+#include <cpuid.h>
 
 #include "txn_proto2_impl.h"
+#include "txn_replication.h"
 #include "counter.h"
+#include "futex.h"
+#include "learned_index.h"
+#include "point_index.h"
+#include "thread_placement.h"
+#include "txn_checkpoint.h"
+#include "txn_tracer.h"
 #include "util.h"
+#include "amd64.h"
 
 using namespace std;
 using namespace util;
@@ -19,19 +38,52 @@ bool txn_logger::g_persist = false;
 bool txn_logger::g_call_fsync = true;
 bool txn_logger::g_use_compression = false;
 bool txn_logger::g_fake_writes = false;
+bool txn_logger::g_async_fsync = false;
+bool txn_logger::g_use_dax = false;
+uint64_t txn_logger::g_group_commit_us = 0;
+size_t txn_logger::g_ncompress_threads = 0;
+bool txn_logger::g_pin_loggers_to_numa_nodes = false;
+bool txn_logger::g_coalesce_writes = false;
+bool txn_logger::g_compact_encoding = false;
+bool txn_logger::g_checksum = false;
+size_t txn_logger::g_admission_lag_epochs = 0;
+size_t txn_logger::g_buffer_size = txn_logger::g_default_buffer_size;
+size_t txn_logger::g_initial_buffers = txn_logger::g_perthread_buffers;
+size_t txn_logger::g_buffer_memory_budget = 0;
+atomic<size_t> txn_logger::g_buffer_memory_used(0);
+size_t txn_logger::g_segment_size = 0;
+atomic<uint64_t> txn_logger::g_truncation_epoch(0);
 size_t txn_logger::g_nworkers = 0;
 txn_logger::epoch_array
   txn_logger::per_thread_sync_epochs_[txn_logger::g_nmax_loggers];
 aligned_padded_elem<atomic<uint64_t>>
   txn_logger::system_sync_epoch_(0);
+txn_logger::epoch_array
+  txn_logger::per_thread_sync_tids_[txn_logger::g_nmax_loggers];
+aligned_padded_elem<atomic<uint64_t>>
+  txn_logger::system_sync_tid_(0);
+atomic<uint64_t> txn_logger::g_sync_rounds_started_(0);
+atomic<uint64_t> txn_logger::g_sync_rounds_done_(0);
 percore<txn_logger::persist_ctx>
   txn_logger::g_persist_ctxs;
 percore<txn_logger::persist_stats>
   txn_logger::g_persist_stats;
+aligned_padded_elem<atomic<uint64_t>>
+  txn_logger::g_nbytes_written[txn_logger::g_nmax_loggers];
+percore<txn_logger::durable_waiters>
+  txn_logger::g_durable_waiters;
+const char *const txn_logger::g_pepoch_suffix = ".pepoch";
+int txn_logger::g_pepoch_fd = -1;
+vector<txn_log_shipper *> txn_logger::g_log_shippers;
+txn_log_shipper *txn_logger::g_epoch_shipper = nullptr;
+txn_logger::table_entry txn_logger::g_tables[txn_logger::g_nmax_tables];
+spinlock txn_logger::g_tables_lock;
 event_counter
   txn_logger::g_evt_log_buffer_epoch_boundary("log_buffer_epoch_boundary");
 event_counter
   txn_logger::g_evt_log_buffer_out_of_space("log_buffer_out_of_space");
+event_counter
+  txn_logger::g_evt_log_buffer_group_commit("log_buffer_group_commit");
 event_counter
   txn_logger::g_evt_log_buffer_bytes_before_compress("log_buffer_bytes_before_compress");
 event_counter
@@ -48,9 +100,232 @@ event_avg_counter
   txn_logger::g_evt_avg_logger_bytes_per_writev("avg_logger_bytes_per_writev");
 event_avg_counter
   txn_logger::g_evt_avg_logger_bytes_per_sec("avg_logger_bytes_per_sec");
+event_histogram
+  txn_logger::g_hist_persist_latency_us("persist_latency_us");
+event_histogram *txn_logger::g_hist_logger_writev_us[txn_logger::g_nmax_loggers];
+event_histogram *txn_logger::g_hist_logger_fsync_us[txn_logger::g_nmax_loggers];
 
 static event_avg_counter
   evt_avg_log_buffer_iov_len("avg_log_buffer_iov_len");
+static event_counter evt_log_segments_created("log_segments_created");
+static event_counter evt_log_segments_recycled("log_segments_recycled");
+static event_counter evt_log_segments_deleted("log_segments_deleted");
+static event_counter evt_log_dax_flushes("log_dax_flushes");
+static event_counter evt_log_dax_msyncs("log_dax_msyncs");
+static event_counter evt_durable_callbacks("durable_callbacks");
+static event_counter evt_log_compressor_idle_sleeps("log_compressor_idle_sleeps");
+static event_counter evt_logger_coalesced_writes("logger_coalesced_writes");
+static event_counter evt_logger_coalesced_bytes("logger_coalesced_bytes");
+static event_counter evt_log_buffers_grown("log_buffers_grown");
+static event_counter evt_log_buffers_freed("log_buffers_freed");
+static event_counter evt_admission_delayed_txns("admission_delayed_txns");
+static event_avg_counter evt_avg_admission_delay_us("avg_admission_delay_us");
+
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
+namespace {
+  // runs fdatasync() on behalf of a logger, so the logger can write out its
+  // next batch while the previous one is being flushed. only one request
+  // may be outstanding at a time
+  class background_syncer {
+  public:
+    background_syncer(event_histogram *hist)
+      : fd_(-1), hist_(hist), nrequests_(0), ndone_(0)
+    {
+      std::thread(&background_syncer::loop, this).detach();
+    }
+
+    inline void
+    start(int fd)
+    {
+      INVARIANT(done());
+      fd_ = fd;
+      nrequests_.fetch_add(1, memory_order_release);
+      requested_.notify();
+    }
+
+    inline bool
+    done() const
+    {
+      return ndone_.load(memory_order_acquire) ==
+             nrequests_.load(memory_order_acquire);
+    }
+
+    inline void
+    wait()
+    {
+      done_.wait_until([this]() { return done(); });
+    }
+
+  private:
+    void
+    loop()
+    {
+      for (uint64_t n = 1;; n++) {
+        requested_.wait_until([this, n]() {
+          return nrequests_.load(memory_order_acquire) >= n;
+        });
+        const uint64_t start_us = timer::cur_usec();
+        if (unlikely(fdatasync(fd_) == -1)) {
+          perror("fdatasync");
+          ALWAYS_ASSERT(false);
+        }
+        hist_->offer(timer::cur_usec() - start_us);
+        ndone_.store(n, memory_order_release);
+        done_.notify();
+      }
+    }
+
+    int fd_;
+    event_histogram *const hist_;
+    atomic<uint64_t> nrequests_;
+    atomic<uint64_t> ndone_;
+    futex_event requested_;
+    futex_event done_;
+  };
+
+  typedef void (*flush_line_fn)(const void *);
+
+  // the cheapest way of writing back a cache line which this cpu has
+  flush_line_fn
+  pick_flush_line_fn()
+  {
+    if (__get_cpuid_max(0, nullptr) >= 7) {
+      unsigned a, b, c, d;
+      __cpuid_count(7, 0, a, b, c, d);
+      if (b & (1U << 24))
+        return &clwb;
+      if (b & (1U << 23))
+        return &clflushopt;
+    }
+    return &clflush;
+  }
+
+  // a log segment written through a shared mapping. with MAP_SYNC (ie on a
+  // DAX filesystem), the file's blocks and metadata are persistent once
+  // mapped, so writing back the cache lines we copied into makes them
+  // durable. otherwise the mapping is backed by the page cache, and must be
+  // msync()-ed instead (which is only useful for testing)
+  class dax_segment {
+  public:
+    dax_segment()
+      : p_(nullptr), sz_(0), off_(0), persisted_(0), sync_(false) {}
+
+    ~dax_segment() { unmap(); }
+
+    dax_segment(const dax_segment &) = delete;
+    dax_segment &operator=(const dax_segment &) = delete;
+
+    void
+    map(int fd, size_t sz)
+    {
+      INVARIANT(!p_);
+      // the segment is zero-filled up to sz, so recovery stops right after
+      // the last buffer we copied in
+      if (ftruncate(fd, sz) == -1) {
+        perror("ftruncate");
+        ALWAYS_ASSERT(false);
+      }
+      void *p = mmap(nullptr, sz, PROT_READ|PROT_WRITE,
+                     MAP_SHARED_VALIDATE|MAP_SYNC, fd, 0);
+      sync_ = p != MAP_FAILED;
+      if (!sync_) {
+        static bool s_warned = false;
+        if (!s_warned) {
+          s_warned = true;
+          cerr << "[WARNING] log segments are not on a DAX filesystem, "
+               << "falling back to msync()" << endl;
+        }
+        p = mmap(nullptr, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      if (p == MAP_FAILED) {
+        perror("mmap");
+        ALWAYS_ASSERT(false);
+      }
+      p_ = (uint8_t *) p;
+      sz_ = sz;
+      off_ = persisted_ = 0;
+    }
+
+    void
+    unmap()
+    {
+      if (!p_)
+        return;
+      munmap(p_, sz_);
+      p_ = nullptr;
+    }
+
+    inline bool
+    fits(size_t n) const
+    {
+      return off_ + n <= sz_;
+    }
+
+    inline void
+    append(const void *buf, size_t n)
+    {
+      INVARIANT(fits(n));
+      NDB_MEMCPY(p_ + off_, buf, n);
+      off_ += n;
+    }
+
+    // makes everything appended so far durable
+    void
+    persist()
+    {
+      if (persisted_ == off_)
+        return;
+      if (sync_) {
+        static const flush_line_fn s_flush_line = pick_flush_line_fn();
+        const uintptr_t end = uintptr_t(p_ + off_);
+        for (uintptr_t p = uintptr_t(p_ + persisted_) & ~uintptr_t(CACHELINE_SIZE - 1);
+             p < end; p += CACHELINE_SIZE)
+          s_flush_line((const void *) p);
+        sfence();
+        ++evt_log_dax_flushes;
+      } else {
+        static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+        const size_t start = persisted_ & ~(s_page_size - 1);
+        if (msync(p_ + start, off_ - start, MS_SYNC) == -1) {
+          perror("msync");
+          ALWAYS_ASSERT(false);
+        }
+        ++evt_log_dax_msyncs;
+      }
+      persisted_ = off_;
+    }
+
+  private:
+    uint8_t *p_;
+    size_t sz_;
+    size_t off_;
+    size_t persisted_;
+    bool sync_;
+  };
+}
+
+static void
+sync_parent_dir(const string &fname)
+{
+  const size_t pos = fname.rfind('/');
+  const string dir = pos == string::npos ? "." : fname.substr(0, pos + 1);
+  const int fd = open(dir.c_str(), O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  if (fsync(fd) == -1) {
+    perror("fsync");
+    ALWAYS_ASSERT(false);
+  }
+  close(fd);
+}
 
 void
 txn_logger::Init(
@@ -60,7 +335,20 @@ txn_logger::Init(
     vector<vector<unsigned>> *assignments_used,
     bool call_fsync,
     bool use_compression,
-    bool fake_writes)
+    bool fake_writes,
+    size_t segment_size,
+    bool async_fsync,
+    uint64_t group_commit_us,
+    size_t ncompress_threads,
+    bool numa_aware,
+    bool use_dax,
+    const vector<string> &standbys,
+    size_t standby_quorum,
+    bool coalesce_writes,
+    bool compact_encoding,
+    size_t buffer_size,
+    size_t buffer_memory_budget,
+    size_t admission_lag_epochs)
 {
   INVARIANT(!g_persist);
   INVARIANT(g_nworkers == 0);
@@ -68,28 +356,111 @@ txn_logger::Init(
   INVARIANT(!logfiles.empty());
   INVARIANT(logfiles.size() <= g_nmax_loggers);
   INVARIANT(!use_compression || g_perthread_buffers > 1); // need 1 as scratch buf
+  if (use_dax && !segment_size)
+    segment_size = DefaultDaxSegmentSize;
+  g_segment_size = segment_size;
+  g_use_dax = use_dax && !fake_writes;
   vector<int> fds;
   for (auto &fname : logfiles) {
-    int fd = open(fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
-    if (fd == -1) {
+    int fd;
+    if (segment_size) {
+      // get rid of everything a previous run left behind, as O_TRUNC would
+      for (auto &seg : ListSegments(fname))
+        unlink(seg.c_str());
+      unlink(fname.c_str());
+      deque<log_segment> sealed;
+      fd = open_segment(fname, 0, sealed);
+    } else {
+      fd = open(fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+      if (fd == -1) {
+        perror("open");
+        ALWAYS_ASSERT(false);
+      }
+    }
+    fds.push_back(fd);
+  }
+  if (!fake_writes) {
+    const string pepoch_fname = logfiles[0] + g_pepoch_suffix;
+    g_pepoch_fd = open(pepoch_fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+    if (g_pepoch_fd == -1) {
       perror("open");
       ALWAYS_ASSERT(false);
     }
-    fds.push_back(fd);
   }
   g_persist = true;
   g_call_fsync = call_fsync;
   g_use_compression = use_compression;
   g_fake_writes = fake_writes;
+  g_async_fsync = async_fsync && call_fsync && !fake_writes && !g_use_dax &&
+    standbys.empty();
+  g_group_commit_us = group_commit_us;
+  g_ncompress_threads = use_compression ? ncompress_threads : 0;
+  g_pin_loggers_to_numa_nodes = numa_aware && numa_available() != -1;
+  // compressed buffers are opaque to the loggers
+  g_coalesce_writes = coalesce_writes && !use_compression;
+  g_compact_encoding = compact_encoding;
+  g_checksum = crc32c::IsHardwareAccelerated();
+  SetAdmissionLagEpochs(admission_lag_epochs);
   g_nworkers = nworkers;
 
+  g_buffer_size = buffer_size ? buffer_size : g_default_buffer_size;
+  // must hold a compressed horizon, and fit buf_sz_
+  ALWAYS_ASSERT(g_buffer_size >= 2 * g_horizon_buffer_size);
+  ALWAYS_ASSERT(g_buffer_size <= UINT_MAX);
+  g_buffer_memory_budget = buffer_memory_budget;
+  g_initial_buffers = g_perthread_buffers;
+  if (buffer_memory_budget) {
+    // half the budget is split between the cores up front, the other half
+    // goes to whichever cores outrun their loggers (see GrowBuffers())
+    const size_t nbufs = buffer_memory_budget / (sizeof(pbuffer) + g_buffer_size);
+    ALWAYS_ASSERT(nbufs >= 2 * nworkers); // each core needs two to make progress
+    g_initial_buffers =
+      min(g_perthread_buffers, max(size_t(2), nbufs / (2 * nworkers)));
+  }
+
   for (size_t i = 0; i < g_nmax_loggers; i++)
-    for (size_t j = 0; j < g_nworkers; j++)
+    for (size_t j = 0; j < g_nworkers; j++) {
       per_thread_sync_epochs_[i].epochs_[j].store(0, memory_order_release);
+      per_thread_sync_tids_[i].epochs_[j].store(0, memory_order_release);
+    }
+
+  // never freed, like event counters
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (!g_hist_logger_writev_us[i])
+      g_hist_logger_writev_us[i] =
+        new event_histogram("logger" + to_string(i) + "_writev_us");
+    if (!g_hist_logger_fsync_us[i])
+      g_hist_logger_fsync_us[i] =
+        new event_histogram("logger" + to_string(i) + "_fsync_us");
+  }
+
+  // also never freed. connecting up front means an unreachable standby
+  // fails Init() instead of the first commit
+  if (!standbys.empty()) {
+    for (size_t i = 0; i < fds.size(); i++)
+      g_log_shippers.push_back(new txn_log_shipper(
+            standbys, standby_quorum, txn_replication::STREAM_LOG, i));
+    g_epoch_shipper = new txn_log_shipper(
+        standbys, standby_quorum, txn_replication::STREAM_EPOCH, 0);
+  }
 
   vector<thread> writers;
   vector<vector<unsigned>> assignments(assignments_given);
 
+  vector<int> logger_nodes(fds.size(), -1);
+  if (g_pin_loggers_to_numa_nodes) {
+    // loggers whose device has no known node are spread over the nodes
+    const int nnodes = numa_num_configured_nodes();
+    for (size_t i = 0; i < fds.size(); i++) {
+      logger_nodes[i] = NumaNodeOfFile(
+          segment_size ? SegmentFileName(logfiles[i], 0) : logfiles[i]);
+      if (logger_nodes[i] < 0 || logger_nodes[i] >= nnodes)
+        logger_nodes[i] = i % nnodes;
+    }
+    if (assignments.empty())
+      assignments = ComputeNumaAssignments(g_nworkers, logger_nodes);
+  }
+
   if (assignments.empty()) {
     // compute assuming homogenous disks
     if (g_nworkers <= fds.size()) {
@@ -112,12 +483,29 @@ txn_logger::Init(
   INVARIANT(AssignmentsValid(assignments, fds.size(), g_nworkers));
 
   for (size_t i = 0; i < assignments.size(); i++) {
+    // run each logger on the node most of its workers are on
+    int node = -1;
+    if (g_pin_loggers_to_numa_nodes) {
+      map<int, size_t> counts;
+      for (auto w : assignments[i])
+        counts[numa_node_of_cpu(w % numa_num_configured_cpus())]++;
+      node = logger_nodes[i];
+      size_t best = 0;
+      for (auto &p : counts)
+        if (p.second > best) {
+          best = p.second;
+          node = p.first;
+        }
+    }
     writers.emplace_back(
         &txn_logger::writer,
-        i, fds[i], assignments[i]);
+        i, logfiles[i], fds[i], node, assignments[i]);
     writers.back().detach();
   }
 
+  for (size_t i = 0; i < g_ncompress_threads; i++)
+    thread(&txn_logger::compressor, i, g_ncompress_threads).detach();
+
   thread persist_thread(&txn_logger::persister, assignments);
   persist_thread.detach();
 
@@ -125,6 +513,55 @@ txn_logger::Init(
     *assignments_used = assignments;
 }
 
+int
+txn_logger::NumaNodeOfFile(const string &fname)
+{
+  struct stat st;
+  if (stat(fname.c_str(), &st) == -1)
+    return -1;
+  const string dev =
+    "/sys/dev/block/" + to_string(major(st.st_dev)) + ":" +
+    to_string(minor(st.st_dev));
+  // partitions are one level below their disk, and nvme namespaces one level
+  // below their controller
+  static const char *const suffixes[] = {
+    "/device/numa_node",
+    "/device/device/numa_node",
+    "/../device/numa_node",
+    "/../device/device/numa_node",
+  };
+  for (auto suffix : suffixes) {
+    ifstream ifs(dev + suffix);
+    int node;
+    if (ifs >> node)
+      return node;
+  }
+  return -1;
+}
+
+vector<vector<unsigned>>
+txn_logger::ComputeNumaAssignments(
+    size_t nworkers, const vector<int> &logger_nodes)
+{
+  vector<vector<unsigned>> assignments(logger_nodes.size());
+  map<int, vector<size_t>> loggers_by_node;
+  for (size_t i = 0; i < logger_nodes.size(); i++)
+    loggers_by_node[logger_nodes[i]].push_back(i);
+  vector<size_t> all_loggers;
+  for (size_t i = 0; i < logger_nodes.size(); i++)
+    all_loggers.push_back(i);
+  map<int, size_t> next_by_node;
+  for (size_t w = 0; w < nworkers; w++) {
+    const int node = numa_node_of_cpu(w % numa_num_configured_cpus());
+    auto it = loggers_by_node.find(node);
+    const vector<size_t> &candidates =
+      it == loggers_by_node.end() ? all_loggers : it->second;
+    size_t &next = next_by_node[node];
+    assignments[candidates[next++ % candidates.size()]].push_back(w);
+  }
+  return assignments;
+}
+
 void
 txn_logger::persister(
     vector<vector<unsigned>> assignments)
@@ -132,7 +569,8 @@ txn_logger::persister(
   timer loop_timer;
   for (;;) {
     const uint64_t last_loop_usec = loop_timer.lap();
-    const uint64_t delay_time_usec = ticker::tick_us;
+    const uint64_t delay_time_usec =
+      g_group_commit_us ? g_group_commit_us : ticker::TickUsec();
     if (last_loop_usec < delay_time_usec) {
       const uint64_t sleep_ns = (delay_time_usec - last_loop_usec) * 1000;
       struct timespec t;
@@ -149,6 +587,9 @@ txn_logger::advance_system_sync_epoch(
     const vector<vector<unsigned>> &assignments)
 {
   uint64_t min_so_far = numeric_limits<uint64_t>::max();
+  uint64_t min_tid_so_far = numeric_limits<uint64_t>::max();
+  const uint64_t round = g_group_commit_us ?
+    g_sync_rounds_started_.fetch_add(1, memory_order_acq_rel) + 1 : 0;
   const uint64_t best_tick_ex =
     ticker::s_instance.global_current_tick();
   // special case 0
@@ -165,7 +606,7 @@ txn_logger::advance_system_sync_epoch(
         // core->logger queue is empty, then that means we can advance its sync
         // epoch up to best_tick_inc, b/c it is guaranteed that the next time
         // it does any actions will be in epoch > best_tick_inc
-        if (!ctx.persist_buffers_.peek()) {
+        if (!ctx.persist_buffers_.peek() && !compress_pending(ctx)) {
           spinlock &l = ticker::s_instance.lock_for(k);
           if (!l.is_locked()) {
             bool did_lock = false;
@@ -176,10 +617,17 @@ txn_logger::advance_system_sync_epoch(
               }
             }
             if (did_lock) {
-              if (!ctx.persist_buffers_.peek()) {
+              if (!ctx.persist_buffers_.peek() && !compress_pending(ctx)) {
                 min_so_far = min(min_so_far, best_tick_inc);
                 per_thread_sync_epochs_[i].epochs_[k].store(
                     best_tick_inc, memory_order_release);
+                // every txn the core has committed so far is durable, unless
+                // it is still sitting in an unpushed buffer
+                if (g_group_commit_us && has_unpushed_txns(ctx))
+                  min_tid_so_far = min(
+                      min_tid_so_far,
+                      per_thread_sync_tids_[i].epochs_[k].load(
+                        memory_order_acquire));
                 l.unlock();
                 continue;
               }
@@ -191,14 +639,44 @@ txn_logger::advance_system_sync_epoch(
             per_thread_sync_epochs_[i].epochs_[k].load(
               memory_order_acquire),
             min_so_far);
+        if (g_group_commit_us)
+          min_tid_so_far = min(
+              per_thread_sync_tids_[i].epochs_[k].load(
+                memory_order_acquire),
+              min_tid_so_far);
       }
 
+  // a core's txns are persisted in TID order, so every txn with a TID <=
+  // min_tid_so_far was durable when this round started. an idle core can
+  // still commit a txn with a lower TID later on, but only in an epoch >
+  // best_tick_inc, so capped at the end of best_tick_inc, every txn there
+  // will ever be with a TID <= sync_tid is durable, and recovery can replay
+  // exactly those. it never moves back: whatever was below it stays so
+  const uint64_t prev_sync_tid = system_sync_tid_->load(memory_order_acquire);
+  const uint64_t sync_tid = !g_group_commit_us ? 0 :
+    max(prev_sync_tid,
+        min(min_tid_so_far,
+            transaction_proto2_static::MakeTid(
+              transaction_proto2_static::CoreMask,
+              transaction_proto2_static::NumIdMask >>
+                transaction_proto2_static::NumIdShift,
+              best_tick_inc)));
+
   const uint64_t syssync =
     system_sync_epoch_->load(memory_order_acquire);
 
   INVARIANT(min_so_far < numeric_limits<uint64_t>::max());
   INVARIANT(syssync <= min_so_far);
 
+  if (g_epoch_shipper && min_so_far != syssync) {
+    // every batch the epoch depends on was completed (and so replicated)
+    // before its epochs were published, which we read above
+    vector<uint64_t> seqs;
+    for (auto shipper : g_log_shippers)
+      seqs.push_back(shipper->completed_seq());
+    g_epoch_shipper->wait(g_epoch_shipper->ship_epoch(min_so_far, seqs));
+  }
+
   // need to aggregate from [syssync + 1, min_so_far]
   const uint64_t now_us = timer::cur_usec();
   for (size_t i = 0; i < g_persist_stats.size(); i++) {
@@ -212,22 +690,552 @@ txn_logger::advance_system_sync_epoch(
         non_atomic_fetch_add(
             ps.latency_numer_,
             (now_us - start_us) * ntxns_in_epoch);
+        if (ntxns_in_epoch)
+          g_hist_persist_latency_us.offer(now_us - start_us, ntxns_in_epoch);
         pes.ntxns_.store(0, memory_order_release);
         pes.earliest_start_us_.store(0, memory_order_release);
     }
   }
 
   system_sync_epoch_->store(min_so_far, memory_order_release);
+
+  if (g_pepoch_fd != -1 &&
+      (min_so_far != syssync || sync_tid != prev_sync_tid)) {
+    const uint64_t v[2] = {min_so_far, sync_tid};
+    const size_t n = g_group_commit_us ? sizeof(v) : sizeof(v[0]);
+    const ssize_t ret = pwrite(g_pepoch_fd, v, n, 0);
+    if (unlikely(ret != ssize_t(n))) {
+      perror("pwrite");
+      ALWAYS_ASSERT(false);
+    }
+    if (g_call_fsync && unlikely(fdatasync(g_pepoch_fd) == -1)) {
+      perror("fdatasync");
+      ALWAYS_ASSERT(false);
+    }
+  }
+
+  if (g_group_commit_us) {
+    // txns are only credited as durable once recovery would replay them.
+    // the round number is published last, so readers never pair a stale
+    // TID with a newer round
+    system_sync_tid_->store(sync_tid, memory_order_release);
+    g_sync_rounds_done_.store(round, memory_order_release);
+  }
+
+  // only once the persistent epoch itself is on disk, so recovery agrees
+  // with what the callbacks were told
+  if (min_so_far != syssync)
+    fire_durable_callbacks(min_so_far);
+}
+
+void
+txn_logger::fire_durable_callbacks(uint64_t epoch)
+{
+  vector<pair<uint64_t, durable_callback *>> ready;
+  for (size_t k = 0; k < g_durable_waiters.size(); k++) {
+    durable_waiters &w = g_durable_waiters[k];
+    if (!w.size_.load(memory_order_acquire))
+      continue;
+    {
+      std::lock_guard<spinlock> l(w.lock_);
+      while (!w.q_.empty() &&
+             transaction_proto2_static::EpochId(w.q_.front().first) <= epoch) {
+        ready.push_back(w.q_.front());
+        w.q_.pop_front();
+      }
+      w.size_.store(w.q_.size(), memory_order_release);
+    }
+    for (auto &p : ready)
+      p.second->on_durable(p.first);
+    evt_durable_callbacks += ready.size();
+    ready.clear();
+  }
+}
+
+void
+txn_logger::NotifyOnDurable(uint64_t tid, durable_callback *cb)
+{
+  if (!IsPersistenceEnabled()) {
+    cb->on_durable(tid);
+    return;
+  }
+  durable_waiters &w = g_durable_waiters.my();
+  std::lock_guard<spinlock> l(w.lock_);
+  INVARIANT(w.q_.empty() ||
+            transaction_proto2_static::EpochId(w.q_.back().first) <=
+            transaction_proto2_static::EpochId(tid));
+  w.q_.emplace_back(tid, cb);
+  w.size_.store(w.q_.size(), memory_order_release);
+}
+
+namespace {
+  // deletes itself once called
+  class trace_durable_callback : public txn_logger::durable_callback {
+  public:
+    trace_durable_callback() : start_(util::timer::cur_usec()) {}
+
+    virtual void
+    on_durable(uint64_t tid)
+    {
+      txn_tracer::RecordDurable(tid, util::timer::cur_usec() - start_);
+      delete this;
+    }
+
+  private:
+    const uint64_t start_;
+  };
+}
+
+void
+txn_logger::TraceDurable(uint64_t tid)
+{
+  NotifyOnDurable(tid, new trace_durable_callback);
+}
+
+void
+txn_logger::compressor(unsigned id, unsigned n)
+{
+  // horizons come from the workers' commit paths, which we won't make
+  // notify us, so a compressor with nothing to do for a while checks back
+  // every IdleSleepUsec instead of spinning
+  static const uint64_t IdleSleepUsec = 100;
+  unsigned nidle = 0;
+  for (;;) {
+    bool did_work = false;
+    for (size_t k = id; k < NMAXCORES; k += n) {
+      persist_ctx &ctx = persist_ctx_for(k, INITMODE_NONE);
+      if (!ctx.init_)
+        continue;
+      pbuffer *horizon;
+      // leave the horizon in the queue until we are finished with it, so the
+      // core does not look idle in the meantime
+      while ((horizon = ctx.compress_queue_.peek())) {
+        const bool flush = horizon->flush_;
+        persist_stats &stats = g_persist_stats[k];
+        const uint64_t npushed =
+          transaction_proto2_static::push_horizon_to_buffer(
+              horizon, ctx.lz4ctx_, ctx.all_buffers_, ctx.persist_buffers_);
+        if (npushed)
+          non_atomic_fetch_add(stats.ntxns_pushed_, npushed);
+        pbuffer *px;
+        if (flush &&
+            (px = ctx.all_buffers_.peek()) &&
+            px->header()->nentries_) {
+          pbuffer *px0 = ctx.all_buffers_.deq();
+          INVARIANT(px == px0);
+          non_atomic_fetch_add(stats.ntxns_pushed_, uint64_t(px0->header()->nentries_));
+          ctx.persist_buffers_.enq(px0);
+        }
+        horizon->reset();
+        pbuffer *horizon0 = ctx.compress_queue_.deq();
+        INVARIANT(horizon == horizon0);
+        ctx.free_horizons_.enq(horizon0);
+        did_work = true;
+      }
+    }
+    if (did_work) {
+      nidle = 0;
+    } else if (++nidle < futex::SpinsBeforeBlocking) {
+      nop_pause();
+    } else {
+      ++evt_log_compressor_idle_sleeps;
+      struct timespec t;
+      t.tv_sec  = 0;
+      t.tv_nsec = IdleSleepUsec * 1000;
+      nanosleep(&t, nullptr);
+    }
+  }
+}
+
+bool
+txn_logger::GrowBuffers(unsigned core_id)
+{
+  if (!g_buffer_memory_budget)
+    return false;
+  persist_ctx &ctx = persist_ctx_for(core_id, INITMODE_NONE);
+  INVARIANT(ctx.init_);
+  // only the caller adds to nbuffers_, so this check cannot go stale
+  if (ctx.nbuffers_.load(memory_order_acquire) >= g_perthread_buffers)
+    return false;
+  const size_t nbytes = sizeof(pbuffer) + g_buffer_size;
+  size_t used = g_buffer_memory_used.load(memory_order_acquire);
+  do {
+    if (used + nbytes > g_buffer_memory_budget)
+      return false;
+  } while (!g_buffer_memory_used.compare_exchange_weak(used, used + nbytes));
+  char *mem = (char *) malloc(nbytes);
+  ALWAYS_ASSERT(mem);
+  ctx.nbuffers_.fetch_add(1, memory_order_acq_rel);
+  ctx.all_buffers_.enq(new (mem) pbuffer(core_id, g_buffer_size, true));
+  ++evt_log_buffers_grown;
+  return true;
+}
+
+bool
+txn_logger::has_unpushed_txns(persist_ctx &ctx)
+{
+  if (!ctx.init_)
+    return false;
+  if (g_use_compression && ctx.horizon_->header()->nentries_)
+    return true;
+  if (compress_pending(ctx))
+    return true;
+  pbuffer *px = ctx.all_buffers_.peek();
+  return px && px->header()->nentries_;
+}
+
+uint32_t
+txn_logger::TableIdFromName(const string &name)
+{
+  // 32-bit FNV-1a
+  uint32_t h = 2166136261U;
+  for (auto c : name) {
+    h ^= uint8_t(c);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static const concurrent_btree *const TableTombstone =
+  reinterpret_cast<const concurrent_btree *>(0x1);
+
+void
+txn_logger::RegisterTable(const string &name, const concurrent_btree *btr)
+{
+  INVARIANT(btr && btr != TableTombstone);
+  const uint32_t id = TableIdFromName(name);
+  ::lock_guard<spinlock> l(g_tables_lock);
+  for (size_t i = TableSlotFor(btr), n = 0;
+       n < g_nmax_tables;
+       i = (i + 1) & (g_nmax_tables - 1), n++) {
+    const concurrent_btree *px = g_tables[i].btr_.load(memory_order_acquire);
+    INVARIANT(px != btr);
+    if (!px || px == TableTombstone) {
+      g_tables[i].id_ = id;
+      g_tables[i].all_fields_.store(0, memory_order_release);
+      g_tables[i].btr_.store(btr, memory_order_release);
+      return;
+    }
+  }
+  ALWAYS_ASSERT(false); // too many tables
+}
+
+void
+txn_logger::UnregisterTable(const concurrent_btree *btr)
+{
+  ::lock_guard<spinlock> l(g_tables_lock);
+  for (size_t i = TableSlotFor(btr), n = 0;
+       n < g_nmax_tables;
+       i = (i + 1) & (g_nmax_tables - 1), n++) {
+    const concurrent_btree *px = g_tables[i].btr_.load(memory_order_acquire);
+    if (px == btr) {
+      g_tables[i].btr_.store(TableTombstone, memory_order_release);
+      return;
+    }
+    if (!px)
+      break;
+  }
+  ALWAYS_ASSERT(false);
+}
+
+void
+txn_logger::SetTableFieldsMask(const concurrent_btree *btr, uint64_t all_fields)
+{
+  INVARIANT(all_fields);
+  ::lock_guard<spinlock> l(g_tables_lock);
+  for (size_t i = TableSlotFor(btr), n = 0;
+       n < g_nmax_tables;
+       i = (i + 1) & (g_nmax_tables - 1), n++) {
+    const concurrent_btree *px = g_tables[i].btr_.load(memory_order_acquire);
+    if (px == btr) {
+      g_tables[i].all_fields_.store(all_fields, memory_order_release);
+      return;
+    }
+    if (!px)
+      break;
+  }
+  ALWAYS_ASSERT(false);
+}
+
+size_t
+txn_logger::CoalesceWrites(uint8_t *p, size_t n, bool compact)
+{
+  struct txn_extent {
+    uint64_t tid_;
+    size_t nwrites_;
+  };
+  struct write_extent {
+    uint64_t tid_;
+    const uint8_t *v_; // of the value, in the copy of the buffer
+    uint32_t vlen_;
+    bool keep_;
+  };
+
+  // the table ids the buffer writes to are looked up once each, since tables
+  // are indexed by btree
+  unordered_map<uint32_t, uint64_t> all_fields;
+  auto all_fields_for = [&all_fields](uint32_t table_id) {
+    auto it = all_fields.find(table_id);
+    if (it != all_fields.end())
+      return it->second;
+    uint64_t m = 0;
+    for (size_t i = 0; i < g_nmax_tables; i++) {
+      const concurrent_btree *px = g_tables[i].btr_.load(memory_order_acquire);
+      if (px && px != TableTombstone && g_tables[i].id_ == table_id) {
+        m = g_tables[i].all_fields_.load(memory_order_acquire);
+        break;
+      }
+    }
+    all_fields[table_id] = m;
+    return m;
+  };
+
+  // the kept writes are encoded again (keys are prefix compressed against
+  // the write before them), so they are decoded out of a copy
+  const string buf((const char *) p, n);
+  serializer<uint32_t, true> vs_uint32_t;
+  txn_decoder dec(compact);
+  vector<txn_extent> txns;
+  vector<write_extent> writes;
+  vector<string> keys; // [table id][key]
+  vector<bool> supersedes;
+
+  const uint8_t *q = (const uint8_t *) buf.data();
+  const uint8_t * const end = q + n;
+  while (q < end) {
+    txn_extent t;
+    uint32_t nwrites;
+    q = dec.read_txn(q, end, t.tid_, nwrites);
+    if (unlikely(!q))
+      // not a buffer we can parse: leave it as it was
+      return n;
+    t.nwrites_ = nwrites;
+    txns.push_back(t);
+    for (uint32_t i = 0; i < nwrites; i++) {
+      uint32_t table_id, klen, vlen;
+      const uint8_t *k;
+      q = dec.read_key(q, end, table_id, k, klen);
+      if (unlikely(!q || q == end))
+        return n;
+      string key((const char *) &table_id, sizeof(table_id));
+      key.append((const char *) k, klen);
+      q = vs_uint32_t.read(q, &vlen);
+      if (unlikely(q > end || vlen > size_t(end - q)))
+        return n;
+      bool whole = true;
+      if (vlen) {
+        const uint64_t m = all_fields_for(table_id);
+        if (m) {
+          INVARIANT(vlen >= sizeof(uint64_t));
+          uint64_t fields;
+          NDB_MEMCPY(&fields, q, sizeof(fields));
+          whole = (fields & m) == m;
+        }
+      }
+      writes.push_back(write_extent{t.tid_, q, vlen, true});
+      keys.emplace_back(move(key));
+      supersedes.push_back(whole);
+      q += vlen;
+    }
+  }
+  INVARIANT(q == end);
+
+  // a write is dropped if a later one wholly replaces it
+  unordered_map<string, uint64_t> superseded_by; // => tid of the latest
+  size_t ndropped = 0;
+  for (size_t i = writes.size(); i-- > 0; ) {
+    auto it = superseded_by.find(keys[i]);
+    if (it != superseded_by.end() && it->second > writes[i].tid_) {
+      writes[i].keep_ = false;
+      ndropped++;
+    }
+    if (supersedes[i]) {
+      uint64_t &tid = superseded_by[keys[i]];
+      tid = max(tid, writes[i].tid_);
+    }
+  }
+  if (!ndropped)
+    return n;
+
+  // the kept writes are encoded into scratch space sized for the worst
+  // case. they should fit back in the buffer, as a dropped write takes more
+  // bytes than the key after it can lose of the prefix it shared, but if they
+  // ever do not, the buffer is left as it was
+  const size_t MaxVarint32NBytes = 5;
+  size_t bound = txns.size() *
+    (txn_encoder::MaxTidNBytes(compact) + MaxVarint32NBytes);
+  for (size_t i = 0; i < writes.size(); i++)
+    if (writes[i].keep_)
+      bound += 4 * MaxVarint32NBytes + keys[i].size() + writes[i].vlen_;
+  vector<uint8_t> scratch(bound);
+  txn_encoder enc(compact, 0);
+  uint8_t * const start = scratch.data();
+  uint8_t *out = start;
+  size_t widx = 0;
+  for (auto &t : txns) {
+    uint32_t nkept = 0;
+    for (size_t i = widx; i < widx + t.nwrites_; i++)
+      nkept += writes[i].keep_;
+    out = enc.write_txn(out, t.tid_, nkept);
+    for (size_t i = widx; i < widx + t.nwrites_; i++) {
+      const write_extent &w = writes[i];
+      if (!w.keep_)
+        continue;
+      uint32_t table_id;
+      NDB_MEMCPY(&table_id, keys[i].data(), sizeof(table_id));
+      out = enc.write_key(
+          out, table_id, (const uint8_t *) keys[i].data() + sizeof(table_id),
+          keys[i].size() - sizeof(table_id));
+      out = vs_uint32_t.write(out, w.vlen_);
+      NDB_MEMCPY(out, w.v_, w.vlen_);
+      out += w.vlen_;
+    }
+    widx += t.nwrites_;
+  }
+  const size_t nout = out - start;
+  INVARIANT(nout <= bound);
+  if (unlikely(nout > n))
+    return n;
+  NDB_MEMCPY(p, start, nout);
+  evt_logger_coalesced_writes += ndropped;
+  evt_logger_coalesced_bytes += n - nout;
+  return nout;
+}
+
+string
+txn_logger::SegmentFileName(const string &logfile, uint64_t segno)
+{
+  return logfile + ".seg." + to_string(segno);
+}
+
+vector<string>
+txn_logger::ListSegments(const string &logfile)
+{
+  const size_t pos = logfile.rfind('/');
+  const string dir = pos == string::npos ? "." : logfile.substr(0, pos + 1);
+  const string prefix =
+    (pos == string::npos ? logfile : logfile.substr(pos + 1)) + ".seg.";
+  vector<pair<uint64_t, string>> segs;
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return vector<string>();
+  while (struct dirent *ent = readdir(d)) {
+    const string name = ent->d_name;
+    if (name.size() <= prefix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0)
+      continue;
+    const string suffix = name.substr(prefix.size());
+    if (suffix.find_first_not_of("0123456789") != string::npos)
+      continue;
+    segs.emplace_back(stoull(suffix), SegmentFileName(logfile, stoull(suffix)));
+  }
+  closedir(d);
+  sort(segs.begin(), segs.end());
+  vector<string> ret;
+  for (auto &p : segs)
+    ret.emplace_back(move(p.second));
+  return ret;
+}
+
+int
+txn_logger::open_segment(
+    const string &logfile, uint64_t segno,
+    deque<log_segment> &sealed)
+{
+  const string fname = SegmentFileName(logfile, segno);
+
+  // the oldest unneeded segment is renamed into place, which saves creating
+  // a new file. the rest are deleted so the log does not grow without bound
+  const uint64_t tepoch = g_truncation_epoch.load(memory_order_acquire);
+  string recycled;
+  while (!sealed.empty() && sealed.front().max_epoch_ <= tepoch) {
+    const string old_fname = SegmentFileName(logfile, sealed.front().segno_);
+    sealed.pop_front();
+    if (recycled.empty()) {
+      recycled = old_fname;
+      continue;
+    }
+    if (unlink(old_fname.c_str()) == -1) {
+      perror("unlink");
+      ALWAYS_ASSERT(false);
+    }
+    ++evt_log_segments_deleted;
+  }
+  if (!recycled.empty()) {
+    if (rename(recycled.c_str(), fname.c_str()) == -1) {
+      perror("rename");
+      ALWAYS_ASSERT(false);
+    }
+    ++evt_log_segments_recycled;
+  } else {
+    ++evt_log_segments_created;
+  }
+
+  // the file is truncated so recovery never sees stale buffers, but its space
+  // is reserved up front so appends do not allocate extents (mapped
+  // segments are sized when they are mapped instead)
+  const int fd = open(fname.c_str(),
+      O_CREAT|(g_use_dax ? O_RDWR : O_WRONLY)|O_TRUNC, 0664);
+  if (fd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  // best effort, not every filesystem supports this
+  if (!g_use_dax)
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, g_segment_size);
+  if (g_call_fsync)
+    sync_parent_dir(fname);
+  return fd;
 }
 
+void
+txn_logger::release_durable_buffers(
+    const vector<unsigned> &assignment,
+    vector<deque<undurable_buffer>> &undurable)
+{
+  const uint64_t round = g_sync_rounds_done_.load(memory_order_acquire);
+  const uint64_t tid = system_sync_tid_->load(memory_order_acquire);
+  const uint64_t now_us = timer::cur_usec();
+  for (auto idx : assignment)
+    for (size_t k = idx; k < NMAXCORES; k += g_nworkers) {
+      auto &q = undurable[k];
+      auto &ps = g_persist_stats[k];
+      while (!q.empty() &&
+             q.front().round_ < round &&
+             q.front().last_tid_ <= tid) {
+        const undurable_buffer &b = q.front();
+        INVARIANT(now_us >= b.earliest_start_us_);
+        non_atomic_fetch_add(ps.ntxns_persisted_, b.nentries_);
+        non_atomic_fetch_add(
+            ps.latency_numer_,
+            (now_us - b.earliest_start_us_) * b.nentries_);
+        g_hist_persist_latency_us.offer(
+            now_us - b.earliest_start_us_, b.nentries_);
+        q.pop_front();
+      }
+    }
+}
+
+#ifdef LOGGER_UNSAFE_REDUCE_BUFFER_SIZE
+  #define PXLEN(px) (((px)->curoff_ < 4) ? (px)->curoff_ : ((px)->curoff_ / 4))
+#else
+  #define PXLEN(px) ((px)->curoff_)
+#endif
+
 void
 txn_logger::writer(
-    unsigned id, int fd,
+    unsigned id, string logfile, int fd, int numa_node,
     vector<unsigned> assignment)
 {
 
-  if (g_pin_loggers_to_numa_nodes) {
-    ALWAYS_ASSERT(!numa_run_on_node(id % numa_num_configured_nodes()));
+  // the pbuffers were allocated by (and so are local to) the workers, so
+  // running here keeps the logger's reads of them off the interconnect. a
+  // placement plan put the logger on a cpu of its workers' socket
+  const int cpu = thread_placement::LoggerCpu(id);
+  if (cpu >= 0) {
+    thread_placement::PinCurrentThread(cpu);
+  } else if (numa_node >= 0) {
+    ALWAYS_ASSERT(!numa_run_on_node(numa_node));
     ALWAYS_ASSERT(!sched_yield());
   }
 
@@ -236,23 +1244,114 @@ txn_logger::writer(
   vector<pbuffer *> pxs;
   timer loop_timer;
 
-  // XXX: sense is not useful for now, unless we want to
-  // fsync in the background...
+  // with g_async_fsync, the previous batch (at !sense) can still be waiting
+  // on its fdatasync() while the current batch (at sense) is being written
   bool sense = false; // cur is at sense, prev is at !sense
   uint64_t epoch_prefixes[2][NMAXCORES];
+  size_t nscheduled[2][NMAXCORES]; // # of buffers in each batch, per core
 
   NDB_MEMSET(&epoch_prefixes[0], 0, sizeof(epoch_prefixes[0]));
   NDB_MEMSET(&epoch_prefixes[1], 0, sizeof(epoch_prefixes[1]));
+  NDB_MEMSET(&nscheduled[0], 0, sizeof(nscheduled[0]));
+  NDB_MEMSET(&nscheduled[1], 0, sizeof(nscheduled[1]));
+
+  uint64_t last_tids[2][NMAXCORES]; // only used with group commit
+  vector<deque<undurable_buffer>> undurable(
+      g_group_commit_us ? NMAXCORES : 0);
+
+  event_histogram &writev_hist = *g_hist_logger_writev_us[id];
+  event_histogram &fsync_hist = *g_hist_logger_fsync_us[id];
+
+  txn_log_shipper * const shipper =
+    g_log_shippers.empty() ? nullptr : g_log_shippers[id];
+  INVARIANT(!shipper || !g_async_fsync);
+
+  unique_ptr<background_syncer> syncer(
+      g_async_fsync ? new background_syncer(&fsync_hist) : nullptr);
+  bool sync_pending = false; // is the batch at !sense being flushed?
+
+  // once a batch is durable: update metadata, and return its buffers. its
+  // buffers must stay in the persist queues until then, otherwise the
+  // persister considers their cores idle
+  epoch_array &ea = per_thread_sync_epochs_[id];
+  epoch_array &ta = per_thread_sync_tids_[id];
+  auto complete_batch = [&](bool s) {
+    // read before publishing the tids, see undurable_buffer
+    const uint64_t round = g_sync_rounds_started_.load(memory_order_acquire);
+    for (auto idx: assignment) {
+      for (size_t k = idx; k < NMAXCORES; k += g_nworkers) {
+        const uint64_t x0 = ea.epochs_[k].load(memory_order_acquire);
+        const uint64_t x1 = epoch_prefixes[s][k];
+        if (x1 > x0)
+          ea.epochs_[k].store(x1, memory_order_release);
+        if (g_group_commit_us && nscheduled[s][k])
+          ta.epochs_[k].store(last_tids[s][k], memory_order_release);
+
+        persist_ctx &ctx = persist_ctx_for(k, INITMODE_NONE);
+
+        // the core should keep enough buffers to fill while twice its
+        // recent peak per batch is written out; grown buffers past that are
+        // freed, so the core's share of the budget follows its log rate
+        ctx.peak_nscheduled_ =
+          max(nscheduled[s][k], ctx.peak_nscheduled_ * 7 / 8);
+        const size_t nkeep = max(g_initial_buffers, 2 * ctx.peak_nscheduled_);
+
+        for (; nscheduled[s][k]; nscheduled[s][k]--) {
+          pbuffer *px = ctx.persist_buffers_.deq();
+          INVARIANT(px);
+          INVARIANT(px->io_scheduled_);
+#ifdef LOGGER_STRIDE_OVER_BUFFER
+          {
+            const size_t pxlen = PXLEN(px);
+            const size_t stridelen = 1;
+            for (size_t p = 0; p < pxlen; p += stridelen)
+              if ((&px->buf_start_[0])[p] & 0xF)
+                non_atomic_fetch_add(ea.dummy_work_, 1UL);
+          }
+#endif
+          INVARIANT(px->header()->nentries_);
+          if (g_group_commit_us)
+            undurable[k].push_back({
+                px->header()->last_tid_, BufferNEntries(*px->header()),
+                px->earliest_start_us_, round});
+          INVARIANT(ctx.init_);
+          INVARIANT(px->core_id_ == k);
+          if (px->grown_ && ctx.nbuffers_.load(memory_order_acquire) > nkeep) {
+            ctx.nbuffers_.fetch_sub(1, memory_order_acq_rel);
+            g_buffer_memory_used.fetch_sub(sizeof(pbuffer) + g_buffer_size);
+            free(px);
+            ++evt_log_buffers_freed;
+            continue;
+          }
+          px->reset();
+          ctx.all_buffers_.enq(px);
+        }
+      }
+    }
+  };
+
+  // only used if g_segment_size > 0
+  uint64_t segno = 0, seg_nbytes = 0, seg_max_epoch = 0;
+  deque<log_segment> sealed;
+
+  // only used if g_use_dax
+  dax_segment dax;
+  if (g_use_dax)
+    dax.map(fd, g_segment_size);
 
   // NOTE: a core id in the persistence system really represets
   // all cores in the regular system modulo g_nworkers
   size_t nbufswritten = 0, nbyteswritten = 0;
   for (;;) {
 
+    if (g_group_commit_us)
+      release_durable_buffers(assignment, undurable);
+
     const uint64_t last_loop_usec = loop_timer.lap();
-    const uint64_t delay_time_usec = ticker::tick_us;
-    // don't allow this loop to proceed less than an epoch's worth of time,
-    // so we can batch IO
+    const uint64_t delay_time_usec =
+      g_group_commit_us ? g_group_commit_us : ticker::TickUsec();
+    // don't allow this loop to proceed less than an epoch's worth of time
+    // (or the group commit interval), so we can batch IO
     if (last_loop_usec < delay_time_usec && nbufswritten < iovs.size()) {
       const uint64_t sleep_ns = (delay_time_usec - last_loop_usec) * 1000;
       struct timespec t;
@@ -275,7 +1374,11 @@ txn_logger::writer(
         ctx.persist_buffers_.peekall(pxs);
         for (auto px : pxs) {
           INVARIANT(px);
-          INVARIANT(!px->io_scheduled_);
+          if (px->io_scheduled_) {
+            // belongs to the batch which is still being flushed
+            INVARIANT(sync_pending);
+            continue;
+          }
           INVARIANT(nbufswritten <= iovs.size());
           INVARIANT(px->header()->nentries_);
           INVARIANT(px->core_id_ == k);
@@ -288,19 +1391,24 @@ txn_logger::writer(
             ++g_evt_logger_max_lag_wait;
             break;
           }
-          iovs[nbufswritten].iov_base = (void *) &px->buf_start_[0];
+          if (g_coalesce_writes)
+            px->curoff_ = sizeof(logbuf_header) +
+              CoalesceWrites(px->datastart(), px->datasize(),
+                             g_compact_encoding);
+          if (g_compact_encoding)
+            px->header()->nentries_ |= CompactBufferBit;
+          if (g_checksum)
+            px->header()->crc_ =
+              BufferChecksum(*px->header(), px->datastart(), px->datasize());
 
-#ifdef LOGGER_UNSAFE_REDUCE_BUFFER_SIZE
-  #define PXLEN(px) (((px)->curoff_ < 4) ? (px)->curoff_ : ((px)->curoff_ / 4))
-#else
-  #define PXLEN(px) ((px)->curoff_)
-#endif
+          iovs[nbufswritten].iov_base = (void *) &px->buf_start_[0];
 
           const size_t pxlen = PXLEN(px);
 
           iovs[nbufswritten].iov_len = pxlen;
           evt_avg_log_buffer_iov_len.offer(pxlen);
           px->io_scheduled_ = true;
+          nscheduled[sense][k]++;
           nbufswritten++;
           nbyteswritten += pxlen;
 
@@ -323,40 +1431,105 @@ txn_logger::writer(
           INVARIANT(epoch_prefixes[sense][k] <= px_epoch);
           INVARIANT(px_epoch > 0);
           epoch_prefixes[sense][k] = px_epoch - 1;
-          auto &pes = g_persist_stats[k].d_[px_epoch % g_max_lag_epochs];
-          if (!pes.ntxns_.load(memory_order_acquire))
-            pes.earliest_start_us_.store(px->earliest_start_us_, memory_order_release);
-          non_atomic_fetch_add(pes.ntxns_, px->header()->nentries_);
-          g_evt_avg_log_entry_ntxns.offer(px->header()->nentries_);
+          seg_max_epoch = max(seg_max_epoch, px_epoch);
+          last_tids[sense][k] = px->header()->last_tid_;
+          if (!g_group_commit_us) {
+            // otherwise accounted for by release_durable_buffers()
+            auto &pes = g_persist_stats[k].d_[px_epoch % g_max_lag_epochs];
+            if (!pes.ntxns_.load(memory_order_acquire))
+              pes.earliest_start_us_.store(px->earliest_start_us_, memory_order_release);
+            non_atomic_fetch_add(pes.ntxns_, uint64_t(BufferNEntries(*px->header())));
+          }
+          g_evt_avg_log_entry_ntxns.offer(BufferNEntries(*px->header()));
         }
       }
     }
 
   process:
     if (!nbufswritten) {
+      if (sync_pending && syncer->done()) {
+        complete_batch(!sense);
+        sync_pending = false;
+      }
       // XXX: should probably sleep here
       nop_pause();
       continue;
     }
 
     const bool dosense = sense;
+    bool durable = true; // is the batch at dosense durable yet?
+
+    // the standbys write the batch while we do
+    const uint64_t ship_seq =
+      shipper ? shipper->ship(&iovs[0], nbufswritten, nbyteswritten) : 0;
+    g_nbytes_written[id]->fetch_add(nbyteswritten, memory_order_relaxed);
 
-    if (!g_fake_writes) {
+    if (g_use_dax) {
 #ifdef ENABLE_EVENT_COUNTERS
       timer write_timer;
 #endif
+      const uint64_t copy_start_us = timer::cur_usec();
+      for (size_t i = 0; i < nbufswritten; i++) {
+        if (unlikely(!dax.fits(iovs[i].iov_len))) {
+          // segments only ever end on a buffer boundary. the next segment
+          // may also hold buffers of this batch, so it inherits the batch's
+          // epochs
+          if (g_call_fsync)
+            dax.persist();
+          dax.unmap();
+          close(fd);
+          sealed.push_back({segno, seg_max_epoch});
+          fd = open_segment(logfile, ++segno, sealed);
+          ALWAYS_ASSERT(iovs[i].iov_len <= g_segment_size);
+          dax.map(fd, g_segment_size);
+        }
+        dax.append(iovs[i].iov_base, iovs[i].iov_len);
+      }
+      const uint64_t copy_end_us = timer::cur_usec();
+      writev_hist.offer(copy_end_us - copy_start_us);
+      if (g_call_fsync) {
+        dax.persist();
+        fsync_hist.offer(timer::cur_usec() - copy_end_us);
+      }
+
+#ifdef ENABLE_EVENT_COUNTERS
+      {
+        g_evt_avg_logger_bytes_per_writev.offer(nbyteswritten);
+        const double bytes_per_sec =
+          double(nbyteswritten)/(write_timer.lap_ms() / 1000.0);
+        g_evt_avg_logger_bytes_per_sec.offer(bytes_per_sec);
+      }
+#endif
+    } else if (!g_fake_writes) {
+#ifdef ENABLE_EVENT_COUNTERS
+      timer write_timer;
+#endif
+      const uint64_t writev_start_us = timer::cur_usec();
       const ssize_t ret = writev(fd, &iovs[0], nbufswritten);
       if (unlikely(ret == -1)) {
         perror("writev");
         ALWAYS_ASSERT(false);
       }
+      const uint64_t writev_end_us = timer::cur_usec();
+      writev_hist.offer(writev_end_us - writev_start_us);
 
-      if (g_call_fsync) {
+      if (syncer) {
+        // a flush only covers the previous batch once it has finished,
+        // after which the current batch can be handed off
+        if (sync_pending) {
+          syncer->wait();
+          complete_batch(!dosense);
+        }
+        syncer->start(fd);
+        sync_pending = true;
+        durable = false;
+      } else if (g_call_fsync) {
         const int fret = fdatasync(fd);
         if (unlikely(fret == -1)) {
           perror("fdatasync");
           ALWAYS_ASSERT(false);
         }
+        fsync_hist.offer(timer::cur_usec() - writev_end_us);
       }
 
 #ifdef ENABLE_EVENT_COUNTERS
@@ -367,43 +1540,28 @@ txn_logger::writer(
         g_evt_avg_logger_bytes_per_sec.offer(bytes_per_sec);
       }
 #endif
-    }
-
-    // update metadata from previous write
-    //
-    // return all buffers that have been io_scheduled_ - we can do this as
-    // soon as write returns. we take care to return to the proper buffer
-    epoch_array &ea = per_thread_sync_epochs_[id];
-    for (auto idx: assignment) {
-      for (size_t k = idx; k < NMAXCORES; k += g_nworkers) {
-        const uint64_t x0 = ea.epochs_[k].load(memory_order_acquire);
-        const uint64_t x1 = epoch_prefixes[dosense][k];
-        if (x1 > x0)
-          ea.epochs_[k].store(x1, memory_order_release);
 
-        persist_ctx &ctx = persist_ctx_for(k, INITMODE_NONE);
-        pbuffer *px, *px0;
-        while ((px = ctx.persist_buffers_.peek()) && px->io_scheduled_) {
-#ifdef LOGGER_STRIDE_OVER_BUFFER
-          {
-            const size_t pxlen = PXLEN(px);
-            const size_t stridelen = 1;
-            for (size_t p = 0; p < pxlen; p += stridelen)
-              if ((&px->buf_start_[0])[p] & 0xF)
-                non_atomic_fetch_add(ea.dummy_work_, 1UL);
-          }
-#endif
-          px0 = ctx.persist_buffers_.deq();
-          INVARIANT(px == px0);
-          INVARIANT(px->header()->nentries_);
-          px0->reset();
-          INVARIANT(ctx.init_);
-          INVARIANT(px0->core_id_ == k);
-          ctx.all_buffers_.enq(px0);
+      // segments only ever end on a buffer boundary
+      seg_nbytes += nbyteswritten;
+      if (g_segment_size && seg_nbytes >= g_segment_size) {
+        if (sync_pending) {
+          syncer->wait();
+          sync_pending = false;
+          durable = true;
         }
+        close(fd);
+        sealed.push_back({segno, seg_max_epoch});
+        fd = open_segment(logfile, ++segno, sealed);
+        seg_nbytes = seg_max_epoch = 0;
       }
     }
 
+    if (durable) {
+      if (shipper)
+        shipper->wait(ship_seq);
+      complete_batch(dosense);
+    }
+
     // bump the sense
     sense = !sense;
   }
@@ -442,6 +1600,17 @@ txn_logger::clear_ntxns_persisted_statistics()
       pes.earliest_start_us_.store(0, memory_order_release);
     }
   }
+  for (size_t i = 0; i < g_nmax_loggers; i++)
+    g_nbytes_written[i]->store(0, memory_order_release);
+}
+
+uint64_t
+txn_logger::compute_nbytes_written()
+{
+  uint64_t ret = 0;
+  for (size_t i = 0; i < g_nmax_loggers; i++)
+    ret += g_nbytes_written[i]->load(memory_order_acquire);
+  return ret;
 }
 
 void
@@ -459,6 +1628,24 @@ txn_logger::wait_for_idle_state()
   }
 }
 
+void
+txn_logger::WaitForAdmission(uint64_t delay_us)
+{
+  ++evt_admission_delayed_txns;
+  evt_avg_admission_delay_us.offer(delay_us);
+  // short delays are spun out, since a sleep would overshoot them
+  if (delay_us < 100) {
+    const uint64_t until_us = timer::cur_usec() + delay_us;
+    while (timer::cur_usec() < until_us)
+      nop_pause();
+    return;
+  }
+  struct timespec t;
+  t.tv_sec  = delay_us / 1000000;
+  t.tv_nsec = (delay_us % 1000000) * 1000;
+  nanosleep(&t, nullptr);
+}
+
 void
 txn_logger::wait_until_current_point_persisted()
 {
@@ -477,6 +1664,12 @@ static event_counter evt_local_chain_cleanups("local_chain_cleanups");
 static event_counter evt_try_delete_unlinks("try_delete_unlinks");
 static event_avg_counter evt_avg_time_inbetween_ro_epochs_usec(
     "avg_time_inbetween_ro_epochs_usec");
+static event_counter evt_proto_gc_reaped("proto_gc_reaped");
+static event_counter evt_proto_gc_handoffs("proto_gc_handoffs");
+static event_gauge gauge_proto_gc_oldest_unreaped_ro_tick(
+    "proto_gc_oldest_unreaped_ro_tick");
+static event_gauge gauge_proto_gc_lag_ro_ticks("proto_gc_lag_ro_ticks");
+static event_histogram hist_proto_gc_reap_cycles("proto_gc_reap_cycles");
 
 void
 transaction_proto2_static::InitGC()
@@ -484,10 +1677,40 @@ transaction_proto2_static::InitGC()
   g_flags->g_gc_init.store(true, memory_order_release);
 }
 
+static mutex g_pins_lock;
+static multiset<uint64_t> g_pins; // read only ticks
+
+// caller holds g_pins_lock
+static inline uint64_t
+OldestPin()
+{
+  return g_pins.empty() ? transaction_proto2_static::NoPin : *g_pins.begin();
+}
+
+void
+transaction_proto2_static::PinSnapshot(uint64_t tid)
+{
+  const uint64_t ro_tick = to_read_only_tick(EpochId(tid));
+  std::lock_guard<mutex> l(g_pins_lock);
+  g_pins.insert(ro_tick);
+  g_flags->g_pinned_ro_tick.store(OldestPin(), memory_order_release);
+}
+
+void
+transaction_proto2_static::UnpinSnapshot(uint64_t tid)
+{
+  const uint64_t ro_tick = to_read_only_tick(EpochId(tid));
+  std::lock_guard<mutex> l(g_pins_lock);
+  auto it = g_pins.find(ro_tick);
+  ALWAYS_ASSERT(it != g_pins.end());
+  g_pins.erase(it);
+  g_flags->g_pinned_ro_tick.store(OldestPin(), memory_order_release);
+}
+
 static void
 sleep_ro_epoch()
 {
-  const uint64_t sleep_ns = transaction_proto2_static::ReadOnlyEpochUsec * 1000;
+  const uint64_t sleep_ns = transaction_proto2_static::ReadOnlyEpochUsec() * 1000;
   struct timespec t;
   t.tv_sec  = sleep_ns / ONE_SECOND_NS;
   t.tv_nsec = sleep_ns % ONE_SECOND_NS;
@@ -514,7 +1737,7 @@ transaction_proto2_static::PurgeThreadOutstandingGCTasks()
       sleep_ro_epoch();
       continue;
     }
-    const uint64_t ro_tick_geq = ro_tick_ex - 1;
+    const uint64_t ro_tick_geq = ClampToPinned(ro_tick_ex - 1);
     if (ro_tick_geq < e) {
       sleep_ro_epoch();
       continue;
@@ -562,6 +1785,24 @@ transaction_proto2_static::clean_up_to_including(threadctx &ctx, uint64_t ro_tic
 #endif
   ctx.last_reaped_epoch_ = ro_tick_geq;
 
+  ctx.scratch_.empty_accept_from(ctx.queue_, ro_tick_geq);
+  ctx.scratch_.transfer_freelist(ctx.queue_);
+  const size_t n = reap(ctx, ctx.scratch_, ro_tick_geq);
+  INVARIANT(ctx.nqueued_ >= n);
+  ctx.nqueued_ -= n;
+  update_gc_gauges(ctx);
+}
+
+size_t
+transaction_proto2_static::reap(threadctx &ctx, px_queue &q, uint64_t ro_tick_geq)
+{
+  INVARIANT(!rcu::s_instance.in_rcu_region());
+  if (q.empty())
+    return 0;
+#ifdef ENABLE_EVENT_COUNTERS
+  scoped_cycle_timer reap_timer(hist_proto_gc_reap_cycles);
+#endif
+
 #ifdef CHECK_INVARIANTS
   const uint64_t last_tick_ex = ticker::s_instance.global_last_tick_exclusive();
   INVARIANT(last_tick_ex);
@@ -584,11 +1825,6 @@ transaction_proto2_static::clean_up_to_including(threadctx &ctx, uint64_t ro_tic
       px->~scoped_rcu_base<false>(); \
     } while (0)
 
-  ctx.scratch_.empty_accept_from(ctx.queue_, ro_tick_geq);
-  ctx.scratch_.transfer_freelist(ctx.queue_);
-  px_queue &q = ctx.scratch_;
-  if (q.empty())
-    return;
   bool in_rcu = false;
   size_t niters_with_rcu = 0, n = 0;
   for (auto it = q.begin(); it != q.end(); ++it, ++n, ++niters_with_rcu) {
@@ -641,6 +1877,7 @@ transaction_proto2_static::clean_up_to_including(threadctx &ctx, uint64_t ro_tic
               marked_ptr<string>(),
               nullptr),
             my_ro_tick);
+        on_gc_enqueue(ctx);
         ++g_evt_proto_gc_delete_requeue;
         // reclaim string ptrs
         string *spx = delent.key_.get();
@@ -671,6 +1908,13 @@ transaction_proto2_static::clean_up_to_including(threadctx &ctx, uint64_t ro_tic
         niters_with_rcu = 0;
         in_rcu = true;
       }
+      if (point_index * const idx = point_index::For(delent.btr_))
+        idx->remove(k, delent.tuple());
+      if (learned_index * const idx = learned_index::For(delent.btr_))
+        idx->remove(k, delent.tuple());
+      if (unlikely(txn_checkpointer::IsJournalingRemovals()))
+        txn_checkpointer::JournalRemoval(
+            delent.btr_, k, delent.tuple()->version);
       typename concurrent_btree::value_type removed = 0;
       const bool did_remove = delent.btr_->remove(k, &removed);
       ALWAYS_ASSERT(did_remove);
@@ -687,10 +1931,130 @@ transaction_proto2_static::clean_up_to_including(threadctx &ctx, uint64_t ro_tic
   }
   q.clear();
   g_evt_avg_proto_gc_queue_len.offer(n);
+  evt_proto_gc_reaped += n;
 
   if (in_rcu)
     EXIT_RCU();
   INVARIANT(!rcu::s_instance.in_rcu_region());
+  return n;
+}
+
+struct transaction_proto2_static::gc_thread {
+  std::mutex lock_;
+  condition_variable cv_;
+  deque<gc_batch *> batches_;
+};
+
+void
+transaction_proto2_static::StartGCThreads(size_t n, const vector<unsigned> &cpus)
+{
+  ALWAYS_ASSERT(!NumGCThreads());
+  ALWAYS_ASSERT(n > 0);
+  for (size_t i = 0; i < n; i++) {
+    g_gc_threads.push_back(new gc_thread);
+    thread(&transaction_proto2_static::gc_loop, g_gc_threads.back(),
+           cpus.empty() ? -1 : int(cpus[i % cpus.size()])).detach();
+  }
+  g_flags->g_ngc_threads.store(n, memory_order_release);
+}
+
+void
+transaction_proto2_static::hand_off_to_gc(threadctx &ctx, uint64_t ro_tick_geq)
+{
+  INVARIANT(!rcu::s_instance.in_rcu_region());
+  INVARIANT(ctx.last_reaped_epoch_ <= ro_tick_geq);
+  if (ctx.last_reaped_epoch_ == ro_tick_geq)
+    return;
+  ctx.last_reaped_epoch_ = ro_tick_geq;
+  uint64_t e;
+  if (!ctx.queue_.get_earliest_epoch(e) || e > ro_tick_geq)
+    return;
+
+  gc_batch *b = nullptr;
+  {
+    ::lock_guard<spinlock> l(ctx.spare_lock_);
+    if (!ctx.spare_batches_.empty()) {
+      b = ctx.spare_batches_.back();
+      ctx.spare_batches_.pop_back();
+    }
+  }
+  if (b) {
+    b->queue_.transfer_freelist(ctx.queue_);
+    ctx.pool_.insert(ctx.pool_.end(), b->pool_.begin(), b->pool_.end());
+    b->pool_.clear();
+  } else {
+    b = new gc_batch;
+    b->owner_ = &ctx;
+  }
+  b->ro_tick_geq_ = ro_tick_geq;
+  b->queue_.empty_accept_from(ctx.queue_, ro_tick_geq);
+  const size_t n = distance(b->queue_.begin(), b->queue_.end());
+  INVARIANT(ctx.nqueued_ >= n);
+  ctx.nqueued_ -= n;
+  update_gc_gauges(ctx);
+  ++evt_proto_gc_handoffs;
+
+  gc_thread &t = *g_gc_threads[coreid::core_id() % g_gc_threads.size()];
+  {
+    std::lock_guard<std::mutex> l(t.lock_);
+    t.batches_.push_back(b);
+  }
+  t.cv_.notify_one();
+}
+
+void
+transaction_proto2_static::gc_loop(gc_thread *t, int cpu)
+{
+  if (cpu >= 0)
+    rcu::s_instance.pin_current_thread(cpu);
+  // the gc thread's own ctx holds what it had to requeue
+  threadctx &ctx = g_threadctxs.my();
+  for (;;) {
+    gc_batch *b = nullptr;
+    {
+      unique_lock<mutex> l(t->lock_);
+      if (t->batches_.empty())
+        t->cv_.wait_for(
+            l, chrono::microseconds(ReadOnlyEpochUsec()),
+            [t]() { return !t->batches_.empty(); });
+      if (!t->batches_.empty()) {
+        b = t->batches_.front();
+        t->batches_.pop_front();
+      }
+    }
+    if (b) {
+      reap(ctx, b->queue_, b->ro_tick_geq_);
+      // the strings go back to the worker, which allocates them
+      b->pool_.insert(b->pool_.end(), ctx.pool_.begin(), ctx.pool_.end());
+      ctx.pool_.clear();
+      threadctx &owner = *b->owner_;
+      ::lock_guard<spinlock> l(owner.spare_lock_);
+      owner.spare_batches_.push_back(b);
+    }
+    const uint64_t last_tick_ex = ticker::s_instance.global_last_tick_exclusive();
+    const uint64_t ro_tick_ex = to_read_only_tick(last_tick_ex - 1);
+    if (last_tick_ex && ro_tick_ex)
+      clean_up_to_including(ctx, ClampToPinned(ro_tick_ex - 1));
+  }
+}
+
+void
+transaction_proto2_static::update_gc_gauges(const threadctx &ctx)
+{
+#ifdef ENABLE_EVENT_COUNTERS
+  g_gauge_proto_gc_queue_depth.set(ctx.nqueued_);
+  uint64_t e;
+  if (!ctx.queue_.get_earliest_epoch(e)) {
+    gauge_proto_gc_oldest_unreaped_ro_tick.set(0);
+    gauge_proto_gc_lag_ro_ticks.set(0);
+    return;
+  }
+  // a lag which keeps growing is GC falling behind (or being held back)
+  const uint64_t cur_ro_tick =
+    to_read_only_tick(ticker::s_instance.global_current_tick());
+  gauge_proto_gc_oldest_unreaped_ro_tick.set(e);
+  gauge_proto_gc_lag_ro_ticks.set(cur_ro_tick > e ? cur_ro_tick - e : 0);
+#endif
 }
 
 aligned_padded_elem<transaction_proto2_static::hackstruct>
@@ -699,6 +2063,8 @@ aligned_padded_elem<transaction_proto2_static::flags>
   transaction_proto2_static::g_flags;
 percore_lazy<transaction_proto2_static::threadctx>
   transaction_proto2_static::g_threadctxs;
+vector<transaction_proto2_static::gc_thread *>
+  transaction_proto2_static::g_gc_threads;
 event_counter
   transaction_proto2_static::g_evt_worker_thread_wait_log_buffer(
       "worker_thread_wait_log_buffer");
@@ -708,9 +2074,21 @@ event_counter
 event_counter
   transaction_proto2_static::g_evt_proto_gc_delete_requeue(
       "proto_gc_delete_requeue");
+event_counter
+  transaction_proto2_static::g_evt_bounded_staleness_validated_reads(
+      "bounded_staleness_validated_reads");
+event_counter
+  transaction_proto2_static::g_evt_version_chain_trims(
+      "version_chain_trims");
+event_counter
+  transaction_proto2_static::g_evt_version_chain_cuts(
+      "version_chain_cuts");
 event_avg_counter
   transaction_proto2_static::g_evt_avg_log_entry_size(
       "avg_log_entry_size");
 event_avg_counter
   transaction_proto2_static::g_evt_avg_proto_gc_queue_len(
       "avg_proto_gc_queue_len");
+event_gauge
+  transaction_proto2_static::g_gauge_proto_gc_queue_depth(
+      "proto_gc_queue_depth");
@@ -5,6 +5,8 @@
 #include <atomic>
 #include <vector>
 #include <set>
+#include <deque>
+#include <limits>
 
 #include <lz4.h>
 
@@ -15,11 +17,13 @@
 #include "circbuf.h"
 #include "spinbarrier.h"
 #include "record/serializer.h"
+#include "crc32c.h"
 
 // forward decl
 template <typename Traits> class transaction_proto2;
 template <template <typename> class Transaction>
   class txn_epoch_sync;
+class txn_log_shipper;
 
 // the system has a single logging subsystem (composed of multiple lgogers)
 // NOTE: currently, the persistence epoch is tied 1:1 with the ticker's epoch
@@ -33,11 +37,12 @@ class txn_logger {
 public:
 
   static const size_t g_nmax_loggers = 16;
-  static const size_t g_perthread_buffers = 256; // 256 outstanding buffers
-  static const size_t g_buffer_size = (1<<20); // in bytes
+  static const size_t g_perthread_buffers = 256; // at most 256 outstanding buffers
+  static const size_t g_default_buffer_size = (1<<20); // in bytes
   static const size_t g_horizon_buffer_size = 2 * (1<<16); // in bytes
+  static const size_t g_perthread_horizons = 4; // with a compression pool
   static const size_t g_max_lag_epochs = 128; // cannot lag more than 128 epochs
-  static const bool   g_pin_loggers_to_numa_nodes = false;
+  static const size_t g_nmax_tables = 4096; // must be a power of two
 
   static inline bool
   IsPersistenceEnabled()
@@ -51,10 +56,83 @@ public:
     return g_use_compression;
   }
 
+  // whether txns are logged in the compact encoding (see txn_encoder)
+  static inline bool
+  IsCompactEncodingEnabled()
+  {
+    return g_compact_encoding;
+  }
+
+  // 0 if workers compress their own log buffers
+  static inline size_t
+  NumCompressThreads()
+  {
+    return g_ncompress_threads;
+  }
+
+  // 0 if group commit is done at epoch granularity
+  static inline uint64_t
+  GroupCommitUsec()
+  {
+    return g_group_commit_us;
+  }
+
   // init the logging subsystem.
   //
   // should only be called ONCE is not thread-safe.  if assignments_used is not
   // null, then fills it with a copy of the assignment actually computed
+  //
+  // if segment_size > 0, each logfile is instead split into segments (see
+  // SegmentFileName()) of roughly segment_size bytes each
+  //
+  // if async_fsync is set, each logger's fdatasync() runs in the background
+  // while the logger writes out its next batch
+  //
+  // if ncompress_threads > 0 (and use_compression is set), workers hand
+  // their filled horizons to a pool of ncompress_threads threads, which
+  // compress them into log buffers on the workers' behalf. each core is
+  // served by a single compression thread, so its log stays in order
+  //
+  // if numa_aware is set, each logger is pinned to the NUMA node of the
+  // workers it serves. if no assignments are given, workers are assigned to
+  // the loggers whose devices are on their own node (see NumaNodeOfFile()),
+  // assuming worker i runs on cpu i
+  //
+  // if group_commit_us > 0, log buffers are flushed once their oldest txn is
+  // group_commit_us old (instead of at epoch boundaries), and txns are
+  // considered durable as soon as they and everything they could depend on
+  // are on disk (see advance_system_sync_epoch())
+  //
+  // if use_dax is set, the logfiles should live on a DAX filesystem
+  // (persistent or CXL memory). each segment is mapped into memory and log
+  // buffers are copied into it and flushed out of the cache, instead of
+  // going through writev() and fdatasync(). logfiles are always segmented in
+  // this mode (in DefaultDaxSegmentSize segments if segment_size is 0)
+  //
+  // if standbys (host:port) are given, the log is also shipped to them (see
+  // txn_replication.h), and a batch is only durable once standby_quorum of
+  // them (0 for all) have it. not compatible with async_fsync
+  //
+  // if coalesce_writes is set (and use_compression is not), each logger
+  // drops the writes in a log buffer which a later write of the same key in
+  // that buffer wholly replaces (see CoalesceWrites()), before writing it out
+  //
+  // if compact_encoding is set, txns are logged in version 2 of the format
+  // (see txn_encoder), and each buffer is marked as such (see
+  // CompactBufferBit). it works with or without compression
+  //
+  // buffer_size is the size of each log buffer (0 for
+  // g_default_buffer_size). if buffer_memory_budget > 0, the log buffers of
+  // all cores take at most that many bytes: each core starts with a share
+  // of half of it, and grows its pool out of the other half when its
+  // buffers run out (see GrowBuffers()), instead of starting with
+  // g_perthread_buffers of them
+  //
+  // if admission_lag_epochs > 0 (it must be < g_max_lag_epochs), new
+  // read-write txns are held back once the persistent epoch falls more than
+  // that many epochs behind the current one (see AdmissionDelayUsec()), so
+  // workers slow down gradually instead of stalling when the loggers
+  // reach g_max_lag_epochs or the log buffers run out
   static void Init(
       size_t nworkers,
       const std::vector<std::string> &logfiles,
@@ -62,16 +140,148 @@ public:
       std::vector<std::vector<unsigned>> *assignments_used = nullptr,
       bool call_fsync = true,
       bool use_compression = false,
-      bool fake_writes = false);
+      bool fake_writes = false,
+      size_t segment_size = 0,
+      bool async_fsync = false,
+      uint64_t group_commit_us = 0,
+      size_t ncompress_threads = 0,
+      bool numa_aware = false,
+      bool use_dax = false,
+      const std::vector<std::string> &standbys = std::vector<std::string>(),
+      size_t standby_quorum = 0,
+      bool coalesce_writes = false,
+      bool compact_encoding = false,
+      size_t buffer_size = 0,
+      size_t buffer_memory_budget = 0,
+      size_t admission_lag_epochs = 0);
+
+  static const size_t DefaultDaxSegmentSize = (1 << 26);
+
+  // the NUMA node of the device fname lives on, or -1 if unknown
+  static int
+  NumaNodeOfFile(const std::string &fname);
+
+  // segment segno of logfile is named <logfile>.seg.<segno>
+  static std::string
+  SegmentFileName(const std::string &logfile, uint64_t segno);
+
+  // the segments of logfile which currently exist, ordered by segno
+  static std::vector<std::string>
+  ListSegments(const std::string &logfile);
+
+  // allows segments which only contain txns in epochs <= epoch to be
+  // recycled. should only be called once the effects of those txns are
+  // durable elsewhere (ie in a checkpoint of every logged table)
+  static inline void
+  AdvanceTruncationEpoch(uint64_t epoch)
+  {
+    uint64_t cur = g_truncation_epoch.load(std::memory_order_acquire);
+    while (cur < epoch &&
+           !g_truncation_epoch.compare_exchange_weak(
+             cur, epoch, std::memory_order_acq_rel))
+      ;
+  }
+
+  // the persistent epoch is periodically written to the first logfile's
+  // name with this suffix appended, so recovery knows where to stop. with
+  // group commit, it is followed by the persistent tid (see
+  // system_sync_tid_), up to which txns past the epoch are durable too
+  static const char *const g_pepoch_suffix;
+
+  // tables are identified in the log by an id derived from their name, so a
+  // restarted process which re-creates its tables under the same names can
+  // map log records back to them
+  static uint32_t
+  TableIdFromName(const std::string &name);
+
+  // called by txn_btree construction/destruction (see
+  // base_txn_btree_handler<transaction_proto2>)
+  static void RegisterTable(const std::string &name, const concurrent_btree *btr);
+  static void UnregisterTable(const concurrent_btree *btr);
+
+  // called by typed_txn_btree construction: btr logs its writes as [fields
+  // mask (8 bytes)] followed by the fields, and those with every bit of
+  // all_fields set are whole records. other tables log whole values
+  static void SetTableFieldsMask(const concurrent_btree *btr,
+                                 uint64_t all_fields);
+
+  // the txns in [p, p + n) (laid out as by txn_encoder, compact or not) are
+  // rewritten in place, without the writes which a write of the same key at a later tid
+  // supersedes: a removal, or a whole (non-delta) value. every txn is kept,
+  // if with fewer writes. returns the new size (n, with the buffer as it was,
+  // if it does not parse or the writes kept would not fit back in it)
+  //
+  // replay only looks at the latest whole value of each key, and the deltas
+  // after it (see txn_log_replayer), so it gets the same records back as long
+  // as a buffer is persisted (or lost) as a whole, which it is since all its
+  // txns are in the same epoch
+  static size_t CoalesceWrites(uint8_t *p, size_t n, bool compact);
+
+  static inline uint32_t
+  TableIdFor(const concurrent_btree *btr)
+  {
+    for (size_t i = TableSlotFor(btr), n = 0;
+         n < g_nmax_tables;
+         i = (i + 1) & (g_nmax_tables - 1), n++) {
+      const concurrent_btree *px = g_tables[i].btr_.load(std::memory_order_acquire);
+      if (likely(px == btr))
+        return g_tables[i].id_;
+      if (!px)
+        break;
+    }
+    ALWAYS_ASSERT(false); // all txn_btrees are registered on construction
+    return 0;
+  }
 
+  // logs written before buffers were checksummed had a 64-bit nentries_, so
+  // their crc_ reads as 0
   struct logbuf_header {
-    uint64_t nentries_; // > 0 for all valid log buffers
+    uint32_t nentries_; // > 0 for all valid log buffers
+    uint32_t crc_; // see BufferChecksum(), 0 if not checksummed
     uint64_t last_tid_; // TID of the last commit
   } PACKED;
 
+  // set in the nentries_ of a buffer written out with its txns in the
+  // compact encoding, so a log says itself how to decode each buffer
+  static const uint32_t CompactBufferBit = 1U << 31;
+
+  // the number of txns in a buffer written out
+  static inline uint32_t
+  BufferNEntries(const logbuf_header &hdr)
+  {
+    return hdr.nentries_ & ~CompactBufferBit;
+  }
+
+  static inline bool
+  IsCompactBuffer(const logbuf_header &hdr)
+  {
+    return hdr.nentries_ & CompactBufferBit;
+  }
+
+  // the CRC32C of a buffer's header (but crc_) and its n bytes of data.
+  // never 0 (which stands for no checksum)
+  static inline uint32_t
+  BufferChecksum(const logbuf_header &hdr, const uint8_t *data, size_t n)
+  {
+    uint32_t crc = crc32c::Value(&hdr.last_tid_, sizeof(hdr.last_tid_));
+    crc = crc32c::Extend(crc, &hdr.nentries_, sizeof(hdr.nentries_));
+    crc = crc32c::Extend(crc, data, n);
+    return crc ? crc : 1;
+  }
+
+  // whether the loggers checksum the buffers they write out. only with
+  // hardware crc instructions, which keep it off the critical path
+  static inline bool
+  IsChecksumEnabled()
+  {
+    return g_checksum;
+  }
+
   struct pbuffer {
     uint64_t earliest_start_us_; // start time of the earliest txn
     bool io_scheduled_; // has the logger scheduled IO yet?
+    bool flush_; // (horizons w/ a compression pool) push the log buffer to
+                 // the logger once this horizon is compressed into it
 
     unsigned curoff_; // current offset into buf_ for writing
 
@@ -79,6 +289,8 @@ public:
 
     const unsigned buf_sz_;
 
+    const bool grown_; // malloc()-ed on its own by GrowBuffers()
+
     // must be last field
     uint8_t buf_start_[0];
 
@@ -89,8 +301,8 @@ public:
     //
     // NOTE: it is not necessary to call the destructor for pbuffer, since
     // it only contains PODs
-    pbuffer(unsigned core_id, unsigned buf_sz)
-      : core_id_(core_id), buf_sz_(buf_sz)
+    pbuffer(unsigned core_id, unsigned buf_sz, bool grown = false)
+      : core_id_(core_id), buf_sz_(buf_sz), grown_(grown)
     {
       INVARIANT(((char *)this) + sizeof(*this) == (char *) &buf_start_[0]);
       INVARIANT(buf_sz > sizeof(logbuf_header));
@@ -106,6 +318,7 @@ public:
     {
       earliest_start_us_ = 0;
       io_scheduled_ = false;
+      flush_ = false;
       curoff_ = sizeof(logbuf_header);
       NDB_MEMSET(&buf_start_[0], 0, buf_sz_);
     }
@@ -156,6 +369,175 @@ public:
     can_hold_tid(uint64_t tid) const;
   } PACKED;
 
+  // each txn is laid out as [tid (8 bytes)][nwrites (varint)], followed by
+  // nwrites [table id (varint)][klen (varint)][key][vlen (varint)][value]
+  // records. a zero length value denotes a removal
+  //
+  // the compact encoding (version 2 of the format) instead starts each txn
+  // with the difference between its tid and the tid of the txn before it in
+  // the same log buffer (or horizon, with compression), or 0 for the first
+  // one, as a zigzag varint. and each record starts with a [(shared << 1) |
+  // new table (varint)], followed by [table id (varint)] only if new table is
+  // set, then [suffix len (varint)][key suffix], where shared is the length
+  // of the prefix its key has in common with the key of the record before it
+  // in the txn (0 for the first). new table is set for the first record of a
+  // txn, and whenever the table changes from the record before it
+  class txn_encoder {
+  public:
+    // prev_tid is that of the txn before in the buffer, 0 if none
+    txn_encoder(bool compact, uint64_t prev_tid)
+      : compact_(compact), prev_tid_(prev_tid),
+        table_id_(0), key_(nullptr), klen_(0) {}
+
+    // the most bytes a tid can take
+    static inline size_t
+    MaxTidNBytes(bool compact)
+    {
+      return compact ? 10 : sizeof(uint64_t);
+    }
+
+    inline uint8_t *
+    write_txn(uint8_t *p, uint64_t tid, uint32_t nwrites)
+    {
+      if (compact_)
+        p = write_uvint64(p, ZigZag(tid - prev_tid_));
+      else
+        p = s_uint64_t.write(p, tid);
+      prev_tid_ = tid;
+      key_ = nullptr;
+      return vs_uint32_t.write(p, nwrites);
+    }
+
+    // k must stay put until the next record (or txn) is written
+    inline uint8_t *
+    write_key(uint8_t *p, uint32_t table_id, const uint8_t *k, uint32_t klen)
+    {
+      uint32_t shared = 0;
+      if (!compact_) {
+        p = vs_uint32_t.write(p, table_id);
+        p = vs_uint32_t.write(p, klen);
+      } else {
+        const bool new_table = !key_ || table_id != table_id_;
+        if (!new_table)
+          shared = shared_prefix(k, klen);
+        p = vs_uint32_t.write(p, (shared << 1) | new_table);
+        if (new_table)
+          p = vs_uint32_t.write(p, table_id);
+        p = vs_uint32_t.write(p, klen - shared);
+        table_id_ = table_id;
+        key_ = k;
+        klen_ = klen;
+      }
+      NDB_MEMCPY(p, k + shared, klen - shared);
+      return p + (klen - shared);
+    }
+
+    // like write_key(), without writing anything
+    inline size_t
+    key_nbytes(uint32_t table_id, const uint8_t *k, uint32_t klen)
+    {
+      if (!compact_)
+        return vs_uint32_t.nbytes(&table_id) + vs_uint32_t.nbytes(&klen) + klen;
+      const bool new_table = !key_ || table_id != table_id_;
+      const uint32_t shared = new_table ? 0 : shared_prefix(k, klen);
+      const uint32_t h = (shared << 1) | new_table;
+      const uint32_t suffix = klen - shared;
+      table_id_ = table_id;
+      key_ = k;
+      klen_ = klen;
+      return vs_uint32_t.nbytes(&h) +
+        (new_table ? vs_uint32_t.nbytes(&table_id) : 0) +
+        vs_uint32_t.nbytes(&suffix) + suffix;
+    }
+
+  private:
+    inline uint32_t
+    shared_prefix(const uint8_t *k, uint32_t klen) const
+    {
+      const uint32_t n = std::min(klen, klen_);
+      uint32_t i = 0;
+      while (i < n && k[i] == key_[i])
+        i++;
+      return i;
+    }
+
+    static inline uint64_t
+    ZigZag(uint64_t d)
+    {
+      return (d << 1) ^ uint64_t(int64_t(d) >> 63);
+    }
+
+    serializer<uint32_t, true> vs_uint32_t;
+    serializer<uint64_t, false> s_uint64_t;
+    const bool compact_;
+    uint64_t prev_tid_;
+    uint32_t table_id_;
+    const uint8_t *key_; // of the record before, null if none in this txn
+    uint32_t klen_;
+  };
+
+  // reads back what a txn_encoder writes, in the same order. every read
+  // returns nullptr if the record runs past end
+  class txn_decoder {
+  public:
+    explicit txn_decoder(bool compact)
+      : compact_(compact), prev_tid_(0), table_id_(0) {}
+
+    inline const uint8_t *
+    read_txn(const uint8_t *p, const uint8_t *end,
+             uint64_t &tid, uint32_t &nwrites)
+    {
+      if (compact_) {
+        uint64_t d;
+        if (!(p = failsafe_read_uvint64(p, end - p, &d)))
+          return nullptr;
+        tid = prev_tid_ + ((d >> 1) ^ (0 - (d & 1)));
+      } else if (!(p = s_uint64_t.failsafe_read(p, end - p, &tid))) {
+        return nullptr;
+      }
+      prev_tid_ = tid;
+      key_.clear();
+      return vs_uint32_t.failsafe_read(p, end - p, &nwrites);
+    }
+
+    // k stays valid until the next read
+    inline const uint8_t *
+    read_key(const uint8_t *p, const uint8_t *end, uint32_t &table_id,
+             const uint8_t *&k, uint32_t &klen)
+    {
+      if (!compact_) {
+        if (!(p = vs_uint32_t.failsafe_read(p, end - p, &table_id)) ||
+            !(p = vs_uint32_t.failsafe_read(p, end - p, &klen)) ||
+            size_t(end - p) < klen)
+          return nullptr;
+        k = p;
+        return p + klen;
+      }
+      uint32_t h, suffix;
+      if (!(p = vs_uint32_t.failsafe_read(p, end - p, &h)))
+        return nullptr;
+      if ((h & 1) && !(p = vs_uint32_t.failsafe_read(p, end - p, &table_id_)))
+        return nullptr;
+      if (!(p = vs_uint32_t.failsafe_read(p, end - p, &suffix)) ||
+          size_t(end - p) < suffix || (h >> 1) > key_.size())
+        return nullptr;
+      key_.resize(h >> 1);
+      key_.append((const char *) p, suffix);
+      table_id = table_id_;
+      k = (const uint8_t *) key_.data();
+      klen = key_.size();
+      return p + suffix;
+    }
+
+  private:
+    serializer<uint32_t, true> vs_uint32_t;
+    serializer<uint64_t, false> s_uint64_t;
+    const bool compact_;
+    uint64_t prev_tid_;
+    uint32_t table_id_;
+    std::string key_;
+  };
+
   static bool
   AssignmentsValid(const std::vector<std::vector<unsigned>> &assignments,
                    unsigned nfds,
@@ -184,10 +566,15 @@ public:
   compute_ntxns_persisted_statistics();
 
   // purge counters from each thread about the number of
-  // persisted txns
+  // persisted txns (and the loggers' byte counts)
   static void
   clear_ntxns_persisted_statistics();
 
+  // bytes the loggers have written (after compression), since the last
+  // clear_ntxns_persisted_statistics()
+  static uint64_t
+  compute_nbytes_written();
+
   // wait until the logging system appears to be idle.
   //
   // note that this isn't a guarantee, just a best effort attempt
@@ -198,10 +585,142 @@ public:
   static void
   wait_until_current_point_persisted();
 
+  // all txns in epochs <= the returned epoch are durable
+  static inline uint64_t
+  persistent_epoch()
+  {
+    return system_sync_epoch_->load(std::memory_order_acquire);
+  }
+
+  // how long a read-write txn starting now should wait before it runs. 0
+  // until the persistent epoch lags the current one by more than
+  // g_admission_lag_epochs; from there it grows with the square of the
+  // excess lag, up to a whole tick once the lag reaches g_max_lag_epochs
+  static inline uint64_t
+  AdmissionDelayUsec()
+  {
+    if (likely(!g_admission_lag_epochs))
+      return 0;
+    const uint64_t lag = ticker::s_instance.global_current_tick() -
+      std::min(persistent_epoch(), ticker::s_instance.global_current_tick());
+    if (likely(lag <= g_admission_lag_epochs))
+      return 0;
+    const uint64_t span = g_max_lag_epochs - g_admission_lag_epochs;
+    const uint64_t over = std::min(lag - g_admission_lag_epochs, span);
+    return ticker::TickUsec() * over * over / (span * span);
+  }
+
+  // see Init(): 0 to not hold back txns at all
+  static inline void
+  SetAdmissionLagEpochs(size_t lag_epochs)
+  {
+    ALWAYS_ASSERT(lag_epochs < g_max_lag_epochs);
+    g_admission_lag_epochs = lag_epochs;
+  }
+
+  // waits out a delay given by AdmissionDelayUsec()
+  static void
+  WaitForAdmission(uint64_t delay_us);
+
+  // holds back a txn with txn_flags about to be started, as long as
+  // AdmissionDelayUsec() says. read-only txns add nothing to the log, so they
+  // are never held back. it must be called before the txn is constructed (or
+  // reset()): a txn's rcu region guards its epoch, so waiting inside one
+  // would keep the ticker from advancing the epoch. a thread already in an
+  // rcu region is let through
+  static inline void
+  Admit(uint64_t txn_flags)
+  {
+    if (txn_flags & transaction_base::TXN_FLAG_READ_ONLY)
+      return;
+    const uint64_t delay_us = AdmissionDelayUsec();
+    if (unlikely(delay_us) && !rcu::s_instance.in_rcu_region())
+      WaitForAdmission(delay_us);
+  }
+
+  // see NotifyOnDurable()
+  struct durable_callback {
+    virtual ~durable_callback() {}
+    // tid is the one given to NotifyOnDurable()
+    virtual void on_durable(uint64_t tid) = 0;
+  };
+
+  // a durable_callback which can be polled (or waited on) from any thread
+  class durable_handle : public durable_callback {
+  public:
+    durable_handle() : tid_(0), done_(false) {}
+
+    virtual void
+    on_durable(uint64_t tid)
+    {
+      tid_ = tid;
+      done_.store(true, std::memory_order_release);
+    }
+
+    inline bool
+    is_durable() const
+    {
+      return done_.load(std::memory_order_acquire);
+    }
+
+    inline void
+    wait() const
+    {
+      while (!is_durable())
+        nop_pause();
+    }
+
+    // only valid once is_durable()
+    inline uint64_t
+    tid() const
+    {
+      return tid_;
+    }
+
+    // so the handle can be given to NotifyOnDurable() again
+    inline void
+    reset()
+    {
+      INVARIANT(is_durable());
+      done_.store(false, std::memory_order_release);
+    }
+
+  private:
+    uint64_t tid_;
+    std::atomic<bool> done_;
+  };
+
+  // calls cb->on_durable(tid), from the persister thread, once the epoch of
+  // tid is durable (with group commit the txn might have been durable a
+  // little earlier). cb must stay alive until then. if persistence is
+  // disabled, cb is called right away, on the calling thread
+  //
+  // must be called from the core which committed tid, and callbacks should
+  // be quick, since they hold up the advancement of the persistent epoch
+  static void
+  NotifyOnDurable(uint64_t tid, durable_callback *cb);
+
+  // records, into txn_tracer, how long after now tid becomes durable. same
+  // rules as NotifyOnDurable()
+  static void
+  TraceDurable(uint64_t tid);
+
 private:
 
   // data structures
 
+  struct table_entry {
+    std::atomic<const concurrent_btree *> btr_;
+    uint32_t id_;
+    std::atomic<uint64_t> all_fields_; // 0 if whole values are logged
+  };
+
+  static inline size_t
+  TableSlotFor(const concurrent_btree *btr)
+  {
+    return (uintptr_t(btr) >> 4) & (g_nmax_tables - 1);
+  }
+
   struct epoch_array {
     // don't use percore<std::atomic<uint64_t>> because we don't want padding
     std::atomic<uint64_t> epochs_[NMAXCORES];
@@ -218,7 +737,22 @@ private:
     circbuf<pbuffer, g_perthread_buffers> all_buffers_;     // logger pushes to core
     circbuf<pbuffer, g_perthread_buffers> persist_buffers_; // core pushes to logger
 
-    persist_ctx() : init_(false), lz4ctx_(nullptr), horizon_(nullptr) {}
+    // with a compression pool, the compression thread (instead of the core)
+    // is the one consuming all_buffers_ and pushing to persist_buffers_
+    circbuf<pbuffer, g_perthread_horizons> free_horizons_;  // compressor pushes to core
+    circbuf<pbuffer, g_perthread_horizons> compress_queue_; // core pushes to compressor
+
+    // log buffers the core has, between all_buffers_, persist_buffers_ and
+    // the logger. never more than g_perthread_buffers, so neither circbuf
+    // can fill up
+    std::atomic<size_t> nbuffers_;
+
+    // (logger) decaying peak of the buffers the core filled per batch
+    size_t peak_nscheduled_;
+
+    persist_ctx()
+      : init_(false), lz4ctx_(nullptr), horizon_(nullptr),
+        nbuffers_(0), peak_nscheduled_(0) {}
   };
 
   // context per one epoch
@@ -257,12 +791,58 @@ private:
 
   // makes copy on purpose
   static void writer(
-      unsigned id, int fd,
+      unsigned id, std::string logfile, int fd, int numa_node,
       std::vector<unsigned> assignment);
 
+  // assigns workers to the loggers on their own NUMA node, spreading them
+  // evenly. a node without a logger of its own shares all of them
+  static std::vector<std::vector<unsigned>>
+  ComputeNumaAssignments(size_t nworkers, const std::vector<int> &logger_nodes);
+
+  struct log_segment {
+    uint64_t segno_;
+    uint64_t max_epoch_; // of the buffers written to the segment
+  };
+
+  // a buffer which is on disk, but whose txns might depend on txns which
+  // are not yet (only used with group commit)
+  struct undurable_buffer {
+    uint64_t last_tid_;
+    uint64_t nentries_;
+    uint64_t earliest_start_us_;
+    uint64_t round_; // g_sync_rounds_started_ when the buffer hit the disk
+  };
+
+  // accounts for the undurable buffers (of the cores in assignment) which
+  // have since become durable
+  static void
+  release_durable_buffers(
+      const std::vector<unsigned> &assignment,
+      std::vector<std::deque<undurable_buffer>> &undurable);
+
+  // are any of the core's horizons waiting on its compression thread?
+  static inline bool
+  compress_pending(persist_ctx &ctx)
+  {
+    return g_ncompress_threads && ctx.compress_queue_.peek();
+  }
+
+  // is the core holding on to txns which are not in its persist queue?
+  static bool
+  has_unpushed_txns(persist_ctx &ctx);
+
+  // opens segment segno of logfile, recycling a sealed segment if one is no
+  // longer needed
+  static int
+  open_segment(const std::string &logfile, uint64_t segno,
+               std::deque<log_segment> &sealed);
+
   static void persister(
       std::vector<std::vector<unsigned>> assignments);
 
+  // compresses the horizons of cores id, id + n, id + 2n, ...
+  static void compressor(unsigned id, unsigned n);
+
   enum InitMode {
     INITMODE_NONE, // no initialization
     INITMODE_REG,  // just use malloc() to init buffers
@@ -275,10 +855,11 @@ private:
     INVARIANT(core_id < g_persist_ctxs.size());
     persist_ctx &ctx = g_persist_ctxs[core_id];
     if (unlikely(!ctx.init_ && imode != INITMODE_NONE)) {
-      size_t needed = g_perthread_buffers * (sizeof(pbuffer) + g_buffer_size);
+      size_t needed = g_initial_buffers * (sizeof(pbuffer) + g_buffer_size);
+      const size_t nhorizons = g_ncompress_threads ? g_perthread_horizons : 1;
       if (IsCompressionEnabled())
         needed += size_t(LZ4_create_size()) +
-          sizeof(pbuffer) + g_horizon_buffer_size;
+          nhorizons * (sizeof(pbuffer) + g_horizon_buffer_size);
       char *mem =
         (imode == INITMODE_REG) ?
           (char *) malloc(needed) :
@@ -288,16 +869,29 @@ private:
         mem += LZ4_create_size();
         ctx.horizon_ = new (mem) pbuffer(core_id, g_horizon_buffer_size);
         mem += sizeof(pbuffer) + g_horizon_buffer_size;
+        for (size_t i = 1; i < nhorizons; i++) {
+          ctx.free_horizons_.enq(new (mem) pbuffer(core_id, g_horizon_buffer_size));
+          mem += sizeof(pbuffer) + g_horizon_buffer_size;
+        }
       }
-      for (size_t i = 0; i < g_perthread_buffers; i++) {
+      for (size_t i = 0; i < g_initial_buffers; i++) {
         ctx.all_buffers_.enq(new (mem) pbuffer(core_id, g_buffer_size));
         mem += sizeof(pbuffer) + g_buffer_size;
       }
+      ctx.nbuffers_.store(g_initial_buffers, std::memory_order_release);
+      g_buffer_memory_used.fetch_add(
+          g_initial_buffers * (sizeof(pbuffer) + g_buffer_size));
       ctx.init_ = true;
     }
     return ctx;
   }
 
+  // with a buffer memory budget, gives core_id's all_buffers_ one more
+  // buffer, if the core and the budget have room for it. called by the
+  // (single) consumer of all_buffers_ once it runs dry, ie once the logger
+  // has fallen that far behind. returns false if it did not
+  static bool GrowBuffers(unsigned core_id);
+
   // static state
 
   static bool g_persist; // whether or not logging is enabled
@@ -310,6 +904,39 @@ private:
   static bool g_fake_writes; // whether or not to fake doing writes (to measure
                              // pure overhead of disk)
 
+  static bool g_async_fsync; // whether or not to overlap fdatasync() with
+                             // writing the next batch
+
+  static bool g_use_dax; // whether or not logs are written through mappings
+                         // of (persistent memory) segments
+
+  static uint64_t g_group_commit_us; // 0 for epoch granularity group commit
+
+  static size_t g_ncompress_threads; // 0 if workers compress inline
+
+  static bool g_pin_loggers_to_numa_nodes;
+
+  static bool g_coalesce_writes; // whether or not loggers coalesce buffers
+
+  static bool g_compact_encoding; // whether or not txns are logged compactly
+
+  static bool g_checksum; // whether or not loggers checksum buffers
+
+  static size_t g_admission_lag_epochs; // 0 if admission is not controlled
+
+  static size_t g_buffer_size; // in bytes
+
+  static size_t g_initial_buffers; // allocated per core up front
+
+  static size_t g_buffer_memory_budget; // in bytes, 0 if none
+
+  // bytes of log buffers allocated so far, across all cores
+  static std::atomic<size_t> g_buffer_memory_used;
+
+  static size_t g_segment_size; // 0 if logfiles are not segmented
+
+  static std::atomic<uint64_t> g_truncation_epoch;
+
   static size_t g_nworkers; // assignments are computed based on g_nworkers
                             // but a logger responsible for core i is really
                             // responsible for cores i + k * g_nworkers, for k
@@ -328,14 +955,57 @@ private:
   static util::aligned_padded_elem<std::atomic<uint64_t>>
     system_sync_epoch_ CACHE_ALIGNED;
 
+  // only used with group commit. like per_thread_sync_epochs_, but holds the
+  // TID of the last txn persisted instead
+  static epoch_array
+    per_thread_sync_tids_[g_nmax_loggers] CACHE_ALIGNED;
+
+  // only used with group commit. every txn which was on disk before round
+  // g_sync_rounds_done_ started, and has a TID <= system_sync_tid_, is
+  // durable along with its dependencies (since a txn's TID is larger than
+  // the TIDs of the txns it depends on). it is only published once it is
+  // in the pepoch file, so recovery replays every txn counted durable
+  static util::aligned_padded_elem<std::atomic<uint64_t>>
+    system_sync_tid_ CACHE_ALIGNED;
+  static std::atomic<uint64_t> g_sync_rounds_started_;
+  static std::atomic<uint64_t> g_sync_rounds_done_;
+
   static percore<persist_ctx> g_persist_ctxs CACHE_ALIGNED;
 
+  static int g_pepoch_fd; // where the persistent epoch is written, -1 if none
+
+  // empty (and null) if the log is not replicated
+  static std::vector<txn_log_shipper *> g_log_shippers; // one per logger
+  static txn_log_shipper *g_epoch_shipper;
+
+  // open addressed by btree pointer, deleted entries are tombstoned.
+  // modifications are serialized by g_tables_lock
+  static table_entry g_tables[g_nmax_tables];
+  static spinlock g_tables_lock;
+
   static percore<persist_stats> g_persist_stats CACHE_ALIGNED;
 
+  static util::aligned_padded_elem<std::atomic<uint64_t>>
+    g_nbytes_written[g_nmax_loggers];
+
+  // callbacks registered by each core, in TID order
+  struct durable_waiters {
+    spinlock lock_;
+    std::atomic<size_t> size_; // so the persister can skip idle cores
+    std::deque<std::pair<uint64_t, durable_callback *>> q_;
+    durable_waiters() : size_(0) {}
+  };
+
+  static percore<durable_waiters> g_durable_waiters CACHE_ALIGNED;
+
+  // fires the callbacks whose epochs are <= epoch
+  static void fire_durable_callbacks(uint64_t epoch);
+
   // counters
 
   static event_counter g_evt_log_buffer_epoch_boundary;
   static event_counter g_evt_log_buffer_out_of_space;
+  static event_counter g_evt_log_buffer_group_commit;
   static event_counter g_evt_log_buffer_bytes_before_compress;
   static event_counter g_evt_log_buffer_bytes_after_compress;
   static event_counter g_evt_logger_writev_limit_met;
@@ -344,6 +1014,16 @@ private:
   static event_avg_counter g_evt_avg_log_buffer_compress_time_us;
   static event_avg_counter g_evt_avg_logger_bytes_per_writev;
   static event_avg_counter g_evt_avg_logger_bytes_per_sec;
+
+  // time from commit to durability, in usec. each (core, epoch) (or with
+  // group commit, each log buffer) contributes its txns, all at the latency
+  // of its earliest txn
+  static event_histogram g_hist_persist_latency_us;
+
+  // per logger, named logger<id>_writev_us and logger<id>_fsync_us. with
+  // DAX, these time the copy into the mapping and the cache line flushes
+  static event_histogram *g_hist_logger_writev_us[g_nmax_loggers];
+  static event_histogram *g_hist_logger_fsync_us[g_nmax_loggers];
 };
 
 static inline std::ostream &
@@ -355,6 +1035,7 @@ operator<<(std::ostream &o, txn_logger::logbuf_header &hdr)
 }
 
 class transaction_proto2_static {
+  friend class txn_logger; // for push_horizon_to_buffer()
 public:
 
   // NOTE:
@@ -364,17 +1045,23 @@ public:
   // however, read only txns and GC are tied to multiples of the ticker
   // subsystem's tick
 
+  // the tick length is set at runtime (see ticker::TickUsec()), so a read
+  // only epoch is only 1 s long at the default tick length
+
 #ifdef CHECK_INVARIANTS
   static const uint64_t ReadOnlyEpochMultiplier = 10; /* 10 * 1 ms */
 #else
   static const uint64_t ReadOnlyEpochMultiplier = 25; /* 25 * 40 ms */
-  static_assert(ticker::tick_us * ReadOnlyEpochMultiplier == 1000000, "");
+  static_assert(ticker::DefaultTickUsec * ReadOnlyEpochMultiplier == 1000000, "");
 #endif
 
   static_assert(ReadOnlyEpochMultiplier >= 1, "XX");
 
-  static const uint64_t ReadOnlyEpochUsec =
-    ticker::tick_us * ReadOnlyEpochMultiplier;
+  static inline uint64_t
+  ReadOnlyEpochUsec()
+  {
+    return ticker::TickUsec() * ReadOnlyEpochMultiplier;
+  }
 
   static inline uint64_t constexpr
   to_read_only_tick(uint64_t epoch_tick)
@@ -407,6 +1094,48 @@ public:
     return (v & EpochMask) >> EpochShift;
   }
 
+  /**
+   * Trims the version chain of head, which must be the latest (and locked)
+   * tuple of its record, on a writer's path. The versions past the first one
+   * every snapshot sees are never read again, so they are unlinked (they are
+   * already queued for GC, which still frees them). And if chains are
+   * bounded, the chain is cut after MaxVersionChainLength() versions, so the
+   * snapshot readers which would have walked past the cut abort instead
+   */
+  static inline void
+  TrimVersionChain(dbtuple *head)
+  {
+    INVARIANT(head->is_locked());
+    INVARIANT(head->is_latest());
+    const uint64_t last_tick_ex = ticker::s_instance.global_last_tick_exclusive();
+    // all reads happen at >= ro_tick_ex - 1 (see
+    // on_post_rcu_region_completion()), or at a pinned snapshot
+    const uint64_t ro_tick_ex =
+      last_tick_ex ? to_read_only_tick(last_tick_ex - 1) : 0;
+    const uint64_t ro_tick_geq = ro_tick_ex ? ClampToPinned(ro_tick_ex - 1) : 0;
+    // a pinned snapshot must be able to read the whole chain
+    const size_t max_len =
+      PinnedReadOnlyTick() == NoPin ? MaxVersionChainLength() : 0;
+    dbtuple *c = head;
+    for (size_t n = 1;; n++) {
+      dbtuple * const next = c->get_next();
+      if (!next || next == dbtuple::TruncatedChain())
+        return;
+      if (ro_tick_ex &&
+          to_read_only_tick(EpochId(c->version)) <= ro_tick_geq) {
+        c->clear_next();
+        ++g_evt_version_chain_trims;
+        return;
+      }
+      if (max_len && n >= max_len) {
+        c->set_next(dbtuple::TruncatedChain());
+        ++g_evt_version_chain_cuts;
+        return;
+      }
+      c = next;
+    }
+  }
+
   // XXX(stephentu): HACK
   static void
   wait_an_epoch()
@@ -439,6 +1168,17 @@ public:
       return MakeTid(CoreMask, NumIdMask >> NumIdShift, b - 1);
   }
 
+  // an upper bound on how old the snapshot ComputeReadOnlyTid(global_tick_ex)
+  // is: it ends at the last read only epoch boundary, and the current tick
+  // may be about to end
+  static inline uint64_t
+  ReadOnlyStalenessUsec(uint64_t global_tick_ex)
+  {
+    const uint64_t b =
+      (global_tick_ex / ReadOnlyEpochMultiplier) * ReadOnlyEpochMultiplier;
+    return (global_tick_ex - b + 1) * ticker::TickUsec();
+  }
+
   static const uint64_t NBitsNumber = 24;
 
   // XXX(stephentu): need to implement core ID recycling
@@ -481,6 +1221,24 @@ public:
 
   static void PurgeThreadOutstandingGCTasks();
 
+  // moves the reaping of delete queues off of the workers, onto n
+  // background threads: once per read only epoch, a worker hands everything
+  // in its queue which has become reapable to a gc thread in bulk, instead
+  // of reaping it inline after its txn. a worker's batches all go to the
+  // same gc thread, so they are reaped in order. if cpus are given, gc
+  // thread i is pinned to cpus[i % cpus.size()] (spare cores or
+  // hyperthreads, ideally). call at most once, before the workers start
+  static void
+  StartGCThreads(size_t n,
+                 const std::vector<unsigned> &cpus = std::vector<unsigned>());
+
+  // 0 if workers reap their own delete queues
+  static inline size_t
+  NumGCThreads()
+  {
+    return g_flags->g_ngc_threads.load(std::memory_order_acquire);
+  }
+
 #ifdef PROTO2_CAN_DISABLE_GC
   static inline bool
   IsGCEnabled()
@@ -489,6 +1247,66 @@ public:
   }
 #endif
 
+  // snapshot readers which would walk a version chain past n versions abort
+  // instead, 0 for no bound (see TrimVersionChain())
+  static void
+  SetMaxVersionChainLength(size_t n)
+  {
+    g_flags->g_max_version_chain_length.store(n, std::memory_order_release);
+  }
+  static inline size_t
+  MaxVersionChainLength()
+  {
+    return g_flags->g_max_version_chain_length.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Keeps everything the snapshot at tid reads from being trimmed or
+   * reclaimed until UnpinSnapshot(tid), so read-only txns made to read at tid
+   * (see transaction_proto2::set_snapshot_tid()) can be spread over any
+   * length of time. tid must be the snapshot_tid() of a read-only txn which
+   * is still running, since older snapshots may already be gone. A pin holds
+   * back GC (and version chain cuts) for everyone, so unpin it as soon as
+   * possible
+   */
+  static void PinSnapshot(uint64_t tid);
+  static void UnpinSnapshot(uint64_t tid);
+
+  static const uint64_t NoPin = std::numeric_limits<uint64_t>::max();
+
+  /**
+   * On a hot standby, read-only txns read at tid (a pinned snapshot, see
+   * txn_log_follower) rather than at the latest read only epoch, which may
+   * hold only part of the writes of an epoch of the primary being applied.
+   * 0, the default, goes back to the latest read only epoch
+   */
+  static inline void
+  SetStandbyReadTid(uint64_t tid)
+  {
+    g_flags->g_standby_read_tid.store(tid, std::memory_order_release);
+  }
+
+  static inline uint64_t
+  StandbyReadTid()
+  {
+    return g_flags->g_standby_read_tid.load(std::memory_order_acquire);
+  }
+
+  // the read only tick of the oldest pinned snapshot, NoPin if none
+  static inline uint64_t
+  PinnedReadOnlyTick()
+  {
+    return g_flags->g_pinned_ro_tick.load(std::memory_order_acquire);
+  }
+
+  // the oldest read only tick reads happen at, given that reads other than
+  // at a pinned snapshot happen at >= ro_tick_geq
+  static inline uint64_t
+  ClampToPinned(uint64_t ro_tick_geq)
+  {
+    return std::min(ro_tick_geq, PinnedReadOnlyTick());
+  }
+
 #ifdef PROTO2_CAN_DISABLE_SNAPSHOTS
   static void
   DisableSnapshots()
@@ -546,18 +1364,37 @@ protected:
 
   typedef basic_px_queue<delete_entry, 4096> px_queue;
 
+  struct threadctx;
+
+  // a worker's reapable delete entries, handed to a gc thread (see
+  // StartGCThreads()). the gc thread gives it back with the groups and key
+  // strings it freed, for the worker to reuse
+  struct gc_batch {
+    threadctx *owner_;
+    uint64_t ro_tick_geq_;
+    px_queue queue_;
+    std::vector<std::string *> pool_;
+    gc_batch() : owner_(nullptr), ro_tick_geq_(0) {}
+  };
+
+  struct gc_thread;
+
   struct threadctx {
     uint64_t last_commit_tid_;
     unsigned last_reaped_epoch_;
+    size_t nqueued_; // in queue_
 #ifdef ENABLE_EVENT_COUNTERS
     uint64_t last_reaped_timestamp_us_;
 #endif
     px_queue queue_;
     px_queue scratch_;
     std::deque<std::string *> pool_;
+    spinlock spare_lock_; // guards spare_batches_
+    std::vector<gc_batch *> spare_batches_; // given back by gc threads
     threadctx() :
         last_commit_tid_(0)
       , last_reaped_epoch_(0)
+      , nqueued_(0)
 #ifdef ENABLE_EVENT_COUNTERS
       , last_reaped_timestamp_us_(0)
 #endif
@@ -571,13 +1408,37 @@ protected:
   static void
   clean_up_to_including(threadctx &ctx, uint64_t ro_tick_geq);
 
+  // hands what clean_up_to_including() would reap to a gc thread
+  static void
+  hand_off_to_gc(threadctx &ctx, uint64_t ro_tick_geq);
+
+  // reaps every entry of q (which are all <= ro_tick_geq), leaving it
+  // empty. entries which cannot be reaped yet are requeued in ctx, and key
+  // strings are kept in ctx.pool_. returns the # of entries
+  static size_t
+  reap(threadctx &ctx, px_queue &q, uint64_t ro_tick_geq);
+
+  static void gc_loop(gc_thread *t, int cpu);
+
+  // call after every queue_.enqueue()
+  static inline ALWAYS_INLINE void
+  on_gc_enqueue(threadctx &ctx)
+  {
+    g_gauge_proto_gc_queue_depth.set(++ctx.nqueued_);
+  }
+
+  // how far behind ctx's GC is, for the gauges
+  static void update_gc_gauges(const threadctx &ctx);
+
   // helper methods
   static inline txn_logger::pbuffer *
-  wait_for_head(txn_logger::pbuffer_circbuf &pull_buf)
+  wait_for_head(txn_logger::pbuffer_circbuf &pull_buf, unsigned core_id)
   {
     // XXX(stephentu): spinning for now
     txn_logger::pbuffer *px;
     while (unlikely(!(px = pull_buf.peek()))) {
+      if (txn_logger::GrowBuffers(core_id))
+        continue;
       nop_pause();
       ++g_evt_worker_thread_wait_log_buffer;
     }
@@ -585,6 +1446,22 @@ protected:
     return px;
   }
 
+  // hands the current horizon off to the core's compression thread, and
+  // replaces it with a free one
+  static inline void
+  hand_off_horizon(txn_logger::persist_ctx &ctx, bool flush)
+  {
+    INVARIANT(txn_logger::NumCompressThreads());
+    ctx.horizon_->flush_ = flush;
+    ctx.compress_queue_.enq(ctx.horizon_);
+    while (unlikely(!ctx.free_horizons_.peek())) {
+      nop_pause();
+      ++g_evt_worker_thread_wait_log_buffer;
+    }
+    ctx.horizon_ = ctx.free_horizons_.deq();
+    INVARIANT(!ctx.horizon_->header()->nentries_);
+  }
+
   // pushes horizon to the front entry of pull_buf, pushing
   // to push_buf if necessary
   //
@@ -606,7 +1483,7 @@ protected:
     size_t ntxns_pushed_to_logger = 0;
 
     // horizon out of space- try to push horizon to buffer
-    txn_logger::pbuffer *px = wait_for_head(pull_buf);
+    txn_logger::pbuffer *px = wait_for_head(pull_buf, horizon->core_id_);
     const uint64_t compressed_space_needed =
       sizeof(uint32_t) + LZ4_compressBound(horizon->datasize());
 
@@ -619,7 +1496,7 @@ protected:
       txn_logger::pbuffer *px1 = pull_buf.deq();
       INVARIANT(px == px1);
       push_buf.enq(px1);
-      px = wait_for_head(pull_buf);
+      px = wait_for_head(pull_buf, horizon->core_id_);
       if (buffer_cond)
         ++txn_logger::g_evt_log_buffer_epoch_boundary;
       else
@@ -685,17 +1562,32 @@ protected:
   struct flags {
     std::atomic<bool> g_gc_init;
     std::atomic<bool> g_disable_snapshots;
-    constexpr flags() : g_gc_init(false), g_disable_snapshots(false) {}
+    std::atomic<size_t> g_max_version_chain_length; // 0 for unbounded
+    std::atomic<uint64_t> g_pinned_ro_tick; // see PinSnapshot()
+    std::atomic<uint64_t> g_standby_read_tid; // see SetStandbyReadTid()
+    std::atomic<size_t> g_ngc_threads; // see StartGCThreads()
+    constexpr flags()
+      : g_gc_init(false), g_disable_snapshots(false),
+        g_max_version_chain_length(0),
+        g_pinned_ro_tick(std::numeric_limits<uint64_t>::max()),
+        g_standby_read_tid(0),
+        g_ngc_threads(0) {}
   };
   static util::aligned_padded_elem<flags> g_flags;
 
   static percore_lazy<threadctx> g_threadctxs;
 
+  static std::vector<gc_thread *> g_gc_threads; // never freed
+
   static event_counter g_evt_worker_thread_wait_log_buffer;
   static event_counter g_evt_dbtuple_no_space_for_delkey;
   static event_counter g_evt_proto_gc_delete_requeue;
+  static event_counter g_evt_bounded_staleness_validated_reads;
+  static event_counter g_evt_version_chain_trims;
+  static event_counter g_evt_version_chain_cuts;
   static event_avg_counter g_evt_avg_log_entry_size;
   static event_avg_counter g_evt_avg_proto_gc_queue_len;
+  static event_gauge g_gauge_proto_gc_queue_depth;
 };
 
 bool
@@ -728,13 +1620,10 @@ public:
 
   transaction_proto2(uint64_t flags,
                      typename Traits::StringAllocator &sa)
-    : transaction<transaction_proto2, Traits>(flags, sa)
+    : transaction<transaction_proto2, Traits>(flags, sa),
+      last_commit_tid_(0)
   {
-    if (this->get_flags() & transaction_base::TXN_FLAG_READ_ONLY) {
-      const uint64_t global_tick_ex =
-        this->rcu_guard_->guard()->impl().global_last_tick_exclusive();
-      u_.last_consistent_tid = ComputeReadOnlyTid(global_tick_ex);
-    }
+    init_snapshot();
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
     dbtuple::TupleLockRegionBegin();
 #endif
@@ -743,12 +1632,58 @@ public:
 
   ~transaction_proto2()
   {
+    if (this->is_parked())
+      return;
 #ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
     dbtuple::AssertAllTupleLocksReleased();
 #endif
     INVARIANT(rcu::s_instance.in_rcu_region());
   }
 
+  // see transaction::park() and transaction::reset()
+  inline void
+  on_park()
+  {
+#ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
+    dbtuple::AssertAllTupleLocksReleased();
+#endif
+  }
+
+  inline void
+  on_reset()
+  {
+    last_commit_tid_ = 0;
+    init_snapshot();
+#ifdef TUPLE_LOCK_OWNERSHIP_CHECKING
+    dbtuple::TupleLockRegionBegin();
+#endif
+  }
+
+  inline void
+  init_snapshot()
+  {
+    if (this->get_flags() & transaction_base::TXN_FLAG_READ_ONLY) {
+      const uint64_t standby_tid = StandbyReadTid();
+      if (unlikely(standby_tid)) {
+        u_.last_consistent_tid = standby_tid;
+        return;
+      }
+      const uint64_t global_tick_ex =
+        this->rcu_guard_->guard()->impl().global_last_tick_exclusive();
+      if (unlikely(this->get_flags() &
+                   transaction_base::TXN_FLAG_BOUNDED_STALENESS) &&
+          ReadOnlyStalenessUsec(global_tick_ex) >
+            transaction_base::MaxStalenessUsec(this->get_flags())) {
+        // versions are only kept at read only epoch boundaries, so there is
+        // no fresher snapshot to fall back on
+        ++g_evt_bounded_staleness_validated_reads;
+        this->snapshot = false;
+      } else {
+        u_.last_consistent_tid = ComputeReadOnlyTid(global_tick_ex);
+      }
+    }
+  }
+
   inline bool
   can_overwrite_record_tid(tid_t prev, tid_t cur) const
   {
@@ -769,6 +1704,40 @@ public:
            !prev;
   }
 
+  // read-only epochs an adaptive table waits, after a snapshot read it,
+  // before it overwrites in place again
+  static const uint64_t AdaptiveQuietReadOnlyTicks = 2;
+
+  inline bool
+  can_drop_old_versions(const concurrent_btree *btr) const
+  {
+    switch (btr->write_policy()) {
+    case transaction_base::WRITE_POLICY_VERSIONED:
+      return false;
+    case transaction_base::WRITE_POLICY_IN_PLACE:
+      break;
+    case transaction_base::WRITE_POLICY_ADAPTIVE:
+      {
+        const uint64_t last = btr->last_snapshot_read();
+        const uint64_t ro_tick =
+          to_read_only_tick(ticker::s_instance.global_current_tick());
+        if (last && last - 1 + AdaptiveQuietReadOnlyTicks >= ro_tick)
+          return false;
+      }
+      break;
+    }
+    // a pinned snapshot must be able to read every chain
+    return PinnedReadOnlyTick() == NoPin;
+  }
+
+  inline void
+  note_snapshot_read(const concurrent_btree *btr) const
+  {
+    if (btr->write_policy() == transaction_base::WRITE_POLICY_ADAPTIVE)
+      btr->note_snapshot_read(
+          to_read_only_tick(ticker::s_instance.global_current_tick()));
+  }
+
   // can only read elements in this epoch or previous epochs
   inline bool
   can_read_tid(tid_t t) const
@@ -776,9 +1745,35 @@ public:
     return true;
   }
 
+  // like commit(), but if the txn commits then cb->on_durable() is called
+  // once it is durable (see txn_logger::NotifyOnDurable()), so the caller
+  // can go on to run other txns in the meantime. txns which did not write
+  // anything wait for the epoch they committed in, since they could have
+  // read writes which are not durable yet
+  bool
+  commit_async(txn_logger::durable_callback *cb, bool doThrow = false)
+  {
+    last_commit_tid_ = 0;
+    if (!this->commit(doThrow))
+      return false;
+    const tid_t tid = last_commit_tid_ ? last_commit_tid_ :
+      MakeTid(0, 0, ticker::s_instance.global_current_tick());
+    txn_logger::NotifyOnDurable(tid, cb);
+    return true;
+  }
+
+  inline void
+  on_trace_durable(tid_t commit_tid)
+  {
+    if (txn_logger::IsPersistenceEnabled())
+      txn_logger::TraceDurable(commit_tid);
+  }
+
   inline void
   on_tid_finish(tid_t commit_tid)
   {
+    if (this->state == transaction_base::TXN_COMMITED)
+      last_commit_tid_ = commit_tid;
     if (!txn_logger::IsPersistenceEnabled() ||
         this->state != transaction_base::TXN_COMMITED)
       return;
@@ -789,8 +1784,10 @@ public:
     // compute how much space is necessary
     uint64_t space_needed = 0;
 
-    // 8 bytes to indicate TID
-    space_needed += sizeof(uint64_t);
+    // 8 bytes to indicate TID (at most 10 with compact encoding, since
+    // which buffer the txn goes in is not known yet)
+    const bool compact = txn_logger::IsCompactEncodingEnabled();
+    space_needed += txn_logger::txn_encoder::MaxTidNBytes(compact);
 
     // variable bytes to indicate # of records written
 #ifdef LOGGER_UNSAFE_FAKE_COMPRESSION
@@ -803,11 +1800,12 @@ public:
 
     // each record needs to be recorded
     write_set_u32_vec value_sizes;
+    txn_logger::txn_encoder enc(compact, 0);
     for (unsigned idx = 0; idx < nwrites; idx++) {
       const transaction_base::write_record_t &rec = this->write_set[idx];
-      const uint32_t k_nbytes = rec.get_key().size();
-      space_needed += vs_uint32_t.nbytes(&k_nbytes);
-      space_needed += k_nbytes;
+      space_needed += enc.key_nbytes(
+          txn_logger::TableIdFor(rec.get_btree()),
+          (const uint8_t *) rec.get_key().data(), rec.get_key().size());
 
       const uint32_t v_nbytes = rec.get_value() ?
           rec.get_writer()(
@@ -834,6 +1832,7 @@ public:
 
     util::non_atomic_fetch_add(stats.ntxns_committed_, 1UL);
 
+    const uint64_t group_commit_us = txn_logger::GroupCommitUsec();
     const bool do_compress = txn_logger::IsCompressionEnabled();
     if (do_compress) {
       // try placing in horizon
@@ -847,22 +1846,48 @@ public:
         }
         INVARIANT(ctx.horizon_->datasize());
         // horizon out of space, so we push it
-        const uint64_t npushed =
-          push_horizon_to_buffer(ctx.horizon_, ctx.lz4ctx_, pull_buf, push_buf);
-        if (npushed)
-          util::non_atomic_fetch_add(stats.ntxns_pushed_, npushed);
+        if (txn_logger::NumCompressThreads()) {
+          hand_off_horizon(ctx, false);
+        } else {
+          const uint64_t npushed =
+            push_horizon_to_buffer(ctx.horizon_, ctx.lz4ctx_, pull_buf, push_buf);
+          if (npushed)
+            util::non_atomic_fetch_add(stats.ntxns_pushed_, npushed);
+        }
       }
 
       INVARIANT(ctx.horizon_->space_remaining() >= space_needed);
       const uint64_t written =
         write_current_txn_into_buffer(ctx.horizon_, commit_tid, value_sizes);
-      if (written != space_needed)
+      if (written > space_needed)
         INVARIANT(false);
 
+      // with group commit, don't wait for an epoch boundary (or a full
+      // buffer) to hand the horizon off to the logger
+      if (unlikely(group_commit_us) &&
+          util::timer::cur_usec() - ctx.horizon_->earliest_start_us_ >= group_commit_us) {
+        if (txn_logger::NumCompressThreads()) {
+          hand_off_horizon(ctx, true);
+        } else {
+          const uint64_t npushed =
+            push_horizon_to_buffer(ctx.horizon_, ctx.lz4ctx_, pull_buf, push_buf);
+          if (npushed)
+            util::non_atomic_fetch_add(stats.ntxns_pushed_, npushed);
+          txn_logger::pbuffer *px = pull_buf.peek();
+          if (px && px->header()->nentries_) {
+            txn_logger::pbuffer *px0 = pull_buf.deq();
+            INVARIANT(px == px0);
+            util::non_atomic_fetch_add(stats.ntxns_pushed_, uint64_t(px0->header()->nentries_));
+            push_buf.enq(px0);
+          }
+        }
+        ++txn_logger::g_evt_log_buffer_group_commit;
+      }
+
     } else {
 
     retry:
-      txn_logger::pbuffer *px = wait_for_head(pull_buf);
+      txn_logger::pbuffer *px = wait_for_head(pull_buf, my_core_id);
       INVARIANT(px && px->core_id_ == my_core_id);
       bool cond = false;
       if (px->space_remaining() < space_needed ||
@@ -871,7 +1896,7 @@ public:
         txn_logger::pbuffer *px0 = pull_buf.deq();
         INVARIANT(px == px0);
         INVARIANT(px0->header()->nentries_);
-        util::non_atomic_fetch_add(stats.ntxns_pushed_, px0->header()->nentries_);
+        util::non_atomic_fetch_add(stats.ntxns_pushed_, uint64_t(px0->header()->nentries_));
         push_buf.enq(px0);
         if (cond)
           ++txn_logger::g_evt_log_buffer_epoch_boundary;
@@ -882,14 +1907,25 @@ public:
 
       const uint64_t written =
         write_current_txn_into_buffer(px, commit_tid, value_sizes);
-      if (written != space_needed)
+      if (written > space_needed)
         INVARIANT(false);
+
+      // see above
+      if (unlikely(group_commit_us) &&
+          util::timer::cur_usec() - px->earliest_start_us_ >= group_commit_us) {
+        txn_logger::pbuffer *px0 = pull_buf.deq();
+        INVARIANT(px == px0);
+        util::non_atomic_fetch_add(stats.ntxns_pushed_, uint64_t(px0->header()->nentries_));
+        push_buf.enq(px0);
+        ++txn_logger::g_evt_log_buffer_group_commit;
+      }
     }
   }
 
 private:
 
-  // assumes enough space in px to hold this txn
+  // assumes enough space in px to hold this txn. see txn_logger::txn_encoder
+  // for the layout
   inline uint64_t
   write_current_txn_into_buffer(
       txn_logger::pbuffer *px,
@@ -905,7 +1941,6 @@ private:
     uint8_t *porig = p;
 
     serializer<uint32_t, true> vs_uint32_t;
-    serializer<uint64_t, false> s_uint64_t;
 
 #ifdef LOGGER_UNSAFE_FAKE_COMPRESSION
     const unsigned nwrites = 0;
@@ -916,15 +1951,16 @@ private:
 
     INVARIANT(nwrites == value_sizes.size());
 
-    p = s_uint64_t.write(p, commit_tid);
-    p = vs_uint32_t.write(p, nwrites);
+    txn_logger::txn_encoder enc(
+        txn_logger::IsCompactEncodingEnabled(),
+        px->header()->nentries_ ? px->header()->last_tid_ : 0);
+    p = enc.write_txn(p, commit_tid, nwrites);
 
     for (unsigned idx = 0; idx < nwrites; idx++) {
       const transaction_base::write_record_t &rec = this->write_set[idx];
-      const uint32_t k_nbytes = rec.get_key().size();
-      p = vs_uint32_t.write(p, k_nbytes);
-      NDB_MEMCPY(p, rec.get_key().data(), k_nbytes);
-      p += k_nbytes;
+      p = enc.write_key(
+          p, txn_logger::TableIdFor(rec.get_btree()),
+          (const uint8_t *) rec.get_key().data(), rec.get_key().size());
       const uint32_t v_nbytes = value_sizes[idx];
       p = vs_uint32_t.write(p, v_nbytes);
       if (v_nbytes) {
@@ -942,8 +1978,14 @@ private:
 
 public:
 
-  inline ALWAYS_INLINE bool is_snapshot() const {
-    return this->get_flags() & transaction_base::TXN_FLAG_READ_ONLY;
+  // makes this read-only txn, which must not have read anything yet, read
+  // at the pinned snapshot tid (see transaction_proto2_static::PinSnapshot())
+  inline void
+  set_snapshot_tid(transaction_base::tid_t tid)
+  {
+    INVARIANT(this->is_snapshot());
+    INVARIANT(to_read_only_tick(EpochId(tid)) >= PinnedReadOnlyTick());
+    u_.last_consistent_tid = tid;
   }
 
   inline transaction_base::tid_t
@@ -960,6 +2002,38 @@ public:
     return u_.last_consistent_tid;
   }
 
+  // turns tuple, the latest version of key in btr, into a logical delete at
+  // its own tid if that is no later than cutoff, to be GC-ed like any other
+  // (see txn_ttl). nothing is logged. returns false if the tuple is locked,
+  // newer than cutoff, or already deleted. the txn must be running
+  bool
+  expire_tuple(dbtuple *tuple, const std::string &key,
+               concurrent_btree *btr, tid_t cutoff)
+  {
+    INVARIANT(rcu::s_instance.in_rcu_region());
+    dbtuple::version_t v;
+    if (!tuple->try_lock(true, 16, v))
+      return false;
+    if (!dbtuple::IsLatest(v) ||
+        dbtuple::IsDeleting(v) ||
+        tuple->version == dbtuple::MAX_TID ||
+        tuple->version > cutoff) {
+      tuple->unlock();
+      return false;
+    }
+    tuple->mark_modifying();
+    if (dbtuple::IsCold(v))
+      // the row's value in the cold file is garbage from here on
+      tuple->clear_cold();
+    tuple->mark_deleting();
+    tuple->size = 0;
+    // the delete is as good as made now, at the tuple's own tid
+    on_logical_delete_at(tuple, key, btr,
+        to_read_only_tick(ticker::s_instance.global_current_tick()));
+    tuple->unlock();
+    return true;
+  }
+
   void
   dump_debug_info() const
   {
@@ -999,6 +2073,9 @@ public:
         if (it->get_tid() > ret)
           ret = it->get_tid();
       }
+      for (auto &r : this->field_read_set)
+        if (r.t > ret)
+          ret = r.t;
     }
 
     {
@@ -1044,6 +2121,8 @@ public:
   inline ALWAYS_INLINE void
   on_dbtuple_spill(dbtuple *tuple_ahead, dbtuple *tuple)
   {
+    TrimVersionChain(tuple_ahead);
+
 #ifdef PROTO2_CAN_DISABLE_GC
     if (!IsGCEnabled())
       return;
@@ -1079,11 +2158,22 @@ public:
         delete_entry(tuple_ahead, tuple_ahead->version,
           tuple, marked_ptr<std::string>(), nullptr),
         ro_tick);
+    on_gc_enqueue(ctx);
   }
 
   inline ALWAYS_INLINE void
   on_logical_delete(dbtuple *tuple, const std::string &key, concurrent_btree *btr)
   {
+    on_logical_delete_at(
+        tuple, key, btr, to_read_only_tick(this->u_.commit_epoch));
+  }
+
+  // as on_logical_delete(), for a delete made visible in read only tick
+  // ro_tick
+  inline ALWAYS_INLINE void
+  on_logical_delete_at(dbtuple *tuple, const std::string &key,
+                       concurrent_btree *btr, uint64_t ro_tick)
+  {
 #ifdef PROTO2_CAN_DISABLE_GC
     if (!IsGCEnabled())
       return;
@@ -1097,7 +2187,6 @@ public:
     INVARIANT(!tuple->size);
     INVARIANT(rcu::s_instance.in_rcu_region());
 
-    const uint64_t ro_tick = to_read_only_tick(this->u_.commit_epoch);
     threadctx &ctx = g_threadctxs.my();
 
 #ifdef CHECK_INVARIANTS
@@ -1116,6 +2205,7 @@ public:
       ctx.queue_.enqueue(
           delete_entry(nullptr, tuple->version, tuple, mpx, btr),
           ro_tick);
+      on_gc_enqueue(ctx);
     } else {
       // this is a rare event
       ++g_evt_dbtuple_no_space_for_delkey;
@@ -1135,6 +2225,7 @@ public:
       ctx.queue_.enqueue(
           delete_entry(nullptr, tuple->version, tuple, mpx, btr),
           ro_tick);
+      on_gc_enqueue(ctx);
     }
   }
 
@@ -1156,9 +2247,12 @@ public:
       // won't have anything to clean
       return;
     // all reads happening at >= ro_tick_geq
-    const uint64_t ro_tick_geq = ro_tick_ex - 1;
+    const uint64_t ro_tick_geq = ClampToPinned(ro_tick_ex - 1);
     threadctx &ctx = g_threadctxs.my();
-    clean_up_to_including(ctx, ro_tick_geq);
+    if (NumGCThreads())
+      hand_off_to_gc(ctx, ro_tick_geq);
+    else
+      clean_up_to_including(ctx, ro_tick_geq);
   }
 
 private:
@@ -1170,19 +2264,62 @@ private:
     // the epoch for this txn -- committing non-snapshot txns only
     uint64_t commit_epoch;
   } u_;
+
+  tid_t last_commit_tid_; // set by on_tid_finish(), 0 if none
 };
 
 // txn_btree_handler specialization
 template <>
 struct base_txn_btree_handler<transaction_proto2> {
   static inline void
-  on_construct()
+  on_construct(const std::string &name, concurrent_btree *btr)
   {
 #ifndef PROTO2_CAN_DISABLE_GC
     transaction_proto2_static::InitGC();
 #endif
+    txn_logger::RegisterTable(name, btr);
+  }
+  static inline void
+  on_typed_construct(concurrent_btree *btr, uint64_t all_fields)
+  {
+    txn_logger::SetTableFieldsMask(btr, all_fields);
+  }
+  static inline void
+  on_destruct(concurrent_btree *btr)
+  {
+    txn_logger::UnregisterTable(btr);
   }
   static const bool has_background_task = true;
+  // as if committed at the start of the current epoch, so snapshots see the
+  // records once it is over, just like regular inserts
+  static inline transaction_base::tid_t
+  bulk_load_tid()
+  {
+    return transaction_proto2_static::MakeTid(
+        0, 0, ticker::s_instance.global_last_tick_exclusive());
+  }
+  // bulk loads are not logged, so with logging on they would be lost in a
+  // crash (or leave recovery replaying later writes onto missing rows)
+  static inline bool
+  can_bulk_load()
+  {
+    return !txn_logger::IsPersistenceEnabled();
+  }
+  static inline bool
+  snapshot_covers(transaction_base::tid_t tid, uint64_t tick)
+  {
+    return tid && transaction_proto2_static::EpochId(tid) >= tick;
+  }
+  static inline void
+  pin_snapshot(transaction_base::tid_t tid)
+  {
+    transaction_proto2_static::PinSnapshot(tid);
+  }
+  static inline void
+  unpin_snapshot(transaction_base::tid_t tid)
+  {
+    transaction_proto2_static::UnpinSnapshot(tid);
+  }
 };
 
 template <>
@@ -1225,6 +2362,12 @@ struct txn_epoch_sync<transaction_proto2> : public transaction_proto2_static {
       txn_logger::g_persist_stats[my_core_id];
     txn_logger::pbuffer_circbuf &pull_buf = ctx.all_buffers_;
     txn_logger::pbuffer_circbuf &push_buf = ctx.persist_buffers_;
+    if (txn_logger::IsCompressionEnabled() &&
+        txn_logger::NumCompressThreads()) {
+      // the compression thread owns the log buffers
+      hand_off_horizon(ctx, true);
+      return;
+    }
     if (txn_logger::IsCompressionEnabled() &&
         ctx.horizon_->header()->nentries_) {
       INVARIANT(ctx.horizon_->datasize());
@@ -1242,7 +2385,7 @@ struct txn_epoch_sync<transaction_proto2> : public transaction_proto2_static {
     //std::cerr << "core " << my_core_id
     //          << " pushing buffer to logger" << std::endl;
     txn_logger::pbuffer *px0 = pull_buf.deq();
-    util::non_atomic_fetch_add(stats.ntxns_pushed_, px0->header()->nentries_);
+    util::non_atomic_fetch_add(stats.ntxns_pushed_, uint64_t(px0->header()->nentries_));
     INVARIANT(px0 == px);
     push_buf.enq(px0);
   }
@@ -1253,6 +2396,13 @@ struct txn_epoch_sync<transaction_proto2> : public transaction_proto2_static {
       return std::make_tuple(0, 0, 0.0);
     return txn_logger::compute_ntxns_persisted_statistics();
   }
+  static uint64_t
+  compute_nbytes_logged()
+  {
+    if (!txn_logger::IsPersistenceEnabled())
+      return 0;
+    return txn_logger::compute_nbytes_written();
+  }
   static void
   reset_ntxn_persisted()
   {
@@ -0,0 +1,1038 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txn_recovery.h"
+#include "txn_checkpoint.h"
+#include "txn_ttl.h"
+#include "spinbarrier.h"
+#include "counter.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+  struct buffer_desc {
+    const uint8_t *data_; // just past the logbuf_header
+    size_t len_;
+    uint64_t nentries_;
+    uint64_t epoch_;
+    uint64_t core_;
+    bool compact_; // see txn_logger::IsCompactBuffer()
+  };
+
+  struct mapped_file {
+    const uint8_t *p_;
+    size_t sz_;
+    mapped_file() : p_(nullptr), sz_(0) {}
+  };
+
+  typedef pair<uint32_t, string> table_key;
+
+  struct table_key_hash {
+    inline size_t
+    operator()(const table_key &k) const
+    {
+      return std::hash<string>()(k.second) ^ (size_t(k.first) << 1);
+    }
+  };
+
+  // the expiry records logged for a table (see txn_ttl)
+  struct table_expiry {
+    uint64_t cutoff_; // the highest TTL cutoff
+    vector<txn_ttl::deleted_range> ranges_;
+
+    table_expiry() : cutoff_(0) {}
+
+    inline bool
+    expires(const char *k, size_t klen, uint64_t tid) const
+    {
+      if (tid <= cutoff_)
+        return true;
+      for (auto &r : ranges_)
+        if (tid <= r.tid_ && r.contains(k, klen))
+          return true;
+      return false;
+    }
+  };
+
+  typedef pair<uint64_t, string> delta_entry; // (tid, logged delta)
+
+  struct versioned_value {
+    bool has_base_; // false if only deltas to the key were seen so far
+    bool loaded_;   // the key was bulk loaded from a checkpoint image
+    uint64_t tid_;
+    string value_; // empty for removals
+    vector<delta_entry> deltas_; // unordered, may predate the base
+
+    versioned_value() : has_base_(false), loaded_(false), tid_(0) {}
+
+    // a write at tid wins over an earlier write of the same txn, since a
+    // txn logs its writes in the order they were made
+    inline bool
+    base_older_than(uint64_t tid) const
+    {
+      return !has_base_ || tid_ <= tid;
+    }
+
+    inline void
+    drop_deltas_upto(uint64_t tid)
+    {
+      if (deltas_.empty())
+        return;
+      deltas_.erase(
+          remove_if(deltas_.begin(), deltas_.end(),
+            [tid](const delta_entry &d) { return d.first <= tid; }),
+          deltas_.end());
+    }
+
+    inline void
+    merge(versioned_value &&other)
+    {
+      if (other.has_base_ && (!has_base_ || tid_ < other.tid_)) {
+        has_base_ = true;
+        tid_ = other.tid_;
+        value_ = move(other.value_);
+      }
+      if (deltas_.empty())
+        deltas_ = move(other.deltas_);
+      else
+        for (auto &d : other.deltas_)
+          deltas_.push_back(move(d));
+    }
+  };
+
+  typedef unordered_map<table_key, versioned_value, table_key_hash> partition_map;
+
+  // decodes one txn starting at p, invoking fn(tid, table_id, key, klen, value, vlen)
+  // for each write. returns nullptr if [p, end) does not hold an entire txn
+  template <typename Fn>
+  const uint8_t *
+  decode_txn(const uint8_t *p, const uint8_t *end,
+             txn_logger::txn_decoder &dec, Fn &fn)
+  {
+    serializer<uint32_t, true> vs_uint32_t;
+    uint64_t tid;
+    uint32_t nwrites;
+    if (!(p = dec.read_txn(p, end, tid, nwrites)))
+      return nullptr;
+    for (uint32_t i = 0; i < nwrites; i++) {
+      uint32_t table_id, klen, vlen;
+      const uint8_t *k;
+      if (!(p = dec.read_key(p, end, table_id, k, klen)) ||
+          !(p = vs_uint32_t.failsafe_read(p, end - p, &vlen)) ||
+          size_t(end - p) < vlen)
+        return nullptr;
+      fn(tid, table_id, k, klen, p, vlen);
+      p += vlen;
+    }
+    return p;
+  }
+
+  struct noop_visitor {
+    inline void
+    operator()(uint64_t, uint32_t, const uint8_t *, uint32_t,
+               const uint8_t *, uint32_t) const {}
+  };
+
+  // decodes up to nentries txns which start at p. if compressed, the txns
+  // are contained in [uint32_t len][lz4 data] chunks. returns the end of the
+  // buffer, or nullptr if it is incomplete. with compact encoding, tids are
+  // relative to the txn before in the same buffer (or chunk)
+  template <typename Fn>
+  const uint8_t *
+  decode_buffer(const uint8_t *p, const uint8_t *end, uint64_t nentries,
+                bool compressed, bool compact, vector<uint8_t> &scratch,
+                Fn &fn)
+  {
+    if (!compressed) {
+      txn_logger::txn_decoder dec(compact);
+      for (uint64_t i = 0; i < nentries; i++)
+        if (!(p = decode_txn(p, end, dec, fn)))
+          return nullptr;
+      return p;
+    }
+    serializer<uint32_t, false> s_uint32_t;
+    scratch.resize(txn_logger::g_horizon_buffer_size);
+    uint64_t n = 0;
+    while (n < nentries) {
+      uint32_t clen;
+      if (!(p = s_uint32_t.failsafe_read(p, end - p, &clen)) ||
+          size_t(end - p) < clen)
+        return nullptr;
+      const int ret = LZ4_decompress_safe(
+          (const char *) p, (char *) &scratch[0], clen, scratch.size());
+      if (ret < 0)
+        return nullptr;
+      p += clen;
+      const uint8_t *q = &scratch[0];
+      const uint8_t * const qend = q + ret;
+      txn_logger::txn_decoder dec(compact);
+      while (q < qend) {
+        if (!(q = decode_txn(q, qend, dec, fn)))
+          return nullptr;
+        n++;
+      }
+    }
+    return n == nentries ? p : nullptr;
+  }
+
+  // returns true if the entire file was made up of valid buffers
+  bool
+  scan_file(const mapped_file &f, bool compressed, vector<buffer_desc> &bufs)
+  {
+    const uint8_t *p = f.p_;
+    const uint8_t * const end = f.p_ + f.sz_;
+    vector<uint8_t> scratch;
+    noop_visitor v;
+    while (p < end) {
+      if (size_t(end - p) < sizeof(txn_logger::logbuf_header))
+        return false;
+      txn_logger::logbuf_header hdr;
+      NDB_MEMCPY(&hdr, p, sizeof(hdr));
+      if (!hdr.nentries_)
+        // the rest of the file is preallocated (or never written)
+        return false;
+      const uint8_t * const data = p + sizeof(hdr);
+      const uint8_t * const next =
+        decode_buffer(data, end, txn_logger::BufferNEntries(hdr), compressed,
+                      txn_logger::IsCompactBuffer(hdr), scratch, v);
+      if (!next)
+        return false;
+      if (hdr.crc_ &&
+          hdr.crc_ != txn_logger::BufferChecksum(hdr, data, next - data))
+        // torn (or otherwise corrupt), so it and everything after it is
+        // dropped
+        return false;
+      buffer_desc d;
+      d.data_ = data;
+      d.len_ = next - data;
+      d.nentries_ = txn_logger::BufferNEntries(hdr);
+      d.epoch_ = transaction_proto2_static::EpochId(hdr.last_tid_);
+      d.core_ = transaction_proto2_static::CoreId(hdr.last_tid_);
+      d.compact_ = txn_logger::IsCompactBuffer(hdr);
+      bufs.push_back(d);
+      p = next;
+    }
+    return true;
+  }
+
+  mapped_file
+  map_file(const string &fname)
+  {
+    mapped_file ret;
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1) {
+      perror("open");
+      ALWAYS_ASSERT(false);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      perror("fstat");
+      ALWAYS_ASSERT(false);
+    }
+    if (st.st_size) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        perror("mmap");
+        ALWAYS_ASSERT(false);
+      }
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      ret.p_ = (const uint8_t *) p;
+      ret.sz_ = st.st_size;
+    }
+    close(fd);
+    return ret;
+  }
+
+  // bulk loads the rows of img into h, using nthreads threads
+  void
+  load_image(const txn_checkpointer::table_image &img,
+             txn_log_replayer::table_handler *h, size_t nthreads)
+  {
+    const size_t n = img.nrows();
+    vector<varkey> keys(n);
+    vector<const uint8_t *> values(n);
+    vector<size_t> sizes(n);
+    auto fill = [&](size_t begin, size_t end) {
+      img.visit(begin, end,
+          [&](uint64_t i, const txn_checkpointer::table_image::row &r) {
+            keys[i] = varkey(r.k_, r.klen_);
+            values[i] = r.v_;
+            sizes[i] = r.vlen_;
+          });
+    };
+    nthreads = max<size_t>(1, min(nthreads, n));
+    const size_t per_thread = n / nthreads;
+    vector<thread> thds;
+    for (size_t t = 1; t < nthreads; t++)
+      thds.emplace_back(fill, t * per_thread,
+                        t + 1 == nthreads ? n : (t + 1) * per_thread);
+    fill(0, nthreads == 1 ? n : per_thread);
+    for (auto &t : thds)
+      t.join();
+    h->bulk_load(keys.data(), values.data(), sizes.data(), n, nthreads);
+  }
+
+  static const size_t InstallBatchSize = 64;
+}
+
+static event_counter evt_log_replay_txns("log_replay_txns");
+static event_counter evt_log_replay_writes("log_replay_writes");
+static event_counter evt_log_replay_deltas("log_replay_deltas");
+
+bool
+txn_log_replayer::ReadPersistentEpoch(const string &logfile, uint64_t &epoch,
+                                      uint64_t *tid)
+{
+  const string fname = logfile + txn_logger::g_pepoch_suffix;
+  const int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  // [epoch][tid], the tid only written with group commit
+  uint64_t v[2] = {0, 0};
+  const ssize_t ret = pread(fd, v, sizeof(v), 0);
+  close(fd);
+  if (ret < ssize_t(sizeof(v[0])))
+    return false;
+  epoch = v[0];
+  if (tid)
+    *tid = ret == sizeof(v) ? v[1] : 0;
+  return true;
+}
+
+txn_log_replayer::replay_stats
+txn_log_replayer::Replay(
+    const vector<string> &logfiles,
+    const string &checkpoint_dir,
+    const map<string, table_type *> &tables,
+    size_t nthreads,
+    bool compressed,
+    bool verbose)
+{
+  vector<unique_ptr<string_table_handler>> handlers;
+  map<string, table_handler *> htables;
+  for (auto &p : tables) {
+    handlers.emplace_back(new string_table_handler(p.second));
+    htables[p.first] = handlers.back().get();
+  }
+  return Replay(logfiles, checkpoint_dir, htables, nthreads, compressed,
+                verbose);
+}
+
+txn_log_replayer::replay_stats
+txn_log_replayer::Replay(
+    const vector<string> &logfiles,
+    const string &checkpoint_dir,
+    const map<string, table_handler *> &tables,
+    size_t nthreads,
+    bool compressed,
+    bool verbose)
+{
+  ALWAYS_ASSERT(nthreads > 0);
+  ALWAYS_ASSERT(!logfiles.empty() || !checkpoint_dir.empty());
+
+  replay_stats stats;
+
+  txn_checkpointer::manifest ckp;
+  const bool has_ckp =
+    !checkpoint_dir.empty() &&
+    txn_checkpointer::ReadManifest(checkpoint_dir, ckp);
+  if (has_ckp)
+    stats.checkpoint_epoch_ = ckp.epoch_;
+  else if (!checkpoint_dir.empty() && verbose)
+    cerr << "[WARNING] no checkpoint found in " << checkpoint_dir << endl;
+  // the deltas' rows merge like any others, so their files are just more
+  // work
+  txn_checkpointer::file_list ckp_files(ckp.files_);
+  for (auto &d : ckp.deltas_)
+    ckp_files.insert(ckp_files.end(), d.begin(), d.end());
+  atomic<size_t> next_ckp_file(0);
+
+  // an image checkpoint is loaded up front, and stays mapped so phase (3)
+  // can look up the rows the log changed
+  const bool has_image = has_ckp && ckp.image_;
+  unordered_map<uint32_t, unique_ptr<txn_checkpointer::table_image>> images;
+
+  const uint32_t ttl_meta_id = txn_logger::TableIdFromName(txn_ttl::MetaTableName);
+  mutex expiries_lock;
+  unordered_map<uint32_t, table_expiry> expiries;
+
+  unordered_map<uint32_t, table_handler *> tables_by_id;
+  for (auto &p : tables) {
+    const uint32_t id = txn_logger::TableIdFromName(p.first);
+    ALWAYS_ASSERT(!tables_by_id.count(id)); // name collision
+    tables_by_id[id] = p.second;
+  }
+
+  if (has_image) {
+    for (auto &f : ckp.files_) {
+      auto hit = tables_by_id.find(f.first);
+      if (hit == tables_by_id.end())
+        continue;
+      unique_ptr<txn_checkpointer::table_image> &img = images[f.first];
+      img.reset(new txn_checkpointer::table_image);
+      const string fname = checkpoint_dir + "/" + f.second;
+      if (!img->map(fname)) {
+        cerr << "[ERROR] corrupt checkpoint file " << fname << endl;
+        ALWAYS_ASSERT(false);
+      }
+      load_image(*img, hit->second, nthreads);
+      stats.ncheckpoint_rows_ += img->nrows();
+    }
+  }
+
+  // a logfile written with segmentation enabled is really the set of its
+  // segments. since replay goes by TID, the order of files does not matter
+  vector<mapped_file> files;
+  for (auto &fname : logfiles) {
+    const vector<string> segs = txn_logger::ListSegments(fname);
+    if (segs.empty() || access(fname.c_str(), F_OK) == 0)
+      files.push_back(map_file(fname));
+    for (auto &seg : segs)
+      files.push_back(map_file(seg));
+  }
+  for (auto &f : files)
+    stats.nbytes_ += f.sz_;
+
+  vector<vector<buffer_desc>> file_bufs(files.size());
+  vector<uint64_t> file_truncated(files.size(), 0);
+
+  // all buffers across all files, in work order for phase 2
+  vector<const buffer_desc *> work;
+  atomic<size_t> next_work(0);
+  vector< vector<partition_map> > partitions(nthreads); // [thread][partition]
+  vector<replay_stats> thread_stats(nthreads);
+
+  spin_barrier b_scanned(nthreads), b_epoch(1), b_decoded(nthreads),
+               b_covered(nthreads);
+
+  // with no persistent epoch file, some core may not have completed any
+  // epoch (not even epoch 0), in which case nothing is persistent
+  bool none_persistent = false;
+
+  auto body = [&](size_t id) {
+    replay_stats &ts = thread_stats[id];
+
+    // phase 1
+    for (size_t i = id; i < files.size(); i += nthreads)
+      file_truncated[i] = !scan_file(files[i], compressed, file_bufs[i]);
+    b_scanned.count_down();
+
+    // the calling thread computes the persistent epoch in between
+    b_epoch.wait_for();
+
+    // phase 2
+    const uint64_t pepoch = stats.persistent_epoch_;
+    const uint64_t ptid = stats.persistent_tid_;
+    vector<partition_map> &mine = partitions[id];
+    mine.resize(nthreads);
+    vector<uint8_t> scratch;
+    auto lookup = [&](uint32_t table_id, const uint8_t *k, uint32_t klen)
+        -> versioned_value & {
+      table_key tk(table_id, string((const char *) k, klen));
+      partition_map &pm = mine[table_key_hash()(tk) % nthreads];
+      return pm[move(tk)];
+    };
+    // the txns of a buffer past the persistent epoch are only durable up to
+    // the persistent tid
+    uint64_t upto_tid = numeric_limits<uint64_t>::max();
+    auto apply = [&](uint64_t tid, uint32_t table_id,
+                     const uint8_t *k, uint32_t klen,
+                     const uint8_t *v, uint32_t vlen) {
+      if (unlikely(tid > upto_tid))
+        return;
+      ts.nwrites_++;
+      if (unlikely(table_id == ttl_meta_id)) {
+        txn_ttl::deleted_range r;
+        bool is_range;
+        if (!txn_ttl::DecodeRecord(v, vlen, r, is_range))
+          return;
+        std::lock_guard<mutex> l(expiries_lock);
+        table_expiry &x = expiries[
+          txn_logger::TableIdFromName(string((const char *) k, klen))];
+        if (is_range)
+          x.ranges_.push_back(move(r));
+        else
+          x.cutoff_ = max(x.cutoff_, r.tid_);
+        return;
+      }
+      auto hit = tables_by_id.find(table_id);
+      if (unlikely(hit == tables_by_id.end())) {
+        ts.nwrites_unknown_++;
+        return;
+      }
+      const table_handler * const h = hit->second;
+      versioned_value &vv = lookup(table_id, k, klen);
+      if (!vv.base_older_than(tid))
+        return;
+      if (vlen && h->is_delta(v, vlen)) {
+        vv.deltas_.emplace_back(tid, string((const char *) v, vlen));
+        return;
+      }
+      vv.has_base_ = true;
+      vv.tid_ = tid;
+      vv.drop_deltas_upto(tid);
+      if (vlen)
+        h->to_record(v, vlen, vv.value_);
+      else
+        vv.value_.clear();
+    };
+
+    // rows in a checkpoint are versioned by the snapshot tid they were read
+    // at (rows of a delta by their own), so they merge with the log like any
+    // other (full) write, or delete
+    struct ckp_callback : public txn_checkpointer::row_callback {
+      ckp_callback(decltype(lookup) &lookup, uint32_t table_id)
+        : lookup_(&lookup), table_id_(table_id), nrows_(0) {}
+      virtual void
+      invoke(uint64_t tid,
+             const uint8_t *k, size_t klen,
+             const uint8_t *v, size_t vlen)
+      {
+        versioned_value &vv = (*lookup_)(table_id_, k, klen);
+        if (vv.base_older_than(tid)) {
+          vv.has_base_ = true;
+          vv.tid_ = tid;
+          vv.drop_deltas_upto(tid);
+          vv.value_.assign((const char *) v, vlen);
+        }
+        nrows_++;
+      }
+      decltype(lookup) *lookup_;
+      uint32_t table_id_;
+      uint64_t nrows_;
+    };
+    if (has_ckp && !has_image) {
+      for (;;) {
+        const size_t i = next_ckp_file.fetch_add(1, memory_order_acq_rel);
+        if (i >= ckp_files.size())
+          break;
+        if (!tables_by_id.count(ckp_files[i].first))
+          continue;
+        ckp_callback c(lookup, ckp_files[i].first);
+        const string fname = checkpoint_dir + "/" + ckp_files[i].second;
+        if (!txn_checkpointer::VisitFile(fname, c)) {
+          cerr << "[ERROR] corrupt checkpoint file " << fname << endl;
+          ALWAYS_ASSERT(false);
+        }
+        ts.ncheckpoint_rows_ += c.nrows_;
+      }
+    }
+
+    for (;;) {
+      const size_t i = next_work.fetch_add(1, memory_order_acq_rel);
+      if (i >= work.size())
+        break;
+      const buffer_desc *d = work[i];
+      if (none_persistent ||
+          (d->epoch_ > pepoch &&
+           (!ptid || d->epoch_ > transaction_proto2_static::EpochId(ptid)))) {
+        ts.nbuffers_skipped_++;
+        continue;
+      }
+      if (has_ckp && d->epoch_ <= ckp.epoch_) {
+        // already reflected in the checkpoint
+        ts.nbuffers_checkpointed_++;
+        continue;
+      }
+      upto_tid = d->epoch_ > pepoch ? ptid : numeric_limits<uint64_t>::max();
+      const uint8_t *ret UNUSED =
+        decode_buffer(d->data_, d->data_ + d->len_, d->nentries_,
+                      compressed, d->compact_, scratch, apply);
+      INVARIANT(ret == d->data_ + d->len_);
+      ts.ntxns_ += d->nentries_;
+    }
+    b_decoded.count_down();
+    b_decoded.wait_for();
+
+    // the log has nothing on rows only an image holds, so those a range
+    // delete covers are brought in here, to be removed in phase 3
+    if (has_image) {
+      for (auto &x : expiries) {
+        auto iit = images.find(x.first);
+        if (x.second.ranges_.empty() || iit == images.end())
+          continue;
+        const uint64_t n = iit->second->nrows();
+        iit->second->visit(n * id / nthreads, n * (id + 1) / nthreads,
+            [&](uint64_t i, const txn_checkpointer::table_image::row &r) {
+              for (auto &dr : x.second.ranges_)
+                if (r.tid_ <= dr.tid_ &&
+                    dr.contains((const char *) r.k_, r.klen_)) {
+                  lookup(x.first, r.k_, r.klen_);
+                  break;
+                }
+            });
+      }
+      b_covered.count_down();
+      b_covered.wait_for();
+    }
+
+    // phase 3: thread id owns partition id
+    partition_map &merged = mine[id];
+    for (size_t t = 0; t < nthreads; t++) {
+      if (t == id)
+        continue;
+      for (auto &p : partitions[t][id]) {
+        auto it = merged.find(p.first);
+        if (it == merged.end())
+          merged.emplace(p.first, move(p.second));
+        else
+          it->second.merge(move(p.second));
+      }
+      partition_map().swap(partitions[t][id]);
+    }
+
+    // a key in the image is already loaded, and its row merges with the
+    // log like a checkpoint row would have in phase 2. returns true if the
+    // row is the key's base record
+    auto image_base = [&](const table_key &tk, versioned_value &vv) -> bool {
+      auto iit = images.find(tk.first);
+      txn_checkpointer::table_image::row r;
+      if (iit == images.end() ||
+          !iit->second->find((const uint8_t *) tk.second.data(),
+                             tk.second.size(), r))
+        return false;
+      vv.loaded_ = true;
+      if (!vv.base_older_than(r.tid_))
+        return false;
+      vv.has_base_ = true;
+      vv.tid_ = r.tid_;
+      vv.drop_deltas_upto(r.tid_);
+      vv.value_.assign((const char *) r.v_, r.vlen_);
+      return true;
+    };
+
+    // fold deltas onto their base records. only deltas logged at or after
+    // the base was written apply (deltas of the same txn as the base which
+    // came before it were already dropped in phase 2, since a txn is
+    // decoded by a single thread)
+    for (auto it = merged.begin(); it != merged.end();) {
+      versioned_value &vv = it->second;
+      const bool from_image = has_image && image_base(it->first, vv);
+      size_t napplied = 0;
+      if (!vv.deltas_.empty()) {
+        stable_sort(vv.deltas_.begin(), vv.deltas_.end(),
+            [](const delta_entry &a, const delta_entry &b) {
+              return a.first < b.first;
+            });
+        const table_handler * const h = tables_by_id.at(it->first.first);
+        for (auto &d : vv.deltas_) {
+          if (vv.has_base_ && d.first < vv.tid_)
+            continue;
+          if (unlikely(!vv.has_base_ || vv.value_.empty() ||
+                       !h->apply_delta(
+                         vv.value_, (const uint8_t *) d.second.data(),
+                         d.second.size()))) {
+            // the record was created before the log (and checkpoint) begins
+            vv.has_base_ = false;
+            break;
+          }
+          ts.ndeltas_++;
+          napplied++;
+        }
+        vector<delta_entry>().swap(vv.deltas_);
+        if (!vv.has_base_) {
+          ts.ndeltas_orphaned_++;
+          it = merged.erase(it);
+          continue;
+        }
+      }
+      auto xit = expiries.find(it->first.first);
+      const bool expired = xit != expiries.end() &&
+                           !vv.value_.empty() &&
+                           xit->second.expires(it->first.second.data(),
+                                               it->first.second.size(),
+                                               vv.tid_);
+      if (expired) {
+        vv.value_.clear();
+        ts.nkeys_expired_++;
+      }
+      if (from_image && !napplied && !expired) {
+        // the log has nothing newer than what was loaded
+        it = merged.erase(it);
+        continue;
+      }
+      ++it;
+    }
+
+    txn_epoch_sync<transaction_proto2>::thread_init(true);
+    auto it = merged.begin();
+    while (it != merged.end()) {
+      auto batch_begin = it;
+      for (;;) {
+        replay_traits::StringAllocator sa;
+        replay_txn_type t(0, sa);
+        try {
+          size_t n = 0, nremoved = 0;
+          for (it = batch_begin; it != merged.end() && n < InstallBatchSize; ++it) {
+            table_handler * const h = tables_by_id.at(it->first.first);
+            // removals only need to be installed for keys which were loaded,
+            // the table being empty otherwise
+            if (it->second.value_.empty()) {
+              if (it->second.loaded_) {
+                h->remove(t, it->first.second);
+                nremoved++;
+                n++;
+              }
+              continue;
+            }
+            h->install(t, it->first.second, it->second.value_);
+            n++;
+          }
+          if (t.commit(false)) {
+            ts.nkeys_installed_ += n - nremoved;
+            ts.nkeys_removed_ += nremoved;
+            break;
+          }
+        } catch (transaction_abort_exception &ex) {
+        }
+      }
+    }
+    txn_epoch_sync<transaction_proto2>::thread_end();
+    partition_map().swap(merged);
+  };
+
+  vector<thread> thds;
+  for (size_t i = 0; i < nthreads; i++)
+    thds.emplace_back(body, i);
+
+  b_scanned.wait_for();
+  {
+    map<uint64_t, uint64_t> core_max_epochs;
+    for (size_t i = 0; i < files.size(); i++) {
+      stats.nfiles_truncated_ += file_truncated[i];
+      for (auto &d : file_bufs[i]) {
+        work.push_back(&d);
+        uint64_t &e = core_max_epochs[d.core_];
+        e = max(e, d.epoch_);
+      }
+    }
+    stats.nbuffers_ = work.size();
+    uint64_t pepoch = 0, ptid = 0;
+    bool found = false;
+    for (auto &fname : logfiles)
+      if ((found = ReadPersistentEpoch(fname, pepoch, &ptid)))
+        break;
+    if (!found) {
+      // epoch e is only complete for a core once we see one of its buffers
+      // from an epoch > e, so a core only seen in epoch 0 has none complete
+      pepoch = numeric_limits<uint64_t>::max();
+      for (auto &p : core_max_epochs) {
+        if (!p.second)
+          none_persistent = true;
+        else
+          pepoch = min(pepoch, p.second - 1);
+      }
+      if (core_max_epochs.empty() || none_persistent)
+        pepoch = 0;
+      if (verbose) {
+        if (none_persistent)
+          cerr << "[WARNING] no persistent epoch found, and none is complete"
+               << endl;
+        else
+          cerr << "[WARNING] no persistent epoch found, using epoch "
+               << pepoch << endl;
+      }
+    }
+    stats.persistent_epoch_ = pepoch;
+    stats.persistent_tid_ = ptid;
+  }
+  b_epoch.count_down();
+
+  for (auto &t : thds)
+    t.join();
+
+  for (auto &ts : thread_stats) {
+    stats.nbuffers_skipped_ += ts.nbuffers_skipped_;
+    stats.nbuffers_checkpointed_ += ts.nbuffers_checkpointed_;
+    stats.ncheckpoint_rows_ += ts.ncheckpoint_rows_;
+    stats.ntxns_ += ts.ntxns_;
+    stats.nwrites_ += ts.nwrites_;
+    stats.nwrites_unknown_ += ts.nwrites_unknown_;
+    stats.nkeys_installed_ += ts.nkeys_installed_;
+    stats.nkeys_removed_ += ts.nkeys_removed_;
+    stats.nkeys_expired_ += ts.nkeys_expired_;
+    stats.ndeltas_ += ts.ndeltas_;
+    stats.ndeltas_orphaned_ += ts.ndeltas_orphaned_;
+  }
+  evt_log_replay_txns += stats.ntxns_;
+  evt_log_replay_writes += stats.nwrites_;
+  evt_log_replay_deltas += stats.ndeltas_;
+
+  for (auto &f : files)
+    if (f.p_)
+      munmap((void *) f.p_, f.sz_);
+
+  if (verbose)
+    cerr << "[log replay] " << stats << endl;
+  return stats;
+}
+
+static event_counter evt_log_follow_epochs("log_follow_epochs");
+static event_counter evt_log_follow_writes("log_follow_writes");
+static event_counter evt_log_follow_deltas_orphaned("log_follow_deltas_orphaned");
+
+txn_log_follower::txn_log_follower(
+    const vector<string> &logfiles,
+    const map<string, txn_log_replayer::table_handler *> &tables,
+    bool compressed,
+    uint64_t from_epoch,
+    uint64_t poll_us)
+  : logfiles_(logfiles), compressed_(compressed),
+    poll_us_(poll_us), offsets_(logfiles.size(), 0), read_tid_(0),
+    running_(true), applied_epoch_(from_epoch)
+{
+  ALWAYS_ASSERT(!logfiles.empty());
+  for (auto &p : tables) {
+    const uint32_t id = txn_logger::TableIdFromName(p.first);
+    ALWAYS_ASSERT(!tables_by_id_.count(id)); // name collision
+    tables_by_id_[id] = p.second;
+  }
+  advance_read_tid();
+  thd_ = thread(&txn_log_follower::loop, this);
+}
+
+txn_log_follower::~txn_log_follower()
+{
+  running_.store(false, memory_order_release);
+  thd_.join();
+  transaction_proto2_static::SetStandbyReadTid(0);
+  ticker::WaitOutCurrentTick();
+  transaction_proto2_static::UnpinSnapshot(read_tid_);
+}
+
+void
+txn_log_follower::wait_for_epoch(uint64_t epoch)
+{
+  unique_lock<mutex> l(lock_);
+  cv_.wait(l, [this, epoch]() { return applied_epoch() >= epoch; });
+}
+
+void
+txn_log_follower::loop()
+{
+  txn_epoch_sync<transaction_proto2>::thread_init(true);
+  while (running_.load(memory_order_acquire)) {
+    // the buffers of the persistent epoch are in the logfiles by the time
+    // it is written out
+    uint64_t pepoch = 0;
+    for (auto &fname : logfiles_)
+      if (txn_log_replayer::ReadPersistentEpoch(fname, pepoch))
+        break;
+    if (pepoch <= applied_epoch()) {
+      this_thread::sleep_for(chrono::microseconds(poll_us_));
+      continue;
+    }
+    read_new_buffers();
+    apply_upto(pepoch);
+    advance_read_tid();
+    {
+      std::lock_guard<mutex> l(lock_);
+      applied_epoch_.store(pepoch, memory_order_release);
+    }
+    cv_.notify_all();
+    ++evt_log_follow_epochs;
+  }
+  txn_epoch_sync<transaction_proto2>::thread_end();
+}
+
+void
+txn_log_follower::read_new_buffers()
+{
+  vector<uint8_t> buf, scratch;
+  noop_visitor v;
+  for (size_t i = 0; i < logfiles_.size(); i++) {
+    const int fd = open(logfiles_[i].c_str(), O_RDONLY);
+    if (fd == -1)
+      // the logger's stream has not connected yet
+      continue;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      perror("fstat");
+      ALWAYS_ASSERT(false);
+    }
+    uint64_t &off = offsets_[i];
+    ALWAYS_ASSERT(uint64_t(st.st_size) >= off); // see txn_log_follower
+    buf.resize(st.st_size - off);
+    size_t n = 0;
+    while (n < buf.size()) {
+      const ssize_t ret = pread(fd, &buf[n], buf.size() - n, off + n);
+      if (ret <= 0)
+        break;
+      n += ret;
+    }
+    close(fd);
+
+    // stops at the first buffer not yet entirely written
+    const uint8_t *p = buf.data();
+    const uint8_t * const end = p + n;
+    while (size_t(end - p) >= sizeof(txn_logger::logbuf_header)) {
+      txn_logger::logbuf_header hdr;
+      NDB_MEMCPY(&hdr, p, sizeof(hdr));
+      if (!hdr.nentries_)
+        break;
+      const uint8_t * const data = p + sizeof(hdr);
+      const uint8_t * const next =
+        decode_buffer(data, end, txn_logger::BufferNEntries(hdr), compressed_,
+                      txn_logger::IsCompactBuffer(hdr), scratch, v);
+      if (!next ||
+          (hdr.crc_ &&
+           hdr.crc_ != txn_logger::BufferChecksum(hdr, data, next - data)))
+        break;
+      const uint64_t epoch = transaction_proto2_static::EpochId(hdr.last_tid_);
+      if (epoch > applied_epoch()) {
+        pending_.emplace_back();
+        pending_buffer &b = pending_.back();
+        b.epoch_ = epoch;
+        b.nentries_ = txn_logger::BufferNEntries(hdr);
+        b.compact_ = txn_logger::IsCompactBuffer(hdr);
+        b.data_.assign(data, next);
+      }
+      p = next;
+    }
+    off += p - buf.data();
+  }
+}
+
+void
+txn_log_follower::apply_upto(uint64_t epoch)
+{
+  typedef txn_log_replayer::table_handler table_handler;
+
+  // the newest write to each key, and the deltas after it
+  unordered_map<table_key, versioned_value, table_key_hash> writes;
+  auto visit = [&](uint64_t tid, uint32_t table_id,
+                   const uint8_t *k, uint32_t klen,
+                   const uint8_t *v, uint32_t vlen) {
+    auto hit = tables_by_id_.find(table_id);
+    if (hit == tables_by_id_.end())
+      return;
+    ++evt_log_follow_writes;
+    const table_handler * const h = hit->second;
+    versioned_value &vv =
+      writes[table_key(table_id, string((const char *) k, klen))];
+    if (!vv.base_older_than(tid))
+      return;
+    if (vlen && h->is_delta(v, vlen)) {
+      vv.deltas_.emplace_back(tid, string((const char *) v, vlen));
+      return;
+    }
+    vv.has_base_ = true;
+    vv.tid_ = tid;
+    vv.drop_deltas_upto(tid);
+    if (vlen)
+      h->to_record(v, vlen, vv.value_);
+    else
+      vv.value_.clear();
+  };
+  vector<uint8_t> scratch;
+  for (auto &b : pending_) {
+    if (b.epoch_ > epoch)
+      continue;
+    const uint8_t *ret UNUSED =
+      decode_buffer(b.data_.data(), b.data_.data() + b.data_.size(),
+                    b.nentries_, compressed_, b.compact_, scratch, visit);
+    INVARIANT(ret == b.data_.data() + b.data_.size());
+  }
+  pending_.erase(
+      remove_if(pending_.begin(), pending_.end(),
+        [epoch](const pending_buffer &b) { return b.epoch_ <= epoch; }),
+      pending_.end());
+  for (auto &p : writes)
+    stable_sort(p.second.deltas_.begin(), p.second.deltas_.end(),
+        [](const delta_entry &a, const delta_entry &b) {
+          return a.first < b.first;
+        });
+
+  auto it = writes.begin();
+  while (it != writes.end()) {
+    auto batch_begin = it;
+    for (;;) {
+      txn_log_replayer::replay_traits::StringAllocator sa;
+      txn_log_replayer::replay_txn_type t(0, sa);
+      try {
+        size_t n = 0, norphaned = 0;
+        string record;
+        for (it = batch_begin; it != writes.end() && n < InstallBatchSize;
+             ++it, n++) {
+          table_handler * const h = tables_by_id_.at(it->first.first);
+          const versioned_value &vv = it->second;
+          bool exists;
+          if (vv.has_base_) {
+            record = vv.value_;
+            exists = !record.empty();
+          } else {
+            exists = h->read(t, it->first.second, record);
+          }
+          bool orphaned = false;
+          for (auto &d : vv.deltas_) {
+            if (vv.has_base_ && d.first < vv.tid_)
+              continue;
+            if (unlikely(!exists ||
+                         !h->apply_delta(
+                           record, (const uint8_t *) d.second.data(),
+                           d.second.size()))) {
+              orphaned = true;
+              break;
+            }
+          }
+          if (unlikely(orphaned)) {
+            norphaned++;
+            continue;
+          }
+          if (exists)
+            h->install(t, it->first.second, record);
+          else if (vv.has_base_)
+            h->remove(t, it->first.second);
+        }
+        if (t.commit(false)) {
+          evt_log_follow_deltas_orphaned += norphaned;
+          break;
+        }
+      } catch (transaction_abort_exception &ex) {
+      }
+    }
+  }
+}
+
+void
+txn_log_follower::advance_read_tid()
+{
+  // what was installed committed by the current tick, so the first read
+  // only snapshot past it has all of it
+  const uint64_t tick = ticker::s_instance.global_current_tick();
+  uint64_t tid = 0;
+  while (!tid) {
+    {
+      // like a read-only txn taking its snapshot, so GC leaves it be
+      scoped_rcu_region guard;
+      const uint64_t ro_tid = transaction_proto2_static::ComputeReadOnlyTid(
+          ticker::s_instance.global_last_tick_exclusive());
+      if (ro_tid && transaction_proto2_static::EpochId(ro_tid) >= tick) {
+        transaction_proto2_static::PinSnapshot(ro_tid);
+        tid = ro_tid;
+      }
+    }
+    if (!tid)
+      this_thread::sleep_for(chrono::microseconds(ticker::TickUsec()));
+  }
+  transaction_proto2_static::SetStandbyReadTid(tid);
+  const uint64_t old = read_tid_;
+  read_tid_ = tid;
+  if (!old)
+    return;
+  // the read-only txns still reading at the old snapshot are over
+  ticker::WaitOutCurrentTick();
+  transaction_proto2_static::UnpinSnapshot(old);
+}
@@ -0,0 +1,443 @@
+#ifndef _NDB_TXN_RECOVERY_H_
+#define _NDB_TXN_RECOVERY_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <map>
+
+#include "txn_proto2_impl.h"
+#include "typed_txn_btree.h"
+
+/**
+ * Rebuilds txn_btrees from the log files written by txn_logger.
+ *
+ * Replay happens in three phases, each of which runs on all threads:
+ *   (1) every log file is scanned (one thread per file) to find the
+ *       boundaries, epoch, and core of each log buffer it contains. a file
+ *       is cut off at its first incomplete buffer, or the first whose
+ *       checksum (see txn_logger::BufferChecksum()) does not match
+ *   (2) the buffers in epochs <= the last persistent epoch (and the txns
+ *       <= the persistent tid in later buffers, see below) are decoded,
+ *       keeping only the highest TID write to each key. keys are hash
+ *       partitioned, so each partition is owned by exactly one thread
+ *   (3) each thread merges its partition and installs the surviving values
+ *       into the tables using regular transactions
+ *
+ * The last persistent epoch is read from the file the logger maintains next
+ * to the first log file (see txn_logger::g_pepoch_suffix). If that file is
+ * missing, we conservatively use the minimum over all cores of the last
+ * epoch each core completed in the log. With group commit, the file also
+ * holds the persistent tid: every txn with a TID up to it is durable, even
+ * past the persistent epoch, and so is replayed too.
+ *
+ * Each log file may also have been written as a set of segments (see
+ * txn_logger::SegmentFileName()), all of which are replayed.
+ *
+ * Compression cannot be told from the log itself, so Replay() has to be told
+ * about it. The compact encoding of txns (see txn_logger::txn_encoder) is
+ * marked in each buffer's header (see txn_logger::CompactBufferBit).
+ *
+ * If a checkpoint directory is given, the last complete checkpoint in it
+ * (see txn_checkpointer) is loaded in phase (2) as well, and only log buffers
+ * in epochs after the checkpoint's epoch are replayed on top of it. An image
+ * checkpoint is instead mapped and bulk loaded into the tables before phase
+ * (1), by all threads, and phase (3) only installs the keys the log changed
+ * since: each is looked up in the image, which then acts as its base record.
+ *
+ * The tables must be empty, and created under the same names they had when
+ * the log was written (see txn_logger::TableIdFromName()). How a table's
+ * logged values turn into records is up to its table_handler: txn_btree logs
+ * entire values, while typed_txn_btree logs [fields mask] followed by only
+ * the fields a write changed, and such deltas are applied in TID order on top
+ * of the last full record of their key.
+ *
+ * Writes to the txn_ttl::MetaTableName table are expiry records, and the
+ * keys of a table at or below its highest logged cutoff, or covered by one
+ * of its logged range deletes, are dropped (rows which only an image holds
+ * are left to be expired again by TTL, but not by range deletes).
+ *
+ * If persistence is enabled when Replay() runs, the installing transactions
+ * are themselves logged, so the new log files become self-contained. Do not
+ * replay from the log files the running logger is writing into.
+ */
+class txn_log_replayer {
+public:
+  typedef txn_btree<transaction_proto2> table_type;
+
+  struct replay_traits : public default_stable_transaction_traits {};
+  typedef transaction_proto2<replay_traits> replay_txn_type;
+
+  // decodes and installs the writes to one table
+  class table_handler {
+  public:
+    virtual ~table_handler() {}
+
+    // true if the (non-empty) logged value v only holds part of a record,
+    // and so must be applied to the previous record of its key
+    virtual bool
+    is_delta(const uint8_t *v, size_t vlen) const
+    {
+      return false;
+    }
+
+    // the record a non-delta (non-empty) logged value stands for
+    virtual void
+    to_record(const uint8_t *v, size_t vlen, std::string &record) const
+    {
+      record.assign((const char *) v, vlen);
+    }
+
+    // returns false if the delta could not be applied
+    virtual bool
+    apply_delta(std::string &record, const uint8_t *v, size_t vlen) const
+    {
+      return false;
+    }
+
+    virtual void install(replay_txn_type &t,
+                         const std::string &key,
+                         const std::string &record) = 0;
+
+    // removes a key loaded by bulk_load()
+    virtual void remove(replay_txn_type &t, const std::string &key) = 0;
+
+    // the record at key, which deltas apply to when the log has no write of
+    // its own under them (see txn_log_follower). returns false if none
+    virtual bool read(replay_txn_type &t, const std::string &key,
+                      std::string &record) = 0;
+
+    // fills the (empty) table with keys[i] => the stored records values[i],
+    // i in [0, n), the keys being sorted (see
+    // base_txn_btree::bulk_load_records())
+    virtual void bulk_load(const varkey *keys, const uint8_t *const *values,
+                           const size_t *sizes, size_t n, size_t nthreads) = 0;
+  };
+
+  class string_table_handler : public table_handler {
+  public:
+    string_table_handler(table_type *btr) : btr_(btr) {}
+    virtual void
+    install(replay_txn_type &t, const std::string &key,
+            const std::string &record)
+    {
+      btr_->insert(t, key, record);
+    }
+    virtual void
+    remove(replay_txn_type &t, const std::string &key)
+    {
+      btr_->remove(t, key);
+    }
+    virtual bool
+    read(replay_txn_type &t, const std::string &key, std::string &record)
+    {
+      return btr_->search(t, key, record);
+    }
+    virtual void
+    bulk_load(const varkey *keys, const uint8_t *const *values,
+              const size_t *sizes, size_t n, size_t nthreads)
+    {
+      btr_->bulk_load_records(keys, values, sizes, n, nthreads);
+    }
+  private:
+    table_type *btr_;
+  };
+
+  template <typename Schema>
+  class typed_table_handler : public table_handler {
+  public:
+    typedef typed_txn_btree<transaction_proto2, Schema> btree_type;
+
+    typed_table_handler(btree_type *btr) : btr_(btr) {}
+
+    virtual bool is_delta(const uint8_t *v, size_t vlen) const;
+    virtual void to_record(const uint8_t *v, size_t vlen,
+                           std::string &record) const;
+    virtual bool apply_delta(std::string &record,
+                             const uint8_t *v, size_t vlen) const;
+    virtual void install(replay_txn_type &t, const std::string &key,
+                         const std::string &record);
+    virtual void remove(replay_txn_type &t, const std::string &key);
+    virtual bool read(replay_txn_type &t, const std::string &key,
+                      std::string &record);
+    virtual void
+    bulk_load(const varkey *keys, const uint8_t *const *values,
+              const size_t *sizes, size_t n, size_t nthreads)
+    {
+      btr_->bulk_load_records(keys, values, sizes, n, nthreads);
+    }
+  private:
+    typedef typed_txn_btree_<Schema> typed_type;
+    typedef typename Schema::key_type key_type;
+    typedef typename Schema::value_type value_type;
+    typedef typename Schema::value_descriptor_type value_descriptor_type;
+    typedef typename Schema::key_encoder_type key_encoder_type;
+    typedef typename Schema::value_encoder_type value_encoder_type;
+
+    btree_type *btr_;
+  };
+
+  struct replay_stats {
+    uint64_t persistent_epoch_;
+    uint64_t persistent_tid_;    // txns past the persistent epoch up to it
+                                 // are durable too (with group commit)
+    uint64_t nbytes_;            // # of bytes of log files scanned
+    uint64_t nbuffers_;          // # of buffers found in the log
+    uint64_t nbuffers_skipped_;  // # of buffers beyond the persistent epoch
+    uint64_t ntxns_;             // # of txns replayed
+    uint64_t nwrites_;           // # of writes replayed
+    uint64_t nwrites_unknown_;   // # of writes to tables not given to Replay()
+    uint64_t nkeys_installed_;   // # of keys which survived and were installed
+    uint64_t nfiles_truncated_;  // # of files which ended in a partial (or
+                                 // corrupt) buffer
+    uint64_t checkpoint_epoch_;
+    uint64_t nbuffers_checkpointed_; // # of buffers covered by the checkpoint
+    uint64_t ncheckpoint_rows_;
+    uint64_t nkeys_removed_;     // # of image rows removed by the log
+    uint64_t nkeys_expired_;     // # of keys dropped by expiry records
+    uint64_t ndeltas_;           // # of field deltas applied to records
+    uint64_t ndeltas_orphaned_;  // # of keys dropped for lack of a base record
+
+    replay_stats()
+      : persistent_epoch_(0), persistent_tid_(0),
+        nbytes_(0), nbuffers_(0), nbuffers_skipped_(0),
+        ntxns_(0), nwrites_(0), nwrites_unknown_(0),
+        nkeys_installed_(0), nfiles_truncated_(0),
+        checkpoint_epoch_(0), nbuffers_checkpointed_(0),
+        ncheckpoint_rows_(0), nkeys_removed_(0), nkeys_expired_(0),
+        ndeltas_(0), ndeltas_orphaned_(0) {}
+  };
+
+  // not thread-safe, and should only be called once the tables are
+  // constructed (but before any other txns execute against them)
+  static replay_stats
+  Replay(const std::vector<std::string> &logfiles,
+         const std::string &checkpoint_dir, // empty for none
+         const std::map<std::string, table_type *> &tables,
+         size_t nthreads,
+         bool compressed,
+         bool verbose = false);
+
+  // same as above, for tables of any kind
+  static replay_stats
+  Replay(const std::vector<std::string> &logfiles,
+         const std::string &checkpoint_dir, // empty for none
+         const std::map<std::string, table_handler *> &tables,
+         size_t nthreads,
+         bool compressed,
+         bool verbose = false);
+
+  // reads the persistent epoch written by the logger for logfile, and the
+  // persistent tid into tid (0 if none was written), returns false if none
+  // exists
+  static bool
+  ReadPersistentEpoch(const std::string &logfile, uint64_t &epoch,
+                      uint64_t *tid = nullptr);
+};
+
+/**
+ * Applies the log a hot standby receives (see txn_log_receiver) to its
+ * tables as it becomes persistent, so the standby serves read-only txns
+ * while the primary runs.
+ *
+ * Every poll_us, the follower reads what the logfiles grew by, and applies
+ * the buffers of the epochs up to the new persistent epoch with txns of its
+ * own: the newest write to each key, and the field deltas after it (on top
+ * of the record in the table if the log has no write under them). Once they
+ * have committed, it pins the first read only snapshot past them, and makes
+ * read-only txns read at it (see
+ * transaction_proto2_static::SetStandbyReadTid()), so they see the primary
+ * as of an epoch, never part way through one. So the standby's reads lag
+ * the primary by about a read only epoch.
+ *
+ * The tables must be empty, or recovered up to from_epoch (see
+ * txn_log_replayer::Replay()). Only read-only txns may run on them besides
+ * the follower's. Expiry records (see txn_ttl) are not applied, and a
+ * primary must not reconnect (restarting the logfiles) while a follower
+ * runs: stop it, and recover anew, to fail over
+ */
+class txn_log_follower {
+public:
+  // blocks until read-only txns read at a snapshot of the tables as given
+  txn_log_follower(
+      const std::vector<std::string> &logfiles,
+      const std::map<std::string, txn_log_replayer::table_handler *> &tables,
+      bool compressed,
+      uint64_t from_epoch = 0,
+      uint64_t poll_us = 1000);
+
+  // stops applying, and lets read-only txns read the latest snapshot again
+  ~txn_log_follower();
+
+  txn_log_follower(const txn_log_follower &) = delete;
+  txn_log_follower(txn_log_follower &&) = delete;
+  txn_log_follower &operator=(const txn_log_follower &) = delete;
+
+  // the last epoch of the primary which read-only txns see
+  inline uint64_t
+  applied_epoch() const
+  {
+    return applied_epoch_.load(std::memory_order_acquire);
+  }
+
+  // blocks until read-only txns see epoch
+  void wait_for_epoch(uint64_t epoch);
+
+private:
+  struct pending_buffer {
+    uint64_t epoch_;
+    uint64_t nentries_;
+    bool compact_; // see txn_logger::IsCompactBuffer()
+    std::vector<uint8_t> data_; // just past the logbuf_header
+  };
+
+  void loop();
+
+  // reads the complete buffers the logfiles grew by into pending_
+  void read_new_buffers();
+
+  // installs the writes of the pending buffers in epochs <= epoch
+  void apply_upto(uint64_t epoch);
+
+  // makes read-only txns read past all that was installed so far
+  void advance_read_tid();
+
+  const std::vector<std::string> logfiles_;
+  std::unordered_map<uint32_t, txn_log_replayer::table_handler *> tables_by_id_;
+  const bool compressed_;
+  const uint64_t poll_us_;
+  std::vector<uint64_t> offsets_; // per logfile, past its last complete buffer
+  std::vector<pending_buffer> pending_;
+  uint64_t read_tid_; // pinned, 0 for none
+
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> applied_epoch_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::thread thd_;
+};
+
+static inline std::ostream &
+operator<<(std::ostream &o, const txn_log_replayer::replay_stats &s)
+{
+  o << "{persistent_epoch=" << s.persistent_epoch_
+    << ", persistent_tid=" << s.persistent_tid_
+    << ", nbytes=" << s.nbytes_
+    << ", nbuffers=" << s.nbuffers_
+    << ", nbuffers_skipped=" << s.nbuffers_skipped_
+    << ", ntxns=" << s.ntxns_
+    << ", nwrites=" << s.nwrites_
+    << ", nwrites_unknown=" << s.nwrites_unknown_
+    << ", nkeys_installed=" << s.nkeys_installed_
+    << ", nfiles_truncated=" << s.nfiles_truncated_
+    << ", checkpoint_epoch=" << s.checkpoint_epoch_
+    << ", nbuffers_checkpointed=" << s.nbuffers_checkpointed_
+    << ", ncheckpoint_rows=" << s.ncheckpoint_rows_
+    << ", nkeys_removed=" << s.nkeys_removed_
+    << ", nkeys_expired=" << s.nkeys_expired_
+    << ", ndeltas=" << s.ndeltas_
+    << ", ndeltas_orphaned=" << s.ndeltas_orphaned_ << "}";
+  return o;
+}
+
+// typed_txn_btree logs [fields mask (8 bytes)], followed by either the entire
+// encoded record (all fields) or each field in the mask, in field order. see
+// typed_txn_btree_::do_delta_write_standalone()
+
+template <typename Schema>
+bool
+txn_log_replayer::typed_table_handler<Schema>::is_delta(
+    const uint8_t *v, size_t vlen) const
+{
+  ALWAYS_ASSERT(vlen >= sizeof(uint64_t));
+  uint64_t fields;
+  NDB_MEMCPY(&fields, v, sizeof(fields));
+  return !typed_type::IsAllFields(fields);
+}
+
+template <typename Schema>
+void
+txn_log_replayer::typed_table_handler<Schema>::to_record(
+    const uint8_t *v, size_t vlen, std::string &record) const
+{
+  INVARIANT(!is_delta(v, vlen));
+  record.assign((const char *) v + sizeof(uint64_t), vlen - sizeof(uint64_t));
+}
+
+template <typename Schema>
+bool
+txn_log_replayer::typed_table_handler<Schema>::apply_delta(
+    std::string &record, const uint8_t *v, size_t vlen) const
+{
+  const value_encoder_type value_encoder;
+  value_type obj;
+  if (unlikely(!value_encoder.failsafe_read(
+          (const uint8_t *) record.data(), record.size(), &obj)))
+    return false;
+  uint64_t fields;
+  NDB_MEMCPY(&fields, v, sizeof(fields));
+  const uint8_t *p = v + sizeof(fields);
+  const uint8_t * const end = v + vlen;
+  for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+    if ((1UL << i) & fields) {
+      uint8_t * const px = reinterpret_cast<uint8_t *>(&obj) +
+        value_descriptor_type::cstruct_offsetof(i);
+      if (unlikely(!(p = value_descriptor_type::failsafe_read_fn(i)(
+              p, end - p, px))))
+        return false;
+    }
+  }
+  if (unlikely(p != end))
+    return false;
+  value_encoder.write(record, &obj);
+  return true;
+}
+
+template <typename Schema>
+void
+txn_log_replayer::typed_table_handler<Schema>::install(
+    replay_txn_type &t, const std::string &key, const std::string &record)
+{
+  const key_encoder_type key_encoder;
+  const value_encoder_type value_encoder;
+  key_type k;
+  value_type obj;
+  key_encoder.read(key, &k);
+  ALWAYS_ASSERT(value_encoder.failsafe_read(
+        (const uint8_t *) record.data(), record.size(), &obj));
+  btr_->insert(t, k, obj);
+}
+
+template <typename Schema>
+bool
+txn_log_replayer::typed_table_handler<Schema>::read(
+    replay_txn_type &t, const std::string &key, std::string &record)
+{
+  const key_encoder_type key_encoder;
+  const value_encoder_type value_encoder;
+  key_type k;
+  value_type obj;
+  key_encoder.read(key, &k);
+  if (!btr_->search(t, k, obj))
+    return false;
+  value_encoder.write(record, &obj);
+  return true;
+}
+
+template <typename Schema>
+void
+txn_log_replayer::typed_table_handler<Schema>::remove(
+    replay_txn_type &t, const std::string &key)
+{
+  const key_encoder_type key_encoder;
+  key_type k;
+  key_encoder.read(key, &k);
+  btr_->remove(t, k);
+}
+
+#endif /* _NDB_TXN_RECOVERY_H_ */
@@ -0,0 +1,461 @@
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "txn_replication.h"
+#include "txn_proto2_impl.h"
+#include "counter.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+static event_counter evt_log_shipped_bytes("log_shipped_bytes");
+static event_counter evt_log_received_bytes("log_received_bytes");
+static event_histogram hist_replication_wait_us("replication_wait_us");
+
+int
+txn_replication::Connect(const string &endpoint)
+{
+  const size_t pos = endpoint.rfind(':');
+  if (pos == string::npos) {
+    cerr << "[ERROR] bad standby endpoint " << endpoint
+         << ", expected host:port" << endl;
+    return -1;
+  }
+  const string host = endpoint.substr(0, pos);
+  const string port = endpoint.substr(pos + 1);
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  const int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+  if (ret) {
+    cerr << "[ERROR] getaddrinfo " << endpoint << ": " << gai_strerror(ret) << endl;
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo *p = res; p; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd == -1)
+      continue;
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd == -1) {
+    perror("connect");
+    return -1;
+  }
+  // messages are already batched by the loggers
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool
+txn_replication::SendAll(int fd, const struct iovec *iov, size_t n)
+{
+  vector<struct iovec> left(iov, iov + n);
+  size_t i = 0;
+  while (i < left.size()) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &left[i];
+    msg.msg_iovlen = min(left.size() - i, size_t(IOV_MAX));
+    // a standby going away should not kill the primary
+    ssize_t ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    for (; i < left.size() && size_t(ret) >= left[i].iov_len; i++)
+      ret -= left[i].iov_len;
+    if (i < left.size()) {
+      left[i].iov_base = (char *) left[i].iov_base + ret;
+      left[i].iov_len -= ret;
+    }
+  }
+  return true;
+}
+
+bool
+txn_replication::RecvAll(int fd, void *p, size_t n)
+{
+  char *px = (char *) p;
+  while (n) {
+    const ssize_t ret = recv(fd, px, n, 0);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    px += ret;
+    n -= ret;
+  }
+  return true;
+}
+
+txn_log_shipper::txn_log_shipper(
+    const vector<string> &standbys,
+    size_t quorum,
+    txn_replication::StreamKind kind,
+    uint32_t id)
+  : quorum_(quorum ? quorum : standbys.size()), seq_(0), completed_(0)
+{
+  ALWAYS_ASSERT(!standbys.empty());
+  ALWAYS_ASSERT(quorum_ <= standbys.size());
+  for (auto &s : standbys) {
+    const int fd = txn_replication::Connect(s);
+    if (fd == -1) {
+      cerr << "[ERROR] could not connect to standby " << s << endl;
+      ALWAYS_ASSERT(false);
+    }
+    txn_replication::hello h;
+    h.magic_ = txn_replication::Magic;
+    h.kind_ = kind;
+    h.id_ = id;
+    struct iovec iov = {&h, sizeof(h)};
+    ALWAYS_ASSERT(txn_replication::SendAll(fd, &iov, 1));
+    links_.push_back({s, fd, 0});
+  }
+}
+
+txn_log_shipper::~txn_log_shipper()
+{
+  for (auto &l : links_)
+    if (l.fd_ != -1)
+      close(l.fd_);
+}
+
+uint64_t
+txn_log_shipper::ship(const struct iovec *iov, size_t n, size_t nbytes)
+{
+  txn_replication::msg_header h;
+  h.seq_ = ++seq_;
+  h.arg_ = nbytes;
+  vector<struct iovec> iovs;
+  iovs.reserve(n + 1);
+  iovs.push_back({&h, sizeof(h)});
+  iovs.insert(iovs.end(), iov, iov + n);
+  for (auto &l : links_) {
+    if (l.fd_ == -1)
+      continue;
+    if (!txn_replication::SendAll(l.fd_, &iovs[0], iovs.size()))
+      lost(l);
+  }
+  evt_log_shipped_bytes += nbytes;
+  return seq_;
+}
+
+uint64_t
+txn_log_shipper::ship_epoch(uint64_t epoch, const vector<uint64_t> &seqs)
+{
+  txn_replication::msg_header h;
+  h.seq_ = ++seq_;
+  h.arg_ = epoch;
+  const uint64_t n = seqs.size();
+  struct iovec iovs[3] = {
+    {&h, sizeof(h)},
+    {(void *) &n, sizeof(n)},
+    {(void *) seqs.data(), n * sizeof(uint64_t)},
+  };
+  for (auto &l : links_) {
+    if (l.fd_ == -1)
+      continue;
+    if (!txn_replication::SendAll(l.fd_, &iovs[0], 3))
+      lost(l);
+  }
+  return seq_;
+}
+
+void
+txn_log_shipper::wait(uint64_t seq)
+{
+  const uint64_t start_us = timer::cur_usec();
+  vector<struct pollfd> pfds;
+  vector<link *> waiting;
+  for (;;) {
+    size_t nacked = 0;
+    pfds.clear();
+    waiting.clear();
+    for (auto &l : links_) {
+      if (l.fd_ == -1)
+        continue;
+      if (l.acked_ >= seq) {
+        nacked++;
+        continue;
+      }
+      pfds.push_back({l.fd_, POLLIN, 0});
+      waiting.push_back(&l);
+    }
+    if (nacked >= quorum_)
+      break;
+    if (poll(&pfds[0], pfds.size(), -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      ALWAYS_ASSERT(false);
+    }
+    for (size_t i = 0; i < pfds.size(); i++) {
+      if (!pfds[i].revents)
+        continue;
+      // acks arrive in order, and can be for older messages
+      uint64_t acked;
+      if (!txn_replication::RecvAll(pfds[i].fd, &acked, sizeof(acked)))
+        lost(*waiting[i]);
+      else
+        waiting[i]->acked_ = acked;
+    }
+  }
+  if (seq > completed_.load(memory_order_acquire))
+    completed_.store(seq, memory_order_release);
+  hist_replication_wait_us.offer(timer::cur_usec() - start_us);
+}
+
+void
+txn_log_shipper::lost(link &l)
+{
+  cerr << "[WARNING] lost standby " << l.endpoint_ << endl;
+  close(l.fd_);
+  l.fd_ = -1;
+  if (nalive() < quorum_) {
+    cerr << "[ERROR] lost the replication quorum (" << quorum_ << ")" << endl;
+    ALWAYS_ASSERT(false);
+  }
+}
+
+size_t
+txn_log_shipper::nalive() const
+{
+  size_t n = 0;
+  for (auto &l : links_)
+    if (l.fd_ != -1)
+      n++;
+  return n;
+}
+
+txn_log_receiver::txn_log_receiver(
+    uint16_t port,
+    const vector<string> &logfiles,
+    bool call_fsync)
+  : logfiles_(logfiles), call_fsync_(call_fsync), listen_fd_(-1),
+    running_(true), persistent_epoch_(0),
+    durable_seqs_(logfiles.size(), 0), nconnected_(0), nopen_(0)
+{
+  ALWAYS_ASSERT(!logfiles_.empty());
+  listen_fd_ = socket(AF_INET6, SOCK_STREAM, 0);
+  if (listen_fd_ == -1) {
+    perror("socket");
+    ALWAYS_ASSERT(false);
+  }
+  const int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (::bind(listen_fd_, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    perror("bind");
+    ALWAYS_ASSERT(false);
+  }
+  if (listen(listen_fd_, 64) == -1) {
+    perror("listen");
+    ALWAYS_ASSERT(false);
+  }
+  acceptor_ = thread(&txn_log_receiver::accept_loop, this);
+}
+
+txn_log_receiver::~txn_log_receiver()
+{
+  running_.store(false, memory_order_release);
+  // wakes up accept() and recv()
+  shutdown(listen_fd_, SHUT_RDWR);
+  acceptor_.join();
+  close(listen_fd_);
+  {
+    std::lock_guard<mutex> l(lock_);
+    for (auto fd : fds_)
+      shutdown(fd, SHUT_RDWR);
+    cv_.notify_all();
+  }
+  for (auto &t : servers_)
+    t.join();
+}
+
+void
+txn_log_receiver::wait_for_primary()
+{
+  unique_lock<mutex> l(lock_);
+  cv_.wait(l, [this]() { return nconnected_ && !nopen_; });
+}
+
+void
+txn_log_receiver::accept_loop()
+{
+  while (running_.load(memory_order_acquire)) {
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      // shut down
+      break;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::lock_guard<mutex> l(lock_);
+    if (!running_.load(memory_order_acquire)) {
+      close(fd);
+      break;
+    }
+    fds_.push_back(fd);
+    servers_.emplace_back(&txn_log_receiver::serve, this, fd);
+  }
+}
+
+void
+txn_log_receiver::serve(int fd)
+{
+  txn_replication::hello h;
+  if (txn_replication::RecvAll(fd, &h, sizeof(h)) &&
+      h.magic_ == txn_replication::Magic) {
+    {
+      std::lock_guard<mutex> l(lock_);
+      nconnected_++;
+      nopen_++;
+    }
+    if (h.kind_ == txn_replication::STREAM_LOG && h.id_ < logfiles_.size())
+      serve_log(fd, h.id_);
+    else if (h.kind_ == txn_replication::STREAM_EPOCH)
+      serve_epoch(fd);
+    else
+      cerr << "[WARNING] dropping unknown stream (kind=" << h.kind_
+           << ", id=" << h.id_ << ")" << endl;
+    std::lock_guard<mutex> l(lock_);
+    nopen_--;
+  } else {
+    cerr << "[WARNING] dropping connection without a valid hello" << endl;
+  }
+  std::lock_guard<mutex> l(lock_);
+  fds_.erase(find(fds_.begin(), fds_.end(), fd));
+  close(fd);
+  cv_.notify_all();
+}
+
+void
+txn_log_receiver::serve_log(int fd, uint32_t id)
+{
+  const int lfd = open(logfiles_[id].c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+  if (lfd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  {
+    std::lock_guard<mutex> l(lock_);
+    durable_seqs_[id] = 0;
+  }
+  vector<char> buf(1 << 20);
+  txn_replication::msg_header m;
+  while (txn_replication::RecvAll(fd, &m, sizeof(m))) {
+    for (uint64_t left = m.arg_; left; ) {
+      const size_t n = min(left, uint64_t(buf.size()));
+      if (!txn_replication::RecvAll(fd, &buf[0], n))
+        goto done;
+      for (size_t off = 0; off < n; ) {
+        const ssize_t ret = write(lfd, &buf[off], n - off);
+        if (unlikely(ret == -1)) {
+          perror("write");
+          ALWAYS_ASSERT(false);
+        }
+        off += ret;
+      }
+      left -= n;
+    }
+    if (call_fsync_ && unlikely(fdatasync(lfd) == -1)) {
+      perror("fdatasync");
+      ALWAYS_ASSERT(false);
+    }
+    evt_log_received_bytes += m.arg_;
+    {
+      std::lock_guard<mutex> l(lock_);
+      durable_seqs_[id] = m.seq_;
+      cv_.notify_all();
+    }
+    struct iovec iov = {&m.seq_, sizeof(m.seq_)};
+    if (!txn_replication::SendAll(fd, &iov, 1))
+      break;
+  }
+done:
+  // a partial batch at the end is ignored by recovery
+  close(lfd);
+}
+
+void
+txn_log_receiver::serve_epoch(int fd)
+{
+  const string fname = logfiles_[0] + txn_logger::g_pepoch_suffix;
+  const int pfd = open(fname.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0664);
+  if (pfd == -1) {
+    perror("open");
+    ALWAYS_ASSERT(false);
+  }
+  txn_replication::msg_header m;
+  vector<uint64_t> seqs;
+  while (txn_replication::RecvAll(fd, &m, sizeof(m))) {
+    uint64_t n;
+    if (!txn_replication::RecvAll(fd, &n, sizeof(n)))
+      break;
+    if (n > logfiles_.size()) {
+      cerr << "[ERROR] primary has " << n << " loggers, but only "
+           << logfiles_.size() << " logfiles were given" << endl;
+      ALWAYS_ASSERT(false);
+    }
+    seqs.resize(n);
+    if (n && !txn_replication::RecvAll(fd, &seqs[0], n * sizeof(uint64_t)))
+      break;
+    if (!wait_for_batches(seqs))
+      break;
+    const uint64_t epoch = m.arg_;
+    const ssize_t ret = pwrite(pfd, &epoch, sizeof(epoch), 0);
+    if (unlikely(ret != sizeof(epoch))) {
+      perror("pwrite");
+      ALWAYS_ASSERT(false);
+    }
+    if (call_fsync_ && unlikely(fdatasync(pfd) == -1)) {
+      perror("fdatasync");
+      ALWAYS_ASSERT(false);
+    }
+    persistent_epoch_.store(epoch, memory_order_release);
+    struct iovec iov = {&m.seq_, sizeof(m.seq_)};
+    if (!txn_replication::SendAll(fd, &iov, 1))
+      break;
+  }
+  close(pfd);
+}
+
+bool
+txn_log_receiver::wait_for_batches(const vector<uint64_t> &seqs)
+{
+  unique_lock<mutex> l(lock_);
+  cv_.wait(l, [this, &seqs]() {
+    if (!running_.load(memory_order_acquire))
+      return true;
+    for (size_t i = 0; i < seqs.size(); i++)
+      if (durable_seqs_[i] < seqs[i])
+        return false;
+    return true;
+  });
+  return running_.load(memory_order_acquire);
+}
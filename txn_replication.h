@@ -0,0 +1,172 @@
+#ifndef _NDB_TXN_REPLICATION_H_
+#define _NDB_TXN_REPLICATION_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/uio.h>
+
+#include "macros.h"
+
+/**
+ * Log shipping from txn_logger to hot standbys, over TCP.
+ *
+ * Every logger opens a connection to each standby, over which it sends each
+ * batch of log buffers it writes (byte for byte what goes into its own
+ * logfile). The persister opens one more connection to each standby, over
+ * which it sends every new persistent epoch. A standby (txn_log_receiver)
+ * appends the batches of logger i to its own i-th logfile, and writes the
+ * persistent epochs next to its first logfile, just like the primary does.
+ * It acknowledges each message once the message is durable.
+ *
+ * On the primary, a batch (and then a persistent epoch) only counts as
+ * durable once a quorum of the standbys has acknowledged it, on top of the
+ * local fdatasync() (if any). So with call_fsync unset, replication stands
+ * in for local fsync on the commit path.
+ *
+ * To fail over, wait for the primary to go away (see
+ * txn_log_receiver::wait_for_primary()) and recover from the standby's
+ * logfiles with txn_log_replayer::Replay().
+ *
+ * Each connection starts with a hello, after which the primary sends
+ * [msg_header] messages. On a log stream, a message is followed by arg_
+ * bytes of log. On the epoch stream, arg_ is the persistent epoch, and it is
+ * followed by [n (8 bytes)][seq (8 bytes)] * n: the last batch of each of the
+ * n loggers the epoch depends on. The log streams and the epoch stream are
+ * separate connections, so a standby only writes an epoch out once it holds
+ * those batches itself. The standby answers each message with its seq_ (8
+ * bytes) once it is durable.
+ */
+class txn_replication {
+public:
+  static const uint64_t Magic = 0x53494c4f5245504cUL; // "SILOREPL"
+
+  enum StreamKind {
+    STREAM_LOG   = 1, // id is the logger
+    STREAM_EPOCH = 2,
+  };
+
+  struct hello {
+    uint64_t magic_;
+    uint32_t kind_;
+    uint32_t id_;
+  } PACKED;
+
+  struct msg_header {
+    uint64_t seq_;
+    uint64_t arg_;
+  } PACKED;
+
+  // returns -1 if the endpoint (host:port) cannot be connected to
+  static int Connect(const std::string &endpoint);
+
+  // return false if the peer went away
+  static bool SendAll(int fd, const struct iovec *iov, size_t n);
+  static bool RecvAll(int fd, void *p, size_t n);
+};
+
+// the primary's end of one stream, to every standby
+class txn_log_shipper {
+public:
+  // quorum is the # of standbys which must acknowledge each message, 0 for
+  // all of them
+  txn_log_shipper(const std::vector<std::string> &standbys,
+                  size_t quorum,
+                  txn_replication::StreamKind kind,
+                  uint32_t id);
+  ~txn_log_shipper();
+
+  txn_log_shipper(const txn_log_shipper &) = delete;
+  txn_log_shipper(txn_log_shipper &&) = delete;
+  txn_log_shipper &operator=(const txn_log_shipper &) = delete;
+
+  // both return the seq to wait() on
+  uint64_t ship(const struct iovec *iov, size_t n, size_t nbytes);
+  uint64_t ship_epoch(uint64_t epoch, const std::vector<uint64_t> &seqs);
+
+  // blocks until a quorum of the standbys has acknowledged seq. losing the
+  // quorum is fatal
+  void wait(uint64_t seq);
+
+  // the last seq wait() returned for
+  inline uint64_t
+  completed_seq() const
+  {
+    return completed_.load(std::memory_order_acquire);
+  }
+
+private:
+  struct link {
+    std::string endpoint_;
+    int fd_;
+    uint64_t acked_;
+  };
+
+  void lost(link &l);
+  size_t nalive() const;
+
+  std::vector<link> links_;
+  const size_t quorum_;
+  uint64_t seq_;
+  std::atomic<uint64_t> completed_;
+};
+
+// the standby's end of the streams of a primary
+class txn_log_receiver {
+public:
+  // listens on port. logger i's stream is appended to logfiles[i] (which
+  // are truncated when the stream connects), and the persistent epochs are
+  // written to logfiles[0] + txn_logger::g_pepoch_suffix
+  txn_log_receiver(uint16_t port,
+                   const std::vector<std::string> &logfiles,
+                   bool call_fsync = true);
+
+  // stops (and waits for) all of the receiving threads
+  ~txn_log_receiver();
+
+  txn_log_receiver(const txn_log_receiver &) = delete;
+  txn_log_receiver(txn_log_receiver &&) = delete;
+  txn_log_receiver &operator=(const txn_log_receiver &) = delete;
+
+  // the last persistent epoch received (and made durable)
+  inline uint64_t
+  persistent_epoch() const
+  {
+    return persistent_epoch_.load(std::memory_order_acquire);
+  }
+
+  // blocks until a primary has connected and all of its streams have since
+  // closed
+  void wait_for_primary();
+
+private:
+  void accept_loop();
+  void serve(int fd);
+  void serve_log(int fd, uint32_t id);
+  void serve_epoch(int fd);
+
+  // returns false if the receiver is stopped first
+  bool wait_for_batches(const std::vector<uint64_t> &seqs);
+
+  const std::vector<std::string> logfiles_;
+  const bool call_fsync_;
+  int listen_fd_;
+
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> persistent_epoch_;
+
+  std::mutex lock_; // protects the fields below
+  std::condition_variable cv_;
+  std::vector<int> fds_;
+  std::vector<uint64_t> durable_seqs_; // per log stream
+  size_t nconnected_; // streams ever connected
+  size_t nopen_;
+  std::vector<std::thread> servers_;
+
+  std::thread acceptor_;
+};
+
+#endif /* _NDB_TXN_REPLICATION_H_ */
@@ -0,0 +1,172 @@
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "txn_tracer.h"
+#include "counter.h"
+#include "util.h"
+
+using namespace std;
+
+static_assert(sizeof(txn_trace_record) == 64, "trace file format changed");
+
+atomic<uint64_t> txn_tracer::g_one_in(0);
+percore<uint64_t> txn_tracer::g_ntxns;
+atomic<txn_tracer::ring *> txn_tracer::g_rings[NMAXCORES];
+__thread uint8_t txn_tracer::tl_txn_type = txn_trace_record::NoTxnType;
+
+static event_counter evt_txn_trace_records("txn_trace_records");
+static event_counter evt_txn_trace_drops("txn_trace_drops");
+
+// Enable() and Disable() only
+static mutex g_lifecycle_mutex;
+static thread g_drainer;
+static atomic<bool> g_stop_draining(false);
+static int g_fd = -1;
+
+static void
+WriteFully(int fd, const void *p, size_t n)
+{
+  const char *c = (const char *) p;
+  while (n) {
+    const ssize_t r = write(fd, c, n);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("txn_tracer write");
+      return;
+    }
+    c += r;
+    n -= r;
+  }
+}
+
+void
+txn_tracer::Enable(uint64_t one_in, const string &path)
+{
+  std::lock_guard<mutex> l(g_lifecycle_mutex);
+  ALWAYS_ASSERT(g_fd == -1);
+  if (!one_in)
+    return;
+  g_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ALWAYS_ASSERT(g_fd != -1);
+  // magic, record size, version
+  const uint64_t magic = TraceFileMagic;
+  const uint32_t hdr[2] = {sizeof(txn_trace_record), 1};
+  WriteFully(g_fd, &magic, sizeof(magic));
+  WriteFully(g_fd, hdr, sizeof(hdr));
+  g_stop_draining.store(false, memory_order_release);
+  g_drainer = thread(&txn_tracer::Drainer);
+  g_one_in.store(one_in, memory_order_release);
+}
+
+void
+txn_tracer::Disable()
+{
+  std::lock_guard<mutex> l(g_lifecycle_mutex);
+  if (g_fd == -1)
+    return;
+  g_one_in.store(0, memory_order_release);
+  g_stop_draining.store(true, memory_order_release);
+  g_drainer.join();
+  Drain(g_fd);
+  close(g_fd);
+  g_fd = -1;
+}
+
+void
+txn_tracer::NameTxnType(uint8_t type, const string &name)
+{
+  if (!IsEnabled())
+    return;
+  txn_trace_record rec;
+  NDB_MEMSET(&rec, 0, sizeof(rec));
+  rec.kind_ = txn_trace_record::KIND_TXN_TYPE;
+  rec.txn_type_ = type;
+  strncpy(rec.name_, name.c_str(), sizeof(rec.name_) - 1);
+  rec.tsc_ = rdtsc();
+  Record(rec);
+}
+
+void
+txn_tracer::RecordDurable(uint64_t tid, uint64_t wait_us)
+{
+  if (!IsEnabled())
+    return;
+  txn_trace_record rec;
+  NDB_MEMSET(&rec, 0, sizeof(rec));
+  rec.kind_ = txn_trace_record::KIND_DURABLE;
+  rec.txn_type_ = txn_trace_record::NoTxnType;
+  rec.durable_.wait_us_ = wait_us;
+  rec.tsc_ = rdtsc();
+  rec.tid_ = tid;
+  Record(rec);
+}
+
+void
+txn_tracer::Record(txn_trace_record &rec)
+{
+  const unsigned core = coreid::core_id();
+  rec.core_ = core;
+  ring *r = g_rings[core].load(memory_order_acquire);
+  if (unlikely(!r))
+    r = NewRing(core);
+  const uint64_t head = r->head_.load(memory_order_relaxed);
+  if (unlikely(head - r->tail_.load(memory_order_acquire) >= RingSize)) {
+    ++evt_txn_trace_drops;
+    return;
+  }
+  r->recs_[head % RingSize] = rec;
+  r->head_.store(head + 1, memory_order_release);
+  ++evt_txn_trace_records;
+}
+
+txn_tracer::ring *
+txn_tracer::NewRing(unsigned core)
+{
+  void *p = nullptr;
+  ALWAYS_ASSERT(!posix_memalign(&p, CACHELINE_SIZE, sizeof(ring)));
+  ring * const r = new (p) ring;
+  r->head_.store(0, memory_order_relaxed);
+  r->tail_.store(0, memory_order_relaxed);
+  // only core ever stores its ring, and rings are never freed, so a drainer
+  // can keep reading the rings of cores which have come and gone
+  g_rings[core].store(r, memory_order_release);
+  return r;
+}
+
+void
+txn_tracer::Drain(int fd)
+{
+  for (auto &p : g_rings) {
+    ring * const r = p.load(memory_order_acquire);
+    if (!r)
+      continue;
+    const uint64_t tail = r->tail_.load(memory_order_relaxed);
+    const uint64_t head = r->head_.load(memory_order_acquire);
+    if (head == tail)
+      continue;
+    // at most two runs, if the records wrap around the end of the ring
+    const size_t begin = tail % RingSize;
+    const size_t n = head - tail;
+    const size_t n0 = min(n, RingSize - begin);
+    WriteFully(fd, &r->recs_[begin], n0 * sizeof(txn_trace_record));
+    if (n0 < n)
+      WriteFully(fd, &r->recs_[0], (n - n0) * sizeof(txn_trace_record));
+    r->tail_.store(head, memory_order_release);
+  }
+}
+
+void
+txn_tracer::Drainer()
+{
+  while (!g_stop_draining.load(memory_order_acquire)) {
+    Drain(g_fd);
+    this_thread::sleep_for(chrono::microseconds(DrainIntervalUsec));
+  }
+}
@@ -0,0 +1,195 @@
+#ifndef _NDB_TXN_TRACER_H_
+#define _NDB_TXN_TRACER_H_
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+#include "amd64.h"
+#include "core.h"
+#include "counter.h"
+#include "macros.h"
+
+/**
+ * A trace record, as written to the trace file. Times are rdtsc() cycles,
+ * except for the durability wait
+ */
+struct txn_trace_record {
+  enum kind_t {
+    KIND_TXN = 1,      // a txn which committed, or aborted
+    KIND_DURABLE = 2,  // a traced txn (by tid_) became durable
+    KIND_TXN_TYPE = 3, // names txn_type_
+  };
+
+  // the phases of transaction::commit() (see COMMIT_PHASE_END())
+  enum phase_t {
+    lock_phase,
+    tid_phase,
+    read_validation_phase,
+    node_validation_phase,
+    install_phase,
+    log_phase,
+    NPhases,
+  };
+
+  static const uint8_t NoTxnType = 0xff;
+
+  uint8_t kind_;
+  uint8_t txn_type_;     // see txn_tracer::SetTxnType()
+  uint8_t abort_reason_; // ABORT_REASON_NONE if committed
+  uint8_t unused_;
+  uint16_t core_;
+  uint16_t unused1_;
+  union {
+    struct {
+      uint32_t nreads_;
+      uint32_t nwrites_;
+      uint32_t nabsent_;
+      uint32_t phase_cycles_[NPhases]; // 0 for the phases not run
+      uint32_t unused_;
+    } txn_;
+    struct {
+      uint64_t wait_us_; // from the end of commit()
+    } durable_;
+    char name_[40]; // KIND_TXN_TYPE, NUL padded
+  };
+  uint64_t tsc_; // KIND_TXN: when the txn started to commit (or aborted)
+  uint64_t tid_; // the commit tid, 0 if none
+};
+
+/**
+ * Traces 1-in-N txns (per core) into a binary file, for the latency
+ * outliers which only ever happen in production.
+ *
+ * A traced txn writes a txn_trace_record into a per-core ring when it
+ * commits or aborts, and another (KIND_DURABLE) once it is durable. Rings
+ * are single producer, single consumer, and a record which finds its ring
+ * full is dropped. A background thread drains the rings into the file,
+ * which is the 16 byte header (see TraceFileMagic) followed by the records.
+ *
+ * Txns which are not traced pay for a per-core increment, like
+ * abort_sampler
+ */
+class txn_tracer {
+public:
+
+  static const uint64_t TraceFileMagic = 0x31435254534e5854ULL; // "TXNSTRC1"
+  static const size_t RingSize = 1024; // records per core
+  static const uint64_t DrainIntervalUsec = 10000;
+
+  static inline bool
+  IsEnabled()
+  {
+    return g_one_in.load(std::memory_order_relaxed);
+  }
+
+  // starts tracing into (a new) path. 0 stops tracing. should be called
+  // before any txns run
+  static void Enable(uint64_t one_in, const std::string &path);
+
+  // stops tracing, and writes out what is left in the rings
+  static void Disable();
+
+  // should the calling core's next txn be traced?
+  static inline bool
+  ShouldSample()
+  {
+    const uint64_t one_in = g_one_in.load(std::memory_order_relaxed);
+    if (likely(!one_in))
+      return false;
+    uint64_t &n = g_ntxns.my();
+    return (n++ % one_in) == 0;
+  }
+
+  // the type of the txns the calling thread runs from now on, as it
+  // appears in their records. NameTxnType() names it in the trace
+  static inline void
+  SetTxnType(uint8_t type)
+  {
+    tl_txn_type = type;
+  }
+
+  static void NameTxnType(uint8_t type, const std::string &name);
+
+  static inline void
+  BeginTxn(txn_trace_record &rec, size_t nreads, size_t nwrites, size_t nabsent)
+  {
+    NDB_MEMSET(&rec, 0, sizeof(rec));
+    rec.kind_ = txn_trace_record::KIND_TXN;
+    rec.txn_type_ = tl_txn_type;
+    rec.txn_.nreads_ = nreads;
+    rec.txn_.nwrites_ = nwrites;
+    rec.txn_.nabsent_ = nabsent;
+    rec.tsc_ = rdtsc();
+  }
+
+  static inline void
+  EndTxn(txn_trace_record &rec, uint8_t abort_reason, uint64_t tid)
+  {
+    rec.abort_reason_ = abort_reason;
+    rec.tid_ = tid;
+    Record(rec);
+  }
+
+  // from any thread, once the txn which committed at tid is durable
+  static void RecordDurable(uint64_t tid, uint64_t wait_us);
+
+private:
+
+  struct ring {
+    std::atomic<uint64_t> head_; // only the core's thread moves it
+    std::atomic<uint64_t> tail_ CACHE_ALIGNED; // only the drainer moves it
+    txn_trace_record recs_[RingSize] CACHE_ALIGNED;
+  };
+
+  static void Record(txn_trace_record &rec);
+  static ring *NewRing(unsigned core);
+  static void Drain(int fd);
+  static void Drainer();
+
+  static std::atomic<uint64_t> g_one_in;
+  static percore<uint64_t> g_ntxns CACHE_ALIGNED;
+  static std::atomic<ring *> g_rings[NMAXCORES];
+  static __thread uint8_t tl_txn_type;
+};
+
+/**
+ * Times the phases of a commit, into the transaction_base commit phase
+ * histograms (with event counters) and into the txn's trace record, if it
+ * is traced. Without either, it is a branch per phase
+ */
+class commit_phase_timer {
+public:
+  commit_phase_timer(txn_trace_record *rec) : rec_(rec), start_(0)
+  {
+#ifndef ENABLE_EVENT_COUNTERS
+    if (likely(!rec_))
+      return;
+#endif
+    start_ = rdtsc();
+  }
+
+  inline ALWAYS_INLINE void
+  end(event_histogram &h, txn_trace_record::phase_t phase)
+  {
+#ifndef ENABLE_EVENT_COUNTERS
+    if (likely(!rec_))
+      return;
+#endif
+    const uint64_t now = rdtsc();
+    const uint64_t cycles = now - start_;
+#ifdef ENABLE_EVENT_COUNTERS
+    h.offer(cycles);
+#endif
+    if (unlikely(rec_))
+      rec_->txn_.phase_cycles_[phase] = std::min(cycles, uint64_t(UINT32_MAX));
+    start_ = now;
+  }
+
+private:
+  txn_trace_record *const rec_;
+  uint64_t start_;
+};
+
+#endif /* _NDB_TXN_TRACER_H_ */
@@ -0,0 +1,411 @@
+#include <string.h>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "counter.h"
+#include "rcu.h"
+#include "txn_btree.h"
+#include "txn_proto2_impl.h"
+#include "txn_ttl.h"
+#include "util.h"
+
+using namespace std;
+using namespace util;
+
+static event_counter evt_ttl_rows_expired("ttl_rows_expired");
+static event_counter evt_ttl_cutoffs_logged("ttl_cutoffs_logged");
+static event_counter evt_ttl_range_deletes("ttl_range_deletes");
+
+const char *const txn_ttl::MetaTableName = "__ttl__";
+
+atomic<size_t> txn_ttl::g_nregistered(0);
+txn_ttl::registry_entry txn_ttl::g_registry[txn_ttl::NMaxTables];
+
+namespace {
+
+  struct ttl_traits : public default_transaction_traits {};
+  typedef transaction_proto2<ttl_traits> reap_txn_type;
+
+  const concurrent_btree *const TableTombstone = (const concurrent_btree *) 0x1;
+
+  // keys the reaper visits per txn (and per hold of g_lock)
+  const size_t ReapChunk = 256;
+
+  // guards registry changes, and is held while a table's rows are being
+  // expired, so it is not destroyed under the reaper
+  mutex g_lock;
+
+  // (tick, time in us) samples, oldest first, taken by the reaper
+  deque<pair<uint64_t, uint64_t>> g_clock;
+
+  unique_ptr<txn_btree<transaction_proto2>> g_meta;
+
+  // the tid which ends epoch e
+  inline uint64_t
+  EpochEndTid(uint64_t e)
+  {
+    return transaction_proto2_static::MakeTid(
+        transaction_proto2_static::CoreMask,
+        transaction_proto2_static::NumIdMask >>
+          transaction_proto2_static::NumIdShift,
+        e);
+  }
+
+  // the highest tid committed no later than time us, by the samples
+  uint64_t
+  CutoffAt(uint64_t us)
+  {
+    for (auto it = g_clock.rbegin(); it != g_clock.rend(); ++it) {
+      if (it->second > us)
+        continue;
+      // txns in epochs before the sampled tick got their tids before it
+      // began
+      if (it->first <= 1)
+        return 0;
+      return EpochEndTid(it->first - 1);
+    }
+    return 0;
+  }
+
+  // [cutoff][lower size (uint32)][lower][has upper (uint8)][upper]
+  string
+  EncodeRange(const txn_ttl::deleted_range &r)
+  {
+    const uint32_t lsz = r.lower_.size();
+    const uint8_t has_upper = r.has_upper_;
+    string ret((const char *) &r.tid_, sizeof(r.tid_));
+    ret.append((const char *) &lsz, sizeof(lsz));
+    ret.append(r.lower_);
+    ret.append((const char *) &has_upper, sizeof(has_upper));
+    ret.append(r.upper_);
+    return ret;
+  }
+
+  inline bool
+  SameRange(const txn_ttl::deleted_range &a, const txn_ttl::deleted_range &b)
+  {
+    return a.tid_ == b.tid_ && a.lower_ == b.lower_ &&
+           a.has_upper_ == b.has_upper_ && a.upper_ == b.upper_;
+  }
+
+  struct reap_callback {
+    reap_callback(uint64_t cutoff) : cutoff_(cutoff), n_(0), more_(false) {}
+    bool
+    operator()(const concurrent_btree::string_type &k,
+               concurrent_btree::value_type v)
+    {
+      dbtuple * const tuple = reinterpret_cast<dbtuple *>(v);
+      last_.assign(k.data(), k.size());
+      const dbtuple::version_t hv = tuple->unstable_version();
+      if (dbtuple::IsLatest(hv) && !dbtuple::IsDeleting(hv) &&
+          tuple->version <= cutoff_)
+        victims_.emplace_back(last_, tuple);
+      if (++n_ == ReapChunk) {
+        more_ = true;
+        return false;
+      }
+      return true;
+    }
+    const uint64_t cutoff_;
+    vector<pair<string, dbtuple *>> victims_;
+    string last_;
+    size_t n_;
+    bool more_;
+  };
+
+  // record is a cutoff, or a range (see txn_ttl::DecodeRecord())
+  void
+  LogRecord(const string &name, const string &record)
+  {
+    for (;;) {
+      ttl_traits::StringAllocator sa;
+      reap_txn_type t(0, sa);
+      try {
+        g_meta->insert(t, name, record);
+        if (t.commit(false))
+          break;
+      } catch (transaction_abort_exception &ex) {
+      }
+    }
+  }
+
+  void
+  ReapLoop(uint64_t reap_interval_us)
+  {
+    for (;;) {
+      this_thread::sleep_for(chrono::microseconds(reap_interval_us));
+      txn_ttl::Reap();
+    }
+  }
+}
+
+void
+txn_ttl::Init(uint64_t reap_interval_us)
+{
+  ALWAYS_ASSERT(!g_meta);
+  g_meta.reset(new txn_btree<transaction_proto2>(
+      sizeof(uint64_t), false, MetaTableName));
+  {
+    std::lock_guard<mutex> l(g_lock);
+    g_clock.emplace_back(ticker::s_instance.global_current_tick(),
+                         timer::cur_usec());
+  }
+  if (reap_interval_us)
+    thread(ReapLoop, reap_interval_us).detach();
+}
+
+bool
+txn_ttl::DecodeRecord(const uint8_t *v, size_t vlen,
+                      deleted_range &r, bool &is_range)
+{
+  if (vlen < sizeof(r.tid_))
+    return false;
+  memcpy(&r.tid_, v, sizeof(r.tid_));
+  is_range = vlen > sizeof(r.tid_);
+  if (!is_range)
+    return true;
+  const uint8_t *p = v + sizeof(r.tid_);
+  const uint8_t * const end = v + vlen;
+  uint32_t lsz;
+  if (size_t(end - p) < sizeof(lsz))
+    return false;
+  memcpy(&lsz, p, sizeof(lsz));
+  p += sizeof(lsz);
+  if (size_t(end - p) < lsz + 1)
+    return false;
+  r.lower_.assign((const char *) p, lsz);
+  p += lsz;
+  r.has_upper_ = *p++;
+  if (!r.has_upper_ && p != end)
+    return false;
+  r.upper_.assign((const char *) p, end - p);
+  return true;
+}
+
+txn_ttl::registry_entry *
+txn_ttl::Register(concurrent_btree *btr, const string &name)
+{
+  INVARIANT(btr && btr != TableTombstone);
+  registry_entry * const e = EntryFor(btr);
+  if (e)
+    return e;
+  for (size_t i = SlotFor(btr), n = 0;
+       n < NMaxTables;
+       i = (i + 1) & (NMaxTables - 1), n++) {
+    const concurrent_btree * const px =
+      g_registry[i].btr_.load(memory_order_acquire);
+    if (!px || px == TableTombstone) {
+      g_registry[i].cutoff_.store(0, memory_order_release);
+      g_registry[i].ranges_.store(nullptr, memory_order_release);
+      g_registry[i].ttl_us_ = 0;
+      g_registry[i].name_ = name;
+      g_registry[i].btr_.store(btr, memory_order_release);
+      g_nregistered.fetch_add(1, memory_order_release);
+      return &g_registry[i];
+    }
+  }
+  ALWAYS_ASSERT(false); // too many tables
+  return nullptr;
+}
+
+void
+txn_ttl::SetRanges(registry_entry *e, range_list *ranges)
+{
+  const range_list * const old =
+    e->ranges_.exchange(ranges, memory_order_acq_rel);
+  if (old) {
+    scoped_rcu_region guard;
+    rcu::s_instance.free(const_cast<range_list *>(old));
+  }
+}
+
+bool
+txn_ttl::IsInitialized()
+{
+  return bool(g_meta);
+}
+
+void
+txn_ttl::RegisterTree(concurrent_btree *btr, const string &name,
+                      uint64_t ttl_us)
+{
+  ALWAYS_ASSERT(g_meta); // Init() was not called
+  std::lock_guard<mutex> l(g_lock);
+  registry_entry * const e = Register(btr, name);
+  INVARIANT(!e->ttl_us_);
+  e->ttl_us_ = ttl_us;
+}
+
+void
+txn_ttl::UnregisterTree(concurrent_btree *btr)
+{
+  if (likely(!g_nregistered.load(memory_order_acquire)))
+    return;
+  std::lock_guard<mutex> l(g_lock);
+  registry_entry * const e = EntryFor(btr);
+  if (!e)
+    return; // never had a TTL or range deletes
+  SetRanges(e, nullptr);
+  e->btr_.store(TableTombstone, memory_order_release);
+  g_nregistered.fetch_sub(1, memory_order_release);
+}
+
+void
+txn_ttl::DeleteRange(concurrent_btree *btr, const string &name,
+                     const string &lower, const string *upper)
+{
+  ALWAYS_ASSERT(g_meta); // Init() was not called
+  INVARIANT(!rcu::s_instance.in_rcu_region());
+  deleted_range r;
+  r.lower_ = lower;
+  r.has_upper_ = upper;
+  if (upper)
+    r.upper_ = *upper;
+  const uint64_t e = ticker::s_instance.global_current_tick();
+  r.tid_ = EpochEndTid(e);
+
+  // logged before anyone reads by it (see Reap())
+  LogRecord(name, EncodeRange(r));
+  {
+    std::lock_guard<mutex> l(g_lock);
+    registry_entry * const ent = Register(btr, name);
+    const range_list * const rl = ent->ranges_.load(memory_order_acquire);
+    range_list * const nl = rl ? new range_list(*rl) : new range_list;
+    nl->push_back(r);
+    SetRanges(ent, nl);
+  }
+  ++evt_ttl_range_deletes;
+
+  // commits later in the epoch are deleted too, so the range is only
+  // deleted for good once it is over
+  ticker::WaitForTick(e);
+}
+
+size_t
+txn_ttl::Reap()
+{
+  struct moved {
+    concurrent_btree *btr_;
+    string name_;
+    uint64_t cutoff_;
+  };
+  struct ranged {
+    concurrent_btree *btr_;
+    deleted_range range_;
+  };
+  vector<moved> todo;
+  vector<ranged> ranges;
+  const uint64_t now = timer::cur_usec();
+  {
+    std::lock_guard<mutex> l(g_lock);
+    g_clock.emplace_back(ticker::s_instance.global_current_tick(), now);
+    // a range's rows can only be expired once its epoch is over
+    const uint64_t last_tick_ex =
+      ticker::s_instance.global_last_tick_exclusive();
+    uint64_t max_ttl_us = 0;
+    for (size_t i = 0; i < NMaxTables; i++) {
+      const concurrent_btree * const px =
+        g_registry[i].btr_.load(memory_order_acquire);
+      if (!px || px == TableTombstone)
+        continue;
+      const registry_entry &e = g_registry[i];
+      concurrent_btree * const btr = const_cast<concurrent_btree *>(px);
+      if (const range_list * const rl = e.ranges_.load(memory_order_acquire))
+        for (auto &r : *rl)
+          if (transaction_proto2_static::EpochId(r.tid_) < last_tick_ex)
+            ranges.push_back({btr, r});
+      if (!e.ttl_us_)
+        continue;
+      max_ttl_us = max(max_ttl_us, e.ttl_us_);
+      const uint64_t cutoff = now > e.ttl_us_ ? CutoffAt(now - e.ttl_us_) : 0;
+      if (cutoff > e.cutoff_.load(memory_order_acquire))
+        todo.push_back({btr, e.name_, cutoff});
+    }
+    // only the newest sample from before the longest TTL is still needed
+    while (g_clock.size() > 1 && g_clock[1].second + max_ttl_us <= now)
+      g_clock.pop_front();
+  }
+
+  // expires the rows of btr in [lower, upper) at tids <= cutoff, a chunk at
+  // a time. returns the number of rows found to expire (some may have been
+  // busy, and are left for the next pass)
+  size_t n = 0;
+  auto expire = [&n](concurrent_btree *btr, const string &lower,
+                     const string *upper, uint64_t cutoff) -> size_t {
+    size_t nfound = 0;
+    string start(lower);
+    for (;;) {
+      std::lock_guard<mutex> l(g_lock);
+      if (!EntryFor(btr))
+        break; // unregistered since
+      ttl_traits::StringAllocator sa;
+      reap_txn_type t(0, sa);
+      reap_callback c(cutoff);
+      if (upper) {
+        const varkey vupper(*upper);
+        btr->search_range(varkey(start), &vupper, c);
+      } else {
+        btr->search_range(varkey(start), nullptr, c);
+      }
+      nfound += c.victims_.size();
+      for (auto &p : c.victims_)
+        if (t.expire_tuple(p.second, p.first, btr, cutoff))
+          n++;
+      // nothing to validate. leaving the txn's RCU region lets GC at the
+      // deletes queued so far
+      t.commit(false);
+      if (!c.more_)
+        break;
+      // the smallest key after the last one visited
+      start = c.last_;
+      start.push_back('\0');
+    }
+    return nfound;
+  };
+
+  for (auto &m : todo) {
+    // logged before anyone reads by it, so replay never keeps a row some
+    // read already treated as expired
+    LogRecord(m.name_, string((const char *) &m.cutoff_, sizeof(m.cutoff_)));
+    ++evt_ttl_cutoffs_logged;
+    {
+      std::lock_guard<mutex> l(g_lock);
+      registry_entry * const e = EntryFor(m.btr_);
+      if (!e)
+        continue; // unregistered since
+      e->cutoff_.store(m.cutoff_, memory_order_release);
+    }
+    expire(m.btr_, string(), nullptr, m.cutoff_);
+  }
+
+  for (auto &rr : ranges) {
+    const deleted_range &r = rr.range_;
+    if (expire(rr.btr_, r.lower_, r.has_upper_ ? &r.upper_ : nullptr, r.tid_))
+      continue;
+    // every row the range covers reads as deleted without it now
+    std::lock_guard<mutex> l(g_lock);
+    registry_entry * const e = EntryFor(rr.btr_);
+    const range_list * const rl =
+      e ? e->ranges_.load(memory_order_acquire) : nullptr;
+    if (!rl)
+      continue; // unregistered since
+    range_list * const nl = new range_list;
+    for (auto &o : *rl)
+      if (!SameRange(o, r))
+        nl->push_back(o);
+    if (nl->empty()) {
+      delete nl;
+      SetRanges(e, nullptr);
+    } else {
+      SetRanges(e, nl);
+    }
+  }
+
+  evt_ttl_rows_expired += n;
+  return n;
+}
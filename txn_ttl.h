@@ -0,0 +1,158 @@
+#ifndef _NDB_TXN_TTL_H_
+#define _NDB_TXN_TTL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "btree_choice.h"
+#include "macros.h"
+
+/**
+ * Per-table time to live: the rows of a table with a TTL (see
+ * base_txn_btree::set_ttl()) expire ttl_us after the txn which last wrote
+ * them committed, without anybody deleting them.
+ *
+ * Time is kept in epochs. A reaper thread samples the current tick every
+ * reap interval, from which it can tell the newest epoch which was over at
+ * least ttl_us ago. Each table has a cutoff tid, which only moves forward,
+ * and reads treat rows at or below their table's cutoff as absent (see
+ * transaction::do_tuple_read()). So a row lives for ttl_us, plus up to about
+ * a reap interval.
+ *
+ * The reaper then turns the expired rows into logical deletes in place, at
+ * their own tids (see transaction_proto2::expire_tuple()), and puts them on
+ * its proto2 GC queue, which unlinks them from the tree once no snapshot can
+ * see them. Nothing is logged per row: each time a table's cutoff moves, one
+ * expiry record is (a write of the cutoff, keyed by the table's name, to the
+ * MetaTableName table), and replay drops every row the record covers (see
+ * txn_log_replayer). Rows reinstalled by replay get new tids, so those the
+ * log has no expiry record for live for up to another ttl_us after a
+ * restart.
+ *
+ * Range deletes (see base_txn_btree::delete_range()) work the same way, with
+ * a fixed cutoff over a range of keys: DeleteRange() logs one expiry record
+ * for the range, at a tid which ends the current epoch, and publishes it
+ * right away, so the whole range reads as deleted as of that epoch. Once the
+ * epoch is over the reaper expires the range's rows, and drops the range
+ * when a pass finds none left. A truncate is a range delete of every key.
+ * Like a TTL cutoff moving, a range delete is not isolated from the txns of
+ * the epoch it is made in: they may see the range partly deleted
+ */
+class txn_ttl {
+public:
+
+  // the table the expiry records are written to
+  static const char *const MetaTableName;
+
+  // rows in [lower_, upper_) (no upper bound unless has_upper_) at tids <=
+  // tid_ are deleted
+  struct deleted_range {
+    std::string lower_;
+    std::string upper_;
+    bool has_upper_;
+    uint64_t tid_;
+
+    inline bool
+    contains(const char *k, size_t klen) const
+    {
+      return lower_.compare(0, lower_.size(), k, klen) <= 0 &&
+             (!has_upper_ || upper_.compare(0, upper_.size(), k, klen) > 0);
+    }
+  };
+
+  // an expiry record is a cutoff tid, followed by the range for a range
+  // delete. returns false if v is not a record. r.tid_ is the cutoff
+  static bool DecodeRecord(const uint8_t *v, size_t vlen,
+                           deleted_range &r, bool &is_range);
+
+  // should be called once, before any table with a TTL is used. a
+  // reap_interval_us of 0 starts no reaper (Reap() can be called by hand)
+  static void Init(uint64_t reap_interval_us);
+  static bool IsInitialized();
+
+  // tables are registered for their lifetime (see base_txn_btree)
+  static void RegisterTree(concurrent_btree *btr, const std::string &name,
+                           uint64_t ttl_us);
+  static void UnregisterTree(concurrent_btree *btr);
+
+  // deletes the rows of btr in [lower, upper) (upper null for no bound), as
+  // of the end of the current epoch, which it waits for. not to be called
+  // from within a txn
+  static void DeleteRange(concurrent_btree *btr, const std::string &name,
+                          const std::string &lower, const std::string *upper);
+
+  // rows of key k in btr at tids <= CutoffFor(btr, k, klen) are expired. 0
+  // for tables without a TTL or range deletes. caller is in an RCU region
+  static inline uint64_t
+  CutoffFor(const concurrent_btree *btr, const char *k, size_t klen)
+  {
+    if (likely(!g_nregistered.load(std::memory_order_acquire)))
+      return 0;
+    const registry_entry * const e = EntryFor(btr);
+    if (!e)
+      return 0;
+    uint64_t ret = e->cutoff_.load(std::memory_order_acquire);
+    const range_list * const rl = e->ranges_.load(std::memory_order_acquire);
+    if (unlikely(rl))
+      for (auto &r : *rl)
+        if (r.tid_ > ret && r.contains(k, klen))
+          ret = r.tid_;
+    return ret;
+  }
+
+  // one pass of the reaper: moves the cutoffs (logging them), and expires
+  // the rows they and the range deletes cover. returns the number of rows
+  // expired
+  static size_t Reap();
+
+private:
+
+  static const size_t NMaxTables = 1024;
+
+  static inline size_t
+  SlotFor(const concurrent_btree *btr)
+  {
+    return (uintptr_t(btr) >> 4) & (NMaxTables - 1);
+  }
+
+  // replaced as a whole, the old list being freed through RCU
+  typedef std::vector<deleted_range> range_list;
+
+  struct registry_entry {
+    std::atomic<const concurrent_btree *> btr_;
+    std::atomic<uint64_t> cutoff_;
+    std::atomic<const range_list *> ranges_; // null if none
+    // only touched under the registry lock
+    uint64_t ttl_us_; // 0 if the table only has range deletes
+    std::string name_;
+  };
+
+  // with the registry lock held
+  static registry_entry *Register(concurrent_btree *btr,
+                                  const std::string &name);
+  static void SetRanges(registry_entry *e, range_list *ranges);
+
+  static inline registry_entry *
+  EntryFor(const concurrent_btree *btr)
+  {
+    for (size_t i = SlotFor(btr), n = 0;
+         n < NMaxTables;
+         i = (i + 1) & (NMaxTables - 1), n++) {
+      const concurrent_btree * const px =
+        g_registry[i].btr_.load(std::memory_order_acquire);
+      if (px == btr)
+        return &g_registry[i];
+      if (!px)
+        break;
+    }
+    return nullptr;
+  }
+
+  static std::atomic<size_t> g_nregistered;
+  static registry_entry g_registry[NMaxTables];
+};
+
+#endif /* _NDB_TXN_TTL_H_ */
@@ -4,6 +4,19 @@
 #include "base_txn_btree.h"
 #include "txn_btree.h"
 #include "record/cursor.h"
+#include "record/encoder.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 template <typename Schema>
 struct typed_txn_btree_ {
@@ -24,6 +37,14 @@ struct typed_txn_btree_ {
     return (m & AllFieldsMask) == AllFieldsMask;
   }
 
+  // records of fixed layout schemas are their value_type's bytes, so single
+  // fields are read and written in place at their struct offsets
+  static inline constexpr bool
+  IsFixedLayout()
+  {
+    return value_descriptor_type::fixed_layout();
+  }
+
   class key_reader {
   public:
     constexpr key_reader(bool no_key_results) : no_key_results(no_key_results) {}
@@ -50,27 +71,161 @@ struct typed_txn_btree_ {
     bool no_key_results;
   };
 
+  // value fields can be added to a schema, at the end, without rewriting
+  // the table: the records written before hold only the leading fields of
+  // the new schema (which, being encoded in field order, are a prefix of a
+  // record of it). reads of such an old record zero the fields it lacks (see
+  // do_old_record_read()), writes of some of its fields rewrite it whole, at
+  // the current schema, and typed_txn_btree::upgrade_old_records() rewrites
+  // those nobody writes.
+  //
+  // sets n to the number of fields [data, data + sz) holds. false if it does
+  // not end on a field boundary
+  static inline bool
+  FieldsIn(const uint8_t *data, size_t sz, size_t &n)
+  {
+    if (IsFixedLayout()) {
+      for (size_t i = value_descriptor_type::nfields() + 1; i-- > 0; )
+        if (FixedRecordNBytes(i) == sz) {
+          n = i;
+          return true;
+        }
+      return false;
+    }
+    size_t i = 0;
+    for (; sz && i < value_descriptor_type::nfields(); i++) {
+      const size_t fsz =
+        value_descriptor_type::failsafe_skip_fn(i)(data, sz, nullptr);
+      if (unlikely(!fsz))
+        return false;
+      data += fsz;
+      sz -= fsz;
+    }
+    n = i;
+    return !sz;
+  }
+
+  // the size of a fixed layout record of the first n fields, which are laid
+  // out packed: where field n - 1 ends
+  static inline size_t
+  FixedRecordNBytes(size_t n)
+  {
+    INVARIANT(IsFixedLayout());
+    INVARIANT(n <= value_descriptor_type::nfields());
+    return n ? value_descriptor_type::cstruct_offsetof(n - 1) +
+               value_descriptor_type::cstruct_sizeof(n - 1)
+             : 0;
+  }
+
+  // is [data, data + sz) a record of the current schema?
+  static inline bool
+  IsCurrentRecord(const uint8_t *data, size_t sz)
+  {
+    if (IsFixedLayout())
+      return sz == FixedRecordNBytes(value_descriptor_type::nfields());
+    size_t n;
+    return FieldsIn(data, sz, n) &&
+           n == value_descriptor_type::nfields();
+  }
+
+  // do_record_read() of a record of an older schema
+  static bool
+  do_old_record_read(const uint8_t *data, size_t sz, uint64_t fields_mask,
+                     value_type *v)
+  {
+    size_t n;
+    if (unlikely(!FieldsIn(data, sz, n) ||
+                 n == value_descriptor_type::nfields()))
+      return false;
+    uint8_t * const px = reinterpret_cast<uint8_t *>(v);
+    read_record_cursor<base_type> r(data, sz);
+    for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+      if (!((1UL << i) & fields_mask))
+        continue;
+      const size_t off = value_descriptor_type::cstruct_offsetof(i);
+      if (i >= n)
+        memset(px + off, 0, value_descriptor_type::cstruct_sizeof(i));
+      else if (IsFixedLayout())
+        NDB_MEMCPY(px + off, data + off, value_descriptor_type::cstruct_sizeof(i));
+      else if (unlikely(!r.skip_to(i) || !r.read_current_and_advance(v)))
+        return false;
+    }
+    return true;
+  }
+
+  // dst's fields in fields, taken from src
+  static inline void
+  CopyFields(value_type *dst, const value_type *src, uint64_t fields)
+  {
+    uint8_t * const px = reinterpret_cast<uint8_t *>(dst);
+    const uint8_t * const pv = reinterpret_cast<const uint8_t *>(src);
+    for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+      if ((1UL << i) & fields) {
+        const size_t off = value_descriptor_type::cstruct_offsetof(i);
+        NDB_MEMCPY(px + off, pv + off, value_descriptor_type::cstruct_sizeof(i));
+      }
+    }
+  }
+
+  // the record [buf, buf + sz) of an older schema, brought up to the
+  // current one, with the fields in fields taken from v
+  static inline void
+  upgrade_record(const uint8_t *buf, size_t sz, const value_type *v,
+                 uint64_t fields, value_type *out)
+  {
+    ALWAYS_ASSERT(do_old_record_read(buf, sz, AllFieldsMask & ~fields, out));
+    CopyFields(out, v, fields);
+  }
+
   static inline bool
   do_record_read(const uint8_t *data, size_t sz, uint64_t fields_mask, value_type *v)
   {
     if (IsAllFields(fields_mask)) {
       // read the entire record
       const value_encoder_type value_encoder;
-      return value_encoder.failsafe_read(data, sz, v);
+      return likely(value_encoder.failsafe_read(data, sz, v)) ||
+             do_old_record_read(data, sz, fields_mask, v);
+    } else if (IsFixedLayout()) {
+      if (unlikely(!IsCurrentRecord(data, sz)))
+        return do_old_record_read(data, sz, fields_mask, v);
+      uint8_t * const px = reinterpret_cast<uint8_t *>(v);
+      for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+        if ((1UL << i) & fields_mask) {
+          const size_t off = value_descriptor_type::cstruct_offsetof(i);
+          NDB_MEMCPY(px + off, data + off, value_descriptor_type::cstruct_sizeof(i));
+        }
+      }
+      return true;
     } else {
       // pick individual fields
       read_record_cursor<base_type> r(data, sz);
       for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
         if ((1UL << i) & fields_mask) {
-          r.skip_to(i);
-          if (unlikely(!r.read_current_and_advance(v)))
-            return false;
+          if (unlikely(!r.skip_to(i) || !r.read_current_and_advance(v)))
+            return do_old_record_read(data, sz, fields_mask, v);
         }
       }
       return true;
     }
   }
 
+  // whether the fields in mask of the fixed layout record rec (of sz bytes)
+  // have the same bytes as those of v
+  static bool
+  SameFields(const uint8_t *rec, size_t sz, const uint8_t *v, uint64_t mask)
+  {
+    if (unlikely(!IsCurrentRecord(rec, sz)))
+      return false;
+    for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+      if ((1UL << i) & mask) {
+        const size_t off = value_descriptor_type::cstruct_offsetof(i);
+        if (memcmp(rec + off, v + off, value_descriptor_type::cstruct_sizeof(i)))
+          return false;
+      }
+    }
+    return true;
+  }
+
   class single_value_reader {
   public:
     typedef typename Schema::value_type value_type;
@@ -146,6 +301,67 @@ struct typed_txn_btree_ {
     uint64_t fields_mask;
   };
 
+  // decodes the fields in pred_mask first, and the rest of fields_mask only
+  // for the records pred passes, so the records a scan filters out are
+  // never decoded past what the predicate looks at
+  template <typename Predicate>
+  class predicate_value_reader {
+  public:
+    typedef typename Schema::value_type value_type;
+
+    constexpr predicate_value_reader(
+        const Predicate &pred, uint64_t pred_mask, uint64_t fields_mask)
+      : pred(pred), pred_mask(pred_mask),
+        rest_mask(fields_mask & ~pred_mask), m(false) {}
+
+    template <typename StringAllocator>
+    inline bool
+    operator()(const uint8_t *data, size_t sz, StringAllocator &sa)
+    {
+      if (unlikely(!do_record_read(data, sz, pred_mask, &v)))
+        return false;
+      // a record failing the predicate is still a successful read (a failed
+      // one would be retried)
+      m = pred(const_cast<const value_type &>(v));
+      if (!m || !rest_mask)
+        return true;
+      return do_record_read(data, sz, rest_mask, &v);
+    }
+
+    inline value_type &
+    results()
+    {
+      return v;
+    }
+
+    inline const value_type &
+    results() const
+    {
+      return v;
+    }
+
+    template <typename StringAllocator>
+    inline void
+    dup(const value_type &vdup, StringAllocator &sa)
+    {
+      v = vdup;
+      m = pred(const_cast<const value_type &>(v));
+    }
+
+    inline bool
+    matched() const
+    {
+      return m;
+    }
+
+  private:
+    Predicate pred;
+    uint64_t pred_mask;
+    uint64_t rest_mask;
+    value_type v;
+    bool m;
+  };
+
   class key_writer {
   public:
     constexpr key_writer(const key_type *k) : k(k) {}
@@ -182,6 +398,14 @@ struct typed_txn_btree_ {
       const value_encoder_type value_encoder;
       return value_encoder.nbytes(v);
     }
+    if (unlikely(!IsCurrentRecord(buf, sz))) {
+      value_type u;
+      upgrade_record(buf, sz, v, fields, &u);
+      const value_encoder_type value_encoder;
+      return value_encoder.nbytes(&u);
+    }
+    if (IsFixedLayout())
+      return sizeof(value_type);
 
     ssize_t new_updates_sum = 0;
     for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
@@ -261,6 +485,24 @@ struct typed_txn_btree_ {
       value_encoder.write(buf, v);
       return;
     }
+    if (unlikely(!IsCurrentRecord(buf, sz))) {
+      value_type u;
+      upgrade_record(buf, sz, v, fields, &u);
+      const value_encoder_type value_encoder;
+      value_encoder.write(buf, &u);
+      return;
+    }
+    if (IsFixedLayout()) {
+      INVARIANT(sz == FixedRecordNBytes(value_descriptor_type::nfields()));
+      const uint8_t * const px = reinterpret_cast<const uint8_t *>(v);
+      for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+        if ((1UL << i) & fields) {
+          const size_t off = value_descriptor_type::cstruct_offsetof(i);
+          NDB_MEMCPY(buf + off, px + off, value_descriptor_type::cstruct_sizeof(i));
+        }
+      }
+      return;
+    }
     write_record_cursor<base_type> wc(buf);
     for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
       if ((1UL << i) & fields) {
@@ -323,11 +565,53 @@ struct typed_txn_btree_ {
     case dbtuple::TUPLE_WRITER_DO_DELTA_WRITE:
       do_delta_write_standalone(vx, Fields, p, sz);
       return 0;
+    case dbtuple::TUPLE_WRITER_RESOLVE_DELTA:
+    case dbtuple::TUPLE_WRITER_ADD_DELTA:
+      break; // not commutative
     }
     ALWAYS_ASSERT(false);
     return 0;
   }
 
+  // dst.f = op(dst.f, src.f), for every field f in fields
+  static inline void
+  aggregate_fields(value_type *dst, const value_type *src, uint64_t fields,
+                   aggregate_op op)
+  {
+    uint8_t * const d = reinterpret_cast<uint8_t *>(dst);
+    const uint8_t * const s = reinterpret_cast<const uint8_t *>(src);
+    for (uint64_t i = 0; i < value_descriptor_type::nfields(); i++) {
+      if ((1UL << i) & fields) {
+        const size_t off = value_descriptor_type::cstruct_offsetof(i);
+        value_descriptor_type::aggregate_fn(i, op)(d + off, s + off);
+      }
+    }
+  }
+
+  // the commutative version of tuple_writer<Fields>(), for aggregates: once
+  // resolved, the delta holds the values to write for Fields
+  template <uint64_t Fields, aggregate_op Op>
+  static inline size_t
+  tuple_aggregate_writer(dbtuple::TupleWriterMode mode, const void *v, uint8_t *p, size_t sz)
+  {
+    value_type *vx = reinterpret_cast<value_type *>(const_cast<void *>(v));
+    switch (mode) {
+    case dbtuple::TUPLE_WRITER_RESOLVE_DELTA:
+      {
+        INVARIANT(sz);
+        value_type cur;
+        ALWAYS_ASSERT(do_record_read(p, sz, Fields, &cur));
+        aggregate_fields(vx, &cur, Fields, Op);
+        return 0;
+      }
+    case dbtuple::TUPLE_WRITER_ADD_DELTA:
+      aggregate_fields(reinterpret_cast<value_type *>(p), vx, Fields, Op);
+      return 0;
+    default:
+      return tuple_writer<Fields>(mode, v, p, sz);
+    }
+  }
+
   class value_writer {
   public:
     constexpr value_writer(const value_type *v, uint64_t fields)
@@ -450,14 +734,49 @@ public:
   typed_txn_btree(size_type value_size_hint = 128,
                   bool mostly_append = false,
                   const std::string &name = "<unknown>")
-    : super_type(value_size_hint, mostly_append, name)
-  {}
+    : super_type(value_size_hint, mostly_append, name),
+      secondary_indexes(nullptr),
+      field_validation(false)
+  {
+    base_txn_btree_handler<Transaction>::on_typed_construct(
+        this->get_underlying_btree(), AllFieldsMask);
+  }
+
+  ~typed_txn_btree()
+  {
+    delete secondary_indexes.load(std::memory_order_acquire);
+  }
 
   template <typename Traits, typename FieldsMask = AllFields>
   inline bool search(
       Transaction<Traits> &t, const key_type &k, value_type &v,
       FieldsMask fm = FieldsMask());
 
+  // search() of each keys[i], i in [0, n), into values[i], with found[i] set
+  // to whether it was found. the lookups are batched, so their cache misses
+  // overlap instead of being taken one descent at a time (see
+  // base_txn_btree::do_search_batch())
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline void multi_search(
+      Transaction<Traits> &t, const key_type *keys, size_t n,
+      value_type *values, bool *found, FieldsMask fm = FieldsMask());
+
+  /**
+   * The inner side of an index nested-loop join: for each outer row (the
+   * results of a scan of another table, say), looks up inner_key(outer[i])
+   * in this table, all of them in one multi_search(), and then calls
+   * callback(outer[i], k, v) for each one found, in order.
+   *
+   * inner_key is a key_type(const Outer &), and callback a
+   * void(const Outer &, const key_type &, const value_type &). Returns the
+   * number found
+   */
+  template <typename Traits, typename Outer, typename InnerKey,
+            typename Callback, typename FieldsMask = AllFields>
+  inline size_t index_join(
+      Transaction<Traits> &t, const std::vector<Outer> &outer,
+      InnerKey inner_key, Callback callback, FieldsMask fm = FieldsMask());
+
   template <typename Traits, typename FieldsMask = AllFields>
   inline void search_range_call(
       Transaction<Traits> &t, const key_type &lower, const key_type *upper,
@@ -465,6 +784,29 @@ public:
       bool no_key_results = false /* skip decoding of keys? */,
       FieldsMask fm = FieldsMask());
 
+  // like search_range_call(), but split into callbacks.size() subranges,
+  // callbacks[i] getting the i-th one (see
+  // txn_btree::search_range_call_parallel())
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline void search_range_call_parallel(
+      Transaction<Traits> &t, const key_type &lower, const key_type *upper,
+      const std::vector<search_range_callback *> &callbacks,
+      bool no_key_results = false /* skip decoding of keys? */,
+      FieldsMask fm = FieldsMask());
+
+  // like search_range_call(), but only invokes callback on the records for
+  // which pred(v) is true. pred is given v with (at least) the fields in
+  // PredicateFields decoded, and the rest of FieldsMask are only decoded for
+  // the records it passes (nor are their keys)
+  template <typename Traits, typename Predicate, typename PredicateFields,
+            typename FieldsMask = AllFields>
+  inline void search_range_call_if(
+      Transaction<Traits> &t, const key_type &lower, const key_type *upper,
+      const Predicate &pred, search_range_callback &callback,
+      PredicateFields pfm,
+      bool no_key_results = false /* skip decoding of keys? */,
+      FieldsMask fm = FieldsMask());
+
   // a lower-level variant which does not bother to decode the key/values
   template <typename Traits>
   inline void bytes_search_range_call(
@@ -485,8 +827,176 @@ public:
   inline void remove(
       Transaction<Traits> &t, const key_type &k);
 
+  // put() of keys[i] => values[i], for i in [0, n). the keys are sorted
+  // and descended in lockstep, which is much cheaper than n put()s for
+  // many, mostly adjacent keys. a key given twice ends up with its last
+  // value. a table with secondary indexes takes n put()s
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline void put_batch(
+      Transaction<Traits> &t, const key_type *keys, const value_type *values,
+      size_t n, FieldsMask fm = FieldsMask());
+
+  // insert() of keys[i] => values[i], for i in [0, n); see put_batch()
+  template <typename Traits>
+  inline void insert_batch(
+      Transaction<Traits> &t, const key_type *keys, const value_type *values,
+      size_t n);
+
+  // adds the fields (in fm) of delta to the record at k, without reading it:
+  // the sums are taken at commit, under the record's lock, so txns which only
+  // increment a record do not conflict. returns false if there is no record
+  // at k. the fields must be numeric
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline bool increment(
+      Transaction<Traits> &t, const key_type &k, const value_type &delta,
+      FieldsMask fm = FieldsMask());
+
+  // increment() for any aggregate_op: folds the fields (in fm) of v into
+  // the record at k with Op, at commit. e.g. a running max is kept with
+  // aggregate<AGGREGATE_MAX>(), and a count by incrementing by 1.
+  // a txn must fold into a record with a single Op and fm
+  template <aggregate_op Op, typename Traits, typename FieldsMask = AllFields>
+  inline bool aggregate(
+      Transaction<Traits> &t, const key_type &k, const value_type &v,
+      FieldsMask fm = FieldsMask());
+
+  /**
+   * Declares idx a secondary index of this table: from now on, each record
+   * k => v has the entry ik => iv in idx, where extract(k, v, ik, iv)
+   * returns true (false for a record without an entry). A put(), insert()
+   * or remove() (or a batch of them) first reads the record it replaces,
+   * then removes the old record's entry, and writes the new one's, unless
+   * they are the same. The entries are written by the same txn, so they
+   * commit (and are logged) with the record.
+   *
+   * extract() must not depend on fields written by increment() or
+   * aggregate(), which do not read the record. A txn writing a key more
+   * than once keeps its entries right only if it reads its own writes (see
+   * Traits::read_own_writes). Records already in the table get no entries:
+   * to index a table in use, see build_secondary_index()
+   */
+  template <typename IndexSchema>
+  void add_secondary_index(
+      typed_txn_btree<Transaction, IndexSchema> &idx,
+      bool (*extract)(const key_type &k, const value_type &v,
+                      typename IndexSchema::key_type &ik,
+                      typename IndexSchema::value_type &iv));
+
+  /**
+   * With field validation on, a search() of only some of a record's fields
+   * only conflicts with writes which change those fields: at commit, a
+   * record written since the read still validates if the fields read have
+   * the same bytes (and the record is still the latest, and not locked).
+   * So a txn reading a customer's name no longer aborts because another
+   * updated the customer's balance. Reads of all fields, scans, and records
+   * the txn also writes are validated by version as usual.
+   *
+   * Each such read keeps a copy of the record's value_type until the txn
+   * ends. Only fixed layout schemas (see IsFixedLayout()) can be validated
+   * by field: returns false, and leaves it off, for any other
+   */
+  bool
+  set_field_validation(bool on)
+  {
+    if (!typed_txn_btree_<Schema>::IsFixedLayout())
+      return false;
+    field_validation = on;
+    return true;
+  }
+
+  // records upgrade_old_records() scans per txn
+  static const size_t UpgradeChunkNRecords = 256;
+
+  /**
+   * Rewrites the records in [lower, upper) (upper null for no bound) which
+   * were written before value fields were added to the schema, at the
+   * current schema (see typed_txn_btree_::FieldsIn()). Reads and writes
+   * already handle such records, so this is only the background pass which
+   * rewrites those nobody writes, in txns of UpgradeChunkNRecords scanned
+   * records, at up to max_per_sec rewritten records a second (0 for no
+   * limit). Returns the number rewritten. Not to be called from within a txn
+   */
+  template <typename Traits>
+  size_t upgrade_old_records(const key_type &lower, const key_type *upper,
+                             uint64_t max_per_sec = 0);
+
+  // records build_secondary_index() scans (or drains) per txn
+  static const size_t IndexBuildChunkNRecords = 256;
+
+  /**
+   * add_secondary_index() for a table in use, with entries for the records
+   * already there too, and without holding up the table's txns. idx must be
+   * empty, and is not to be used until the call returns.
+   *
+   * From the call on, txns write the entries of their writes to a change
+   * buffer (a table of idx's schema), so they commit with the records. Once
+   * the txns which began before are over, a snapshot past all of them is
+   * pinned and scanned by nthreads threads, each taking a range of the table,
+   * in read-only txns of IndexBuildChunkNRecords records, and idx is bulk
+   * loaded bottom up with the entries found. The change buffer is drained
+   * into idx once txns write their entries to both. The change buffer holds
+   * the latest state of each entry written since the call, so the drain
+   * puts those it has into idx, and removes those removed from it, and the
+   * snapshot stays pinned until the drain is over, so such removals are
+   * not reclaimed before. Then the change buffer is dropped.
+   *
+   * Records are scanned and drained at up to max_per_sec a second (0 for no
+   * limit). Returns the number of entries made. Not to be called from
+   * within a txn
+   */
+  template <typename Traits, typename IndexSchema>
+  size_t build_secondary_index(
+      typed_txn_btree<Transaction, IndexSchema> &idx,
+      bool (*extract)(const key_type &k, const value_type &v,
+                      typename IndexSchema::key_type &ik,
+                      typename IndexSchema::value_type &iv),
+      size_t nthreads = 1,
+      uint64_t max_per_sec = 0);
+
 private:
 
+  struct secondary_index {
+    concurrent_btree *btr;
+    point_index *hidx;
+    dbtuple::tuple_writer_t writer;
+    dbtuple::tuple_writer_t remover;
+    // sets the encoded key and raw value of the record's entry, if any
+    std::function<
+      bool (const key_type &, const value_type &, std::string &, std::string &)>
+      entry;
+  };
+
+  typedef std::vector<secondary_index> secondary_index_list;
+
+  template <typename IndexSchema>
+  static secondary_index MakeSecondaryIndex(
+      typed_txn_btree<Transaction, IndexSchema> &idx,
+      bool (*extract)(const key_type &k, const value_type &v,
+                      typename IndexSchema::key_type &ik,
+                      typename IndexSchema::value_type &iv));
+
+  // replaces the index writing to from (nullptr to add one) with to
+  // (nullptr to drop it). txns which already loaded the old list may still
+  // write by it, see ticker::WaitOutCurrentTick()
+  void replace_secondary_index(const concurrent_btree *from,
+                               const secondary_index *to);
+
+  // keeps the entries of ss in step with the write the txn is about to make
+  // to k, of the fields in fields of v (a removal if v is null)
+  template <typename Traits>
+  void update_secondary_entries(
+      Transaction<Traits> &t, const secondary_index_list &ss,
+      const key_type &k, const value_type *v, uint64_t fields);
+
+  // makes the entries of idx which are in buffer (or were removed from it)
+  // those of buffer, in txns of IndexBuildChunkNRecords entries. returns
+  // the number put into idx
+  template <typename Traits, typename IndexSchema>
+  static size_t DrainIndexEntries(
+      typed_txn_btree<Transaction, IndexSchema> &buffer,
+      typed_txn_btree<Transaction, IndexSchema> &idx,
+      uint64_t max_per_sec);
+
   template <typename Traits>
   static inline const std::string *
   stablize(Transaction<Traits> &t, const key_type &k)
@@ -509,8 +1019,71 @@ private:
 
   key_encoder_type key_encoder;
   value_encoder_type value_encoder;
+  // replaced as a whole (the old list freed by RCU), nullptr for none
+  std::atomic<const secondary_index_list *> secondary_indexes;
+  std::mutex secondary_indexes_lock; // serializes replacements
+  bool field_validation;
 };
 
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits>
+size_t
+typed_txn_btree<Transaction, Schema>::upgrade_old_records(
+    const key_type &lower, const key_type *upper, uint64_t max_per_sec)
+{
+  // collects the keys of the old records in the next chunk, past after_
+  struct old_records_callback : public bytes_search_range_callback {
+    std::string after_;
+    std::string last_;
+    std::vector<std::string> keys_;
+    size_t n_;
+
+    virtual bool
+    invoke(const string_type &k, const string_type &v)
+    {
+      if (k == after_)
+        return true;
+      last_.assign(k);
+      if (!typed_txn_btree_<Schema>::IsCurrentRecord(
+            reinterpret_cast<const uint8_t *>(v.data()), v.size()))
+        keys_.emplace_back(k);
+      return ++n_ < UpgradeChunkNRecords;
+    }
+  };
+
+  old_records_callback c;
+  key_type start = lower;
+  size_t nupgraded = 0;
+  const uint64_t t0 = util::timer::cur_usec();
+  for (;;) {
+    c.keys_.clear();
+    c.n_ = 0;
+    {
+      typename Traits::StringAllocator arena;
+      Transaction<Traits> t(0, arena);
+      try {
+        this->bytes_search_range_call(t, start, upper, c);
+        for (auto &ks : c.keys_) {
+          key_type k;
+          value_type v;
+          key_encoder.read(ks, &k);
+          if (this->search(t, k, v))
+            this->put(t, k, v);
+        }
+        t.commit(true);
+      } catch (transaction_abort_exception &ex) {
+        continue;
+      }
+    }
+    nupgraded += c.keys_.size();
+    if (c.n_ < UpgradeChunkNRecords)
+      return nupgraded;
+    key_encoder.read(c.last_, &start);
+    c.after_ = c.last_;
+    ticker::Throttle(max_per_sec, t0, nupgraded);
+  }
+}
+
 template <template <typename> class Transaction, typename Schema>
 template <typename Traits, typename FieldsMask>
 bool
@@ -520,9 +1093,66 @@ typed_txn_btree<Transaction, Schema>::search(
 {
   // XXX: template single_value_reader with mask
   single_value_reader vr(v, FieldsMask::value);
+  if (field_validation &&
+      !typed_txn_btree_<Schema>::IsAllFields(FieldsMask::value)) {
+    const transaction_base::field_read_t fr{
+      FieldsMask::value, reinterpret_cast<const uint8_t *>(&v), sizeof(v),
+      &typed_txn_btree_<Schema>::SameFields};
+    return this->do_search(t, k, vr, &fr);
+  }
   return this->do_search(t, k, vr);
 }
 
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename FieldsMask>
+void
+typed_txn_btree<Transaction, Schema>::multi_search(
+    Transaction<Traits> &t, const key_type *keys, size_t n,
+    value_type *values, bool *found, FieldsMask fm)
+{
+  std::vector<single_value_reader> vrs;
+  vrs.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    vrs.emplace_back(values[i], FieldsMask::value);
+  if (field_validation &&
+      !typed_txn_btree_<Schema>::IsAllFields(FieldsMask::value)) {
+    std::vector<transaction_base::field_read_t> frs;
+    frs.reserve(n);
+    for (size_t i = 0; i < n; i++)
+      frs.push_back(transaction_base::field_read_t{
+          FieldsMask::value, reinterpret_cast<const uint8_t *>(&values[i]),
+          sizeof(values[i]), &typed_txn_btree_<Schema>::SameFields});
+    this->do_search_batch(t, keys, n, vrs.data(), found, frs.data());
+    return;
+  }
+  this->do_search_batch(t, keys, n, vrs.data(), found);
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename Outer, typename InnerKey,
+          typename Callback, typename FieldsMask>
+size_t
+typed_txn_btree<Transaction, Schema>::index_join(
+    Transaction<Traits> &t, const std::vector<Outer> &outer,
+    InnerKey inner_key, Callback callback, FieldsMask fm)
+{
+  const size_t n = outer.size();
+  std::vector<key_type> keys;
+  keys.reserve(n);
+  for (auto &o : outer)
+    keys.push_back(inner_key(o));
+  std::vector<value_type> values(n);
+  std::unique_ptr<bool[]> found(new bool[n]);
+  multi_search(t, keys.data(), n, values.data(), found.get(), fm);
+  size_t nfound = 0;
+  for (size_t i = 0; i < n; i++)
+    if (found[i]) {
+      callback(outer[i], keys[i], values[i]);
+      nfound++;
+    }
+  return nfound;
+}
+
 template <template <typename> class Transaction, typename Schema>
 template <typename Traits, typename FieldsMask>
 void
@@ -538,6 +1168,40 @@ typed_txn_btree<Transaction, Schema>::search_range_call(
   this->do_search_range_call(t, lower, upper, callback, kr, vr);
 }
 
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename FieldsMask>
+void
+typed_txn_btree<Transaction, Schema>::search_range_call_parallel(
+    Transaction<Traits> &t,
+    const key_type &lower, const key_type *upper,
+    const std::vector<search_range_callback *> &callbacks,
+    bool no_key_results,
+    FieldsMask fm)
+{
+  key_reader kr(no_key_results);
+  value_reader vr(FieldsMask::value);
+  this->do_parallel_search_range_call(t, lower, upper, callbacks, kr, vr);
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename Predicate, typename PredicateFields,
+          typename FieldsMask>
+void
+typed_txn_btree<Transaction, Schema>::search_range_call_if(
+    Transaction<Traits> &t,
+    const key_type &lower, const key_type *upper,
+    const Predicate &pred,
+    search_range_callback &callback,
+    PredicateFields pfm,
+    bool no_key_results,
+    FieldsMask fm)
+{
+  key_reader kr(no_key_results);
+  typename typed_txn_btree_<Schema>::template predicate_value_reader<Predicate>
+    vr(pred, PredicateFields::value, FieldsMask::value);
+  this->do_search_range_call(t, lower, upper, callback, kr, vr);
+}
+
 template <template <typename> class Transaction, typename Schema>
 template <typename Traits>
 void
@@ -563,6 +1227,10 @@ typed_txn_btree<Transaction, Schema>::put(
   static_assert(IsSupportable<Traits>(), "xx");
   const dbtuple::tuple_writer_t tw =
     &typed_txn_btree_<Schema>::template tuple_writer<FieldsMask::value>;
+  const secondary_index_list * const ss =
+    secondary_indexes.load(std::memory_order_acquire);
+  if (unlikely(ss))
+    update_secondary_entries(t, *ss, k, &v, FieldsMask::value);
   this->do_tree_put(t, stablize(t, k), stablize(t, v), tw, false);
 }
 
@@ -575,9 +1243,49 @@ typed_txn_btree<Transaction, Schema>::insert(
   static_assert(IsSupportable<Traits>(), "xx");
   const dbtuple::tuple_writer_t tw =
     &typed_txn_btree_<Schema>::template tuple_writer<AllFieldsMask>;
+  const secondary_index_list * const ss =
+    secondary_indexes.load(std::memory_order_acquire);
+  if (unlikely(ss))
+    update_secondary_entries(t, *ss, k, &v, AllFieldsMask);
   this->do_tree_put(t, stablize(t, k), stablize(t, v), tw, true);
 }
 
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename FieldsMask>
+void
+typed_txn_btree<Transaction, Schema>::put_batch(
+    Transaction<Traits> &t, const key_type *keys, const value_type *values,
+    size_t n, FieldsMask fm)
+{
+  static_assert(IsSupportable<Traits>(), "xx");
+  if (unlikely(secondary_indexes.load(std::memory_order_acquire))) {
+    // each write reads the record it replaces, which must be after the
+    // writes to its key before it
+    for (size_t i = 0; i < n; i++)
+      put(t, keys[i], values[i], fm);
+    return;
+  }
+  const dbtuple::tuple_writer_t tw =
+    &typed_txn_btree_<Schema>::template tuple_writer<FieldsMask::value>;
+  std::vector<const std::string *> ks(n);
+  std::vector<const value_type *> vs(n);
+  for (size_t i = 0; i < n; i++) {
+    ks[i] = stablize(t, keys[i]);
+    vs[i] = stablize(t, values[i]);
+  }
+  this->do_tree_put_batch(t, ks.data(), vs.data(), n, tw);
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits>
+void
+typed_txn_btree<Transaction, Schema>::insert_batch(
+    Transaction<Traits> &t, const key_type *keys, const value_type *values,
+    size_t n)
+{
+  put_batch(t, keys, values, n, AllFields());
+}
+
 template <template <typename> class Transaction, typename Schema>
 template <typename Traits>
 void
@@ -587,7 +1295,372 @@ typed_txn_btree<Transaction, Schema>::remove(
   static_assert(IsSupportable<Traits>(), "xx");
   const dbtuple::tuple_writer_t tw =
     &typed_txn_btree_<Schema>::template tuple_writer<0>;
+  const secondary_index_list * const ss =
+    secondary_indexes.load(std::memory_order_acquire);
+  if (unlikely(ss))
+    update_secondary_entries(t, *ss, k, nullptr, 0);
   this->do_tree_put(t, stablize(t, k), nullptr, tw, false);
 }
 
+template <template <typename> class Transaction, typename Schema>
+template <typename IndexSchema>
+void
+typed_txn_btree<Transaction, Schema>::add_secondary_index(
+    typed_txn_btree<Transaction, IndexSchema> &idx,
+    bool (*extract)(const key_type &k, const value_type &v,
+                    typename IndexSchema::key_type &ik,
+                    typename IndexSchema::value_type &iv))
+{
+  const secondary_index s = MakeSecondaryIndex(idx, extract);
+  replace_secondary_index(nullptr, &s);
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename IndexSchema>
+typename typed_txn_btree<Transaction, Schema>::secondary_index
+typed_txn_btree<Transaction, Schema>::MakeSecondaryIndex(
+    typed_txn_btree<Transaction, IndexSchema> &idx,
+    bool (*extract)(const key_type &k, const value_type &v,
+                    typename IndexSchema::key_type &ik,
+                    typename IndexSchema::value_type &iv))
+{
+  secondary_index s;
+  s.btr = &idx.underlying_btree;
+  s.hidx = idx.hash_index.get();
+  s.writer =
+    &typed_txn_btree_<IndexSchema>::template tuple_writer<
+      typed_txn_btree_<IndexSchema>::AllFieldsMask>;
+  s.remover = &typed_txn_btree_<IndexSchema>::template tuple_writer<0>;
+  s.entry = [extract](const key_type &k, const value_type &v,
+                      std::string &ikey, std::string &ivalue) {
+    typename IndexSchema::key_type ik;
+    typename IndexSchema::value_type iv;
+    if (!extract(k, v, ik, iv))
+      return false;
+    const typename IndexSchema::key_encoder_type key_encoder;
+    key_encoder.write(ikey, &ik);
+    ivalue.assign(reinterpret_cast<const char *>(&iv), sizeof(iv));
+    return true;
+  };
+  return s;
+}
+
+template <template <typename> class Transaction, typename Schema>
+void
+typed_txn_btree<Transaction, Schema>::replace_secondary_index(
+    const concurrent_btree *from, const secondary_index *to)
+{
+  std::lock_guard<std::mutex> l(secondary_indexes_lock);
+  const secondary_index_list * const old =
+    secondary_indexes.load(std::memory_order_acquire);
+  secondary_index_list * const ss =
+    old ? new secondary_index_list(*old) : new secondary_index_list;
+  auto it = ss->begin();
+  while (it != ss->end() && it->btr != from)
+    ++it;
+  if (!from)
+    ss->push_back(*to);
+  else if (to)
+    *it = *to;
+  else
+    ss->erase(it);
+  secondary_indexes.store(ss, std::memory_order_release);
+  if (old) {
+    scoped_rcu_region guard;
+    rcu::s_instance.free(const_cast<secondary_index_list *>(old));
+  }
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits>
+void
+typed_txn_btree<Transaction, Schema>::update_secondary_entries(
+    Transaction<Traits> &t, const secondary_index_list &ss,
+    const key_type &k, const value_type *v, uint64_t fields)
+{
+  // the record k holds, as the txn sees it, and the one it will hold
+  value_type old_v, new_v;
+  const bool had = search(t, k, old_v);
+  if (v) {
+    new_v = *v;
+    if (had && !typed_txn_btree_<Schema>::IsAllFields(fields)) {
+      new_v = old_v;
+      typed_txn_btree_<Schema>::CopyFields(&new_v, v, fields);
+    }
+  }
+  for (auto &s : ss) {
+    std::string * const old_ikey = t.string_allocator()();
+    std::string * const old_ivalue = t.string_allocator()();
+    std::string * const ikey = t.string_allocator()();
+    std::string * const ivalue = t.string_allocator()();
+    const bool has_old = had && s.entry(k, old_v, *old_ikey, *old_ivalue);
+    const bool has_new = v && s.entry(k, new_v, *ikey, *ivalue);
+    const bool moved = has_old && (!has_new || *old_ikey != *ikey);
+    if (moved)
+      super_type::do_btree_put(
+          t, *s.btr, s.hidx, old_ikey, nullptr, s.remover, false);
+    if (has_new && (!has_old || moved || *old_ivalue != *ivalue))
+      super_type::do_btree_put(
+          t, *s.btr, s.hidx, ikey, ivalue->data(), s.writer, !has_old || moved);
+  }
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename IndexSchema>
+size_t
+typed_txn_btree<Transaction, Schema>::build_secondary_index(
+    typed_txn_btree<Transaction, IndexSchema> &idx,
+    bool (*extract)(const key_type &k, const value_type &v,
+                    typename IndexSchema::key_type &ik,
+                    typename IndexSchema::value_type &iv),
+    size_t nthreads,
+    uint64_t max_per_sec)
+{
+  typedef typename IndexSchema::key_type index_key_type;
+  typedef typename IndexSchema::value_type index_value_type;
+  typedef std::pair<std::string, index_value_type> entry;
+  typedef base_txn_btree_handler<Transaction> handler;
+  INVARIANT(nthreads > 0);
+
+  // collects the entries of the next chunk of records, past after_
+  struct entries_callback : public search_range_callback {
+    bool (*extract_)(const key_type &, const value_type &,
+                     index_key_type &, index_value_type &);
+    std::string after_;
+    std::string last_;
+    std::vector<entry> entries_;
+    size_t n_;
+
+    virtual bool
+    invoke(const key_type &k, const value_type &v)
+    {
+      const key_encoder_type key_encoder;
+      last_.clear();
+      key_encoder.write(last_, &k);
+      if (last_ == after_)
+        return true;
+      index_key_type ik;
+      index_value_type iv;
+      if (extract_(k, v, ik, iv)) {
+        const typename IndexSchema::key_encoder_type index_key_encoder;
+        entries_.emplace_back(std::string(), iv);
+        index_key_encoder.write(entries_.back().first, &ik);
+      }
+      return ++n_ < IndexBuildChunkNRecords;
+    }
+  };
+
+  typed_txn_btree<Transaction, IndexSchema> buffer(
+      128, false, idx.get_name() + "_build");
+  const secondary_index to_buffer = MakeSecondaryIndex(buffer, extract);
+  const secondary_index to_idx = MakeSecondaryIndex(idx, extract);
+  replace_secondary_index(nullptr, &to_buffer);
+
+  // the txns which did not write to the buffer are over, and committed by
+  // the current tick
+  ticker::WaitOutCurrentTick();
+  const uint64_t tick = ticker::s_instance.global_current_tick();
+  transaction_base::tid_t tid;
+  for (;;) {
+    typename Traits::StringAllocator arena;
+    Transaction<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+    tid = t.snapshot_tid();
+    const bool covers = handler::snapshot_covers(tid, tick);
+    if (covers)
+      handler::pin_snapshot(tid);
+    t.abort();
+    if (covers)
+      break;
+    std::this_thread::sleep_for(std::chrono::microseconds(ticker::TickUsec()));
+  }
+
+  // the ranges start at the first keys past the split points
+  std::vector<std::string> starts;
+  {
+    scoped_rcu_region guard;
+    std::vector<std::string> bounds =
+      this->underlying_btree.split_range(varkey(), nullptr, nthreads);
+    bounds.insert(bounds.begin(), std::string());
+    for (auto &b : bounds) {
+      std::string first;
+      auto first_key =
+        [&first](const std::string &k, typename concurrent_btree::value_type) {
+          first = k;
+          return false;
+        };
+      this->underlying_btree.search_range(varkey(b), nullptr, first_key);
+      if (!first.empty() && (starts.empty() || first > starts.back()))
+        starts.push_back(first);
+    }
+  }
+
+  std::vector<std::vector<entry>> found(starts.size());
+  // the ranges share the limit
+  const uint64_t max_per_range_sec = max_per_sec && !starts.empty() ?
+    std::max<uint64_t>(max_per_sec / starts.size(), 1) : 0;
+  auto scan = [&](size_t i) {
+    entries_callback c;
+    c.extract_ = extract;
+    key_type start, end;
+    key_encoder.read(starts[i], &start);
+    if (i + 1 < starts.size())
+      key_encoder.read(starts[i + 1], &end);
+    const key_type * const upper = i + 1 < starts.size() ? &end : nullptr;
+    size_t nscanned = 0;
+    const uint64_t t0 = util::timer::cur_usec();
+    for (;;) {
+      const size_t nentries = c.entries_.size();
+      c.n_ = 0;
+      {
+        typename Traits::StringAllocator arena;
+        Transaction<Traits> t(transaction_base::TXN_FLAG_READ_ONLY, arena);
+        t.set_snapshot_tid(tid);
+        try {
+          this->search_range_call(t, start, upper, c);
+          t.commit(true);
+        } catch (transaction_abort_exception &ex) {
+          c.entries_.erase(c.entries_.begin() + nentries, c.entries_.end());
+          continue;
+        }
+      }
+      nscanned += c.n_;
+      if (c.n_ < IndexBuildChunkNRecords)
+        break;
+      key_encoder.read(c.last_, &start);
+      c.after_ = c.last_;
+      ticker::Throttle(max_per_range_sec, t0, nscanned);
+    }
+    found[i].swap(c.entries_);
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < starts.size(); i++)
+    workers.emplace_back(scan, i);
+  if (!starts.empty())
+    scan(0);
+  for (auto &w : workers)
+    w.join();
+
+  std::vector<entry> entries;
+  for (auto &f : found)
+    std::move(f.begin(), f.end(), std::back_inserter(entries));
+  found.clear();
+  std::sort(entries.begin(), entries.end(),
+      [](const entry &a, const entry &b) { return a.first < b.first; });
+  entries.erase(
+      std::unique(entries.begin(), entries.end(),
+        [](const entry &a, const entry &b) { return a.first == b.first; }),
+      entries.end());
+  std::vector<std::string> ikeys;
+  std::vector<index_value_type> ivalues;
+  ikeys.reserve(entries.size());
+  ivalues.reserve(entries.size());
+  for (auto &e : entries) {
+    ikeys.emplace_back(std::move(e.first));
+    ivalues.push_back(e.second);
+  }
+  entries.clear();
+  if (!ikeys.empty())
+    idx.do_bulk_load(ikeys.data(), ivalues.data(), ikeys.size(),
+        &typed_txn_btree_<IndexSchema>::template tuple_writer<
+          typed_txn_btree_<IndexSchema>::AllFieldsMask>);
+
+  // once every txn writes its entries to idx as well as to the buffer, the
+  // buffer is drained into idx, and then dropped
+  size_t n = ikeys.size();
+  replace_secondary_index(nullptr, &to_idx);
+  ticker::WaitOutCurrentTick();
+  n += DrainIndexEntries<Traits>(buffer, idx, max_per_sec);
+  handler::unpin_snapshot(tid);
+  replace_secondary_index(&buffer.underlying_btree, nullptr);
+  ticker::WaitOutCurrentTick();
+  return n;
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename IndexSchema>
+size_t
+typed_txn_btree<Transaction, Schema>::DrainIndexEntries(
+    typed_txn_btree<Transaction, IndexSchema> &buffer,
+    typed_txn_btree<Transaction, IndexSchema> &idx,
+    uint64_t max_per_sec)
+{
+  const typename IndexSchema::key_encoder_type key_encoder;
+  std::string after;
+  std::vector<std::string> keys;
+  size_t ndrained = 0, nscanned = 0;
+  const uint64_t t0 = util::timer::cur_usec();
+  for (;;) {
+    // the chunk's keys are read off the tree, and its entries by the txn
+    keys.clear();
+    {
+      scoped_rcu_region guard;
+      auto next_key =
+        [&after, &keys](const std::string &k,
+                        typename concurrent_btree::value_type) {
+          if (k != after)
+            keys.push_back(k);
+          return keys.size() < IndexBuildChunkNRecords;
+        };
+      buffer.underlying_btree.search_range(varkey(after), nullptr, next_key);
+    }
+    size_t n = 0;
+    {
+      typename Traits::StringAllocator arena;
+      Transaction<Traits> t(0, arena);
+      try {
+        for (auto &ks : keys) {
+          typename IndexSchema::key_type ik;
+          typename IndexSchema::value_type iv;
+          key_encoder.read(ks, &ik);
+          // an entry which is gone from the buffer was removed while the
+          // index was built
+          if (buffer.search(t, ik, iv)) {
+            idx.put(t, ik, iv);
+            n++;
+          } else {
+            idx.remove(t, ik);
+          }
+        }
+        t.commit(true);
+      } catch (transaction_abort_exception &ex) {
+        continue;
+      }
+    }
+    ndrained += n;
+    nscanned += keys.size();
+    if (keys.size() < IndexBuildChunkNRecords)
+      return ndrained;
+    after = keys.back();
+    ticker::Throttle(max_per_sec, t0, nscanned);
+  }
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <typename Traits, typename FieldsMask>
+bool
+typed_txn_btree<Transaction, Schema>::increment(
+    Transaction<Traits> &t, const key_type &k, const value_type &delta,
+    FieldsMask fm)
+{
+  return aggregate<AGGREGATE_SUM>(t, k, delta, fm);
+}
+
+template <template <typename> class Transaction, typename Schema>
+template <aggregate_op Op, typename Traits, typename FieldsMask>
+bool
+typed_txn_btree<Transaction, Schema>::aggregate(
+    Transaction<Traits> &t, const key_type &k, const value_type &v,
+    FieldsMask fm)
+{
+  static_assert(IsSupportable<Traits>(), "xx");
+  static_assert(FieldsMask::value != 0, "xx");
+  const dbtuple::tuple_writer_t tw =
+    &typed_txn_btree_<Schema>::template tuple_aggregate_writer<FieldsMask::value, Op>;
+  // the delta is resolved in place at commit, so it must be our own copy
+  std::string * const px = t.string_allocator()();
+  px->assign(reinterpret_cast<const char *>(&v), sizeof(v));
+  return this->do_tree_increment(
+      t, stablize(t, k), reinterpret_cast<value_type *>(&(*px)[0]), tw);
+}
+
 #endif /* _NDB_TYPED_TXN_BTREE_H_ */
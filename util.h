@@ -681,6 +681,18 @@ public:
     new (&obj_[0]) T(std::forward<Args>(args)...);
   }
 
+  // constructs the object again, after destroy()
+  template <class... Args>
+  inline void
+  reconstruct(Args &&... args)
+  {
+#ifdef CHECK_INVARIANTS
+    ALWAYS_ASSERT(destroyed_);
+    destroyed_ = false;
+#endif
+    new (&obj_[0]) T(std::forward<Args>(args)...);
+  }
+
   // up to you to call this at most once
   inline void
   destroy()
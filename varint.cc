@@ -1,4 +1,5 @@
 #include <iostream>
+#include <limits>
 
 #include "varint.h"
 #include "macros.h"
@@ -20,6 +21,41 @@ do_test(uint32_t v)
   p0 = read_uvint32(p0, &v0);
   ALWAYS_ASSERT(v == v0);
   ALWAYS_ASSERT(p == p0);
+
+  uint8_t wbuf[8] = {0};
+  write_uvint32(&wbuf[0], v);
+  uint32_t v1 = 0;
+  ALWAYS_ASSERT(read_uvint32_word(&wbuf[0], &v1) - &wbuf[0] == p - &buf[0]);
+  ALWAYS_ASSERT(v == v1);
+}
+
+static void
+do_test64(uint64_t v)
+{
+  uint8_t buf[10];
+  uint8_t *p = write_uvint64(&buf[0], v);
+  ALWAYS_ASSERT(size_t(p - &buf[0]) == size_uvint64(v));
+  uint64_t v0 = 0;
+  ALWAYS_ASSERT(failsafe_read_uvint64(&buf[0], p - &buf[0], &v0) == p);
+  ALWAYS_ASSERT(v == v0);
+  ALWAYS_ASSERT(!failsafe_read_uvint64(&buf[0], p - &buf[0] - 1, &v0));
+}
+
+static void
+do_batch_test(fast_random &r, size_t n)
+{
+  uint32_t values[64], values0[64];
+  uint8_t buf[64 * 5];
+  uint8_t *p = &buf[0];
+  for (size_t i = 0; i < n; i++) {
+    // mostly small values, so runs of one-byte varints show up
+    values[i] = (r.next() % 4) ? (r.next_u32() & 0x7F) : r.next_u32();
+    p = write_uvint32(p, values[i]);
+  }
+  const uint8_t *p0 = read_uvint32_batch(&buf[0], p, n, &values0[0]);
+  ALWAYS_ASSERT(p0 == p);
+  for (size_t i = 0; i < n; i++)
+    ALWAYS_ASSERT(values[i] == values0[i]);
 }
 
 void
@@ -28,5 +64,10 @@ varint::Test()
   fast_random r(2043859);
   for (int i = 0; i < 1000; i++)
     do_test(r.next_u32());
+  for (int i = 0; i < 1000; i++)
+    do_batch_test(r, r.next() % 65);
+  for (int i = 0; i < 1000; i++)
+    do_test64(r.next() >> (r.next() % 64));
+  do_test64(numeric_limits<uint64_t>::max());
   cerr << "varint tests passed" << endl;
 }
@@ -42,6 +42,73 @@ read_uvint32(const uint8_t *buf, uint32_t *value)
   return read_uvint32_slow(buf, value);
 }
 
+// decodes the varint starting at the low byte of w (a little-endian load of
+// the stream) into value, returning its length, or 0 if it does not end
+// within 5 bytes
+inline ALWAYS_INLINE size_t
+decode_uvint32_word(uint64_t w, uint32_t *value)
+{
+  // the terminating byte is the first one with a clear high bit
+  const uint64_t stop = ~w & 0x0000008080808080ULL;
+  if (unlikely(!stop))
+    return 0;
+  const uint64_t x = w & (stop ^ (stop - 1)) & 0x7F7F7F7F7FULL;
+  *value = uint32_t(
+       (x        & 0x7FULL) |
+      ((x >>  1) & (0x7FULL <<  7)) |
+      ((x >>  2) & (0x7FULL << 14)) |
+      ((x >>  3) & (0x7FULL << 21)) |
+      ((x >>  4) & (0x7FULL << 28)));
+  return (__builtin_ctzll(stop) >> 3) + 1;
+}
+
+/**
+ * Like read_uvint32(), but branch-free: decodes the varint at buf out of a
+ * single 8-byte load.
+ *
+ * Assumes [buf, buf + 8) is readable memory (which the varint itself need not
+ * fill), and that buf points to a well encoded varint
+ */
+inline ALWAYS_INLINE const uint8_t *
+read_uvint32_word(const uint8_t *buf, uint32_t *value)
+{
+  uint64_t w;
+  NDB_MEMCPY(&w, buf, sizeof(w));
+  const size_t n = decode_uvint32_word(w, value);
+  ALWAYS_ASSERT(n); // improper encoding
+  return buf + n;
+}
+
+/**
+ * Read n consecutive uvint32s from [buf, end) into values, returning the
+ * next position in buf after the last one.
+ *
+ * Runs of eight one-byte varints (which is what most small integer fields
+ * encode to) are decoded eight at a time, and the rest with
+ * read_uvint32_word() while a full word remains before end
+ */
+inline const uint8_t *
+read_uvint32_batch(const uint8_t *buf, const uint8_t *end,
+                   size_t n, uint32_t *values)
+{
+  size_t i = 0;
+  while (i < n && end - buf >= 8) {
+    uint64_t w;
+    NDB_MEMCPY(&w, buf, sizeof(w));
+    if (!(w & 0x8080808080808080ULL) && n - i >= 8) {
+      for (size_t j = 0; j < 8; j++)
+        values[i + j] = uint32_t(w >> (8 * j)) & 0x7F;
+      i += 8;
+      buf += 8;
+      continue;
+    }
+    buf = read_uvint32_word(buf, &values[i++]);
+  }
+  for (; i < n; i++)
+    buf = read_uvint32(buf, &values[i]);
+  return buf;
+}
+
 inline const uint8_t *
 failsafe_read_uvint32_slow(
     const uint8_t *buf, size_t nbytes, uint32_t *value)
@@ -78,6 +145,13 @@ failsafe_read_uvint32(
     *value = ch;
     return stream + 1;
   }
+  if (likely(nbytes >= 8)) {
+    uint64_t w;
+    NDB_MEMCPY(&w, stream, sizeof(w));
+    const size_t n = decode_uvint32_word(w, value);
+    if (likely(n))
+      return stream + n;
+  }
   return failsafe_read_uvint32_slow(stream, nbytes, value);
 }
 
@@ -156,6 +230,57 @@ size_uvint32(uint32_t value)
   return 5;
 }
 
+/**
+ * 64-bit counterparts of the above, for values which are usually small but
+ * need not fit in 32 bits. encoded in at most 10 bytes
+ */
+inline uint8_t *
+write_uvint64(uint8_t *buf, uint64_t value)
+{
+  while (value > 0x7F) {
+    *buf++ = (((uint8_t) value) & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *buf++ = ((uint8_t) value) & 0x7F;
+  return buf;
+}
+
+inline size_t
+size_uvint64(uint64_t value)
+{
+  size_t n = 1;
+  while (value > 0x7F) {
+    value >>= 7;
+    n++;
+  }
+  return n;
+}
+
+inline const uint8_t *
+failsafe_read_uvint64(const uint8_t *buf, size_t nbytes, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (unsigned shift = 0; shift < 70; shift += 7) {
+    if (unlikely(!nbytes--))
+      return nullptr;
+    const uint64_t b = *buf++;
+    result |= (b & 0x7F) << shift;
+    if (likely(b < 0x80)) {
+      *value = result;
+      return buf;
+    }
+  }
+  return nullptr;
+}
+
+inline const uint8_t *
+read_uvint64(const uint8_t *buf, uint64_t *value)
+{
+  const uint8_t *p = failsafe_read_uvint64(buf, 10, value);
+  INVARIANT(p);
+  return p;
+}
+
 class varint {
 public:
   static void Test();
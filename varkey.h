@@ -43,9 +43,12 @@ public:
   {
   }
 
-  explicit inline varkey(const imstring &s)
-    : p(s.data()), l(s.size())
+  template <bool RCU, size_t N>
+  explicit inline varkey(const base_imstring<RCU, N> &s)
   {
+    size_t n;
+    s.read(p, n);
+    l = n;
   }
 
   inline bool
@@ -0,0 +1,125 @@
+#ifndef _NDB_VERTICAL_TXN_BTREE_H_
+#define _NDB_VERTICAL_TXN_BTREE_H_
+
+#include <string>
+
+#include "typed_txn_btree.h"
+
+/**
+ * A typed table split vertically into hot and cold fields (declared with
+ * DO_SPLIT_STRUCT()), each part kept in a table of its own under the same
+ * key. Rows are inserted and removed as a whole, but each part is read and
+ * written on its own: a write of hot fields never copies (or versions) the
+ * cold part, and a read of hot fields never touches it, so large, rarely
+ * used fields stay out of the cache and the GC's way. Nor do writes to one
+ * part conflict with reads of the other.
+ *
+ * Reading both parts costs two lookups, so fields which are usually read
+ * together belong in the same part. Scans and anything else not wrapped here
+ * go to hot_table() or cold_table() directly
+ */
+template <template <typename> class Transaction, typename Hot, typename Cold>
+class vertical_txn_btree {
+public:
+
+  typedef typed_txn_btree<Transaction, schema<Hot>> hot_table_type;
+  typedef typed_txn_btree<Transaction, cold_schema<Hot, Cold>> cold_table_type;
+
+  typedef typename Hot::key key_type;
+  typedef typename Hot::value value_type;
+  typedef typename Cold::value cold_value_type;
+  typedef typename hot_table_type::size_type size_type;
+
+  typedef typename hot_table_type::AllFields AllFields;
+  typedef typename cold_table_type::AllFields AllColdFields;
+
+  // the cold part is named name + "_cold"
+  vertical_txn_btree(size_type hot_size_hint = 128,
+                     size_type cold_size_hint = 512,
+                     bool mostly_append = false,
+                     const std::string &name = "<unknown>")
+    : hot(hot_size_hint, mostly_append, name),
+      cold(cold_size_hint, mostly_append, name + "_cold")
+  {
+  }
+
+  // reads the hot fields in fm
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline bool
+  search(Transaction<Traits> &t, const key_type &k, value_type &v,
+         FieldsMask fm = FieldsMask())
+  {
+    return hot.search(t, k, v, fm);
+  }
+
+  // reads the cold fields in fm
+  template <typename Traits, typename FieldsMask = AllColdFields>
+  inline bool
+  search_cold(Transaction<Traits> &t, const key_type &k, cold_value_type &v,
+              FieldsMask fm = FieldsMask())
+  {
+    return cold.search(t, k, v, fm);
+  }
+
+  // reads the whole row
+  template <typename Traits>
+  inline bool
+  search(Transaction<Traits> &t, const key_type &k, value_type &v,
+         cold_value_type &cv)
+  {
+    return hot.search(t, k, v) && cold.search(t, k, cv);
+  }
+
+  // writes the hot fields in fm of an existing row
+  template <typename Traits, typename FieldsMask = AllFields>
+  inline void
+  put(Transaction<Traits> &t, const key_type &k, const value_type &v,
+      FieldsMask fm = FieldsMask())
+  {
+    hot.put(t, k, v, fm);
+  }
+
+  // writes the cold fields in fm of an existing row
+  template <typename Traits, typename FieldsMask = AllColdFields>
+  inline void
+  put_cold(Transaction<Traits> &t, const key_type &k, const cold_value_type &v,
+           FieldsMask fm = FieldsMask())
+  {
+    cold.put(t, k, v, fm);
+  }
+
+  template <typename Traits>
+  inline void
+  insert(Transaction<Traits> &t, const key_type &k, const value_type &v,
+         const cold_value_type &cv)
+  {
+    hot.insert(t, k, v);
+    cold.insert(t, k, cv);
+  }
+
+  template <typename Traits>
+  inline void
+  remove(Transaction<Traits> &t, const key_type &k)
+  {
+    hot.remove(t, k);
+    cold.remove(t, k);
+  }
+
+  inline hot_table_type &
+  hot_table()
+  {
+    return hot;
+  }
+
+  inline cold_table_type &
+  cold_table()
+  {
+    return cold;
+  }
+
+private:
+  hot_table_type hot;
+  cold_table_type cold;
+};
+
+#endif /* _NDB_VERTICAL_TXN_BTREE_H_ */